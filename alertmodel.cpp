@@ -0,0 +1,129 @@
+#include "alertmodel.h"
+#include <QColor>
+#include <QDateTime>
+#include <QLocale>
+
+AlertModel::AlertModel(QObject *parent)
+    : QAbstractTableModel(parent)
+{
+}
+
+int AlertModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : groups.size();
+}
+
+int AlertModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : ColumnCount;
+}
+
+const AlertGroup &AlertModel::groupAt(int row) const
+{
+    return groups.at(groups.size() - 1 - row);
+}
+
+QVariant AlertModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= groups.size())
+        return QVariant();
+
+    const AlertGroup &group = groupAt(index.row());
+    if (role == Qt::ToolTipRole)
+        return group.firstPath;
+    if (role == Qt::ForegroundRole && index.column() == SeverityColumn) {
+        switch (group.severity) {
+        case Alert::High: return QColor("#c62828");
+        case Alert::Medium: return QColor("#ef6c00");
+        default: return QColor("#777777");
+        }
+    }
+    if (role == Qt::TextAlignmentRole && index.column() == CountColumn)
+        return int(Qt::AlignRight | Qt::AlignVCenter);
+    if (role != Qt::DisplayRole)
+        return QVariant();
+
+    switch (index.column()) {
+    case SeverityColumn:
+        return QString::fromLatin1(alertSeverityName(group.severity));
+    case RuleColumn:
+        return group.rule;
+    case LocationColumn:
+        return group.location;
+    case ProcessColumn:
+        return group.process;
+    case CountColumn:
+        return QLocale().toString(qulonglong(group.count));
+    case LastSeenColumn:
+        return QDateTime::fromMSecsSinceEpoch(group.lastMs).toString("hh:mm:ss");
+    default:
+        return QVariant();
+    }
+}
+
+QVariant AlertModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation != Qt::Horizontal || role != Qt::DisplayRole)
+        return QVariant();
+
+    switch (section) {
+    case SeverityColumn: return tr("Severity");
+    case RuleColumn: return tr("Rule");
+    case LocationColumn: return tr("Where");
+    case ProcessColumn: return tr("Source");
+    case CountColumn: return tr("Count");
+    case LastSeenColumn: return tr("Last seen");
+    default: return QVariant();
+    }
+}
+
+void AlertModel::addBatch(const AlertBatch &batch)
+{
+    // Counts first, while rows still match the sequence numbers
+    int firstChanged = groups.size();
+    int lastChanged = -1;
+    for (const AlertGroup &update : batch.updated) {
+        const auto it = sequences.constFind(update.id);
+        if (it == sequences.constEnd())
+            continue;
+        const int position = int(*it - firstSequence);
+        groups[position].count = update.count;
+        groups[position].lastMs = update.lastMs;
+        const int row = groups.size() - 1 - position;
+        firstChanged = qMin(firstChanged, row);
+        lastChanged = qMax(lastChanged, row);
+    }
+    if (lastChanged >= 0)
+        emit dataChanged(index(firstChanged, CountColumn), index(lastChanged, LastSeenColumn));
+
+    // New groups go on top, the most severe first; appending them in
+    // reverse puts the first one last, which is row 0
+    const int opened = qMin(batch.opened.size(), kMaxRows);
+    if (opened > 0) {
+        beginInsertRows(QModelIndex(), 0, opened - 1);
+        for (int i = opened - 1; i >= 0; --i) {
+            sequences.insert(batch.opened.at(i).id, firstSequence + quint64(groups.size()));
+            groups.append(batch.opened.at(i));
+        }
+        endInsertRows();
+    }
+
+    const int excess = groups.size() - kMaxRows;
+    if (excess > 0) {
+        beginRemoveRows(QModelIndex(), kMaxRows, groups.size() - 1);
+        for (int i = 0; i < excess; ++i)
+            sequences.remove(groups.at(i).id);
+        groups.remove(0, excess);
+        firstSequence += quint64(excess);
+        endRemoveRows();
+    }
+}
+
+void AlertModel::clear()
+{
+    beginResetModel();
+    firstSequence += quint64(groups.size());
+    groups.clear();
+    sequences.clear();
+    endResetModel();
+}
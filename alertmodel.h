@@ -0,0 +1,49 @@
+#ifndef ALERTMODEL_H
+#define ALERTMODEL_H
+
+#include <QAbstractTableModel>
+#include <QHash>
+#include <QVector>
+#include "alertpipeline.h"
+
+// The latest alert groups, newest first, capped at kMaxRows. It is fed
+// a batch at a time from AlertPipeline::take(), so an alert storm costs
+// the view one insert and one dataChanged per tick, not one per alert.
+class AlertModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+    static const int kMaxRows = 1000;
+
+    enum Column {
+        SeverityColumn = 0,
+        RuleColumn,
+        LocationColumn,
+        ProcessColumn,
+        CountColumn,
+        LastSeenColumn,
+        ColumnCount
+    };
+
+    explicit AlertModel(QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+    void addBatch(const AlertBatch &batch);
+    void clear();
+
+private:
+    const AlertGroup &groupAt(int row) const;
+
+    // Oldest first; the position of a group is its sequence number minus
+    // firstSequence, so trimming the oldest renumbers nothing
+    QVector<AlertGroup> groups;
+    quint64 firstSequence = 0;
+    QHash<quint64, quint64> sequences;   // Group id -> sequence number
+};
+
+#endif // ALERTMODEL_H
@@ -0,0 +1,234 @@
+#include "alertpipeline.h"
+#include <QDateTime>
+#include <QMutexLocker>
+#include <QStringList>
+
+namespace {
+
+bool isSeparator(QChar c)
+{
+    return c == QLatin1Char('/') || c == QLatin1Char('\\');
+}
+
+} // namespace
+
+Alert alertForVerdict(const QString &path, const ScanVerdict &verdict)
+{
+    Alert alert;
+    alert.severity = verdict.status == ScanVerdict::Malicious ? Alert::High : Alert::Medium;
+    // The EICAR file is harmless by design and only tests detection
+    if (verdict.flags & ScanVerdict::EicarTestFile)
+        alert.severity = Alert::Low;
+    // Named after the lowest flag that matters; Truncated only says how
+    // much of the file was read
+    const quint16 flags = verdict.flags & ~quint16(ScanVerdict::Truncated);
+    alert.rule = QString::fromLatin1(flags ? scanFlagName(quint16(flags & -flags)) : scanStatusName(verdict.status));
+    alert.path = path;
+    alert.process = "File scanner";
+    alert.timeMs = QDateTime::currentMSecsSinceEpoch();
+    return alert;
+}
+
+void AlertPipeline::setOptions(const Options &options)
+{
+    QMutexLocker lock(&mutex);
+    config = options;
+}
+
+AlertPipeline::Options AlertPipeline::options() const
+{
+    QMutexLocker lock(&mutex);
+    return config;
+}
+
+AlertPipeline::Stats AlertPipeline::stats() const
+{
+    QMutexLocker lock(&mutex);
+    return totals;
+}
+
+QString AlertPipeline::pathPrefix(const QString &path, int depth)
+{
+    const int last = qMax(path.lastIndexOf(QLatin1Char('/')), path.lastIndexOf(QLatin1Char('\\')));
+    if (last < 0)
+        return path;
+    // Index 0 is skipped so a leading separator does not count as a
+    // directory of its own
+    int directories = 0;
+    for (int i = 1; i < last; ++i) {
+        if (isSeparator(path.at(i)) && !isSeparator(path.at(i - 1)) && ++directories == depth)
+            return path.left(i);
+    }
+    return path.left(qMax(last, 1));
+}
+
+void AlertPipeline::submit(const Alert &alert)
+{
+    const quint8 severity = qMin<quint8>(alert.severity, Alert::High);
+    QMutexLocker lock(&mutex);
+    ++totals.alerts;
+    ++unreported[severity];
+
+    Key key { alert.rule, pathPrefix(alert.path, config.pathDepth), alert.process };
+    auto it = groups.find(key);
+    // A group still in the queue has not been shown yet, so it keeps
+    // counting even past its window
+    if (it != groups.end() && (it->queued || alert.timeMs - it->alert.lastMs <= config.dedupWindowMs)) {
+        Group &group = *it;
+        ++group.alert.count;
+        group.alert.lastMs = qMax(group.alert.lastMs, alert.timeMs);
+        ++totals.deduplicated;
+        if (group.taken && !group.dirty) {
+            group.dirty = true;
+            dirty.append(key);
+        }
+        return;
+    }
+
+    if (it == groups.end() && groups.size() >= config.maxGroups) {
+        ++totals.ungrouped;
+        return;
+    }
+
+    Group group;
+    group.alert.id = nextGroupId++;
+    group.alert.severity = severity;
+    group.alert.rule = alert.rule;
+    group.alert.location = key.location;
+    group.alert.process = alert.process;
+    group.alert.firstPath = alert.path;
+    group.alert.count = 1;
+    group.alert.firstMs = alert.timeMs;
+    group.alert.lastMs = alert.timeMs;
+    ++totals.groups;
+
+    if (it != groups.end()) {
+        // Its window passed before take() closed it; keep its last count
+        if (it->dirty)
+            closed.append(it->alert);
+        *it = group;
+    } else {
+        it = groups.insert(key, group);
+    }
+    enqueue(key, *it);
+}
+
+void AlertPipeline::enqueue(const Key &key, Group &group)
+{
+    const int severity = group.alert.severity;
+    if (queued >= config.queueCapacity) {
+        int victim = 0;
+        while (victim < severity && queues[victim].isEmpty())
+            ++victim;
+        if (victim >= severity) {
+            ++totals.shed;
+            return;
+        }
+        // The newest of the least severe has waited the least
+        const auto evicted = groups.find(queues[victim].takeLast());
+        if (evicted != groups.end())
+            evicted->queued = false;
+        --queued;
+        ++totals.preempted;
+    }
+    queues[severity].enqueue(key);
+    group.queued = true;
+    ++queued;
+}
+
+AlertBatch AlertPipeline::take(qint64 nowMs, int maxGroups)
+{
+    QMutexLocker lock(&mutex);
+    AlertBatch batch;
+
+    batch.updated.swap(closed);
+    for (const Key &key : dirty) {
+        const auto it = groups.find(key);
+        if (it != groups.end() && it->dirty) {
+            it->dirty = false;
+            batch.updated.append(it->alert);
+        }
+    }
+    dirty.clear();
+
+    for (int severity = Alert::High; severity >= 0; --severity) {
+        QQueue<Key> &queue = queues[severity];
+        while (!queue.isEmpty() && batch.opened.size() < maxGroups) {
+            const auto it = groups.find(queue.dequeue());
+            --queued;
+            if (it == groups.end())
+                continue;
+            it->queued = false;
+            it->taken = true;
+            batch.opened.append(it->alert);
+        }
+    }
+    batch.waiting = queued;
+
+    // Close groups whose window has passed; those still queued stay until
+    // they are taken
+    for (auto it = groups.begin(); it != groups.end();) {
+        if (!it->queued && nowMs - it->alert.lastMs > config.dedupWindowMs)
+            it = groups.erase(it);
+        else
+            ++it;
+    }
+
+    const double burst = qMax(1, config.notificationBurst);
+    if (refilledMs < 0) {
+        tokens = burst;
+    } else if (nowMs > refilledMs) {
+        tokens = qMin(burst, tokens + double(nowMs - refilledMs) / double(qMax<qint64>(1, config.notificationIntervalMs)));
+    }
+    refilledMs = nowMs;
+
+    // New groups get a notification each only while nothing else waits
+    // for one; otherwise they join the roll-up
+    qint64 waitingAlerts = 0;
+    for (quint64 count : unreported)
+        waitingAlerts += qint64(count);
+    for (const AlertGroup &group : batch.opened)
+        waitingAlerts -= qint64(group.count);
+    if (waitingAlerts <= 0) {
+        for (const AlertGroup &group : batch.opened) {
+            if (tokens < 1)
+                break;
+            tokens -= 1;
+            AlertNotification notification;
+            notification.severity = group.severity;
+            notification.alerts = group.count;
+            notification.text = QString("%1 in %2 (%3)").arg(group.rule, group.location, group.process);
+            if (group.count > 1)
+                notification.text += QString(", %1 times").arg(group.count);
+            batch.notifications.append(notification);
+            unreported[group.severity] -= qMin(unreported[group.severity], group.count);
+            ++totals.notifications;
+        }
+    }
+
+    quint64 rollUp = 0;
+    for (quint64 count : unreported)
+        rollUp += count;
+    if (rollUp > 0 && tokens >= 1) {
+        tokens -= 1;
+        AlertNotification notification;
+        notification.alerts = rollUp;
+        QStringList parts;
+        for (int severity = Alert::High; severity >= 0; --severity) {
+            if (!unreported[severity])
+                continue;
+            if (parts.isEmpty())
+                notification.severity = quint8(severity);
+            parts.append(QString("%1 %2").arg(unreported[severity]).arg(alertSeverityName(quint8(severity))));
+            unreported[severity] = 0;
+        }
+        notification.text = QString("%1 more %2 (%3)")
+                                .arg(rollUp)
+                                .arg(rollUp == 1 ? "detection" : "detections")
+                                .arg(parts.join(", "));
+        batch.notifications.append(notification);
+        ++totals.notifications;
+        totals.rolledUp += rollUp;
+    }
+    return batch;
+}
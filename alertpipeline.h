@@ -0,0 +1,169 @@
+#ifndef ALERTPIPELINE_H
+#define ALERTPIPELINE_H
+
+#include <QHash>
+#include <QMutex>
+#include <QQueue>
+#include <QString>
+#include <QVector>
+#include "scanverdict.h"
+
+// One detection as an engine reports it
+struct Alert
+{
+    enum Severity : quint8 {
+        Low = 0,
+        Medium,
+        High,
+        SeverityCount
+    };
+
+    quint8 severity = Medium;
+    QString rule;           // What matched: "eicar_test_file", "writable_code"
+    QString path;           // File, domain or address it is about
+    QString process;        // What raised it
+    qint64 timeMs = 0;      // ms since epoch
+};
+
+inline const char *alertSeverityName(quint8 severity)
+{
+    static const char *const names[] = { "low", "medium", "high" };
+    return severity < Alert::SeverityCount ? names[severity] : "unknown";
+}
+
+// What the file scanner raises for a Suspicious or Malicious verdict,
+// wherever it runs
+Alert alertForVerdict(const QString &path, const ScanVerdict &verdict);
+
+// Alerts with the same rule, path prefix and process, each within the
+// dedup window of the one before, counted as one
+struct AlertGroup
+{
+    quint64 id = 0;
+    quint8 severity = Alert::Medium;
+    QString rule;
+    QString location;       // Path prefix shared by the group
+    QString process;
+    QString firstPath;      // Full path of the alert that opened it
+    quint64 count = 0;
+    qint64 firstMs = 0;
+    qint64 lastMs = 0;
+};
+
+// Rate limited: either one new group, or a roll-up of every alert that
+// did not get a notification of its own since the last one
+struct AlertNotification
+{
+    quint8 severity = Alert::Medium;
+    QString text;
+    quint64 alerts = 0;     // Alerts it stands for
+};
+
+// What the GUI takes from the pipeline on one tick
+struct AlertBatch
+{
+    QVector<AlertGroup> opened;          // New groups, most severe first
+    QVector<AlertGroup> updated;         // Taken before, and grown since
+    QVector<AlertNotification> notifications;
+    int waiting = 0;                     // Groups left in the queue
+};
+
+// Turns a burst of detections into a bounded amount of GUI work. Engines
+// call submit() from their own threads; the GUI calls take() on a timer,
+// so an outbreak costs it the same per tick however fast alerts arrive.
+//
+// Alerts with the same rule, process and path prefix (the first
+// `pathDepth` directories) are counted into one group while they keep
+// arriving within `dedupWindowMs` of each other. Each new group waits in
+// a bounded queue, one FIFO per severity: when it is full, a more severe
+// group preempts the newest of the least severe, and a group with nothing
+// less severe to displace is shed, though its alerts are still counted.
+// Notifications come from a token bucket of `notificationBurst` tokens
+// refilled every `notificationIntervalMs`; whatever arrives while it is
+// empty is rolled up into the next one ("312 more detections").
+class AlertPipeline
+{
+public:
+    struct Options
+    {
+        qint64 dedupWindowMs = 10000;
+        int pathDepth = 3;
+        int queueCapacity = 256;
+        int maxGroups = 8192;
+        int notificationBurst = 3;
+        qint64 notificationIntervalMs = 5000;
+    };
+
+    struct Stats
+    {
+        quint64 alerts = 0;
+        quint64 deduplicated = 0;    // Counted into an open group
+        quint64 groups = 0;          // Opened
+        quint64 preempted = 0;       // Pushed out of the queue by a more severe group
+        quint64 shed = 0;            // New groups turned away by the full queue
+        quint64 ungrouped = 0;       // Alerts left out of any group, the table being full
+        quint64 notifications = 0;
+        quint64 rolledUp = 0;        // Alerts reported only as part of a roll-up
+    };
+
+    void setOptions(const Options &options);
+    Options options() const;
+
+    // Any thread
+    void submit(const Alert &alert);
+
+    // Takes at most `maxGroups` new groups, with updates to those taken
+    // before and the notifications due at `nowMs`, and closes groups
+    // whose window has passed
+    AlertBatch take(qint64 nowMs, int maxGroups);
+
+    Stats stats() const;
+
+    // The first `depth` directories of `path`; `path` itself when it is
+    // not a path at all, like a domain
+    static QString pathPrefix(const QString &path, int depth);
+
+private:
+    struct Key
+    {
+        QString rule;
+        QString location;
+        QString process;
+
+        bool operator==(const Key &other) const
+        {
+            return rule == other.rule && location == other.location && process == other.process;
+        }
+    };
+    friend size_t qHash(const Key &key, size_t seed = 0)
+    {
+        return qHashMulti(seed, key.rule, key.location, key.process);
+    }
+
+    struct Group
+    {
+        AlertGroup alert;
+        bool queued = false;
+        bool taken = false;
+        bool dirty = false;     // Taken, grown, and in `dirty`
+    };
+
+    void enqueue(const Key &key, Group &group);
+
+    mutable QMutex mutex;
+    Options config;
+    QHash<Key, Group> groups;
+    QQueue<Key> queues[Alert::SeverityCount];
+    int queued = 0;
+    QVector<Key> dirty;
+    QVector<AlertGroup> closed;             // Replaced while dirty, last counts for take()
+    quint64 nextGroupId = 1;
+
+    // Token bucket, and the alerts waiting for a notification by severity
+    double tokens = 0;
+    qint64 refilledMs = -1;
+    quint64 unreported[Alert::SeverityCount] = {};
+    Stats totals;
+};
+
+#endif // ALERTPIPELINE_H
@@ -0,0 +1,107 @@
+#include "benchmarks.h"
+#include "chartwidget.h"
+#include <QApplication>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+// Loads <points> samples of a random walk into a ChartWidget, then zooms
+// and pans through them and appends live, one synchronous paint per
+// frame, and reports frame times. Runs its own QApplication, on the
+// offscreen platform unless QT_QPA_PLATFORM says otherwise.
+int benchmarkChart(int argc, char *argv[])
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QApplication app(argc, argv);
+    const quint64 pointCount = argc > 2 ? QByteArray(argv[2]).toULongLong() : 10000000;
+    if (pointCount < 2) {
+        fprintf(stderr, "usage: --bench-chart <points>\n");
+        return 2;
+    }
+
+    ChartWidget chart;
+    chart.resize(1600, 400);
+    chart.setFollowing(false);
+
+    // A random walk, one sample per second
+    const double start = 1700000000;
+    std::mt19937_64 random(1);
+    double value = 0;
+    QVector<QPointF> batch;
+    QElapsedTimer elapsed;
+    elapsed.start();
+    for (quint64 i = 0; i < pointCount;) {
+        batch.clear();
+        for (int k = 0; k < 65536 && i < pointCount; ++k, ++i) {
+            value += double(int(random() % 2001) - 1000);
+            batch.append(QPointF(start + double(i), value));
+        }
+        chart.appendPoints(batch);
+    }
+    fprintf(stderr, "%llu points loaded in %lld ms, %.0f MB\n", static_cast<unsigned long long>(pointCount),
+            static_cast<long long>(elapsed.elapsed()), chart.samples().memoryBytes() / 1048576.0);
+
+    auto settle = [&app, &chart]() {
+        QElapsedTimer wait;
+        wait.start();
+        while (!chart.isSettled() && wait.elapsed() < 5000)
+            app.processEvents(QEventLoop::AllEvents, 5);
+    };
+    chart.show();
+    chart.fitAll();
+    settle();
+
+    // Zoom from everything down to ~2000 samples and back out while
+    // panning, one view change and one synchronous paint per frame
+    const int kFrames = 1200;
+    const double fullSpan = double(pointCount - 1);
+    const double minimumSpan = qMin(2000.0, fullSpan);
+    LatencyHistogram frames;
+    int settledFrames = 0;
+    QElapsedTimer total;
+    total.start();
+    for (int frame = 0; frame < kFrames; ++frame) {
+        const double phase = double(frame % 600) / 600;
+        const double depth = phase < 0.5 ? phase * 2 : (1 - phase) * 2;
+        const double span = fullSpan * std::pow(minimumSpan / fullSpan, depth);
+        const double left = start + (fullSpan - span) * (0.5 + 0.5 * std::sin(frame * 0.05));
+        elapsed.start();
+        chart.setViewRange(left, left + span);
+        chart.repaint();
+        app.processEvents();
+        frames.record(quint64(elapsed.nsecsElapsed()));
+        settledFrames += chart.isSettled() ? 1 : 0;
+    }
+    const double seconds = total.nsecsElapsed() / 1e9;
+    const LatencyHistogram &decimation = chart.decimationLatency();
+    fprintf(stderr, "zoom/pan: %d frames, %.0f FPS, frame p50 %.2f ms p99 %.2f ms, %d frames showed an exact decimation\n",
+            kFrames, kFrames / seconds, frames.percentile(50) / 1e6, frames.percentile(99) / 1e6, settledFrames);
+    fprintf(stderr, "decimation: %llu runs, p50 %.2f ms p99 %.2f ms\n",
+            static_cast<unsigned long long>(decimation.count()),
+            decimation.percentile(50) / 1e6, decimation.percentile(99) / 1e6);
+
+    // Live tail: one sample per frame while following, about two pixels
+    // per sample, so every frame scrolls and draws a new strip
+    const int kAppends = 2000;
+    double lastX = start + fullSpan;
+    chart.setViewRange(lastX - 800, lastX);
+    chart.setFollowing(true);
+    settle();
+    LatencyHistogram appends;
+    total.start();
+    for (int i = 0; i < kAppends; ++i) {
+        value += double(int(random() % 2001) - 1000);
+        lastX += 1;
+        elapsed.start();
+        chart.appendPoints({ QPointF(lastX, value) });
+        chart.repaint();
+        app.processEvents();
+        appends.record(quint64(elapsed.nsecsElapsed()));
+    }
+    fprintf(stderr, "live append: %d frames, %.0f FPS, frame p50 %.2f ms p99 %.2f ms\n", kAppends,
+            kAppends / (total.nsecsElapsed() / 1e9), appends.percentile(50) / 1e6, appends.percentile(99) / 1e6);
+    return 0;
+}
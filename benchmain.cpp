@@ -0,0 +1,168 @@
+#include "benchmarks.h"
+#include "parserworker.h"
+#include "scanreportwriter.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <cstdio>
+
+// rhynec-bench: the performance checks of the engines, and of the models
+// and chart the GUI puts on them, kept out of the application binaries.
+// One benchmark per run; the exit status says whether its checks passed.
+int main(int argc, char *argv[])
+{
+    // The sandboxed parser workers re-exec this binary
+    if (argc > 1 && qstrcmp(argv[1], "--parser-worker") == 0)
+        return runParserWorker(argc, argv);
+
+    // Chart rendering, on the offscreen platform by default
+    if (argc > 1 && qstrcmp(argv[1], "--bench-chart") == 0)
+        return benchmarkChart(argc, argv);
+
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("rhynec-bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Rhynec Security benchmarks\n\n"
+                                     "--bench-chart <points> must come first and runs on its own.");
+    parser.addHelpOption();
+    QCommandLineOption benchOption("bench-report", "Write <rows> synthetic rows and report rows/s.", "rows");
+    QCommandLineOption replayOption("bench-replay", "Replay a pcap/pcapng <file> and report packets/s.", "file");
+    QCommandLineOption loopsOption("replay-loops", "Replay the file <n> times (default 1).", "n", "1");
+    QCommandLineOption flowsOption("bench-flows", "Track <count> synthetic flows and report ns/packet.", "count");
+    QCommandLineOption inspectOption("bench-inspect", "Track the flows of --bench-replay with and without TLS/HTTP "
+                                                      "payload inspection and report the added ns/packet.");
+    QCommandLineOption historyOption("bench-history", "Store a week of history for <series> counters and report memory.", "series");
+    QCommandLineOption ipInfoBenchOption("bench-ipinfo", "Compile <prefixes> synthetic IP data prefixes and report lookups/s.",
+                                         "prefixes");
+    QCommandLineOption dnsOption("bench-dns", "Send <queries> through a local DNS stub and report queries/s.", "queries");
+    QCommandLineOption portScanOption("bench-portscan", "Scan <probes> host:port pairs on 127.0.0.1-16 and report probes/s.",
+                                      "probes");
+    QCommandLineOption aeadOption("bench-aead", "Seal <megabytes> per packet size on every ChaCha20-Poly1305 path "
+                                                "and report cycles/byte.", "megabytes");
+    QCommandLineOption vpnOption("bench-vpn", "Run two tunnels between network namespaces for <seconds>, on poll() "
+                                              "and on io_uring, and report Gbit/s, round trips and system calls per "
+                                              "packet (needs CAP_NET_ADMIN).", "seconds");
+    QCommandLineOption probeOption("bench-probe", "Probe <servers> local stand-in VPN servers with injected delay and "
+                                                  "loss, and check the latency ranking.", "servers");
+    QCommandLineOption catalogOption("bench-catalog", "Search <entries> synthetic VPN servers a keystroke at a time and "
+                                                      "report ms per keystroke.", "entries");
+    QCommandLineOption scanIoOption("bench-scan-io", "Scan <path> in sandboxed workers reading through pread, then "
+                                                     "io_uring, and report files/s and system calls per file.", "path");
+    QCommandLineOption metricsOption("bench-metrics", "Write metrics from <threads> threads, paced and flat out, while "
+                                                      "draining them at 60 Hz, and report the drain cost.", "threads");
+    QCommandLineOption alertsOption("bench-alerts", "Raise <alerts> alerts per second for 5 s while taking them as the "
+                                                    "Security tab does, and check the event loop stays responsive.",
+                                    "alerts");
+    QCommandLineOption journalOption("bench-journal", "Journal <events> over 30 days, then query the last hour of "
+                                                      "blocked connections, and report events/s and query ms.", "events");
+    QCommandLineOption eventLogOption("bench-eventlog", "Journal <events>, scroll the Status tab's log model through "
+                                                        "them and search them, and report ms per frame and search.",
+                                      "events");
+    QCommandLineOption ipcOption("bench-ipc", "Serve the daemon socket in-process, attach to it and pass <records> "
+                                              "results through its shared ring, and report us per round trip and "
+                                              "records/s.", "records");
+    QCommandLineOption tasksOption("bench-tasks", "Fork and join <tasks> tasks on the task scheduler and a QThreadPool, "
+                                                  "then time Interactive tasks behind a Background backlog, and report "
+                                                  "tasks/s and us waited.", "tasks");
+    QCommandLineOption firewallOption("bench-firewall", "Classify flows against up to <rules> synthetic firewall rules "
+                                                        "(packets of --bench-replay if given) and report ns/match.", "rules");
+    parser.addOptions(ScanReportWriter::commandLineOptions());
+    parser.addOptions({ benchOption, replayOption, loopsOption, flowsOption, inspectOption, historyOption,
+                        ipInfoBenchOption, dnsOption, firewallOption, portScanOption, aeadOption, vpnOption,
+                        probeOption, catalogOption, scanIoOption, metricsOption, alertsOption, journalOption,
+                        eventLogOption, ipcOption, tasksOption });
+    parser.process(app);
+
+    if (parser.isSet(ipInfoBenchOption)) {
+        return benchmarkIpInfo(parser.value(ipInfoBenchOption).toInt());
+    }
+
+    if (parser.isSet(dnsOption)) {
+        return benchmarkDns(parser.value(dnsOption).toULongLong());
+    }
+
+    if (parser.isSet(aeadOption)) {
+        return benchmarkAead(parser.value(aeadOption).toInt());
+    }
+
+    if (parser.isSet(vpnOption)) {
+        return benchmarkVpn(parser.value(vpnOption).toInt());
+    }
+
+    if (parser.isSet(scanIoOption)) {
+        return benchmarkScanIo(parser.value(scanIoOption));
+    }
+
+    if (parser.isSet(metricsOption)) {
+        return benchmarkMetrics(parser.value(metricsOption).toInt());
+    }
+
+    if (parser.isSet(alertsOption)) {
+        return benchmarkAlerts(parser.value(alertsOption).toInt());
+    }
+
+    if (parser.isSet(journalOption)) {
+        return benchmarkJournal(parser.value(journalOption).toULongLong());
+    }
+
+    if (parser.isSet(eventLogOption)) {
+        return benchmarkEventLog(parser.value(eventLogOption).toULongLong());
+    }
+
+    if (parser.isSet(ipcOption)) {
+        return benchmarkIpc(parser.value(ipcOption).toULongLong());
+    }
+
+    if (parser.isSet(tasksOption)) {
+        return benchmarkTasks(parser.value(tasksOption).toULongLong());
+    }
+
+    if (parser.isSet(probeOption)) {
+        return benchmarkProbe(parser.value(probeOption).toInt());
+    }
+
+    if (parser.isSet(catalogOption)) {
+        return benchmarkCatalog(parser.value(catalogOption).toInt());
+    }
+
+    if (parser.isSet(portScanOption)) {
+        return benchmarkPortScan(parser.value(portScanOption).toULongLong());
+    }
+
+    if (parser.isSet(firewallOption)) {
+        return benchmarkFirewall(parser.value(firewallOption).toInt(),
+                                 parser.isSet(replayOption) ? parser.value(replayOption) : QString());
+    }
+
+    if (parser.isSet(historyOption)) {
+        return benchmarkHistory(parser.value(historyOption).toInt());
+    }
+
+    if (parser.isSet(inspectOption)) {
+        if (!parser.isSet(replayOption)) {
+            fprintf(stderr, "--bench-inspect needs a capture: --bench-replay <file>\n");
+            return 2;
+        }
+        return benchmarkInspection(parser.value(replayOption));
+    }
+
+    if (parser.isSet(flowsOption)) {
+        return benchmarkFlows(parser.value(flowsOption).toULongLong());
+    }
+
+    if (parser.isSet(replayOption)) {
+        return benchmarkReplay(parser.value(replayOption), parser.value(loopsOption).toInt());
+    }
+
+    if (parser.isSet(benchOption)) {
+        ScanReportWriter writer;
+        if (!writer.beginFromCommandLine(parser)
+            || (!writer.isActive() && !writer.begin("/dev/null", ScanReportWriter::Format::JsonLines))) {
+            fprintf(stderr, "report: %s\n", qPrintable(writer.errorString()));
+            return 2;
+        }
+        return benchmarkReport(writer, parser.value(benchOption).toULongLong());
+    }
+
+    parser.showHelp(2);
+}
@@ -0,0 +1,47 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include <QString>
+
+class ScanReportWriter;
+
+// The measurements rhynec-bench runs, one group per source file. Each
+// prints what it found to stderr and returns 0 when its checks pass, 1
+// when they fail and 2 when it could not run; see the definitions for
+// what each does.
+
+// benchscan.cpp
+int benchmarkReport(ScanReportWriter &writer, quint64 rowCount);
+int benchmarkScanIo(const QString &path);
+
+// benchnetwork.cpp
+int benchmarkReplay(const QString &path, int loops);
+int benchmarkFlows(quint64 flowCount);
+int benchmarkInspection(const QString &path);
+int benchmarkDns(quint64 queryCount);
+int benchmarkPortScan(quint64 probeCount);
+int benchmarkFirewall(int ruleCount, const QString &replayPath);
+int benchmarkIpInfo(int prefixCount);
+
+// benchstorage.cpp
+int benchmarkHistory(int seriesCount);
+int benchmarkJournal(quint64 eventCount);
+int benchmarkEventLog(quint64 eventCount);
+
+// benchvpn.cpp
+int benchmarkAead(int megabytes);
+int benchmarkVpn(int seconds);
+int benchmarkProbe(int serverCount);
+int benchmarkCatalog(int entryCount);
+
+// benchruntime.cpp
+int benchmarkMetrics(int threadCount);
+int benchmarkAlerts(int alertsPerSecond);
+int benchmarkIpc(quint64 recordCount);
+int benchmarkTasks(quint64 taskCount);
+
+// benchchart.cpp: `rhynec-bench --bench-chart <points>`, which makes its
+// own QApplication
+int benchmarkChart(int argc, char *argv[]);
+
+#endif // BENCHMARKS_H
@@ -0,0 +1,938 @@
+#include "benchmarks.h"
+#include "dnsmessage.h"
+#include "dnsstub.h"
+#include "domainblocklist.h"
+#include "firewallclassifier.h"
+#include "flowtable.h"
+#include "ipinfotable.h"
+#include "packetcapture.h"
+#include "portscanner.h"
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <set>
+
+#ifdef Q_OS_LINUX
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+// Replays a capture through the header-only decode path with no
+// analyzers attached and reports packets/s
+int benchmarkReplay(const QString &path, int loops)
+{
+    CaptureEngine engine;
+    QString failure;
+    QObject::connect(&engine, &CaptureEngine::error, [&failure](const QString &message) {
+        failure = message;
+    });
+    engine.setSource(new PcapReplaySource(path, loops));
+    engine.start();
+    engine.wait();
+    if (!failure.isEmpty()) {
+        fprintf(stderr, "replay: %s\n", qPrintable(failure));
+        return 2;
+    }
+
+    const CaptureStats stats = engine.stats();
+    fprintf(stderr, "%llu packets (%llu non-IP) in %lld ms, %.2f Mpps, batch p50 %.1f us, p99 %.1f us\n",
+            static_cast<unsigned long long>(stats.packets),
+            static_cast<unsigned long long>(stats.undecoded),
+            static_cast<long long>(stats.elapsedMs),
+            stats.packetsPerSecond / 1e6,
+            stats.batchLatency.percentile(50) / 1000.0,
+            stats.batchLatency.percentile(99) / 1000.0);
+    return 0;
+}
+
+// Fills a flow table with <flowCount> distinct synthetic TCP flows, then
+// touches each again from the other direction, and reports the cost per
+// packet and the table's occupancy and probe counters
+int benchmarkFlows(quint64 flowCount)
+{
+    const int kBatch = 256;
+    const qint64 startNs = 1700000000LL * 1000000000LL;
+    FlowTable table(flowCount);
+    std::vector<uchar> headers(size_t(kBatch) * 40, 0);
+    std::vector<PacketView> batch(kBatch);
+
+    QElapsedTimer elapsed;
+    for (int pass = 0; pass < 2; ++pass) {
+        elapsed.start();
+        for (quint64 first = 0; first < flowCount; first += kBatch) {
+            const int count = int(qMin<quint64>(kBatch, flowCount - first));
+            for (int i = 0; i < count; ++i) {
+                const quint64 flow = first + quint64(i);
+                const quint32 client = quint32(flow * 2654435761u);
+                const quint32 server = 0x0a000001;
+                uchar *header = headers.data() + i * 40;
+                header[0] = 0x45;
+                memcpy(header + 12, pass == 0 ? &client : &server, 4);
+                memcpy(header + 16, pass == 0 ? &server : &client, 4);
+
+                PacketView &packet = batch[size_t(i)];
+                packet = PacketView();
+                packet.data = header;
+                packet.ipVersion = 4;
+                packet.protocol = 6;
+                packet.sourcePort = pass == 0 ? quint16(flow) : 443;
+                packet.destinationPort = pass == 0 ? 443 : quint16(flow);
+                packet.tcpFlags = 0x10;
+                packet.wireLength = 1500;
+                packet.timestampNs = startNs + qint64(pass) * 1000000000LL + qint64(flow);
+            }
+            table.onPackets(batch.data(), count);
+        }
+        fprintf(stderr, "pass %d: %.1f ns/packet\n", pass + 1,
+                double(elapsed.nsecsElapsed()) / double(qMax<quint64>(flowCount, 1)));
+    }
+
+    const FlowTableStats stats = table.stats();
+    fprintf(stderr, "%llu live flows, %.1f%% of %llu slots, %llu evicted, probe avg %.2f max %llu, %.0f MB\n",
+            static_cast<unsigned long long>(stats.liveFlows), stats.occupancy() * 100,
+            static_cast<unsigned long long>(stats.slots),
+            static_cast<unsigned long long>(stats.evictions), stats.averageProbe(),
+            static_cast<unsigned long long>(stats.maxProbe), stats.memoryBytes / 1e6);
+    return 0;
+}
+
+namespace {
+
+// Keeps a copy of every replayed packet so the same capture can be fed
+// to several tables
+class PacketRecorder : public PacketSink
+{
+public:
+    void onPackets(const PacketView *packets, int count) override
+    {
+        for (int i = 0; i < count; ++i) {
+            offsets.push_back(bytes.size());
+            bytes.insert(bytes.end(), packets[i].data, packets[i].data + packets[i].capturedLength);
+            views.push_back(packets[i]);
+        }
+    }
+
+    // Points the views at the copies once recording is over
+    void finish()
+    {
+        for (size_t i = 0; i < views.size(); ++i)
+            views[i].data = bytes.data() + offsets[i];
+    }
+
+    std::vector<uchar> bytes;
+    std::vector<size_t> offsets;
+    std::vector<PacketView> views;
+};
+
+} // namespace
+
+// Runs every packet of a capture through flow tables with and without
+// payload inspection and reports the cost it adds per packet, best of
+// three runs each, and what the extractor found
+int benchmarkInspection(const QString &path)
+{
+    const int kBatch = 256;
+    const int kRuns = 3;
+
+    CaptureEngine engine;
+    PacketRecorder recorder;
+    QString failure;
+    QObject::connect(&engine, &CaptureEngine::error, [&failure](const QString &message) {
+        failure = message;
+    });
+    engine.setSource(new PcapReplaySource(path));
+    engine.addSink(&recorder);
+    engine.start();
+    engine.wait();
+    if (!failure.isEmpty() || recorder.views.empty()) {
+        fprintf(stderr, "replay: %s\n", failure.isEmpty() ? "no packets" : qPrintable(failure));
+        return 2;
+    }
+    recorder.finish();
+    const std::vector<PacketView> &packets = recorder.views;
+    const int count = int(packets.size());
+
+    double bestNs[2] = { 0, 0 };
+    FlowTableStats stats;
+    for (int run = 0; run < kRuns * 2; ++run) {
+        const bool inspect = run % 2 == 1;
+        FlowTable table(1 << 20);
+        table.setInspectionEnabled(inspect);
+        QElapsedTimer elapsed;
+        elapsed.start();
+        for (int start = 0; start < count; start += kBatch)
+            table.onPackets(packets.data() + start, qMin(kBatch, count - start));
+        const double ns = double(elapsed.nsecsElapsed()) / double(count);
+        if (run < 2 || ns < bestNs[inspect])
+            bestNs[inspect] = ns;
+        if (inspect)
+            stats = table.stats();
+    }
+
+    fprintf(stderr, "%d packets, %llu flows: %.1f ns/packet without inspection, %.1f with (+%.1f ns)\n",
+            count, static_cast<unsigned long long>(stats.created), bestNs[0], bestNs[1], bestNs[1] - bestNs[0]);
+    fprintf(stderr, "%llu TLS (%llu reassembled, %llu incomplete), %llu HTTP\n",
+            static_cast<unsigned long long>(stats.tlsFlows), static_cast<unsigned long long>(stats.reassembled),
+            static_cast<unsigned long long>(stats.reassemblyFailures), static_cast<unsigned long long>(stats.httpFlows));
+    return 0;
+}
+
+namespace {
+
+#ifdef Q_OS_LINUX
+
+// Stand-in for a recursive resolver on 127.0.0.1: answers A queries with
+// 192.0.2.1 (TTL 300) and anything else with an empty NOERROR, so the
+// benchmark measures the stub rather than the internet
+class StandInUpstream : public QThread
+{
+public:
+    ~StandInUpstream()
+    {
+        stopRequested.store(true);
+        wait();
+        if (fd >= 0)
+            ::close(fd);
+    }
+
+    bool open()
+    {
+        fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        const timeval timeout = { 0, 100000 };
+        if (fd < 0 || bind(fd, reinterpret_cast<sockaddr *>(&address), length) < 0
+            || getsockname(fd, reinterpret_cast<sockaddr *>(&address), &length) < 0)
+            return false;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        boundPort = ntohs(address.sin_port);
+        return true;
+    }
+
+    quint16 port() const { return boundPort; }
+
+protected:
+    void run() override
+    {
+        uchar query[4096];
+        uchar answer[4096 + 16];
+        while (!stopRequested.load()) {
+            sockaddr_storage client;
+            socklen_t clientLength = sizeof(client);
+            const ssize_t length = recvfrom(fd, query, sizeof(query), 0, reinterpret_cast<sockaddr *>(&client), &clientLength);
+            DnsMessage::Question question;
+            if (length < 0 || !DnsMessage::readQuestion(query, int(length), &question))
+                continue;
+            int size = DnsMessage::makeReply(query, question.end, DnsMessage::NoError, answer);
+            if (question.type == 1) {
+                const uchar record[16] = { 0xc0, 12, 0, 1, 0, 1, 0, 0, 0x01, 0x2c, 0, 4, 192, 0, 2, 1 };
+                memcpy(answer + size, record, sizeof(record));
+                size += int(sizeof(record));
+                DnsMessage::writeBe16(answer + 6, 1);
+            }
+            sendto(fd, answer, size_t(size), 0, reinterpret_cast<sockaddr *>(&client), clientLength);
+        }
+    }
+
+private:
+    int fd = -1;
+    quint16 boundPort = 0;
+    std::atomic<bool> stopRequested { false };
+};
+
+#endif
+
+} // namespace
+
+// Compiles a synthetic two-million-domain blocklist and reports image size,
+// load time and lookup cost, then drives a DnsStub over loopback with
+// <queryCount> queries (a quarter blocked, half repeats of a small hot
+// set, a quarter unique and forwarded to a local stand-in upstream),
+// keeping a window of queries in flight, and reports queries/s and
+// latency percentiles
+int benchmarkDns(quint64 queryCount)
+{
+#ifdef Q_OS_LINUX
+    const int kBlockedDomains = 2000000;
+    const int kTrackers = 5000;
+    const int kHotNames = 1000;
+    const int kWindow = 64;
+    const QString imagePath = QDir::temp().filePath("rhynec-bench-dns.rbl");
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    DomainBlocklist::Builder builder;
+    char name[96];
+    for (int i = 0; i < kBlockedDomains; ++i) {
+        const int length = snprintf(name, sizeof(name), "ads%d.tracker%d.example", i, i % kTrackers);
+        builder.add(name, length, i % 4 == 0);
+    }
+    DomainBlocklist::CompileStats compileStats;
+    QString failure;
+    if (!builder.write(imagePath, &compileStats, &failure)) {
+        fprintf(stderr, "blocklist: %s\n", qPrintable(failure));
+        return 2;
+    }
+    fprintf(stderr, "blocklist: %llu domains compiled in %lld ms, %.1f MB image\n",
+            static_cast<unsigned long long>(compileStats.domains), static_cast<long long>(elapsed.elapsed()),
+            compileStats.imageBytes / 1048576.0);
+
+    // Half blocked (exact or under a subdomain-blocking entry), half not
+    std::mt19937_64 random(1);
+    std::vector<QByteArray> lookups;
+    for (int i = 0; i < 1000000; ++i) {
+        const int domain = int(random() % kBlockedDomains);
+        const int length = i % 2 ? snprintf(name, sizeof(name), "www.ads%d.tracker%d.example", domain, domain % kTrackers)
+                                 : snprintf(name, sizeof(name), "ads%d.tracker%d.example", domain, domain % kTrackers);
+        lookups.push_back(QByteArray(name, length));
+    }
+    DomainBlocklist blocklist;
+    elapsed.start();
+    if (!blocklist.open(imagePath)) {
+        fprintf(stderr, "blocklist: %s\n", qPrintable(blocklist.errorString()));
+        return 2;
+    }
+    const qint64 openNs = elapsed.nsecsElapsed();
+    quint64 matched = 0;
+    elapsed.start();
+    for (const QByteArray &lookup : lookups)
+        matched += blocklist.isBlocked(lookup.constData(), lookup.size()) ? 1 : 0;
+    fprintf(stderr, "blocklist: opened in %.1f us, %.0f ns/lookup, %.1f%% blocked\n", openNs / 1000.0,
+            double(elapsed.nsecsElapsed()) / double(lookups.size()), 100.0 * double(matched) / double(lookups.size()));
+    blocklist.close();
+
+    StandInUpstream upstream;
+    if (!upstream.open()) {
+        fprintf(stderr, "upstream: %s\n", strerror(errno));
+        return 2;
+    }
+    upstream.start();
+
+    DnsStub stub;
+    DnsStub::Options options;
+    options.port = 0;
+    options.upstreamAddress = "127.0.0.1";
+    options.upstreamPort = upstream.port();
+    options.blocklistPath = imagePath;
+    options.cacheEntries = 4 * kHotNames;
+    stub.setOptions(options);
+    QObject::connect(&stub, &DnsStub::error, [&failure](const QString &message) { failure = message; });
+    stub.start();
+    elapsed.start();
+    while (stub.localPort() == 0 && !stub.isFinished() && elapsed.elapsed() < 5000)
+        QThread::msleep(1);
+    if (stub.localPort() == 0) {
+        stub.requestStop();
+        stub.wait();
+        fprintf(stderr, "stub: %s\n", qPrintable(failure));
+        return 2;
+    }
+
+    const int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(stub.localPort());
+    if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0) {
+        fprintf(stderr, "client: %s\n", strerror(errno));
+        return 2;
+    }
+
+    // Query IDs are the low bits of the sequence number, and a window far
+    // below 65536 keeps them unique among the queries in flight
+    std::vector<qint64> sentAt(65536, -1);
+    LatencyHistogram roundTrips;
+    quint64 sent = 0;
+    quint64 answered = 0;
+    quint64 lost = 0;
+    int inFlight = 0;
+    uchar packet[512];
+    QElapsedTimer clock;
+    clock.start();
+    while (answered + lost < queryCount) {
+        while (inFlight < kWindow && sent < queryCount) {
+            const int kind = int(sent % 8);
+            const quint64 pick = random();
+            int length;
+            if (kind < 2) {
+                const int domain = int(pick % kBlockedDomains);
+                length = snprintf(name, sizeof(name), "ads%d.tracker%d.example", domain, domain % kTrackers);
+            } else if (kind < 6) {
+                length = snprintf(name, sizeof(name), "host%d.bench.test", int(pick % kHotNames));
+            } else {
+                length = snprintf(name, sizeof(name), "unique%llu.bench.test", static_cast<unsigned long long>(sent));
+            }
+            const quint16 id = quint16(sent);
+            const int size = DnsMessage::makeQuery(id, name, length, 1, packet);
+            sentAt[id] = clock.nsecsElapsed();
+            send(fd, packet, size_t(size), 0);
+            ++sent;
+            ++inFlight;
+        }
+
+        pollfd readable = { fd, POLLIN, 0 };
+        if (poll(&readable, 1, 1000) <= 0) {
+            // Nothing for a second; whatever is in flight is lost
+            for (qint64 &time : sentAt)
+                time = -1;
+            lost += quint64(inFlight);
+            inFlight = 0;
+            continue;
+        }
+        while (true) {
+            const ssize_t length = recv(fd, packet, sizeof(packet), MSG_DONTWAIT);
+            if (length < 0)
+                break;
+            if (length < DnsMessage::kHeaderSize)
+                continue;
+            const quint16 id = DnsMessage::id(packet);
+            if (sentAt[id] < 0)
+                continue;
+            roundTrips.record(quint64(clock.nsecsElapsed() - sentAt[id]));
+            sentAt[id] = -1;
+            --inFlight;
+            ++answered;
+        }
+    }
+    const double seconds = clock.nsecsElapsed() / 1e9;
+    ::close(fd);
+    stub.requestStop();
+    stub.wait();
+    QFile::remove(imagePath);
+
+    const DnsStats stats = stub.stats();
+    fprintf(stderr, "%llu queries in %.2f s: %.0f queries/s, round trip p50 %.1f us p99 %.1f us, %llu lost\n",
+            static_cast<unsigned long long>(answered), seconds, double(answered) / seconds,
+            roundTrips.percentile(50) / 1000.0, roundTrips.percentile(99) / 1000.0,
+            static_cast<unsigned long long>(lost));
+    fprintf(stderr, "stub: %llu blocked, %llu cache hits, %llu forwarded, %llu timeouts; overhead p50 %.1f us p99 %.1f us\n",
+            static_cast<unsigned long long>(stats.blocked), static_cast<unsigned long long>(stats.cacheHits),
+            static_cast<unsigned long long>(stats.forwarded), static_cast<unsigned long long>(stats.timeouts),
+            stats.overhead.percentile(50) / 1000.0, stats.overhead.percentile(99) / 1000.0);
+    return lost == 0 ? 0 : 1;
+#else
+    Q_UNUSED(queryCount);
+    fprintf(stderr, "The DNS benchmark requires Linux\n");
+    return 2;
+#endif
+}
+
+// Scans <probeCount> host:port pairs spread over 16 loopback addresses
+// (127.0.0.1-16), with listeners on every 50th port of each, and checks
+// that exactly the listening ports come back open. Ports stay below the
+// ephemeral range so a connect can never meet itself.
+int benchmarkPortScan(quint64 probeCount)
+{
+#ifdef Q_OS_LINUX
+    const int kHosts = 16;
+    const int kFirstPort = 20000;
+    const int kMaxPorts = 12000;
+    const int kListenerSpacing = 50;
+
+    const int portCount = int(qBound<quint64>(1, probeCount / kHosts, kMaxPorts));
+    std::vector<int> listeners;
+    std::set<std::pair<int, int>> expected;
+    for (int host = 1; host <= kHosts; ++host) {
+        // Offset per host so hosts differ in which ports are open
+        for (int port = kFirstPort + host % kListenerSpacing; port < kFirstPort + portCount; port += kListenerSpacing) {
+            const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            sockaddr_in address;
+            memset(&address, 0, sizeof(address));
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK + host - 1);
+            address.sin_port = htons(quint16(port));
+            const int reuse = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+            if (fd < 0 || bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 || listen(fd, 1024) < 0) {
+                fprintf(stderr, "listen on 127.0.0.%d:%d: %s\n", host, port, strerror(errno));
+                for (int listener : listeners)
+                    ::close(listener);
+                return 2;
+            }
+            listeners.push_back(fd);
+            expected.insert({ host, port });
+        }
+    }
+
+    PortScanner scanner;
+    PortScanner::Options options;
+    options.targets = QString("127.0.0.1-%1").arg(kHosts);
+    options.ports = QString("%1-%2").arg(kFirstPort).arg(kFirstPort + portCount - 1);
+    scanner.setOptions(options);
+    // Direct connections: the handlers run on the scanner's thread, which
+    // is joined before they are read
+    std::set<std::pair<int, int>> found;
+    int hostsUp = 0;
+    QString failure;
+    PortScanStats stats;
+    QObject::connect(&scanner, &PortScanner::resultsReady, [&found, &hostsUp](const QVector<PortScanResult> &results) {
+        for (const PortScanResult &result : results) {
+            if (result.state == PortScanResult::Open)
+                found.insert({ result.address[3], result.port });
+            else if (result.state == PortScanResult::HostUp)
+                ++hostsUp;
+        }
+    });
+    QObject::connect(&scanner, &PortScanner::statsUpdated, [&stats](const PortScanStats &update) { stats = update; });
+    QObject::connect(&scanner, &PortScanner::error, [&failure](const QString &message) { failure = message; });
+    scanner.start();
+    scanner.wait();
+    for (int listener : listeners)
+        ::close(listener);
+    if (!failure.isEmpty()) {
+        fprintf(stderr, "scan: %s\n", qPrintable(failure));
+        return 2;
+    }
+
+    fprintf(stderr, "%llu probes (%llu retries) in %.2f s: %.0f probes/s, rate limit reached %.0f/s\n",
+            static_cast<unsigned long long>(stats.probes), static_cast<unsigned long long>(stats.retries),
+            stats.elapsedMs / 1000.0, stats.probesPerSecond, stats.rateLimit);
+    fprintf(stderr, "%d of %d hosts up, %llu open, %llu closed, %llu filtered, %llu local errors; "
+            "connect RTT p50 %.1f us p99 %.1f us\n",
+            hostsUp, kHosts, static_cast<unsigned long long>(stats.open), static_cast<unsigned long long>(stats.closed),
+            static_cast<unsigned long long>(stats.filtered), static_cast<unsigned long long>(stats.localErrors),
+            stats.rtt.percentile(50) / 1000.0, stats.rtt.percentile(99) / 1000.0);
+    if (found != expected || hostsUp != kHosts) {
+        fprintf(stderr, "expected %d open ports, found %d\n", int(expected.size()), int(found.size()));
+        return 1;
+    }
+    return 0;
+#else
+    Q_UNUSED(probeCount);
+    fprintf(stderr, "The port scan benchmark requires Linux\n");
+    return 2;
+#endif
+}
+
+namespace {
+
+// Collects one classifier query per IP packet of a replayed capture. The
+// higher port's end is taken as this host, so a capture of client traffic
+// reads as outbound connections.
+class FirewallQueryCollector : public PacketSink
+{
+public:
+    void onPackets(const PacketView *packets, int count) override
+    {
+        for (int i = 0; i < count; ++i) {
+            const PacketView &packet = packets[i];
+            if (packet.ipVersion == 0)
+                continue;
+            const bool outbound = packet.sourcePort >= packet.destinationPort;
+            FirewallQuery query;
+            query.remoteAddress = FirewallAddress::fromBytes(outbound ? packet.destinationAddress() : packet.sourceAddress(),
+                                                             packet.ipVersion == 6);
+            query.localPort = outbound ? packet.sourcePort : packet.destinationPort;
+            query.remotePort = outbound ? packet.destinationPort : packet.sourcePort;
+            query.protocol = packet.protocol;
+            query.direction = outbound ? FirewallRule::Outbound : FirewallRule::Inbound;
+            queries.push_back(query);
+        }
+    }
+
+    std::vector<FirewallQuery> queries;
+};
+
+const char *const kFirewallProcesses[] = { "firefox", "chrome", "curl", "ssh", "sshd", "systemd-resolved", "steam", "python3" };
+const quint16 kFirewallPorts[] = { 22, 25, 53, 80, 123, 443, 993, 3389, 5432, 8080, 8443 };
+const int kFirewallProcessCount = int(sizeof(kFirewallProcesses) / sizeof(kFirewallProcesses[0]));
+const int kFirewallPortCount = int(sizeof(kFirewallPorts) / sizeof(kFirewallPorts[0]));
+
+// A rule set shaped like a large personal firewall: mostly blocklisted
+// hosts and subnets, per-application allows, inbound services, IPv6
+// prefixes and a few port ranges, with catch-all defaults at the bottom
+FirewallRule syntheticFirewallRule(quint32 id, std::mt19937 &random)
+{
+    FirewallRule rule;
+    rule.id = id;
+    const int kind = int(random() % 20);
+    if (kind < 8) {
+        rule.remoteLow = FirewallAddress::fromIpv4(0x2d000000u + random() % 0x1000000u);
+        rule.remoteHigh = rule.remoteLow;
+    } else if (kind < 11) {
+        const quint32 network = (0xc6120000u + random() % 0x10000u) & 0xffffff00u;
+        rule.remoteLow = FirewallAddress::fromIpv4(network);
+        rule.remoteHigh = FirewallAddress::fromIpv4(network | 0xff);
+        rule.protocol = 6;
+        rule.remotePortLow = rule.remotePortHigh = kFirewallPorts[random() % kFirewallPortCount];
+    } else if (kind < 14) {
+        rule.action = FirewallRule::Allow;
+        rule.direction = FirewallRule::Outbound;
+        rule.protocol = random() % 4 == 0 ? 17 : 6;
+        rule.remotePortLow = rule.remotePortHigh = kFirewallPorts[random() % kFirewallPortCount];
+        rule.process = kFirewallProcesses[random() % kFirewallProcessCount];
+    } else if (kind < 16) {
+        rule.action = FirewallRule::Allow;
+        rule.direction = FirewallRule::Inbound;
+        rule.protocol = 6;
+        rule.localPortLow = rule.localPortHigh = quint16(1024 + random() % 20000);
+    } else if (kind < 18) {
+        const quint64 prefix = 0x20010db800000000ULL | quint64(random() % 0x10000u) << 16;
+        rule.remoteLow = { prefix, 0 };
+        rule.remoteHigh = { prefix | 0xffff, ~0ULL };
+    } else {
+        rule.protocol = 17;
+        rule.remotePortLow = quint16(1024 + random() % 30000);
+        rule.remotePortHigh = quint16(rule.remotePortLow + random() % 2000);
+    }
+    return rule;
+}
+
+QVector<FirewallRule> syntheticFirewallRules(int count, std::mt19937 &random)
+{
+    QVector<FirewallRule> rules;
+    rules.reserve(count);
+    for (int i = 0; i < count - 2; ++i)
+        rules.append(syntheticFirewallRule(quint32(i + 1), random));
+    FirewallRule allowOutbound;
+    allowOutbound.id = quint32(qMax(count - 1, 1));
+    allowOutbound.action = FirewallRule::Allow;
+    allowOutbound.direction = FirewallRule::Outbound;
+    FirewallRule blockInbound;
+    blockInbound.id = quint32(qMax(count, 2));
+    blockInbound.direction = FirewallRule::Inbound;
+    rules.append(allowOutbound);
+    rules.append(blockInbound);
+    return rules;
+}
+
+// A quarter of the queries aim at a random rule; the rest look like
+// ordinary outbound connections and mostly fall through to the defaults
+std::vector<FirewallQuery> syntheticFirewallQueries(const QVector<FirewallRule> &rules, FirewallClassifier &classifier,
+                                                    int count, std::mt19937 &random)
+{
+    std::vector<FirewallQuery> queries(static_cast<size_t>(count));
+    for (FirewallQuery &query : queries) {
+        if (random() % 4 == 0) {
+            const FirewallRule &rule = rules.at(int(random() % quint32(rules.size())));
+            query.remoteAddress = rule.remoteLow == FirewallAddress() ? FirewallAddress::fromIpv4(random()) : rule.remoteLow;
+            query.localPort = rule.localPortLow == 0 ? quint16(32768 + random() % 28000) : rule.localPortLow;
+            query.remotePort = rule.remotePortLow == 0 ? kFirewallPorts[random() % kFirewallPortCount] : rule.remotePortLow;
+            query.protocol = rule.protocol == 0 ? 6 : rule.protocol;
+            query.direction = rule.direction == FirewallRule::AnyDirection ? FirewallRule::Outbound : rule.direction;
+            query.process = rule.process.isEmpty() ? classifier.processKey(kFirewallProcesses[random() % kFirewallProcessCount])
+                                                   : classifier.processKey(rule.process);
+        } else {
+            query.remoteAddress = FirewallAddress::fromIpv4(random());
+            query.localPort = quint16(32768 + random() % 28000);
+            query.remotePort = kFirewallPorts[random() % kFirewallPortCount];
+            query.protocol = random() % 4 == 0 ? 17 : 6;
+            query.direction = random() % 10 == 0 ? FirewallRule::Inbound : FirewallRule::Outbound;
+            query.process = classifier.processKey(kFirewallProcesses[random() % kFirewallProcessCount]);
+        }
+    }
+    return queries;
+}
+
+} // namespace
+
+// Compiles synthetic rule sets of 100 rules up to <ruleCount>, classifies
+// synthetic flows (or every packet of <replayPath>) with the compiled
+// classifier and with a rule-by-rule scan, checks that both agree, and
+// reports ns/match, memory and the cost of incremental edits
+int benchmarkFirewall(int ruleCount, const QString &replayPath)
+{
+    const int kQueries = 200000;
+    const int kEdits = 2000;
+    std::mt19937 random(42);
+
+    std::vector<FirewallQuery> replayed;
+    if (!replayPath.isEmpty()) {
+        CaptureEngine engine;
+        FirewallQueryCollector collector;
+        QString failure;
+        QObject::connect(&engine, &CaptureEngine::error, [&failure](const QString &message) {
+            failure = message;
+        });
+        engine.setSource(new PcapReplaySource(replayPath));
+        engine.addSink(&collector);
+        engine.start();
+        engine.wait();
+        if (!failure.isEmpty() || collector.queries.empty()) {
+            fprintf(stderr, "replay: %s\n", failure.isEmpty() ? "no IP packets" : qPrintable(failure));
+            return 2;
+        }
+        replayed.swap(collector.queries);
+        fprintf(stderr, "%llu packets replayed from %s\n", static_cast<unsigned long long>(replayed.size()),
+                qPrintable(replayPath));
+    }
+
+    ruleCount = qMax(ruleCount, 2);
+    int mismatches = 0;
+    for (int count = qMin(100, ruleCount);; count = qMin(count * 10, ruleCount)) {
+        const QVector<FirewallRule> rules = syntheticFirewallRules(count, random);
+        FirewallClassifier classifier;
+        QElapsedTimer timer;
+        timer.start();
+        classifier.setRules(rules);
+        const double compileMs = timer.nsecsElapsed() / 1e6;
+
+        std::vector<FirewallQuery> queries;
+        if (replayed.empty()) {
+            queries = syntheticFirewallQueries(rules, classifier, kQueries, random);
+        } else {
+            queries = replayed;
+            for (FirewallQuery &query : queries)
+                query.process = classifier.processKey(kFirewallProcesses[query.localPort % kFirewallProcessCount]);
+        }
+
+        quint64 blocked = 0;
+        timer.start();
+        for (const FirewallQuery &query : queries) {
+            const FirewallRule *rule = classifier.match(query);
+            blocked += rule && rule->action == FirewallRule::Block;
+        }
+        const double compiledNs = double(timer.nsecsElapsed()) / double(queries.size());
+        timer.start();
+        for (const FirewallQuery &query : queries)
+            classifier.matchLinear(query);
+        const double linearNs = double(timer.nsecsElapsed()) / double(queries.size());
+        for (const FirewallQuery &query : queries)
+            mismatches += classifier.match(query) != classifier.matchLinear(query);
+
+        // Insert, edit, remove and reorder single rules like the editor does
+        quint32 nextId = quint32(count) + 1;
+        timer.start();
+        for (int i = 0; i < kEdits; ++i) {
+            const int rulesNow = classifier.ruleCount();
+            switch (i % 4) {
+            case 0:
+                classifier.insertRule(int(random() % quint32(rulesNow + 1)), syntheticFirewallRule(nextId++, random));
+                break;
+            case 1:
+                classifier.updateRule(syntheticFirewallRule(classifier.ruleAt(int(random() % quint32(rulesNow))).id, random));
+                break;
+            case 2:
+                classifier.removeRule(classifier.ruleAt(int(random() % quint32(rulesNow))).id);
+                break;
+            default:
+                classifier.moveRule(int(random() % quint32(rulesNow)), int(random() % quint32(rulesNow)));
+                break;
+            }
+        }
+        const double editUs = timer.nsecsElapsed() / 1e3 / kEdits;
+        timer.start();
+        for (const FirewallQuery &query : queries)
+            classifier.match(query);
+        const double editedNs = double(timer.nsecsElapsed()) / double(queries.size());
+        for (const FirewallQuery &query : queries)
+            mismatches += classifier.match(query) != classifier.matchLinear(query);
+
+        const FirewallClassifier::Stats stats = classifier.stats();
+        fprintf(stderr, "%6d rules: compile %.1f ms, %.0f ns/match (linear %.0f ns), %.0f%% blocked; "
+                        "after %d edits %.0f ns/match, %.1f us/edit; %d intervals, %.1f MB\n",
+                count, compileMs, compiledNs, linearNs, 100.0 * double(blocked) / double(queries.size()),
+                kEdits, editedNs, editUs, stats.intervals, stats.memoryBytes / 1e6);
+        if (count == ruleCount)
+            break;
+    }
+    if (mismatches > 0) {
+        fprintf(stderr, "%d queries matched a different rule than the linear scan\n", mismatches);
+        return 1;
+    }
+    return 0;
+}
+
+namespace {
+
+// Longest-prefix reference for the IP data benchmark: one hash entry per
+// (length, prefix), probed from /32 down
+class PrefixReference
+{
+public:
+    void insert(quint32 prefix, int length, quint32 value) { entries.insert(key(prefix, length), value); }
+
+    quint32 lookup(quint32 address) const
+    {
+        for (int length = 32; length >= 0; --length) {
+            const quint32 prefix = length ? address & (~quint32(0) << (32 - length)) : 0;
+            const auto found = entries.constFind(key(prefix, length));
+            if (found != entries.constEnd())
+                return found.value();
+        }
+        return 0;
+    }
+
+private:
+    static quint64 key(quint32 prefix, int length) { return (quint64(length) << 32) | prefix; }
+
+    QHash<quint64, quint32> entries;
+};
+
+QByteArray ipv4Text(quint32 address)
+{
+    return QByteArray::number(address >> 24) + '.' + QByteArray::number((address >> 16) & 0xff) + '.'
+           + QByteArray::number((address >> 8) & 0xff) + '.' + QByteArray::number(address & 0xff);
+}
+
+} // namespace
+
+// Writes GeoIP-, ASN- and drop-list-shaped files with <prefixCount> IPv4
+// country prefixes (a third as many AS networks, a twentieth as many
+// listed hosts and networks, a quarter as many IPv6 country prefixes),
+// compiles them, checks a sample of lookups against a hash-per-length
+// reference and reports lookups/s, single and batched, over uniformly
+// random addresses and over a working set of active hosts
+int benchmarkIpInfo(int prefixCount)
+{
+    const char *const countries[] = { "US", "DE", "FR", "CN", "BR", "JP", "GB", "RU", "IN", "NL" };
+    const int kCountries = 10;
+    const int kLookups = 4000000;
+    const int kActiveHosts = 65536;
+    const int kChecked = 500000;
+    const QString geoPath = QDir::temp().filePath("rhynec-bench-geo.csv");
+    const QString asnPath = QDir::temp().filePath("rhynec-bench-asn.csv");
+    const QString dropPath = QDir::temp().filePath("rhynec-bench-drop.txt");
+    const QString imagePath = QDir::temp().filePath("rhynec-bench-ipinfo.rip");
+
+    std::mt19937_64 random(3);
+    PrefixReference countryOf;
+    PrefixReference asnOf;
+    PrefixReference riskOf;
+    QFile geo(geoPath);
+    QFile asn(asnPath);
+    QFile drop(dropPath);
+    if (!geo.open(QIODevice::WriteOnly | QIODevice::Truncate) || !asn.open(QIODevice::WriteOnly | QIODevice::Truncate)
+        || !drop.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        fprintf(stderr, "ipinfo: cannot write sources to %s\n", qPrintable(QDir::tempPath()));
+        return 2;
+    }
+    geo.write("network,country_code\n");
+    asn.write("network,autonomous_system_number,autonomous_system_organization\n");
+    drop.write("; Spamhaus DROP List, synthetic\n");
+    // Mostly /20-/24 like real allocations, the rest down to /8
+    const auto prefixLength = [&random](int shortest, int longest) {
+        return random() % 3 ? longest - int(random() % 5) : shortest + int(random() % quint64(longest - shortest + 1));
+    };
+    for (int i = 0; i < prefixCount; ++i) {
+        const int length = prefixLength(8, 24);
+        const quint32 prefix = quint32(random()) & (~quint32(0) << (32 - length));
+        const int country = int(random() % kCountries);
+        countryOf.insert(prefix, length, quint32(country) + 1);
+        geo.write(ipv4Text(prefix) + '/' + QByteArray::number(length) + ',' + countries[country] + '\n');
+    }
+    for (int i = 0; i < prefixCount / 3; ++i) {
+        const int length = prefixLength(12, 24);
+        const quint32 prefix = quint32(random()) & (~quint32(0) << (32 - length));
+        const quint32 number = quint32(random() % 60000) + 1;
+        asnOf.insert(prefix, length, number);
+        asn.write(ipv4Text(prefix) + '/' + QByteArray::number(length) + ',' + QByteArray::number(number)
+                  + ",\"Network " + QByteArray::number(number) + ", Inc.\"\n");
+    }
+    for (int i = 0; i < prefixCount / 20; ++i) {
+        const int length = random() % 4 ? 32 : prefixLength(16, 24);
+        const quint32 prefix = quint32(random()) & (~quint32(0) << (32 - length));
+        riskOf.insert(prefix, length, 100);
+        drop.write(ipv4Text(prefix) + '/' + QByteArray::number(length) + " ; SBL" + QByteArray::number(i) + '\n');
+    }
+    for (int i = 0; i < prefixCount / 4; ++i) {
+        const int length = 32 + int(random() % 17);
+        const quint64 prefix = (0x2000000000000000ULL | (random() >> 3)) & (~quint64(0) << (64 - length));
+        geo.write(QByteArray::number((prefix >> 48) & 0xffff, 16) + ':' + QByteArray::number((prefix >> 32) & 0xffff, 16)
+                  + ':' + QByteArray::number((prefix >> 16) & 0xffff, 16) + "::/" + QByteArray::number(length) + ','
+                  + countries[random() % kCountries] + '\n');
+    }
+    geo.close();
+    asn.close();
+    drop.close();
+
+    IpInfoTable::CompileStats stats;
+    QString failure;
+    const bool compiled = IpInfoTable::compile({ geoPath, asnPath, dropPath }, imagePath, &stats, &failure);
+    QFile::remove(geoPath);
+    QFile::remove(asnPath);
+    QFile::remove(dropPath);
+    if (!compiled) {
+        fprintf(stderr, "ipinfo: %s\n", qPrintable(failure));
+        return 2;
+    }
+    fprintf(stderr, "ipinfo: %llu networks compiled in %lld ms: %llu records, %llu nodes, %.1f MB image\n",
+            static_cast<unsigned long long>(stats.entries), static_cast<long long>(stats.elapsedMs),
+            static_cast<unsigned long long>(stats.records), static_cast<unsigned long long>(stats.nodes),
+            stats.imageBytes / 1048576.0);
+
+    IpInfoTable table;
+    QElapsedTimer elapsed;
+    elapsed.start();
+    if (!table.open(imagePath)) {
+        fprintf(stderr, "ipinfo: %s\n", qPrintable(table.errorString()));
+        return 2;
+    }
+    const qint64 openNs = elapsed.nsecsElapsed();
+
+    std::vector<quint32> addresses(kLookups);
+    for (quint32 &address : addresses)
+        address = quint32(random());
+    std::vector<const IpInfoRecord *> found(kLookups);
+    table.lookupV4(addresses.data(), kLookups, found.data());
+    int mismatches = 0;
+    for (int i = 0; i < kChecked; ++i) {
+        const IpInfoRecord &record = *found[size_t(i)];
+        const quint32 country = countryOf.lookup(addresses[size_t(i)]);
+        const bool countryMatches = country ? memcmp(record.country, countries[country - 1], 2) == 0 : record.country[0] == 0;
+        if (!countryMatches || record.asn != asnOf.lookup(addresses[size_t(i)])
+            || record.risk != riskOf.lookup(addresses[size_t(i)]) || table.lookupV4(addresses[size_t(i)]) != &record)
+            ++mismatches;
+    }
+
+    std::vector<quint32> active(kActiveHosts);
+    for (quint32 &address : active)
+        address = quint32(random());
+    std::vector<quint32> activeLookups(kLookups);
+    for (quint32 &address : activeLookups)
+        address = active[random() % kActiveHosts];
+
+    // Each pass touches the record too, as a caller reading it would
+    const auto measure = [&table, &found](const std::vector<quint32> &keys, bool batched, quint64 *checksum) {
+        QElapsedTimer timer;
+        timer.start();
+        if (batched) {
+            table.lookupV4(keys.data(), int(keys.size()), found.data());
+            for (const IpInfoRecord *record : found)
+                *checksum += record->asn;
+        } else {
+            for (quint32 address : keys)
+                *checksum += table.lookupV4(address)->asn;
+        }
+        return double(keys.size()) / (double(timer.nsecsElapsed()) / 1e9) / 1e6;
+    };
+    quint64 checksum = 0;
+    const double randomSingle = measure(addresses, false, &checksum);
+    const double randomBatched = measure(addresses, true, &checksum);
+    const double activeSingle = measure(activeLookups, false, &checksum);
+    const double activeBatched = measure(activeLookups, true, &checksum);
+
+    std::vector<quint8> addresses6(size_t(kLookups) * 16);
+    for (size_t i = 0; i < addresses6.size(); i += 8) {
+        const quint64 word = i % 16 ? random() : 0x2000000000000000ULL | (random() >> 3);
+        for (int b = 0; b < 8; ++b)
+            addresses6[i + size_t(b)] = quint8(word >> (56 - 8 * b));
+    }
+    elapsed.start();
+    table.lookupV6(addresses6.data(), kLookups, found.data());
+    for (const IpInfoRecord *record : found)
+        checksum += quint8(record->country[0]);
+    const double batched6 = double(kLookups) / (double(elapsed.nsecsElapsed()) / 1e9) / 1e6;
+
+    fprintf(stderr, "ipinfo: opened in %.1f us; IPv4 M lookups/s: random %.1f single, %.1f batched; "
+                    "%d active hosts %.1f single, %.1f batched; IPv6 random %.1f batched (checksum %llu)\n",
+            openNs / 1000.0, randomSingle, randomBatched, kActiveHosts, activeSingle, activeBatched, batched6,
+            static_cast<unsigned long long>(checksum));
+    table.close();
+    QFile::remove(imagePath);
+    if (mismatches > 0) {
+        fprintf(stderr, "%d of %d lookups disagree with the reference\n", mismatches, kChecked);
+        return 1;
+    }
+    return 0;
+}
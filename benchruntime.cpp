@@ -0,0 +1,594 @@
+#include "benchmarks.h"
+#include "alertmodel.h"
+#include "alertpipeline.h"
+#include "daemonclient.h"
+#include "daemonserver.h"
+#include "metricsbus.h"
+#include "taskscheduler.h"
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QHash>
+#include <QThreadPool>
+#include <QTimer>
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+// <threadCount> engine-like threads write counters, a gauge and a
+// latency sample per event to the metrics bus, first paced at 10000
+// events/s each and then flat out, while this thread drains it at 60 Hz
+// as the Status tab does. The drain should cost the same at either rate,
+// and every update must be accounted for as delivered, dropped or merged.
+int benchmarkMetrics(int threadCount)
+{
+    const int kSeconds = 2;
+    const int kHz = 60;
+    const int kSampleBudget = 2048;
+    const int kPacedPerSecond = 10000;
+    threadCount = qBound(1, threadCount, 64);
+
+    MetricsBus bus;
+    const int packets = bus.metric("bench.packets", MetricsBus::Counter);
+    const int bytes = bus.metric("bench.bytes", MetricsBus::Counter, "B");
+    const int depth = bus.metric("bench.depth", MetricsBus::Gauge);
+    const int latency = bus.metric("bench.latency", MetricsBus::Sample, "ns");
+
+    double drainMicros[2] = {};
+    quint64 droppedBefore = 0;
+    quint64 mergedBefore = 0;
+    for (int paced = 1; paced >= 0; --paced) {
+        QElapsedTimer elapsed;
+        elapsed.start();
+        const qint64 packetsBefore = bus.drain(elapsed.nsecsElapsed(), kSampleBudget).metrics[packets].value;
+        std::atomic<bool> stop { false };
+        std::vector<quint64> written(size_t(threadCount), 0);
+        std::vector<std::unique_ptr<QThread>> threads;
+        for (int t = 0; t < threadCount; ++t) {
+            threads.emplace_back(QThread::create([&, t]() {
+                std::shared_ptr<MetricsProducer> producer = bus.attach(QString("bench %1").arg(t));
+                QElapsedTimer clock;
+                clock.start();
+                quint64 events = 0;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    if (paced && events * 1000000000 / kPacedPerSecond > quint64(clock.nsecsElapsed())) {
+                        QThread::usleep(100);
+                        continue;
+                    }
+                    producer->add(packets);
+                    producer->add(bytes, 1500);
+                    producer->set(depth, qint64(events & 255));
+                    producer->record(latency, qint64(1000 + (events & 1023)));
+                    ++events;
+                }
+                written[size_t(t)] = events;
+                producer->retire();
+            }));
+            threads.back()->start();
+        }
+
+        LatencyHistogram drainNs;
+        quint64 drained = 0;
+        for (int tick = 0; tick < kSeconds * kHz; ++tick) {
+            const qint64 start = elapsed.nsecsElapsed();
+            drained += bus.drain(start, kSampleBudget).samplesDrained;
+            drainNs.record(quint64(elapsed.nsecsElapsed() - start));
+            const qint64 next = qint64(tick + 1) * 1000000000 / kHz;
+            if (next > elapsed.nsecsElapsed())
+                QThread::usleep(quint64(next - elapsed.nsecsElapsed()) / 1000);
+        }
+        stop.store(true);
+        for (auto &thread : threads)
+            thread->wait();
+        const qint64 runNs = elapsed.nsecsElapsed();
+
+        // Drain what is left until every producer has been retired
+        MetricsSnapshot last;
+        do {
+            last = bus.drain(elapsed.nsecsElapsed(), kSampleBudget);
+            drained += last.samplesDrained;
+        } while (last.producers > 0);
+
+        quint64 events = 0;
+        for (quint64 n : written)
+            events += n;
+        const quint64 dropped = last.samplesDropped - droppedBefore;
+        const quint64 merged = last.gaugesMerged - mergedBefore;
+        droppedBefore = last.samplesDropped;
+        mergedBefore = last.gaugesMerged;
+        drainMicros[paced] = drainNs.percentile(50) / 1000.0;
+        fprintf(stderr, "%s: %d threads, %.0f events/s, drain p50 %.1f us p99 %.1f us at %d Hz; %llu samples drained, "
+                        "%llu dropped, %llu gauge sets merged\n",
+                paced ? "paced" : "flat out", threadCount, double(events) * 1e9 / double(runNs),
+                drainNs.percentile(50) / 1000.0, drainNs.percentile(99) / 1000.0, kHz,
+                static_cast<unsigned long long>(drained), static_cast<unsigned long long>(dropped),
+                static_cast<unsigned long long>(merged));
+        if (quint64(last.metrics[packets].value - packetsBefore) != events || drained + dropped != events) {
+            fprintf(stderr, "lost updates: %llu packets counted, %llu samples accounted for, of %llu events\n",
+                    static_cast<unsigned long long>(last.metrics[packets].value - packetsBefore),
+                    static_cast<unsigned long long>(drained + dropped), static_cast<unsigned long long>(events));
+            return 1;
+        }
+    }
+    fprintf(stderr, "drain cost flat out: %.2fx the paced one, bounded by the %d-sample budget\n",
+            drainMicros[1] > 0 ? drainMicros[0] / drainMicros[1] : 0, kSampleBudget);
+    return 0;
+}
+
+// An outbreak at <alertsPerSecond>, from four threads: most alerts repeat
+// a few worm groups, some land in thousands of shared folders, and a few
+// are high severity in unique places. This thread runs an event loop
+// like the GUI's, taking from the pipeline every 250 ms as the Security
+// tab does and timing a 60 Hz frame timer next to it. The UI counts as
+// interactive if no frame is held up past kMaxFrameGapMs.
+int benchmarkAlerts(int alertsPerSecond)
+{
+    const int kSeconds = 5;
+    const int kThreads = 4;
+    const int kTakeIntervalMs = 250;
+    const int kAlertsPerTake = 64;
+    const int kFrameIntervalMs = 16;
+    const double kMaxFrameGapMs = 50;
+    alertsPerSecond = qBound(1, alertsPerSecond, 10000000);
+
+    AlertPipeline pipeline;
+    AlertModel model;
+    const qint64 startMs = QDateTime::currentMSecsSinceEpoch();
+
+    std::atomic<bool> stop { false };
+    std::vector<quint64> submitted(size_t(kThreads), 0);
+    std::vector<qint64> submitNs(size_t(kThreads), 0);
+    std::vector<std::unique_ptr<QThread>> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back(QThread::create([&, t]() {
+            std::mt19937 random(quint32(t + 1));
+            const quint64 perSecond = quint64(qMax(1, alertsPerSecond / kThreads));
+            QElapsedTimer clock;
+            clock.start();
+            quint64 count = 0;
+            qint64 busyNs = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                if (count * 1000000000 / perSecond > quint64(clock.nsecsElapsed())) {
+                    QThread::usleep(200);
+                    continue;
+                }
+                Alert alert;
+                alert.process = "File scanner";
+                const quint32 kind = random() % 1000;
+                if (kind < 900) {
+                    alert.severity = Alert::Medium;
+                    alert.rule = kind % 2 ? "writable_code" : "packed_sections";
+                    alert.path = QString("/home/user/.cache/%1/payload-%2.bin").arg(kind % 4).arg(count);
+                } else if (kind < 990) {
+                    alert.severity = Alert::Low;
+                    alert.rule = "embedded_javascript";
+                    alert.path = QString("/srv/share/%1/doc-%2.pdf").arg(random() % 5000).arg(count);
+                } else {
+                    alert.severity = Alert::High;
+                    alert.rule = "entry_outside_code";
+                    alert.path = QString("/tmp/%1-%2/dropper").arg(t).arg(count);
+                }
+                alert.timeMs = QDateTime::currentMSecsSinceEpoch();
+                const qint64 before = clock.nsecsElapsed();
+                pipeline.submit(alert);
+                busyNs += clock.nsecsElapsed() - before;
+                ++count;
+            }
+            submitted[size_t(t)] = count;
+            submitNs[size_t(t)] = busyNs;
+        }));
+        threads.back()->start();
+    }
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    LatencyHistogram takeNs;
+    LatencyHistogram frameGapUs;
+    qint64 lastFrameNs = 0;
+    quint64 taken = 0;
+    quint64 notified = 0;
+    quint64 notifications = 0;
+    int waiting = 0;
+    auto takeBatch = [&]() {
+        const qint64 before = elapsed.nsecsElapsed();
+        const AlertBatch batch = pipeline.take(QDateTime::currentMSecsSinceEpoch(), kAlertsPerTake);
+        model.addBatch(batch);
+        takeNs.record(quint64(elapsed.nsecsElapsed() - before));
+        taken += quint64(batch.opened.size());
+        waiting = batch.waiting;
+        for (const AlertNotification &notification : batch.notifications) {
+            notified += notification.alerts;
+            ++notifications;
+            if (notifications <= 8)
+                fprintf(stderr, "  %6.2f s  [%s] %s\n", (QDateTime::currentMSecsSinceEpoch() - startMs) / 1000.0,
+                        alertSeverityName(notification.severity), qPrintable(notification.text));
+        }
+    };
+
+    QEventLoop loop;
+    QTimer takeTimer;
+    QObject::connect(&takeTimer, &QTimer::timeout, takeBatch);
+    takeTimer.start(kTakeIntervalMs);
+    QTimer frameTimer;
+    frameTimer.setTimerType(Qt::PreciseTimer);
+    QObject::connect(&frameTimer, &QTimer::timeout, [&]() {
+        const qint64 now = elapsed.nsecsElapsed();
+        if (lastFrameNs > 0)
+            frameGapUs.record(quint64(now - lastFrameNs) / 1000);
+        lastFrameNs = now;
+    });
+    frameTimer.start(kFrameIntervalMs);
+    QTimer::singleShot(kSeconds * 1000, &loop, &QEventLoop::quit);
+    loop.exec();
+    stop.store(true);
+    for (auto &thread : threads)
+        thread->wait();
+    takeBatch();
+
+    quint64 alerts = 0;
+    qint64 busyNs = 0;
+    for (int t = 0; t < kThreads; ++t) {
+        alerts += submitted[size_t(t)];
+        busyNs += submitNs[size_t(t)];
+    }
+    const AlertPipeline::Stats stats = pipeline.stats();
+    fprintf(stderr, "%llu alerts in %d s (%.0f/s), submit %.2f us each: %llu counted into open groups, "
+                    "%llu groups opened, %llu left out of a full group table\n",
+            static_cast<unsigned long long>(alerts), kSeconds, double(alerts) / kSeconds, busyNs / 1000.0 / qMax<quint64>(1, alerts),
+            static_cast<unsigned long long>(stats.deduplicated), static_cast<unsigned long long>(stats.groups),
+            static_cast<unsigned long long>(stats.ungrouped));
+    fprintf(stderr, "groups: %llu shown, %llu preempted, %llu shed, %d waiting; %d rows in the table\n",
+            static_cast<unsigned long long>(taken), static_cast<unsigned long long>(stats.preempted),
+            static_cast<unsigned long long>(stats.shed), waiting, model.rowCount());
+    fprintf(stderr, "%llu notifications for %llu alerts; take p50 %.1f us, p99 %.1f us; frame gap p99 %.1f ms, "
+                    "max %.1f ms (limit %.0f ms)\n",
+            static_cast<unsigned long long>(notifications), static_cast<unsigned long long>(notified),
+            takeNs.percentile(50) / 1000.0, takeNs.percentile(99) / 1000.0, frameGapUs.percentile(99) / 1000.0,
+            frameGapUs.max() / 1000.0, kMaxFrameGapMs);
+
+    const AlertPipeline::Options options = pipeline.options();
+    const quint64 maxNotifications = quint64(options.notificationBurst)
+                                     + quint64(kSeconds * 1000 / options.notificationIntervalMs) + 1;
+    bool ok = true;
+    if (stats.alerts != alerts || stats.deduplicated + stats.groups + stats.ungrouped != alerts
+        || stats.groups != taken + stats.preempted + stats.shed + quint64(waiting)) {
+        fprintf(stderr, "alerts unaccounted for\n");
+        ok = false;
+    }
+    if (notifications > maxNotifications) {
+        fprintf(stderr, "%llu notifications, more than the rate limit allows (%llu)\n",
+                static_cast<unsigned long long>(notifications), static_cast<unsigned long long>(maxNotifications));
+        ok = false;
+    }
+    if (frameGapUs.max() / 1000.0 > kMaxFrameGapMs) {
+        fprintf(stderr, "a frame waited %.1f ms\n", frameGapUs.max() / 1000.0);
+        ok = false;
+    }
+    return ok ? 0 : 1;
+}
+
+// Serves rhynec-daemon's socket from this process and attaches to it from
+// a second thread, as the GUI does: attach and detach times, Ping round
+// trips with small and large bodies, then <records> results posted by a
+// third thread and read from the shared ring, checked for order and
+// against the daemon's own count in the metrics snapshot
+int benchmarkIpc(quint64 recordCount)
+{
+#ifdef Q_OS_LINUX
+    const int kAttachCycles = 200;
+    const int kPings = 20000;
+    const int kLargePings = 2000;
+    const int kLargeBytes = 60 << 10;
+    recordCount = qBound<quint64>(1000, recordCount, 1000000000);
+
+    DaemonServer::Options options;
+    options.socketPath = QDir::temp().filePath(QString("rhynec-bench-%1.sock").arg(QCoreApplication::applicationPid()));
+    DaemonServer server;
+    if (!server.listen(options)) {
+        fprintf(stderr, "daemon: %s\n", qPrintable(server.errorString()));
+        return 2;
+    }
+    MetricsBus *bus = server.metrics();
+    const int postedId = bus->metric("bench/posted", MetricsBus::Counter);
+
+    bool ok = true;
+    std::unique_ptr<QThread> gui(QThread::create([&]() {
+        DaemonClient client;
+        LatencyHistogram attachNs;
+        LatencyHistogram detachNs;
+        QElapsedTimer elapsed;
+        for (int i = 0; i < kAttachCycles; ++i) {
+            elapsed.start();
+            if (!client.attach(options.socketPath)) {
+                fprintf(stderr, "attach: %s\n", qPrintable(client.errorString()));
+                ok = false;
+                return;
+            }
+            attachNs.record(quint64(elapsed.nsecsElapsed()));
+            elapsed.start();
+            client.detach();
+            detachNs.record(quint64(elapsed.nsecsElapsed()));
+        }
+        fprintf(stderr, "%d attaches: p50 %.0f us, p99 %.0f us; detach p50 %.1f us\n", kAttachCycles,
+                attachNs.percentile(50) / 1e3, attachNs.percentile(99) / 1e3, detachNs.percentile(50) / 1e3);
+
+        if (!client.attach(options.socketPath)) {
+            fprintf(stderr, "attach: %s\n", qPrintable(client.errorString()));
+            ok = false;
+            return;
+        }
+        LatencyHistogram pingNs;
+        qint64 roundTripNs = 0;
+        for (int i = 0; i < kPings && ok; ++i) {
+            ok = client.ping(16, &roundTripNs);
+            pingNs.record(quint64(roundTripNs));
+        }
+        elapsed.start();
+        for (int i = 0; i < kLargePings && ok; ++i)
+            ok = client.ping(kLargeBytes, &roundTripNs);
+        if (!ok) {
+            fprintf(stderr, "ping: %s\n", qPrintable(client.errorString()));
+            return;
+        }
+        fprintf(stderr, "%d pings of 16 bytes: p50 %.1f us, p99 %.1f us, max %.2f ms; %d KB pings: %.0f MB/s\n", kPings,
+                pingNs.percentile(50) / 1e3, pingNs.percentile(99) / 1e3, pingNs.max() / 1e6, kLargeBytes >> 10,
+                2.0 * kLargePings * kLargeBytes / 1048576.0 / (elapsed.nsecsElapsed() / 1e9));
+
+        // The results a scan would post; the time field carries the order
+        std::atomic<bool> posting { true };
+        std::unique_ptr<QThread> producer(QThread::create([&]() {
+            std::shared_ptr<MetricsProducer> metrics = bus->attach("bench producer");
+            const QByteArray text = "clean elf /home/user/src/project/build/obj/unit.o";
+            for (quint64 i = 0; i < recordCount; ++i) {
+                server.postEvent(EventJournal::ScanResult, qint64(i), text);
+                metrics->add(postedId);
+            }
+            metrics->retire();
+            posting.store(false, std::memory_order_release);
+        }));
+        DaemonRing *ring = client.ring();
+        quint64 received = 0;
+        quint64 payloadBytes = 0;
+        qint64 next = 0;
+        bool ordered = true;
+        elapsed.start();
+        producer->start();
+        for (;;) {
+            const bool done = !posting.load(std::memory_order_acquire);
+            const DaemonRing::Record *record = ring->peek();
+            if (!record) {
+                // Empty after the producer finished: nothing more will come
+                if (done)
+                    break;
+                QThread::yieldCurrentThread();
+                continue;
+            }
+            ordered = ordered && record->timeUs >= next;
+            next = record->timeUs + 1;
+            payloadBytes += record->bytes;
+            ++received;
+            ring->release(record);
+        }
+        const double seconds = elapsed.nsecsElapsed() / 1e9;
+        producer->wait();
+        const quint64 dropped = ring->droppedRecords();
+        fprintf(stderr, "%llu results through a %llu KB ring in %.2f s: %.2f M/s, %.0f MB/s; %llu dropped while full\n",
+                static_cast<unsigned long long>(received), static_cast<unsigned long long>(ring->capacity() >> 10),
+                seconds, received / seconds / 1e6, payloadBytes / 1048576.0 / seconds,
+                static_cast<unsigned long long>(dropped));
+        if (!ordered || received + dropped != recordCount) {
+            fprintf(stderr, "  results out of order or lost\n");
+            ok = false;
+        }
+
+        // The counter reaches the snapshot with the next publish
+        bool counted = false;
+        for (int attempt = 0; attempt < 50 && !counted; ++attempt) {
+            QThread::msleep(20);
+            MetricsSnapshot snapshot;
+            ring->readMetrics(&snapshot, "daemon/");
+            for (const MetricsSnapshot::Metric &metric : snapshot.metrics)
+                counted = counted || (metric.name == "daemon/bench/posted" && quint64(metric.value) == recordCount);
+        }
+        if (!counted) {
+            fprintf(stderr, "  the metrics snapshot never showed %llu posted\n", static_cast<unsigned long long>(recordCount));
+            ok = false;
+        }
+        client.detach();
+    }));
+
+    // The server answers from this thread's event loop
+    QEventLoop loop;
+    QObject::connect(gui.get(), &QThread::finished, &loop, &QEventLoop::quit);
+    gui->start();
+    loop.exec();
+    gui->wait();
+    return ok ? 0 : 1;
+#else
+    Q_UNUSED(recordCount);
+    fprintf(stderr, "--bench-ipc needs Linux\n");
+    return 2;
+#endif
+}
+
+// Splits a sum over <taskCount> tasks as a binary tree, each task posting
+// its two halves from the worker it runs on, once on a TaskScheduler and
+// once on a QThreadPool of as many threads, and reports tasks/s and how
+// many were stolen. Then queues a second of Background work per worker
+// and posts Interactive tasks behind it one at a time, reporting how long
+// they waited, cancels what is left of the backlog and checks it was
+// skipped, and posts results back to this thread's event loop. Ends with
+// the histograms the scheduler wrote to its MetricsBus.
+int benchmarkTasks(quint64 taskCount)
+{
+    const int kLeafSteps = 2000;                      // A few microseconds
+    const qint64 kBacklogTaskNs = 500000;
+    const int kProbes = 200;
+    const int kPostBacks = 10000;
+    taskCount = qBound<quint64>(1000, taskCount, 100000000);
+    const quint64 leaves = (taskCount + 1) / 2;
+
+    auto leaf = [](quint64 i) {
+        quint64 x = i;
+        for (int step = 0; step < kLeafSteps; ++step)
+            x = x * 6364136223846793005ull + 1442695040888963407ull;
+        return x;
+    };
+    QElapsedTimer elapsed;
+    elapsed.start();
+    quint64 expected = 0;
+    for (quint64 i = 0; i < leaves; ++i)
+        expected += leaf(i);
+    const double serialSeconds = elapsed.nsecsElapsed() / 1e9;
+
+    // Declared first, so the scheduler's workers are gone before it is
+    MetricsBus bus;
+    QHash<QString, LatencyHistogram> histograms;
+    quint64 samplesDropped = 0;
+    auto collect = [&]() {
+        const MetricsSnapshot snapshot = bus.drain(elapsed.nsecsElapsed(), 1 << 20);
+        for (const MetricsSnapshot::Metric &metric : snapshot.metrics) {
+            if (metric.kind == MetricsBus::Sample)
+                histograms[metric.name].merge(metric.samples);
+        }
+        samplesDropped = snapshot.samplesDropped;
+    };
+
+    TaskScheduler::Options options;
+    options.pinWorkers = true;
+    TaskScheduler scheduler(options);
+    scheduler.setMetricsBus(&bus);
+    bool ok = true;
+
+    const int forkType = scheduler.taskType("fork");
+    std::atomic<quint64> sum { 0 };
+    std::function<void(quint64, quint64)> split = [&](quint64 lo, quint64 hi) {
+        if (hi - lo == 1) {
+            sum.fetch_add(leaf(lo), std::memory_order_relaxed);
+            return;
+        }
+        const quint64 mid = lo + (hi - lo) / 2;
+        scheduler.post(forkType, TaskScheduler::Normal, [&split, lo, mid]() { split(lo, mid); });
+        scheduler.post(forkType, TaskScheduler::Normal, [&split, mid, hi]() { split(mid, hi); });
+    };
+    elapsed.start();
+    scheduler.post(forkType, TaskScheduler::Normal, [&split, leaves]() { split(0, leaves); });
+    scheduler.waitForIdle();
+    const double schedulerSeconds = elapsed.nsecsElapsed() / 1e9;
+    const quint64 tasks = scheduler.tasksRun();
+    fprintf(stderr, "%d workers: %llu tasks in %.3f s, %.2f M tasks/s, %llu stolen (serial %.3f s)\n",
+            scheduler.workerCount(), static_cast<unsigned long long>(tasks), schedulerSeconds,
+            tasks / schedulerSeconds / 1e6, static_cast<unsigned long long>(scheduler.tasksStolen()), serialSeconds);
+    if (sum.load() != expected) {
+        fprintf(stderr, "  the scheduler's sum is wrong\n");
+        ok = false;
+    }
+    collect();
+
+    {
+        QThreadPool pool;
+        pool.setMaxThreadCount(scheduler.workerCount());
+        std::atomic<quint64> poolSum { 0 };
+        std::function<void(quint64, quint64)> poolSplit = [&](quint64 lo, quint64 hi) {
+            if (hi - lo == 1) {
+                poolSum.fetch_add(leaf(lo), std::memory_order_relaxed);
+                return;
+            }
+            const quint64 mid = lo + (hi - lo) / 2;
+            pool.start([&poolSplit, lo, mid]() { poolSplit(lo, mid); });
+            pool.start([&poolSplit, mid, hi]() { poolSplit(mid, hi); });
+        };
+        elapsed.start();
+        pool.start([&poolSplit, leaves]() { poolSplit(0, leaves); });
+        pool.waitForDone();
+        const double poolSeconds = elapsed.nsecsElapsed() / 1e9;
+        fprintf(stderr, "QThreadPool: %.3f s, %.2f M tasks/s\n", poolSeconds, tasks / poolSeconds / 1e6);
+        if (poolSum.load() != expected) {
+            fprintf(stderr, "  the pool's sum is wrong\n");
+            ok = false;
+        }
+    }
+
+    // Enough Background work to keep every worker busy for a second;
+    // an Interactive task should only wait for one of them to finish
+    // the task it is on
+    const int backlogTasks = scheduler.workerCount() * int(1000000000 / kBacklogTaskNs);
+    const int backlogType = scheduler.taskType("backlog");
+    CancellationToken backlog = CancellationToken::create();
+    std::atomic<int> backlogRun { 0 };
+    for (int i = 0; i < backlogTasks; ++i) {
+        scheduler.post(backlogType, TaskScheduler::Background, [&]() {
+            QElapsedTimer spin;
+            spin.start();
+            while (spin.nsecsElapsed() < kBacklogTaskNs) {
+            }
+            backlogRun.fetch_add(1, std::memory_order_relaxed);
+        }, backlog);
+    }
+    const int probeType = scheduler.taskType("probe");
+    LatencyHistogram probeWaitNs;
+    for (int i = 0; i < kProbes; ++i) {
+        CancellationToken probe = CancellationToken::create();
+        const qint64 postedNs = elapsed.nsecsElapsed();
+        scheduler.post(probeType, TaskScheduler::Interactive, [&, postedNs]() {
+            probeWaitNs.record(quint64(elapsed.nsecsElapsed() - postedNs));
+        }, probe);
+        scheduler.wait(probe);
+        QThread::usleep(1000);
+    }
+    const quint64 cancelledBefore = scheduler.tasksCancelled();
+    backlog.cancel();
+    scheduler.wait(backlog);
+    const int skipped = backlogTasks - backlogRun.load();
+    fprintf(stderr, "Interactive behind %d Background tasks of %lld us: waited p50 %.0f us, p99 %.0f us, max %.0f us; "
+                    "%d of the backlog skipped once cancelled\n",
+            backlogTasks, kBacklogTaskNs / 1000, probeWaitNs.percentile(50) / 1e3, probeWaitNs.percentile(99) / 1e3,
+            probeWaitNs.max() / 1e3, skipped);
+    if (skipped == 0 || scheduler.tasksCancelled() - cancelledBefore != quint64(skipped)) {
+        fprintf(stderr, "  cancelling the backlog did not skip what was queued\n");
+        ok = false;
+    }
+    collect();
+
+    // Results handed back through the event loop, as the tabs get them
+    {
+        QObject receiver;
+        QEventLoop loop;
+        const int postBackType = scheduler.taskType("post-back");
+        int delivered = 0;
+        quint64 deliveredSum = 0;
+        elapsed.start();
+        for (int i = 0; i < kPostBacks; ++i) {
+            scheduler.run(postBackType, TaskScheduler::Interactive, &receiver, [i]() { return quint64(i); },
+                          [&](quint64 value) {
+                              deliveredSum += value;
+                              if (++delivered == kPostBacks)
+                                  loop.quit();
+                          });
+        }
+        QTimer::singleShot(10000, &loop, &QEventLoop::quit);
+        loop.exec();
+        fprintf(stderr, "%d results posted back in %.1f ms\n", delivered, elapsed.nsecsElapsed() / 1e6);
+        if (delivered != kPostBacks || deliveredSum != quint64(kPostBacks) * (kPostBacks - 1) / 2) {
+            fprintf(stderr, "  results were lost on the way back\n");
+            ok = false;
+        }
+        scheduler.waitForIdle();
+    }
+    collect();
+
+    QStringList names = histograms.keys();
+    std::sort(names.begin(), names.end());
+    for (const QString &name : names) {
+        const LatencyHistogram &histogram = histograms[name];
+        if (histogram.count() == 0)
+            continue;
+        fprintf(stderr, "  %-24s %9llu samples  p50 %9.1f us  p99 %9.1f us\n", qPrintable(name),
+                static_cast<unsigned long long>(histogram.count()), histogram.percentile(50) / 1e3,
+                histogram.percentile(99) / 1e3);
+    }
+    fprintf(stderr, "  %llu samples dropped while the rings were full\n", static_cast<unsigned long long>(samplesDropped));
+    return ok ? 0 : 1;
+}
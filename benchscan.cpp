@@ -0,0 +1,91 @@
+#include "benchmarks.h"
+#include "filescanner.h"
+#include "parserworkerpool.h"
+#include "scanreportwriter.h"
+#include <QEventLoop>
+#include <cstdio>
+
+// Writes synthetic rows to measure formatter and output throughput
+int benchmarkReport(ScanReportWriter &writer, quint64 rowCount)
+{
+    ScanVerdict verdict;
+    verdict.fileType = ScanVerdict::Pe;
+    verdict.fileSize = 183296;
+    verdict.parseMicros = 42;
+
+    char path[96];
+    for (quint64 i = 0; i < rowCount; ++i) {
+        const int length = snprintf(path, sizeof(path), "/srv/share/projects/build-%llu/bin/tool_%llu.exe",
+                                    static_cast<unsigned long long>(i % 997),
+                                    static_cast<unsigned long long>(i));
+        verdict.status = (i % 50 == 0) ? ScanVerdict::Suspicious : ScanVerdict::Clean;
+        verdict.flags = (i % 50 == 0) ? quint16(ScanVerdict::PackedSections) : quint16(0);
+        verdict.score = (i % 50 == 0) ? 40 : 0;
+        writer.addResultUtf8(path, length, verdict);
+    }
+    if (!writer.finish()) {
+        fprintf(stderr, "report: %s\n", qPrintable(writer.errorString()));
+        return 2;
+    }
+
+    fprintf(stderr, "%llu rows, %llu bytes formatted, %llu bytes written, %.0f rows/s\n",
+            static_cast<unsigned long long>(writer.rowsWritten()),
+            static_cast<unsigned long long>(writer.bytesFormatted()),
+            static_cast<unsigned long long>(writer.bytesWritten()),
+            writer.rowsPerSecond());
+    return 0;
+}
+
+namespace {
+
+// One sandboxed scan of `path`; returns files per second
+double scanFilesPerSecond(const QString &path, bool ioUring, ParserWorkerPool *pool, FileScanner *scanner)
+{
+    pool->setIoUringEnabled(ioUring);
+    QEventLoop loop;
+    QObject::connect(scanner, &FileScanner::finished, &loop, &QEventLoop::quit, Qt::QueuedConnection);
+    scanner->start(path);
+    loop.exec();
+    QObject::disconnect(scanner, &FileScanner::finished, &loop, nullptr);
+    return scanner->elapsedMs() > 0 ? scanner->filesScanned() * 1000.0 / scanner->elapsedMs() : 0;
+}
+
+} // namespace
+
+// Scans `path` with the sandboxed pool reading files through open/pread,
+// then through io_uring, and reports files/s and the system calls spent
+// per file handed to a worker. A first, unreported scan warms the page
+// cache so both paths read from memory.
+int benchmarkScanIo(const QString &path)
+{
+#ifdef Q_OS_LINUX
+    ParserWorkerPool pool;
+    pool.setMode(ParserWorkerPool::Mode::Sandboxed);
+    FileScanner scanner(&pool);
+    scanFilesPerSecond(path, false, &pool, &scanner);
+    if (scanner.filesScanned() == 0) {
+        fprintf(stderr, "No files under %s\n", qPrintable(path));
+        return 2;
+    }
+
+    double perFile[2] = {};
+    for (int ioUring = 0; ioUring < 2; ++ioUring) {
+        const quint64 filesBefore = pool.dispatchedFiles();
+        const quint64 callsBefore = pool.dispatchSyscalls();
+        const double filesPerSecond = scanFilesPerSecond(path, ioUring != 0, &pool, &scanner);
+        const quint64 files = pool.dispatchedFiles() - filesBefore;
+        perFile[ioUring] = files ? double(pool.dispatchSyscalls() - callsBefore) / files : 0;
+        fprintf(stderr, "%s: %llu files, %.0f files/s, %.3f system calls per file dispatched\n",
+                qPrintable(pool.readPath()), static_cast<unsigned long long>(scanner.filesScanned()), filesPerSecond,
+                perFile[ioUring]);
+    }
+    if (pool.readPath().startsWith("io_uring") && perFile[1] > 0)
+        fprintf(stderr, "io_uring: %.1fx fewer system calls per file\n", perFile[0] / perFile[1]);
+    pool.stop();
+    return 0;
+#else
+    Q_UNUSED(path);
+    fprintf(stderr, "The scan I/O benchmark requires Linux\n");
+    return 2;
+#endif
+}
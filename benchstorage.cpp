@@ -0,0 +1,340 @@
+#include "benchmarks.h"
+#include "eventjournal.h"
+#include "eventlogmodel.h"
+#include "eventsearch.h"
+#include "timeseriesstore.h"
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+// Fills a store with a week of history for <seriesCount> counters: one
+// sample a minute for the first days, then an hour of 1 s samples. One
+// series in ten is busy; the rest are idle with occasional bursts, like
+// most per-process counters. Reports memory, query latency and the cost
+// of a snapshot round trip.
+int benchmarkHistory(int seriesCount)
+{
+    const qint64 kWeek = 7 * 24 * 3600;
+    const qint64 end = 1700000000 + kWeek;
+    const qint64 start = end - kWeek;
+    const qint64 fineStart = end - 3600;
+
+    TimeSeriesStore store;
+    std::vector<int> ids;
+    for (int i = 0; i < seriesCount; ++i)
+        ids.push_back(store.series(QString("proc:bench%1:rx").arg(i)));
+
+    std::mt19937_64 random(1);
+    auto sample = [&random](int index) -> double {
+        if (index % 10 == 0)
+            return double(random() % 2000000);
+        return random() % 200 == 0 ? double(random() % 50000) : 0.0;
+    };
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    quint64 appends = 0;
+    for (qint64 time = start; time < end; time += time < fineStart ? 60 : 1) {
+        for (int i = 0; i < seriesCount; ++i)
+            store.append(ids[size_t(i)], time, sample(i));
+        appends += quint64(seriesCount);
+    }
+    const qint64 fillNs = elapsed.nsecsElapsed();
+
+    TimeSeriesStore::Stats stats = store.stats();
+    fprintf(stderr, "%d series, %llu points in %llu blocks, %.1f MB, %llu evicted blocks, %.0f ns/append\n",
+            stats.series, static_cast<unsigned long long>(stats.points),
+            static_cast<unsigned long long>(stats.blocks), stats.memoryBytes / 1048576.0,
+            static_cast<unsigned long long>(stats.evictedBlocks), double(fillNs) / double(qMax<quint64>(appends, 1)));
+
+    QVector<TimeSeriesStore::Point> points;
+    const struct { const char *label; TimeSeriesStore::Resolution resolution; qint64 span; } queries[] = {
+        { "last hour at 1 s", TimeSeriesStore::Seconds, 3600 },
+        { "last week at 1 min", TimeSeriesStore::Minutes, kWeek },
+        { "last week at 1 h", TimeSeriesStore::Hours, kWeek },
+    };
+    for (const auto &query : queries) {
+        points.clear();
+        elapsed.start();
+        store.query(ids[0], query.resolution, end - query.span, end, points);
+        fprintf(stderr, "%s: %d points in %.3f ms\n", query.label, points.size(), elapsed.nsecsElapsed() / 1e6);
+    }
+
+    const QString path = QDir::temp().filePath("rhynec-bench-history.tsdb");
+    elapsed.start();
+    if (!store.saveSnapshot(path)) {
+        fprintf(stderr, "snapshot failed: %s\n", qPrintable(store.errorString()));
+        return 1;
+    }
+    const qint64 saveNs = elapsed.nsecsElapsed();
+    TimeSeriesStore restored;
+    elapsed.start();
+    const bool loaded = restored.loadSnapshot(path);
+    fprintf(stderr, "snapshot %.1f MB: save %.0f ms, load %.0f ms%s\n", QFile(path).size() / 1048576.0,
+            saveNs / 1e6, elapsed.nsecsElapsed() / 1e6, loaded ? "" : " (load failed)");
+    QFile::remove(path);
+    return loaded ? 0 : 1;
+}
+
+// Journals <eventCount> events spread over the last 30 days from one
+// thread as fast as it can append, mostly scan results with a quarter
+// blocked connections, then asks for the last hour of blocked connections
+// before and after reopening the journal, and checks the count. A second,
+// smaller run with compressed blocks reports the space it saves. Ends by
+// holding the uncompressed ingest rate and the slowest query against the
+// targets: a million events/s on one core, a query in milliseconds.
+int benchmarkJournal(quint64 eventCount)
+{
+    const qint64 kMonthUs = 30ll * 24 * 3600 * 1000000;
+    const qint64 kHourUs = 3600ll * 1000000;
+    const double kTargetEventsPerSecond = 1000000;
+    const double kQueryBudgetMs = 10;
+    eventCount = qBound<quint64>(1000, eventCount, 1000000000);
+    const QString path = QDir::temp().filePath("rhynec-bench-journal");
+    const qint64 endUs = QDateTime::currentMSecsSinceEpoch() * 1000;
+    const qint64 hourUs = endUs - kHourUs;
+
+    auto typeOf = [](quint64 i) -> quint8 {
+        const quint64 kind = (i * 0x9e3779b97f4a7c15ull) >> 54;   // 0-1023
+        if (kind < 256)
+            return EventJournal::BlockedConnection;
+        if (kind < 1000)
+            return EventJournal::ScanResult;
+        return kind < 1016 ? EventJournal::VpnStateChange : EventJournal::SecurityAlert;
+    };
+
+    quint64 expected = 0;
+    auto ingest = [&](EventJournal &journal, quint64 count) -> double {
+        char payload[32];
+        expected = 0;
+        QElapsedTimer elapsed;
+        elapsed.start();
+        quint64 sequence = 0;
+        for (quint64 i = 0; i < count; ++i) {
+            // In double: i * kMonthUs overflows 64 bits past 7 million events
+            const qint64 timeUs = endUs - kMonthUs + qint64(double(kMonthUs) * double(i) / double(count));
+            const quint8 type = typeOf(i);
+            // Address and port of a connection, or a scanned file's inode
+            // and verdict; roughly what the engines would log
+            const quint64 word = i * 0xbf58476d1ce4e5b9ull;
+            memcpy(payload, &word, sizeof(word));
+            memcpy(payload + 8, &i, sizeof(i));
+            const int size = type == EventJournal::BlockedConnection ? 18 : 24;
+            sequence = journal.append(type, timeUs, payload, size);
+            if (type == EventJournal::BlockedConnection && timeUs >= hourUs)
+                ++expected;
+        }
+        if (!journal.waitForDurable(sequence))
+            return 0;
+        return count / (elapsed.nsecsElapsed() / 1e9);
+    };
+
+    double slowestQueryMs = 0;
+    auto lastHour = [&](EventJournal &journal, const char *label) {
+        QVector<EventJournal::Event> events;
+        EventJournal::QueryStats queryStats;
+        QElapsedTimer elapsed;
+        elapsed.start();
+        journal.query(hourUs, endUs, EventJournal::typeBit(EventJournal::BlockedConnection), &events, -1, &queryStats);
+        const double queryMs = elapsed.nsecsElapsed() / 1e6;
+        slowestQueryMs = qMax(slowestQueryMs, queryMs);
+        fprintf(stderr, "last hour of blocked connections, %s: %d events in %.3f ms (%d segments mapped, "
+                        "%llu of %llu blocks decoded)\n",
+                label, events.size(), queryMs, queryStats.segmentsMapped,
+                static_cast<unsigned long long>(queryStats.blocksDecoded),
+                static_cast<unsigned long long>(queryStats.blocksIndexed));
+        return quint64(events.size());
+    };
+
+    QDir(path).removeRecursively();
+    EventJournal::Options options;
+    options.directory = path;
+    bool ok = true;
+    double ingestRate = 0;
+    {
+        EventJournal journal;
+        if (!journal.open(options)) {
+            fprintf(stderr, "journal: %s\n", qPrintable(journal.errorString()));
+            return 1;
+        }
+        ingestRate = ingest(journal, eventCount);
+        const EventJournal::Stats stats = journal.stats();
+        fprintf(stderr, "%llu events over 30 days in %d segments, %.1f MB (%.1f bytes/event), %.0f events/s, "
+                        "%llu syncs, %llu appends waited\n",
+                static_cast<unsigned long long>(stats.durableEvents), stats.segments, stats.diskBytes / 1048576.0,
+                double(stats.diskBytes) / double(eventCount), ingestRate, static_cast<unsigned long long>(stats.syncs),
+                static_cast<unsigned long long>(stats.appendWaits));
+        if (stats.durableEvents != eventCount) {
+            fprintf(stderr, "only %llu events are durable\n", static_cast<unsigned long long>(stats.durableEvents));
+            ok = false;
+        }
+        if (lastHour(journal, "open") != expected)
+            ok = false;
+        journal.close();
+    }
+    {
+        EventJournal journal;
+        QElapsedTimer elapsed;
+        elapsed.start();
+        if (!journal.open(options)) {
+            fprintf(stderr, "journal: %s\n", qPrintable(journal.errorString()));
+            return 1;
+        }
+        fprintf(stderr, "reopened in %.1f ms\n", elapsed.nsecsElapsed() / 1e6);
+        if (lastHour(journal, "reopened") != expected)
+            ok = false;
+    }
+    QDir(path).removeRecursively();
+
+    options.compress = true;
+    {
+        EventJournal journal;
+        if (!journal.open(options)) {
+            fprintf(stderr, "journal: %s\n", qPrintable(journal.errorString()));
+            return 1;
+        }
+        const double rate = ingest(journal, eventCount / 4);
+        const EventJournal::Stats stats = journal.stats();
+        fprintf(stderr, "compressed: %llu events, %.1f MB of records stored in %.1f MB, %.0f events/s\n",
+                static_cast<unsigned long long>(stats.durableEvents), stats.rawBytes / 1048576.0,
+                stats.storedBytes / 1048576.0, rate);
+        if (lastHour(journal, "compressed") != expected)
+            ok = false;
+    }
+    QDir(path).removeRecursively();
+
+    // Timings vary with the machine, so only the counts decide the result
+    fprintf(stderr, "targets: ingest %.0f events/s of %.0f %s, slowest query %.3f ms of %.0f ms %s\n", ingestRate,
+            kTargetEventsPerSecond, ingestRate >= kTargetEventsPerSecond ? "met" : "MISSED", slowestQueryMs,
+            kQueryBudgetMs, slowestQueryMs <= kQueryBudgetMs ? "met" : "MISSED");
+    if (!ok)
+        fprintf(stderr, "expected %llu events in the last hour\n", static_cast<unsigned long long>(expected));
+    return ok ? 0 : 1;
+}
+
+// Journals <eventCount> scan results, one in 500 an alert, then scrolls
+// an EventLogModel through them as a view would: a frame is the 40 rows
+// on screen, moving a few rows at a time or jumping as if the scroll bar
+// were dragged. Reports the cost of a frame and how many rows stay
+// cached, then searches for one dropper before the search index is built
+// and after, and checks the hits.
+int benchmarkEventLog(quint64 eventCount)
+{
+    const int kVisibleRows = 40;
+    const int kFrames = 2000;
+    const int kDroppers = 1000;
+    eventCount = qBound<quint64>(10000, eventCount, 1000000000);
+    const QString path = QDir::temp().filePath("rhynec-bench-eventlog");
+    QDir(path).removeRecursively();
+
+    EventJournal journal;
+    EventJournal::Options options;
+    options.directory = path;
+    if (!journal.open(options)) {
+        fprintf(stderr, "journal: %s\n", qPrintable(journal.errorString()));
+        return 1;
+    }
+    const qint64 startUs = (QDateTime::currentMSecsSinceEpoch() - qint64(eventCount)) * 1000;
+    const QString needle = "DROPPER-77/";
+    quint64 expected = 0;
+    quint64 sequence = 0;
+    QElapsedTimer elapsed;
+    elapsed.start();
+    for (quint64 i = 0; i < eventCount; ++i) {
+        const qint64 timeUs = startUs + qint64(i) * 1000;
+        if (i % 500 == 0) {
+            const quint64 dropper = (i / 500) % kDroppers;
+            expected += dropper == 77 ? 1 : 0;
+            sequence = journal.append(EventJournal::SecurityAlert, timeUs,
+                                      QString("high entry_outside_code /tmp/dropper-%1/payload").arg(dropper).toUtf8());
+        } else {
+            sequence = journal.append(EventJournal::ScanResult, timeUs,
+                                      QString("clean elf /home/user/src/project%1/build/obj/unit%2.o")
+                                          .arg(i % 97)
+                                          .arg(i)
+                                          .toUtf8());
+        }
+    }
+    journal.waitForDurable(sequence);
+    const EventJournal::Stats stats = journal.stats();
+    fprintf(stderr, "%llu events journaled in %.1f s, %.1f MB\n", static_cast<unsigned long long>(eventCount),
+            elapsed.nsecsElapsed() / 1e9, stats.diskBytes / 1048576.0);
+
+    EventLogModel model(&journal);
+    std::mt19937 random(7);
+    LatencyHistogram frameNs;
+    int row = model.rowCount() - kVisibleRows;
+    for (int frame = 0; frame < kFrames; ++frame) {
+        // Mostly wheel steps up the log, every tenth frame a drag
+        if (frame % 10 == 0)
+            row = int(random() % quint32(model.rowCount() - kVisibleRows));
+        else
+            row = qMax(0, row - 3);
+        elapsed.start();
+        for (int r = row; r < row + kVisibleRows; ++r) {
+            for (int column = 0; column < EventLogModel::ColumnCount; ++column)
+                model.data(model.index(r, column));
+        }
+        frameNs.record(quint64(elapsed.nsecsElapsed()));
+    }
+    fprintf(stderr, "%d frames of %d rows: p50 %.0f us, p99 %.0f us, max %.2f ms; %d rows cached of %d\n", kFrames,
+            kVisibleRows, frameNs.percentile(50) / 1e3, frameNs.percentile(99) / 1e3, frameNs.max() / 1e6,
+            model.cachedPages() * EventLogModel::kPageRows, model.rowCount());
+
+    EventSearch search(&journal);
+    quint64 hits = 0;
+    quint64 searchId = 0;
+    qint64 firstHitNs = -1;
+    QEventLoop loop;
+    QObject::connect(&search, &EventSearch::hitsFound, &loop, [&](quint64 id, const QVector<EventSearchHit> &found) {
+        if (id != searchId)
+            return;
+        if (firstHitNs < 0)
+            firstHitNs = elapsed.nsecsElapsed();
+        for (const EventSearchHit &hit : found)
+            hits += hit.event.payload.contains("dropper-77/") ? 1 : 0;
+    });
+    QObject::connect(&search, &EventSearch::searchFinished, &loop,
+                     [&](quint64 id, quint64 pagesRead, quint64 pagesSkipped) {
+        if (id != searchId)
+            return;
+        fprintf(stderr, "  %llu hits, first after %.1f ms, all in %.1f ms; %llu pages read, %llu skipped\n",
+                static_cast<unsigned long long>(hits), firstHitNs / 1e6, elapsed.nsecsElapsed() / 1e6,
+                static_cast<unsigned long long>(pagesRead), static_cast<unsigned long long>(pagesSkipped));
+        loop.quit();
+    });
+    search.start();
+
+    bool ok = true;
+    auto find = [&](const char *label) {
+        fprintf(stderr, "search %s:\n", label);
+        hits = 0;
+        firstHitNs = -1;
+        elapsed.start();
+        searchId = search.search(needle, EventLogModel::kMaxHits);
+        loop.exec();
+        if (hits != expected) {
+            fprintf(stderr, "  expected %llu hits\n", static_cast<unsigned long long>(expected));
+            ok = false;
+        }
+    };
+    find("before indexing");
+
+    elapsed.start();
+    // All but the page still filling up at the end
+    while (search.indexedEvents() + EventSearch::kPageEvents <= eventCount)
+        QThread::msleep(10);
+    fprintf(stderr, "indexed in %.1f s\n", elapsed.nsecsElapsed() / 1e9);
+    find("with the index");
+
+    search.requestStop();
+    search.wait();
+    journal.close();
+    QDir(path).removeRecursively();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,797 @@
+#include "benchmarks.h"
+#include "chacha20poly1305.h"
+#include "servercatalogmodel.h"
+#include "vpnprober.h"
+#include "vpntunnel.h"
+#include <QDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QTimer>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <queue>
+#include <random>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Reference cycles from the time-stamp counter, or 0 where there is none
+quint64 cycleCount()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+} // namespace
+
+// Checks the RFC 8439 vectors, then seals <megabytes> of 64-byte,
+// 1400-byte and 64 KB packets on every AEAD path the CPU has, one packet
+// per call and in batches of 64, opens them in batches, and reports
+// cycles/byte (ns/byte without a TSC)
+int benchmarkAead(int megabytes)
+{
+    using ChaCha20Poly1305::Implementation;
+    using ChaCha20Poly1305::Packet;
+    const int kBatch = 64;
+    const size_t kSizes[] = { 64, 1400, 65536 };
+    const size_t kSlot = 65536 + ChaCha20Poly1305::kTagSize;
+    const quint64 target = quint64(qMax(1, megabytes)) << 20;
+
+    QString failure;
+    if (!ChaCha20Poly1305::selfTest(&failure)) {
+        fprintf(stderr, "aead: self-test: %s\n", qPrintable(failure));
+        return 1;
+    }
+    fprintf(stderr, "aead: RFC 8439 vectors pass on every path; default %s\n",
+            ChaCha20Poly1305::implementationName(ChaCha20Poly1305::implementation()));
+
+    std::mt19937 random(7);
+    std::vector<uchar> sealed(kSlot * kBatch);
+    std::vector<uchar> opened(kSlot * kBatch);
+    for (uchar &byte : sealed)
+        byte = uchar(random());
+    uchar key[ChaCha20Poly1305::kKeySize];
+    uchar nonces[kBatch][ChaCha20Poly1305::kNonceSize];
+    uchar ad[16];
+    for (uchar &byte : key)
+        byte = uchar(random());
+    for (int i = 0; i < kBatch; ++i) {
+        for (uchar &byte : nonces[i])
+            byte = uchar(random());
+    }
+    for (uchar &byte : ad)
+        byte = uchar(random());
+
+    const bool haveCycles = cycleCount() != 0;
+    const Implementation best = ChaCha20Poly1305::implementation();
+    int failures = 0;
+    for (Implementation path : { Implementation::Scalar, Implementation::Sse2, Implementation::Avx2, Implementation::Avx512 }) {
+        if (!ChaCha20Poly1305::setImplementation(path))
+            continue;
+        for (size_t size : kSizes) {
+            std::vector<Packet> seals(kBatch);
+            std::vector<Packet> opens(kBatch);
+            for (int i = 0; i < kBatch; ++i) {
+                uchar *slot = &sealed[kSlot * size_t(i)];
+                seals[i] = { nonces[i], ad, sizeof(ad), slot, slot, size, slot + size };
+                opens[i] = { nonces[i], ad, sizeof(ad), slot, &opened[kSlot * size_t(i)], size, slot + size };
+            }
+
+            // Cost per byte of one run: cycles (or ns) and Gbit/s
+            double cost[3];
+            double gbps[3];
+            for (int run = 0; run < 3; ++run) {
+                quint64 bytes = 0;
+                bool authentic[kBatch];
+                QElapsedTimer timer;
+                timer.start();
+                const quint64 start = cycleCount();
+                for (int i = 0; bytes < target; i = (i + 1) % kBatch) {
+                    if (run == 0) {
+                        const Packet &packet = seals[i];
+                        ChaCha20Poly1305::seal(key, packet.nonce, packet.ad, packet.adLength, packet.input,
+                                               packet.length, packet.output, packet.tag);
+                        bytes += size;
+                    } else if (run == 1) {
+                        ChaCha20Poly1305::sealBatch(key, seals.data(), kBatch);
+                        bytes += size * kBatch;
+                    } else {
+                        failures += kBatch - ChaCha20Poly1305::openBatch(key, opens.data(), kBatch, authentic);
+                        bytes += size * kBatch;
+                    }
+                }
+                const qint64 ns = qMax<qint64>(1, timer.nsecsElapsed());
+                cost[run] = double(haveCycles ? cycleCount() - start : quint64(ns)) / double(bytes);
+                gbps[run] = double(bytes) * 8 / double(ns);
+            }
+            const char *unit = haveCycles ? "c/B" : "ns/B";
+            fprintf(stderr, "aead: %-7s %5llu B: seal %.2f %s (%.2f Gbit/s), batch of %d %.2f %s (%.2f Gbit/s), "
+                            "open batch %.2f %s (%.2f Gbit/s)\n",
+                    ChaCha20Poly1305::implementationName(path), static_cast<unsigned long long>(size),
+                    cost[0], unit, gbps[0], kBatch, cost[1], unit, gbps[1], cost[2], unit, gbps[2]);
+        }
+    }
+    ChaCha20Poly1305::setImplementation(best);
+    if (failures > 0) {
+        fprintf(stderr, "%d sealed packets failed to open\n", failures);
+        return 1;
+    }
+    return 0;
+}
+
+namespace {
+
+#ifdef Q_OS_LINUX
+
+// One end of the VPN benchmark: TUN queues and test sockets opened inside
+// a network namespace of its own, which they keep alive
+struct VpnBenchSide
+{
+    std::vector<int> tunFds;
+    int tcpFd = -1;
+    int udpFd = -1;
+    QString failure;
+
+    ~VpnBenchSide()
+    {
+        if (tcpFd >= 0)
+            ::close(tcpFd);
+        if (udpFd >= 0)
+            ::close(udpFd);
+    }
+
+    // Runs on a thread of its own: unshare() moves only the calling thread
+    void open(int queues, const char *interface, const char *address, quint32 serviceAddress, quint16 servicePort)
+    {
+        if (unshare(CLONE_NEWNET) < 0) {
+            failure = QString("unshare: %1").arg(strerror(errno));
+            return;
+        }
+        if (!VpnTunnel::openTun(interface, queues, &tunFds, &failure)
+            || !VpnTunnel::configureInterface(interface, address, VpnTunnel::Options().mtu, &failure))
+            return;
+        tcpFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        udpFd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (serviceAddress == 0)
+            return;
+        sockaddr_in service;
+        memset(&service, 0, sizeof(service));
+        service.sin_family = AF_INET;
+        service.sin_addr.s_addr = htonl(serviceAddress);
+        service.sin_port = htons(servicePort);
+        if (tcpFd < 0 || udpFd < 0 || bind(tcpFd, reinterpret_cast<sockaddr *>(&service), sizeof(service)) < 0
+            || listen(tcpFd, 4) < 0 || bind(udpFd, reinterpret_cast<sockaddr *>(&service), sizeof(service)) < 0)
+            failure = QString("service sockets: %1").arg(strerror(errno));
+    }
+};
+
+// Runs two tunnels in this process with their TUN devices in two fresh
+// network namespaces (10.99.0.1 and 10.99.0.2), carried over UDP on
+// loopback, and measures through them like iperf: round trips of small
+// UDP pings for per-packet latency, then one TCP stream for <seconds> for
+// throughput. Reports the queues' system calls per tunnel packet, both
+// ends together, and the I/O path they ended up on.
+int benchmarkVpnPath(int seconds, bool ioUring, double *syscallsPerPacket, QString *io)
+{
+    const int kQueues = qBound(1, QThread::idealThreadCount() / 2, 4);
+    const quint32 kAddressB = 0x0a630002;
+    const quint16 kServicePort = 5201;
+    const int kWarmupPings = 100;
+    const int kPings = 2000;
+    const int kChunkSize = 128 * 1024;
+
+    VpnBenchSide a;
+    VpnBenchSide b;
+    std::unique_ptr<QThread> setup(QThread::create([&a, kQueues]() {
+        a.open(kQueues, "rvpn-a", "10.99.0.1/24", 0, 0);
+    }));
+    setup->start();
+    setup->wait();
+    setup.reset(QThread::create([&b, kQueues, kAddressB, kServicePort]() {
+        b.open(kQueues, "rvpn-b", "10.99.0.2/24", kAddressB, kServicePort);
+    }));
+    setup->start();
+    setup->wait();
+    if (!a.failure.isEmpty() || !b.failure.isEmpty()) {
+        fprintf(stderr, "namespaces: %s\n", qPrintable(a.failure.isEmpty() ? b.failure : a.failure));
+        return 2;
+    }
+
+    // The transport stays in this namespace, on loopback
+    VpnTunnel::Options optionsA;
+    optionsA.key = VpnTunnel::generateKey();
+    optionsA.listenPort = 47100;
+    optionsA.peerAddress = "127.0.0.1";
+    optionsA.peerPort = 47200;
+    optionsA.ioUring = ioUring;
+    VpnTunnel::Options optionsB = optionsA;
+    std::swap(optionsB.listenPort, optionsB.peerPort);
+    std::vector<int> transportA;
+    std::vector<int> transportB;
+    QString failure;
+    if (!VpnTunnel::openTransport(optionsA, kQueues, &transportA, &failure)
+        || !VpnTunnel::openTransport(optionsB, kQueues, &transportB, &failure)) {
+        fprintf(stderr, "transport: %s\n", qPrintable(failure));
+        for (int fd : transportA)
+            ::close(fd);
+        return 2;
+    }
+    VpnTunnel tunnelA;
+    VpnTunnel tunnelB;
+    tunnelA.setOptions(optionsA);
+    tunnelB.setOptions(optionsB);
+    tunnelA.adoptQueues(a.tunFds, transportA);
+    tunnelB.adoptQueues(b.tunFds, transportB);
+    QObject::connect(&tunnelA, &VpnTunnel::error, [&failure](const QString &message) { failure = message; });
+    QObject::connect(&tunnelB, &VpnTunnel::error, [&failure](const QString &message) { failure = message; });
+    tunnelA.start();
+    tunnelB.start();
+    // Packets before the session keys are dropped, so wait for every queue
+    QElapsedTimer handshake;
+    handshake.start();
+    while ((tunnelA.stats().sessions < kQueues || tunnelB.stats().sessions < kQueues) && handshake.elapsed() < 5000)
+        QThread::msleep(10);
+
+    std::atomic<bool> stopEcho { false };
+    std::unique_ptr<QThread> echo(QThread::create([&b, &stopEcho]() {
+        uchar packet[2048];
+        while (!stopEcho.load()) {
+            pollfd readable = { b.udpFd, POLLIN, 0 };
+            if (poll(&readable, 1, 100) <= 0)
+                continue;
+            sockaddr_storage from;
+            socklen_t fromLength = sizeof(from);
+            const ssize_t length = recvfrom(b.udpFd, packet, sizeof(packet), 0, reinterpret_cast<sockaddr *>(&from), &fromLength);
+            if (length > 0)
+                sendto(b.udpFd, packet, size_t(length), 0, reinterpret_cast<sockaddr *>(&from), fromLength);
+        }
+    }));
+    echo->start();
+
+    sockaddr_in service;
+    memset(&service, 0, sizeof(service));
+    service.sin_family = AF_INET;
+    service.sin_addr.s_addr = htonl(kAddressB);
+    service.sin_port = htons(kServicePort);
+    const timeval timeout = { 1, 0 };
+    setsockopt(a.udpFd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    ::connect(a.udpFd, reinterpret_cast<sockaddr *>(&service), sizeof(service));
+    LatencyHistogram roundTrips;
+    int lost = 0;
+    uchar ping[64] = {};
+    QElapsedTimer clock;
+    for (int i = 0; i < kWarmupPings + kPings; ++i) {
+        clock.start();
+        send(a.udpFd, ping, sizeof(ping), 0);
+        if (recv(a.udpFd, ping, sizeof(ping), 0) != ssize_t(sizeof(ping))) {
+            ++lost;
+            continue;
+        }
+        if (i >= kWarmupPings)
+            roundTrips.record(quint64(clock.nsecsElapsed()));
+    }
+    stopEcho.store(true);
+    echo->wait();
+
+    quint64 received = 0;
+    qint64 receiveNs = 0;
+    std::unique_ptr<QThread> sink(QThread::create([&b, &received, &receiveNs]() {
+        const int connection = accept(b.tcpFd, nullptr, nullptr);
+        if (connection < 0)
+            return;
+        std::unique_ptr<uchar[]> buffer(new uchar[1 << 18]);
+        QElapsedTimer sinkClock;
+        while (true) {
+            const ssize_t length = recv(connection, buffer.get(), 1 << 18, 0);
+            if (length <= 0)
+                break;
+            if (received == 0)
+                sinkClock.start();
+            received += quint64(length);
+        }
+        receiveNs = sinkClock.isValid() ? sinkClock.nsecsElapsed() : 0;
+        ::close(connection);
+    }));
+    sink->start();
+    const VpnStats before = tunnelA.stats();
+    if (::connect(a.tcpFd, reinterpret_cast<sockaddr *>(&service), sizeof(service)) == 0) {
+        std::unique_ptr<uchar[]> chunk(new uchar[kChunkSize]());
+        clock.start();
+        while (clock.elapsed() < qint64(seconds) * 1000) {
+            if (send(a.tcpFd, chunk.get(), kChunkSize, MSG_NOSIGNAL) < 0)
+                break;
+        }
+    } else {
+        failure = QString("connect through the tunnel: %1").arg(strerror(errno));
+    }
+    shutdown(a.tcpFd, SHUT_RDWR);
+    ::close(a.tcpFd);
+    a.tcpFd = -1;
+    // Unblocks accept() if the connect never arrived
+    shutdown(b.tcpFd, SHUT_RDWR);
+    sink->wait();
+
+    tunnelA.requestStop();
+    tunnelB.requestStop();
+    tunnelA.wait();
+    tunnelB.wait();
+    const VpnStats statsA = tunnelA.stats();
+    const VpnStats statsB = tunnelB.stats();
+    if (!failure.isEmpty()) {
+        fprintf(stderr, "%s\n", qPrintable(failure));
+        return 2;
+    }
+
+    const quint64 packets = statsA.txPackets - before.txPackets;
+    const quint64 allPackets = qMax<quint64>(statsA.txPackets + statsB.txPackets, 1);
+    *syscallsPerPacket = double(statsA.syscalls + statsB.syscalls) / double(allPackets);
+    *io = statsA.io;
+    fprintf(stderr, "%s: %d queues per end, GSO %s, GRO %s, %llu handshakes\n", qPrintable(statsA.io), statsA.queues,
+            statsA.gso ? "on" : "off", statsB.gro ? "on" : "off",
+            static_cast<unsigned long long>(statsA.handshakes + statsB.handshakes));
+    fprintf(stderr, "latency: %d pings, round trip p50 %.1f us p99 %.1f us, %d lost\n", kPings,
+            roundTrips.percentile(50) / 1000.0, roundTrips.percentile(99) / 1000.0, lost);
+    fprintf(stderr, "throughput: %.2f GB in %.2f s: %.2f Gbit/s over TCP, %.0f tunnel packets/s\n",
+            received / 1e9, receiveNs / 1e9, receiveNs > 0 ? double(received) * 8 / double(receiveNs) : 0.0,
+            receiveNs > 0 ? double(packets) * 1e9 / double(receiveNs) : 0.0);
+    fprintf(stderr, "sender: %.2f TUN reads, %.3f sends per packet; receiver: %.3f receives per packet, "
+            "%llu dropped, %llu failed authentication\n",
+            double(statsA.tunReads) / double(qMax<quint64>(statsA.txPackets, 1)),
+            double(statsA.sendCalls) / double(qMax<quint64>(statsA.txPackets, 1)),
+            double(statsB.receiveCalls) / double(qMax<quint64>(statsB.rxPackets, 1)),
+            static_cast<unsigned long long>(statsA.dropped + statsB.dropped),
+            static_cast<unsigned long long>(statsA.authFailures + statsB.authFailures));
+    fprintf(stderr, "system calls: %.3f per tunnel packet, waits included\n", *syscallsPerPacket);
+    return lost == 0 && received > 0 ? 0 : 1;
+}
+
+#endif
+
+} // namespace
+
+// The VPN benchmark on the poll() loop, then on io_uring. Needs
+// CAP_NET_ADMIN.
+int benchmarkVpn(int seconds)
+{
+#ifdef Q_OS_LINUX
+    double pollCalls = 0;
+    double ringCalls = 0;
+    QString pollIo;
+    QString ringIo;
+    const int pollResult = benchmarkVpnPath(seconds, false, &pollCalls, &pollIo);
+    if (pollResult == 2)
+        return 2;
+    const int ringResult = benchmarkVpnPath(seconds, true, &ringCalls, &ringIo);
+    if (ringResult == 2)
+        return 2;
+    if (ringIo == "io_uring" && ringCalls > 0)
+        fprintf(stderr, "io_uring: %.3f against %.3f system calls per packet, %.1fx fewer\n", ringCalls, pollCalls,
+                pollCalls / ringCalls);
+    return qMax(pollResult, ringResult);
+#else
+    Q_UNUSED(seconds);
+    fprintf(stderr, "The VPN benchmark requires Linux\n");
+    return 2;
+#endif
+}
+
+namespace {
+
+#ifdef Q_OS_LINUX
+
+// Stand-ins for VPN servers on 127.0.0.1, one UDP socket each, that echo
+// probes after an injected delay plus jitter and drop some outright
+class StandInProbeServers : public QThread
+{
+public:
+    ~StandInProbeServers()
+    {
+        stopRequested.store(true);
+        wait();
+        for (const pollfd &entry : fds)
+            ::close(entry.fd);
+    }
+
+    // Server i answers after delaysMs[i] plus up to jittersMs[i], and
+    // drops a losses[i] fraction of probes
+    bool open(const std::vector<double> &delaysMs, const std::vector<double> &jittersMs, const std::vector<double> &losses)
+    {
+        delays = delaysMs;
+        jitters = jittersMs;
+        lossRates = losses;
+        for (size_t i = 0; i < delays.size(); ++i) {
+            const int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (fd < 0)
+                return false;
+            fds.push_back({ fd, POLLIN, 0 });
+            sockaddr_in address;
+            memset(&address, 0, sizeof(address));
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            socklen_t length = sizeof(address);
+            if (bind(fd, reinterpret_cast<sockaddr *>(&address), length) < 0
+                || getsockname(fd, reinterpret_cast<sockaddr *>(&address), &length) < 0)
+                return false;
+            ports.push_back(ntohs(address.sin_port));
+        }
+        return true;
+    }
+
+    quint16 port(int server) const { return ports[size_t(server)]; }
+
+protected:
+    void run() override
+    {
+        struct Reply
+        {
+            qint64 dueNs;
+            int server;
+            sockaddr_in client;
+            uchar datagram[VpnTunnel::kHeaderSize];
+            bool operator>(const Reply &other) const { return dueNs > other.dueNs; }
+        };
+        std::priority_queue<Reply, std::vector<Reply>, std::greater<Reply>> pending;
+        std::mt19937_64 random(2);
+        std::uniform_real_distribution<double> uniform(0, 1);
+        QElapsedTimer clock;
+        clock.start();
+        while (!stopRequested.load()) {
+            qint64 now = clock.nsecsElapsed();
+            while (!pending.empty() && pending.top().dueNs <= now) {
+                const Reply &reply = pending.top();
+                sendto(fds[size_t(reply.server)].fd, reply.datagram, sizeof(reply.datagram), 0,
+                       reinterpret_cast<const sockaddr *>(&reply.client), sizeof(reply.client));
+                pending.pop();
+            }
+            const qint64 waitNs = pending.empty() ? 1000000 : qMin<qint64>(1000000, pending.top().dueNs - now);
+            const timespec timeout = { 0, long(waitNs) };
+            if (ppoll(fds.data(), nfds_t(fds.size()), &timeout, nullptr) <= 0)
+                continue;
+            now = clock.nsecsElapsed();
+            for (size_t i = 0; i < fds.size(); ++i) {
+                if (!(fds[i].revents & POLLIN))
+                    continue;
+                Reply reply;
+                socklen_t clientLength = sizeof(reply.client);
+                while (recvfrom(fds[i].fd, reply.datagram, sizeof(reply.datagram), 0,
+                                reinterpret_cast<sockaddr *>(&reply.client), &clientLength) == ssize_t(sizeof(reply.datagram))) {
+                    clientLength = sizeof(reply.client);
+                    if (reply.datagram[0] != VpnTunnel::kProbeType || uniform(random) < lossRates[i])
+                        continue;
+                    reply.datagram[0] = VpnTunnel::kProbeReplyType;
+                    reply.server = int(i);
+                    reply.dueNs = now + qint64((delays[i] + jitters[i] * uniform(random)) * 1e6);
+                    pending.push(reply);
+                }
+            }
+        }
+    }
+
+private:
+    std::vector<pollfd> fds;
+    std::vector<quint16> ports;
+    std::vector<double> delays;
+    std::vector<double> jitters;
+    std::vector<double> lossRates;
+    std::atomic<bool> stopRequested { false };
+};
+
+#endif
+
+} // namespace
+
+// Probes <serverCount> stand-in servers on loopback with injected delays
+// of 1-49 ms, jitter and loss for a few seconds, then checks the ranking
+// against what was injected and that a second prober, started from the
+// saved cache, has the same best server before sending anything
+int benchmarkProbe(int serverCount)
+{
+#ifdef Q_OS_LINUX
+    const int kSeconds = 6;
+    const double kLossRate = 0.2;
+    serverCount = qBound(2, serverCount, 5000);
+
+    std::vector<double> delays;
+    std::vector<double> jitters;
+    std::vector<double> losses;
+    for (int i = 0; i < serverCount; ++i) {
+        delays.push_back(1 + (i * 37 % 97) * 0.5);
+        jitters.push_back((i % 4) * 0.5);
+        losses.push_back(i % 10 == 0 ? kLossRate : 0);
+    }
+    StandInProbeServers standIns;
+    if (!standIns.open(delays, jitters, losses)) {
+        fprintf(stderr, "stand-ins: %s\n", strerror(errno));
+        return 2;
+    }
+    standIns.start();
+
+    QVector<VpnServer> servers;
+    for (int i = 0; i < serverCount; ++i)
+        servers.append({ QString("stand-in %1").arg(i), "127.0.0.1", standIns.port(i) });
+
+    VpnProber prober;
+    VpnProber::Options options;
+    options.intervalMs = 500;
+    options.timeoutMs = 250;
+    options.probesPerSecond = 4000;
+    prober.setOptions(options);
+    prober.setServers(servers);
+
+    quint64 updates = 0;
+    quint64 moves = 0;
+    std::vector<char> seen(size_t(serverCount), 0);
+    int measured = 0;
+    qint64 allMeasuredMs = -1;
+    QElapsedTimer elapsed;
+    QObject::connect(&prober, &VpnProber::latencyUpdated, [&](int server, int fromRank, int toRank) {
+        ++updates;
+        moves += fromRank != toRank ? 1 : 0;
+        if (prober.latency(server).measured() && !seen[size_t(server)]) {
+            seen[size_t(server)] = 1;
+            if (++measured == serverCount)
+                allMeasuredMs = elapsed.elapsed();
+        }
+    });
+    QEventLoop loop;
+    QTimer::singleShot(kSeconds * 1000, &loop, &QEventLoop::quit);
+    elapsed.start();
+    prober.start();
+    loop.exec();
+    prober.stop();
+
+    // What a lossless server should score: mean delay plus twice the mean
+    // deviation of its uniform jitter
+    auto expected = [&](int i) { return delays[size_t(i)] + jitters[size_t(i)]; };
+    quint64 sent = 0;
+    quint64 received = 0;
+    double errorSum = 0;
+    double errorMax = 0;
+    double lossyLoss = 0;
+    int lossyCount = 0;
+    for (int i = 0; i < serverCount; ++i) {
+        const ServerLatency &result = prober.latency(i);
+        sent += result.sent;
+        received += result.received;
+        const double error = result.measured() ? std::fabs(result.rttMs - delays[size_t(i)] - jitters[size_t(i)] / 2) : 1e9;
+        errorSum += error;
+        errorMax = qMax(errorMax, error);
+        if (losses[size_t(i)] > 0) {
+            lossyLoss += 1 - double(result.received) / double(qMax<quint32>(1, result.sent));
+            ++lossyCount;
+        }
+    }
+    // Lossless pairs whose injected scores differ clearly but rank the
+    // other way; a dozen probes say too little about a 20% loss rate to
+    // hold lossy servers to an order
+    int inversions = 0;
+    const std::vector<int> &ranking = prober.ranking();
+    for (int a = 0; a < serverCount; ++a) {
+        for (int b = a + 1; b < serverCount; ++b) {
+            if (losses[size_t(ranking[size_t(a)])] > 0 || losses[size_t(ranking[size_t(b)])] > 0)
+                continue;
+            const double better = expected(ranking[size_t(a)]);
+            const double worse = expected(ranking[size_t(b)]);
+            inversions += better > worse * 1.25 + 5 ? 1 : 0;
+        }
+    }
+    fprintf(stderr, "%d servers for %d s: %llu probes, %llu replies; all measured after %lld ms; "
+                    "%llu ranking updates, %llu moved a server\n",
+            serverCount, kSeconds, static_cast<unsigned long long>(sent), static_cast<unsigned long long>(received),
+            static_cast<long long>(allMeasuredMs), static_cast<unsigned long long>(updates),
+            static_cast<unsigned long long>(moves));
+    fprintf(stderr, "round trip error vs injected: mean %.2f ms, max %.2f ms; loss %.1f%% measured on %.0f%% injected; "
+                    "%d clear inversions; best is stand-in %d (injected %.1f ms)\n",
+            errorSum / serverCount, errorMax, 100.0 * lossyLoss / qMax(1, lossyCount), 100 * kLossRate, inversions,
+            prober.best(), prober.best() >= 0 ? delays[size_t(prober.best())] : 0.0);
+
+    const QString cachePath = QDir::temp().filePath("rhynec-bench-latency.cache");
+    VpnProber restored;
+    if (!prober.saveCache(cachePath) || !restored.loadCache(cachePath)) {
+        fprintf(stderr, "cache: %s\n", qPrintable(prober.errorString() + restored.errorString()));
+        return 2;
+    }
+    elapsed.start();
+    restored.setServers(servers);
+    const qint64 restoreNs = elapsed.nsecsElapsed();
+    QFile::remove(cachePath);
+    fprintf(stderr, "cache: ranking restored in %.1f us, best is stand-in %d\n", restoreNs / 1000.0, restored.best());
+    return inversions == 0 && restored.best() == prober.best() && prober.best() >= 0 ? 0 : 1;
+#else
+    Q_UNUSED(serverCount);
+    fprintf(stderr, "The probe benchmark requires Linux\n");
+    return 2;
+#endif
+}
+
+namespace {
+
+struct CatalogLocation
+{
+    const char *country;
+    const char *city;
+    const char *code;
+};
+
+const CatalogLocation kCatalogLocations[] = {
+    { "Germany", "Frankfurt", "de-fra" }, { "Germany", "Berlin", "de-ber" }, { "Netherlands", "Amsterdam", "nl-ams" },
+    { "United Kingdom", "London", "uk-lon" }, { "United Kingdom", "Manchester", "uk-man" }, { "France", "Paris", "fr-par" },
+    { "Switzerland", "Zurich", "ch-zrh" }, { "Sweden", "Stockholm", "se-sto" }, { "Norway", "Oslo", "no-osl" },
+    { "Poland", "Warsaw", "pl-waw" }, { "Spain", "Madrid", "es-mad" }, { "Italy", "Milan", "it-mil" },
+    { "United States", "New York", "us-nyc" }, { "United States", "Los Angeles", "us-lax" },
+    { "United States", "Chicago", "us-chi" }, { "United States", "Dallas", "us-dal" }, { "Canada", "Toronto", "ca-tor" },
+    { "Brazil", "Sao Paulo", "br-sao" }, { "Japan", "Tokyo", "jp-tyo" }, { "Singapore", "Singapore", "sg-sin" },
+    { "Australia", "Sydney", "au-syd" }, { "India", "Mumbai", "in-bom" }, { "South Africa", "Johannesburg", "za-jnb" },
+    { "Hong Kong", "Hong Kong", "hk-hkg" },
+};
+const char *const kCatalogFeatures[] = { "", "", "", "p2p", "streaming", "secure core" };
+
+// What ServerCatalog promises, checked the slow way on its own lines
+bool catalogLineMatches(const QByteArray &line, const QString &query)
+{
+    QByteArray words = query.toLower().toUtf8();
+    for (char &c : words) {
+        if (!((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || uchar(c) >= 0x80))
+            c = ' ';
+    }
+    for (const QByteArray &word : words.split(' ')) {
+        if (word.isEmpty())
+            continue;
+        bool found = false;
+        if (word.size() < 3) {
+            for (const QByteArray &lineWord : line.split(' '))
+                found = found || lineWord.startsWith(word);
+        } else {
+            const int maxEdits = word.size() >= 12 ? 2 : word.size() >= 6 ? 1 : 0;
+            std::vector<int> distance(size_t(word.size()) + 1);
+            for (int i = 0; i <= word.size(); ++i)
+                distance[size_t(i)] = i;
+            for (int j = 0; j < line.size() && !found; ++j) {
+                int diagonal = 0;
+                for (int i = 1; i <= word.size(); ++i) {
+                    const int above = distance[size_t(i)];
+                    distance[size_t(i)] = std::min({ above + 1, distance[size_t(i) - 1] + 1,
+                                                     diagonal + (word[i - 1] == line[j] ? 0 : 1) });
+                    diagonal = above;
+                }
+                found = distance[size_t(word.size())] <= maxEdits;
+            }
+        }
+        if (!found)
+            return false;
+    }
+    return true;
+}
+
+// The model's rows are exactly the matching servers in ranking order
+bool catalogRowsValid(const ServerCatalogModel &model, const VpnProber &prober)
+{
+    int expected = 0;
+    for (int server = 0; server < prober.servers().size(); ++server)
+        expected += catalogLineMatches(model.catalog().text(server), model.filter()) ? 1 : 0;
+    if (model.rowCount() != expected)
+        return false;
+    int lastRank = -1;
+    for (int row = 0; row < model.rowCount(); ++row) {
+        const int server = model.serverAt(row);
+        if (prober.rankOf(server) <= lastRank || !catalogLineMatches(model.catalog().text(server), model.filter()))
+            return false;
+        lastRank = prober.rankOf(server);
+    }
+    return true;
+}
+
+} // namespace
+
+// Indexes <entryCount> synthetic servers, types searches into the model a
+// key at a time (typos and backspaces included) and reports the time per
+// keystroke against a 2 ms budget, then feeds probe results into the
+// ranking with a search active. Every result is checked against a scan.
+int benchmarkCatalog(int entryCount)
+{
+    const double kBudgetMs = 2;
+    const int kUpdates = 200000;
+    entryCount = qBound(1, entryCount, 1000000);
+    const int locationCount = int(sizeof(kCatalogLocations) / sizeof(kCatalogLocations[0]));
+    const int featureCount = int(sizeof(kCatalogFeatures) / sizeof(kCatalogFeatures[0]));
+
+    std::mt19937 random(42);
+    QVector<VpnServer> servers;
+    servers.reserve(entryCount);
+    for (int i = 0; i < entryCount; ++i) {
+        const CatalogLocation &location = kCatalogLocations[random() % quint32(locationCount)];
+        VpnServer server;
+        server.name = QString("%1-%2 %3").arg(location.code).arg(random() % 1000, 3, 10, QChar('0'))
+                          .arg(kCatalogFeatures[random() % quint32(featureCount)]).trimmed();
+        server.address = QString("10.%1.%2.%3").arg(random() % 256).arg(random() % 256).arg(1 + random() % 254);
+        server.country = location.country;
+        server.city = location.city;
+        server.load = int(random() % 101);
+        servers.append(server);
+    }
+
+    VpnProber prober;
+    prober.setServers(servers);
+    // In list order, so each lands where it already is
+    std::vector<double> rtts;
+    for (int i = 0; i < entryCount; ++i) {
+        rtts.push_back(5 + 200.0 * i / entryCount);
+        prober.addResult(i, rtts.back());
+    }
+
+    ServerCatalogModel model(&prober);
+    QElapsedTimer elapsed;
+    elapsed.start();
+    model.reload();
+    const qint64 buildNs = elapsed.nsecsElapsed();
+    fprintf(stderr, "%d servers indexed in %.1f ms, %.1f MB\n", entryCount, buildNs / 1e6,
+            model.catalog().memoryBytes() / 1048576.0);
+
+    // Each typed a key at a time after erasing the one before; '<' is a
+    // backspace
+    const char *const typed[] = { "frankfurt", "germany berlin", "new york", "amsterdm", "switzerlnd zurich",
+                                  "us-nyc-01", "10.20", "p2p japan", "stockholm<<<<<<<<<stockholm", "united kingdom lond",
+                                  "streming", "de-fra-1<2", "secure core zurich", "xyzzy", "johanesburg", "s" };
+    QString query;
+    std::vector<double> keystrokeMs;
+    int wrong = 0;
+    for (const char *text : typed) {
+        QString keys = QString(query.size(), QChar('<')) + QString::fromLatin1(text);
+        for (const QChar key : keys) {
+            if (key == '<')
+                query.chop(1);
+            else
+                query.append(key);
+            elapsed.start();
+            model.setFilter(query);
+            keystrokeMs.push_back(elapsed.nsecsElapsed() / 1e6);
+            if (!catalogRowsValid(model, prober)) {
+                fprintf(stderr, "wrong rows for \"%s\"\n", qPrintable(query));
+                ++wrong;
+            }
+        }
+        fprintf(stderr, "  \"%s\": %d matches\n", qPrintable(query), model.rowCount());
+    }
+    std::vector<double> sorted = keystrokeMs;
+    std::sort(sorted.begin(), sorted.end());
+    double sum = 0;
+    for (double ms : keystrokeMs)
+        sum += ms;
+    fprintf(stderr, "%zu keystrokes: mean %.3f ms, p99 %.3f ms, max %.3f ms (budget %.0f ms); %d wrong\n",
+            keystrokeMs.size(), sum / keystrokeMs.size(), sorted[sorted.size() * 99 / 100], sorted.back(), kBudgetMs,
+            wrong);
+
+    quint64 rowMoves = 0;
+    QObject::connect(&model, &QAbstractItemModel::rowsMoved, [&rowMoves]() { ++rowMoves; });
+    model.setFilter("de");
+    elapsed.start();
+    for (int i = 0; i < kUpdates; ++i) {
+        const int server = int(random() % quint32(entryCount));
+        const double jitter = (int(random() % 2001) - 1000) / 10000.0;
+        prober.addResult(server, random() % 50 == 0 ? -1 : rtts[size_t(server)] * (1 + jitter));
+    }
+    const qint64 updateNs = elapsed.nsecsElapsed();
+    const bool updatesValid = catalogRowsValid(model, prober);
+    fprintf(stderr, "%d probe results with \"de\" shown (%d rows): %.2f us each, %llu row moves; rows %s\n", kUpdates,
+            model.rowCount(), updateNs / 1000.0 / kUpdates, static_cast<unsigned long long>(rowMoves),
+            updatesValid ? "match the ranking" : "DO NOT match the ranking");
+    return wrong == 0 && updatesValid ? 0 : 1;
+}
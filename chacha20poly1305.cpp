@@ -0,0 +1,1171 @@
+#include "chacha20poly1305.h"
+#include <QByteArray>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+// The SIMD paths need GCC or Clang function targets; elsewhere only the
+// scalar path is built
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CHACHA_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+using ChaCha20Poly1305::Implementation;
+using ChaCha20Poly1305::Packet;
+
+const int kMaxChaChaLanes = 16;
+const int kMaxPolyLanes = 8;
+// Packets per batch pass, bounding the stack used for one-time keys
+const int kBatchChunk = 64;
+// A message splits into interleaved Poly1305 streams once every lane
+// gets this many blocks, to pay for computing the powers of r
+const size_t kMinStreamBlocks = 4;
+
+const quint32 kSigma[4] = { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574 };
+alignas(64) const uchar kZeroBlock[64] = {};
+
+inline quint32 load32(const uchar *p)
+{
+    return quint32(p[0]) | quint32(p[1]) << 8 | quint32(p[2]) << 16 | quint32(p[3]) << 24;
+}
+
+inline void store32(uchar *p, quint32 v)
+{
+    p[0] = uchar(v);
+    p[1] = uchar(v >> 8);
+    p[2] = uchar(v >> 16);
+    p[3] = uchar(v >> 24);
+}
+
+inline quint32 rotl(quint32 v, int n)
+{
+    return (v << n) | (v >> (32 - n));
+}
+
+// Poly1305 state of every lane in 26-bit limbs, limb-major so that a
+// kernel loads one limb of all its lanes as one vector
+struct PolyLanes
+{
+    alignas(64) quint64 h[5][kMaxPolyLanes];
+    alignas(64) quint64 r[5][kMaxPolyLanes];
+};
+
+// Lane kernels. A ChaCha20 kernel runs one block per lane: lane j takes
+// state words 12 to 15 (counter and nonce) from words[k * kMaxChaChaLanes
+// + j] and XORs its keystream over the 64 bytes at in[j] into out[j]. A
+// Poly1305 kernel runs `blocks` steps h = (h + m) * r on every lane, lane
+// j reading the 16-byte blocks at m[j], m[j] + stride, ...
+typedef void (*ChaChaKernel)(const quint32 *key, const quint32 *words, const uchar *const *in, uchar *const *out);
+typedef void (*PolyKernel)(PolyLanes *lanes, const uchar *const *m, size_t stride, size_t blocks);
+
+struct Kernels
+{
+    Implementation implementation;
+    int chachaLanes;
+    ChaChaKernel chacha;
+    int polyLanes;              // 1 for scalar Poly1305 only
+    PolyKernel poly;
+    const Kernels *narrower;    // Cheaper for a few ChaCha20 blocks
+};
+
+#define QUARTERROUND(a, b, c, d) \
+    a += b; d = rotl(d ^ a, 16);  \
+    c += d; b = rotl(b ^ c, 12);  \
+    a += b; d = rotl(d ^ a, 8);   \
+    c += d; b = rotl(b ^ c, 7);
+
+void chachaBlock(const quint32 input[16], uchar out[64])
+{
+    quint32 x[16];
+    memcpy(x, input, sizeof(x));
+    for (int i = 0; i < 10; ++i) {
+        QUARTERROUND(x[0], x[4], x[8], x[12]);
+        QUARTERROUND(x[1], x[5], x[9], x[13]);
+        QUARTERROUND(x[2], x[6], x[10], x[14]);
+        QUARTERROUND(x[3], x[7], x[11], x[15]);
+        QUARTERROUND(x[0], x[5], x[10], x[15]);
+        QUARTERROUND(x[1], x[6], x[11], x[12]);
+        QUARTERROUND(x[2], x[7], x[8], x[13]);
+        QUARTERROUND(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < 16; ++i)
+        store32(out + 4 * i, x[i] + input[i]);
+}
+
+#undef QUARTERROUND
+
+void chachaScalar(const quint32 *key, const quint32 *words, const uchar *const *in, uchar *const *out)
+{
+    quint32 state[16];
+    memcpy(state, kSigma, sizeof(kSigma));
+    memcpy(state + 4, key, 8 * sizeof(quint32));
+    for (int i = 0; i < 4; ++i)
+        state[12 + i] = words[kMaxChaChaLanes * i];
+    uchar block[64];
+    chachaBlock(state, block);
+    for (int i = 0; i < 64; ++i)
+        out[0][i] = in[0][i] ^ block[i];
+}
+
+#ifdef CHACHA_X86_SIMD
+
+// The ChaCha20 rounds on whole vectors, each holding one state word of
+// every lane's block
+#define LANE_QUARTERROUND(ADD, XOR, ROTL, a, b, c, d) \
+    a = ADD(a, b); d = ROTL(XOR(d, a), 16);          \
+    c = ADD(c, d); b = ROTL(XOR(b, c), 12);          \
+    a = ADD(a, b); d = ROTL(XOR(d, a), 8);           \
+    c = ADD(c, d); b = ROTL(XOR(b, c), 7);
+
+#define LANE_DOUBLEROUND(ADD, XOR, ROTL, x)                             \
+    LANE_QUARTERROUND(ADD, XOR, ROTL, x[0], x[4], x[8], x[12])          \
+    LANE_QUARTERROUND(ADD, XOR, ROTL, x[1], x[5], x[9], x[13])          \
+    LANE_QUARTERROUND(ADD, XOR, ROTL, x[2], x[6], x[10], x[14])         \
+    LANE_QUARTERROUND(ADD, XOR, ROTL, x[3], x[7], x[11], x[15])         \
+    LANE_QUARTERROUND(ADD, XOR, ROTL, x[0], x[5], x[10], x[15])         \
+    LANE_QUARTERROUND(ADD, XOR, ROTL, x[1], x[6], x[11], x[12])         \
+    LANE_QUARTERROUND(ADD, XOR, ROTL, x[2], x[7], x[8], x[13])          \
+    LANE_QUARTERROUND(ADD, XOR, ROTL, x[3], x[4], x[9], x[14])
+
+// One Poly1305 step on every lane, from the message block split into its
+// low and high 64 bits; MUL multiplies the low 32 bits of 64-bit lanes
+#define LANE_POLY_STEP(ADD, MUL, AND, OR, SHL, SHR, lo, hi, h, r, s, mask, hibit)              \
+    {                                                                                           \
+        h[0] = ADD(h[0], AND(lo, mask));                                                        \
+        h[1] = ADD(h[1], AND(SHR(lo, 26), mask));                                               \
+        h[2] = ADD(h[2], AND(OR(SHR(lo, 52), SHL(hi, 12)), mask));                              \
+        h[3] = ADD(h[3], AND(SHR(hi, 14), mask));                                               \
+        h[4] = ADD(h[4], OR(SHR(hi, 40), hibit));                                               \
+        const auto d0 = ADD(ADD(ADD(MUL(h[0], r[0]), MUL(h[1], s[4])), ADD(MUL(h[2], s[3]), MUL(h[3], s[2]))), MUL(h[4], s[1])); \
+        auto d1 = ADD(ADD(ADD(MUL(h[0], r[1]), MUL(h[1], r[0])), ADD(MUL(h[2], s[4]), MUL(h[3], s[3]))), MUL(h[4], s[2])); \
+        auto d2 = ADD(ADD(ADD(MUL(h[0], r[2]), MUL(h[1], r[1])), ADD(MUL(h[2], r[0]), MUL(h[3], s[4]))), MUL(h[4], s[3])); \
+        auto d3 = ADD(ADD(ADD(MUL(h[0], r[3]), MUL(h[1], r[2])), ADD(MUL(h[2], r[1]), MUL(h[3], r[0]))), MUL(h[4], s[4])); \
+        auto d4 = ADD(ADD(ADD(MUL(h[0], r[4]), MUL(h[1], r[3])), ADD(MUL(h[2], r[2]), MUL(h[3], r[1]))), MUL(h[4], r[0])); \
+        auto c = SHR(d0, 26);                                                                   \
+        h[0] = AND(d0, mask);                                                                   \
+        d1 = ADD(d1, c); c = SHR(d1, 26); h[1] = AND(d1, mask);                                 \
+        d2 = ADD(d2, c); c = SHR(d2, 26); h[2] = AND(d2, mask);                                 \
+        d3 = ADD(d3, c); c = SHR(d3, 26); h[3] = AND(d3, mask);                                 \
+        d4 = ADD(d4, c); c = SHR(d4, 26); h[4] = AND(d4, mask);                                 \
+        h[0] = ADD(h[0], ADD(c, SHL(c, 2)));                                                    \
+        c = SHR(h[0], 26);                                                                      \
+        h[0] = AND(h[0], mask);                                                                 \
+        h[1] = ADD(h[1], c);                                                                    \
+    }
+
+// SSE2: 4 ChaCha20 lanes, 2 Poly1305 lanes
+
+#define SSE2_ROTL(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+
+// Turns four vectors of one word per block into four blocks of four words
+__attribute__((target("sse2"))) inline void transpose4(__m128i &a, __m128i &b, __m128i &c, __m128i &d)
+{
+    const __m128i t0 = _mm_unpacklo_epi32(a, b);
+    const __m128i t1 = _mm_unpackhi_epi32(a, b);
+    const __m128i t2 = _mm_unpacklo_epi32(c, d);
+    const __m128i t3 = _mm_unpackhi_epi32(c, d);
+    a = _mm_unpacklo_epi64(t0, t2);
+    b = _mm_unpackhi_epi64(t0, t2);
+    c = _mm_unpacklo_epi64(t1, t3);
+    d = _mm_unpackhi_epi64(t1, t3);
+}
+
+__attribute__((target("sse2"))) inline void xorStore(const uchar *in, uchar *out, __m128i keystream)
+{
+    const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_xor_si128(data, keystream));
+}
+
+__attribute__((target("sse2")))
+void chachaSse2(const quint32 *key, const quint32 *words, const uchar *const *in, uchar *const *out)
+{
+    __m128i s[16];
+    __m128i x[16];
+    for (int i = 0; i < 4; ++i)
+        s[i] = _mm_set1_epi32(int(kSigma[i]));
+    for (int i = 0; i < 8; ++i)
+        s[4 + i] = _mm_set1_epi32(int(key[i]));
+    for (int i = 0; i < 4; ++i)
+        s[12 + i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(words + kMaxChaChaLanes * i));
+    for (int i = 0; i < 16; ++i)
+        x[i] = s[i];
+    for (int i = 0; i < 10; ++i) {
+        LANE_DOUBLEROUND(_mm_add_epi32, _mm_xor_si128, SSE2_ROTL, x)
+    }
+    for (int i = 0; i < 16; ++i)
+        x[i] = _mm_add_epi32(x[i], s[i]);
+
+    // x[4q + k] becomes words 4q to 4q + 3 of block k
+    for (int q = 0; q < 16; q += 4)
+        transpose4(x[q], x[q + 1], x[q + 2], x[q + 3]);
+    for (int k = 0; k < 4; ++k) {
+        for (int q = 0; q < 4; ++q)
+            xorStore(in[k] + 16 * q, out[k] + 16 * q, x[4 * q + k]);
+    }
+}
+
+__attribute__((target("sse2")))
+void polySse2(PolyLanes *lanes, const uchar *const *m, size_t stride, size_t blocks)
+{
+    __m128i hv[5];
+    __m128i rv[5];
+    __m128i sv[5];
+    for (int i = 0; i < 5; ++i) {
+        hv[i] = _mm_load_si128(reinterpret_cast<const __m128i *>(lanes->h[i]));
+        rv[i] = _mm_load_si128(reinterpret_cast<const __m128i *>(lanes->r[i]));
+        sv[i] = _mm_add_epi64(rv[i], _mm_slli_epi64(rv[i], 2));
+    }
+    const __m128i mask = _mm_set1_epi64x(0x3ffffff);
+    const __m128i hibit = _mm_set1_epi64x(1 << 24);
+    for (size_t n = 0; n < blocks; ++n) {
+        const size_t offset = n * stride;
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(m[0] + offset));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(m[1] + offset));
+        const __m128i lo = _mm_unpacklo_epi64(a, b);
+        const __m128i hi = _mm_unpackhi_epi64(a, b);
+        LANE_POLY_STEP(_mm_add_epi64, _mm_mul_epu32, _mm_and_si128, _mm_or_si128, _mm_slli_epi64, _mm_srli_epi64,
+                       lo, hi, hv, rv, sv, mask, hibit)
+    }
+    for (int i = 0; i < 5; ++i)
+        _mm_store_si128(reinterpret_cast<__m128i *>(lanes->h[i]), hv[i]);
+}
+
+// AVX2: 8 ChaCha20 lanes, 4 Poly1305 lanes. Rotations by 16 and 8 are
+// byte shuffles.
+
+#define AVX2_ROTL(v, n) ((n) == 16 ? _mm256_shuffle_epi8(v, rotate16)                            \
+                         : (n) == 8 ? _mm256_shuffle_epi8(v, rotate8)                           \
+                         : _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n))))
+
+__attribute__((target("avx2"))) inline void transpose4(__m256i &a, __m256i &b, __m256i &c, __m256i &d)
+{
+    const __m256i t0 = _mm256_unpacklo_epi32(a, b);
+    const __m256i t1 = _mm256_unpackhi_epi32(a, b);
+    const __m256i t2 = _mm256_unpacklo_epi32(c, d);
+    const __m256i t3 = _mm256_unpackhi_epi32(c, d);
+    a = _mm256_unpacklo_epi64(t0, t2);
+    b = _mm256_unpackhi_epi64(t0, t2);
+    c = _mm256_unpacklo_epi64(t1, t3);
+    d = _mm256_unpackhi_epi64(t1, t3);
+}
+
+__attribute__((target("avx2"))) inline void xorStore(const uchar *in, uchar *out, __m256i keystream)
+{
+    const __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), _mm256_xor_si256(data, keystream));
+}
+
+__attribute__((target("avx2")))
+void chachaAvx2(const quint32 *key, const quint32 *words, const uchar *const *in, uchar *const *out)
+{
+    const __m256i rotate16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                                              2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const __m256i rotate8 = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+                                             3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+    __m256i s[16];
+    __m256i x[16];
+    for (int i = 0; i < 4; ++i)
+        s[i] = _mm256_set1_epi32(int(kSigma[i]));
+    for (int i = 0; i < 8; ++i)
+        s[4 + i] = _mm256_set1_epi32(int(key[i]));
+    for (int i = 0; i < 4; ++i)
+        s[12 + i] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(words + kMaxChaChaLanes * i));
+    for (int i = 0; i < 16; ++i)
+        x[i] = s[i];
+    for (int i = 0; i < 10; ++i) {
+        LANE_DOUBLEROUND(_mm256_add_epi32, _mm256_xor_si256, AVX2_ROTL, x)
+    }
+    for (int i = 0; i < 16; ++i)
+        x[i] = _mm256_add_epi32(x[i], s[i]);
+
+    // As with SSE2, per 128-bit half: the low half of x[4q + k] holds
+    // words of block k, the high half those of block k + 4
+    for (int q = 0; q < 16; q += 4)
+        transpose4(x[q], x[q + 1], x[q + 2], x[q + 3]);
+    for (int k = 0; k < 4; ++k) {
+        xorStore(in[k], out[k], _mm256_permute2x128_si256(x[k], x[4 + k], 0x20));
+        xorStore(in[k] + 32, out[k] + 32, _mm256_permute2x128_si256(x[8 + k], x[12 + k], 0x20));
+        xorStore(in[k + 4], out[k + 4], _mm256_permute2x128_si256(x[k], x[4 + k], 0x31));
+        xorStore(in[k + 4] + 32, out[k + 4] + 32, _mm256_permute2x128_si256(x[8 + k], x[12 + k], 0x31));
+    }
+}
+
+__attribute__((target("avx2")))
+void polyAvx2(PolyLanes *lanes, const uchar *const *m, size_t stride, size_t blocks)
+{
+    __m256i hv[5];
+    __m256i rv[5];
+    __m256i sv[5];
+    for (int i = 0; i < 5; ++i) {
+        hv[i] = _mm256_load_si256(reinterpret_cast<const __m256i *>(lanes->h[i]));
+        rv[i] = _mm256_load_si256(reinterpret_cast<const __m256i *>(lanes->r[i]));
+        sv[i] = _mm256_add_epi64(rv[i], _mm256_slli_epi64(rv[i], 2));
+    }
+    const __m256i mask = _mm256_set1_epi64x(0x3ffffff);
+    const __m256i hibit = _mm256_set1_epi64x(1 << 24);
+    for (size_t n = 0; n < blocks; ++n) {
+        const size_t offset = n * stride;
+        // Lanes 0 and 2 in a, 1 and 3 in b, so the unpacks keep lane order
+        const __m256i a = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(m[0] + offset))),
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(m[2] + offset)), 1);
+        const __m256i b = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(m[1] + offset))),
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(m[3] + offset)), 1);
+        const __m256i lo = _mm256_unpacklo_epi64(a, b);
+        const __m256i hi = _mm256_unpackhi_epi64(a, b);
+        LANE_POLY_STEP(_mm256_add_epi64, _mm256_mul_epu32, _mm256_and_si256, _mm256_or_si256, _mm256_slli_epi64,
+                       _mm256_srli_epi64, lo, hi, hv, rv, sv, mask, hibit)
+    }
+    for (int i = 0; i < 5; ++i)
+        _mm256_store_si256(reinterpret_cast<__m256i *>(lanes->h[i]), hv[i]);
+}
+
+// AVX-512: 16 ChaCha20 lanes, 8 Poly1305 lanes, with native rotations
+
+#define AVX512_ROTL(v, n) _mm512_rol_epi32(v, n)
+
+__attribute__((target("avx512f"))) inline void transpose4(__m512i &a, __m512i &b, __m512i &c, __m512i &d)
+{
+    const __m512i t0 = _mm512_unpacklo_epi32(a, b);
+    const __m512i t1 = _mm512_unpackhi_epi32(a, b);
+    const __m512i t2 = _mm512_unpacklo_epi32(c, d);
+    const __m512i t3 = _mm512_unpackhi_epi32(c, d);
+    a = _mm512_unpacklo_epi64(t0, t2);
+    b = _mm512_unpackhi_epi64(t0, t2);
+    c = _mm512_unpacklo_epi64(t1, t3);
+    d = _mm512_unpackhi_epi64(t1, t3);
+}
+
+__attribute__((target("avx512f"))) inline void xorStore(const uchar *in, uchar *out, __m512i keystream)
+{
+    const __m512i data = _mm512_loadu_si512(in);
+    _mm512_storeu_si512(out, _mm512_xor_si512(data, keystream));
+}
+
+__attribute__((target("avx512f")))
+void chachaAvx512(const quint32 *key, const quint32 *words, const uchar *const *in, uchar *const *out)
+{
+    __m512i s[16];
+    __m512i x[16];
+    for (int i = 0; i < 4; ++i)
+        s[i] = _mm512_set1_epi32(int(kSigma[i]));
+    for (int i = 0; i < 8; ++i)
+        s[4 + i] = _mm512_set1_epi32(int(key[i]));
+    for (int i = 0; i < 4; ++i)
+        s[12 + i] = _mm512_loadu_si512(words + kMaxChaChaLanes * i);
+    for (int i = 0; i < 16; ++i)
+        x[i] = s[i];
+    for (int i = 0; i < 10; ++i) {
+        LANE_DOUBLEROUND(_mm512_add_epi32, _mm512_xor_si512, AVX512_ROTL, x)
+    }
+    for (int i = 0; i < 16; ++i)
+        x[i] = _mm512_add_epi32(x[i], s[i]);
+
+    // Per 128-bit quarter, x[4q + k] now holds words of blocks k, k + 4,
+    // k + 8 and k + 12; a 4x4 transpose of quarters gathers each block
+    for (int q = 0; q < 16; q += 4)
+        transpose4(x[q], x[q + 1], x[q + 2], x[q + 3]);
+    for (int k = 0; k < 4; ++k) {
+        const __m512i t0 = _mm512_shuffle_i32x4(x[k], x[4 + k], 0x44);
+        const __m512i t1 = _mm512_shuffle_i32x4(x[k], x[4 + k], 0xee);
+        const __m512i t2 = _mm512_shuffle_i32x4(x[8 + k], x[12 + k], 0x44);
+        const __m512i t3 = _mm512_shuffle_i32x4(x[8 + k], x[12 + k], 0xee);
+        xorStore(in[k], out[k], _mm512_shuffle_i32x4(t0, t2, 0x88));
+        xorStore(in[k + 4], out[k + 4], _mm512_shuffle_i32x4(t0, t2, 0xdd));
+        xorStore(in[k + 8], out[k + 8], _mm512_shuffle_i32x4(t1, t3, 0x88));
+        xorStore(in[k + 12], out[k + 12], _mm512_shuffle_i32x4(t1, t3, 0xdd));
+    }
+}
+
+__attribute__((target("avx512f")))
+void polyAvx512(PolyLanes *lanes, const uchar *const *m, size_t stride, size_t blocks)
+{
+    __m512i hv[5];
+    __m512i rv[5];
+    __m512i sv[5];
+    for (int i = 0; i < 5; ++i) {
+        hv[i] = _mm512_load_si512(lanes->h[i]);
+        rv[i] = _mm512_load_si512(lanes->r[i]);
+        sv[i] = _mm512_add_epi64(rv[i], _mm512_slli_epi64(rv[i], 2));
+    }
+    const __m512i mask = _mm512_set1_epi64(0x3ffffff);
+    const __m512i hibit = _mm512_set1_epi64(1 << 24);
+    for (size_t n = 0; n < blocks; ++n) {
+        const size_t offset = n * stride;
+        __m128i block[8];
+        for (int j = 0; j < 8; ++j)
+            block[j] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(m[j] + offset));
+        // Even lanes in a, odd in b, a quarter each
+        __m512i a = _mm512_castsi128_si512(block[0]);
+        __m512i b = _mm512_castsi128_si512(block[1]);
+        a = _mm512_inserti32x4(a, block[2], 1);
+        b = _mm512_inserti32x4(b, block[3], 1);
+        a = _mm512_inserti32x4(a, block[4], 2);
+        b = _mm512_inserti32x4(b, block[5], 2);
+        a = _mm512_inserti32x4(a, block[6], 3);
+        b = _mm512_inserti32x4(b, block[7], 3);
+        const __m512i lo = _mm512_unpacklo_epi64(a, b);
+        const __m512i hi = _mm512_unpackhi_epi64(a, b);
+        LANE_POLY_STEP(_mm512_add_epi64, _mm512_mul_epu32, _mm512_and_si512, _mm512_or_si512, _mm512_slli_epi64,
+                       _mm512_srli_epi64, lo, hi, hv, rv, sv, mask, hibit)
+    }
+    for (int i = 0; i < 5; ++i)
+        _mm512_store_si512(lanes->h[i], hv[i]);
+}
+
+#undef LANE_QUARTERROUND
+#undef LANE_DOUBLEROUND
+#undef LANE_POLY_STEP
+
+#endif // CHACHA_X86_SIMD
+
+const Kernels kScalarKernels = { Implementation::Scalar, 1, chachaScalar, 1, nullptr, nullptr };
+#ifdef CHACHA_X86_SIMD
+const Kernels kSse2Kernels = { Implementation::Sse2, 4, chachaSse2, 2, polySse2, nullptr };
+const Kernels kAvx2Kernels = { Implementation::Avx2, 8, chachaAvx2, 4, polyAvx2, &kSse2Kernels };
+const Kernels kAvx512Kernels = { Implementation::Avx512, 16, chachaAvx512, 8, polyAvx512, &kAvx2Kernels };
+#endif
+
+const Kernels &kernelsFor(Implementation implementation)
+{
+    switch (implementation) {
+#ifdef CHACHA_X86_SIMD
+    case Implementation::Sse2:
+        return kSse2Kernels;
+    case Implementation::Avx2:
+        return kAvx2Kernels;
+    case Implementation::Avx512:
+        return kAvx512Kernels;
+#endif
+    default:
+        return kScalarKernels;
+    }
+}
+
+std::atomic<const Kernels *> selected { nullptr };
+
+const Kernels &active()
+{
+    const Kernels *kernels = selected.load(std::memory_order_acquire);
+    if (!kernels) {
+        kernels = &kernelsFor(ChaCha20Poly1305::implementation());
+        selected.store(kernels, std::memory_order_release);
+    }
+    return *kernels;
+}
+
+// Collects ChaCha20 blocks, of one message or of many, and runs them a
+// full set of lanes at a time; the last few go to the narrowest kernel
+// that takes them all. Partial blocks go through scratch space.
+class BlockQueue
+{
+public:
+    BlockQueue(const Kernels &kernels, const uchar *key)
+        : kernels(kernels)
+    {
+        for (int i = 0; i < 8; ++i)
+            keyWords[i] = load32(key + 4 * i);
+    }
+
+    ~BlockQueue()
+    {
+        memset(keyWords, 0, sizeof(keyWords));
+        memset(scratch, 0, sizeof(scratch));
+    }
+
+    void add(quint32 counter, const uchar *nonce, const uchar *in, uchar *out, size_t length)
+    {
+        words[count] = counter;
+        words[kMaxChaChaLanes + count] = load32(nonce);
+        words[2 * kMaxChaChaLanes + count] = load32(nonce + 4);
+        words[3 * kMaxChaChaLanes + count] = load32(nonce + 8);
+        if (length < 64) {
+            memcpy(scratch[count], in, length);
+            inputs[count] = scratch[count];
+            outputs[count] = scratch[count];
+            partial[count] = out;
+            partialLength[count] = length;
+        } else {
+            inputs[count] = in;
+            outputs[count] = out;
+            partial[count] = nullptr;
+        }
+        if (++count == kernels.chachaLanes)
+            run(kernels);
+    }
+
+    void addMessage(quint32 counter, const uchar *nonce, const uchar *in, uchar *out, size_t length)
+    {
+        for (; length > 0; ++counter) {
+            const size_t n = length < 64 ? length : 64;
+            add(counter, nonce, in, out, n);
+            in += n;
+            out += n;
+            length -= n;
+        }
+    }
+
+    // Runs what is queued; spare lanes churn scratch space
+    void flush()
+    {
+        if (count == 0)
+            return;
+        const Kernels *narrow = &kernels;
+        while (narrow->narrower && count <= narrow->narrower->chachaLanes)
+            narrow = narrow->narrower;
+        for (int j = count; j < narrow->chachaLanes; ++j) {
+            for (int k = 0; k < 4; ++k)
+                words[k * kMaxChaChaLanes + j] = 0;
+            inputs[j] = scratch[j];
+            outputs[j] = scratch[j];
+            partial[j] = nullptr;
+        }
+        run(*narrow);
+    }
+
+private:
+    void run(const Kernels &kernel)
+    {
+        kernel.chacha(keyWords, words, inputs, outputs);
+        for (int j = 0; j < count; ++j) {
+            if (partial[j])
+                memcpy(partial[j], scratch[j], partialLength[j]);
+        }
+        count = 0;
+    }
+
+    const Kernels &kernels;
+    int count = 0;
+    quint32 keyWords[8];
+    quint32 words[4 * kMaxChaChaLanes];
+    const uchar *inputs[kMaxChaChaLanes];
+    uchar *outputs[kMaxChaChaLanes];
+    uchar *partial[kMaxChaChaLanes];
+    size_t partialLength[kMaxChaChaLanes];
+    alignas(64) uchar scratch[kMaxChaChaLanes][64];
+};
+
+// a = a * b, partially reduced; b need not be a clamped key
+void multiply(quint32 a[5], const quint32 b[5])
+{
+    const quint64 s1 = quint64(b[1]) * 5, s2 = quint64(b[2]) * 5, s3 = quint64(b[3]) * 5, s4 = quint64(b[4]) * 5;
+    const quint64 d0 = a[0] * quint64(b[0]) + a[1] * s4 + a[2] * s3 + a[3] * s2 + a[4] * s1;
+    quint64 d1 = a[0] * quint64(b[1]) + a[1] * quint64(b[0]) + a[2] * s4 + a[3] * s3 + a[4] * s2;
+    quint64 d2 = a[0] * quint64(b[2]) + a[1] * quint64(b[1]) + a[2] * quint64(b[0]) + a[3] * s4 + a[4] * s3;
+    quint64 d3 = a[0] * quint64(b[3]) + a[1] * quint64(b[2]) + a[2] * quint64(b[1]) + a[3] * quint64(b[0]) + a[4] * s4;
+    quint64 d4 = a[0] * quint64(b[4]) + a[1] * quint64(b[3]) + a[2] * quint64(b[2]) + a[3] * quint64(b[1]) + a[4] * quint64(b[0]);
+
+    quint64 c = d0 >> 26;
+    a[0] = quint32(d0) & 0x3ffffff;
+    d1 += c; c = d1 >> 26; a[1] = quint32(d1) & 0x3ffffff;
+    d2 += c; c = d2 >> 26; a[2] = quint32(d2) & 0x3ffffff;
+    d3 += c; c = d3 >> 26; a[3] = quint32(d3) & 0x3ffffff;
+    d4 += c; c = d4 >> 26; a[4] = quint32(d4) & 0x3ffffff;
+    c = a[0] + c * 5;
+    a[0] = quint32(c) & 0x3ffffff;
+    a[1] += quint32(c >> 26);
+}
+
+// Poly1305 with five 26-bit limbs, so every product fits in 64 bits
+struct Poly1305
+{
+    quint32 r[5];
+    quint32 h[5];
+    quint32 pad[4];
+    const Kernels *kernels;
+
+    void init(const uchar key[32], const Kernels &laneKernels)
+    {
+        r[0] = load32(key) & 0x3ffffff;
+        r[1] = (load32(key + 3) >> 2) & 0x3ffff03;
+        r[2] = (load32(key + 6) >> 4) & 0x3ffc0ff;
+        r[3] = (load32(key + 9) >> 6) & 0x3f03fff;
+        r[4] = (load32(key + 12) >> 8) & 0x00fffff;
+        memset(h, 0, sizeof(h));
+        for (int i = 0; i < 4; ++i)
+            pad[i] = load32(key + 16 + 4 * i);
+        kernels = &laneKernels;
+    }
+
+    // Whole 16-byte blocks, each with the 2^128 bit set
+    void blocks(const uchar *m, size_t length)
+    {
+        const size_t lanes = size_t(kernels->polyLanes);
+        if (lanes > 1 && length / 16 >= kMinStreamBlocks * lanes) {
+            const size_t steps = length / (16 * lanes);
+            streams(m, steps);
+            m += steps * lanes * 16;
+            length -= steps * lanes * 16;
+        }
+
+        const quint32 s1 = r[1] * 5, s2 = r[2] * 5, s3 = r[3] * 5, s4 = r[4] * 5;
+        quint32 h0 = h[0], h1 = h[1], h2 = h[2], h3 = h[3], h4 = h[4];
+        for (; length >= 16; m += 16, length -= 16) {
+            h0 += load32(m) & 0x3ffffff;
+            h1 += (load32(m + 3) >> 2) & 0x3ffffff;
+            h2 += (load32(m + 6) >> 4) & 0x3ffffff;
+            h3 += (load32(m + 9) >> 6) & 0x3ffffff;
+            h4 += (load32(m + 12) >> 8) | (1u << 24);
+
+            const quint64 d0 = quint64(h0) * r[0] + quint64(h1) * s4 + quint64(h2) * s3 + quint64(h3) * s2 + quint64(h4) * s1;
+            quint64 d1 = quint64(h0) * r[1] + quint64(h1) * r[0] + quint64(h2) * s4 + quint64(h3) * s3 + quint64(h4) * s2;
+            quint64 d2 = quint64(h0) * r[2] + quint64(h1) * r[1] + quint64(h2) * r[0] + quint64(h3) * s4 + quint64(h4) * s3;
+            quint64 d3 = quint64(h0) * r[3] + quint64(h1) * r[2] + quint64(h2) * r[1] + quint64(h3) * r[0] + quint64(h4) * s4;
+            quint64 d4 = quint64(h0) * r[4] + quint64(h1) * r[3] + quint64(h2) * r[2] + quint64(h3) * r[1] + quint64(h4) * r[0];
+
+            quint32 c = quint32(d0 >> 26);
+            h0 = quint32(d0) & 0x3ffffff;
+            d1 += c; c = quint32(d1 >> 26); h1 = quint32(d1) & 0x3ffffff;
+            d2 += c; c = quint32(d2 >> 26); h2 = quint32(d2) & 0x3ffffff;
+            d3 += c; c = quint32(d3 >> 26); h3 = quint32(d3) & 0x3ffffff;
+            d4 += c; c = quint32(d4 >> 26); h4 = quint32(d4) & 0x3ffffff;
+            h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+            h1 += c;
+        }
+        h[0] = h0; h[1] = h1; h[2] = h2; h[3] = h3; h[4] = h4;
+    }
+
+    // `steps` blocks per lane as interleaved streams: lane j takes blocks
+    // j, j + lanes, ... multiplying by r^lanes, except that its last block
+    // is multiplied by r^(lanes - j), so the lane sums add up to Horner's
+    // rule over the whole run
+    void streams(const uchar *m, size_t steps)
+    {
+        const int lanes = kernels->polyLanes;
+        quint32 powers[kMaxPolyLanes + 1][5];
+        memcpy(powers[1], r, sizeof(r));
+        for (int k = 2; k <= lanes; ++k) {
+            memcpy(powers[k], powers[k - 1], sizeof(r));
+            multiply(powers[k], r);
+        }
+
+        PolyLanes state = {};
+        const uchar *messages[kMaxPolyLanes] = {};
+        const size_t stride = 16 * size_t(lanes);
+        for (int j = 0; j < lanes; ++j) {
+            for (int i = 0; i < 5; ++i) {
+                state.h[i][j] = j == 0 ? h[i] : 0;
+                state.r[i][j] = powers[lanes][i];
+            }
+            messages[j] = m + 16 * j;
+        }
+        kernels->poly(&state, messages, stride, steps - 1);
+        for (int j = 0; j < lanes; ++j) {
+            for (int i = 0; i < 5; ++i)
+                state.r[i][j] = powers[lanes - j][i];
+            messages[j] += (steps - 1) * stride;
+        }
+        kernels->poly(&state, messages, stride, 1);
+
+        // Limbs stay under 2^27, so the sum fits before carrying
+        quint32 sum[5] = {};
+        for (int j = 0; j < lanes; ++j) {
+            for (int i = 0; i < 5; ++i)
+                sum[i] += quint32(state.h[i][j]);
+        }
+        quint32 c = sum[0] >> 26; sum[0] &= 0x3ffffff;
+        sum[1] += c; c = sum[1] >> 26; sum[1] &= 0x3ffffff;
+        sum[2] += c; c = sum[2] >> 26; sum[2] &= 0x3ffffff;
+        sum[3] += c; c = sum[3] >> 26; sum[3] &= 0x3ffffff;
+        sum[4] += c; c = sum[4] >> 26; sum[4] &= 0x3ffffff;
+        sum[0] += c * 5; c = sum[0] >> 26; sum[0] &= 0x3ffffff;
+        sum[1] += c;
+        memcpy(h, sum, sizeof(h));
+    }
+
+    void finish(uchar tag[16])
+    {
+        quint32 h0 = h[0], h1 = h[1], h2 = h[2], h3 = h[3], h4 = h[4];
+        quint32 c = h1 >> 26; h1 &= 0x3ffffff;
+        h2 += c; c = h2 >> 26; h2 &= 0x3ffffff;
+        h3 += c; c = h3 >> 26; h3 &= 0x3ffffff;
+        h4 += c; c = h4 >> 26; h4 &= 0x3ffffff;
+        h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+        h1 += c;
+
+        // h - p, selected in constant time when h >= p
+        quint32 g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+        quint32 g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+        quint32 g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+        quint32 g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+        quint32 g4 = h4 + c - (1u << 26);
+        quint32 mask = (g4 >> 31) - 1;
+        h0 = (h0 & ~mask) | (g0 & mask);
+        h1 = (h1 & ~mask) | (g1 & mask);
+        h2 = (h2 & ~mask) | (g2 & mask);
+        h3 = (h3 & ~mask) | (g3 & mask);
+        h4 = (h4 & ~mask) | (g4 & mask);
+
+        h0 = h0 | (h1 << 26);
+        h1 = (h1 >> 6) | (h2 << 20);
+        h2 = (h2 >> 12) | (h3 << 14);
+        h3 = (h3 >> 18) | (h4 << 8);
+
+        quint64 f = quint64(h0) + pad[0];
+        store32(tag, quint32(f));
+        f = quint64(h1) + pad[1] + (f >> 32);
+        store32(tag + 4, quint32(f));
+        f = quint64(h2) + pad[2] + (f >> 32);
+        store32(tag + 8, quint32(f));
+        f = quint64(h3) + pad[3] + (f >> 32);
+        store32(tag + 12, quint32(f));
+    }
+};
+
+// The Poly1305 input of one packet as runs of whole blocks: the AD, its
+// zero-padded tail, the ciphertext, its tail, and the lengths
+struct MacRuns
+{
+    const uchar *start[5];
+    size_t blocks[5];
+    int run;            // The one being absorbed
+    uchar tails[3][16];
+
+    void init(const Packet &packet, const uchar *ciphertext)
+    {
+        const size_t adWhole = packet.adLength / 16;
+        const size_t adTail = packet.adLength % 16;
+        const size_t whole = packet.length / 16;
+        const size_t tail = packet.length % 16;
+        memset(tails, 0, sizeof(tails));
+        if (adTail > 0)
+            memcpy(tails[0], packet.ad + 16 * adWhole, adTail);
+        if (tail > 0)
+            memcpy(tails[1], ciphertext + 16 * whole, tail);
+        store32(tails[2], quint32(packet.adLength));
+        store32(tails[2] + 4, quint32(quint64(packet.adLength) >> 32));
+        store32(tails[2] + 8, quint32(packet.length));
+        store32(tails[2] + 12, quint32(quint64(packet.length) >> 32));
+
+        start[0] = packet.ad;
+        blocks[0] = adWhole;
+        start[1] = tails[0];
+        blocks[1] = adTail > 0 ? 1 : 0;
+        start[2] = ciphertext;
+        blocks[2] = whole;
+        start[3] = tails[1];
+        blocks[3] = tail > 0 ? 1 : 0;
+        start[4] = tails[2];
+        blocks[4] = 1;
+        run = 0;
+        next();
+    }
+
+    // Moves past finished runs; false once everything is absorbed
+    bool next()
+    {
+        while (run < 5 && blocks[run] == 0)
+            ++run;
+        return run < 5;
+    }
+
+    void advance(size_t count)
+    {
+        start[run] += 16 * count;
+        blocks[run] -= count;
+    }
+};
+
+// The tags of up to kBatchChunk packets. Every lane takes a packet and
+// keeps it to the end, then takes the next; each kernel call runs as many
+// blocks as all lanes have left in their current runs. A last straggler
+// finishes on its own.
+void macBatch(const Kernels &kernels, const uchar (*polyKeys)[64], const Packet *packets,
+              const uchar *const *ciphertexts, int count, uchar (*tags)[ChaCha20Poly1305::kTagSize])
+{
+    Poly1305 polys[kBatchChunk];
+    MacRuns runs[kBatchChunk];
+    for (int i = 0; i < count; ++i) {
+        polys[i].init(polyKeys[i], kernels);
+        runs[i].init(packets[i], ciphertexts[i]);
+    }
+
+    const int lanes = kernels.polyLanes;
+    if (lanes > 1 && count > 1) {
+        PolyLanes state = {};
+        int holding[kMaxPolyLanes];
+        for (int j = 0; j < lanes; ++j)
+            holding[j] = -1;
+        int taken = 0;
+        for (;;) {
+            int active = 0;
+            int someLane = 0;
+            size_t steps = ~size_t(0);
+            for (int j = 0; j < lanes; ++j) {
+                if (holding[j] < 0 && taken < count) {
+                    holding[j] = taken++;
+                    for (int i = 0; i < 5; ++i) {
+                        state.h[i][j] = 0;
+                        state.r[i][j] = polys[holding[j]].r[i];
+                    }
+                }
+                if (holding[j] >= 0) {
+                    const MacRuns &packet = runs[holding[j]];
+                    steps = qMin(steps, packet.blocks[packet.run]);
+                    someLane = j;
+                    ++active;
+                }
+            }
+            if (active < 2)
+                break;
+
+            // Idle lanes rerun a busy one, and are thrown away
+            const uchar *messages[kMaxPolyLanes];
+            for (int j = 0; j < lanes; ++j) {
+                const MacRuns &packet = runs[holding[holding[j] >= 0 ? j : someLane]];
+                messages[j] = packet.start[packet.run];
+            }
+            kernels.poly(&state, messages, 16, steps);
+            for (int j = 0; j < lanes; ++j) {
+                if (holding[j] < 0)
+                    continue;
+                MacRuns &packet = runs[holding[j]];
+                packet.advance(steps);
+                if (!packet.next()) {
+                    for (int i = 0; i < 5; ++i)
+                        polys[holding[j]].h[i] = quint32(state.h[i][j]);
+                    holding[j] = -1;
+                }
+            }
+        }
+        for (int j = 0; j < lanes; ++j) {
+            if (holding[j] >= 0) {
+                for (int i = 0; i < 5; ++i)
+                    polys[holding[j]].h[i] = quint32(state.h[i][j]);
+            }
+        }
+    }
+
+    for (int i = 0; i < count; ++i) {
+        MacRuns &packet = runs[i];
+        while (packet.next()) {
+            polys[i].blocks(packet.start[packet.run], 16 * packet.blocks[packet.run]);
+            packet.advance(packet.blocks[packet.run]);
+        }
+        polys[i].finish(tags[i]);
+    }
+}
+
+void sealChunk(const Kernels &kernels, const uchar *key, const Packet *packets, int count)
+{
+    alignas(64) uchar polyKeys[kBatchChunk][64];
+    const uchar *ciphertexts[kBatchChunk] = {};
+    uchar tags[kBatchChunk][ChaCha20Poly1305::kTagSize];
+    {
+        BlockQueue queue(kernels, key);
+        for (int i = 0; i < count; ++i) {
+            const Packet &packet = packets[i];
+            queue.add(0, packet.nonce, kZeroBlock, polyKeys[i], 64);
+            queue.addMessage(1, packet.nonce, packet.input, packet.output, packet.length);
+            ciphertexts[i] = packet.output;
+        }
+        queue.flush();
+    }
+    macBatch(kernels, polyKeys, packets, ciphertexts, count, tags);
+    for (int i = 0; i < count; ++i)
+        memcpy(packets[i].tag, tags[i], ChaCha20Poly1305::kTagSize);
+    memset(polyKeys, 0, 64 * size_t(count));
+}
+
+int openChunk(const Kernels &kernels, const uchar *key, const Packet *packets, int count, bool *authentic)
+{
+    alignas(64) uchar polyKeys[kBatchChunk][64];
+    const uchar *ciphertexts[kBatchChunk] = {};
+    uchar expected[kBatchChunk][ChaCha20Poly1305::kTagSize];
+    BlockQueue queue(kernels, key);
+    for (int i = 0; i < count; ++i) {
+        queue.add(0, packets[i].nonce, kZeroBlock, polyKeys[i], 64);
+        ciphertexts[i] = packets[i].input;
+    }
+    queue.flush();
+    macBatch(kernels, polyKeys, packets, ciphertexts, count, expected);
+    memset(polyKeys, 0, 64 * size_t(count));
+
+    int passed = 0;
+    for (int i = 0; i < count; ++i) {
+        const Packet &packet = packets[i];
+        uchar difference = 0;
+        for (int k = 0; k < ChaCha20Poly1305::kTagSize; ++k)
+            difference |= uchar(expected[i][k] ^ packet.tag[k]);
+        authentic[i] = difference == 0;
+        if (authentic[i]) {
+            queue.addMessage(1, packet.nonce, packet.input, packet.output, packet.length);
+            ++passed;
+        }
+    }
+    queue.flush();
+    return passed;
+}
+
+void sealWith(const Kernels &kernels, const uchar *key, const Packet *packets, int count)
+{
+    for (int first = 0; first < count; first += kBatchChunk)
+        sealChunk(kernels, key, packets + first, qMin(kBatchChunk, count - first));
+}
+
+int openWith(const Kernels &kernels, const uchar *key, const Packet *packets, int count, bool *authentic)
+{
+    int passed = 0;
+    for (int first = 0; first < count; first += kBatchChunk)
+        passed += openChunk(kernels, key, packets + first, qMin(kBatchChunk, count - first), authentic + first);
+    return passed;
+}
+
+void chachaWith(const Kernels &kernels, const uchar *key, quint32 counter, const uchar *nonce,
+                const uchar *in, uchar *out, size_t length)
+{
+    BlockQueue queue(kernels, key);
+    queue.addMessage(counter, nonce, in, out, length);
+    queue.flush();
+}
+
+// RFC 8439 2.4.2, 2.8.2 and A.5
+bool checkVectors(const Kernels &kernels, QString *failure)
+{
+    const QByteArray sunscreen = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for "
+                                 "the future, sunscreen would be it.";
+    const uchar *plaintext = reinterpret_cast<const uchar *>(sunscreen.constData());
+    const size_t length = size_t(sunscreen.size());
+    std::vector<uchar> out(length);
+
+    const QByteArray key = QByteArray::fromHex("000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f");
+    const QByteArray nonce = QByteArray::fromHex("000000000000004a00000000");
+    const QByteArray keystreamXor = QByteArray::fromHex(
+        "6e2e359a2568f98041ba0728dd0d6981e97e7aec1d4360c20a27afccfd9fae0bf91b65c5524733ab8f593dabcd62b3571639d624e65152ab"
+        "8f530c359f0861d807ca0dbf500d6a6156a38e088a22b65e52bc514d16ccf806818ce91ab77937365af90bbf74a35be6b40b8eedf2785e42874d");
+    chachaWith(kernels, reinterpret_cast<const uchar *>(key.constData()), 1,
+               reinterpret_cast<const uchar *>(nonce.constData()), plaintext, out.data(), length);
+    if (memcmp(out.data(), keystreamXor.constData(), length) != 0) {
+        *failure = "ChaCha20 encryption (RFC 8439 2.4.2)";
+        return false;
+    }
+
+    const QByteArray aeadKey = QByteArray::fromHex("808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f");
+    const QByteArray aeadNonce = QByteArray::fromHex("070000004041424344454647");
+    const QByteArray ad = QByteArray::fromHex("50515253c0c1c2c3c4c5c6c7");
+    const QByteArray sealed = QByteArray::fromHex(
+        "d31a8d34648e60db7b86afbc53ef7ec2a4aded51296e08fea9e2b5a736ee62d63dbea45e8ca9671282fafb69da92728b1a71de0a9e060b29"
+        "05d6a5b67ecd3b3692ddbd7f2d778b8c9803aee328091b58fab324e4fad675945585808b4831d7bc3ff4def08e4b7a9de576d26586cec64b"
+        "6116" "1ae10b594f09e26a7e902ecbd0600691");
+    uchar tag[ChaCha20Poly1305::kTagSize];
+    const Packet packet = { reinterpret_cast<const uchar *>(aeadNonce.constData()),
+                            reinterpret_cast<const uchar *>(ad.constData()), size_t(ad.size()),
+                            plaintext, out.data(), length, tag };
+    sealWith(kernels, reinterpret_cast<const uchar *>(aeadKey.constData()), &packet, 1);
+    if (memcmp(out.data(), sealed.constData(), length) != 0 || memcmp(tag, sealed.constData() + length, sizeof(tag)) != 0) {
+        *failure = "AEAD encryption (RFC 8439 2.8.2)";
+        return false;
+    }
+
+    const QByteArray openKey = QByteArray::fromHex("1c9240a5eb55d38af333888604f6b5f0473917c1402b80099dca5cbc207075c0");
+    const QByteArray openNonce = QByteArray::fromHex("000000000102030405060708");
+    const QByteArray openAd = QByteArray::fromHex("f33388860000000000004e91");
+    QByteArray ciphertext = QByteArray::fromHex(
+        "64a0861575861af460f062c79be643bd5e805cfd345cf389f108670ac76c8cb24c6cfc18755d43eea09ee94e382d26b0bdb7b73c321b0100"
+        "d4f03b7f355894cf332f830e710b97ce98c8a84abd0b948114ad176e008d33bd60f982b1ff37c8559797a06ef4f0ef61c186324e2b350638"
+        "3606907b6a7c02b0f9f6157b53c867e4b9166c767b804d46a59b5216cde7a4e99040c5a40433225ee282a1b0a06c523eaf4534d7f83fa115"
+        "5b0047718cbc546a0d072b04b3564eea1b422273f548271a0bb2316053fa76991955ebd63159434ecebb4e466dae5a1073a6727627097a10"
+        "49e617d91d361094fa68f0ff77987130305beaba2eda04df997b714d6c6f2c29a6ad5cb4022b02709b");
+    QByteArray openTag = QByteArray::fromHex("eead9d67890cbb22392336fea1851f38");
+    const Packet opened = { reinterpret_cast<const uchar *>(openNonce.constData()),
+                            reinterpret_cast<const uchar *>(openAd.constData()), size_t(openAd.size()),
+                            reinterpret_cast<const uchar *>(ciphertext.constData()),
+                            reinterpret_cast<uchar *>(ciphertext.data()), size_t(ciphertext.size()),
+                            reinterpret_cast<uchar *>(openTag.data()) };
+    const QByteArray draft = "Internet-Drafts are draft documents valid for a maximum of six months and may be "
+                             "updated, replaced, or obsoleted by other documents at any time. It is inappropriate to "
+                             "use Internet-Drafts as reference material or to cite them other than as "
+                             "/\xe2\x80\x9cwork in progress./\xe2\x80\x9d";
+    bool authentic = false;
+    openWith(kernels, reinterpret_cast<const uchar *>(openKey.constData()), &opened, 1, &authentic);
+    if (!authentic || ciphertext != draft) {
+        *failure = "AEAD decryption (RFC 8439 A.5)";
+        return false;
+    }
+    return true;
+}
+
+// Lengths around every lane and block boundary, single and batched,
+// against the scalar path; and a batch with one forged packet
+bool matchesScalar(const Kernels &kernels, QString *failure)
+{
+    static const size_t kLengths[] = { 0, 1, 15, 16, 17, 63, 64, 65, 127, 128, 129, 255, 256, 257, 511, 1023,
+                                       1024, 1025, 1400, 4096, 4099, 16384 + 7, 65536 };
+    const int count = int(sizeof(kLengths) / sizeof(kLengths[0]));
+    std::vector<uchar> data(65536 + 64);
+    quint32 seed = 0x9e3779b9;
+    for (uchar &byte : data) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        byte = uchar(seed);
+    }
+    const uchar *key = data.data();
+    const uchar *ad = data.data() + 7;
+
+    std::vector<std::vector<uchar>> expected(count);
+    std::vector<std::vector<uchar>> actual(count);
+    std::vector<Packet> packets(count);
+    std::vector<uchar> nonces(ChaCha20Poly1305::kNonceSize * size_t(count));
+    for (int i = 0; i < count; ++i) {
+        const size_t length = kLengths[i];
+        expected[i].resize(length + ChaCha20Poly1305::kTagSize);
+        actual[i].resize(length + ChaCha20Poly1305::kTagSize);
+        uchar *nonce = &nonces[ChaCha20Poly1305::kNonceSize * size_t(i)];
+        memcpy(nonce, data.data() + 100 + i, ChaCha20Poly1305::kNonceSize);
+        const Packet reference = { nonce, ad, length % 37, data.data() + 64, expected[i].data(), length,
+                                   expected[i].data() + length };
+        sealWith(kScalarKernels, key, &reference, 1);
+
+        const Packet single = { nonce, ad, length % 37, data.data() + 64, actual[i].data(), length,
+                                actual[i].data() + length };
+        sealWith(kernels, key, &single, 1);
+        if (actual[i] != expected[i]) {
+            *failure = QString("sealing %1 bytes").arg(length);
+            return false;
+        }
+        packets[i] = single;
+    }
+
+    for (int i = 0; i < count; ++i)
+        std::fill(actual[i].begin(), actual[i].end(), 0);
+    sealWith(kernels, key, packets.data(), count);
+    for (int i = 0; i < count; ++i) {
+        if (actual[i] != expected[i]) {
+            *failure = QString("sealing %1 bytes in a batch").arg(kLengths[i]);
+            return false;
+        }
+    }
+
+    // Open in place, with one tag broken
+    const int forged = count / 2;
+    actual[forged].back() ^= 1;
+    for (Packet &packet : packets)
+        packet.input = packet.output;
+    std::unique_ptr<bool[]> authentic(new bool[size_t(count)]);
+    const int passed = openWith(kernels, key, packets.data(), count, authentic.get());
+    for (int i = 0; i < count; ++i) {
+        const size_t length = kLengths[i];
+        const bool intact = i == forged ? memcmp(actual[i].data(), expected[i].data(), length) == 0
+                                        : memcmp(actual[i].data(), data.data() + 64, length) == 0;
+        if (authentic[i] != (i != forged) || !intact) {
+            *failure = QString("opening %1 bytes in a batch").arg(length);
+            return false;
+        }
+    }
+    if (passed != count - 1) {
+        *failure = "counting authentic packets";
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+namespace ChaCha20Poly1305 {
+
+Implementation implementation()
+{
+    const Kernels *kernels = selected.load(std::memory_order_acquire);
+    if (kernels)
+        return kernels->implementation;
+    for (Implementation candidate : { Implementation::Avx512, Implementation::Avx2, Implementation::Sse2 }) {
+        if (supported(candidate))
+            return candidate;
+    }
+    return Implementation::Scalar;
+}
+
+bool supported(Implementation implementation)
+{
+    switch (implementation) {
+    case Implementation::Scalar:
+        return true;
+#ifdef CHACHA_X86_SIMD
+    case Implementation::Sse2:
+        return __builtin_cpu_supports("sse2");
+    case Implementation::Avx2:
+        return __builtin_cpu_supports("avx2");
+    case Implementation::Avx512:
+        return __builtin_cpu_supports("avx512f");
+#endif
+    default:
+        return false;
+    }
+}
+
+bool setImplementation(Implementation implementation)
+{
+    if (!supported(implementation))
+        return false;
+    selected.store(&kernelsFor(implementation), std::memory_order_release);
+    return true;
+}
+
+const char *implementationName(Implementation implementation)
+{
+    switch (implementation) {
+    case Implementation::Sse2:
+        return "SSE2";
+    case Implementation::Avx2:
+        return "AVX2";
+    case Implementation::Avx512:
+        return "AVX-512";
+    default:
+        return "scalar";
+    }
+}
+
+void chacha20(const uchar *key, quint32 counter, const uchar *nonce, const uchar *in, uchar *out, size_t length)
+{
+    chachaWith(active(), key, counter, nonce, in, out, length);
+}
+
+void seal(const uchar *key, const uchar *nonce, const uchar *ad, size_t adLength,
+          const uchar *plaintext, size_t length, uchar *ciphertext, uchar *tag)
+{
+    const Packet packet = { nonce, ad, adLength, plaintext, ciphertext, length, tag };
+    sealChunk(active(), key, &packet, 1);
+}
+
+bool open(const uchar *key, const uchar *nonce, const uchar *ad, size_t adLength,
+          const uchar *ciphertext, size_t length, const uchar *tag, uchar *plaintext)
+{
+    const Packet packet = { nonce, ad, adLength, ciphertext, plaintext, length, const_cast<uchar *>(tag) };
+    bool authentic = false;
+    openChunk(active(), key, &packet, 1, &authentic);
+    return authentic;
+}
+
+void sealBatch(const uchar *key, const Packet *packets, int count)
+{
+    sealWith(active(), key, packets, count);
+}
+
+int openBatch(const uchar *key, const Packet *packets, int count, bool *authentic)
+{
+    return openWith(active(), key, packets, count, authentic);
+}
+
+bool selfTest(QString *failure)
+{
+    for (Implementation candidate : { Implementation::Scalar, Implementation::Sse2, Implementation::Avx2, Implementation::Avx512 }) {
+        if (!supported(candidate))
+            continue;
+        const Kernels &kernels = kernelsFor(candidate);
+        QString what;
+        if (!checkVectors(kernels, &what) || (candidate != Implementation::Scalar && !matchesScalar(kernels, &what))) {
+            *failure = QString("%1 path failed %2").arg(implementationName(candidate), what);
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace ChaCha20Poly1305
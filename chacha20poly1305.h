@@ -0,0 +1,69 @@
+#ifndef CHACHA20POLY1305_H
+#define CHACHA20POLY1305_H
+
+#include <QString>
+#include <QtGlobal>
+#include <cstddef>
+
+// ChaCha20-Poly1305 AEAD (RFC 8439) for the tunnel's packet path. Works
+// in place (ciphertext may alias plaintext) and never allocates.
+//
+// ChaCha20 runs one block per SIMD lane: 4 lanes with SSE2, 8 with AVX2
+// and 16 with AVX-512, picked at runtime from what the CPU supports. The
+// lanes take any blocks, so a long message fills them with consecutive
+// counters and a batch fills them with blocks of different packets.
+// Poly1305 likewise runs 2, 4 or 8 messages side by side; one long
+// message is split into interleaved streams over powers of r.
+namespace ChaCha20Poly1305 {
+
+const int kKeySize = 32;
+const int kNonceSize = 12;
+const int kTagSize = 16;
+
+enum class Implementation { Scalar, Sse2, Avx2, Avx512 };
+
+// The fastest path the CPU supports, or the one set below
+Implementation implementation();
+bool supported(Implementation implementation);
+// Switches every later call over, for benchmarks; false if the CPU lacks
+// it. Calls already running on other threads finish on the old path.
+bool setImplementation(Implementation implementation);
+const char *implementationName(Implementation implementation);
+
+void seal(const uchar *key, const uchar *nonce, const uchar *ad, size_t adLength,
+          const uchar *plaintext, size_t length, uchar *ciphertext, uchar *tag);
+// Checks the tag before decrypting; on failure `plaintext` is untouched
+bool open(const uchar *key, const uchar *nonce, const uchar *ad, size_t adLength,
+          const uchar *ciphertext, size_t length, const uchar *tag, uchar *plaintext);
+
+// One packet of a batch; `output` may alias `input`. sealBatch() writes
+// the tag, openBatch() checks it.
+struct Packet
+{
+    const uchar *nonce;
+    const uchar *ad;
+    size_t adLength;
+    const uchar *input;
+    uchar *output;
+    size_t length;
+    uchar *tag;
+};
+
+// Packets sealed or opened under one key, their blocks and MACs spread
+// over the SIMD lanes together. Far faster than one call per packet when
+// packets are short, as a 64-byte packet alone fills two ChaCha lanes.
+void sealBatch(const uchar *key, const Packet *packets, int count);
+// Authenticates every packet and decrypts those that pass, leaving the
+// rest untouched; authentic[i] says which. Returns how many passed.
+int openBatch(const uchar *key, const Packet *packets, int count, bool *authentic);
+
+// The raw ChaCha20 keystream XOR, starting at block `counter`
+void chacha20(const uchar *key, quint32 counter, const uchar *nonce, const uchar *in, uchar *out, size_t length);
+
+// Checks the RFC 8439 test vectors on every path the CPU supports, and
+// each SIMD path against the scalar one; `failure` says what differed
+bool selfTest(QString *failure);
+
+} // namespace ChaCha20Poly1305
+
+#endif // CHACHA20POLY1305_H
@@ -0,0 +1,387 @@
+#include "chartwidget.h"
+#include <QDateTime>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QPolygonF>
+#include <QWheelEvent>
+#include <cmath>
+
+namespace {
+
+const int kLeftMargin = 64;
+const int kRightMargin = 8;
+const int kTopMargin = 8;
+const int kBottomMargin = 22;
+const int kGridLines = 4;
+const double kWheelZoomStep = 0.8;   // View span per wheel notch
+
+QString formatTime(double seconds, double span)
+{
+    const QDateTime time = QDateTime::fromSecsSinceEpoch(qint64(seconds));
+    if (span > 2 * 24 * 3600)
+        return time.toString("MMM d HH:mm");
+    return time.toString(span > 120 ? "HH:mm" : "HH:mm:ss");
+}
+
+} // namespace
+
+ChartWidget::ChartWidget(QWidget *parent)
+    : QWidget(parent), lineColor("#0a84ff")
+{
+    setMinimumHeight(160);
+    setAttribute(Qt::WA_OpaquePaintEvent);
+    valueFormatter = [](double value) { return QString::number(value, 'g', 4); };
+
+    decimator = new ChartDecimator(&pyramid);
+    decimator->moveToThread(&decimatorThread);
+    connect(&decimatorThread, &QThread::finished, decimator, &QObject::deleteLater);
+    connect(decimator, &ChartDecimator::ready, this, &ChartWidget::onDecimated);
+    decimatorThread.start();
+}
+
+ChartWidget::~ChartWidget()
+{
+    // The decimator reads the pyramid, which outlives the thread
+    decimatorThread.quit();
+    decimatorThread.wait();
+}
+
+void ChartWidget::setMode(DecimationPyramid::Mode newMode)
+{
+    mode = newMode;
+    cacheValid = false;
+    requestDecimation();
+    update();
+}
+
+void ChartWidget::setLineColor(const QColor &color)
+{
+    lineColor = color;
+    cacheValid = false;
+    requestDecimation();
+    update();
+}
+
+void ChartWidget::setValueFormatter(const std::function<QString(double)> &formatter)
+{
+    valueFormatter = formatter;
+    update();
+}
+
+QRect ChartWidget::plotRect() const
+{
+    return rect().adjusted(kLeftMargin, kTopMargin, -kRightMargin, -kBottomMargin);
+}
+
+void ChartWidget::clear()
+{
+    pyramid.clear();
+    latest = DecimatedView();
+    cacheValid = false;
+    ++generation;
+    update();
+}
+
+void ChartWidget::appendPoints(const QVector<QPointF> &points)
+{
+    if (points.isEmpty())
+        return;
+
+    double firstX = 0;
+    double previousLast = 0;
+    const bool hadData = pyramid.bounds(&firstX, &previousLast);
+    pyramid.append(points.constData(), points.size());
+    double lastX = 0;
+    if (!pyramid.bounds(&firstX, &lastX))
+        return;
+    if (!hadData) {
+        fitAll();
+        return;
+    }
+    if (!(lastX > previousLast))
+        return;
+
+    const QRect plot = plotRect();
+    if (following && lastX > to) {
+        const double unitsPerPixel = (to - from) / qMax(plot.width(), 1);
+        const int shift = int((lastX - to) / unitsPerPixel);
+        if (shift <= 0)
+            return; // Under a pixel; drawn once the next append crosses one
+        if (!cacheValid || shift >= plot.width()) {
+            changeView(from + shift * unitsPerPixel, to + shift * unitsPerPixel);
+            return;
+        }
+
+        // Move the cached plot left by whole pixels and draw the new strip
+        const double oldTo = to;
+        from += shift * unitsPerPixel;
+        to += shift * unitsPerPixel;
+        const int deviceShift = qRound(shift * cache.devicePixelRatio());
+        cache.scroll(-deviceShift, 0, cache.rect());
+        if (!renderStrip(oldTo, to))
+            requestDecimation();
+        emit viewRangeChanged(from, to);
+        update(); // Axis labels moved too
+        return;
+    }
+
+    // New samples inside a fixed view: draw just their segment
+    if (cacheValid && previousLast < to && lastX > from) {
+        if (!renderStrip(qMax(previousLast, from), qMin(lastX, to))) {
+            requestDecimation();
+            update();
+        }
+    }
+}
+
+void ChartWidget::setViewRange(double newFrom, double newTo)
+{
+    changeView(newFrom, newTo);
+}
+
+void ChartWidget::fitAll()
+{
+    double firstX = 0;
+    double lastX = 0;
+    if (!pyramid.bounds(&firstX, &lastX))
+        return;
+    if (lastX <= firstX) {
+        firstX -= 1;
+        lastX += 1;
+    }
+    changeView(firstX, lastX);
+}
+
+void ChartWidget::setFollowing(bool follow)
+{
+    following = follow;
+    double firstX = 0;
+    double lastX = 0;
+    if (following && pyramid.bounds(&firstX, &lastX) && lastX > to)
+        changeView(lastX - (to - from), lastX);
+}
+
+void ChartWidget::changeView(double newFrom, double newTo)
+{
+    if (!(newTo > newFrom))
+        return;
+    from = newFrom;
+    to = newTo;
+    cacheValid = false;
+    requestDecimation();
+    emit viewRangeChanged(from, to);
+    update();
+}
+
+void ChartWidget::requestDecimation()
+{
+    decimator->request(from, to, qMax(plotRect().width(), 1), mode, ++generation);
+}
+
+void ChartWidget::onDecimated(const DecimatedView &view)
+{
+    decimationTimes.record(quint64(view.elapsedNs));
+    latest = view;
+    if (view.generation != generation) {
+        // Superseded, but still a better interim picture than the last one
+        if (!cacheValid)
+            update();
+        return;
+    }
+
+    if (!view.points.isEmpty())
+        fitValues(view.yMin, view.yMax);
+    renderCache();
+    update();
+}
+
+void ChartWidget::fitValues(double yMin, double yMax)
+{
+    if (!(yMin <= yMax)) {
+        yLow = 0;
+        yHigh = 1;
+        return;
+    }
+    // Non-negative series such as byte counts keep zero as the baseline
+    const double low = yMin >= 0 ? 0 : yMin;
+    const double high = yMax > low ? yMax : low + 1;
+    const double padding = (high - low) * 0.05;
+    yLow = yMin >= 0 ? 0 : low - padding;
+    yHigh = high + padding;
+}
+
+void ChartWidget::drawGrid(QPainter &painter, const QRect &area) const
+{
+    // Horizontal lines only, so a scrolled cache stays correct
+    painter.setPen(QColor("#f0f0f0"));
+    for (int i = 1; i < kGridLines; ++i) {
+        const int y = area.top() + area.height() * i / kGridLines;
+        painter.drawLine(area.left(), y, area.right(), y);
+    }
+}
+
+void ChartWidget::drawSeries(QPainter &painter, const QVector<QPointF> &points, const QRect &plot,
+                             double viewFrom, double viewTo) const
+{
+    if (points.isEmpty() || !(viewTo > viewFrom) || !(yHigh > yLow))
+        return;
+
+    const double scaleX = plot.width() / (viewTo - viewFrom);
+    const double scaleY = plot.height() / (yHigh - yLow);
+    const double bottom = plot.top() + plot.height();
+    QPolygonF polygon;
+    polygon.reserve(points.size());
+    for (const QPointF &point : points)
+        polygon.append(QPointF(plot.left() + (point.x() - viewFrom) * scaleX, bottom - (point.y() - yLow) * scaleY));
+
+    // No antialiasing: the M4 envelope is exact only when rasterized
+    // pixel-aligned, and it keeps the polyline cheap
+    painter.setRenderHint(QPainter::Antialiasing, false);
+    painter.setPen(QPen(lineColor, 1));
+    if (polygon.size() == 1)
+        painter.drawPoint(polygon.first());
+    else
+        painter.drawPolyline(polygon);
+}
+
+void ChartWidget::renderCache()
+{
+    const QRect plot = plotRect();
+    if (plot.width() <= 0 || plot.height() <= 0) {
+        cacheValid = false;
+        return;
+    }
+
+    const qreal ratio = devicePixelRatioF();
+    if (cache.size() != plot.size() * ratio) {
+        cache = QPixmap(plot.size() * ratio);
+        cache.setDevicePixelRatio(ratio);
+    }
+    cache.fill(Qt::white);
+
+    QPainter painter(&cache);
+    const QRect area(QPoint(0, 0), plot.size());
+    drawGrid(painter, area);
+    drawSeries(painter, latest.points, area, from, to);
+    cacheValid = true;
+}
+
+bool ChartWidget::renderStrip(double stripFrom, double stripTo)
+{
+    const QRect plot = plotRect();
+    const double unitsPerPixel = (to - from) / qMax(plot.width(), 1);
+    // One pixel of overlap on the left joins the new segment to the old
+    const int left = qMax(0, int(std::floor((stripFrom - from) / unitsPerPixel)) - 1);
+    const int right = qMin(plot.width(), int(std::ceil((stripTo - from) / unitsPerPixel)) + 1);
+    if (left >= right)
+        return true;
+
+    // A few columns, so decimate synchronously; always M4, since LTTB
+    // would not pick the same points as the neighbouring columns anyway
+    double yMin = 0;
+    double yMax = 0;
+    const double segmentFrom = from + left * unitsPerPixel;
+    const double segmentTo = from + right * unitsPerPixel;
+    const QVector<QPointF> points = pyramid.decimate(segmentFrom, segmentTo, right - left,
+                                                     DecimationPyramid::MinMax, &yMin, &yMax);
+    if (yMin <= yMax && (yMin < yLow || yMax > yHigh)) {
+        cacheValid = false; // Needs a new value range
+        return false;
+    }
+
+    QPainter painter(&cache);
+    const QRect area(QPoint(0, 0), plot.size());
+    const QRect strip(left, 0, right - left, plot.height());
+    painter.setClipRect(strip);
+    painter.fillRect(strip, Qt::white);
+    drawGrid(painter, area);
+    drawSeries(painter, points, area, from, to);
+    update(strip.translated(plot.topLeft()));
+    return true;
+}
+
+void ChartWidget::paintEvent(QPaintEvent *)
+{
+    QPainter painter(this);
+    painter.fillRect(rect(), Qt::white);
+
+    const QRect plot = plotRect();
+    if (cacheValid) {
+        painter.drawPixmap(plot.topLeft(), cache);
+    } else {
+        // Map the newest decimation onto the current view until the one
+        // for this view arrives
+        painter.save();
+        painter.setClipRect(plot);
+        drawGrid(painter, plot);
+        drawSeries(painter, latest.points, plot, from, to);
+        painter.restore();
+    }
+
+    painter.setPen(QColor("#e0e0e0"));
+    painter.drawRect(plot.adjusted(0, 0, -1, -1));
+
+    painter.setPen(QColor("#777777"));
+    for (int i = 0; i <= kGridLines; ++i) {
+        const int y = plot.top() + plot.height() * i / kGridLines;
+        const double value = yHigh - (yHigh - yLow) * i / kGridLines;
+        painter.drawText(QRect(0, y - 8, kLeftMargin - 6, 16), Qt::AlignRight | Qt::AlignVCenter, valueFormatter(value));
+    }
+    const QRect labels(plot.left(), plot.bottom() + 4, plot.width(), kBottomMargin - 4);
+    painter.drawText(labels, Qt::AlignLeft | Qt::AlignTop, formatTime(from, to - from));
+    painter.drawText(labels, Qt::AlignRight | Qt::AlignTop, formatTime(to, to - from));
+}
+
+void ChartWidget::resizeEvent(QResizeEvent *event)
+{
+    QWidget::resizeEvent(event);
+    cacheValid = false;
+    requestDecimation();
+}
+
+void ChartWidget::wheelEvent(QWheelEvent *event)
+{
+    const int angle = event->angleDelta().y();
+    const QRect plot = plotRect();
+    if (angle == 0 || plot.width() <= 0)
+        return;
+
+    const double factor = std::pow(kWheelZoomStep, angle / 120.0);
+    const double fraction = qBound(0.0, (event->position().x() - plot.left()) / plot.width(), 1.0);
+    const double anchor = from + (to - from) * fraction;
+    following = false;
+    changeView(anchor - (anchor - from) * factor, anchor + (to - anchor) * factor);
+    event->accept();
+}
+
+void ChartWidget::mousePressEvent(QMouseEvent *event)
+{
+    if (event->button() != Qt::LeftButton)
+        return;
+    dragging = true;
+    dragStartX = int(event->position().x());
+    dragFrom = from;
+    dragTo = to;
+    setCursor(Qt::ClosedHandCursor);
+}
+
+void ChartWidget::mouseMoveEvent(QMouseEvent *event)
+{
+    if (!dragging)
+        return;
+    const double shift = -(event->position().x() - dragStartX) * (dragTo - dragFrom) / qMax(plotRect().width(), 1);
+    following = false;
+    changeView(dragFrom + shift, dragTo + shift);
+}
+
+void ChartWidget::mouseReleaseEvent(QMouseEvent *)
+{
+    dragging = false;
+    unsetCursor();
+}
+
+void ChartWidget::mouseDoubleClickEvent(QMouseEvent *)
+{
+    following = true;
+    fitAll();
+}
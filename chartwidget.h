@@ -0,0 +1,108 @@
+#ifndef CHARTWIDGET_H
+#define CHARTWIDGET_H
+
+#include <QWidget>
+#include <QColor>
+#include <QPixmap>
+#include <QThread>
+#include <functional>
+#include "decimationpyramid.h"
+#include "latencyhistogram.h"
+
+// Line chart for long series. Painting never walks the samples: the
+// visible range is decimated to the plot's pixel width on a worker thread
+// and the widget paints that polyline (a few thousand points at most).
+// While a new decimation is pending, the previous one is mapped onto the
+// current view, so zooming and panning stay responsive at any size.
+//
+// The plot is cached in a pixmap. Appending while following the newest
+// data scrolls the cache and rasterizes only the strip that came into
+// view; appending inside a fixed view draws only the new segment.
+//
+// x is seconds since the epoch (for the axis labels). Wheel zooms around
+// the cursor, dragging pans, double-click shows everything and resumes
+// following.
+class ChartWidget : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit ChartWidget(QWidget *parent = nullptr);
+    ~ChartWidget();
+
+    void setMode(DecimationPyramid::Mode mode);
+    void setLineColor(const QColor &color);
+    // Formats y-axis labels; plain numbers by default
+    void setValueFormatter(const std::function<QString(double)> &formatter);
+
+    // x must be non-decreasing across calls
+    void appendPoints(const QVector<QPointF> &points);
+    void clear();
+
+    void setViewRange(double from, double to);
+    double viewFrom() const { return from; }
+    double viewTo() const { return to; }
+    void fitAll();
+
+    // Keeps the newest sample at the right edge as points are appended
+    void setFollowing(bool follow);
+    bool isFollowing() const { return following; }
+
+    const DecimationPyramid &samples() const { return pyramid; }
+    // True once the plot shows a decimation of the current view
+    bool isSettled() const { return cacheValid; }
+    const LatencyHistogram &decimationLatency() const { return decimationTimes; }
+
+signals:
+    void viewRangeChanged(double from, double to);
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+    void wheelEvent(QWheelEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseMoveEvent(QMouseEvent *event) override;
+    void mouseReleaseEvent(QMouseEvent *event) override;
+    void mouseDoubleClickEvent(QMouseEvent *event) override;
+
+private slots:
+    void onDecimated(const DecimatedView &view);
+
+private:
+    QRect plotRect() const;
+    void changeView(double newFrom, double newTo);
+    void requestDecimation();
+    void fitValues(double yMin, double yMax);
+    void renderCache();
+    bool renderStrip(double stripFrom, double stripTo);
+    void drawGrid(QPainter &painter, const QRect &area) const;
+    void drawSeries(QPainter &painter, const QVector<QPointF> &points, const QRect &plot,
+                    double viewFrom, double viewTo) const;
+
+    DecimationPyramid pyramid;
+    QThread decimatorThread;
+    ChartDecimator *decimator;
+    DecimationPyramid::Mode mode = DecimationPyramid::MinMax;
+    quint64 generation = 0;
+    DecimatedView latest;               // Newest result, possibly for an older view
+    LatencyHistogram decimationTimes;
+
+    double from = 0;
+    double to = 1;
+    double yLow = 0;
+    double yHigh = 1;
+    bool following = true;
+
+    QPixmap cache;                      // Plot area only
+    bool cacheValid = false;
+
+    QColor lineColor;
+    std::function<QString(double)> valueFormatter;
+
+    bool dragging = false;
+    int dragStartX = 0;
+    double dragFrom = 0;
+    double dragTo = 0;
+};
+
+#endif // CHARTWIDGET_H
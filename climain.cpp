@@ -0,0 +1,319 @@
+#include "filescanner.h"
+#include "parserworker.h"
+#include "parserworkerpool.h"
+#include "quarantinestore.h"
+#include "scanreportwriter.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
+#include <QTimer>
+#include <cstdio>
+#include <cstring>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// What CI jobs and cron wrappers test for
+const int kExitClean = 0;
+const int kExitDetections = 1;          // Also: a looked-up hash is in quarantine
+const int kExitUsage = 2;               // Bad arguments, or the report could not be written
+const int kExitIncomplete = 3;          // Nothing found, but some files could not be scanned
+
+const int kProgressIntervalMs = 250;
+
+// ioprio_set(2) has no glibc wrapper
+const int kIoPrioWhoProcess = 1;
+const int kIoPrioClassShift = 13;
+const int kIoPrioClassBestEffort = 2;
+const int kIoPrioClassIdle = 3;
+
+// "idle", or "best-effort" with an optional level 0-7 ("best-effort:7").
+// Set on the main thread before any other starts, so the pool's threads
+// and its worker processes inherit it.
+bool setIoPriority(const QString &value, QString *error)
+{
+#ifdef Q_OS_LINUX
+    const QStringList parts = value.split(':');
+    int priority;
+    if (parts.size() == 1 && parts[0] == "idle") {
+        priority = kIoPrioClassIdle << kIoPrioClassShift;
+    } else if (parts[0] == "best-effort" && parts.size() <= 2) {
+        bool ok = true;
+        const int level = parts.size() == 2 ? parts[1].toInt(&ok) : 4;
+        if (!ok || level < 0 || level > 7) {
+            *error = "Best-effort levels run from 0 to 7: " + value;
+            return false;
+        }
+        priority = (kIoPrioClassBestEffort << kIoPrioClassShift) | level;
+    } else {
+        *error = "Unknown I/O priority (idle, best-effort[:0-7]): " + value;
+        return false;
+    }
+    if (syscall(SYS_ioprio_set, kIoPrioWhoProcess, 0, priority) != 0) {
+        *error = QString("ioprio_set: %1").arg(QString::fromLocal8Bit(strerror(errno)));
+        return false;
+    }
+    return true;
+#else
+    Q_UNUSED(value);
+    *error = "--io-priority needs Linux";
+    return false;
+#endif
+}
+
+QByteArray jsonString(const QString &text)
+{
+    const QByteArray utf8 = text.toUtf8();
+    QByteArray quoted;
+    quoted.reserve(utf8.size() + 2);
+    quoted += '"';
+    for (const char c : utf8) {
+        const uchar u = uchar(c);
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        } else if (u < 0x20) {
+            static const char hex[] = "0123456789abcdef";
+            const char escaped[6] = { '\\', 'u', '0', '0', hex[u >> 4], hex[u & 0xf] };
+            quoted.append(escaped, 6);
+        } else {
+            quoted += c;
+        }
+    }
+    quoted += '"';
+    return quoted;
+}
+
+// One JSON object per line on stderr, so standard output stays free for
+// a report written to "-"
+void emitJson(const QByteArray &line)
+{
+    fprintf(stderr, "%s\n", line.constData());
+    fflush(stderr);
+}
+
+// Looks each argument up in the quarantine store: a 64-digit SHA-256, or
+// a file to hash first. Prints one JSON object per argument on stdout.
+int lookupHashes(const QStringList &arguments, const QString &storePath)
+{
+    QuarantineStore store;
+    // A machine that never quarantined anything has no store, and is not
+    // given an empty one by looking
+    const bool haveStore = QFileInfo(storePath).isDir() && store.open(storePath);
+    if (QFileInfo(storePath).isDir() && !haveStore) {
+        fprintf(stderr, "quarantine: %s\n", qPrintable(store.errorString()));
+        return kExitUsage;
+    }
+
+    int status = kExitClean;
+    for (const QString &argument : arguments) {
+        QByteArray digest = QByteArray::fromHex(argument.toLatin1());
+        if (argument.size() != 64 || digest.size() != 32) {
+            QFile file(argument);
+            QCryptographicHash hash(QCryptographicHash::Sha256);
+            if (!file.open(QIODevice::ReadOnly) || !hash.addData(&file)) {
+                fprintf(stderr, "%s: not a SHA-256 or a readable file\n", qPrintable(argument));
+                return kExitUsage;
+            }
+            digest = hash.result();
+        }
+
+        QByteArray line = "{\"sha256\":\"" + digest.toHex() + "\",\"argument\":" + jsonString(argument)
+                          + ",\"quarantined\":[";
+        int matches = 0;
+        for (int i = 0; haveStore && i < store.recordCount(); ++i) {
+            const QuarantineRecord *record = store.record(i);
+            if (memcmp(record->sha256, digest.constData(), 32) != 0)
+                continue;
+            if (matches++ > 0)
+                line += ',';
+            line += "{\"path\":" + jsonString(store.pathOf(*record)) + ",\"host\":" + jsonString(store.hostOf(*record))
+                    + ",\"at\":" + jsonString(QDateTime::fromMSecsSinceEpoch(record->quarantinedAt).toString(Qt::ISODate))
+                    + ",\"size\":" + QByteArray::number(record->originalSize) + ",\"state\":\""
+                    + (record->flags & QuarantineRecord::Removed    ? "removed"
+                       : record->flags & QuarantineRecord::Restored ? "restored"
+                                                                    : "quarantined")
+                    + "\"}";
+        }
+        line += "]}";
+        fprintf(stdout, "%s\n", line.constData());
+        if (matches > 0)
+            status = kExitDetections;
+    }
+    fflush(stdout);
+    return status;
+}
+
+} // namespace
+
+// rhynec-cli: the Security tab's scanner for machines without a display,
+// and for cron and CI loops that start it many times a minute. No GUI
+// library is loaded, and nothing is read at startup that the command does
+// not need.
+int main(int argc, char *argv[])
+{
+    // The sandboxed parser workers re-exec this binary
+    if (argc > 1 && qstrcmp(argv[1], "--parser-worker") == 0)
+        return runParserWorker(argc, argv);
+
+    QElapsedTimer sinceStart;
+    sinceStart.start();
+
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("rhynec-cli");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Rhynec Security command-line scanner\n\n"
+        "Exit status: 0 nothing found, 1 detections (or a looked-up hash is in quarantine), "
+        "2 usage or report errors, 3 nothing found but some files could not be scanned.");
+    parser.addHelpOption();
+    QCommandLineOption progressOption("progress", "Progress as JSON lines on stderr: <format> is json.", "format");
+    QCommandLineOption threadsOption("threads", "Parse with <n> workers (default: cores - 1, at most 8).", "n");
+    QCommandLineOption ioPriorityOption("io-priority", "Read files at <class>: idle, or best-effort[:0-7].", "class");
+    QCommandLineOption inProcessOption("in-process", "Parse in-process instead of in sandboxed workers.");
+    QCommandLineOption lookupOption("lookup", "Look up a SHA-256, or the hash of <file>, in the quarantine.",
+                                    "sha256|file");
+    QCommandLineOption quarantineOption("quarantine", "Quarantine store to look up in (default: the GUI's).", "dir");
+    parser.addOptions(ScanReportWriter::commandLineOptions());
+    parser.addOptions({ progressOption, threadsOption, ioPriorityOption, inProcessOption, lookupOption, quarantineOption });
+    parser.addPositionalArgument("paths", "Files and directories to scan.", "[paths...]");
+    parser.process(app);
+
+    if (parser.isSet(ioPriorityOption)) {
+        QString error;
+        if (!setIoPriority(parser.value(ioPriorityOption), &error)) {
+            fprintf(stderr, "%s\n", qPrintable(error));
+            return kExitUsage;
+        }
+    }
+
+    if (parser.isSet(lookupOption)) {
+        return lookupHashes(parser.values(lookupOption), parser.isSet(quarantineOption)
+                                                             ? parser.value(quarantineOption)
+                                                             : QuarantineStore::defaultDirectory());
+    }
+
+    const QStringList paths = parser.positionalArguments();
+    if (paths.isEmpty()) {
+        parser.showHelp(kExitUsage);
+    }
+    const bool json = parser.isSet(progressOption);
+    if (json && parser.value(progressOption) != "json") {
+        fprintf(stderr, "Unknown progress format: %s\n", qPrintable(parser.value(progressOption)));
+        return kExitUsage;
+    }
+
+    int threads = 0;
+    if (parser.isSet(threadsOption)) {
+        threads = parser.value(threadsOption).toInt();
+        if (threads < 1) {
+            fprintf(stderr, "--threads needs a positive count\n");
+            return kExitUsage;
+        }
+    }
+
+    // Opened last, as it truncates the report
+    ScanReportWriter writer;
+    if (!writer.beginFromCommandLine(parser)) {
+        fprintf(stderr, "report: %s\n", qPrintable(writer.errorString()));
+        return kExitUsage;
+    }
+
+    ParserWorkerPool pool;
+    pool.setMode(parser.isSet(inProcessOption) ? ParserWorkerPool::Mode::InProcess
+                                               : ParserWorkerPool::Mode::Sandboxed);
+    if (threads > 0)
+        pool.setWorkerCount(threads);
+    FileScanner scanner(&pool);
+
+    // The scanner counts per start(), and each path is one
+    quint64 files = 0;
+    quint64 detections = 0;
+    quint64 incomplete = 0;
+    qint64 firstResultMs = -1;
+    int nextPath = 0;
+
+    QObject::connect(&scanner, &FileScanner::resultReady, &app, [&](const QString &path, const ScanVerdict &verdict) {
+        if (firstResultMs < 0)
+            firstResultMs = sinceStart.elapsed();
+        ++files;
+        if (verdict.status == ScanVerdict::Suspicious || verdict.status == ScanVerdict::Malicious) {
+            ++detections;
+            if (json) {
+                emitJson("{\"event\":\"detection\",\"path\":" + jsonString(path) + ",\"status\":\""
+                         + scanStatusName(verdict.status) + "\",\"type\":\"" + scanFileTypeName(verdict.fileType)
+                         + "\",\"score\":" + QByteArray::number(verdict.score) + '}');
+            }
+        } else if (verdict.status != ScanVerdict::Clean) {
+            ++incomplete;
+        }
+        if (writer.isActive())
+            writer.addResult(path, verdict);
+    });
+
+    QTimer progressTimer;
+    QObject::connect(&progressTimer, &QTimer::timeout, &app, [&]() {
+        emitJson("{\"event\":\"progress\",\"files\":" + QByteArray::number(files) + ",\"detections\":"
+                 + QByteArray::number(detections) + ",\"elapsed_ms\":" + QByteArray::number(sinceStart.elapsed())
+                 + '}');
+    });
+
+    auto startNext = [&]() {
+        if (nextPath == paths.size()) {
+            app.quit();
+            return;
+        }
+        const QString path = paths[nextPath++];
+        if (json)
+            emitJson("{\"event\":\"scan\",\"path\":" + jsonString(path) + '}');
+        scanner.start(path);
+    };
+    QObject::connect(&scanner, &FileScanner::finished, &app, startNext, Qt::QueuedConnection);
+
+    if (json) {
+        emitJson(QByteArray("{\"event\":\"start\",\"mode\":\"")
+                 + (pool.mode() == ParserWorkerPool::Mode::Sandboxed ? "sandboxed" : "in_process") + "\",\"paths\":"
+                 + QByteArray::number(paths.size()) + ",\"startup_ms\":" + QByteArray::number(sinceStart.elapsed())
+                 + '}');
+        progressTimer.start(kProgressIntervalMs);
+    }
+    startNext();
+    app.exec();
+    progressTimer.stop();
+
+    int status = detections > 0 ? kExitDetections : incomplete > 0 ? kExitIncomplete : kExitClean;
+    if (writer.isActive() && !writer.finish()) {
+        fprintf(stderr, "report: %s\n", qPrintable(writer.errorString()));
+        status = kExitUsage;
+    }
+
+    const LatencyHistogram latency = pool.latency(pool.mode());
+    if (json) {
+        emitJson("{\"event\":\"finished\",\"files\":" + QByteArray::number(files) + ",\"detections\":"
+                 + QByteArray::number(detections) + ",\"incomplete\":" + QByteArray::number(incomplete)
+                 + ",\"elapsed_ms\":" + QByteArray::number(sinceStart.elapsed()) + ",\"first_result_ms\":"
+                 + QByteArray::number(firstResultMs) + ",\"p50_us\":" + QByteArray::number(latency.percentile(50) / 1000)
+                 + ",\"p99_us\":" + QByteArray::number(latency.percentile(99) / 1000)
+                 + ",\"exit\":" + QByteArray::number(status) + '}');
+    } else {
+        fprintf(stderr, "%llu files, %llu detections, %llu not scanned in %lld ms (first after %lld ms; "
+                        "p50 %.1f us, p99 %.1f us per file)\n",
+                static_cast<unsigned long long>(files), static_cast<unsigned long long>(detections),
+                static_cast<unsigned long long>(incomplete), static_cast<long long>(sinceStart.elapsed()),
+                static_cast<long long>(firstResultMs), latency.percentile(50) / 1000.0,
+                latency.percentile(99) / 1000.0);
+    }
+    return status;
+}
@@ -0,0 +1,434 @@
+#include "connectionmonitor.h"
+#include "metricsbus.h"
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QDebug>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <ctime>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <linux/inet_diag.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/sock_diag.h>
+#include <linux/tcp.h>
+#endif
+
+namespace {
+
+const qint64 kInodeScanBudgetMicros = 3000;
+const int kRetainEveryRefreshes = 30;
+
+qint64 threadCpuMicros()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return qint64(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+bool cookieLess(const ConnectionRow &a, const ConnectionRow &b)
+{
+    return a.cookie < b.cookie;
+}
+
+} // namespace
+
+#ifdef Q_OS_LINUX
+
+QVector<qint32> SocketInodeCache::listPids() const
+{
+    QVector<qint32> pids;
+    DIR *proc = opendir("/proc");
+    if (!proc)
+        return pids;
+    while (dirent *entry = readdir(proc)) {
+        if (entry->d_name[0] < '1' || entry->d_name[0] > '9')
+            continue;
+        pids.append(qint32(strtol(entry->d_name, nullptr, 10)));
+    }
+    closedir(proc);
+    return pids;
+}
+
+int SocketInodeCache::scanProcess(qint32 pid, QSet<quint32> *wanted)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/fd", pid);
+    const int dirFd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd < 0)
+        return 0; // Exited, or not ours to inspect
+    DIR *dir = fdopendir(dirFd);
+    if (!dir) {
+        close(dirFd);
+        return 0;
+    }
+
+    int found = 0;
+    char target[64];
+    while (dirent *entry = readdir(dir)) {
+        if (entry->d_name[0] == '.')
+            continue;
+        const ssize_t length = readlinkat(dirFd, entry->d_name, target, sizeof(target) - 1);
+        // Socket links look like "socket:[12345]"
+        if (length < 9 || memcmp(target, "socket:[", 8) != 0)
+            continue;
+        target[length] = '\0';
+        const quint32 inode = quint32(strtoul(target + 8, nullptr, 10));
+        if (inode) {
+            inodeOwners.insert(inode, pid);
+            found += wanted->remove(inode) ? 1 : 0;
+        }
+    }
+    closedir(dir);
+
+    if (!scannedAt.contains(pid)) {
+        QFile comm(QString("/proc/%1/comm").arg(pid));
+        if (comm.open(QIODevice::ReadOnly))
+            pendingNames.insert(pid, QString::fromUtf8(comm.readLine().trimmed()));
+    }
+    scannedAt.insert(pid, QDateTime::currentMSecsSinceEpoch());
+    return found;
+}
+
+#else
+
+QVector<qint32> SocketInodeCache::listPids() const
+{
+    return QVector<qint32>();
+}
+
+int SocketInodeCache::scanProcess(qint32, QSet<quint32> *)
+{
+    return 0;
+}
+
+#endif
+
+void SocketInodeCache::resolve(const std::vector<quint32> &inodes, qint64 budgetMicros)
+{
+    QSet<quint32> wanted;
+    wanted.reserve(int(inodes.size()));
+    for (quint32 inode : inodes) {
+        if (!inodeOwners.contains(inode))
+            wanted.insert(inode);
+    }
+    if (wanted.isEmpty())
+        return;
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    // Never-scanned PIDs first, then the ones scanned longest ago
+    QVector<qint32> pids = listPids();
+    QHash<qint32, qint64> alive;
+    alive.reserve(pids.size());
+    for (qint32 pid : pids)
+        alive.insert(pid, scannedAt.value(pid, -1));
+    for (auto it = scannedAt.begin(); it != scannedAt.end();) {
+        if (alive.contains(it.key()))
+            ++it;
+        else
+            it = scannedAt.erase(it);
+    }
+    std::sort(pids.begin(), pids.end(), [&alive](qint32 a, qint32 b) {
+        return alive.value(a) < alive.value(b);
+    });
+
+    // Each scan takes what it resolved off the wanted set, so a refresh
+    // costs the sockets the PIDs hold, not PIDs times unresolved inodes
+    for (qint32 pid : pids) {
+        scanProcess(pid, &wanted);
+        if (wanted.isEmpty() || elapsed.nsecsElapsed() / 1000 > budgetMicros)
+            break;
+    }
+}
+
+void SocketInodeCache::retain(const std::vector<quint32> &liveInodes)
+{
+    for (auto it = inodeOwners.begin(); it != inodeOwners.end();) {
+        if (std::binary_search(liveInodes.begin(), liveInodes.end(), it.key()))
+            ++it;
+        else
+            it = inodeOwners.erase(it);
+    }
+}
+
+QHash<qint32, QString> SocketInodeCache::takeNewProcessNames()
+{
+    QHash<qint32, QString> names;
+    names.swap(pendingNames);
+    return names;
+}
+
+ConnectionMonitor::ConnectionMonitor(QObject *parent)
+    : QObject(parent), timer(this)
+{
+    qRegisterMetaType<ConnectionDiff>();
+    receiveBuffer.resize(256 * 1024);
+    connect(&timer, &QTimer::timeout, this, &ConnectionMonitor::refresh);
+}
+
+ConnectionMonitor::~ConnectionMonitor()
+{
+#ifdef Q_OS_LINUX
+    if (netlinkFd >= 0)
+        close(netlinkFd);
+#endif
+    if (metrics)
+        metrics->retire();
+}
+
+void ConnectionMonitor::setMetricsBus(MetricsBus *bus)
+{
+    metricsBus = bus;
+    if (!bus)
+        return;
+    socketsMetric = bus->metric("net.sockets", MetricsBus::Gauge);
+    openedMetric = bus->metric("net.sockets.opened", MetricsBus::Counter);
+    refreshMetric = bus->metric("net.refresh", MetricsBus::Sample, "ns");
+    // A full registry leaves the monitor off the bus
+    if (socketsMetric < 0 || openedMetric < 0 || refreshMetric < 0)
+        metricsBus = nullptr;
+}
+
+void ConnectionMonitor::start(int intervalMs)
+{
+    timer.start(intervalMs);
+    refresh();
+}
+
+void ConnectionMonitor::stop()
+{
+    timer.stop();
+}
+
+#ifdef Q_OS_LINUX
+
+bool ConnectionMonitor::openSocket()
+{
+    if (netlinkFd >= 0)
+        return true;
+    netlinkFd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+    if (netlinkFd < 0)
+        return false;
+    // Large dumps arrive in bursts; a bigger buffer means fewer recv calls
+    int size = 4 << 20;
+    setsockopt(netlinkFd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    return true;
+}
+
+bool ConnectionMonitor::dump(quint8 family, quint8 protocol, std::vector<ConnectionRow> &rows)
+{
+    struct {
+        nlmsghdr header;
+        inet_diag_req_v2 request;
+    } message;
+    memset(&message, 0, sizeof(message));
+    message.header.nlmsg_len = sizeof(message);
+    message.header.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+    message.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    message.header.nlmsg_seq = ++sequence;
+    message.request.sdiag_family = family;
+    message.request.sdiag_protocol = protocol;
+    message.request.idiag_states = ~0u;
+    // tcp_info carries the per-socket byte counters; UDP ignores it
+    message.request.idiag_ext = 1 << (INET_DIAG_INFO - 1);
+
+    sockaddr_nl kernel;
+    memset(&kernel, 0, sizeof(kernel));
+    kernel.nl_family = AF_NETLINK;
+    if (sendto(netlinkFd, &message, sizeof(message), 0, reinterpret_cast<sockaddr *>(&kernel), sizeof(kernel)) < 0)
+        return false;
+
+    for (;;) {
+        const ssize_t received = recv(netlinkFd, receiveBuffer.data(), receiveBuffer.size(), 0);
+        if (received < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        int remaining = int(received);
+        for (nlmsghdr *header = reinterpret_cast<nlmsghdr *>(receiveBuffer.data());
+             NLMSG_OK(header, remaining); header = NLMSG_NEXT(header, remaining)) {
+            if (header->nlmsg_seq != message.header.nlmsg_seq)
+                continue;
+            if (header->nlmsg_type == NLMSG_DONE)
+                return true;
+            if (header->nlmsg_type == NLMSG_ERROR)
+                return false;
+
+            const inet_diag_msg *diag = static_cast<const inet_diag_msg *>(NLMSG_DATA(header));
+            ConnectionRow row;
+            row.cookie = quint64(diag->id.idiag_cookie[1]) << 32 | diag->id.idiag_cookie[0];
+            row.family = diag->idiag_family;
+            row.protocol = protocol;
+            row.state = diag->idiag_state;
+            row.localPort = ntohs(diag->id.idiag_sport);
+            row.remotePort = ntohs(diag->id.idiag_dport);
+            const size_t addressBytes = family == AF_INET ? 4 : 16;
+            memcpy(row.localAddress, diag->id.idiag_src, addressBytes);
+            memcpy(row.remoteAddress, diag->id.idiag_dst, addressBytes);
+            row.inode = diag->idiag_inode;
+            row.uid = diag->idiag_uid;
+            row.rxQueue = diag->idiag_rqueue;
+            row.txQueue = diag->idiag_wqueue;
+
+            int attributeBytes = int(header->nlmsg_len - NLMSG_LENGTH(sizeof(*diag)));
+            for (const rtattr *attribute = reinterpret_cast<const rtattr *>(diag + 1);
+                 RTA_OK(attribute, attributeBytes); attribute = RTA_NEXT(attribute, attributeBytes)) {
+                if (attribute->rta_type != INET_DIAG_INFO)
+                    continue;
+                // Older kernels send a shorter tcp_info; missing fields stay zero
+                tcp_info info;
+                memset(&info, 0, sizeof(info));
+                memcpy(&info, RTA_DATA(attribute), qMin<size_t>(RTA_PAYLOAD(attribute), sizeof(info)));
+                if (RTA_PAYLOAD(attribute) >= offsetof(tcp_info, tcpi_bytes_received) + sizeof(info.tcpi_bytes_received)) {
+                    row.bytesReceived = info.tcpi_bytes_received;
+                    row.bytesSent = info.tcpi_bytes_acked;
+                }
+            }
+            rows.push_back(row);
+        }
+    }
+}
+
+#else
+
+bool ConnectionMonitor::openSocket()
+{
+    return false;
+}
+
+bool ConnectionMonitor::dump(quint8, quint8, std::vector<ConnectionRow> &)
+{
+    return false;
+}
+
+#endif
+
+void ConnectionMonitor::refresh()
+{
+    QElapsedTimer wall;
+    wall.start();
+    const qint64 cpuStart = threadCpuMicros();
+
+    if (!openSocket()) {
+        if (!reportedError) {
+            reportedError = true;
+            emit error(tr("NETLINK_SOCK_DIAG is not available: %1").arg(QString::fromLocal8Bit(strerror(errno))));
+        }
+        return;
+    }
+
+#ifdef Q_OS_LINUX
+    const quint8 families[] = { AF_INET, AF_INET6 };
+    const quint8 protocols[] = { IPPROTO_TCP, IPPROTO_UDP };
+#else
+    const quint8 families[] = { 0 };
+    const quint8 protocols[] = { 0 };
+#endif
+    current.clear();
+    current.reserve(previous.size() + 1024);
+    for (quint8 protocol : protocols) {
+        for (quint8 family : families) {
+            if (!dump(family, protocol, current)) {
+                emit error(tr("sock_diag dump failed"));
+                return;
+            }
+        }
+    }
+    std::sort(current.begin(), current.end(), cookieLess);
+
+    ConnectionDiff diff;
+    diff.stats.netlinkMicros = wall.nsecsElapsed() / 1000;
+
+    // Fill PIDs from the cache, then spend a bounded budget on the rest
+    std::vector<quint32> unresolved;
+    for (ConnectionRow &row : current) {
+        if (row.inode == 0)
+            continue;
+        row.pid = inodeCache.lookup(row.inode);
+        if (row.pid < 0)
+            unresolved.push_back(row.inode);
+    }
+    const qint64 scanStart = wall.nsecsElapsed();
+    inodeCache.resolve(unresolved, kInodeScanBudgetMicros);
+    diff.stats.inodeScanMicros = (wall.nsecsElapsed() - scanStart) / 1000;
+    if (!unresolved.empty()) {
+        for (ConnectionRow &row : current) {
+            if (row.pid < 0 && row.inode != 0)
+                row.pid = inodeCache.lookup(row.inode);
+            diff.stats.unresolvedInodes += (row.pid < 0 && row.inode != 0) ? 1 : 0;
+        }
+    }
+
+    if (++refreshCount % kRetainEveryRefreshes == 0) {
+        std::vector<quint32> live;
+        live.reserve(current.size());
+        for (const ConnectionRow &row : current)
+            live.push_back(row.inode);
+        std::sort(live.begin(), live.end());
+        inodeCache.retain(live);
+    }
+
+    // Both snapshots are sorted by cookie, so one merge pass finds
+    // additions, removals and in-place changes. The same pass sums each
+    // process's byte counter deltas; a socket that is new since the last
+    // refresh counts in full, except on the first refresh
+    const bool countTraffic = refreshCount > 1;
+    auto addTraffic = [&diff](const ConnectionRow &row, quint64 received, quint64 sent) {
+        if (row.pid < 0 || (received == 0 && sent == 0))
+            return;
+        ProcessTraffic &traffic = diff.traffic[row.pid];
+        traffic.bytesReceived += received;
+        traffic.bytesSent += sent;
+    };
+    size_t i = 0, j = 0;
+    while (i < previous.size() || j < current.size()) {
+        if (j == current.size() || (i < previous.size() && previous[i].cookie < current[j].cookie)) {
+            diff.removed.append(previous[i++].cookie);
+        } else if (i == previous.size() || current[j].cookie < previous[i].cookie) {
+            if (countTraffic)
+                addTraffic(current[j], current[j].bytesReceived, current[j].bytesSent);
+            diff.added.append(current[j++]);
+        } else {
+            const ConnectionRow &now = current[j];
+            const ConnectionRow &before = previous[i];
+            if (countTraffic)
+                addTraffic(now, now.bytesReceived >= before.bytesReceived ? now.bytesReceived - before.bytesReceived : 0,
+                           now.bytesSent >= before.bytesSent ? now.bytesSent - before.bytesSent : 0);
+            if (!now.sameVisibleState(before))
+                diff.changed.append(now);
+            ++i;
+            ++j;
+        }
+    }
+    previous.swap(current);
+
+    diff.processNames = inodeCache.takeNewProcessNames();
+    diff.stats.sockets = int(previous.size());
+    diff.stats.added = diff.added.size();
+    diff.stats.removed = diff.removed.size();
+    diff.stats.changed = diff.changed.size();
+    diff.stats.wallMicros = wall.nsecsElapsed() / 1000;
+    diff.stats.cpuMicros = threadCpuMicros() - cpuStart;
+    if (metricsBus && !metrics)
+        metrics = metricsBus->attach("Connections");
+    if (metrics) {
+        metrics->set(socketsMetric, diff.stats.sockets);
+        // The first refresh finds sockets, it does not see them open
+        metrics->add(openedMetric, countTraffic ? quint64(diff.stats.added) : 0);
+        metrics->record(refreshMetric, diff.stats.wallMicros * 1000);
+    }
+    emit diffReady(diff);
+}
@@ -0,0 +1,154 @@
+#ifndef CONNECTIONMONITOR_H
+#define CONNECTIONMONITOR_H
+
+#include <QObject>
+#include <QHash>
+#include <QMetaType>
+#include <QSet>
+#include <QString>
+#include <QTimer>
+#include <QVector>
+#include <memory>
+#include <vector>
+
+class MetricsBus;
+class MetricsProducer;
+
+// One TCP or UDP socket as reported by sock_diag. The kernel socket cookie
+// is unique for the socket's lifetime and is used as the row identity.
+struct ConnectionRow
+{
+    quint64 cookie = 0;
+    quint8 family = 0;     // AF_INET / AF_INET6
+    quint8 protocol = 0;   // IPPROTO_TCP / IPPROTO_UDP
+    quint8 state = 0;      // TCP_* state from <netinet/tcp.h>
+    quint8 reserved = 0;
+    quint16 localPort = 0;
+    quint16 remotePort = 0;
+    quint8 localAddress[16] = {};
+    quint8 remoteAddress[16] = {};
+    quint32 inode = 0;
+    quint32 uid = 0;
+    quint32 rxQueue = 0;
+    quint32 txQueue = 0;
+    qint32 pid = -1;       // -1 until the inode cache resolves it
+    quint64 bytesReceived = 0;  // TCP only, from tcp_info
+    quint64 bytesSent = 0;      // Acknowledged by the peer
+
+    // Columns the UI shows and which therefore count as a change
+    bool sameVisibleState(const ConnectionRow &other) const
+    {
+        return state == other.state && rxQueue == other.rxQueue && txQueue == other.txQueue
+               && pid == other.pid;
+    }
+};
+
+struct ConnectionRefreshStats
+{
+    int sockets = 0;
+    int added = 0;
+    int removed = 0;
+    int changed = 0;
+    int unresolvedInodes = 0;
+    qint64 wallMicros = 0;     // Whole refresh including PID resolution
+    qint64 cpuMicros = 0;      // Thread CPU time spent in the refresh
+    qint64 netlinkMicros = 0;  // Dump + decode only
+    qint64 inodeScanMicros = 0;
+};
+
+// Bytes a process moved over TCP since the previous refresh
+struct ProcessTraffic
+{
+    quint64 bytesReceived = 0;
+    quint64 bytesSent = 0;
+};
+
+// Everything the UI needs to update its table incrementally
+struct ConnectionDiff
+{
+    QVector<ConnectionRow> added;
+    QVector<ConnectionRow> changed;
+    QVector<quint64> removed;
+    QHash<qint32, QString> processNames;  // Newly seen PIDs only
+    QHash<qint32, ProcessTraffic> traffic; // Per PID; empty on the first refresh
+    ConnectionRefreshStats stats;
+};
+
+Q_DECLARE_METATYPE(ConnectionDiff)
+
+// Maps socket inodes to owning PIDs by reading /proc/<pid>/fd, but only
+// for inodes it has not seen before and within a per-refresh time budget.
+// PIDs discovered since the previous scan are checked first, because new
+// sockets mostly belong to new processes.
+class SocketInodeCache
+{
+public:
+    // Returns the PID owning `inode`, or -1 if not (yet) known
+    qint32 lookup(quint32 inode) const { return inodeOwners.value(inode, -1); }
+
+    // Tries to resolve the given inodes, spending at most budgetMicros
+    void resolve(const std::vector<quint32> &inodes, qint64 budgetMicros);
+
+    // Forgets inodes that no longer exist
+    void retain(const std::vector<quint32> &liveInodes);
+
+    QHash<qint32, QString> takeNewProcessNames();
+
+private:
+    // Records the PID's sockets and returns how many of them it took
+    // off `wanted`
+    int scanProcess(qint32 pid, QSet<quint32> *wanted);
+    QVector<qint32> listPids() const;
+
+    QHash<quint32, qint32> inodeOwners;
+    QHash<qint32, qint64> scannedAt;      // PID -> last scan time (ms)
+    QHash<qint32, QString> pendingNames;
+};
+
+// Periodically dumps all TCP/UDP sockets with NETLINK_SOCK_DIAG (binary,
+// one request per family/protocol pair) instead of parsing the text in
+// /proc/net/tcp*, and emits only what changed since the previous dump.
+// Intended to live on a worker thread; all work happens in its timer.
+class ConnectionMonitor : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ConnectionMonitor(QObject *parent = nullptr);
+    ~ConnectionMonitor();
+
+    // Before the first refresh; sockets, new sockets and refresh times are
+    // then counted there from the monitor's thread
+    void setMetricsBus(MetricsBus *bus);
+
+public slots:
+    void start(int intervalMs = 1000);
+    void stop();
+    void refresh();
+
+signals:
+    void diffReady(const ConnectionDiff &diff);
+    void error(const QString &message);
+
+private:
+    bool openSocket();
+    bool dump(quint8 family, quint8 protocol, std::vector<ConnectionRow> &rows);
+
+    int netlinkFd = -1;
+    QTimer timer;
+    std::vector<ConnectionRow> previous;   // Sorted by cookie
+    std::vector<ConnectionRow> current;
+    std::vector<char> receiveBuffer;
+    SocketInodeCache inodeCache;
+    quint32 sequence = 0;
+    int refreshCount = 0;
+    bool reportedError = false;
+
+    MetricsBus *metricsBus = nullptr;
+    std::shared_ptr<MetricsProducer> metrics;
+    int socketsMetric = -1;
+    int openedMetric = -1;
+    int refreshMetric = -1;
+};
+
+#endif // CONNECTIONMONITOR_H
@@ -0,0 +1,237 @@
+#include "connectiontablemodel.h"
+#include "firewallclassifier.h"
+#include "ipinfotable.h"
+#include <QHostAddress>
+
+namespace {
+
+// Linux AF_/IPPROTO_ values as reported by sock_diag
+const quint8 kFamilyInet = 2;
+const quint8 kFamilyInet6 = 10;
+const quint8 kProtocolUdp = 17;
+const quint8 kTcpSynReceived = 3;
+const quint8 kTcpListen = 10;
+
+// Start of the kernel's default ephemeral port range
+const quint16 kEphemeralPorts = 32768;
+
+// Beyond this many removals a reset is cheaper than row-by-row signals
+const int kResetThreshold = 2000;
+
+const char *tcpStateName(quint8 state)
+{
+    static const char *const names[] = {
+        "", "ESTABLISHED", "SYN_SENT", "SYN_RECV", "FIN_WAIT1", "FIN_WAIT2", "TIME_WAIT",
+        "CLOSE", "CLOSE_WAIT", "LAST_ACK", "LISTEN", "CLOSING", "NEW_SYN_RECV"
+    };
+    return state < sizeof(names) / sizeof(names[0]) ? names[state] : "?";
+}
+
+} // namespace
+
+ConnectionTableModel::ConnectionTableModel(QObject *parent)
+    : QAbstractTableModel(parent)
+{
+}
+
+int ConnectionTableModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : rows.size();
+}
+
+int ConnectionTableModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : ColumnCount;
+}
+
+QString ConnectionTableModel::formatEndpoint(const ConnectionRow &row, bool local) const
+{
+    const quint8 *bytes = local ? row.localAddress : row.remoteAddress;
+    const quint16 port = local ? row.localPort : row.remotePort;
+    QHostAddress address;
+    if (row.family == kFamilyInet) {
+        address.setAddress(quint32(bytes[0]) << 24 | quint32(bytes[1]) << 16 | quint32(bytes[2]) << 8 | bytes[3]);
+        return QString("%1:%2").arg(address.toString()).arg(port);
+    }
+    address.setAddress(bytes);
+    return QString("[%1]:%2").arg(address.toString()).arg(port);
+}
+
+QVariant ConnectionTableModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= rows.size() || role != Qt::DisplayRole)
+        return QVariant();
+
+    const ConnectionRow &row = rows.at(index.row());
+    switch (index.column()) {
+    case ProcessColumn:
+        if (row.pid < 0)
+            return QString("-");
+        return QString("%1 (%2)").arg(processNames.value(row.pid, "?")).arg(row.pid);
+    case ProtocolColumn: {
+        QString name = row.protocol == kProtocolUdp ? "UDP" : "TCP";
+        return row.family == kFamilyInet6 ? name + "6" : name;
+    }
+    case LocalColumn:
+        return formatEndpoint(row, true);
+    case RemoteColumn:
+        return formatEndpoint(row, false);
+    case OriginColumn:
+        return originText(row);
+    case StateColumn:
+        // Unconnected UDP sockets report TCP_CLOSE
+        if (row.protocol == kProtocolUdp)
+            return row.state == 1 ? "CONNECTED" : "";
+        return tcpStateName(row.state);
+    case QueueColumn:
+        return QString("%1 / %2").arg(row.rxQueue).arg(row.txQueue);
+    case RuleColumn:
+        return ruleText(row);
+    default:
+        return QVariant();
+    }
+}
+
+QVariant ConnectionTableModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation != Qt::Horizontal || role != Qt::DisplayRole)
+        return QVariant();
+
+    switch (section) {
+    case ProcessColumn: return tr("Process");
+    case ProtocolColumn: return tr("Proto");
+    case LocalColumn: return tr("Local");
+    case RemoteColumn: return tr("Remote");
+    case OriginColumn: return tr("Origin");
+    case StateColumn: return tr("State");
+    case QueueColumn: return tr("Rx / Tx queue");
+    case RuleColumn: return tr("Rule");
+    default: return QVariant();
+    }
+}
+
+void ConnectionTableModel::setClassifier(const FirewallClassifier *rules)
+{
+    classifier = rules;
+    reclassify();
+}
+
+void ConnectionTableModel::reclassify()
+{
+    if (!rows.isEmpty())
+        emit dataChanged(index(0, RuleColumn), index(rows.size() - 1, RuleColumn));
+}
+
+void ConnectionTableModel::setIpInfo(const IpInfoTable *table)
+{
+    ipInfo = table;
+    if (!rows.isEmpty())
+        emit dataChanged(index(0, OriginColumn), index(rows.size() - 1, OriginColumn));
+}
+
+// Looked up on demand like the Rule column; the table is mapped, so a
+// row costs a few cache misses
+QString ConnectionTableModel::originText(const ConnectionRow &row) const
+{
+    if (!ipInfo || !ipInfo->isOpen())
+        return QString();
+    return ipInfo->describe(*ipInfo->lookup(row.remoteAddress, row.family == kFamilyInet6));
+}
+
+// Classified on demand: only visible rows are asked for, and a lookup
+// costs well under the time to paint the cell
+QString ConnectionTableModel::ruleText(const ConnectionRow &row) const
+{
+    if (!classifier)
+        return QString();
+
+    // Listening sockets and connections to a local service port are
+    // inbound; the rest were opened from here
+    const bool inbound = row.state == kTcpListen || row.state == kTcpSynReceived
+                         || (row.localPort < kEphemeralPorts && row.remotePort >= kEphemeralPorts);
+    FirewallQuery query;
+    query.remoteAddress = FirewallAddress::fromBytes(row.remoteAddress, row.family == kFamilyInet6);
+    query.localPort = row.localPort;
+    query.remotePort = row.remotePort;
+    query.protocol = row.protocol;
+    query.direction = inbound ? FirewallRule::Inbound : FirewallRule::Outbound;
+    query.process = row.pid < 0 ? -1 : classifier->findProcessKey(processNames.value(row.pid));
+
+    const FirewallRule *rule = classifier->match(query);
+    if (!rule)
+        return "-";
+    const QString verdict = rule->action == FirewallRule::Allow ? tr("Allow") : tr("Block");
+    return rule->comment.isEmpty() ? verdict : QString("%1 (%2)").arg(verdict, rule->comment);
+}
+
+void ConnectionTableModel::removeRow(int row)
+{
+    const int last = rows.size() - 1;
+    rowOfCookie.remove(rows.at(row).cookie);
+    if (row != last) {
+        rows[row] = rows.at(last);
+        rowOfCookie.insert(rows.at(row).cookie, row);
+        emit dataChanged(index(row, 0), index(row, ColumnCount - 1));
+    }
+    beginRemoveRows(QModelIndex(), last, last);
+    rows.removeLast();
+    endRemoveRows();
+}
+
+void ConnectionTableModel::applyDiff(const ConnectionDiff &diff)
+{
+    for (auto it = diff.processNames.constBegin(); it != diff.processNames.constEnd(); ++it)
+        processNames.insert(it.key(), it.value());
+
+    if (diff.removed.size() > kResetThreshold) {
+        // Mass churn: rebuild instead of emitting thousands of signals
+        beginResetModel();
+        for (quint64 cookie : diff.removed) {
+            const int row = rowOfCookie.value(cookie, -1);
+            if (row < 0)
+                continue;
+            const int last = rows.size() - 1;
+            rowOfCookie.remove(cookie);
+            if (row != last) {
+                rows[row] = rows.at(last);
+                rowOfCookie.insert(rows.at(row).cookie, row);
+            }
+            rows.removeLast();
+        }
+        for (const ConnectionRow &row : diff.changed) {
+            const int existing = rowOfCookie.value(row.cookie, -1);
+            if (existing >= 0)
+                rows[existing] = row;
+        }
+        for (const ConnectionRow &row : diff.added) {
+            rowOfCookie.insert(row.cookie, rows.size());
+            rows.append(row);
+        }
+        endResetModel();
+        return;
+    }
+
+    for (quint64 cookie : diff.removed) {
+        const int row = rowOfCookie.value(cookie, -1);
+        if (row >= 0)
+            removeRow(row);
+    }
+
+    for (const ConnectionRow &row : diff.changed) {
+        const int existing = rowOfCookie.value(row.cookie, -1);
+        if (existing < 0)
+            continue;
+        rows[existing] = row;
+        emit dataChanged(index(existing, 0), index(existing, ColumnCount - 1));
+    }
+
+    if (!diff.added.isEmpty()) {
+        const int first = rows.size();
+        beginInsertRows(QModelIndex(), first, first + diff.added.size() - 1);
+        for (const ConnectionRow &row : diff.added) {
+            rowOfCookie.insert(row.cookie, rows.size());
+            rows.append(row);
+        }
+        endInsertRows();
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef CONNECTIONTABLEMODEL_H
+#define CONNECTIONTABLEMODEL_H
+
+#include <QAbstractTableModel>
+#include <QHash>
+#include <QVector>
+#include "connectionmonitor.h"
+
+class FirewallClassifier;
+class IpInfoTable;
+
+// Live socket table for the Network tab. Applies ConnectionDiffs in place:
+// removals swap the last row into the hole, so each update costs time
+// proportional to the diff rather than to the number of sockets.
+class ConnectionTableModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+    enum Column {
+        ProcessColumn = 0,
+        ProtocolColumn,
+        LocalColumn,
+        RemoteColumn,
+        OriginColumn,
+        StateColumn,
+        QueueColumn,
+        RuleColumn,
+        ColumnCount
+    };
+
+    explicit ConnectionTableModel(QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+    // Rules to classify rows against in the Rule column; nullptr hides
+    // the verdicts. The classifier must outlive the model or be unset.
+    void setClassifier(const FirewallClassifier *classifier);
+    // Country, AS and reputation for the Origin column; same lifetime
+    // rule as the classifier
+    void setIpInfo(const IpInfoTable *table);
+
+public slots:
+    void applyDiff(const ConnectionDiff &diff);
+    // The rules changed; refresh the Rule column
+    void reclassify();
+
+private:
+    void removeRow(int row);
+    QString formatEndpoint(const ConnectionRow &row, bool local) const;
+    QString ruleText(const ConnectionRow &row) const;
+    QString originText(const ConnectionRow &row) const;
+
+    QVector<ConnectionRow> rows;
+    QHash<quint64, int> rowOfCookie;
+    QHash<qint32, QString> processNames;
+    const FirewallClassifier *classifier = nullptr;
+    const IpInfoTable *ipInfo = nullptr;
+};
+
+#endif // CONNECTIONTABLEMODEL_H
@@ -0,0 +1,300 @@
+#include "daemonclient.h"
+#include "eventjournal.h"
+#include <QElapsedTimer>
+#include <QFile>
+#include <QSocketNotifier>
+#include <cstring>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+DaemonClient::DaemonClient(QObject *parent)
+    : QObject(parent)
+{
+}
+
+DaemonClient::~DaemonClient()
+{
+    detach();
+}
+
+#ifdef Q_OS_LINUX
+
+bool DaemonClient::attach(const QString &socketPath)
+{
+    detach();
+    const QByteArray path = QFile::encodeName(socketPath);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.isEmpty() || size_t(path.size()) >= sizeof(address.sun_path)) {
+        lastError = "Socket path is empty or too long: " + socketPath;
+        return false;
+    }
+    memcpy(address.sun_path, path.constData(), size_t(path.size()));
+
+    socketFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (socketFd < 0 || ::connect(socketFd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+        lastError = QString("No daemon at %1: %2").arg(socketPath, QString::fromLocal8Bit(strerror(errno)));
+        detach();
+        return false;
+    }
+    fcntl(socketFd, F_SETFL, fcntl(socketFd, F_GETFL) | O_NONBLOCK);
+
+    DaemonHelloBody hello;
+    hello.version = kDaemonProtocolVersion;
+    hello.reserved = 0;
+    DaemonMessageHeader header;
+    int ringFd = -1;
+    if (!request(DaemonMessage::Hello, reinterpret_cast<const char *>(&hello), sizeof(hello), &header, &ringFd)) {
+        detach();
+        return false;
+    }
+
+    DaemonWelcomeBody welcome;
+    if (DaemonMessage(header.type) != DaemonMessage::Welcome || replyBody.size() != int(sizeof(welcome)) || ringFd < 0) {
+        if (ringFd >= 0)
+            ::close(ringFd);
+        lastError = DaemonMessage(header.type) == DaemonMessage::Failed ? QString::fromUtf8(replyBody)
+                                                                        : QString("Unexpected reply to Hello");
+        detach();
+        return false;
+    }
+    memcpy(&welcome, replyBody.constData(), sizeof(welcome));
+    if (!shared.attach(ringFd)) {
+        lastError = shared.errorString();
+        detach();
+        return false;
+    }
+    pid = qint64(welcome.daemonPid);
+
+    // Readable from now on only when the daemon goes away, or with a
+    // reply to a request that gave up waiting
+    notifier = new QSocketNotifier(socketFd, QSocketNotifier::Read, this);
+    connect(notifier, &QSocketNotifier::activated, this, &DaemonClient::onSocketReadable);
+    return true;
+}
+
+void DaemonClient::detach()
+{
+    // Often called from the notifier's own signal
+    if (notifier) {
+        notifier->setEnabled(false);
+        notifier->deleteLater();
+    }
+    notifier = nullptr;
+    shared.close();
+    if (socketFd >= 0)
+        ::close(socketFd);
+    socketFd = -1;
+    pid = 0;
+}
+
+bool DaemonClient::request(DaemonMessage type, const char *body, int size, DaemonMessageHeader *replyHeader,
+                           int *passedFd)
+{
+    const quint32 id = nextRequestId++;
+    if (!sendDaemonMessage(socketFd, type, id, body, size)) {
+        lastError = QString("Cannot reach the daemon: %1").arg(QString::fromLocal8Bit(strerror(errno)));
+        // Turned away: the daemon said why before it hung up
+        if (receiveDaemonMessage(socketFd, replyHeader, &replyBody, passedFd) > 0
+            && DaemonMessage(replyHeader->type) == DaemonMessage::Failed)
+            lastError = QString::fromUtf8(replyBody);
+        return false;
+    }
+
+    QElapsedTimer waited;
+    waited.start();
+    for (;;) {
+        const int received = receiveDaemonMessage(socketFd, replyHeader, &replyBody, passedFd);
+        if (received > 0) {
+            // Turned away before Hello was read; that reason has no id
+            if (replyHeader->requestId == id
+                || (replyHeader->requestId == 0 && DaemonMessage(replyHeader->type) == DaemonMessage::Failed))
+                return true;
+            // A late reply to a request that gave up
+            if (passedFd && *passedFd >= 0)
+                ::close(*passedFd);
+            continue;
+        }
+        if (received == 0) {
+            lastError = "The daemon closed the connection";
+            return false;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            lastError = QString("Cannot read from the daemon: %1").arg(QString::fromLocal8Bit(strerror(errno)));
+            return false;
+        }
+        const qint64 remainingMs = kReplyTimeoutMs - waited.elapsed();
+        if (remainingMs <= 0) {
+            lastError = "The daemon did not answer";
+            return false;
+        }
+        struct pollfd readable;
+        readable.fd = socketFd;
+        readable.events = POLLIN;
+        readable.revents = 0;
+        poll(&readable, 1, int(remainingMs));
+    }
+}
+
+void DaemonClient::onSocketReadable()
+{
+    while (socketFd >= 0) {
+        DaemonMessageHeader header;
+        int fd = -1;
+        const int received = receiveDaemonMessage(socketFd, &header, &replyBody, &fd);
+        if (received > 0) {
+            if (fd >= 0)
+                ::close(fd);
+            continue;
+        }
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        lastError = "The daemon went away";
+        detach();
+        emit detached();
+    }
+}
+
+#else
+
+bool DaemonClient::attach(const QString &)
+{
+    lastError = "The daemon needs Linux";
+    return false;
+}
+
+void DaemonClient::detach()
+{
+}
+
+bool DaemonClient::request(DaemonMessage, const char *, int, DaemonMessageHeader *, int *)
+{
+    lastError = "The daemon needs Linux";
+    return false;
+}
+
+void DaemonClient::onSocketReadable()
+{
+}
+
+#endif
+
+bool DaemonClient::ping(int payloadBytes, qint64 *roundTripNs)
+{
+    if (!isAttached()) {
+        lastError = "Not attached to the daemon";
+        return false;
+    }
+    QElapsedTimer timer;
+    timer.start();
+    pingBody.resize(qBound(0, payloadBytes, kDaemonMaxMessageBytes));
+    DaemonMessageHeader header;
+    if (!request(DaemonMessage::Ping, pingBody.constData(), pingBody.size(), &header, nullptr))
+        return false;
+    if (DaemonMessage(header.type) != DaemonMessage::Pong || replyBody.size() != pingBody.size()) {
+        lastError = "Unexpected reply to Ping";
+        return false;
+    }
+    *roundTripNs = timer.nsecsElapsed();
+    return true;
+}
+
+bool DaemonClient::startScan(const QString &path)
+{
+    return command(DaemonMessage::StartScan, path.toUtf8());
+}
+
+bool DaemonClient::cancelScan()
+{
+    return command(DaemonMessage::CancelScan, QByteArray());
+}
+
+bool DaemonClient::startCapture(const QString &interfaceName)
+{
+    return command(DaemonMessage::StartCapture, interfaceName.toUtf8());
+}
+
+bool DaemonClient::stopCapture()
+{
+    return command(DaemonMessage::StopCapture, QByteArray());
+}
+
+bool DaemonClient::startTunnel(const VpnTunnel::Options &options)
+{
+    DaemonTunnelBody body;
+    if (!packTunnelOptions(options, &body)) {
+        lastError = "Tunnel options too long for the daemon, or the key is not 32 bytes";
+        return false;
+    }
+    return command(DaemonMessage::StartTunnel, QByteArray(reinterpret_cast<const char *>(&body), int(sizeof(body))));
+}
+
+bool DaemonClient::stopTunnel()
+{
+    return command(DaemonMessage::StopTunnel, QByteArray());
+}
+
+bool DaemonClient::queryTunnel(VpnStats *stats, bool *running, QString *failure, VpnTunnel::Options *options)
+{
+    if (!isAttached()) {
+        lastError = "Not attached to the daemon";
+        return false;
+    }
+    DaemonMessageHeader header;
+    if (!request(DaemonMessage::QueryTunnel, nullptr, 0, &header, nullptr))
+        return false;
+    DaemonTunnelStatusBody status;
+    if (DaemonMessage(header.type) != DaemonMessage::TunnelStatus || replyBody.size() != int(sizeof(status))) {
+        lastError = DaemonMessage(header.type) == DaemonMessage::Failed ? QString::fromUtf8(replyBody)
+                                                                        : QString("Unexpected reply to QueryTunnel");
+        return false;
+    }
+    memcpy(&status, replyBody.constData(), sizeof(status));
+    *stats = unpackTunnelStatus(status);
+    *running = status.running != 0;
+    *failure = QString::fromUtf8(status.failure, int(qstrnlen(status.failure, sizeof(status.failure))));
+    if (options) {
+        *options = unpackTunnelOptions(status.options);
+        options->key.clear();
+    }
+    return true;
+}
+
+bool DaemonClient::command(DaemonMessage type, const QByteArray &body)
+{
+    if (!isAttached()) {
+        lastError = "Not attached to the daemon";
+        return false;
+    }
+    DaemonMessageHeader header;
+    if (!request(type, body.constData(), body.size(), &header, nullptr))
+        return false;
+    if (DaemonMessage(header.type) != DaemonMessage::Ok) {
+        lastError = QString::fromUtf8(replyBody);
+        return false;
+    }
+    return true;
+}
+
+int DaemonClient::takeEvents(EventJournal *journal, int budget)
+{
+    int taken = 0;
+    while (taken < budget) {
+        const DaemonRing::Record *record = shared.peek();
+        if (!record)
+            break;
+        if (record->type < EventJournal::TypeCount)
+            journal->append(record->type, record->timeUs, record->payload(), int(record->bytes));
+        shared.release(record);
+        ++taken;
+    }
+    return taken;
+}
@@ -0,0 +1,78 @@
+#ifndef DAEMONCLIENT_H
+#define DAEMONCLIENT_H
+
+#include <QByteArray>
+#include <QObject>
+#include <QString>
+#include "daemonprotocol.h"
+#include "daemonring.h"
+
+class EventJournal;
+class QSocketNotifier;
+
+// The GUI's end of rhynec-daemon: attaching connects to its socket, says
+// Hello and maps the DaemonRing the Welcome brings, a round trip and an
+// mmap; detaching unmaps it and closes the socket.
+//
+// Commands wait for their reply, at most kReplyTimeoutMs; the daemon
+// answers them from its event loop without touching the engines' threads.
+// Results are not pushed: the caller drains them from ring() on its own
+// timer, or straight into a journal with takeEvents().
+class DaemonClient : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const int kReplyTimeoutMs = 2000;
+
+    explicit DaemonClient(QObject *parent = nullptr);
+    ~DaemonClient();
+
+    bool attach(const QString &socketPath = QString::fromLatin1(kDaemonSocketPath));
+    void detach();
+    bool isAttached() const { return socketFd >= 0; }
+    QString errorString() const { return lastError; }
+    qint64 daemonPid() const { return pid; }
+
+    // A Ping carrying `payloadBytes`, and the time until its Pong
+    bool ping(int payloadBytes, qint64 *roundTripNs);
+    bool startScan(const QString &path);
+    bool cancelScan();
+    bool startCapture(const QString &interfaceName);
+    bool stopCapture();
+    // The tunnel runs in the daemon, which holds CAP_NET_ADMIN for its TUN
+    // device; it stays up after the GUI detaches. Stopping waits for it.
+    bool startTunnel(const VpnTunnel::Options &options);
+    bool stopTunnel();
+    // Its counters, whether it runs, why its last run failed if it did,
+    // and what it was started with, the key left empty
+    bool queryTunnel(VpnStats *stats, bool *running, QString *failure, VpnTunnel::Options *options = nullptr);
+
+    // Valid while attached
+    DaemonRing *ring() { return &shared; }
+    // Appends up to `budget` events from the ring to `journal`, straight
+    // from the shared memory; returns how many
+    int takeEvents(EventJournal *journal, int budget);
+
+signals:
+    // The daemon went away; detach() does not send it
+    void detached();
+
+private slots:
+    void onSocketReadable();
+
+private:
+    bool command(DaemonMessage type, const QByteArray &body);
+    bool request(DaemonMessage type, const char *body, int size, DaemonMessageHeader *replyHeader, int *passedFd);
+
+    int socketFd = -1;
+    QSocketNotifier *notifier = nullptr;
+    DaemonRing shared;
+    quint32 nextRequestId = 1;
+    qint64 pid = 0;
+    QByteArray replyBody;                    // Reused for every reply
+    QByteArray pingBody;
+    QString lastError;
+};
+
+#endif // DAEMONCLIENT_H
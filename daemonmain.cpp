@@ -0,0 +1,69 @@
+#include "daemonserver.h"
+#include "parserworker.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QSocketNotifier>
+#include <cstdio>
+
+#ifdef Q_OS_LINUX
+#include <csignal>
+#include <sys/signalfd.h>
+#include <unistd.h>
+#endif
+
+// rhynec-daemon: the engines that need privileges, served to the GUI over
+// a Unix socket. Stays in the foreground; the service manager runs it.
+int main(int argc, char *argv[])
+{
+    // The scan pool's sandboxed workers re-exec this binary
+    if (argc > 1 && qstrcmp(argv[1], "--parser-worker") == 0)
+        return runParserWorker(argc, argv);
+
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("rhynec-daemon");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Rhynec Security privileged backend");
+    parser.addHelpOption();
+    QCommandLineOption socketOption("socket", QString("Listen on <path> (default %1).").arg(kDaemonSocketPath), "path",
+                                    QString::fromLatin1(kDaemonSocketPath));
+    QCommandLineOption groupOption("group", "Let members of <group> attach, besides root.", "group");
+    QCommandLineOption ringOption("ring-mb", "Keep up to <megabytes> of results for the GUI (default 8).", "megabytes",
+                                  "8");
+    parser.addOptions({ socketOption, groupOption, ringOption });
+    parser.process(app);
+
+    DaemonServer::Options options;
+    options.socketPath = parser.value(socketOption);
+    options.group = parser.value(groupOption);
+    options.ringBytes = qBound(1ll, parser.value(ringOption).toLongLong(), 1024ll) << 20;
+
+#ifdef Q_OS_LINUX
+    // SIGTERM and SIGINT end the event loop, so the server removes its
+    // socket on the way out
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGTERM);
+    sigaddset(&stopSignals, SIGINT);
+    sigprocmask(SIG_BLOCK, &stopSignals, nullptr);
+    const int signalFd = signalfd(-1, &stopSignals, SFD_CLOEXEC | SFD_NONBLOCK);
+    QSocketNotifier signalNotifier(signalFd, QSocketNotifier::Read);
+    QObject::connect(&signalNotifier, &QSocketNotifier::activated, &app, &QCoreApplication::quit);
+#endif
+
+    int status = 0;
+    {
+        DaemonServer server;
+        if (!server.listen(options)) {
+            fprintf(stderr, "rhynec-daemon: %s\n", qPrintable(server.errorString()));
+            status = 1;
+        } else {
+            status = app.exec();
+        }
+    }
+#ifdef Q_OS_LINUX
+    signalNotifier.setEnabled(false);
+    close(signalFd);
+#endif
+    return status;
+}
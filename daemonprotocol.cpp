@@ -0,0 +1,238 @@
+#include "daemonprotocol.h"
+#include <cstring>
+
+static_assert(sizeof(DaemonTunnelBody::key) == ChaCha20Poly1305::kKeySize, "the tunnel key travels whole");
+
+namespace {
+
+// False if `text` had to be cut short
+template <size_t Size>
+bool packText(char (&field)[Size], const QString &text)
+{
+    const QByteArray bytes = text.toUtf8();
+    const size_t length = qMin(Size, size_t(bytes.size()));
+    memset(field, 0, Size);
+    memcpy(field, bytes.constData(), length);
+    return length == size_t(bytes.size());
+}
+
+template <size_t Size>
+QString unpackText(const char (&field)[Size])
+{
+    return QString::fromUtf8(field, int(qstrnlen(field, uint(Size))));
+}
+
+} // namespace
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+bool sendDaemonMessage(int socket, DaemonMessage type, quint32 requestId, const char *body, int size, int passFd)
+{
+    DaemonMessageHeader header;
+    header.type = quint16(type);
+    header.reserved = 0;
+    header.requestId = requestId;
+
+    struct iovec parts[2];
+    parts[0].iov_base = &header;
+    parts[0].iov_len = sizeof(header);
+    parts[1].iov_base = const_cast<char *>(body);
+    parts[1].iov_len = size_t(qMax(size, 0));
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = parts;
+    message.msg_iovlen = size > 0 ? 2 : 1;
+
+    union {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    if (passFd >= 0) {
+        memset(&control, 0, sizeof(control));
+        message.msg_control = control.buffer;
+        message.msg_controllen = sizeof(control.buffer);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &passFd, sizeof(int));
+    }
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(socket, &message, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    return sent == ssize_t(sizeof(header)) + qMax(size, 0);
+}
+
+int receiveDaemonMessage(int socket, DaemonMessageHeader *header, QByteArray *body, int *passedFd)
+{
+    if (passedFd)
+        *passedFd = -1;
+    // Growing back to the largest message keeps the allocation of the
+    // last call, so a client reusing `body` allocates once
+    body->resize(kDaemonMaxMessageBytes);
+
+    struct iovec parts[2];
+    parts[0].iov_base = header;
+    parts[0].iov_len = sizeof(*header);
+    parts[1].iov_base = body->data();
+    parts[1].iov_len = size_t(body->size());
+
+    union {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = parts;
+    message.msg_iovlen = 2;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    ssize_t received;
+    do {
+        received = recvmsg(socket, &message, MSG_CMSG_CLOEXEC);
+    } while (received < 0 && errno == EINTR);
+    if (received < 0) {
+        body->clear();
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len >= CMSG_LEN(sizeof(int)))
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+
+    if (received == 0) {
+        body->clear();
+        return 0;
+    }
+    if (received < ssize_t(sizeof(*header)) || (message.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+        if (fd >= 0)
+            close(fd);
+        body->clear();
+        errno = EPROTO;
+        return -1;
+    }
+    body->resize(int(received - ssize_t(sizeof(*header))));
+    if (passedFd)
+        *passedFd = fd;
+    else if (fd >= 0)
+        close(fd);
+    return 1;
+}
+
+#else
+
+bool sendDaemonMessage(int, DaemonMessage, quint32, const char *, int, int)
+{
+    return false;
+}
+
+int receiveDaemonMessage(int, DaemonMessageHeader *, QByteArray *body, int *passedFd)
+{
+    if (passedFd)
+        *passedFd = -1;
+    body->clear();
+    return -1;
+}
+
+#endif
+
+bool packTunnelOptions(const VpnTunnel::Options &options, DaemonTunnelBody *body)
+{
+    memset(body, 0, sizeof(*body));
+    if (options.key.size() != int(sizeof(body->key)))
+        return false;
+    memcpy(body->key, options.key.constData(), sizeof(body->key));
+    body->mtu = quint32(qMax(options.mtu, 0));
+    body->listenPort = options.listenPort;
+    body->peerPort = options.peerPort;
+    body->queues = quint32(qMax(options.queues, 0));
+    body->batchSize = quint32(qMax(options.batchSize, 0));
+    body->ioUring = options.ioUring ? 1 : 0;
+    bool fits = packText(body->interfaceName, options.interfaceName);
+    fits = packText(body->address, options.address) && fits;
+    fits = packText(body->peerAddress, options.peerAddress) && fits;
+    return fits;
+}
+
+VpnTunnel::Options unpackTunnelOptions(const DaemonTunnelBody &body)
+{
+    VpnTunnel::Options options;
+    options.interfaceName = unpackText(body.interfaceName);
+    options.address = unpackText(body.address);
+    options.mtu = int(qMin(body.mtu, quint32(65535)));
+    options.listenPort = body.listenPort;
+    options.peerAddress = unpackText(body.peerAddress);
+    options.peerPort = body.peerPort;
+    options.key = QByteArray(reinterpret_cast<const char *>(body.key), int(sizeof(body.key)));
+    options.queues = int(qMin(body.queues, quint32(1024)));
+    options.batchSize = int(qMin(body.batchSize, quint32(1024)));
+    options.ioUring = body.ioUring != 0;
+    return options;
+}
+
+void packTunnelStatus(const VpnStats &stats, bool running, const QString &failure, DaemonTunnelStatusBody *body)
+{
+    memset(body, 0, sizeof(*body));
+    body->running = running ? 1 : 0;
+    body->gso = stats.gso ? 1 : 0;
+    body->gro = stats.gro ? 1 : 0;
+    body->queues = stats.queues;
+    body->sessions = stats.sessions;
+    body->txPackets = stats.txPackets;
+    body->txBytes = stats.txBytes;
+    body->rxPackets = stats.rxPackets;
+    body->rxBytes = stats.rxBytes;
+    body->tunReads = stats.tunReads;
+    body->tunWrites = stats.tunWrites;
+    body->sendCalls = stats.sendCalls;
+    body->receiveCalls = stats.receiveCalls;
+    body->syscalls = stats.syscalls;
+    body->authFailures = stats.authFailures;
+    body->replays = stats.replays;
+    body->dropped = stats.dropped;
+    body->handshakes = stats.handshakes;
+    body->txGbps = stats.txGbps;
+    body->rxGbps = stats.rxGbps;
+    body->elapsedMs = stats.elapsedMs;
+    packText(body->crypto, stats.crypto);
+    packText(body->io, stats.io);
+    packText(body->failure, failure);
+}
+
+VpnStats unpackTunnelStatus(const DaemonTunnelStatusBody &body)
+{
+    VpnStats stats;
+    stats.txPackets = body.txPackets;
+    stats.txBytes = body.txBytes;
+    stats.rxPackets = body.rxPackets;
+    stats.rxBytes = body.rxBytes;
+    stats.tunReads = body.tunReads;
+    stats.tunWrites = body.tunWrites;
+    stats.sendCalls = body.sendCalls;
+    stats.receiveCalls = body.receiveCalls;
+    stats.syscalls = body.syscalls;
+    stats.authFailures = body.authFailures;
+    stats.replays = body.replays;
+    stats.dropped = body.dropped;
+    stats.handshakes = body.handshakes;
+    stats.queues = body.queues;
+    stats.sessions = body.sessions;
+    stats.crypto = unpackText(body.crypto);
+    stats.gso = body.gso != 0;
+    stats.gro = body.gro != 0;
+    stats.io = unpackText(body.io);
+    stats.txGbps = body.txGbps;
+    stats.rxGbps = body.rxGbps;
+    stats.elapsedMs = body.elapsedMs;
+    return stats;
+}
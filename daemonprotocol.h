@@ -0,0 +1,136 @@
+#ifndef DAEMONPROTOCOL_H
+#define DAEMONPROTOCOL_H
+
+#include <QByteArray>
+#include <QtGlobal>
+#include "vpntunnel.h"
+
+// Wire format of the control channel between rhynec-daemon and the GUI.
+// Messages travel over a SOCK_SEQPACKET Unix socket, one message per
+// datagram: a DaemonMessageHeader, then a body whose layout the type
+// fixes, raw structs or UTF-8 text. Every request gets exactly one reply
+// carrying its requestId, and the daemon sends nothing unasked, so a
+// client can wait for its reply without matching anything else.
+//
+// Results and metrics do not go through the socket at all: Welcome
+// passes the memfd of a DaemonRing, which both sides map. The VPN
+// tunnel's counters are the exception: they are asked for with
+// QueryTunnel, about once a second, and come back in the reply.
+
+const char kDaemonSocketPath[] = "/run/rhynec/daemon.sock";
+const quint32 kDaemonProtocolVersion = 2;
+const int kDaemonMaxMessageBytes = 64 << 10;
+
+enum class DaemonMessage : quint16 {
+    Hello = 1,                 // DaemonHelloBody
+    Welcome,                   // DaemonWelcomeBody, with the ring's memfd
+    Ping,                      // Any body, echoed in the Pong
+    Pong,
+    StartScan,                 // Text: a file or directory
+    CancelScan,
+    StartCapture,              // Text: an interface, empty for all
+    StopCapture,
+    Ok,                        // A command was carried out
+    Failed,                    // Text: why not
+    StartTunnel,               // DaemonTunnelBody
+    StopTunnel,
+    QueryTunnel,               // Answered with TunnelStatus
+    TunnelStatus               // DaemonTunnelStatusBody
+};
+
+struct DaemonMessageHeader
+{
+    quint16 type;              // DaemonMessage
+    quint16 reserved;
+    quint32 requestId;
+};
+
+struct DaemonHelloBody
+{
+    quint32 version;
+    quint32 reserved;
+};
+
+struct DaemonWelcomeBody
+{
+    quint32 version;
+    quint32 daemonPid;
+    quint64 regionBytes;       // Size of the memfd to map
+};
+
+// VpnTunnel::Options. Text fields are UTF-8, NUL-padded, and need no NUL
+// when full.
+struct DaemonTunnelBody
+{
+    char interfaceName[16];    // IFNAMSIZ
+    char address[48];
+    char peerAddress[64];
+    quint8 key[32];
+    quint32 mtu;
+    quint16 listenPort;
+    quint16 peerPort;
+    quint32 queues;
+    quint32 batchSize;
+    quint32 ioUring;
+    quint32 reserved;
+};
+
+// VpnStats, and what the tunnel was started with
+struct DaemonTunnelStatusBody
+{
+    quint8 running;            // 0 before the first start, once stopped, and after a failure
+    quint8 gso;
+    quint8 gro;
+    quint8 reserved;
+    qint32 queues;
+    qint32 sessions;
+    qint32 reserved2;
+    quint64 txPackets;
+    quint64 txBytes;
+    quint64 rxPackets;
+    quint64 rxBytes;
+    quint64 tunReads;
+    quint64 tunWrites;
+    quint64 sendCalls;
+    quint64 receiveCalls;
+    quint64 syscalls;
+    quint64 authFailures;
+    quint64 replays;
+    quint64 dropped;
+    quint64 handshakes;
+    double txGbps;
+    double rxGbps;
+    qint64 elapsedMs;
+    char crypto[16];
+    char io[64];
+    char failure[256];         // Why the last run stopped on its own, cut short to fit
+    DaemonTunnelBody options;  // The key zeroed
+};
+
+static_assert(sizeof(DaemonMessageHeader) == 8, "daemon messages are sent as raw bytes");
+static_assert(sizeof(DaemonHelloBody) == 8, "daemon messages are sent as raw bytes");
+static_assert(sizeof(DaemonWelcomeBody) == 16, "daemon messages are sent as raw bytes");
+static_assert(sizeof(DaemonTunnelBody) == 184, "daemon messages are sent as raw bytes");
+static_assert(sizeof(DaemonTunnelStatusBody) == 664, "daemon messages are sent as raw bytes");
+
+// Sends one message, and `passFd` along with it unless it is -1. False if
+// the socket would not take it whole.
+bool sendDaemonMessage(int socket, DaemonMessage type, quint32 requestId, const char *body, int size,
+                       int passFd = -1);
+
+// Receives one message into `header` and `body`. A file descriptor sent
+// along is stored in `passedFd` if that is given, and closed otherwise.
+// Returns 1 for a message, 0 once the peer has closed, -1 on an error,
+// a malformed message or, on a non-blocking socket, nothing to read.
+int receiveDaemonMessage(int socket, DaemonMessageHeader *header, QByteArray *body, int *passedFd = nullptr);
+
+// The tunnel's options and counters as they travel, and back. Packing
+// options is false if a text field does not fit or the key has the wrong
+// size; unpacking a status leaves out the options, which
+// unpackTunnelOptions() reads.
+bool packTunnelOptions(const VpnTunnel::Options &options, DaemonTunnelBody *body);
+VpnTunnel::Options unpackTunnelOptions(const DaemonTunnelBody &body);
+void packTunnelStatus(const VpnStats &stats, bool running, const QString &failure, DaemonTunnelStatusBody *body);
+VpnStats unpackTunnelStatus(const DaemonTunnelStatusBody &body);
+
+#endif // DAEMONPROTOCOL_H
@@ -0,0 +1,337 @@
+#include "daemonring.h"
+#include <cstring>
+#include <new>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char kRingMagic[8] = { 'R', 'H', 'D', 'R', 'I', 'N', 'G', '1' };
+const quint32 kVersion = 1;
+const quint64 kMinDataBytes = 64 << 10;
+const quint64 kMaxDataBytes = quint64(1) << 30;
+const quint64 kRecordAlign = 16;
+// Copies of the metrics that a publish overlapped before giving up
+const int kMetricsAttempts = 4;
+
+static_assert(sizeof(DaemonRing::Record) == kRecordAlign, "records are read in place by another process");
+
+quint64 alignedRecord(quint64 payloadBytes)
+{
+    return (sizeof(DaemonRing::Record) + payloadBytes + kRecordAlign - 1) & ~(kRecordAlign - 1);
+}
+
+void copyText(char *target, size_t size, const QString &text)
+{
+    const QByteArray utf8 = text.toUtf8();
+    const size_t length = qMin(size - 1, size_t(utf8.size()));
+    memcpy(target, utf8.constData(), length);
+    memset(target + length, 0, size - length);
+}
+
+QString textOf(const char *text, size_t size)
+{
+    return QString::fromUtf8(text, int(strnlen(text, size)));
+}
+
+} // namespace
+
+DaemonRing::DaemonRing()
+{
+}
+
+DaemonRing::~DaemonRing()
+{
+    close();
+}
+
+#ifdef Q_OS_LINUX
+
+bool DaemonRing::map(int fd, qint64 bytes)
+{
+    void *address = mmap(nullptr, size_t(bytes), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (address == MAP_FAILED) {
+        lastError = QString("mmap: %1").arg(strerror(errno));
+        return false;
+    }
+    mapping = static_cast<uchar *>(address);
+    mappedBytes = bytes;
+    return true;
+}
+
+bool DaemonRing::create(qint64 dataBytes)
+{
+    close();
+    quint64 size = kMinDataBytes;
+    while (size < qMin(quint64(qMax<qint64>(dataBytes, 0)), kMaxDataBytes))
+        size <<= 1;
+    const qint64 headerSize = (qint64(sizeof(Header)) + 4095) & ~qint64(4095);
+    const qint64 total = headerSize + qint64(size);
+
+    const int fd = memfd_create("rhynec-daemon-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0 || ftruncate(fd, off_t(total)) != 0) {
+        lastError = QString("memfd: %1").arg(strerror(errno));
+        if (fd >= 0)
+            ::close(fd);
+        return false;
+    }
+    // The GUI must not be able to shrink it under the daemon
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+    if (!map(fd, total)) {
+        ::close(fd);
+        return false;
+    }
+
+    memfd = fd;
+    header = new (mapping) Header();
+    memcpy(header->magic, kRingMagic, sizeof(kRingMagic));
+    header->version = kVersion;
+    header->headerBytes = quint32(headerSize);
+    header->dataBytes = size;
+    data = mapping + headerSize;
+    dataSize = size;
+    writeTail = 0;
+    cachedHead = 0;
+    return true;
+}
+
+bool DaemonRing::attach(int fd)
+{
+    close();
+    const qint64 headerSize = (qint64(sizeof(Header)) + 4095) & ~qint64(4095);
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size < headerSize + qint64(kMinDataBytes)) {
+        lastError = "The daemon's ring is too small";
+        ::close(fd);
+        return false;
+    }
+    if (!map(fd, status.st_size)) {
+        ::close(fd);
+        return false;
+    }
+
+    Header *shared = reinterpret_cast<Header *>(mapping);
+    const quint64 size = shared->dataBytes;
+    if (memcmp(shared->magic, kRingMagic, sizeof(kRingMagic)) != 0 || shared->version != kVersion
+        || shared->headerBytes != quint32(headerSize) || size < kMinDataBytes || (size & (size - 1)) != 0
+        || headerSize + qint64(size) > status.st_size) {
+        lastError = "The daemon's ring is of another version";
+        munmap(mapping, size_t(mappedBytes));
+        mapping = nullptr;
+        mappedBytes = 0;
+        ::close(fd);
+        return false;
+    }
+
+    memfd = fd;
+    header = shared;
+    data = mapping + headerSize;
+    dataSize = size;
+    // Carries on where the last GUI stopped
+    readHead = header->head.load(std::memory_order_acquire);
+    cachedTail = readHead;
+    return true;
+}
+
+void DaemonRing::close()
+{
+    if (mapping)
+        munmap(mapping, size_t(mappedBytes));
+    if (memfd >= 0)
+        ::close(memfd);
+    memfd = -1;
+    mapping = nullptr;
+    mappedBytes = 0;
+    header = nullptr;
+    data = nullptr;
+    dataSize = 0;
+}
+
+#else
+
+bool DaemonRing::map(int, qint64)
+{
+    return false;
+}
+
+bool DaemonRing::create(qint64)
+{
+    lastError = "The daemon needs Linux";
+    return false;
+}
+
+bool DaemonRing::attach(int)
+{
+    lastError = "The daemon needs Linux";
+    return false;
+}
+
+void DaemonRing::close()
+{
+}
+
+#endif
+
+bool DaemonRing::write(quint8 type, qint64 timeUs, const char *payload, int size)
+{
+    if (!header || size < 0)
+        return false;
+    const quint64 need = alignedRecord(quint64(size));
+    quint64 offset = writeTail & (dataSize - 1);
+    const quint64 toEnd = dataSize - offset;
+    const quint64 total = need <= toEnd ? need : need + toEnd;
+    if (need > dataSize / 4) {
+        header->dropped.store(header->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return false;
+    }
+    if (dataSize - (writeTail - cachedHead) < total) {
+        // Clamped, so a GUI writing nonsense there only loses its own
+        // records
+        const quint64 lowest = writeTail > dataSize ? writeTail - dataSize : 0;
+        cachedHead = qBound(lowest, header->head.load(std::memory_order_acquire), writeTail);
+        if (dataSize - (writeTail - cachedHead) < total) {
+            header->dropped.store(header->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+    }
+
+    if (need > toEnd) {
+        Record *padding = reinterpret_cast<Record *>(data + offset);
+        padding->kind = Padding;
+        padding->type = 0;
+        padding->reserved = 0;
+        padding->bytes = quint32(toEnd - sizeof(Record));
+        padding->timeUs = 0;
+        writeTail += toEnd;
+        offset = 0;
+    }
+    Record *record = reinterpret_cast<Record *>(data + offset);
+    record->kind = Event;
+    record->type = type;
+    record->reserved = 0;
+    record->bytes = quint32(size);
+    record->timeUs = timeUs;
+    memcpy(record + 1, payload, size_t(size));
+    writeTail += need;
+    header->tail.store(writeTail, std::memory_order_release);
+    return true;
+}
+
+void DaemonRing::publish(const MetricsSnapshot &snapshot)
+{
+    if (!header)
+        return;
+    const quint32 sequence = header->metricsSequence.load(std::memory_order_relaxed);
+    header->metricsSequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    const int count = qMin(snapshot.metrics.size(), int(kMaxMetrics));
+    for (int i = 0; i < count; ++i) {
+        const MetricsSnapshot::Metric &metric = snapshot.metrics.at(i);
+        MetricSlot &slot = header->metrics[i];
+        copyText(slot.name, sizeof(slot.name), metric.name);
+        copyText(slot.unit, sizeof(slot.unit), metric.unit);
+        slot.kind = metric.kind;
+        slot.reserved = 0;
+        slot.value = metric.value;
+        slot.ratePerSecond = metric.ratePerSecond;
+        slot.samples = metric.samples;
+    }
+    header->metricCount = count;
+    header->producers = snapshot.producers;
+    header->intervalNs = snapshot.intervalNs;
+    header->samplesDropped = snapshot.samplesDropped;
+    header->gaugesMerged = snapshot.gaugesMerged;
+
+    header->metricsSequence.store(sequence + 2, std::memory_order_release);
+}
+
+const DaemonRing::Record *DaemonRing::peek()
+{
+    if (!header)
+        return nullptr;
+    for (;;) {
+        if (readHead == cachedTail) {
+            cachedTail = header->tail.load(std::memory_order_acquire);
+            if (readHead == cachedTail)
+                return nullptr;
+        }
+        const quint64 offset = readHead & (dataSize - 1);
+        const quint64 room = dataSize - offset;
+        const Record *record = reinterpret_cast<const Record *>(data + offset);
+        if (cachedTail - readHead > dataSize || alignedRecord(record->bytes) > room) {
+            // Not something the daemon writes; skip to what it writes next
+            readHead = cachedTail;
+            header->head.store(readHead, std::memory_order_release);
+            return nullptr;
+        }
+        if (record->kind == Event)
+            return record;
+        readHead += alignedRecord(record->bytes);
+        header->head.store(readHead, std::memory_order_release);
+    }
+}
+
+void DaemonRing::release(const Record *record)
+{
+    readHead += alignedRecord(record->bytes);
+    header->head.store(readHead, std::memory_order_release);
+}
+
+bool DaemonRing::readMetrics(MetricsSnapshot *snapshot, const QString &prefix) const
+{
+    if (!header)
+        return false;
+    for (int attempt = 0; attempt < kMetricsAttempts; ++attempt) {
+        const quint32 before = header->metricsSequence.load(std::memory_order_acquire);
+        if (before & 1)
+            continue;
+        // A seqlock: the copy may tear while the daemon publishes, and is
+        // only used if the count shows it did not
+        const int count = qBound(0, header->metricCount, int(kMaxMetrics));
+        metricsCopy.resize(size_t(count));
+        memcpy(static_cast<void *>(metricsCopy.data()), header->metrics, sizeof(MetricSlot) * size_t(count));
+        const int producers = header->producers;
+        const quint64 samplesDropped = header->samplesDropped;
+        const quint64 gaugesMerged = header->gaugesMerged;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (header->metricsSequence.load(std::memory_order_relaxed) != before)
+            continue;
+
+        for (const MetricSlot &slot : metricsCopy) {
+            MetricsSnapshot::Metric metric;
+            metric.name = prefix + textOf(slot.name, sizeof(slot.name));
+            metric.unit = textOf(slot.unit, sizeof(slot.unit));
+            metric.kind = slot.kind;
+            metric.value = slot.value;
+            metric.ratePerSecond = slot.ratePerSecond;
+            metric.samples = slot.samples;
+            snapshot->metrics.append(metric);
+        }
+        snapshot->producers += producers;
+        snapshot->samplesDropped += samplesDropped;
+        snapshot->gaugesMerged += gaugesMerged;
+        return true;
+    }
+    return false;
+}
+
+quint64 DaemonRing::droppedRecords() const
+{
+    return header ? header->dropped.load(std::memory_order_relaxed) : 0;
+}
+
+quint64 DaemonRing::pendingBytes() const
+{
+    if (!header)
+        return 0;
+    const quint64 tail = header->tail.load(std::memory_order_acquire);
+    const quint64 head = header->head.load(std::memory_order_acquire);
+    return tail - qMin(head, tail);
+}
@@ -0,0 +1,141 @@
+#ifndef DAEMONRING_H
+#define DAEMONRING_H
+
+#include <QString>
+#include <QtGlobal>
+#include <atomic>
+#include <vector>
+#include "latencyhistogram.h"
+#include "metricsbus.h"
+
+// The memory rhynec-daemon shares with the GUI: one sealed memfd that the
+// daemon creates and the GUI maps after attaching, so results and metrics
+// cross the process boundary without a system call or a copy into a
+// message.
+//
+// Events go through a single-producer single-consumer ring of records,
+// each a Record followed by its payload, 16-byte aligned and never split
+// at the end of the ring: a record that would not fit there is preceded
+// by a padding record to the end. The daemon writes and moves the tail;
+// the GUI reads records in place and moves the head, on a line of its
+// own. When the ring is full, because the GUI is behind or not attached,
+// records are dropped and counted rather than waited for. The head stays
+// where the last GUI left it, so the next one starts with what was kept.
+//
+// Metrics are the daemon's last MetricsSnapshot, rewritten at display
+// rate under a sequence count: odd while it is being written, so a
+// reader that saw it change copies again.
+//
+// The GUI runs with fewer privileges than the daemon and can write the
+// whole mapping. The daemon therefore reads nothing from it but the head,
+// which it clamps to what the ring can hold, and the memfd is sealed
+// against resizing.
+class DaemonRing
+{
+public:
+    static const int kMaxMetrics = MetricsProducer::kMaxMetrics;
+
+    enum RecordKind : quint16 {
+        Padding = 0,
+        Event                          // An EventJournal event
+    };
+
+    struct Record
+    {
+        quint16 kind;
+        quint8 type;                   // EventJournal::Type
+        quint8 reserved;
+        quint32 bytes;                 // Of the payload that follows
+        qint64 timeUs;
+
+        const char *payload() const { return reinterpret_cast<const char *>(this + 1); }
+    };
+
+    DaemonRing();
+    ~DaemonRing();
+    DaemonRing(const DaemonRing &) = delete;
+    DaemonRing &operator=(const DaemonRing &) = delete;
+
+    // Daemon side: a new memfd with `dataBytes` of ring, rounded up to a
+    // power of two
+    bool create(qint64 dataBytes);
+    // GUI side: maps the memfd Welcome passed, and takes it over
+    bool attach(int fd);
+    void close();
+
+    bool isValid() const { return header != nullptr; }
+    int fd() const { return memfd; }
+    qint64 regionBytes() const { return mappedBytes; }
+    quint64 capacity() const { return dataSize; }
+    QString errorString() const { return lastError; }
+
+    // Daemon side, one thread at a time. False if the record was dropped.
+    bool write(quint8 type, qint64 timeUs, const char *data, int size);
+    void publish(const MetricsSnapshot &snapshot);
+
+    // GUI side. The oldest record not yet released, or nullptr when the
+    // ring is empty; it stays valid until release().
+    const Record *peek();
+    void release(const Record *record);
+    // Appends the daemon's metrics to `snapshot`, their names prefixed
+    // with `prefix`; false if they could not be read consistently
+    bool readMetrics(MetricsSnapshot *snapshot, const QString &prefix) const;
+
+    // Either side
+    quint64 droppedRecords() const;
+    quint64 pendingBytes() const;
+
+private:
+    struct MetricSlot
+    {
+        char name[48];
+        char unit[16];
+        qint32 kind;
+        qint32 reserved;
+        qint64 value;
+        double ratePerSecond;
+        LatencyHistogram samples;
+    };
+
+    struct Header
+    {
+        char magic[8];
+        quint32 version;
+        quint32 headerBytes;           // Where the ring starts
+        quint64 dataBytes;
+
+        alignas(64) std::atomic<quint64> tail;       // Daemon
+        std::atomic<quint64> dropped;
+        alignas(64) std::atomic<quint64> head;       // GUI
+
+        alignas(64) std::atomic<quint32> metricsSequence;
+        qint32 metricCount;
+        qint32 producers;
+        qint64 intervalNs;
+        quint64 samplesDropped;
+        quint64 gaugesMerged;
+        MetricSlot metrics[kMaxMetrics];
+    };
+
+    static_assert(std::atomic<quint64>::is_always_lock_free, "the ring is shared between processes");
+
+    bool map(int fd, qint64 bytes);
+
+    int memfd = -1;
+    uchar *mapping = nullptr;
+    qint64 mappedBytes = 0;
+    Header *header = nullptr;
+    uchar *data = nullptr;
+    quint64 dataSize = 0;
+    QString lastError;
+
+    // Each side's own end, and its last look at the other's, so neither
+    // reads the other's line on every record
+    quint64 writeTail = 0;
+    quint64 cachedHead = 0;
+    quint64 readHead = 0;
+    quint64 cachedTail = 0;
+    mutable std::vector<MetricSlot> metricsCopy;     // GUI side, reused
+};
+
+#endif // DAEMONRING_H
@@ -0,0 +1,413 @@
+#include "daemonserver.h"
+#include "alertpipeline.h"
+#include "eventjournal.h"
+#include "filescanner.h"
+#include "packetcapture.h"
+#include "parserworkerpool.h"
+#include "vpntunnel.h"
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QSocketNotifier>
+#include <cstring>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <grp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// GUIs waiting to be turned away while one is attached
+const int kListenBacklog = 4;
+// Samples taken off the engines' rings per publish, as the Status tab does
+const int kSampleBudget = 2048;
+
+} // namespace
+
+DaemonServer::DaemonServer(QObject *parent)
+    : QObject(parent)
+{
+    connect(&publishTimer, &QTimer::timeout, this, &DaemonServer::publishMetrics);
+}
+
+DaemonServer::~DaemonServer()
+{
+    stopTunnel();
+    stopCapture();
+    scanThread.quit();
+    scanThread.wait();
+    dropClient();
+#ifdef Q_OS_LINUX
+    if (listenFd >= 0) {
+        ::close(listenFd);
+        unlink(QFile::encodeName(settings.socketPath).constData());
+    }
+#endif
+}
+
+#ifdef Q_OS_LINUX
+
+bool DaemonServer::listen(const Options &options)
+{
+    settings = options;
+    if (!ring.create(options.ringBytes)) {
+        lastError = ring.errorString();
+        return false;
+    }
+
+    const QByteArray path = QFile::encodeName(options.socketPath);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.isEmpty() || size_t(path.size()) >= sizeof(address.sun_path)) {
+        lastError = "Socket path is empty or too long: " + options.socketPath;
+        return false;
+    }
+    memcpy(address.sun_path, path.constData(), size_t(path.size()));
+    QDir().mkpath(QFileInfo(options.socketPath).absolutePath());
+
+    // A socket file left by a daemon that did not exit cleanly is
+    // replaced; one that still answers belongs to a daemon that runs
+    const int probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    const bool taken = probe >= 0 && ::connect(probe, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0;
+    if (probe >= 0)
+        ::close(probe);
+    if (taken) {
+        lastError = "Another daemon is listening on " + options.socketPath;
+        return false;
+    }
+    unlink(path.constData());
+
+    listenFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    // Connecting takes write permission on the socket file: owner only,
+    // until the group is given it below
+    const mode_t previousMask = umask(0177);
+    const bool bound = listenFd >= 0 && bind(listenFd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0;
+    umask(previousMask);
+    if (!bound || ::listen(listenFd, kListenBacklog) != 0) {
+        lastError = QString("Cannot listen on %1: %2").arg(options.socketPath, QString::fromLocal8Bit(strerror(errno)));
+        if (listenFd >= 0)
+            ::close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+    if (!options.group.isEmpty()) {
+        const struct group *entry = getgrnam(options.group.toLocal8Bit().constData());
+        if (!entry || chown(path.constData(), uid_t(-1), entry->gr_gid) != 0 || chmod(path.constData(), 0660) != 0) {
+            lastError = QString("Cannot give group %1 the socket").arg(options.group);
+            ::close(listenFd);
+            listenFd = -1;
+            unlink(path.constData());
+            return false;
+        }
+    }
+
+    listenNotifier = new QSocketNotifier(listenFd, QSocketNotifier::Read, this);
+    connect(listenNotifier, &QSocketNotifier::activated, this, &DaemonServer::onListenReadable);
+
+    // Scanning runs on its own thread, as in the Security tab: the pool
+    // does blocking reads, and commands must not wait for them
+    scanPool = new ParserWorkerPool();
+    scanPool->setMetricsBus(&bus);
+    scanner = new FileScanner(scanPool);
+    scanPool->moveToThread(&scanThread);
+    scanner->moveToThread(&scanThread);
+    connect(&scanThread, &QThread::finished, scanner, &QObject::deleteLater);
+    connect(&scanThread, &QThread::finished, scanPool, &QObject::deleteLater);
+    connect(scanner, &FileScanner::resultReady, scanner, [this](const QString &path, const ScanVerdict &verdict) {
+        onScanResult(path, verdict);
+    }, Qt::DirectConnection);
+    scanThread.start();
+
+    clock.start();
+    publishTimer.start(qMax(1, options.publishIntervalMs));
+    return true;
+}
+
+void DaemonServer::onListenReadable()
+{
+    const int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (fd < 0)
+        return;
+    // A GUI that detached and attaches again may be seen connecting
+    // before its old socket is seen closing
+    if (clientFd >= 0)
+        onClientReadable();
+    if (clientFd >= 0) {
+        // A second reader would move the ring's head under the first
+        const QByteArray reason = "Another GUI is attached to the daemon";
+        sendDaemonMessage(fd, DaemonMessage::Failed, 0, reason.constData(), reason.size());
+        ::close(fd);
+        return;
+    }
+    clientFd = fd;
+    clientGreeted = false;
+    clientNotifier = new QSocketNotifier(clientFd, QSocketNotifier::Read, this);
+    connect(clientNotifier, &QSocketNotifier::activated, this, &DaemonServer::onClientReadable);
+}
+
+void DaemonServer::onClientReadable()
+{
+    while (clientFd >= 0) {
+        DaemonMessageHeader header;
+        const int received = receiveDaemonMessage(clientFd, &header, &messageBody);
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (received <= 0) {
+            dropClient();
+            return;
+        }
+        handleMessage(header, messageBody);
+    }
+}
+
+void DaemonServer::handleMessage(const DaemonMessageHeader &header, const QByteArray &body)
+{
+    const DaemonMessage type = DaemonMessage(header.type);
+    if (!clientGreeted && type != DaemonMessage::Hello) {
+        reply(header, DaemonMessage::Failed, "Hello first");
+        dropClient();
+        return;
+    }
+
+    switch (type) {
+    case DaemonMessage::Hello: {
+        DaemonHelloBody hello;
+        memset(&hello, 0, sizeof(hello));
+        memcpy(&hello, body.constData(), qMin(size_t(body.size()), sizeof(hello)));
+        if (hello.version != kDaemonProtocolVersion) {
+            reply(header, DaemonMessage::Failed,
+                  QString("The daemon speaks protocol %1, not %2").arg(kDaemonProtocolVersion).arg(hello.version).toUtf8());
+            dropClient();
+            return;
+        }
+        DaemonWelcomeBody welcome;
+        welcome.version = kDaemonProtocolVersion;
+        welcome.daemonPid = quint32(getpid());
+        welcome.regionBytes = quint64(ring.regionBytes());
+        if (!sendDaemonMessage(clientFd, DaemonMessage::Welcome, header.requestId,
+                               reinterpret_cast<const char *>(&welcome), sizeof(welcome), ring.fd())) {
+            dropClient();
+            return;
+        }
+        clientGreeted = true;
+        break;
+    }
+    case DaemonMessage::Ping:
+        reply(header, DaemonMessage::Pong, body);
+        break;
+    case DaemonMessage::StartScan: {
+        const QString error = startScan(QString::fromUtf8(body));
+        reply(header, error.isEmpty() ? DaemonMessage::Ok : DaemonMessage::Failed, error.toUtf8());
+        break;
+    }
+    case DaemonMessage::CancelScan:
+        QMetaObject::invokeMethod(scanner, &FileScanner::cancel);
+        reply(header, DaemonMessage::Ok);
+        break;
+    case DaemonMessage::StartCapture: {
+        const QString error = startCapture(QString::fromUtf8(body));
+        reply(header, error.isEmpty() ? DaemonMessage::Ok : DaemonMessage::Failed, error.toUtf8());
+        break;
+    }
+    case DaemonMessage::StopCapture:
+        stopCapture();
+        reply(header, DaemonMessage::Ok);
+        break;
+    case DaemonMessage::StartTunnel: {
+        const QString error = startTunnel(body);
+        reply(header, error.isEmpty() ? DaemonMessage::Ok : DaemonMessage::Failed, error.toUtf8());
+        break;
+    }
+    case DaemonMessage::StopTunnel:
+        stopTunnel();
+        reply(header, DaemonMessage::Ok);
+        break;
+    case DaemonMessage::QueryTunnel:
+        reply(header, DaemonMessage::TunnelStatus, tunnelStatus());
+        break;
+    default:
+        reply(header, DaemonMessage::Failed, QString("Unknown message %1").arg(header.type).toUtf8());
+        break;
+    }
+}
+
+void DaemonServer::reply(const DaemonMessageHeader &request, DaemonMessage type, const QByteArray &body)
+{
+    // A GUI that lets its replies pile up is dropped rather than waited for
+    if (clientFd >= 0 && !sendDaemonMessage(clientFd, type, request.requestId, body.constData(), body.size()))
+        dropClient();
+}
+
+void DaemonServer::dropClient()
+{
+    // Often called from the notifier's own signal
+    if (clientNotifier) {
+        clientNotifier->setEnabled(false);
+        clientNotifier->deleteLater();
+    }
+    clientNotifier = nullptr;
+    if (clientFd >= 0)
+        ::close(clientFd);
+    clientFd = -1;
+    clientGreeted = false;
+}
+
+#else
+
+bool DaemonServer::listen(const Options &options)
+{
+    settings = options;
+    lastError = "The daemon needs Linux";
+    return false;
+}
+
+void DaemonServer::onListenReadable()
+{
+}
+
+void DaemonServer::onClientReadable()
+{
+}
+
+void DaemonServer::handleMessage(const DaemonMessageHeader &, const QByteArray &)
+{
+}
+
+void DaemonServer::reply(const DaemonMessageHeader &, DaemonMessage, const QByteArray &)
+{
+}
+
+void DaemonServer::dropClient()
+{
+}
+
+#endif
+
+bool DaemonServer::postEvent(quint8 type, qint64 timeUs, const QByteArray &text)
+{
+    QMutexLocker lock(&ringMutex);
+    return ring.write(type, timeUs, text.constData(), text.size());
+}
+
+void DaemonServer::publishMetrics()
+{
+    ring.publish(bus.drain(clock.nsecsElapsed(), kSampleBudget));
+}
+
+QString DaemonServer::startScan(const QString &path)
+{
+    if (!QFileInfo::exists(path))
+        return "No such file or directory: " + path;
+    FileScanner *fileScanner = scanner;
+    QMetaObject::invokeMethod(scanner, [fileScanner, path]() { fileScanner->start(path); });
+    return QString();
+}
+
+// Runs on the scan thread
+void DaemonServer::onScanResult(const QString &path, const ScanVerdict &verdict)
+{
+    // The same lines the Security tab journals for its own scans
+    const qint64 timeUs = QDateTime::currentMSecsSinceEpoch() * 1000;
+    postEvent(EventJournal::ScanResult, timeUs,
+              QString("%1 %2 %3")
+                  .arg(QString::fromLatin1(scanStatusName(verdict.status)),
+                       QString::fromLatin1(scanFileTypeName(verdict.fileType)), path)
+                  .toUtf8());
+    if (verdict.status == ScanVerdict::Suspicious || verdict.status == ScanVerdict::Malicious) {
+        const Alert alert = alertForVerdict(path, verdict);
+        postEvent(EventJournal::SecurityAlert, timeUs,
+                  QString("%1 %2 %3").arg(QString::fromLatin1(alertSeverityName(alert.severity)), alert.rule, path).toUtf8());
+    }
+}
+
+QString DaemonServer::startCapture(const QString &interfaceName)
+{
+    stopCapture();
+    TpacketV3Source::Options options;
+    options.interfaceName = interfaceName;
+    capture = new CaptureEngine(this);
+    capture->setMetricsBus(&bus);
+    capture->setSource(new TpacketV3Source(options));
+    // The source is opened on the capture thread; the GUI sees a failure
+    // as capture metrics that never move, and the reason is logged here
+    connect(capture, &CaptureEngine::error, this, [](const QString &message) {
+        qWarning() << "Capture failed:" << message;
+    });
+    capture->start();
+    return QString();
+}
+
+void DaemonServer::stopCapture()
+{
+    if (!capture)
+        return;
+    capture->requestStop();
+    capture->wait();
+    delete capture;
+    capture = nullptr;
+}
+
+QString DaemonServer::startTunnel(const QByteArray &body)
+{
+    DaemonTunnelBody request;
+    if (body.size() != int(sizeof(request)))
+        return "Malformed tunnel options";
+    memcpy(&request, body.constData(), sizeof(request));
+    if (tunnel && tunnel->isRunning())
+        return "The tunnel is already up";
+    if (!tunnel) {
+        tunnel = new VpnTunnel(this);
+        tunnel->setMetricsBus(&bus);
+        // Emitted on the tunnel's thread just before it finishes, so the
+        // reason is in place by the time a query sees it stopped
+        connect(tunnel, &VpnTunnel::error, this, [this](const QString &message) {
+            QMutexLocker lock(&tunnelMutex);
+            tunnelFailure = message;
+            qWarning() << "Tunnel failed:" << message;
+        }, Qt::DirectConnection);
+    }
+    {
+        QMutexLocker lock(&tunnelMutex);
+        tunnelFailure.clear();
+    }
+    tunnel->setOptions(unpackTunnelOptions(request));
+    // The TUN device is opened on the tunnel's thread; a failure shows as
+    // a stopped tunnel and its reason in the next status
+    tunnel->start();
+    return QString();
+}
+
+void DaemonServer::stopTunnel()
+{
+    if (!tunnel || !tunnel->isRunning())
+        return;
+    tunnel->requestStop();
+    tunnel->wait();
+}
+
+QByteArray DaemonServer::tunnelStatus()
+{
+    DaemonTunnelStatusBody status;
+    QString failure;
+    {
+        QMutexLocker lock(&tunnelMutex);
+        failure = tunnelFailure;
+    }
+    if (!tunnel) {
+        packTunnelStatus(VpnStats(), false, failure, &status);
+    } else {
+        packTunnelStatus(tunnel->stats(), tunnel->isRunning(), failure, &status);
+        packTunnelOptions(tunnel->options(), &status.options);
+        memset(status.options.key, 0, sizeof(status.options.key));
+    }
+    return QByteArray(reinterpret_cast<const char *>(&status), int(sizeof(status)));
+}
@@ -0,0 +1,107 @@
+#ifndef DAEMONSERVER_H
+#define DAEMONSERVER_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QObject>
+#include <QString>
+#include <QThread>
+#include <QTimer>
+#include "daemonprotocol.h"
+#include "daemonring.h"
+#include "metricsbus.h"
+#include "scanverdict.h"
+
+class CaptureEngine;
+class FileScanner;
+class ParserWorkerPool;
+class QSocketNotifier;
+class VpnTunnel;
+
+// The privileged half of Rhynec: runs the engines that need more than a
+// desktop session should hold, raw packet capture and the VPN tunnel's
+// TUN device first among them, and serves one GUI at a time over a Unix
+// socket (see daemonprotocol.h).
+//
+// The GUI attaches with Hello and gets the memfd of the server's
+// DaemonRing back. From then on scan results reach it through the ring
+// and the engines' metrics through the ring's snapshot, published every
+// publishIntervalMs; the socket only carries commands. Detaching is
+// closing the socket. The engines keep running without a GUI, and what
+// they report meanwhile waits in the ring as far as it fits; a tunnel
+// left up is found by the next GUI's QueryTunnel.
+//
+// Lives on the thread that calls listen(), which serves the socket and
+// publishes the metrics; scans run on a thread of their own, capture on
+// the CaptureEngine's and the tunnel on the VpnTunnel's.
+class DaemonServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Options
+    {
+        QString socketPath = QString::fromLatin1(kDaemonSocketPath);
+        QString group;                 // Allowed to connect besides root; empty for root only
+        qint64 ringBytes = 8 << 20;
+        int publishIntervalMs = 33;
+    };
+
+    explicit DaemonServer(QObject *parent = nullptr);
+    ~DaemonServer();
+
+    bool listen(const Options &options);
+    QString errorString() const { return lastError; }
+    bool hasClient() const { return clientFd >= 0; }
+
+    // Where the daemon's engines, and any other code in the process,
+    // count what they do for the GUI
+    MetricsBus *metrics() { return &bus; }
+
+    // Any thread. Queues an event for the GUI; false if the ring had no
+    // room, in which case it is counted as dropped.
+    bool postEvent(quint8 type, qint64 timeUs, const QByteArray &text);
+
+private slots:
+    void onListenReadable();
+    void onClientReadable();
+    void publishMetrics();
+
+private:
+    void handleMessage(const DaemonMessageHeader &header, const QByteArray &body);
+    void reply(const DaemonMessageHeader &request, DaemonMessage type, const QByteArray &body = QByteArray());
+    void dropClient();
+    QString startScan(const QString &path);
+    QString startCapture(const QString &interfaceName);
+    void stopCapture();
+    QString startTunnel(const QByteArray &body);
+    void stopTunnel();
+    QByteArray tunnelStatus();
+    void onScanResult(const QString &path, const ScanVerdict &verdict);
+
+    Options settings;
+    QString lastError;
+    int listenFd = -1;
+    int clientFd = -1;
+    QSocketNotifier *listenNotifier = nullptr;
+    QSocketNotifier *clientNotifier = nullptr;
+    bool clientGreeted = false;
+    QByteArray messageBody;                  // Reused for every message
+
+    DaemonRing ring;
+    QMutex ringMutex;                        // Writers on more than one thread
+    MetricsBus bus;
+    QTimer publishTimer;
+    QElapsedTimer clock;
+
+    QThread scanThread;
+    ParserWorkerPool *scanPool = nullptr;
+    FileScanner *scanner = nullptr;
+    CaptureEngine *capture = nullptr;
+    VpnTunnel *tunnel = nullptr;
+    QMutex tunnelMutex;
+    QString tunnelFailure;                   // Set on the tunnel's thread
+};
+
+#endif // DAEMONSERVER_H
@@ -0,0 +1,297 @@
+#include "decimationpyramid.h"
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+const int kFanoutBits = 3;
+const quint64 kFanoutMask = (1 << kFanoutBits) - 1;
+
+void mergeInto(double min, double max, quint32 minIndex, quint32 maxIndex,
+                double &intoMin, double &intoMax, quint32 &intoMinIndex, quint32 &intoMaxIndex)
+{
+    // Ties keep the earliest sample, whatever order ranges are merged in
+    if (min < intoMin || (min == intoMin && minIndex < intoMinIndex)) {
+        intoMin = min;
+        intoMinIndex = minIndex;
+    }
+    if (max > intoMax || (max == intoMax && maxIndex < intoMaxIndex)) {
+        intoMax = max;
+        intoMaxIndex = maxIndex;
+    }
+}
+
+} // namespace
+
+DecimationPyramid::Bucket DecimationPyramid::entry(int tier, quint64 index) const
+{
+    if (tier == 0)
+        return { ys[index], ys[index], quint32(index), quint32(index) };
+    return levels[size_t(tier - 1)][index];
+}
+
+void DecimationPyramid::addTier()
+{
+    const int below = int(levels.size());
+    const quint64 count = below == 0 ? xs.size() : levels.back().size();
+    std::vector<Bucket> level((count + kFanoutMask) >> kFanoutBits,
+                              { std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity(), 0, 0 });
+    for (quint64 k = 0; k < count; ++k) {
+        const Bucket source = entry(below, k);
+        Bucket &target = level[k >> kFanoutBits];
+        mergeInto(source.min, source.max, source.minIndex, source.maxIndex,
+                  target.min, target.max, target.minIndex, target.maxIndex);
+    }
+    levels.push_back(std::move(level));
+}
+
+void DecimationPyramid::append(const QPointF *points, int count)
+{
+    QMutexLocker lock(&mutex);
+    for (int i = 0; i < count; ++i) {
+        const double x = points[i].x();
+        const double y = points[i].y();
+        if (std::isnan(x) || (!xs.empty() && x < xs.back()) || xs.size() >= std::numeric_limits<quint32>::max())
+            continue;
+
+        const quint64 index = xs.size();
+        xs.push_back(x);
+        ys.push_back(y);
+        for (size_t level = 0; level < levels.size(); ++level) {
+            const quint64 bucket = index >> (kFanoutBits * (level + 1));
+            std::vector<Bucket> &buckets = levels[level];
+            if (bucket == buckets.size()) {
+                buckets.push_back({ y, y, quint32(index), quint32(index) });
+            } else {
+                Bucket &target = buckets[bucket];
+                mergeInto(y, y, quint32(index), quint32(index), target.min, target.max, target.minIndex, target.maxIndex);
+            }
+        }
+        // Grow until the top level is a single bucket
+        while ((levels.empty() ? xs.size() : levels.back().size()) >= 2)
+            addTier();
+    }
+}
+
+void DecimationPyramid::clear()
+{
+    QMutexLocker lock(&mutex);
+    xs.clear();
+    ys.clear();
+    levels.clear();
+}
+
+quint64 DecimationPyramid::size() const
+{
+    QMutexLocker lock(&mutex);
+    return xs.size();
+}
+
+bool DecimationPyramid::bounds(double *firstX, double *lastX) const
+{
+    QMutexLocker lock(&mutex);
+    if (xs.empty())
+        return false;
+    *firstX = xs.front();
+    *lastX = xs.back();
+    return true;
+}
+
+quint64 DecimationPyramid::memoryBytes() const
+{
+    QMutexLocker lock(&mutex);
+    quint64 bytes = (xs.capacity() + ys.capacity()) * sizeof(double);
+    for (const std::vector<Bucket> &level : levels)
+        bytes += level.capacity() * sizeof(Bucket);
+    return bytes;
+}
+
+DecimationPyramid::Bucket DecimationPyramid::rangeMinMax(quint64 first, quint64 last) const
+{
+    Bucket result = { std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity(), 0, 0 };
+    auto merge = [&result](const Bucket &source) {
+        mergeInto(source.min, source.max, source.minIndex, source.maxIndex,
+                  result.min, result.max, result.minIndex, result.maxIndex);
+    };
+
+    // Peel unaligned entries off both ends, then continue one level up
+    quint64 low = first;
+    quint64 high = last;
+    for (int tier = 0; low < high; ++tier) {
+        if (tier == int(levels.size())) {
+            for (quint64 k = low; k < high; ++k)
+                merge(entry(tier, k));
+            break;
+        }
+        while (low < high && (low & kFanoutMask))
+            merge(entry(tier, low++));
+        while (low < high && (high & kFanoutMask))
+            merge(entry(tier, --high));
+        low >>= kFanoutBits;
+        high >>= kFanoutBits;
+    }
+    return result;
+}
+
+QVector<QPointF> DecimationPyramid::decimateM4(double from, double to, int columns, double *yMin, double *yMax) const
+{
+    QVector<QPointF> points;
+    if (xs.empty() || columns <= 0 || !(to > from))
+        return points;
+
+    const quint64 begin = quint64(std::lower_bound(xs.begin(), xs.end(), from) - xs.begin());
+    const quint64 end = quint64(std::upper_bound(xs.begin(), xs.end(), to) - xs.begin());
+    const quint64 first = begin > 0 ? begin - 1 : 0;
+    const quint64 last = end < xs.size() ? end + 1 : end;
+
+    if (end > begin) {
+        const Bucket visible = rangeMinMax(begin, end);
+        if (yMin)
+            *yMin = visible.min;
+        if (yMax)
+            *yMax = visible.max;
+    }
+
+    if (last - first <= quint64(columns) * 2) {
+        points.reserve(int(last - first));
+        for (quint64 i = first; i < last; ++i)
+            points.append(QPointF(xs[i], ys[i]));
+        return points;
+    }
+
+    points.reserve(columns * 4 + 2);
+    if (first < begin)
+        points.append(QPointF(xs[first], ys[first]));
+
+    const double width = (to - from) / columns;
+    quint64 start = begin;
+    for (int column = 0; column < columns && start < end; ++column) {
+        quint64 stop = end;
+        if (column < columns - 1) {
+            const double edge = from + width * (column + 1);
+            stop = quint64(std::lower_bound(xs.begin() + qint64(start), xs.begin() + qint64(end), edge) - xs.begin());
+        }
+        if (stop == start)
+            continue;
+
+        const Bucket range = rangeMinMax(start, stop);
+        quint64 indices[4] = { start, range.minIndex, range.maxIndex, stop - 1 };
+        std::sort(indices, indices + 4);
+        for (int k = 0; k < 4; ++k) {
+            if (k == 0 || indices[k] != indices[k - 1])
+                points.append(QPointF(xs[indices[k]], ys[indices[k]]));
+        }
+        start = stop;
+    }
+
+    if (last > end)
+        points.append(QPointF(xs[end], ys[end]));
+    return points;
+}
+
+QVector<QPointF> DecimationPyramid::largestTriangles(const QVector<QPointF> &points, int threshold)
+{
+    const int count = points.size();
+    if (threshold < 3 || threshold >= count)
+        return points;
+
+    QVector<QPointF> sampled;
+    sampled.reserve(threshold);
+    sampled.append(points.first());
+
+    // The first and last points are kept; the rest are split into
+    // threshold - 2 buckets and each contributes the point forming the
+    // largest triangle with the previous pick and the next bucket's mean
+    const double bucketSize = double(count - 2) / (threshold - 2);
+    int previous = 0;
+    for (int bucket = 0; bucket < threshold - 2; ++bucket) {
+        const int nextStart = int(std::floor((bucket + 1) * bucketSize)) + 1;
+        const int nextEnd = qMin(int(std::floor((bucket + 2) * bucketSize)) + 1, count);
+        double meanX = 0;
+        double meanY = 0;
+        if (nextStart < nextEnd) {
+            for (int i = nextStart; i < nextEnd; ++i) {
+                meanX += points[i].x();
+                meanY += points[i].y();
+            }
+            meanX /= nextEnd - nextStart;
+            meanY /= nextEnd - nextStart;
+        } else {
+            meanX = points.last().x();
+            meanY = points.last().y();
+        }
+
+        const int rangeStart = int(std::floor(bucket * bucketSize)) + 1;
+        const int rangeEnd = qMin(int(std::floor((bucket + 1) * bucketSize)) + 1, count - 1);
+        const QPointF anchor = points[previous];
+        double bestArea = -1;
+        int best = rangeStart;
+        for (int i = rangeStart; i < rangeEnd; ++i) {
+            const double area = std::fabs((anchor.x() - meanX) * (points[i].y() - anchor.y())
+                                          - (anchor.x() - points[i].x()) * (meanY - anchor.y()));
+            if (area > bestArea) {
+                bestArea = area;
+                best = i;
+            }
+        }
+        sampled.append(points[best]);
+        previous = best;
+    }
+
+    sampled.append(points.last());
+    return sampled;
+}
+
+QVector<QPointF> DecimationPyramid::decimate(double from, double to, int columns, Mode mode,
+                                             double *yMin, double *yMax) const
+{
+    QMutexLocker lock(&mutex);
+    QVector<QPointF> envelope = decimateM4(from, to, columns, yMin, yMax);
+    if (mode == MinMax)
+        return envelope;
+    // Two extra points for the samples just outside the range
+    return largestTriangles(envelope, columns + 2);
+}
+
+ChartDecimator::ChartDecimator(const DecimationPyramid *pyramid, QObject *parent)
+    : QObject(parent), pyramid(pyramid)
+{
+    qRegisterMetaType<DecimatedView>();
+}
+
+void ChartDecimator::request(double from, double to, int columns, DecimationPyramid::Mode mode, quint64 generation)
+{
+    QMutexLocker lock(&mutex);
+    pending.from = from;
+    pending.to = to;
+    pending.columns = columns;
+    pending.generation = generation;
+    pendingMode = mode;
+    if (!scheduled) {
+        scheduled = true;
+        QMetaObject::invokeMethod(this, &ChartDecimator::process, Qt::QueuedConnection);
+    }
+}
+
+void ChartDecimator::process()
+{
+    DecimatedView view;
+    DecimationPyramid::Mode mode;
+    {
+        QMutexLocker lock(&mutex);
+        view = pending;
+        mode = pendingMode;
+        scheduled = false;
+    }
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    view.yMin = 0;
+    view.yMax = 0;
+    view.points = pyramid->decimate(view.from, view.to, view.columns, mode, &view.yMin, &view.yMax);
+    view.elapsedNs = elapsed.nsecsElapsed();
+    emit ready(view);
+}
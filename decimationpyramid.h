@@ -0,0 +1,111 @@
+#ifndef DECIMATIONPYRAMID_H
+#define DECIMATIONPYRAMID_H
+
+#include <QObject>
+#include <QMetaType>
+#include <QMutex>
+#include <QPointF>
+#include <QVector>
+#include <vector>
+
+// Append-only (x, y) samples with x non-decreasing, plus a pyramid of
+// min/max summaries: each level summarizes 8 entries of the level below,
+// so the min/max of any index range costs O(8 * levels) rather than
+// O(range). Appends update one bucket per level.
+//
+// decimate() reduces a visible x range to a polyline for a given pixel
+// width without touching more than a few summaries per column:
+//   MinMax  first, min, max and last sample of every column (M4), which
+//           rasterizes identically to drawing every sample
+//   Lttb    Largest-Triangle-Three-Buckets over the M4 envelope, one
+//           point per column, for smoother lines
+// Ranges with fewer samples than two per column are returned as-is. The
+// samples just outside the range are included so lines reach the edges.
+// All methods are thread-safe.
+class DecimationPyramid
+{
+public:
+    enum Mode { MinMax, Lttb };
+
+    DecimationPyramid() = default;
+    DecimationPyramid(const DecimationPyramid &) = delete;
+    DecimationPyramid &operator=(const DecimationPyramid &) = delete;
+
+    // Samples whose x is smaller than the last x are dropped
+    void append(const QPointF *points, int count);
+    void clear();
+
+    quint64 size() const;
+    bool bounds(double *firstX, double *lastX) const;
+
+    // Returns the polyline for [from, to] in data coordinates; yMin/yMax
+    // receive the value range of the samples inside [from, to]
+    QVector<QPointF> decimate(double from, double to, int columns, Mode mode,
+                              double *yMin = nullptr, double *yMax = nullptr) const;
+
+    quint64 memoryBytes() const;
+
+private:
+    struct Bucket
+    {
+        double min;
+        double max;
+        quint32 minIndex;
+        quint32 maxIndex;
+    };
+
+    Bucket entry(int tier, quint64 index) const;
+    Bucket rangeMinMax(quint64 first, quint64 last) const;
+    void addTier();
+    QVector<QPointF> decimateM4(double from, double to, int columns, double *yMin, double *yMax) const;
+    static QVector<QPointF> largestTriangles(const QVector<QPointF> &points, int threshold);
+
+    mutable QMutex mutex;
+    std::vector<double> xs;
+    std::vector<double> ys;
+    std::vector<std::vector<Bucket>> levels;  // levels[0] summarizes 8 samples
+};
+
+// One decimation result, tagged with the view it was computed for
+struct DecimatedView
+{
+    double from = 0;
+    double to = 0;
+    int columns = 0;
+    quint64 generation = 0;
+    QVector<QPointF> points;
+    double yMin = 0;
+    double yMax = 0;
+    qint64 elapsedNs = 0;
+};
+
+Q_DECLARE_METATYPE(DecimatedView)
+
+// Runs decimation off the GUI thread. Requests are coalesced: while one
+// is being computed only the newest pending request survives, so a burst
+// of zoom/pan events costs at most one extra decimation.
+class ChartDecimator : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ChartDecimator(const DecimationPyramid *pyramid, QObject *parent = nullptr);
+
+    // Thread-safe
+    void request(double from, double to, int columns, DecimationPyramid::Mode mode, quint64 generation);
+
+signals:
+    void ready(const DecimatedView &view);
+
+private slots:
+    void process();
+
+private:
+    const DecimationPyramid *pyramid;
+    QMutex mutex;
+    DecimatedView pending;
+    DecimationPyramid::Mode pendingMode = DecimationPyramid::MinMax;
+    bool scheduled = false;
+};
+
+#endif // DECIMATIONPYRAMID_H
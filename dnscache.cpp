@@ -0,0 +1,141 @@
+#include "dnscache.h"
+
+namespace {
+
+const quint32 kMaxTtl = 86400;
+const quint32 kMaxNegativeTtl = 3600;
+
+} // namespace
+
+DnsCache::DnsCache(int capacity)
+    : maxEntries(qMax(capacity, 1))
+{
+}
+
+void DnsCache::setCapacity(int capacity)
+{
+    maxEntries = qMax(capacity, 1);
+    while (entries.size() > maxEntries)
+        remove(entries.find(recency.back()));
+}
+
+void DnsCache::clear()
+{
+    entries.clear();
+    recency.clear();
+}
+
+QByteArray DnsCache::key(const DnsMessage::Question &question)
+{
+    QByteArray key(question.name, question.nameLength);
+    key.resize(question.nameLength + 5);
+    uchar *tail = reinterpret_cast<uchar *>(key.data()) + question.nameLength;
+    tail[0] = 0;
+    DnsMessage::writeBe16(tail + 1, question.type);
+    DnsMessage::writeBe16(tail + 3, question.klass);
+    return key;
+}
+
+void DnsCache::remove(QHash<QByteArray, Entry>::iterator it)
+{
+    recency.erase(it->position);
+    entries.erase(it);
+}
+
+bool DnsCache::lookup(const QByteArray &key, quint16 id, qint64 nowMs, QByteArray *response)
+{
+    auto it = entries.find(key);
+    if (it == entries.end())
+        return false;
+    if (nowMs >= it->expiresMs) {
+        remove(it);
+        return false;
+    }
+    recency.splice(recency.begin(), recency, it->position);
+
+    *response = it->response;
+    uchar *data = reinterpret_cast<uchar *>(response->data());
+    DnsMessage::setId(data, id);
+    const quint32 age = quint32((nowMs - it->storedMs) / 1000);
+    if (age > 0) {
+        for (quint16 offset : it->ttlOffsets) {
+            const quint32 ttl = DnsMessage::readBe32(data + offset);
+            DnsMessage::writeBe32(data + offset, ttl > age ? ttl - age : 0);
+        }
+    }
+    return true;
+}
+
+bool DnsCache::insert(const QByteArray &key, const uchar *response, int length, qint64 nowMs)
+{
+    using namespace DnsMessage;
+    if (length < kHeaderSize || length > 0xffff || isTruncated(response))
+        return false;
+    const int code = rcode(response);
+    if (code != NoError && code != NameError)
+        return false;
+
+    int offset = kHeaderSize;
+    for (int i = questionCount(response); i > 0; --i) {
+        offset = skipName(response, length, offset);
+        if (offset < 0 || offset + 4 > length)
+            return false;
+        offset += 4;
+    }
+
+    const int answers = readBe16(response + 6);
+    const int authority = readBe16(response + 8);
+    const int records = recordCount(response);
+    QVector<quint16> ttlOffsets;
+    ttlOffsets.reserve(records);
+    quint32 minTtl = kMaxTtl;
+    quint32 negativeTtl = 0;
+    bool haveSoa = false;
+    for (int i = 0; i < records; ++i) {
+        offset = skipName(response, length, offset);
+        if (offset < 0 || offset + 10 > length)
+            return false;
+        const quint16 type = readBe16(response + offset);
+        const quint32 ttl = readBe32(response + offset + 4);
+        const int dataLength = readBe16(response + offset + 8);
+        const int dataEnd = offset + 10 + dataLength;
+        if (dataEnd > length)
+            return false;
+
+        // The OPT pseudo-record's "TTL" holds EDNS flags
+        if (type != Opt) {
+            ttlOffsets.append(quint16(offset + 4));
+            minTtl = qMin(minTtl, ttl);
+        }
+        if (type == Soa && i >= answers && i < answers + authority && dataLength >= 22) {
+            negativeTtl = qMin(ttl, readBe32(response + dataEnd - 4));
+            haveSoa = true;
+        }
+        offset = dataEnd;
+    }
+
+    quint32 lifetime = minTtl;
+    if (code == NameError || answers == 0) {
+        if (!haveSoa)
+            return false;
+        lifetime = qMin(negativeTtl, kMaxNegativeTtl);
+    }
+    if (lifetime == 0)
+        return false;
+
+    auto it = entries.find(key);
+    if (it == entries.end()) {
+        if (entries.size() >= maxEntries)
+            remove(entries.find(recency.back()));
+        recency.push_front(key);
+        it = entries.insert(key, Entry());
+        it->position = recency.begin();
+    } else {
+        recency.splice(recency.begin(), recency, it->position);
+    }
+    it->response = QByteArray(reinterpret_cast<const char *>(response), length);
+    it->ttlOffsets = ttlOffsets;
+    it->storedMs = nowMs;
+    it->expiresMs = nowMs + qint64(lifetime) * 1000;
+    return true;
+}
@@ -0,0 +1,55 @@
+#ifndef DNSCACHE_H
+#define DNSCACHE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QVector>
+#include <list>
+#include "dnsmessage.h"
+
+// LRU cache of upstream answers, keyed on the question. Each entry keeps
+// the answer as received plus the offsets of its TTL fields; a hit copies
+// the answer, patches in the client's query ID and lowers every TTL by the
+// time the entry has been held, so clients age records correctly.
+//
+// Positive answers live for their smallest record TTL. NXDOMAIN and empty
+// NOERROR answers live for the SOA minimum from the authority section
+// (RFC 2308) and are not cached without one. Truncated answers and other
+// rcodes are never cached. Answers are kept whole whichever transport
+// brought them; the stub truncates a hit that is too large for a UDP
+// client.
+class DnsCache
+{
+public:
+    explicit DnsCache(int capacity = 10000);
+
+    void setCapacity(int capacity);
+    int capacity() const { return maxEntries; }
+    int size() const { return entries.size(); }
+    void clear();
+
+    static QByteArray key(const DnsMessage::Question &question);
+
+    // On a hit, replaces `response` with the cached answer for `id`
+    bool lookup(const QByteArray &key, quint16 id, qint64 nowMs, QByteArray *response);
+    // Returns false when the answer is not cacheable
+    bool insert(const QByteArray &key, const uchar *response, int length, qint64 nowMs);
+
+private:
+    struct Entry
+    {
+        QByteArray response;
+        QVector<quint16> ttlOffsets;
+        qint64 storedMs = 0;
+        qint64 expiresMs = 0;
+        std::list<QByteArray>::iterator position;
+    };
+
+    void remove(QHash<QByteArray, Entry>::iterator it);
+
+    int maxEntries;
+    QHash<QByteArray, Entry> entries;
+    std::list<QByteArray> recency;     // Most recently used first
+};
+
+#endif // DNSCACHE_H
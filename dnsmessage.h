@@ -0,0 +1,189 @@
+#ifndef DNSMESSAGE_H
+#define DNSMESSAGE_H
+
+#include <QtGlobal>
+#include <cstring>
+
+// Just enough of the DNS wire format (RFC 1035) for a forwarding stub:
+// header fields, the question, and header-only replies. Everything reads
+// from a caller-owned buffer and never past `length`.
+namespace DnsMessage {
+
+const int kHeaderSize = 12;
+const int kMaxName = 255;
+
+enum Rcode { NoError = 0, FormatError = 1, ServerFailure = 2, NameError = 3, NotImplemented = 4 };
+enum RecordType : quint16 { Soa = 6, Opt = 41 };
+
+inline quint16 readBe16(const uchar *p)
+{
+    return quint16(p[0] << 8 | p[1]);
+}
+
+inline quint32 readBe32(const uchar *p)
+{
+    return quint32(p[0]) << 24 | quint32(p[1]) << 16 | quint32(p[2]) << 8 | p[3];
+}
+
+inline void writeBe16(uchar *p, quint16 value)
+{
+    p[0] = uchar(value >> 8);
+    p[1] = uchar(value);
+}
+
+inline void writeBe32(uchar *p, quint32 value)
+{
+    p[0] = uchar(value >> 24);
+    p[1] = uchar(value >> 16);
+    p[2] = uchar(value >> 8);
+    p[3] = uchar(value);
+}
+
+inline quint16 id(const uchar *message) { return readBe16(message); }
+inline void setId(uchar *message, quint16 value) { writeBe16(message, value); }
+inline bool isResponse(const uchar *message) { return message[2] & 0x80; }
+inline int opcode(const uchar *message) { return (message[2] >> 3) & 0x0f; }
+inline bool isTruncated(const uchar *message) { return message[2] & 0x02; }
+inline void setTruncated(uchar *message) { message[2] |= 0x02; }
+inline int rcode(const uchar *message) { return message[3] & 0x0f; }
+inline quint16 questionCount(const uchar *message) { return readBe16(message + 4); }
+inline quint16 recordCount(const uchar *message)
+{
+    return quint16(readBe16(message + 6) + readBe16(message + 8) + readBe16(message + 10));
+}
+
+// Returns the offset just past an encoded (possibly compressed) name, or -1
+inline int skipName(const uchar *message, int length, int offset)
+{
+    while (offset < length) {
+        const uchar label = message[offset];
+        if (label == 0)
+            return offset + 1;
+        if ((label & 0xc0) == 0xc0)
+            return offset + 2 <= length ? offset + 2 : -1;
+        if (label & 0xc0)
+            return -1;
+        offset += 1 + label;
+    }
+    return -1;
+}
+
+struct Question
+{
+    char name[kMaxName + 1];    // Dotted, lowercase, no root dot; "" for the root
+    int nameLength = 0;
+    quint16 type = 0;
+    quint16 klass = 0;
+    int end = 0;                // Offset just past the question
+};
+
+// Reads the only question of a query or response. Names in a question are
+// never compressed in practice; pointers, labels containing dots and a
+// question count other than one are treated as malformed.
+inline bool readQuestion(const uchar *message, int length, Question *question)
+{
+    if (length < kHeaderSize || questionCount(message) != 1)
+        return false;
+    int offset = kHeaderSize;
+    int nameLength = 0;
+    while (true) {
+        if (offset >= length)
+            return false;
+        const int label = message[offset++];
+        if (label == 0)
+            break;
+        if (label > 63 || offset + label > length || nameLength + label + 1 > kMaxName)
+            return false;
+        if (nameLength > 0)
+            question->name[nameLength++] = '.';
+        for (int i = 0; i < label; ++i) {
+            char c = char(message[offset + i]);
+            if (c == '.' || c == '\0')
+                return false;
+            if (c >= 'A' && c <= 'Z')
+                c = char(c - 'A' + 'a');
+            question->name[nameLength++] = c;
+        }
+        offset += label;
+    }
+    if (offset + 4 > length)
+        return false;
+    question->name[nameLength] = '\0';
+    question->nameLength = nameLength;
+    question->type = readBe16(message + offset);
+    question->klass = readBe16(message + offset + 2);
+    question->end = offset + 4;
+    return true;
+}
+
+// The largest UDP reply the sender of `query` takes: the payload size in
+// its OPT record (RFC 6891), or 512 without one (RFC 1035)
+inline int udpPayloadLimit(const uchar *query, int length, int questionEnd)
+{
+    int offset = questionEnd;
+    const int records = recordCount(query);
+    for (int i = 0; i < records; ++i) {
+        offset = skipName(query, length, offset);
+        if (offset < 0 || offset + 10 > length)
+            break;
+        if (readBe16(query + offset) == Opt)
+            return qMax(512, int(readBe16(query + offset + 2)));
+        offset += 10 + readBe16(query + offset + 8);
+    }
+    return 512;
+}
+
+// Writes a recursive query for the dotted `name` (class IN). `out` needs
+// kHeaderSize + nameLength + 6 bytes. Returns the length, or -1 for an
+// empty label or one longer than 63 bytes.
+inline int makeQuery(quint16 queryId, const char *name, int nameLength, quint16 type, uchar *out)
+{
+    if (nameLength > 0 && name[nameLength - 1] == '.')
+        --nameLength;
+    if (nameLength > kMaxName - 2)
+        return -1;
+    memset(out, 0, kHeaderSize);
+    setId(out, queryId);
+    out[2] = 0x01;      // RD
+    writeBe16(out + 4, 1);
+    int offset = kHeaderSize;
+    int labelStart = 0;
+    for (int i = 0; i <= nameLength; ++i) {
+        if (i < nameLength && name[i] != '.')
+            continue;
+        const int label = i - labelStart;
+        if ((label == 0 && nameLength > 0) || label > 63)
+            return -1;
+        out[offset++] = uchar(label);
+        memcpy(out + offset, name + labelStart, size_t(label));
+        offset += label;
+        labelStart = i + 1;
+    }
+    if (nameLength > 0)
+        out[offset++] = 0;
+    writeBe16(out + offset, type);
+    writeBe16(out + offset + 2, 1);
+    return offset + 4;
+}
+
+// Writes a reply to `query` carrying no records: the header with QR and
+// RA set, the given rcode and, when questionEnd > 0, the question echoed.
+// `out` must hold questionEnd bytes (kHeaderSize at least). Returns the
+// reply length.
+inline int makeReply(const uchar *query, int questionEnd, int rcode, uchar *out)
+{
+    const int length = qMax(questionEnd, kHeaderSize);
+    if (out != query)
+        memcpy(out, query, size_t(length));
+    out[2] = uchar(0x80 | (query[2] & 0x79));   // QR, keep opcode and RD; clear AA and TC
+    out[3] = uchar(0x80 | (rcode & 0x0f));      // RA
+    writeBe16(out + 4, questionEnd > 0 ? 1 : 0);
+    writeBe16(out + 6, 0);
+    writeBe16(out + 8, 0);
+    writeBe16(out + 10, 0);
+    return length;
+}
+
+} // namespace DnsMessage
+
+#endif // DNSMESSAGE_H
@@ -0,0 +1,882 @@
+#include "dnsstub.h"
+#include "dnscache.h"
+#include "dnsmessage.h"
+#include "domainblocklist.h"
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <ctime>
+#include <deque>
+#include <memory>
+#include <random>
+#include <unordered_map>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const int kPollMs = 100;
+const qint64 kPublishIntervalNs = 1000000000;
+const int kReceiveBatch = 32;
+const int kBatchesPerWakeup = 8;
+const int kUdpBufferSize = 4096;
+const int kSocketBufferBytes = 1 << 20;
+const int kMaxPending = 30000;
+const int kMaxConnections = 512;
+const int kMaxConnectionOutput = 1 << 20;
+// TCP is read a chunk at a time, and at most a budget per connection and
+// wakeup; epoll is level-triggered, so the rest waits for the next round
+// while the UDP socket and other connections take their turn
+const int kReadChunk = 16384;
+const int kReadBudget = 64 << 10;
+const qint64 kClientIdleNs = 10000000000LL;
+
+qint64 monotonicNanos()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Builds a reply without records in `reply`
+void localReply(const uchar *query, int questionEnd, int rcode, QByteArray *reply)
+{
+    reply->resize(qMax(questionEnd, DnsMessage::kHeaderSize));
+    DnsMessage::makeReply(query, questionEnd, rcode, reinterpret_cast<uchar *>(reply->data()));
+}
+
+void appendFrame(QByteArray &output, const char *message, int length)
+{
+    const char prefix[2] = { char(length >> 8), char(length) };
+    output.append(prefix, 2);
+    output.append(message, length);
+}
+
+} // namespace
+
+#ifdef Q_OS_LINUX
+
+namespace {
+
+bool parseAddress(const QString &text, quint16 port, sockaddr_storage *address, socklen_t *length)
+{
+    memset(address, 0, sizeof(*address));
+    const QByteArray host = text.trimmed().toLatin1();
+    sockaddr_in *v4 = reinterpret_cast<sockaddr_in *>(address);
+    if (inet_pton(AF_INET, host.constData(), &v4->sin_addr) == 1) {
+        v4->sin_family = AF_INET;
+        v4->sin_port = htons(port);
+        *length = sizeof(sockaddr_in);
+        return true;
+    }
+    sockaddr_in6 *v6 = reinterpret_cast<sockaddr_in6 *>(address);
+    if (inet_pton(AF_INET6, host.constData(), &v6->sin6_addr) == 1) {
+        v6->sin6_family = AF_INET6;
+        v6->sin6_port = htons(port);
+        *length = sizeof(sockaddr_in6);
+        return true;
+    }
+    return false;
+}
+
+} // namespace
+
+// Socket state for one run(); lives on the stub's thread only
+class DnsStub::Session
+{
+public:
+    explicit Session(const DnsStub::Options &options);
+    ~Session();
+
+    bool open();
+    bool loadBlocklist();
+    void poll(int timeoutMs);
+    void expire(qint64 nowNs);
+    quint16 localPort() const { return port; }
+    QString errorString() const { return lastError; }
+
+    quint64 queries = 0;
+    quint64 tcpQueries = 0;
+    quint64 blocked = 0;
+    quint64 cacheHits = 0;
+    quint64 forwarded = 0;
+    quint64 timeouts = 0;
+    quint64 malformed = 0;
+    LatencyHistogram overhead;
+    DnsCache cache;
+    DomainBlocklist blocklist;
+
+private:
+    enum Disposition { Reply, Forward, Drop };
+
+    // A UDP query waiting for the upstream, keyed by the ID it was sent with
+    struct PendingQuery
+    {
+        sockaddr_storage client;
+        socklen_t clientLength = 0;
+        quint16 clientId = 0;
+        quint64 serial = 0;
+        QByteArray key;
+        QByteArray question;    // Header and question, for a SERVFAIL
+        qint64 localNs = 0;     // Overhead before the query left
+    };
+
+    struct Deadline
+    {
+        qint64 ns;
+        quint16 id;
+        quint64 serial;
+    };
+
+    // A TCP client, or an upstream connection carrying one of its queries
+    struct Connection
+    {
+        int fd = -1;
+        bool upstream = false;
+        bool writing = false;   // EPOLLOUT is registered
+        quint64 serial = 0;
+        qint64 deadlineNs = 0;  // Idle limit for clients, reply limit upstream
+        QByteArray input;
+        QByteArray output;
+
+        int client = -1;
+        quint64 clientSerial = 0;
+        quint16 clientId = 0;
+        QByteArray key;
+        QByteArray question;
+        qint64 localNs = 0;
+    };
+
+    Disposition classify(const uchar *query, int length, bool overUdp, QByteArray *reply, QByteArray *key,
+                         int *questionEnd);
+    void readClients();
+    void readUpstream();
+    void forwardUdp(uchar *query, int length, const sockaddr_storage &client, socklen_t clientLength,
+                    const QByteArray &key, int questionEnd, qint64 receivedNs);
+    void acceptClients();
+    void serviceConnection(int fd, quint32 events);
+    void readClientConnection(Connection *connection);
+    void answerFrames(Connection *connection);
+    void readUpstreamConnection(Connection *connection);
+    bool openUpstreamConnection(Connection *client, const uchar *query, int length, const QByteArray &key,
+                                int questionEnd, qint64 localNs);
+    void failUpstreamConnection(Connection *connection);
+    void relayToClient(int clientFd, quint64 clientSerial, const char *message, int length);
+    bool readAvailable(Connection *connection, int budget);
+    bool flush(Connection *connection);
+    void closeConnection(int fd);
+    quint16 allocateId();
+
+    DnsStub::Options options;
+    QString lastError;
+    int epollFd = -1;
+    int udpFd = -1;
+    int listenFd = -1;
+    int upstreamFd = -1;
+    quint16 port = 0;
+    sockaddr_storage upstreamAddress;
+    socklen_t upstreamLength = 0;
+    qint64 timeoutNs;
+
+    QHash<quint16, PendingQuery> pending;
+    std::deque<Deadline> deadlines;     // Sorted, since the timeout is fixed
+    std::unordered_map<int, std::unique_ptr<Connection>> connections;
+    quint64 nextSerial = 1;
+    std::mt19937 random;
+
+    std::vector<uchar> receiveBuffer;
+    QByteArray reply;
+};
+
+DnsStub::Session::Session(const DnsStub::Options &options)
+    : cache(options.cacheEntries), options(options),
+      timeoutNs(qint64(qMax(options.upstreamTimeoutMs, 1)) * 1000000),
+      random(std::random_device()()),
+      receiveBuffer(size_t(kReceiveBatch) * kUdpBufferSize)
+{
+    memset(&upstreamAddress, 0, sizeof(upstreamAddress));
+}
+
+DnsStub::Session::~Session()
+{
+    for (auto &entry : connections)
+        ::close(entry.first);
+    for (int fd : { udpFd, listenFd, upstreamFd, epollFd }) {
+        if (fd >= 0)
+            ::close(fd);
+    }
+}
+
+bool DnsStub::Session::open()
+{
+    sockaddr_storage listenAddress;
+    socklen_t listenLength = 0;
+    if (!parseAddress(options.listenAddress, options.port, &listenAddress, &listenLength)) {
+        lastError = QString("Invalid listen address %1").arg(options.listenAddress);
+        return false;
+    }
+    if (!parseAddress(options.upstreamAddress, options.upstreamPort, &upstreamAddress, &upstreamLength)) {
+        lastError = QString("Invalid upstream address %1").arg(options.upstreamAddress);
+        return false;
+    }
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    udpFd = socket(listenAddress.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    listenFd = socket(listenAddress.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    upstreamFd = socket(upstreamAddress.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (epollFd < 0 || udpFd < 0 || listenFd < 0 || upstreamFd < 0) {
+        lastError = QString("socket: %1").arg(strerror(errno));
+        return false;
+    }
+    setsockopt(udpFd, SOL_SOCKET, SO_RCVBUF, &kSocketBufferBytes, sizeof(kSocketBufferBytes));
+    setsockopt(upstreamFd, SOL_SOCKET, SO_RCVBUF, &kSocketBufferBytes, sizeof(kSocketBufferBytes));
+    const int on = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    // With port 0 the TCP listener takes whatever port UDP was given
+    if (bind(udpFd, reinterpret_cast<const sockaddr *>(&listenAddress), listenLength) < 0) {
+        lastError = QString("Cannot listen on %1 port %2: %3")
+                        .arg(options.listenAddress).arg(options.port).arg(strerror(errno));
+        return false;
+    }
+    sockaddr_storage bound;
+    socklen_t boundLength = sizeof(bound);
+    getsockname(udpFd, reinterpret_cast<sockaddr *>(&bound), &boundLength);
+    port = ntohs(bound.ss_family == AF_INET ? reinterpret_cast<sockaddr_in *>(&bound)->sin_port
+                                            : reinterpret_cast<sockaddr_in6 *>(&bound)->sin6_port);
+    if (bind(listenFd, reinterpret_cast<const sockaddr *>(&bound), boundLength) < 0 || listen(listenFd, 128) < 0) {
+        lastError = QString("Cannot listen on TCP port %1: %2").arg(port).arg(strerror(errno));
+        return false;
+    }
+    if (::connect(upstreamFd, reinterpret_cast<const sockaddr *>(&upstreamAddress), upstreamLength) < 0) {
+        lastError = QString("Cannot reach upstream %1: %2").arg(options.upstreamAddress, QString(strerror(errno)));
+        return false;
+    }
+
+    for (int fd : { udpFd, listenFd, upstreamFd }) {
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+    }
+    return true;
+}
+
+bool DnsStub::Session::loadBlocklist()
+{
+    if (options.blocklistPath.isEmpty()) {
+        blocklist.close();
+        return true;
+    }
+    if (!blocklist.open(options.blocklistPath)) {
+        lastError = QString("Blocklist %1: %2").arg(options.blocklistPath, blocklist.errorString());
+        return false;
+    }
+    return true;
+}
+
+void DnsStub::Session::poll(int timeoutMs)
+{
+    epoll_event events[64];
+    const int count = epoll_wait(epollFd, events, 64, timeoutMs);
+    for (int i = 0; i < count; ++i) {
+        const int fd = events[i].data.fd;
+        if (fd == udpFd)
+            readClients();
+        else if (fd == upstreamFd)
+            readUpstream();
+        else if (fd == listenFd)
+            acceptClients();
+        else
+            serviceConnection(fd, events[i].events);
+    }
+}
+
+DnsStub::Session::Disposition DnsStub::Session::classify(const uchar *query, int length, bool overUdp,
+                                                        QByteArray *reply, QByteArray *key, int *questionEnd)
+{
+    using namespace DnsMessage;
+    *questionEnd = 0;
+    if (length < kHeaderSize || isResponse(query)) {
+        ++malformed;
+        return Drop;
+    }
+    if (opcode(query) != 0) {
+        localReply(query, 0, NotImplemented, reply);
+        return Reply;
+    }
+    Question question;
+    if (!readQuestion(query, length, &question)) {
+        ++malformed;
+        localReply(query, 0, FormatError, reply);
+        return Reply;
+    }
+    *questionEnd = question.end;
+    if (blocklist.isOpen() && blocklist.isBlocked(question.name, question.nameLength)) {
+        ++blocked;
+        localReply(query, question.end, NameError, reply);
+        return Reply;
+    }
+    *key = DnsCache::key(question);
+    if (cache.lookup(*key, id(query), monotonicNanos() / 1000000, reply)) {
+        ++cacheHits;
+        // The answer may have come over TCP, or for a client that takes
+        // larger replies; past this client's limit it gets the question
+        // back with TC set and asks again over TCP
+        if (overUdp && reply->size() > qMin(udpPayloadLimit(query, length, question.end), kUdpBufferSize)) {
+            const int cachedRcode = rcode(reinterpret_cast<const uchar *>(reply->constData()));
+            localReply(query, question.end, cachedRcode, reply);
+            setTruncated(reinterpret_cast<uchar *>(reply->data()));
+        }
+        return Reply;
+    }
+    return Forward;
+}
+
+void DnsStub::Session::readClients()
+{
+    mmsghdr messages[kReceiveBatch];
+    iovec vectors[kReceiveBatch];
+    sockaddr_storage peers[kReceiveBatch];
+    for (int batch = 0; batch < kBatchesPerWakeup; ++batch) {
+        memset(messages, 0, sizeof(messages));
+        for (int i = 0; i < kReceiveBatch; ++i) {
+            vectors[i].iov_base = receiveBuffer.data() + size_t(i) * kUdpBufferSize;
+            vectors[i].iov_len = kUdpBufferSize;
+            messages[i].msg_hdr.msg_iov = &vectors[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+            messages[i].msg_hdr.msg_name = &peers[i];
+            messages[i].msg_hdr.msg_namelen = sizeof(peers[i]);
+        }
+        const int count = recvmmsg(udpFd, messages, kReceiveBatch, MSG_DONTWAIT, nullptr);
+        if (count <= 0)
+            return;
+
+        for (int i = 0; i < count; ++i) {
+            const qint64 receivedNs = monotonicNanos();
+            uchar *query = static_cast<uchar *>(vectors[i].iov_base);
+            const int length = int(messages[i].msg_len);
+            const sockaddr *peer = reinterpret_cast<const sockaddr *>(&peers[i]);
+            const socklen_t peerLength = messages[i].msg_hdr.msg_namelen;
+            ++queries;
+            if (messages[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                ++malformed;
+                continue;
+            }
+
+            QByteArray key;
+            int questionEnd = 0;
+            switch (classify(query, length, true, &reply, &key, &questionEnd)) {
+            case Reply:
+                sendto(udpFd, reply.constData(), size_t(reply.size()), 0, peer, peerLength);
+                overhead.record(quint64(monotonicNanos() - receivedNs));
+                break;
+            case Forward:
+                forwardUdp(query, length, peers[i], peerLength, key, questionEnd, receivedNs);
+                break;
+            case Drop:
+                break;
+            }
+        }
+        if (count < kReceiveBatch)
+            return;
+    }
+}
+
+quint16 DnsStub::Session::allocateId()
+{
+    quint16 id;
+    do {
+        id = quint16(random());
+    } while (pending.contains(id));
+    return id;
+}
+
+void DnsStub::Session::forwardUdp(uchar *query, int length, const sockaddr_storage &client, socklen_t clientLength,
+                                  const QByteArray &key, int questionEnd, qint64 receivedNs)
+{
+    PendingQuery entry;
+    entry.clientId = DnsMessage::id(query);
+    if (pending.size() < kMaxPending) {
+        // Random IDs on a connected socket: an off-path spoofer has to
+        // guess the ID and the source port
+        const quint16 upstreamId = allocateId();
+        DnsMessage::setId(query, upstreamId);
+        if (send(upstreamFd, query, size_t(length), 0) == length) {
+            const qint64 sentNs = monotonicNanos();
+            DnsMessage::setId(query, entry.clientId);
+            entry.client = client;
+            entry.clientLength = clientLength;
+            entry.serial = nextSerial++;
+            entry.key = key;
+            entry.question = QByteArray(reinterpret_cast<const char *>(query), questionEnd);
+            entry.localNs = sentNs - receivedNs;
+            pending.insert(upstreamId, entry);
+            deadlines.push_back({ sentNs + timeoutNs, upstreamId, entry.serial });
+            ++forwarded;
+            return;
+        }
+        DnsMessage::setId(query, entry.clientId);
+    }
+
+    localReply(query, questionEnd, DnsMessage::ServerFailure, &reply);
+    sendto(udpFd, reply.constData(), size_t(reply.size()), 0, reinterpret_cast<const sockaddr *>(&client), clientLength);
+    overhead.record(quint64(monotonicNanos() - receivedNs));
+}
+
+void DnsStub::Session::readUpstream()
+{
+    mmsghdr messages[kReceiveBatch];
+    iovec vectors[kReceiveBatch];
+    for (int batch = 0; batch < kBatchesPerWakeup; ++batch) {
+        memset(messages, 0, sizeof(messages));
+        for (int i = 0; i < kReceiveBatch; ++i) {
+            vectors[i].iov_base = receiveBuffer.data() + size_t(i) * kUdpBufferSize;
+            vectors[i].iov_len = kUdpBufferSize;
+            messages[i].msg_hdr.msg_iov = &vectors[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+        const int count = recvmmsg(upstreamFd, messages, kReceiveBatch, MSG_DONTWAIT, nullptr);
+        if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            continue; // An ICMP error from an earlier send; the query will time out
+        if (count <= 0)
+            return;
+
+        for (int i = 0; i < count; ++i) {
+            const qint64 receivedNs = monotonicNanos();
+            uchar *response = static_cast<uchar *>(vectors[i].iov_base);
+            const int length = int(messages[i].msg_len);
+            if (length < DnsMessage::kHeaderSize || !DnsMessage::isResponse(response)
+                || (messages[i].msg_hdr.msg_flags & MSG_TRUNC))
+                continue;
+            auto it = pending.find(DnsMessage::id(response));
+            if (it == pending.end())
+                continue;
+
+            // Error replies may drop the question; anything else must echo ours
+            DnsMessage::Question question;
+            const bool echoed = DnsMessage::readQuestion(response, length, &question);
+            if (echoed ? DnsCache::key(question) != it->key
+                       : DnsMessage::questionCount(response) != 0 || DnsMessage::rcode(response) == DnsMessage::NoError)
+                continue;
+
+            const PendingQuery entry = it.value();
+            pending.erase(it);
+            if (echoed)
+                cache.insert(entry.key, response, length, receivedNs / 1000000);
+            DnsMessage::setId(response, entry.clientId);
+            sendto(udpFd, response, size_t(length), 0, reinterpret_cast<const sockaddr *>(&entry.client),
+                   entry.clientLength);
+            overhead.record(quint64(entry.localNs + monotonicNanos() - receivedNs));
+        }
+        if (count < kReceiveBatch)
+            return;
+    }
+}
+
+void DnsStub::Session::acceptClients()
+{
+    while (true) {
+        const int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            return;
+        if (int(connections.size()) >= kMaxConnections) {
+            ::close(fd);
+            continue;
+        }
+        std::unique_ptr<Connection> connection(new Connection);
+        connection->fd = fd;
+        connection->serial = nextSerial++;
+        connection->deadlineNs = monotonicNanos() + kClientIdleNs;
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+        connections[fd] = std::move(connection);
+    }
+}
+
+void DnsStub::Session::serviceConnection(int fd, quint32 events)
+{
+    auto it = connections.find(fd);
+    if (it == connections.end())
+        return;
+    Connection *connection = it->second.get();
+
+    if (connection->upstream) {
+        if ((events & EPOLLERR) || ((events & EPOLLOUT) && !flush(connection))) {
+            failUpstreamConnection(connection);
+            return;
+        }
+        if (events & (EPOLLIN | EPOLLHUP))
+            readUpstreamConnection(connection);
+        return;
+    }
+
+    if ((events & EPOLLOUT) && !flush(connection)) {
+        closeConnection(fd);
+        return;
+    }
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        readClientConnection(connection);
+}
+
+// Reads up to `budget` bytes; false once the peer has closed or failed
+bool DnsStub::Session::readAvailable(Connection *connection, int budget)
+{
+    char buffer[kReadChunk];
+    while (budget > 0) {
+        const ssize_t count = recv(connection->fd, buffer, size_t(qMin(budget, kReadChunk)), 0);
+        if (count > 0) {
+            connection->input.append(buffer, int(count));
+            budget -= int(count);
+            continue;
+        }
+        return count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+    return true;
+}
+
+void DnsStub::Session::readClientConnection(Connection *connection)
+{
+    // Queries are answered as each chunk completes them, so a client that
+    // pipelines without pause holds at most a budget and a frame in input
+    bool open = true;
+    bool drained = false;
+    for (int budget = kReadBudget; open && !drained && budget > 0 && connection->output.size() <= kMaxConnectionOutput;
+         budget -= kReadChunk) {
+        const int before = connection->input.size();
+        open = readAvailable(connection, kReadChunk);
+        drained = connection->input.size() - before < kReadChunk;
+        answerFrames(connection);
+    }
+    connection->deadlineNs = monotonicNanos() + kClientIdleNs;
+
+    if (!flush(connection) || !open || connection->output.size() > kMaxConnectionOutput)
+        closeConnection(connection->fd);
+}
+
+void DnsStub::Session::answerFrames(Connection *connection)
+{
+    // Queries may be pipelined; each is answered or forwarded on its own
+    int consumed = 0;
+    const QByteArray &input = connection->input;
+    while (input.size() - consumed >= 2) {
+        const qint64 receivedNs = monotonicNanos();
+        const uchar *frame = reinterpret_cast<const uchar *>(input.constData()) + consumed;
+        const int length = DnsMessage::readBe16(frame);
+        if (input.size() - consumed - 2 < length)
+            break;
+        consumed += 2 + length;
+        ++queries;
+        ++tcpQueries;
+
+        QByteArray key;
+        int questionEnd = 0;
+        Disposition disposition = classify(frame + 2, length, false, &reply, &key, &questionEnd);
+        if (disposition == Forward
+            && (int(connections.size()) >= kMaxConnections
+                || !openUpstreamConnection(connection, frame + 2, length, key, questionEnd,
+                                           monotonicNanos() - receivedNs))) {
+            localReply(frame + 2, questionEnd, DnsMessage::ServerFailure, &reply);
+            disposition = Reply;
+        }
+        if (disposition == Reply) {
+            appendFrame(connection->output, reply.constData(), reply.size());
+            overhead.record(quint64(monotonicNanos() - receivedNs));
+        }
+    }
+    connection->input.remove(0, consumed);
+}
+
+bool DnsStub::Session::openUpstreamConnection(Connection *client, const uchar *query, int length,
+                                              const QByteArray &key, int questionEnd, qint64 localNs)
+{
+    const int fd = socket(upstreamAddress.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+    if (::connect(fd, reinterpret_cast<const sockaddr *>(&upstreamAddress), upstreamLength) < 0
+        && errno != EINPROGRESS) {
+        ::close(fd);
+        return false;
+    }
+
+    // A connection per query keeps the client's ID, so nothing to remap
+    std::unique_ptr<Connection> connection(new Connection);
+    connection->fd = fd;
+    connection->upstream = true;
+    connection->writing = true;
+    connection->serial = nextSerial++;
+    connection->client = client->fd;
+    connection->clientSerial = client->serial;
+    connection->clientId = DnsMessage::id(query);
+    connection->key = key;
+    connection->question = QByteArray(reinterpret_cast<const char *>(query), questionEnd);
+    connection->localNs = localNs;
+    connection->deadlineNs = monotonicNanos() + timeoutNs;
+    appendFrame(connection->output, reinterpret_cast<const char *>(query), length);
+
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLOUT;
+    event.data.fd = fd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+    connections[fd] = std::move(connection);
+    ++forwarded;
+    return true;
+}
+
+void DnsStub::Session::readUpstreamConnection(Connection *connection)
+{
+    const bool open = readAvailable(connection, kReadBudget);
+    const QByteArray &input = connection->input;
+    if (input.size() >= 2) {
+        const int length = DnsMessage::readBe16(reinterpret_cast<const uchar *>(input.constData()));
+        if (input.size() >= 2 + length) {
+            const qint64 receivedNs = monotonicNanos();
+            const uchar *response = reinterpret_cast<const uchar *>(input.constData()) + 2;
+            DnsMessage::Question question;
+            if (length < DnsMessage::kHeaderSize || DnsMessage::id(response) != connection->clientId) {
+                failUpstreamConnection(connection);
+                return;
+            }
+            if (DnsMessage::readQuestion(response, length, &question) && DnsCache::key(question) == connection->key)
+                cache.insert(connection->key, response, length, receivedNs / 1000000);
+            relayToClient(connection->client, connection->clientSerial, input.constData() + 2, length);
+            overhead.record(quint64(connection->localNs + monotonicNanos() - receivedNs));
+            closeConnection(connection->fd);
+            return;
+        }
+    }
+    if (!open)
+        failUpstreamConnection(connection);
+}
+
+void DnsStub::Session::failUpstreamConnection(Connection *connection)
+{
+    QByteArray failure;
+    const QByteArray header = connection->question.size() >= DnsMessage::kHeaderSize
+                                  ? connection->question
+                                  : QByteArray(DnsMessage::kHeaderSize, '\0');
+    localReply(reinterpret_cast<const uchar *>(header.constData()), connection->question.size(),
+               DnsMessage::ServerFailure, &failure);
+    DnsMessage::setId(reinterpret_cast<uchar *>(failure.data()), connection->clientId);
+    relayToClient(connection->client, connection->clientSerial, failure.constData(), failure.size());
+    closeConnection(connection->fd);
+}
+
+void DnsStub::Session::relayToClient(int clientFd, quint64 clientSerial, const char *message, int length)
+{
+    // The client may have gone, and its descriptor been reused since
+    auto it = connections.find(clientFd);
+    if (it == connections.end() || it->second->serial != clientSerial)
+        return;
+    Connection *client = it->second.get();
+    appendFrame(client->output, message, length);
+    if (!flush(client) || client->output.size() > kMaxConnectionOutput)
+        closeConnection(clientFd);
+}
+
+bool DnsStub::Session::flush(Connection *connection)
+{
+    int written = 0;
+    while (written < connection->output.size()) {
+        const ssize_t count = send(connection->fd, connection->output.constData() + written,
+                                   size_t(connection->output.size() - written), MSG_NOSIGNAL);
+        if (count > 0) {
+            written += int(count);
+            continue;
+        }
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOTCONN))
+            break;
+        return false;
+    }
+    connection->output.remove(0, written);
+
+    const bool wantWrite = !connection->output.isEmpty();
+    if (wantWrite != connection->writing) {
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN | (wantWrite ? EPOLLOUT : 0);
+        event.data.fd = connection->fd;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, connection->fd, &event);
+        connection->writing = wantWrite;
+    }
+    return true;
+}
+
+void DnsStub::Session::closeConnection(int fd)
+{
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(fd);
+    connections.erase(fd);
+}
+
+void DnsStub::Session::expire(qint64 nowNs)
+{
+    while (!deadlines.empty() && deadlines.front().ns <= nowNs) {
+        const Deadline deadline = deadlines.front();
+        deadlines.pop_front();
+        auto it = pending.find(deadline.id);
+        if (it == pending.end() || it->serial != deadline.serial)
+            continue;
+
+        ++timeouts;
+        const PendingQuery entry = it.value();
+        pending.erase(it);
+        localReply(reinterpret_cast<const uchar *>(entry.question.constData()), entry.question.size(),
+                   DnsMessage::ServerFailure, &reply);
+        sendto(udpFd, reply.constData(), size_t(reply.size()), 0,
+               reinterpret_cast<const sockaddr *>(&entry.client), entry.clientLength);
+    }
+
+    std::vector<int> expired;
+    for (const auto &entry : connections) {
+        if (entry.second->deadlineNs <= nowNs)
+            expired.push_back(entry.first);
+    }
+    for (int fd : expired) {
+        auto it = connections.find(fd);
+        if (it == connections.end())
+            continue;
+        if (it->second->upstream) {
+            ++timeouts;
+            failUpstreamConnection(it->second.get());
+        } else {
+            closeConnection(fd);
+        }
+    }
+}
+
+#else
+
+class DnsStub::Session
+{
+public:
+    explicit Session(const DnsStub::Options &) {}
+
+    bool open() { return false; }
+    bool loadBlocklist() { return false; }
+    void poll(int) {}
+    void expire(qint64) {}
+    quint16 localPort() const { return 0; }
+    QString errorString() const { return "The DNS filter requires epoll (Linux only)"; }
+
+    quint64 queries = 0;
+    quint64 tcpQueries = 0;
+    quint64 blocked = 0;
+    quint64 cacheHits = 0;
+    quint64 forwarded = 0;
+    quint64 timeouts = 0;
+    quint64 malformed = 0;
+    LatencyHistogram overhead;
+    DnsCache cache;
+    DomainBlocklist blocklist;
+};
+
+#endif
+
+DnsStub::DnsStub(QObject *parent)
+    : QThread(parent)
+{
+    qRegisterMetaType<DnsStats>();
+}
+
+DnsStub::~DnsStub()
+{
+    requestStop();
+    wait();
+}
+
+void DnsStub::setOptions(const Options &options)
+{
+    Q_ASSERT(!isRunning());
+    settings = options;
+}
+
+void DnsStub::requestStop()
+{
+    stopRequested.store(true);
+}
+
+void DnsStub::requestBlocklistReload()
+{
+    reloadRequested.store(true);
+}
+
+DnsStats DnsStub::stats() const
+{
+    QMutexLocker lock(&statsMutex);
+    return current;
+}
+
+void DnsStub::run()
+{
+    stopRequested.store(false);
+    reloadRequested.store(false);
+    queriesAtLastPublish = 0;
+    lastPublishNs = 0;
+    {
+        QMutexLocker lock(&statsMutex);
+        current = DnsStats();
+    }
+
+    Session session(settings);
+    if (!session.open()) {
+        emit error(session.errorString());
+        return;
+    }
+    // Without its blocklist the stub still resolves
+    if (!session.loadBlocklist())
+        emit error(session.errorString());
+    boundPort.store(session.localPort());
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    while (!stopRequested.load(std::memory_order_relaxed)) {
+        if (reloadRequested.exchange(false) && !session.loadBlocklist())
+            emit error(session.errorString());
+        session.poll(kPollMs);
+        session.expire(monotonicNanos());
+        const qint64 nowNs = elapsed.nsecsElapsed();
+        if (nowNs - lastPublishNs >= kPublishIntervalNs)
+            publish(session, nowNs, false);
+    }
+    publish(session, elapsed.nsecsElapsed(), true);
+    boundPort.store(0);
+}
+
+void DnsStub::publish(Session &session, qint64 elapsedNs, bool final)
+{
+    DnsStats snapshot;
+    {
+        QMutexLocker lock(&statsMutex);
+        current.queries = session.queries;
+        current.tcpQueries = session.tcpQueries;
+        current.blocked = session.blocked;
+        current.cacheHits = session.cacheHits;
+        current.forwarded = session.forwarded;
+        current.timeouts = session.timeouts;
+        current.malformed = session.malformed;
+        current.cacheEntries = quint64(session.cache.size());
+        current.blocklistDomains = session.blocklist.size();
+        current.elapsedMs = elapsedNs / 1000000;
+        const quint64 queries = final ? session.queries : session.queries - queriesAtLastPublish;
+        const qint64 intervalNs = final ? elapsedNs : elapsedNs - lastPublishNs;
+        current.queriesPerSecond = intervalNs > 0 ? double(queries) * 1e9 / double(intervalNs) : 0;
+        current.overhead.merge(session.overhead);
+        snapshot = current;
+    }
+    session.overhead.reset();
+    queriesAtLastPublish = session.queries;
+    lastPublishNs = elapsedNs;
+    emit statsUpdated(snapshot);
+}
@@ -0,0 +1,93 @@
+#ifndef DNSSTUB_H
+#define DNSSTUB_H
+
+#include <QMetaType>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <atomic>
+#include "latencyhistogram.h"
+
+struct DnsStats
+{
+    quint64 queries = 0;
+    quint64 tcpQueries = 0;
+    quint64 blocked = 0;          // Answered NXDOMAIN from the blocklist
+    quint64 cacheHits = 0;
+    quint64 forwarded = 0;
+    quint64 timeouts = 0;         // Answered SERVFAIL after the upstream timeout
+    quint64 malformed = 0;        // Dropped or answered FORMERR
+    quint64 cacheEntries = 0;
+    quint64 blocklistDomains = 0;
+    qint64 elapsedMs = 0;
+    double queriesPerSecond = 0;  // Last interval; the whole run once stopped
+    // Work the stub does per query, from picking it up to sending the
+    // reply (or the forward, plus relaying the upstream's answer). Time
+    // spent queued behind other queries in a receive batch is not counted.
+    LatencyHistogram overhead;
+};
+
+Q_DECLARE_METATYPE(DnsStats)
+
+// Filtering DNS stub resolver. Listens on UDP and TCP at a local address,
+// answers blocklisted names with NXDOMAIN, serves repeats from a TTL
+// cache and forwards everything else to one upstream server: UDP queries
+// over a connected UDP socket with fresh random IDs, TCP queries over a
+// TCP connection of their own. Upstream silence past the timeout is
+// answered with SERVFAIL.
+//
+// One thread runs an epoll loop over every socket; nothing blocks, so a
+// slow upstream never holds up blocked or cached answers.
+class DnsStub : public QThread
+{
+    Q_OBJECT
+
+public:
+    struct Options
+    {
+        QString listenAddress = "127.0.0.1";
+        quint16 port = 5300;           // 0 picks a free port; see localPort()
+        QString upstreamAddress = "1.1.1.1";
+        quint16 upstreamPort = 53;
+        QString blocklistPath;         // Compiled image; empty disables filtering
+        int cacheEntries = 10000;
+        int upstreamTimeoutMs = 3000;
+    };
+
+    explicit DnsStub(QObject *parent = nullptr);
+    ~DnsStub();
+
+    // Only while stopped
+    void setOptions(const Options &options);
+    Options options() const { return settings; }
+
+    void requestStop();
+    // Reopens the blocklist image, e.g. after it was recompiled
+    void requestBlocklistReload();
+    // The bound port once listening, 0 before and after
+    quint16 localPort() const { return boundPort.load(); }
+    DnsStats stats() const;
+
+signals:
+    void statsUpdated(const DnsStats &stats);
+    void error(const QString &message);
+
+protected:
+    void run() override;
+
+private:
+    class Session;
+
+    void publish(Session &session, qint64 elapsedNs, bool final);
+
+    Options settings;
+    std::atomic<bool> stopRequested { false };
+    std::atomic<bool> reloadRequested { false };
+    std::atomic<quint16> boundPort { 0 };
+    mutable QMutex statsMutex;
+    DnsStats current;
+    quint64 queriesAtLastPublish = 0;
+    qint64 lastPublishNs = 0;
+};
+
+#endif // DNSSTUB_H
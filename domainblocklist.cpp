@@ -0,0 +1,432 @@
+#include "domainblocklist.h"
+#include <QElapsedTimer>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+const char kImageMagic[8] = { 'R', 'H', 'B', 'L', 'K', '0', '0', '1' };
+const quint32 kImageVersion = 1;
+const int kKeysPerBucket = 5;
+const double kTableLoad = 0.97;
+const int kMaxSeeds = 16;
+const int kMaxDomainLength = 253;
+
+struct ImageHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 reserved;
+    quint64 seed;
+    quint64 keyCount;
+    quint64 bucketCount;
+    quint64 tableSize;
+    quint64 pilotOffset;
+    quint64 tableOffset;
+    quint64 fileSize;
+};
+
+inline quint64 mix64(quint64 x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+inline quint64 rotateLeft(quint64 x, int bits)
+{
+    return (x << bits) | (x >> (64 - bits));
+}
+
+quint64 hashBytes(const uchar *data, int length, quint64 seed)
+{
+    quint64 h = seed ^ (quint64(length) * 0x9e3779b97f4a7c15ULL);
+    int i = 0;
+    for (; i + 8 <= length; i += 8) {
+        quint64 word;
+        memcpy(&word, data + i, 8);
+        h = rotateLeft(h ^ mix64(word), 27) * 5 + 0x52dce729;
+    }
+    quint64 tail = 0;
+    for (int shift = 0; i < length; ++i, shift += 8)
+        tail |= quint64(data[i]) << shift;
+    return mix64(h ^ mix64(tail + 0x9e3779b97f4a7c15ULL));
+}
+
+inline quint64 nameHash(const uchar *name, int length)
+{
+    return hashBytes(name, length, 0x243f6a8885a308d3ULL);
+}
+
+// Independent of the hash above; bit 0 is left for the subdomain flag and
+// zero marks an empty slot
+inline quint64 nameFingerprint(const uchar *name, int length)
+{
+    const quint64 fingerprint = hashBytes(name, length, 0x13198a2e03707344ULL) & ~quint64(1);
+    return fingerprint ? fingerprint : 2;
+}
+
+inline quint64 fastRange(quint64 hash, quint64 range)
+{
+    return quint64((unsigned __int128)hash * range >> 64);
+}
+
+inline quint64 bucketFor(quint64 hash, quint64 seed, quint64 bucketCount)
+{
+    return fastRange(mix64(hash ^ seed), bucketCount);
+}
+
+inline quint64 slotFor(quint64 hash, quint64 seed, quint16 pilot, quint64 tableSize)
+{
+    return fastRange(mix64(hash ^ seed ^ (quint64(pilot) + 1) * 0x9e3779b97f4a7c15ULL), tableSize);
+}
+
+// Lowercases and validates; returns the length or -1
+int normalizeDomain(const char *name, int length, uchar *out)
+{
+    if (length > 0 && name[length - 1] == '.')
+        --length;
+    if (length <= 0 || length > kMaxDomainLength)
+        return -1;
+
+    int labelLength = 0;
+    for (int i = 0; i < length; ++i) {
+        uchar c = uchar(name[i]);
+        if (c >= 'A' && c <= 'Z')
+            c = uchar(c - 'A' + 'a');
+        if (c == '.') {
+            if (labelLength == 0)
+                return -1;
+            labelLength = 0;
+        } else if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '-' || c == '_') {
+            if (++labelLength > 63)
+                return -1;
+        } else {
+            return -1;
+        }
+        out[i] = c;
+    }
+    return labelLength ? length : -1;
+}
+
+bool isHostsBoilerplate(const QByteArray &name)
+{
+    return name == "localhost" || name == "localhost.localdomain" || name == "local"
+           || name == "broadcasthost" || name == "0.0.0.0" || name.startsWith("ip6-");
+}
+
+bool looksLikeAddress(const QByteArray &token)
+{
+    if (token.contains(':'))
+        return true;
+    for (char c : token) {
+        if (c != '.' && (c < '0' || c > '9'))
+            return false;
+    }
+    return true;
+}
+
+} // namespace
+
+bool DomainBlocklist::Builder::add(const char *name, int length, bool subdomains)
+{
+    uchar normalized[kMaxDomainLength];
+    const int normalizedLength = normalizeDomain(name, length, normalized);
+    if (normalizedLength < 0)
+        return false;
+    keys.push_back({ nameHash(normalized, normalizedLength),
+                     nameFingerprint(normalized, normalizedLength) | (subdomains ? 1 : 0) });
+    return true;
+}
+
+bool DomainBlocklist::Builder::write(const QString &imagePath, CompileStats *stats, QString *error)
+{
+    // Duplicates share a hash; keep one entry with the union of the flags
+    std::sort(keys.begin(), keys.end(), [](const Key &a, const Key &b) {
+        return a.hash < b.hash || (a.hash == b.hash && a.fingerprint < b.fingerprint);
+    });
+    size_t unique = 0;
+    quint64 duplicates = 0;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (unique > 0 && keys[unique - 1].hash == keys[i].hash) {
+            keys[unique - 1].fingerprint |= keys[i].fingerprint & 1;
+            ++duplicates;
+            continue;
+        }
+        keys[unique++] = keys[i];
+    }
+    keys.resize(unique);
+
+    const quint64 keyCount = keys.size();
+    const quint64 bucketCount = keyCount / kKeysPerBucket + 1;
+    const quint64 tableSize = quint64(double(keyCount) / kTableLoad) + 1;
+    std::vector<quint16> pilots(bucketCount);
+    std::vector<quint64> table(tableSize);
+
+    // Place the largest buckets first, while the table is emptiest; each
+    // bucket gets the first pilot that sends all its keys to free slots
+    std::vector<quint64> bucketOf(keyCount);
+    std::vector<quint32> bucketStart(bucketCount + 1);
+    std::vector<quint32> members(keyCount);
+    std::vector<quint32> order(bucketCount);
+    std::vector<quint64> taken((tableSize + 63) / 64);
+    quint64 seed = 0;
+    bool placed = false;
+    for (int attempt = 0; attempt < kMaxSeeds && !placed; ++attempt) {
+        seed = mix64(quint64(attempt) + 0x5be0cd19137e2179ULL);
+        std::fill(bucketStart.begin(), bucketStart.end(), 0);
+        for (quint64 k = 0; k < keyCount; ++k) {
+            bucketOf[k] = bucketFor(keys[k].hash, seed, bucketCount);
+            ++bucketStart[bucketOf[k] + 1];
+        }
+        for (quint64 b = 0; b < bucketCount; ++b)
+            bucketStart[b + 1] += bucketStart[b];
+        std::vector<quint32> fill(bucketStart.begin(), bucketStart.end() - 1);
+        for (quint64 k = 0; k < keyCount; ++k)
+            members[fill[bucketOf[k]]++] = quint32(k);
+        for (quint64 b = 0; b < bucketCount; ++b)
+            order[b] = quint32(b);
+        std::stable_sort(order.begin(), order.end(), [&bucketStart](quint32 a, quint32 b) {
+            return bucketStart[a + 1] - bucketStart[a] > bucketStart[b + 1] - bucketStart[b];
+        });
+
+        std::fill(taken.begin(), taken.end(), 0);
+        std::fill(table.begin(), table.end(), 0);
+        placed = true;
+        quint64 slots[64];
+        for (quint32 bucket : order) {
+            const quint32 first = bucketStart[bucket];
+            const quint32 size = bucketStart[bucket + 1] - first;
+            if (size == 0)
+                break;
+            if (size > 64) {
+                placed = false;
+                break;
+            }
+            bool found = false;
+            for (quint32 pilot = 0; pilot <= 0xffff && !found; ++pilot) {
+                found = true;
+                for (quint32 i = 0; i < size && found; ++i) {
+                    const quint64 slot = slotFor(keys[members[first + i]].hash, seed, quint16(pilot), tableSize);
+                    if (taken[slot / 64] & (quint64(1) << (slot % 64)))
+                        found = false;
+                    for (quint32 j = 0; j < i && found; ++j)
+                        found = slots[j] != slot;
+                    slots[i] = slot;
+                }
+                if (found) {
+                    pilots[bucket] = quint16(pilot);
+                    for (quint32 i = 0; i < size; ++i) {
+                        taken[slots[i] / 64] |= quint64(1) << (slots[i] % 64);
+                        table[slots[i]] = keys[members[first + i]].fingerprint;
+                    }
+                }
+            }
+            if (!found) {
+                placed = false;
+                break;
+            }
+        }
+    }
+    if (!placed) {
+        *error = "Could not build a perfect hash for the blocklist";
+        return false;
+    }
+
+    ImageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kImageMagic, sizeof(header.magic));
+    header.version = kImageVersion;
+    header.seed = seed;
+    header.keyCount = keyCount;
+    header.bucketCount = bucketCount;
+    header.tableSize = tableSize;
+    header.pilotOffset = sizeof(ImageHeader);
+    header.tableOffset = (header.pilotOffset + bucketCount * sizeof(quint16) + 63) & ~quint64(63);
+    header.fileSize = header.tableOffset + tableSize * sizeof(quint64);
+
+    // Written beside the target and renamed over it, so a running
+    // resolver that has the old image mapped is never disturbed
+    const QString temporaryPath = imagePath + ".new";
+    QFile out(temporaryPath);
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        *error = out.errorString();
+        return false;
+    }
+    const QByteArray padding(int(header.tableOffset - header.pilotOffset - bucketCount * sizeof(quint16)), '\0');
+    bool ok = out.write(reinterpret_cast<const char *>(&header), sizeof(header)) == qint64(sizeof(header));
+    ok = ok && out.write(reinterpret_cast<const char *>(pilots.data()), qint64(bucketCount * sizeof(quint16)))
+                   == qint64(bucketCount * sizeof(quint16));
+    ok = ok && out.write(padding) == padding.size();
+    ok = ok && out.write(reinterpret_cast<const char *>(table.data()), qint64(tableSize * sizeof(quint64)))
+                   == qint64(tableSize * sizeof(quint64));
+    out.close();
+    if (!ok || std::rename(QFile::encodeName(temporaryPath).constData(), QFile::encodeName(imagePath).constData()) != 0) {
+        *error = ok ? QString("Cannot replace %1").arg(imagePath) : out.errorString();
+        QFile::remove(temporaryPath);
+        return false;
+    }
+
+    if (stats) {
+        stats->domains = keyCount;
+        stats->duplicates += duplicates;
+        stats->imageBytes = header.fileSize;
+    }
+    return true;
+}
+
+bool DomainBlocklist::compile(const QString &sourcePath, const QString &imagePath, CompileStats *stats, QString *error)
+{
+    QElapsedTimer elapsed;
+    elapsed.start();
+    CompileStats local;
+    CompileStats &counts = stats ? *stats : local;
+    counts = CompileStats();
+
+    QFile source(sourcePath);
+    if (!source.open(QIODevice::ReadOnly)) {
+        *error = source.errorString();
+        return false;
+    }
+
+    Builder builder;
+    while (!source.atEnd()) {
+        QByteArray line = source.readLine();
+        ++counts.lines;
+        const int comment = line.indexOf('#');
+        if (comment >= 0)
+            line.truncate(comment);
+        line = line.trimmed();
+        if (line.isEmpty() || line.startsWith('!'))
+            continue;
+
+        bool subdomains = false;
+        QList<QByteArray> names;
+        if (line.startsWith("||")) {
+            const int end = line.indexOf('^');
+            if (end < 0 && line.contains('/'))
+                continue; // A URL rule, not a domain
+            names.append(line.mid(2, end < 0 ? -1 : end - 2));
+            subdomains = true;
+        } else {
+            names = line.simplified().split(' ');
+            if (names.size() > 1 && looksLikeAddress(names.first()))
+                names.removeFirst();
+        }
+
+        for (QByteArray &name : names) {
+            if (name.startsWith("*.")) {
+                name.remove(0, 2);
+                subdomains = true;
+            }
+            if (isHostsBoilerplate(name))
+                continue;
+            if (!builder.add(name.constData(), name.size(), subdomains))
+                ++counts.invalid;
+        }
+    }
+
+    if (!builder.write(imagePath, &counts, error))
+        return false;
+    counts.elapsedMs = elapsed.elapsed();
+    return true;
+}
+
+DomainBlocklist::DomainBlocklist()
+{
+}
+
+DomainBlocklist::~DomainBlocklist()
+{
+    close();
+}
+
+void DomainBlocklist::close()
+{
+    if (map)
+        file.unmap(map);
+    file.close();
+    map = nullptr;
+    pilots = nullptr;
+    table = nullptr;
+    keyCount = 0;
+}
+
+bool DomainBlocklist::open(const QString &imagePath)
+{
+    close();
+    file.setFileName(imagePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        lastError = file.errorString();
+        return false;
+    }
+    const quint64 size = quint64(file.size());
+    if (size < sizeof(ImageHeader)) {
+        lastError = "Blocklist image is truncated";
+        file.close();
+        return false;
+    }
+    map = file.map(0, qint64(size));
+    if (!map) {
+        lastError = file.errorString();
+        file.close();
+        return false;
+    }
+
+    ImageHeader header;
+    memcpy(&header, map, sizeof(header));
+    const bool valid = memcmp(header.magic, kImageMagic, sizeof(header.magic)) == 0
+                       && header.version == kImageVersion && header.fileSize == size
+                       && header.bucketCount > 0 && header.tableSize > header.keyCount
+                       && header.pilotOffset == sizeof(ImageHeader)
+                       && header.bucketCount <= (size - header.pilotOffset) / sizeof(quint16)
+                       && header.tableOffset % 64 == 0
+                       && header.tableOffset >= header.pilotOffset + header.bucketCount * sizeof(quint16)
+                       && header.tableSize <= (size - header.tableOffset) / sizeof(quint64)
+                       && header.tableOffset + header.tableSize * sizeof(quint64) == size;
+    if (!valid) {
+        lastError = "Not a blocklist image, or from an incompatible version";
+        close();
+        return false;
+    }
+
+    seed = header.seed;
+    keyCount = header.keyCount;
+    bucketCount = header.bucketCount;
+    tableSize = header.tableSize;
+    pilots = reinterpret_cast<const quint16 *>(map + header.pilotOffset);
+    table = reinterpret_cast<const quint64 *>(map + header.tableOffset);
+    return true;
+}
+
+bool DomainBlocklist::contains(const uchar *name, int length, bool viaParent) const
+{
+    const quint64 hash = nameHash(name, length);
+    const quint16 pilot = pilots[bucketFor(hash, seed, bucketCount)];
+    const quint64 entry = table[slotFor(hash, seed, pilot, tableSize)];
+    if ((entry & ~quint64(1)) != nameFingerprint(name, length))
+        return false;
+    return !viaParent || (entry & 1);
+}
+
+bool DomainBlocklist::isBlocked(const char *name, int length) const
+{
+    if (!table)
+        return false;
+    uchar normalized[kMaxDomainLength];
+    const int normalizedLength = normalizeDomain(name, length, normalized);
+    if (normalizedLength < 0)
+        return false;
+
+    if (contains(normalized, normalizedLength, false))
+        return true;
+    for (int i = 0; i < normalizedLength; ++i) {
+        if (normalized[i] == '.' && contains(normalized + i + 1, normalizedLength - i - 1, true))
+            return true;
+    }
+    return false;
+}
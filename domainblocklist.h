@@ -0,0 +1,82 @@
+#ifndef DOMAINBLOCKLIST_H
+#define DOMAINBLOCKLIST_H
+
+#include <QFile>
+#include <QString>
+#include <vector>
+
+// Read-only set of blocked domains, compiled once into an image file and
+// mapped at load time, so opening a multi-million entry list costs a
+// header check and pages are faulted in only as lookups touch them.
+//
+// The image is a perfect hash (hash-and-displace, one 16-bit pilot per
+// bucket of ~5 keys, table at 97% load) whose slots hold a 63-bit
+// fingerprint of the domain plus a "subdomains too" bit. A lookup is one
+// pilot read and one slot read per label suffix of the queried name:
+// "a.ads.example.com" checks itself, then "ads.example.com" and
+// "example.com" against entries that cover subdomains.
+class DomainBlocklist
+{
+public:
+    struct CompileStats
+    {
+        quint64 lines = 0;
+        quint64 domains = 0;
+        quint64 duplicates = 0;
+        quint64 invalid = 0;
+        quint64 imageBytes = 0;
+        qint64 elapsedMs = 0;
+    };
+
+    // Collects domains and writes the image
+    class Builder
+    {
+    public:
+        // Returns false for names that are not valid domains
+        bool add(const char *name, int length, bool subdomains);
+        quint64 count() const { return quint64(keys.size()); }
+        bool write(const QString &imagePath, CompileStats *stats, QString *error);
+
+    private:
+        struct Key
+        {
+            quint64 hash;
+            quint64 fingerprint;   // Bit 0: also blocks subdomains
+        };
+
+        std::vector<Key> keys;
+    };
+
+    // Accepts hosts files ("0.0.0.0 example.com"), plain lists (one
+    // domain per line) and adblock-style "||example.com^" lines; "#" and
+    // "!" start comments. Plain and hosts entries block the exact name,
+    // "*.example.com" and "||example.com^" also block subdomains.
+    static bool compile(const QString &sourcePath, const QString &imagePath, CompileStats *stats, QString *error);
+
+    DomainBlocklist();
+    ~DomainBlocklist();
+
+    bool open(const QString &imagePath);
+    void close();
+    bool isOpen() const { return table != nullptr; }
+    quint64 size() const { return keyCount; }
+    QString errorString() const { return lastError; }
+
+    // `name` is a dotted domain in any case, with or without the root dot
+    bool isBlocked(const char *name, int length) const;
+
+private:
+    bool contains(const uchar *name, int length, bool viaParent) const;
+
+    QFile file;
+    uchar *map = nullptr;
+    const quint16 *pilots = nullptr;
+    const quint64 *table = nullptr;
+    quint64 keyCount = 0;
+    quint64 bucketCount = 0;
+    quint64 tableSize = 0;
+    quint64 seed = 0;
+    QString lastError;
+};
+
+#endif // DOMAINBLOCKLIST_H
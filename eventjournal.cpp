@@ -0,0 +1,972 @@
+#include "eventjournal.h"
+#include <QDateTime>
+#include <QDeadlineTimer>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char kDataMagic[8] = { 'R', 'H', 'J', 'N', 'L', '0', '0', '1' };
+const char kIndexMagic[8] = { 'R', 'H', 'J', 'I', 'D', 'X', '0', '1' };
+const quint32 kVersion = 1;
+const quint32 kBlockMagic = 0x4b424a52;   // "RJBK"
+const quint32 kCompressedBlock = 0x1;
+// Timestamp delta and payload length varints, and the type byte
+const int kMaxRecordOverhead = 10 + 1 + 5;
+
+struct DataHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 reserved;
+};
+
+struct BlockHeader
+{
+    quint32 magic;
+    quint32 checksum;        // Of the stored bytes
+    qint64 minTimeUs;
+    qint64 maxTimeUs;
+    quint64 typeMask;
+    quint32 storedSize;
+    quint32 rawSize;
+    quint32 count;
+    quint32 flags;
+};
+
+// Totals are only filled in when the segment is sealed; the newest
+// segment's index is rebuilt from its blocks on open instead
+struct IndexHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 sealed;
+    qint64 minTimeUs;
+    qint64 maxTimeUs;
+    quint64 typeMask;
+    quint64 events;
+    quint64 dataBytes;
+    quint32 blocks;
+    quint32 reserved;
+};
+
+struct IndexEntry
+{
+    quint64 offset;          // Of the BlockHeader in the .jnl
+    qint64 minTimeUs;
+    qint64 maxTimeUs;
+    quint64 typeMask;
+    quint32 count;
+    quint32 reserved;
+};
+
+static_assert(sizeof(DataHeader) == 16, "segment headers are read straight from disk");
+static_assert(sizeof(BlockHeader) == 48, "block headers are read straight from disk");
+static_assert(sizeof(IndexHeader) == 64, "index headers are read straight from disk");
+static_assert(sizeof(IndexEntry) == 40, "index entries are mapped from disk");
+
+char *writeVarint(char *out, quint64 value)
+{
+    while (value >= 0x80) {
+        *out++ = char(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = char(value);
+    return out;
+}
+
+// Null if the varint runs past `end` or over 64 bits
+const uchar *readVarint(const uchar *in, const uchar *end, quint64 *value)
+{
+    quint64 result = 0;
+    for (int shift = 0; shift < 64 && in < end; shift += 7) {
+        const uchar byte = *in++;
+        result |= quint64(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return in;
+        }
+    }
+    return nullptr;
+}
+
+quint64 zigzag(qint64 value)
+{
+    return (quint64(value) << 1) ^ quint64(value >> 63);
+}
+
+qint64 unzigzag(quint64 value)
+{
+    return qint64(value >> 1) ^ -qint64(value & 1);
+}
+
+// FNV-1a over 64-bit words; it only has to catch a torn write
+quint32 checksum(const char *data, size_t size)
+{
+    const quint64 kPrime = 0x100000001b3ull;
+    quint64 hash = 0xcbf29ce484222325ull;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        quint64 word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * kPrime;
+    }
+    for (; i < size; ++i)
+        hash = (hash ^ uchar(data[i])) * kPrime;
+    return quint32(hash ^ (hash >> 32));
+}
+
+bool syncFile(QFile &file)
+{
+#ifdef Q_OS_LINUX
+    return fdatasync(file.handle()) == 0;
+#elif defined(Q_OS_UNIX)
+    return fsync(file.handle()) == 0;
+#else
+    return file.flush();
+#endif
+}
+
+bool writeAll(QFile &file, const QByteArray &bytes)
+{
+    return file.write(bytes) == bytes.size();
+}
+
+} // namespace
+
+const char *EventJournal::typeName(quint8 type)
+{
+    static const char *const names[] = { "scan_result", "blocked_connection", "vpn_state_change", "security_alert" };
+    return type < sizeof(names) / sizeof(names[0]) ? names[type] : "unknown";
+}
+
+void EventJournal::Range::add(qint64 timeUs, quint8 type)
+{
+    if (!count) {
+        minTimeUs = timeUs;
+        maxTimeUs = timeUs;
+    } else {
+        minTimeUs = qMin(minTimeUs, timeUs);
+        maxTimeUs = qMax(maxTimeUs, timeUs);
+    }
+    typeMask |= typeBit(type);
+    ++count;
+}
+
+void EventJournal::Range::add(const Range &other)
+{
+    if (!other.count)
+        return;
+    if (!count) {
+        minTimeUs = other.minTimeUs;
+        maxTimeUs = other.maxTimeUs;
+    } else {
+        minTimeUs = qMin(minTimeUs, other.minTimeUs);
+        maxTimeUs = qMax(maxTimeUs, other.maxTimeUs);
+    }
+    typeMask |= other.typeMask;
+    count += other.count;
+}
+
+EventJournal::EventJournal(QObject *parent)
+    : QThread(parent)
+{
+}
+
+EventJournal::~EventJournal()
+{
+    close();
+}
+
+QString EventJournal::errorString() const
+{
+    QMutexLocker lock(&mutex);
+    return lastError;
+}
+
+bool EventJournal::fail(const QString &message)
+{
+    {
+        QMutexLocker lock(&mutex);
+        failed = true;
+        lastError = message;
+        pendingDrained.wakeAll();
+        durableAdvanced.wakeAll();
+    }
+    emit error(message);
+    return false;
+}
+
+QString EventJournal::segmentPath(quint64 id, const char *suffix) const
+{
+    return QDir(settings.directory).filePath(QString("%1.%2").arg(id, 10, 10, QChar('0')).arg(suffix));
+}
+
+bool EventJournal::open(const Options &options)
+{
+    close();
+    settings = options;
+    settings.blockBytes = qBound(4096, settings.blockBytes, 16 << 20);
+    settings.segmentBytes = qMax(settings.segmentBytes, qint64(settings.blockBytes) * 4);
+    settings.commitIntervalMs = qMax(1, settings.commitIntervalMs);
+    settings.maxPendingBlocks = qMax(1, settings.maxPendingBlocks);
+
+    {
+        QMutexLocker lock(&mutex);
+        current = QByteArray(settings.blockBytes, Qt::Uninitialized);
+        currentUsed = 0;
+        currentRange = Range();
+        previousTimeUs = 0;
+        pending.clear();
+        appendedSequence = 0;
+        durableSequence = 0;
+        commitRequested = false;
+        stopRequested = false;
+        failed = false;
+        lastError.clear();
+        segments.clear();
+        droppedEvents = 0;
+        counters = Stats();
+    }
+
+    QDir dir(settings.directory);
+    if (settings.directory.isEmpty() || (!dir.exists() && !dir.mkpath(".")))
+        return fail(QString("Cannot create %1").arg(settings.directory));
+
+    std::vector<quint64> ids;
+    for (const QString &name : dir.entryList(QStringList() << "*.jnl", QDir::Files)) {
+        bool ok = false;
+        const quint64 id = name.left(name.size() - 4).toULongLong(&ok);
+        if (ok && id > 0)
+            ids.push_back(id);
+    }
+    std::sort(ids.begin(), ids.end());
+    for (size_t i = 0; i < ids.size(); ++i) {
+        if (!loadSegment(ids[i], i + 1 == ids.size())) {
+            closeFiles();
+            return false;
+        }
+    }
+    if (ids.empty() && !startSegment(1)) {
+        closeFiles();
+        return false;
+    }
+    dropExpiredSegments(QDateTime::currentMSecsSinceEpoch() * 1000);
+
+    opened = true;
+    start();
+    return true;
+}
+
+void EventJournal::close()
+{
+    if (!opened)
+        return;
+    {
+        QMutexLocker lock(&mutex);
+        stopRequested = true;
+        writerWake.wakeOne();
+        pendingDrained.wakeAll();
+    }
+    wait();
+    closeFiles();
+    QMutexLocker lock(&mutex);
+    opened = false;
+    durableAdvanced.wakeAll();
+}
+
+void EventJournal::closeFiles()
+{
+    if (dataFile.isOpen())
+        dataFile.close();
+    if (indexFile.isOpen())
+        indexFile.close();
+}
+
+bool EventJournal::loadSegment(quint64 id, bool newest)
+{
+    Segment segment;
+    segment.id = id;
+
+    if (!newest) {
+        QFile index(segmentPath(id, "idx"));
+        IndexHeader header;
+        if (index.open(QIODevice::ReadOnly) && index.read(reinterpret_cast<char *>(&header), sizeof(header)) == sizeof(header)
+            && memcmp(header.magic, kIndexMagic, sizeof(kIndexMagic)) == 0 && header.version == kVersion && header.sealed) {
+            segment.range.minTimeUs = header.minTimeUs;
+            segment.range.maxTimeUs = header.maxTimeUs;
+            segment.range.typeMask = header.typeMask;
+            segment.range.count = quint32(header.events);
+            segment.blocks = header.blocks;
+            segment.dataBytes = qint64(header.dataBytes);
+            segment.sealed = true;
+            QMutexLocker lock(&mutex);
+            segments.push_back(segment);
+            return true;
+        }
+        // Never sealed, so a crash came while it was the newest
+    }
+
+    if (!rebuildIndex(segment))
+        return false;
+    {
+        QMutexLocker lock(&mutex);
+        segments.push_back(segment);
+    }
+    if (newest) {
+        dataFile.setFileName(segmentPath(id, "jnl"));
+        indexFile.setFileName(segmentPath(id, "idx"));
+        if (!dataFile.open(QIODevice::ReadWrite | QIODevice::Unbuffered)
+            || !indexFile.open(QIODevice::ReadWrite | QIODevice::Unbuffered))
+            return fail(QString("Cannot open segment %1 for writing").arg(id));
+        dataFile.seek(dataFile.size());
+        indexFile.seek(indexFile.size());
+        return true;
+    }
+    return sealSegment();
+}
+
+bool EventJournal::rebuildIndex(Segment &segment)
+{
+    QFile data(segmentPath(segment.id, "jnl"));
+    if (!data.open(QIODevice::ReadWrite))
+        return fail(QString("Cannot open %1: %2").arg(data.fileName(), data.errorString()));
+
+    const qint64 size = data.size();
+    qint64 offset = qint64(sizeof(DataHeader));
+    QByteArray entries;
+    if (size < offset) {
+        // Created but never written
+        DataHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, kDataMagic, sizeof(kDataMagic));
+        header.version = kVersion;
+        if (!data.resize(0) || data.write(reinterpret_cast<const char *>(&header), sizeof(header)) != sizeof(header))
+            return fail(data.errorString());
+    } else {
+        const uchar *map = data.map(0, size);
+        if (!map)
+            return fail(QString("Cannot map %1: %2").arg(data.fileName(), data.errorString()));
+        DataHeader header;
+        memcpy(&header, map, sizeof(header));
+        if (memcmp(header.magic, kDataMagic, sizeof(kDataMagic)) != 0 || header.version != kVersion) {
+            data.unmap(const_cast<uchar *>(map));
+            return fail(QString("%1 is not a journal segment").arg(data.fileName()));
+        }
+
+        while (offset + qint64(sizeof(BlockHeader)) <= size) {
+            BlockHeader block;
+            memcpy(&block, map + offset, sizeof(block));
+            const qint64 stored = qint64(sizeof(BlockHeader)) + block.storedSize;
+            if (block.magic != kBlockMagic || stored > size - offset
+                || checksum(reinterpret_cast<const char *>(map + offset + sizeof(BlockHeader)), block.storedSize)
+                       != block.checksum)
+                break;
+
+            IndexEntry entry;
+            memset(&entry, 0, sizeof(entry));
+            entry.offset = quint64(offset);
+            entry.minTimeUs = block.minTimeUs;
+            entry.maxTimeUs = block.maxTimeUs;
+            entry.typeMask = block.typeMask;
+            entry.count = block.count;
+            entries.append(reinterpret_cast<const char *>(&entry), sizeof(entry));
+
+            Range range;
+            range.minTimeUs = block.minTimeUs;
+            range.maxTimeUs = block.maxTimeUs;
+            range.typeMask = block.typeMask;
+            range.count = block.count;
+            segment.range.add(range);
+            ++segment.blocks;
+            offset += stored;
+        }
+        data.unmap(const_cast<uchar *>(map));
+        // Whatever follows the last whole block is a torn write
+        if (offset < size && !data.resize(offset))
+            return fail(data.errorString());
+    }
+    segment.dataBytes = offset;
+
+    QFile index(segmentPath(segment.id, "idx"));
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kIndexMagic, sizeof(kIndexMagic));
+    header.version = kVersion;
+    if (!index.open(QIODevice::WriteOnly | QIODevice::Truncate)
+        || index.write(reinterpret_cast<const char *>(&header), sizeof(header)) != sizeof(header)
+        || !writeAll(index, entries))
+        return fail(QString("Cannot write %1: %2").arg(index.fileName(), index.errorString()));
+    return true;
+}
+
+bool EventJournal::startSegment(quint64 id)
+{
+    closeFiles();
+    dataFile.setFileName(segmentPath(id, "jnl"));
+    indexFile.setFileName(segmentPath(id, "idx"));
+    if (!dataFile.open(QIODevice::ReadWrite | QIODevice::Truncate | QIODevice::Unbuffered)
+        || !indexFile.open(QIODevice::ReadWrite | QIODevice::Truncate | QIODevice::Unbuffered))
+        return fail(QString("Cannot create segment %1").arg(id));
+
+    DataHeader data;
+    memset(&data, 0, sizeof(data));
+    memcpy(data.magic, kDataMagic, sizeof(kDataMagic));
+    data.version = kVersion;
+    IndexHeader index;
+    memset(&index, 0, sizeof(index));
+    memcpy(index.magic, kIndexMagic, sizeof(kIndexMagic));
+    index.version = kVersion;
+    if (dataFile.write(reinterpret_cast<const char *>(&data), sizeof(data)) != sizeof(data)
+        || indexFile.write(reinterpret_cast<const char *>(&index), sizeof(index)) != sizeof(index))
+        return fail(QString("Cannot write segment %1: %2").arg(id).arg(dataFile.errorString()));
+
+    Segment segment;
+    segment.id = id;
+    segment.dataBytes = qint64(sizeof(DataHeader));
+    QMutexLocker lock(&mutex);
+    segments.push_back(segment);
+    return true;
+}
+
+bool EventJournal::sealSegment()
+{
+    Segment segment;
+    {
+        QMutexLocker lock(&mutex);
+        segment = segments.back();
+    }
+
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kIndexMagic, sizeof(kIndexMagic));
+    header.version = kVersion;
+    header.sealed = 1;
+    header.minTimeUs = segment.range.minTimeUs;
+    header.maxTimeUs = segment.range.maxTimeUs;
+    header.typeMask = segment.range.typeMask;
+    header.events = segment.range.count;
+    header.dataBytes = quint64(segment.dataBytes);
+    header.blocks = segment.blocks;
+
+    // The blocks and their index go to disk before the header that says
+    // they are complete
+    QFile index(segmentPath(segment.id, "idx"));
+    if (!index.open(QIODevice::ReadWrite | QIODevice::Unbuffered))
+        return fail(QString("Cannot seal %1: %2").arg(index.fileName(), index.errorString()));
+    if (dataFile.isOpen())
+        syncFile(dataFile);
+    syncFile(index);
+    if (index.write(reinterpret_cast<const char *>(&header), sizeof(header)) != sizeof(header) || !syncFile(index))
+        return fail(QString("Cannot seal %1: %2").arg(index.fileName(), index.errorString()));
+
+    QMutexLocker lock(&mutex);
+    segments.back().sealed = true;
+    return true;
+}
+
+void EventJournal::dropExpiredSegments(qint64 nowUs)
+{
+    if (settings.retentionSeconds <= 0)
+        return;
+    const qint64 cutoffUs = nowUs - settings.retentionSeconds * 1000000;
+    std::vector<quint64> expired;
+    {
+        QMutexLocker lock(&mutex);
+        for (auto it = segments.begin(); it != segments.end();) {
+            if (it->sealed && it->range.maxTimeUs < cutoffUs) {
+                expired.push_back(it->id);
+                droppedEvents += it->range.count;
+                it = segments.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    // Along with anything kept next to it, like search signatures. A query
+    // still holding one mapped keeps reading it until it unmaps.
+    const QDir dir(settings.directory);
+    for (quint64 id : expired) {
+        const QString pattern = QString("%1.*").arg(id, 10, 10, QChar('0'));
+        for (const QString &name : dir.entryList(QStringList() << pattern, QDir::Files))
+            QFile::remove(dir.filePath(name));
+    }
+}
+
+quint64 EventJournal::append(quint8 type, qint64 timeUs, const char *data, int size)
+{
+    size = qMax(size, 0);
+    const int needed = kMaxRecordOverhead + size;
+    QMutexLocker lock(&mutex);
+    while (opened && !failed && !stopRequested && currentUsed + needed > current.size()) {
+        if (currentUsed == 0) {
+            // A record larger than a block gets a block of its own
+            current.resize(needed);
+            break;
+        }
+        if (int(pending.size()) >= settings.maxPendingBlocks) {
+            ++counters.appendWaits;
+            pendingDrained.wait(&mutex);
+            continue;
+        }
+        sealCurrentBlock();
+    }
+    if (!opened || failed || stopRequested)
+        return 0;
+
+    if (currentUsed == 0)
+        writerWake.wakeOne();
+    char *start = current.data() + currentUsed;
+    char *out = writeVarint(start, zigzag(timeUs - previousTimeUs));
+    *out++ = char(type);
+    out = writeVarint(out, quint64(size));
+    memcpy(out, data, size_t(size));
+    currentUsed += int(out - start) + size;
+    previousTimeUs = timeUs;
+    currentRange.add(timeUs, type);
+    ++counters.events;
+    return ++appendedSequence;
+}
+
+void EventJournal::sealCurrentBlock()
+{
+    PendingBlock block;
+    block.records.swap(current);
+    block.records.resize(currentUsed);
+    block.range = currentRange;
+    pending.push_back(std::move(block));
+
+    current = QByteArray(settings.blockBytes, Qt::Uninitialized);
+    currentUsed = 0;
+    currentRange = Range();
+    previousTimeUs = 0;
+    writerWake.wakeOne();
+}
+
+bool EventJournal::waitForDurable(quint64 sequence, int timeoutMs)
+{
+    QDeadlineTimer deadline(timeoutMs);
+    QMutexLocker lock(&mutex);
+    while (durableSequence < sequence && !failed && opened) {
+        commitRequested = true;
+        writerWake.wakeOne();
+        if (!durableAdvanced.wait(&mutex, deadline))
+            break;
+    }
+    return durableSequence >= sequence;
+}
+
+void EventJournal::run()
+{
+    QElapsedTimer clock;
+    clock.start();
+    qint64 nextCommitMs = 0;
+    bool unsynced = false;
+    std::vector<PendingBlock> blocks;
+
+    for (;;) {
+        bool commit = false;
+        bool stopping = false;
+        quint64 writtenThrough = 0;
+        {
+            QMutexLocker lock(&mutex);
+            // Idle with nothing to sync, sleep until an append; otherwise
+            // until the next commit is due
+            while (pending.empty() && !commitRequested && !stopRequested) {
+                if (currentUsed == 0 && !unsynced) {
+                    writerWake.wait(&mutex);
+                    nextCommitMs = qMax(nextCommitMs, clock.elapsed() + settings.commitIntervalMs);
+                    continue;
+                }
+                const qint64 remaining = nextCommitMs - clock.elapsed();
+                if (remaining <= 0)
+                    break;
+                writerWake.wait(&mutex, QDeadlineTimer(remaining));
+            }
+            stopping = stopRequested;
+            commit = commitRequested || stopping || clock.elapsed() >= nextCommitMs;
+            if (commit) {
+                if (currentUsed > 0)
+                    sealCurrentBlock();
+                commitRequested = false;
+                writtenThrough = appendedSequence;
+            }
+            // They stay in pending, where queries see them, until writeBlocks()
+            // publishes them in the segment
+            blocks.assign(pending.begin(), pending.end());
+        }
+
+        if (!blocks.empty()) {
+            if (!writeBlocks(blocks))
+                return;
+            unsynced = true;
+            blocks.clear();
+        }
+        if (commit) {
+            if (unsynced && !syncFile(dataFile)) {
+                fail(QString("Cannot sync %1: %2").arg(dataFile.fileName(), dataFile.errorString()));
+                return;
+            }
+            QMutexLocker lock(&mutex);
+            if (unsynced)
+                ++counters.syncs;
+            unsynced = false;
+            durableSequence = qMax(durableSequence, writtenThrough);
+            durableAdvanced.wakeAll();
+            nextCommitMs = clock.elapsed() + settings.commitIntervalMs;
+        }
+        if (stopping)
+            return;
+    }
+}
+
+bool EventJournal::writeBlocks(std::vector<PendingBlock> &blocks)
+{
+    Segment segment;
+    {
+        QMutexLocker lock(&mutex);
+        segment = segments.back();
+    }
+
+    QByteArray data;
+    QByteArray entries;
+    quint64 rawBytes = 0;
+    auto flush = [&]() {
+        if (data.isEmpty())
+            return true;
+        if (!writeAll(dataFile, data) || !writeAll(indexFile, entries))
+            return fail(QString("Cannot write %1: %2").arg(dataFile.fileName(), dataFile.errorString()));
+        const size_t written = size_t(entries.size()) / sizeof(IndexEntry);
+        QMutexLocker lock(&mutex);
+        segments.back() = segment;
+        pending.erase(pending.begin(), pending.begin() + qint64(written));
+        pendingDrained.wakeAll();
+        counters.blocks += written;
+        counters.rawBytes += rawBytes;
+        counters.storedBytes += quint64(data.size());
+        data.clear();
+        entries.clear();
+        rawBytes = 0;
+        return true;
+    };
+
+    for (PendingBlock &block : blocks) {
+        if (segment.dataBytes >= settings.segmentBytes && segment.blocks > 0) {
+            if (!flush() || !sealSegment() || !startSegment(segment.id + 1))
+                return false;
+            dropExpiredSegments(QDateTime::currentMSecsSinceEpoch() * 1000);
+            QMutexLocker lock(&mutex);
+            segment = segments.back();
+        }
+
+        QByteArray stored = block.records;
+        quint32 flags = 0;
+        if (settings.compress) {
+            QByteArray packed = qCompress(reinterpret_cast<const uchar *>(block.records.constData()),
+                                          int(block.records.size()), 1);
+            if (packed.size() < block.records.size()) {
+                stored = packed;
+                flags |= kCompressedBlock;
+            }
+        }
+
+        BlockHeader header;
+        header.magic = kBlockMagic;
+        header.checksum = checksum(stored.constData(), size_t(stored.size()));
+        header.minTimeUs = block.range.minTimeUs;
+        header.maxTimeUs = block.range.maxTimeUs;
+        header.typeMask = block.range.typeMask;
+        header.storedSize = quint32(stored.size());
+        header.rawSize = quint32(block.records.size());
+        header.count = block.range.count;
+        header.flags = flags;
+
+        IndexEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.offset = quint64(segment.dataBytes);
+        entry.minTimeUs = block.range.minTimeUs;
+        entry.maxTimeUs = block.range.maxTimeUs;
+        entry.typeMask = block.range.typeMask;
+        entry.count = block.range.count;
+
+        data.append(reinterpret_cast<const char *>(&header), sizeof(header));
+        data.append(stored);
+        entries.append(reinterpret_cast<const char *>(&entry), sizeof(entry));
+        rawBytes += quint64(block.records.size());
+        segment.range.add(block.range);
+        ++segment.blocks;
+        segment.dataBytes += qint64(sizeof(header)) + stored.size();
+    }
+    return flush();
+}
+
+int EventJournal::decodeBlock(const uchar *records, int size, int skip, qint64 fromUs, qint64 toUs, quint64 typeMask,
+                              QVector<Event> *events, int limit)
+{
+    const uchar *in = records;
+    const uchar *end = records + size;
+    qint64 timeUs = 0;
+    int added = 0;
+    while (in < end && added != limit) {
+        quint64 delta = 0;
+        quint64 length = 0;
+        in = readVarint(in, end, &delta);
+        if (!in || in == end)
+            break;
+        const quint8 type = *in++;
+        in = readVarint(in, end, &length);
+        if (!in || length > quint64(end - in))
+            break;
+        timeUs += unzigzag(delta);
+        if (skip > 0) {
+            --skip;
+        } else if (timeUs >= fromUs && timeUs <= toUs && (typeBit(type) & typeMask)) {
+            Event event;
+            event.timeUs = timeUs;
+            event.type = type;
+            event.payload = QByteArray(reinterpret_cast<const char *>(in), int(length));
+            events->append(event);
+            ++added;
+        }
+        in += length;
+    }
+    return added;
+}
+
+void EventJournal::visitBlocks(const Segment &segment, const std::function<bool(const Range &)> &wanted,
+                               const std::function<bool(const Range &, const uchar *, int)> &visit,
+                               QueryStats &counts) const
+{
+    QFile index(segmentPath(segment.id, "idx"));
+    if (!index.open(QIODevice::ReadOnly))
+        return;
+    const qint64 indexBytes = qint64(sizeof(IndexHeader)) + qint64(segment.blocks) * qint64(sizeof(IndexEntry));
+    const uchar *indexMap = index.map(0, indexBytes);
+    if (!indexMap)
+        return;
+    const IndexEntry *entries = reinterpret_cast<const IndexEntry *>(indexMap + sizeof(IndexHeader));
+
+    std::vector<quint32> picked;
+    for (quint32 i = 0; i < segment.blocks; ++i) {
+        Range range;
+        range.minTimeUs = entries[i].minTimeUs;
+        range.maxTimeUs = entries[i].maxTimeUs;
+        range.typeMask = entries[i].typeMask;
+        range.count = entries[i].count;
+        if (wanted(range))
+            picked.push_back(i);
+    }
+    counts.blocksIndexed += segment.blocks;
+    if (picked.empty()) {
+        index.unmap(const_cast<uchar *>(indexMap));
+        return;
+    }
+
+    // Only the stretch from the first picked block to the end of the last
+    // is mapped
+    const qint64 begin = qint64(entries[picked.front()].offset);
+    const qint64 end = picked.back() + 1 < segment.blocks ? qint64(entries[picked.back() + 1].offset) : segment.dataBytes;
+    QFile data(segmentPath(segment.id, "jnl"));
+    const uchar *dataMap = data.open(QIODevice::ReadOnly) ? data.map(begin, end - begin) : nullptr;
+    if (dataMap) {
+        ++counts.segmentsMapped;
+        for (quint32 i : picked) {
+            const uchar *block = dataMap + (qint64(entries[i].offset) - begin);
+            BlockHeader header;
+            memcpy(&header, block, sizeof(header));
+            if (header.magic != kBlockMagic)
+                break;
+            Range range;
+            range.minTimeUs = header.minTimeUs;
+            range.maxTimeUs = header.maxTimeUs;
+            range.typeMask = header.typeMask;
+            range.count = header.count;
+            const uchar *stored = block + sizeof(BlockHeader);
+            ++counts.blocksDecoded;
+            counts.bytesDecoded += header.rawSize;
+            bool more;
+            if (header.flags & kCompressedBlock) {
+                const QByteArray raw = qUncompress(stored, int(header.storedSize));
+                more = visit(range, reinterpret_cast<const uchar *>(raw.constData()), int(raw.size()));
+            } else {
+                more = visit(range, stored, int(header.storedSize));
+            }
+            if (!more)
+                break;
+        }
+        data.unmap(const_cast<uchar *>(dataMap));
+    }
+    index.unmap(const_cast<uchar *>(indexMap));
+}
+
+int EventJournal::query(qint64 fromUs, qint64 toUs, quint64 typeMask, QVector<Event> *events, int limit,
+                        QueryStats *queryStats) const
+{
+    if (!typeMask)
+        typeMask = ~quint64(0);
+    QueryStats local;
+    QueryStats &counts = queryStats ? *queryStats : local;
+
+    // What to read, taken under the lock; the files are read without it
+    std::vector<Segment> matching;
+    std::vector<PendingBlock> unwritten;
+    {
+        QMutexLocker lock(&mutex);
+        for (const Segment &segment : segments) {
+            if (segment.range.matches(fromUs, toUs, typeMask))
+                matching.push_back(segment);
+        }
+        for (const PendingBlock &block : pending) {
+            if (block.range.matches(fromUs, toUs, typeMask))
+                unwritten.push_back(block);
+        }
+        if (currentRange.matches(fromUs, toUs, typeMask)) {
+            PendingBlock block;
+            block.records = current.left(currentUsed);
+            block.range = currentRange;
+            unwritten.push_back(block);
+        }
+    }
+
+    int added = 0;
+    auto decode = [&](const Range &, const uchar *records, int size) {
+        added += decodeBlock(records, size, 0, fromUs, toUs, typeMask, events, limit < 0 ? -1 : limit - added);
+        return added != limit;
+    };
+    for (const Segment &segment : matching) {
+        if (added == limit)
+            break;
+        visitBlocks(segment, [&](const Range &range) { return range.matches(fromUs, toUs, typeMask); }, decode, counts);
+    }
+    for (const PendingBlock &block : unwritten) {
+        if (added == limit)
+            break;
+        ++counts.blocksDecoded;
+        counts.bytesDecoded += quint64(block.records.size());
+        decode(block.range, reinterpret_cast<const uchar *>(block.records.constData()), int(block.records.size()));
+    }
+    return added;
+}
+
+int EventJournal::read(quint64 position, int count, QVector<Event> *events) const
+{
+    if (count <= 0)
+        return 0;
+
+    // The segments and blocks holding [position, position + count), each
+    // with the position of its first event
+    std::vector<std::pair<Segment, quint64>> holding;
+    std::vector<std::pair<PendingBlock, quint64>> unwritten;
+    {
+        QMutexLocker lock(&mutex);
+        if (position < droppedEvents)
+            return 0;
+        const quint64 last = position + quint64(count);
+        quint64 start = droppedEvents;
+        for (const Segment &segment : segments) {
+            if (start < last && start + segment.range.count > position)
+                holding.emplace_back(segment, start);
+            start += segment.range.count;
+        }
+        for (const PendingBlock &block : pending) {
+            if (start < last && start + block.range.count > position)
+                unwritten.emplace_back(block, start);
+            start += block.range.count;
+        }
+        if (start < last && start + currentRange.count > position) {
+            PendingBlock block;
+            block.records = current.left(currentUsed);
+            block.range = currentRange;
+            unwritten.emplace_back(block, start);
+        }
+    }
+
+    const qint64 kAnyTime = std::numeric_limits<qint64>::max();
+    QueryStats counts;
+    int added = 0;
+    quint64 blockStart = 0;
+    bool gap = false;
+    auto decode = [&](const Range &range, const uchar *records, int size) {
+        // A segment dropped since the snapshot, or a block that would not
+        // decode, leaves events out; what follows would be misnumbered
+        if (position + quint64(added) < blockStart) {
+            gap = true;
+            return false;
+        }
+        const int skip = int(position + quint64(added) - blockStart);
+        added += decodeBlock(records, size, skip, -kAnyTime, kAnyTime, ~quint64(0), events, count - added);
+        blockStart += range.count;
+        return added < count;
+    };
+    for (const auto &segment : holding) {
+        if (added == count || gap)
+            break;
+        blockStart = segment.second;
+        quint64 next = segment.second;
+        visitBlocks(segment.first, [&](const Range &range) {
+            const quint64 first = next;
+            next += range.count;
+            if (next <= position)
+                blockStart = next;   // Skipped whole, so the first picked block starts after it
+            return next > position && first < position + quint64(count);
+        }, decode, counts);
+    }
+    for (const auto &block : unwritten) {
+        if (added == count || gap)
+            break;
+        blockStart = block.second;
+        decode(block.first.range, reinterpret_cast<const uchar *>(block.first.records.constData()),
+               int(block.first.records.size()));
+    }
+    return added;
+}
+
+EventJournal::Span EventJournal::span() const
+{
+    QMutexLocker lock(&mutex);
+    Span result;
+    result.first = droppedEvents;
+    result.end = droppedEvents;
+    for (const Segment &segment : segments)
+        result.end += segment.range.count;
+    for (const PendingBlock &block : pending)
+        result.end += block.range.count;
+    result.end += currentRange.count;
+    return result;
+}
+
+QVector<EventJournal::SegmentInfo> EventJournal::segmentInfo() const
+{
+    QMutexLocker lock(&mutex);
+    QVector<SegmentInfo> result;
+    quint64 start = droppedEvents;
+    for (const Segment &segment : segments) {
+        SegmentInfo info;
+        info.id = segment.id;
+        info.firstPosition = start;
+        info.events = segment.range.count;
+        info.sealed = segment.sealed;
+        result.append(info);
+        start += segment.range.count;
+    }
+    return result;
+}
+
+EventJournal::Stats EventJournal::stats() const
+{
+    QMutexLocker lock(&mutex);
+    Stats result = counters;
+    result.durableEvents = durableSequence;
+    result.segments = int(segments.size());
+    for (const Segment &segment : segments)
+        result.diskBytes += quint64(segment.dataBytes) + sizeof(IndexHeader) + quint64(segment.blocks) * sizeof(IndexEntry);
+    return result;
+}
@@ -0,0 +1,244 @@
+#ifndef EVENTJOURNAL_H
+#define EVENTJOURNAL_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+#include <deque>
+#include <functional>
+#include <vector>
+
+// Durable, append-only history of what the engines did: scan results,
+// blocked connections, VPN state changes and alerts.
+//
+// Events are varint-encoded into blocks (timestamp delta, type, payload
+// length, payload) and blocks into segment files, each with a sidecar
+// index of one entry per block: where it starts, its time range and a
+// bitmask of the event types in it. A query reads only the index entries
+// of segments whose range and types match, and maps only the stretch of
+// the segment those blocks cover, so the last hour of one type costs the
+// same whether the journal holds a day or a month.
+//
+// Under the store directory:
+//   <id>.jnl   header, then blocks: BlockHeader followed by the records,
+//              qCompress'd if that was on and it saved space
+//   <id>.idx   header with the segment's totals, then IndexEntry[]
+//
+// append() only encodes into the block being filled; full blocks are
+// written, and the journal synced, on the journal's own thread. Syncs are
+// group commits: one fdatasync every commitIntervalMs covers every event
+// appended since the last, and waitForDurable() asks for one right away.
+// The index is rebuilt from the segment on open if a crash left it behind,
+// and a torn last block is cut off.
+//
+// Payloads are opaque here; the engines write a line of UTF-8 text, which
+// is what the Status tab's log shows and searches.
+class EventJournal : public QThread
+{
+    Q_OBJECT
+
+public:
+    // Event types are bit positions in query masks, so at most 64
+    enum Type : quint8 {
+        ScanResult = 0,
+        BlockedConnection,
+        VpnStateChange,
+        SecurityAlert,
+        TypeCount
+    };
+
+    static quint64 typeBit(quint8 type) { return quint64(1) << (type & 63); }
+    // Stable lower-case names, for the log and machine-readable output
+    static const char *typeName(quint8 type);
+
+    struct Options
+    {
+        QString directory;
+        int blockBytes = 64 << 10;           // Of records, before compression
+        qint64 segmentBytes = 64ll << 20;
+        int commitIntervalMs = 100;
+        bool compress = false;               // qCompress each block, at level 1
+        qint64 retentionSeconds = 0;         // Segments wholly older are deleted; 0 keeps all
+        int maxPendingBlocks = 64;           // Appenders wait beyond this
+    };
+
+    struct Event
+    {
+        qint64 timeUs = 0;                   // Microseconds since the epoch
+        quint8 type = 0;
+        QByteArray payload;
+    };
+
+    struct QueryStats
+    {
+        int segmentsMapped = 0;
+        quint64 blocksIndexed = 0;           // Index entries looked at
+        quint64 blocksDecoded = 0;
+        quint64 bytesDecoded = 0;
+    };
+
+    // Positions number the events kept, in the order they were appended,
+    // from 0 for the oldest at open(). Retention moves `first` up; the
+    // rest keep their positions until the journal is reopened.
+    struct Span
+    {
+        quint64 first = 0;
+        quint64 end = 0;                     // One past the newest
+    };
+
+    struct SegmentInfo
+    {
+        quint64 id = 0;
+        quint64 firstPosition = 0;
+        quint32 events = 0;                  // Written so far, if not sealed
+        bool sealed = false;
+    };
+
+    struct Stats
+    {
+        quint64 events = 0;                  // Appended since open()
+        quint64 durableEvents = 0;
+        quint64 blocks = 0;                  // Written since open()
+        quint64 rawBytes = 0;
+        quint64 storedBytes = 0;
+        quint64 syncs = 0;
+        quint64 appendWaits = 0;             // Appends that waited for the writer
+        int segments = 0;
+        quint64 diskBytes = 0;               // Every segment on disk
+    };
+
+    explicit EventJournal(QObject *parent = nullptr);
+    ~EventJournal();
+
+    // Opens or creates the journal in options.directory, recovering the
+    // newest segment, and starts writing. False with errorString() set
+    // when the directory cannot be used.
+    bool open(const Options &options);
+    // Writes and syncs everything appended, then stops
+    void close();
+    bool isOpen() const { return opened; }
+    QString errorString() const;
+
+    // Any thread. Returns the event's sequence number for waitForDurable()
+    quint64 append(quint8 type, qint64 timeUs, const char *data, int size);
+    quint64 append(quint8 type, qint64 timeUs, const QByteArray &payload)
+    {
+        return append(type, timeUs, payload.constData(), payload.size());
+    }
+
+    // Blocks until every event up to `sequence` is synced, asking for a
+    // commit now rather than at the next interval. False on timeout or if
+    // the journal failed.
+    bool waitForDurable(quint64 sequence, int timeoutMs = -1);
+
+    // Any thread. Appends the events with fromUs <= time <= toUs whose
+    // type is in `typeMask` (0 for every type) to `events`, in the order
+    // they were appended, at most `limit` of them (-1 for all). Events
+    // not yet written are included. Returns how many were added.
+    int query(qint64 fromUs, qint64 toUs, quint64 typeMask, QVector<Event> *events, int limit = -1,
+              QueryStats *queryStats = nullptr) const;
+
+    // Any thread. Appends up to `count` events from `position` on to
+    // `events`, fewer at the end of the journal, none if `position` is
+    // below span().first. Returns how many were added.
+    int read(quint64 position, int count, QVector<Event> *events) const;
+    Span span() const;
+    // Written segments, oldest first; events still to be written follow
+    // the last one
+    QVector<SegmentInfo> segmentInfo() const;
+    // Files kept next to a segment under a name from here are deleted
+    // along with it
+    QString segmentPath(quint64 id, const char *suffix) const;
+
+    Stats stats() const;
+
+signals:
+    void error(const QString &message);
+
+protected:
+    void run() override;
+
+private:
+    struct Range
+    {
+        qint64 minTimeUs = 0;
+        qint64 maxTimeUs = 0;
+        quint64 typeMask = 0;
+        quint32 count = 0;
+
+        void add(qint64 timeUs, quint8 type);
+        void add(const Range &other);
+        bool matches(qint64 fromUs, qint64 toUs, quint64 types) const
+        {
+            return count && minTimeUs <= toUs && maxTimeUs >= fromUs && (typeMask & types);
+        }
+    };
+
+    // Records of one block, encoded but not yet in the segment's index
+    struct PendingBlock
+    {
+        QByteArray records;
+        Range range;
+    };
+
+    struct Segment
+    {
+        quint64 id = 0;
+        Range range;
+        quint32 blocks = 0;
+        qint64 dataBytes = 0;                // Of the .jnl, header included
+        bool sealed = false;
+    };
+
+    bool loadSegment(quint64 id, bool newest);
+    bool rebuildIndex(Segment &segment);
+    bool startSegment(quint64 id);
+    bool sealSegment();
+    bool writeBlocks(std::vector<PendingBlock> &blocks);
+    void dropExpiredSegments(qint64 nowUs);
+    void sealCurrentBlock();
+    void closeFiles();
+    bool fail(const QString &message);
+    // Calls `wanted` for every block of `segment` in order, then `visit`
+    // with the records of those it picked until it returns false
+    void visitBlocks(const Segment &segment, const std::function<bool(const Range &)> &wanted,
+                     const std::function<bool(const Range &, const uchar *, int)> &visit, QueryStats &counts) const;
+    // Skips `skip` records, then appends those matching, at most `limit`
+    static int decodeBlock(const uchar *records, int size, int skip, qint64 fromUs, qint64 toUs, quint64 typeMask,
+                           QVector<Event> *events, int limit);
+
+    Options settings;
+    bool opened = false;
+
+    // Guards everything below; the appenders, the writer and queries all
+    // take it, the writer only to hand blocks over and publish progress
+    mutable QMutex mutex;
+    QWaitCondition writerWake;               // Blocks sealed, a commit asked for, or stopping
+    QWaitCondition pendingDrained;           // Appenders waiting at maxPendingBlocks
+    QWaitCondition durableAdvanced;
+
+    QByteArray current;                      // Block being filled, sized blockBytes
+    int currentUsed = 0;
+    Range currentRange;
+    qint64 previousTimeUs = 0;
+    std::deque<PendingBlock> pending;
+    quint64 appendedSequence = 0;
+    quint64 durableSequence = 0;
+    bool commitRequested = false;
+    bool stopRequested = false;
+    bool failed = false;
+    QString lastError;
+    std::vector<Segment> segments;           // Oldest first; the last is written to
+    quint64 droppedEvents = 0;               // By retention since open()
+    Stats counters;
+
+    // The writer's own, between open() and close()
+    QFile dataFile;
+    QFile indexFile;
+};
+
+#endif // EVENTJOURNAL_H
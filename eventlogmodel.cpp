@@ -0,0 +1,152 @@
+#include "eventlogmodel.h"
+#include <QColor>
+#include <QDateTime>
+#include <limits>
+
+EventLogModel::EventLogModel(EventJournal *journal, QObject *parent)
+    : QAbstractTableModel(parent), journal(journal), pages(kCachedPages)
+{
+    span = journal->span();
+}
+
+int EventLogModel::logRows() const
+{
+    return int(qMin<quint64>(span.end - span.first, quint64(std::numeric_limits<int>::max())));
+}
+
+int EventLogModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+    return hitsShown ? hits.size() : logRows();
+}
+
+int EventLogModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : ColumnCount;
+}
+
+const EventJournal::Event *EventLogModel::eventAt(int row) const
+{
+    if (hitsShown)
+        return &hits.at(row).event;
+
+    const quint64 position = span.first + quint64(row);
+    const quint64 number = position / kPageRows;
+    Page *page = pages.object(number);
+    // The newest page is read again once rows were added to it
+    if (!page || position - page->first >= quint64(page->events.size())) {
+        page = new Page;
+        page->first = qMax(number * kPageRows, span.first);
+        journal->read(page->first, int((number + 1) * kPageRows - page->first), &page->events);
+        pages.insert(number, page);
+        if (position < page->first || position - page->first >= quint64(page->events.size()))
+            return nullptr;
+    }
+    return &page->events.at(int(position - page->first));
+}
+
+QVariant EventLogModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= rowCount())
+        return QVariant();
+    if (role != Qt::DisplayRole && role != Qt::ToolTipRole && role != Qt::ForegroundRole)
+        return QVariant();
+
+    const EventJournal::Event *event = eventAt(index.row());
+    if (!event)
+        return QVariant();
+    if (role == Qt::ForegroundRole) {
+        switch (event->type) {
+        case EventJournal::SecurityAlert: return QColor("#c62828");
+        case EventJournal::BlockedConnection: return QColor("#ef6c00");
+        default: return QVariant();
+        }
+    }
+    if (role == Qt::ToolTipRole)
+        return index.column() == MessageColumn ? QString::fromUtf8(event->payload) : QVariant();
+
+    switch (index.column()) {
+    case TimeColumn:
+        return QDateTime::fromMSecsSinceEpoch(event->timeUs / 1000).toString("yyyy-MM-dd hh:mm:ss.zzz");
+    case TypeColumn:
+        return QString::fromLatin1(EventJournal::typeName(event->type));
+    case MessageColumn:
+        return QString::fromUtf8(event->payload);
+    default:
+        return QVariant();
+    }
+}
+
+QVariant EventLogModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation != Qt::Horizontal || role != Qt::DisplayRole)
+        return QVariant();
+
+    switch (section) {
+    case TimeColumn: return tr("Time");
+    case TypeColumn: return tr("Type");
+    case MessageColumn: return tr("Event");
+    default: return QVariant();
+    }
+}
+
+void EventLogModel::refresh()
+{
+    const EventJournal::Span now = journal->span();
+    if (hitsShown) {
+        span = now;
+        return;
+    }
+    // Reopened: positions start over
+    if (now.first < span.first || now.first > span.end || now.end < span.end) {
+        beginResetModel();
+        span = now;
+        pages.clear();
+        endResetModel();
+        return;
+    }
+
+    if (now.first > span.first) {
+        beginRemoveRows(QModelIndex(), 0, int(qMin<quint64>(now.first - span.first, quint64(logRows()))) - 1);
+        span.first = now.first;
+        endRemoveRows();
+    }
+
+    const int before = logRows();
+    const int after = int(qMin<quint64>(now.end - span.first, quint64(std::numeric_limits<int>::max())));
+    if (after > before) {
+        beginInsertRows(QModelIndex(), before, after - 1);
+        span.end = now.end;
+        endInsertRows();
+    }
+    span.end = now.end;
+}
+
+void EventLogModel::showLog()
+{
+    beginResetModel();
+    hitsShown = false;
+    hits = QVector<EventSearchHit>();
+    span = journal->span();
+    endResetModel();
+}
+
+void EventLogModel::showHits()
+{
+    beginResetModel();
+    hitsShown = true;
+    hits.clear();
+    endResetModel();
+}
+
+void EventLogModel::addHits(const QVector<EventSearchHit> &found)
+{
+    const int count = qMin(found.size(), kMaxHits - hits.size());
+    if (!hitsShown || count <= 0)
+        return;
+    beginInsertRows(QModelIndex(), hits.size(), hits.size() + count - 1);
+    for (int i = 0; i < count; ++i)
+        hits.append(found.at(i));
+    endInsertRows();
+}
@@ -0,0 +1,69 @@
+#ifndef EVENTLOGMODEL_H
+#define EVENTLOGMODEL_H
+
+#include <QAbstractTableModel>
+#include <QCache>
+#include <QVector>
+#include "eventjournal.h"
+#include "eventsearch.h"
+
+// The event journal as a table, oldest first, or the hits of a search,
+// newest first, as they stream in. Rows are read from the journal a page
+// of kPageRows at a time when the view asks for them, and only the
+// kCachedPages used last are kept, so memory follows what is on screen
+// rather than how long the log is. Hits carry their events and are capped
+// at kMaxHits.
+class EventLogModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+    static const int kPageRows = 256;
+    static const int kCachedPages = 16;
+    static const int kMaxHits = 10000;
+
+    enum Column {
+        TimeColumn = 0,
+        TypeColumn,
+        MessageColumn,
+        ColumnCount
+    };
+
+    explicit EventLogModel(EventJournal *journal, QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+    // Adds the rows of events appended since the last call and removes
+    // those retention dropped. Only the log changes; hits stay as found.
+    void refresh();
+
+    void showLog();
+    // Clears the hits; addHits() brings in those of the new search
+    void showHits();
+    void addHits(const QVector<EventSearchHit> &found);
+    bool showingHits() const { return hitsShown; }
+
+    quint64 events() const { return span.end - span.first; }
+    int cachedPages() const { return pages.size(); }
+
+private:
+    struct Page
+    {
+        quint64 first = 0;                   // Position of events[0]
+        QVector<EventJournal::Event> events;
+    };
+
+    int logRows() const;
+    const EventJournal::Event *eventAt(int row) const;
+
+    EventJournal *journal;
+    EventJournal::Span span;                 // Of the rows in the log
+    bool hitsShown = false;
+    QVector<EventSearchHit> hits;
+    mutable QCache<quint64, Page> pages;     // Page number, position / kPageRows
+};
+
+#endif // EVENTLOGMODEL_H
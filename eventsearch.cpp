@@ -0,0 +1,320 @@
+#include "eventsearch.h"
+#include <QDeadlineTimer>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutexLocker>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+const char kSignatureMagic[8] = { 'R', 'H', 'N', 'G', 'M', '0', '0', '1' };
+const quint32 kVersion = 1;
+const int kSignatureBytes = EventSearch::kSignatureBits / 8;
+// Pages indexed between looks for a new search
+const int kIndexBudget = 16;
+const int kIndexIntervalMs = 1000;
+// Hits wait at most this long, or for this many more, before going out
+const int kHitBatch = 256;
+const qint64 kHitIntervalMs = 50;
+
+struct SignatureHeader
+{
+    char magic[8];
+    quint32 version;
+    quint16 pageEvents;
+    quint16 signatureBits;
+};
+
+static_assert(sizeof(SignatureHeader) == 16, "signature headers are read straight from disk");
+
+uchar fold(uchar c)
+{
+    return c >= 'A' && c <= 'Z' ? uchar(c + ('a' - 'A')) : c;
+}
+
+quint32 trigramBit(uchar a, uchar b, uchar c)
+{
+    const quint32 trigram = quint32(fold(a)) << 16 | quint32(fold(b)) << 8 | fold(c);
+    return (trigram * 0x9e3779b1u) >> (32 - 15);
+}
+
+static_assert(EventSearch::kSignatureBits == 1 << 15, "trigramBit() hashes to 15 bits");
+
+void addTrigrams(const QByteArray &text, uchar *signature)
+{
+    const uchar *p = reinterpret_cast<const uchar *>(text.constData());
+    for (int i = 0; i + 2 < text.size(); ++i) {
+        const quint32 bit = trigramBit(p[i], p[i + 1], p[i + 2]);
+        signature[bit >> 3] |= uchar(1u << (bit & 7));
+    }
+}
+
+// `needle` is already folded
+bool containsFolded(const QByteArray &haystack, const QByteArray &needle)
+{
+    const int last = haystack.size() - needle.size();
+    const uchar *h = reinterpret_cast<const uchar *>(haystack.constData());
+    const uchar *n = reinterpret_cast<const uchar *>(needle.constData());
+    for (int i = 0; i <= last; ++i) {
+        int j = 0;
+        while (j < needle.size() && fold(h[i + j]) == n[j])
+            ++j;
+        if (j == needle.size())
+            return true;
+    }
+    return false;
+}
+
+quint32 pagesOf(const EventJournal::SegmentInfo &segment)
+{
+    // The last page of the segment being written is still filling up
+    const quint32 pageEvents = quint32(EventSearch::kPageEvents);
+    return segment.sealed ? (segment.events + pageEvents - 1) / pageEvents : segment.events / pageEvents;
+}
+
+} // namespace
+
+EventSearch::EventSearch(EventJournal *journal, QObject *parent)
+    : QThread(parent), journal(journal)
+{
+    qRegisterMetaType<EventSearchHit>();
+    qRegisterMetaType<QVector<EventSearchHit>>();
+}
+
+EventSearch::~EventSearch()
+{
+    requestStop();
+    wait();
+}
+
+quint64 EventSearch::search(const QString &text, int maxHits)
+{
+    QMutexLocker lock(&mutex);
+    requestedText = text.toUtf8();
+    for (char &c : requestedText)
+        c = char(fold(uchar(c)));
+    requestedMaxHits = qMax(1, maxHits);
+    const quint64 id = latestId.fetch_add(1) + 1;
+    wake.wakeOne();
+    return id;
+}
+
+void EventSearch::cancel()
+{
+    QMutexLocker lock(&mutex);
+    // Nothing will run under the new id; run() takes it as already started
+    startedId.store(latestId.fetch_add(1) + 1);
+}
+
+void EventSearch::requestStop()
+{
+    QMutexLocker lock(&mutex);
+    stopRequested.store(true);
+    wake.wakeOne();
+}
+
+bool EventSearch::searchWaiting() const
+{
+    return latestId.load(std::memory_order_relaxed) != startedId.load(std::memory_order_relaxed);
+}
+
+bool EventSearch::cancelled(quint64 id) const
+{
+    return stopRequested.load(std::memory_order_relaxed) || latestId.load(std::memory_order_relaxed) != id;
+}
+
+void EventSearch::run()
+{
+    bool behind = true;
+    for (;;) {
+        quint64 id = 0;
+        QByteArray text;
+        int maxHits = 0;
+        {
+            QMutexLocker lock(&mutex);
+            if (!behind && !stopRequested.load() && latestId.load() == startedId.load())
+                wake.wait(&mutex, QDeadlineTimer(kIndexIntervalMs));
+            if (stopRequested.load())
+                return;
+            if (latestId.load() != startedId.load()) {
+                id = latestId.load();
+                startedId.store(id);
+                text = requestedText;
+                maxHits = requestedMaxHits;
+            }
+        }
+        if (id)
+            runSearch(id, text, maxHits);
+        else
+            behind = indexPages(kIndexBudget);
+    }
+}
+
+// True if pages are left to index
+bool EventSearch::indexPages(int budget)
+{
+    const QVector<EventJournal::SegmentInfo> segments = journal->segmentInfo();
+    quint64 events = 0;
+    bool behind = false;
+    QHash<quint64, quint32> kept;
+    QVector<EventJournal::Event> page;
+    for (const EventJournal::SegmentInfo &segment : segments) {
+        const quint32 pages = pagesOf(segment);
+        quint32 done = indexedPages.value(segment.id, ~quint32(0));
+        if (done == pages || budget == 0 || searchWaiting()) {
+            behind = behind || done != pages;
+            kept.insert(segment.id, done == ~quint32(0) ? 0 : done);
+            events += qMin<quint64>(quint64(done == ~quint32(0) ? 0 : done) * kPageEvents, segment.events);
+            continue;
+        }
+
+        QFile file(journal->segmentPath(segment.id, "ngm"));
+        if (!file.open(QIODevice::ReadWrite)) {
+            kept.insert(segment.id, pages);   // Searched by reading, then
+            continue;
+        }
+        SignatureHeader header;
+        const bool valid = file.read(reinterpret_cast<char *>(&header), sizeof(header)) == sizeof(header)
+                           && memcmp(header.magic, kSignatureMagic, sizeof(kSignatureMagic)) == 0
+                           && header.version == kVersion && header.pageEvents == kPageEvents
+                           && header.signatureBits == kSignatureBits;
+        if (!valid) {
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, kSignatureMagic, sizeof(kSignatureMagic));
+            header.version = kVersion;
+            header.pageEvents = quint16(kPageEvents);
+            header.signatureBits = quint16(kSignatureBits);
+            file.resize(0);
+            file.seek(0);
+            file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        }
+        // A signature cut short by a crash is written again
+        done = quint32(qMin<qint64>((file.size() - qint64(sizeof(header))) / kSignatureBytes, pages));
+        file.resize(qint64(sizeof(header)) + qint64(done) * kSignatureBytes);
+        file.seek(file.size());
+
+        QByteArray signature(kSignatureBytes, Qt::Uninitialized);
+        while (done < pages && budget > 0 && !searchWaiting() && !stopRequested.load()) {
+            const quint64 first = segment.firstPosition + quint64(done) * kPageEvents;
+            const int count = int(qMin<quint64>(kPageEvents, segment.firstPosition + segment.events - first));
+            page.clear();
+            if (journal->read(first, count, &page) != count)
+                break;   // Dropped meanwhile
+            signature.fill(0);
+            for (const EventJournal::Event &event : page)
+                addTrigrams(event.payload, reinterpret_cast<uchar *>(signature.data()));
+            if (file.write(signature) != signature.size())
+                break;
+            ++done;
+            --budget;
+        }
+        kept.insert(segment.id, done);
+        events += qMin<quint64>(quint64(done) * kPageEvents, segment.events);
+        behind = behind || done < pages;
+    }
+    // Dropped segments fall out here
+    indexedPages.swap(kept);
+    indexed.store(events, std::memory_order_relaxed);
+    return behind;
+}
+
+void EventSearch::runSearch(quint64 id, const QByteArray &text, int maxHits)
+{
+    std::vector<quint32> bits;
+    for (int i = 0; i + 2 < text.size(); ++i) {
+        const uchar *p = reinterpret_cast<const uchar *>(text.constData()) + i;
+        bits.push_back(trigramBit(p[0], p[1], p[2]));
+    }
+
+    QVector<EventSearchHit> hits;
+    int found = 0;
+    quint64 pagesRead = 0;
+    quint64 pagesSkipped = 0;
+    QElapsedTimer sinceSent;
+    sinceSent.start();
+    QVector<EventJournal::Event> page;
+
+    // Reads [first, end) and matches it newest first; false once done
+    auto scan = [&](quint64 first, quint64 end) {
+        page.clear();
+        journal->read(first, int(end - first), &page);
+        ++pagesRead;
+        for (int i = page.size() - 1; i >= 0 && found < maxHits; --i) {
+            if (!containsFolded(page.at(i).payload, text))
+                continue;
+            EventSearchHit hit;
+            hit.position = first + quint64(i);
+            hit.event = page.at(i);
+            hits.append(hit);
+            ++found;
+        }
+        if (hits.size() >= kHitBatch || (!hits.isEmpty() && sinceSent.elapsed() >= kHitIntervalMs)) {
+            emit hitsFound(id, hits);
+            hits.clear();
+            sinceSent.start();
+        }
+        return found < maxHits && !cancelled(id);
+    };
+
+    const QVector<EventJournal::SegmentInfo> segments = journal->segmentInfo();
+    const EventJournal::Span span = journal->span();
+    // Events not written yet come after the last segment
+    quint64 end = span.end;
+    const quint64 written = segments.isEmpty() ? span.first : segments.last().firstPosition + segments.last().events;
+    bool going = true;
+    while (going && end > written) {
+        const quint64 first = qMax(written, end - qMin<quint64>(end, kPageEvents));
+        going = scan(first, end);
+        end = first;
+    }
+
+    for (int s = segments.size() - 1; s >= 0 && going; --s) {
+        const EventJournal::SegmentInfo &segment = segments.at(s);
+        const quint32 pages = (segment.events + kPageEvents - 1) / kPageEvents;
+        QFile file(journal->segmentPath(segment.id, "ngm"));
+        const uchar *map = nullptr;
+        quint32 signedPages = 0;
+        if (!bits.empty() && file.open(QIODevice::ReadOnly) && file.size() > qint64(sizeof(SignatureHeader))) {
+            signedPages = quint32(qMin<qint64>((file.size() - qint64(sizeof(SignatureHeader))) / kSignatureBytes, pages));
+            if (signedPages > 0)
+                map = file.map(0, qint64(sizeof(SignatureHeader)) + qint64(signedPages) * kSignatureBytes);
+            if (map) {
+                SignatureHeader header;
+                memcpy(&header, map, sizeof(header));
+                if (memcmp(header.magic, kSignatureMagic, sizeof(kSignatureMagic)) != 0 || header.pageEvents != kPageEvents
+                    || header.signatureBits != kSignatureBits) {
+                    file.unmap(const_cast<uchar *>(map));
+                    map = nullptr;
+                }
+            }
+        }
+        for (quint32 p = pages; p-- > 0 && going;) {
+            if (map && p < signedPages) {
+                const uchar *signature = map + sizeof(SignatureHeader) + qint64(p) * kSignatureBytes;
+                bool possible = true;
+                for (quint32 bit : bits) {
+                    if (!(signature[bit >> 3] & (1u << (bit & 7)))) {
+                        possible = false;
+                        break;
+                    }
+                }
+                if (!possible) {
+                    ++pagesSkipped;
+                    going = !cancelled(id);
+                    continue;
+                }
+            }
+            const quint64 first = segment.firstPosition + quint64(p) * kPageEvents;
+            going = scan(first, qMin<quint64>(first + kPageEvents, segment.firstPosition + segment.events));
+        }
+        if (map)
+            file.unmap(const_cast<uchar *>(map));
+    }
+
+    if (cancelled(id))
+        return;
+    if (!hits.isEmpty())
+        emit hitsFound(id, hits);
+    emit searchFinished(id, pagesRead, pagesSkipped);
+}
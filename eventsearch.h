@@ -0,0 +1,90 @@
+#ifndef EVENTSEARCH_H
+#define EVENTSEARCH_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMetaType>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+#include <atomic>
+#include "eventjournal.h"
+
+struct EventSearchHit
+{
+    quint64 position = 0;                // In the journal
+    EventJournal::Event event;
+};
+
+Q_DECLARE_METATYPE(EventSearchHit)
+
+// Full-text search over an EventJournal, on a thread of its own.
+//
+// While no search runs it indexes the journal a page of kPageEvents at a
+// time: a page's signature is a bitmap with a bit set for every trigram
+// (three bytes, ASCII lower-cased) of its events' text, hashed down to
+// kSignatureBits. Signatures are kept next to their segment as <id>.ngm,
+// so the index costs no memory, survives a restart and goes when the
+// journal drops the segment.
+//
+// A search matches the text as a substring, ignoring ASCII case, newest
+// event first. A page whose signature misses any trigram of the text is
+// skipped without reading it; the others, and pages not indexed yet, are
+// read and matched event by event. Hits stream out through hitsFound() as
+// they are found, and a new search or cancel() ends the one running
+// before its next page.
+class EventSearch : public QThread
+{
+    Q_OBJECT
+
+public:
+    static const int kPageEvents = 1024;
+    static const int kSignatureBits = 1 << 15;
+
+    explicit EventSearch(EventJournal *journal, QObject *parent = nullptr);
+    ~EventSearch();
+
+    // Any thread. Starts searching for `text`, at most `maxHits` hits,
+    // and returns the id the signals carry for it
+    quint64 search(const QString &text, int maxHits);
+    void cancel();
+    void requestStop();
+
+    // Events with a signature on disk; the rest are read to search them
+    quint64 indexedEvents() const { return indexed.load(std::memory_order_relaxed); }
+
+signals:
+    void hitsFound(quint64 searchId, const QVector<EventSearchHit> &hits);
+    // Not sent for a search that was cancelled
+    void searchFinished(quint64 searchId, quint64 pagesRead, quint64 pagesSkipped);
+
+protected:
+    void run() override;
+
+private:
+    bool indexPages(int budget);
+    void runSearch(quint64 id, const QByteArray &text, int maxHits);
+    bool searchWaiting() const;
+    bool cancelled(quint64 id) const;
+
+    EventJournal *journal;
+
+    QMutex mutex;
+    QWaitCondition wake;
+    QByteArray requestedText;
+    int requestedMaxHits = 0;
+
+    // A search runs while it is the latest; indexing gives way when the
+    // latest has not started
+    std::atomic<quint64> latestId { 0 };
+    std::atomic<quint64> startedId { 0 };
+    std::atomic<bool> stopRequested { false };
+    std::atomic<quint64> indexed { 0 };
+
+    // The search thread's own
+    QHash<quint64, quint32> indexedPages;    // Segment id -> pages with a signature
+};
+
+#endif // EVENTSEARCH_H
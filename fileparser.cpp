@@ -0,0 +1,274 @@
+#include "fileparser.h"
+#include <cstring>
+#include <ctime>
+
+namespace {
+
+// Score weights per finding; a verdict becomes Suspicious at 30 and
+// Malicious at 100.
+const quint32 kSuspiciousScore = 30;
+const quint32 kMaliciousScore = 100;
+
+const char kEicar[] = "X5O!P%@AP[4\\PZX54(P^)7CC)7}$EICAR-STANDARD-ANTIVIRUS-TEST-FILE!$H+H*";
+
+bool readU16(const uchar *data, qint64 size, qint64 offset, quint16 &out)
+{
+    if (offset < 0 || offset + 2 > size)
+        return false;
+    out = quint16(data[offset]) | quint16(data[offset + 1]) << 8;
+    return true;
+}
+
+bool readU32(const uchar *data, qint64 size, qint64 offset, quint32 &out)
+{
+    if (offset < 0 || offset + 4 > size)
+        return false;
+    out = quint32(data[offset]) | quint32(data[offset + 1]) << 8
+          | quint32(data[offset + 2]) << 16 | quint32(data[offset + 3]) << 24;
+    return true;
+}
+
+bool readU64(const uchar *data, qint64 size, qint64 offset, quint64 &out)
+{
+    quint32 lo = 0, hi = 0;
+    if (!readU32(data, size, offset, lo) || !readU32(data, size, offset + 4, hi))
+        return false;
+    out = quint64(hi) << 32 | lo;
+    return true;
+}
+
+bool startsWith(const uchar *data, qint64 size, const char *magic, qint64 length)
+{
+    return size >= length && memcmp(data, magic, size_t(length)) == 0;
+}
+
+// Bounded substring search; memmem is a GNU extension so keep our own.
+bool contains(const uchar *data, qint64 size, const char *needle, qint64 length)
+{
+    if (length == 0 || size < length)
+        return false;
+    const uchar first = uchar(needle[0]);
+    const uchar *end = data + size - length + 1;
+    for (const uchar *p = data; p < end; ++p) {
+        p = static_cast<const uchar *>(memchr(p, first, size_t(end - p)));
+        if (!p)
+            return false;
+        if (memcmp(p, needle, size_t(length)) == 0)
+            return true;
+    }
+    return false;
+}
+
+void addFinding(ScanVerdict &verdict, quint16 flag, quint32 score)
+{
+    if (!(verdict.flags & flag))
+        verdict.score += score;
+    verdict.flags |= flag;
+}
+
+quint64 monotonicMicros()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return quint64(ts.tv_sec) * 1000000u + quint64(ts.tv_nsec) / 1000u;
+}
+
+} // namespace
+
+ScanVerdict FileParser::parse(const uchar *data, qint64 size, qint64 fileSize)
+{
+    const quint64 started = monotonicMicros();
+
+    ScanVerdict verdict;
+    verdict.fileSize = quint64(qMax<qint64>(fileSize, size));
+    if (size < fileSize)
+        verdict.flags |= ScanVerdict::Truncated;
+
+    // The EICAR file must start at offset 0 and is at most 128 bytes long
+    if (fileSize <= 128 && contains(data, size, kEicar, qint64(sizeof(kEicar) - 1)))
+        addFinding(verdict, ScanVerdict::EicarTestFile, kMaliciousScore);
+
+    if (startsWith(data, size, "\x7f" "ELF", 4)) {
+        verdict.fileType = ScanVerdict::Elf;
+        parseElf(data, size, verdict);
+    } else if (startsWith(data, size, "MZ", 2)) {
+        verdict.fileType = ScanVerdict::Pe;
+        parsePe(data, size, verdict);
+    } else if (startsWith(data, size, "PK\x03\x04", 4)) {
+        verdict.fileType = ScanVerdict::Zip;
+        parseZip(data, size, verdict);
+    } else if (startsWith(data, size, "%PDF-", 5)) {
+        verdict.fileType = ScanVerdict::Pdf;
+        parsePdf(data, size, verdict);
+    } else if (startsWith(data, size, "#!", 2)) {
+        verdict.fileType = ScanVerdict::Script;
+    }
+
+    if (verdict.score >= kMaliciousScore)
+        verdict.status = ScanVerdict::Malicious;
+    else if (verdict.score >= kSuspiciousScore)
+        verdict.status = ScanVerdict::Suspicious;
+
+    verdict.parseMicros = quint32(qMin<quint64>(monotonicMicros() - started, 0xffffffffu));
+    return verdict;
+}
+
+void FileParser::parseElf(const uchar *data, qint64 size, ScanVerdict &verdict)
+{
+    if (size < 16 || data[5] != 1) {
+        // Only little-endian ELF is parsed; anything else is just typed
+        return;
+    }
+
+    const bool is64 = data[4] == 2;
+    quint64 entry = 0, phoff = 0, shoff = 0;
+    quint16 phentsize = 0, phnum = 0;
+    bool ok;
+    if (is64) {
+        ok = readU64(data, size, 24, entry) && readU64(data, size, 32, phoff)
+             && readU64(data, size, 40, shoff) && readU16(data, size, 54, phentsize)
+             && readU16(data, size, 56, phnum);
+    } else {
+        quint32 entry32 = 0, phoff32 = 0, shoff32 = 0;
+        ok = readU32(data, size, 24, entry32) && readU32(data, size, 28, phoff32)
+             && readU32(data, size, 32, shoff32) && readU16(data, size, 42, phentsize)
+             && readU16(data, size, 44, phnum);
+        entry = entry32;
+        phoff = phoff32;
+        shoff = shoff32;
+    }
+    if (!ok) {
+        addFinding(verdict, ScanVerdict::MalformedHeader, 20);
+        return;
+    }
+
+    // Stripped section headers pointing past the end of file are a
+    // classic packer artefact
+    if (shoff > verdict.fileSize)
+        addFinding(verdict, ScanVerdict::MalformedHeader, 20);
+
+    const quint16 minEntSize = is64 ? 56 : 32;
+    if (phnum == 0 || phentsize < minEntSize)
+        return;
+
+    bool entryInCode = false;
+    bool sawLoad = false;
+    for (quint16 i = 0; i < qMin<quint16>(phnum, 256); ++i) {
+        const qint64 ph = qint64(phoff) + qint64(i) * phentsize;
+        if (phoff > quint64(size) || ph + minEntSize > size)
+            break;
+        quint32 type = 0, flags = 0;
+        quint64 vaddr = 0, memsz = 0;
+        if (is64) {
+            readU32(data, size, ph, type);
+            readU32(data, size, ph + 4, flags);
+            readU64(data, size, ph + 16, vaddr);
+            readU64(data, size, ph + 40, memsz);
+        } else {
+            quint32 vaddr32 = 0, memsz32 = 0;
+            readU32(data, size, ph, type);
+            readU32(data, size, ph + 8, vaddr32);
+            readU32(data, size, ph + 20, memsz32);
+            readU32(data, size, ph + 24, flags);
+            vaddr = vaddr32;
+            memsz = memsz32;
+        }
+        if (type != 1) // PT_LOAD
+            continue;
+        sawLoad = true;
+        const bool exec = flags & 0x1;
+        const bool write = flags & 0x2;
+        if (exec && write)
+            addFinding(verdict, ScanVerdict::WritableCode, 25);
+        if (exec && entry >= vaddr && entry - vaddr < memsz)
+            entryInCode = true;
+    }
+
+    if (sawLoad && entry != 0 && !entryInCode)
+        addFinding(verdict, ScanVerdict::EntryOutsideCode, 35);
+}
+
+void FileParser::parsePe(const uchar *data, qint64 size, ScanVerdict &verdict)
+{
+    quint32 peOffset = 0, signature = 0;
+    if (!readU32(data, size, 0x3c, peOffset) || !readU32(data, size, peOffset, signature)
+        || signature != 0x00004550) {
+        // Plain DOS executable or a truncated header
+        if (verdict.flags & ScanVerdict::Truncated)
+            return;
+        addFinding(verdict, ScanVerdict::MalformedHeader, 10);
+        return;
+    }
+
+    const qint64 coff = qint64(peOffset) + 4;
+    quint16 sectionCount = 0, optionalSize = 0;
+    quint32 entryRva = 0;
+    if (!readU16(data, size, coff + 2, sectionCount) || !readU16(data, size, coff + 16, optionalSize)
+        || !readU32(data, size, coff + 20 + 16, entryRva)) {
+        addFinding(verdict, ScanVerdict::MalformedHeader, 20);
+        return;
+    }
+
+    const qint64 sections = coff + 20 + optionalSize;
+    bool entryInCode = false;
+    for (quint16 i = 0; i < qMin<quint16>(sectionCount, 96); ++i) {
+        const qint64 header = sections + qint64(i) * 40;
+        quint32 virtualSize = 0, virtualAddress = 0, rawSize = 0, characteristics = 0;
+        if (!readU32(data, size, header + 8, virtualSize) || !readU32(data, size, header + 12, virtualAddress)
+            || !readU32(data, size, header + 16, rawSize) || !readU32(data, size, header + 36, characteristics))
+            break;
+
+        const char *name = reinterpret_cast<const char *>(data + header);
+        if (strncmp(name, "UPX", 3) == 0 || strncmp(name, ".aspack", 7) == 0
+            || strncmp(name, ".MPRESS", 7) == 0)
+            addFinding(verdict, ScanVerdict::PackedSections, 20);
+
+        const bool exec = characteristics & 0x20000000;
+        const bool write = characteristics & 0x80000000;
+        if (exec && write)
+            addFinding(verdict, ScanVerdict::WritableCode, 25);
+
+        const quint32 span = qMax(virtualSize, rawSize);
+        if (entryRva >= virtualAddress && entryRva - virtualAddress < span && exec)
+            entryInCode = true;
+    }
+
+    if (sectionCount > 0 && entryRva != 0 && !entryInCode)
+        addFinding(verdict, ScanVerdict::EntryOutsideCode, 35);
+}
+
+void FileParser::parseZip(const uchar *data, qint64 size, ScanVerdict &verdict)
+{
+    // Walk local file headers. A data descriptor (bit 3) hides the sizes,
+    // in which case we stop; the central directory may be past the
+    // truncated prefix anyway.
+    quint64 totalCompressed = 0, totalUncompressed = 0;
+    qint64 offset = 0;
+    for (int entries = 0; entries < 65536; ++entries) {
+        quint32 signature = 0, compressed = 0, uncompressed = 0;
+        quint16 flags = 0, nameLength = 0, extraLength = 0;
+        if (!readU32(data, size, offset, signature) || signature != 0x04034b50)
+            break;
+        if (!readU16(data, size, offset + 6, flags) || !readU32(data, size, offset + 18, compressed)
+            || !readU32(data, size, offset + 22, uncompressed) || !readU16(data, size, offset + 26, nameLength)
+            || !readU16(data, size, offset + 28, extraLength))
+            break;
+        if (flags & 0x0008)
+            break;
+        totalCompressed += compressed;
+        totalUncompressed += uncompressed;
+        offset += 30 + qint64(nameLength) + extraLength + compressed;
+    }
+
+    const quint64 ratio = totalCompressed ? totalUncompressed / totalCompressed : 0;
+    if (totalUncompressed > (quint64(1) << 30) && ratio > 100)
+        addFinding(verdict, ScanVerdict::ZipBomb, kMaliciousScore);
+}
+
+void FileParser::parsePdf(const uchar *data, qint64 size, ScanVerdict &verdict)
+{
+    if (contains(data, size, "/JavaScript", 11) || contains(data, size, "/JS", 3))
+        addFinding(verdict, ScanVerdict::EmbeddedJavaScript, 20);
+    if (contains(data, size, "/OpenAction", 11) || contains(data, size, "/Launch", 7))
+        addFinding(verdict, ScanVerdict::AutoAction, 15);
+}
@@ -0,0 +1,24 @@
+#ifndef FILEPARSER_H
+#define FILEPARSER_H
+
+#include "scanverdict.h"
+
+// Structural parser for untrusted files (ELF, PE, ZIP, PDF, scripts).
+// It only ever reads from the buffer it is given and never allocates, so
+// the same code runs in-process and inside the seccomp-restricted parser
+// workers. Every offset taken from the file is bounds-checked.
+class FileParser
+{
+public:
+    // `data` holds the first `size` bytes of a file whose real size is
+    // `fileSize`; when size < fileSize the verdict gets the Truncated flag.
+    static ScanVerdict parse(const uchar *data, qint64 size, qint64 fileSize);
+
+private:
+    static void parseElf(const uchar *data, qint64 size, ScanVerdict &verdict);
+    static void parsePe(const uchar *data, qint64 size, ScanVerdict &verdict);
+    static void parseZip(const uchar *data, qint64 size, ScanVerdict &verdict);
+    static void parsePdf(const uchar *data, qint64 size, ScanVerdict &verdict);
+};
+
+#endif // FILEPARSER_H
@@ -0,0 +1,87 @@
+#include "filescanner.h"
+#include "parserworkerpool.h"
+#include <QFileInfo>
+
+FileScanner::FileScanner(ParserWorkerPool *pool, QObject *parent)
+    : QObject(parent), pool(pool)
+{
+    connect(pool, &ParserWorkerPool::verdictReady, this, &FileScanner::onVerdict);
+}
+
+void FileScanner::start(const QString &path)
+{
+    cancel();
+
+    scanned = 0;
+    detected = 0;
+    running = true;
+    timer.start();
+
+    if (QFileInfo(path).isDir()) {
+        iterator.reset(new QDirIterator(path, QDir::Files | QDir::Hidden | QDir::System | QDir::NoSymLinks,
+                                        QDirIterator::Subdirectories));
+    } else {
+        singleFile = path;
+    }
+
+    if (!pool->isRunning())
+        pool->start();
+    refill();
+    finishIfDone();
+}
+
+void FileScanner::cancel()
+{
+    // Jobs already handed to the pool still complete; their verdicts are
+    // simply ignored once they are no longer tracked here.
+    iterator.reset();
+    singleFile.clear();
+    inFlight.clear();
+    if (running) {
+        running = false;
+        emit finished();
+    }
+}
+
+void FileScanner::refill()
+{
+    if (!singleFile.isEmpty()) {
+        inFlight.insert(pool->submit(singleFile));
+        singleFile.clear();
+        return;
+    }
+
+    while (iterator && inFlight.size() < maxInFlight) {
+        if (!iterator->hasNext()) {
+            iterator.reset();
+            break;
+        }
+        inFlight.insert(pool->submit(iterator->next()));
+    }
+}
+
+void FileScanner::onVerdict(const QString &path, const ScanVerdict &verdict)
+{
+    if (!inFlight.remove(verdict.jobId))
+        return;
+
+    ++scanned;
+    if (verdict.status == ScanVerdict::Suspicious || verdict.status == ScanVerdict::Malicious)
+        ++detected;
+
+    emit resultReady(path, verdict);
+    if ((scanned & 0xff) == 0)
+        emit progress(scanned, detected);
+
+    refill();
+    finishIfDone();
+}
+
+void FileScanner::finishIfDone()
+{
+    if (running && !iterator && singleFile.isEmpty() && inFlight.isEmpty()) {
+        running = false;
+        emit progress(scanned, detected);
+        emit finished();
+    }
+}
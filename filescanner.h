@@ -0,0 +1,58 @@
+#ifndef FILESCANNER_H
+#define FILESCANNER_H
+
+#include <QObject>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QSet>
+#include <memory>
+#include "scanverdict.h"
+
+class ParserWorkerPool;
+
+// Walks a directory tree and feeds files to a ParserWorkerPool, keeping
+// only a bounded number of jobs in flight. The tree is iterated lazily, so
+// scanning millions of files never materialises the file list, and every
+// verdict is forwarded through resultReady() as soon as it arrives.
+class FileScanner : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FileScanner(ParserWorkerPool *pool, QObject *parent = nullptr);
+
+    void setMaxInFlight(int jobs) { maxInFlight = qMax(1, jobs); }
+
+    // Accepts a directory or a single file
+    void start(const QString &path);
+    void cancel();
+    bool isRunning() const { return running; }
+
+    quint64 filesScanned() const { return scanned; }
+    quint64 detections() const { return detected; }
+    qint64 elapsedMs() const { return timer.isValid() ? timer.elapsed() : 0; }
+
+signals:
+    void resultReady(const QString &path, const ScanVerdict &verdict);
+    void progress(quint64 filesScanned, quint64 detections);
+    void finished();
+
+private slots:
+    void onVerdict(const QString &path, const ScanVerdict &verdict);
+
+private:
+    void refill();
+    void finishIfDone();
+
+    ParserWorkerPool *pool;
+    std::unique_ptr<QDirIterator> iterator;
+    QString singleFile;
+    QSet<quint64> inFlight;
+    int maxInFlight = 256;
+    bool running = false;
+    quint64 scanned = 0;
+    quint64 detected = 0;
+    QElapsedTimer timer;
+};
+
+#endif // FILESCANNER_H
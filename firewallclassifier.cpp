@@ -0,0 +1,777 @@
+#include "firewallclassifier.h"
+#include <QHostAddress>
+#include <QStringList>
+#include <algorithm>
+#include <climits>
+
+namespace {
+
+// Interval starts beyond this multiple of what the live rules need are
+// worth a rebuild; removals leave their boundaries behind
+const int kCompactFactor = 2;
+
+// Rules whose bit sits out of rule order are checked one by one after
+// the scan; past this many (plus one per 32 rules) a rebuild is cheaper
+const int kMaxMisplaced = 16;
+
+quint32 successor(quint32 key)
+{
+    return key + 1;
+}
+
+FirewallAddress successor(FirewallAddress key)
+{
+    if (++key.low == 0)
+        ++key.high;
+    return key;
+}
+
+bool isMappedIpv4(const FirewallAddress &address)
+{
+    return address.high == 0 && (address.low >> 32) == 0xffff;
+}
+
+bool parseAddress(const QString &text, FirewallAddress *address, bool *ipv4)
+{
+    QHostAddress parsed;
+    if (!parsed.setAddress(text))
+        return false;
+    if (parsed.protocol() == QAbstractSocket::IPv4Protocol) {
+        *address = FirewallAddress::fromIpv4(parsed.toIPv4Address());
+        *ipv4 = true;
+        return true;
+    }
+    const Q_IPV6ADDR bytes = parsed.toIPv6Address();
+    *address = FirewallAddress::fromBytes(reinterpret_cast<const quint8 *>(&bytes), true);
+    *ipv4 = false;
+    return true;
+}
+
+QString addressText(const FirewallAddress &address)
+{
+    if (isMappedIpv4(address))
+        return QHostAddress(quint32(address.low)).toString();
+    quint8 bytes[16];
+    for (int i = 0; i < 8; ++i) {
+        bytes[i] = quint8(address.high >> (56 - 8 * i));
+        bytes[8 + i] = quint8(address.low >> (56 - 8 * i));
+    }
+    return QHostAddress(bytes).toString();
+}
+
+// Host bits of a /prefix over 128 bits
+FirewallAddress hostMask(int prefix)
+{
+    FirewallAddress mask;
+    if (prefix < 64) {
+        mask.high = prefix == 0 ? ~0ULL : ~0ULL >> prefix;
+        mask.low = ~0ULL;
+    } else {
+        mask.low = prefix == 64 ? ~0ULL : (prefix == 128 ? 0 : ~0ULL >> (prefix - 64));
+    }
+    return mask;
+}
+
+// The prefix length if [low, high] is exactly one CIDR block, else -1
+int prefixLength(const FirewallAddress &low, const FirewallAddress &high)
+{
+    for (int prefix = 0; prefix <= 128; ++prefix) {
+        const FirewallAddress mask = hostMask(prefix);
+        if ((low.high & mask.high) == 0 && (low.low & mask.low) == 0
+            && high.high == (low.high | mask.high) && high.low == (low.low | mask.low))
+            return prefix;
+    }
+    return -1;
+}
+
+template<typename Key>
+void addBoundaries(std::vector<Key> *boundaries, Key low, Key high, Key maxKey)
+{
+    boundaries->push_back(low);
+    if (high != maxKey)
+        boundaries->push_back(successor(high));
+}
+
+} // namespace
+
+FirewallAddress FirewallAddress::fromBytes(const quint8 *bytes, bool ipv6)
+{
+    if (!ipv6)
+        return fromIpv4(quint32(bytes[0]) << 24 | quint32(bytes[1]) << 16 | quint32(bytes[2]) << 8 | bytes[3]);
+    FirewallAddress address;
+    for (int i = 0; i < 8; ++i) {
+        address.high = address.high << 8 | bytes[i];
+        address.low = address.low << 8 | bytes[8 + i];
+    }
+    return address;
+}
+
+bool FirewallRule::setRemote(const QString &text)
+{
+    const QString trimmed = text.trimmed();
+    if (trimmed.isEmpty() || trimmed == "*" || trimmed.compare("any", Qt::CaseInsensitive) == 0) {
+        remoteLow = FirewallAddress();
+        remoteHigh = FirewallAddress::max();
+        return true;
+    }
+
+    FirewallAddress low;
+    FirewallAddress high;
+    bool lowIpv4 = false;
+    bool highIpv4 = false;
+    const int dash = trimmed.indexOf('-');
+    const int slash = trimmed.indexOf('/');
+    if (dash >= 0) {
+        if (!parseAddress(trimmed.left(dash).trimmed(), &low, &lowIpv4)
+            || !parseAddress(trimmed.mid(dash + 1).trimmed(), &high, &highIpv4)
+            || lowIpv4 != highIpv4 || high < low)
+            return false;
+    } else if (slash >= 0) {
+        bool ok = false;
+        int prefix = trimmed.mid(slash + 1).toInt(&ok);
+        if (!ok || prefix < 0 || !parseAddress(trimmed.left(slash), &low, &lowIpv4))
+            return false;
+        if (lowIpv4)
+            prefix += 96;
+        if (prefix > 128)
+            return false;
+        const FirewallAddress mask = hostMask(prefix);
+        low.high &= ~mask.high;
+        low.low &= ~mask.low;
+        high = { low.high | mask.high, low.low | mask.low };
+    } else {
+        if (!parseAddress(trimmed, &low, &lowIpv4))
+            return false;
+        high = low;
+    }
+    remoteLow = low;
+    remoteHigh = high;
+    return true;
+}
+
+QString FirewallRule::remoteText() const
+{
+    if (remoteLow == FirewallAddress() && remoteHigh == FirewallAddress::max())
+        return "any";
+    if (remoteLow == remoteHigh)
+        return addressText(remoteLow);
+    const int prefix = prefixLength(remoteLow, remoteHigh);
+    if (prefix >= 96 && isMappedIpv4(remoteLow))
+        return QString("%1/%2").arg(addressText(remoteLow)).arg(prefix - 96);
+    if (prefix >= 0)
+        return QString("%1/%2").arg(addressText(remoteLow)).arg(prefix);
+    return QString("%1-%2").arg(addressText(remoteLow), addressText(remoteHigh));
+}
+
+bool FirewallRule::parsePorts(const QString &text, quint16 *low, quint16 *high)
+{
+    const QString trimmed = text.trimmed();
+    if (trimmed.isEmpty() || trimmed == "*" || trimmed.compare("any", Qt::CaseInsensitive) == 0) {
+        *low = 0;
+        *high = 65535;
+        return true;
+    }
+    const QStringList parts = trimmed.split('-');
+    if (parts.size() > 2)
+        return false;
+    bool lowOk = false;
+    bool highOk = false;
+    const uint first = parts.first().trimmed().toUInt(&lowOk);
+    const uint last = parts.last().trimmed().toUInt(&highOk);
+    if (!lowOk || !highOk || first > last || last > 65535)
+        return false;
+    *low = quint16(first);
+    *high = quint16(last);
+    return true;
+}
+
+QString FirewallRule::portsText(quint16 low, quint16 high)
+{
+    if (low == 0 && high == 65535)
+        return "any";
+    if (low == high)
+        return QString::number(low);
+    return QString("%1-%2").arg(low).arg(high);
+}
+
+void FirewallClassifier::SparseBits::set(int bit)
+{
+    const quint32 index = quint32(bit) >> 6;
+    auto it = std::lower_bound(words.begin(), words.end(), index,
+                               [](const Word &word, quint32 value) { return word.index < value; });
+    if (it == words.end() || it->index != index)
+        it = words.insert(it, Word { index, 0 });
+    it->bits |= 1ULL << (bit & 63);
+}
+
+void FirewallClassifier::SparseBits::clear(int bit)
+{
+    const quint32 index = quint32(bit) >> 6;
+    auto it = std::lower_bound(words.begin(), words.end(), index,
+                               [](const Word &word, quint32 value) { return word.index < value; });
+    if (it == words.end() || it->index != index)
+        return;
+    it->bits &= ~(1ULL << (bit & 63));
+    if (it->bits == 0)
+        words.erase(it);
+}
+
+template<typename Key>
+FirewallClassifier::RangeField<Key>::RangeField(Key maxKey)
+    : maxKey(maxKey)
+{
+    reset();
+}
+
+template<typename Key>
+void FirewallClassifier::RangeField<Key>::reset()
+{
+    starts.assign(1, Key());
+    sets.assign(1, SparseBits());
+}
+
+template<typename Key>
+int FirewallClassifier::RangeField<Key>::find(Key key) const
+{
+    return int(std::upper_bound(starts.begin(), starts.end(), key) - starts.begin()) - 1;
+}
+
+template<typename Key>
+int FirewallClassifier::RangeField<Key>::split(Key at)
+{
+    const int i = find(at);
+    if (starts[size_t(i)] == at)
+        return i;
+    starts.insert(starts.begin() + i + 1, at);
+    sets.insert(sets.begin() + i + 1, sets[size_t(i)]);
+    return i + 1;
+}
+
+template<typename Key>
+void FirewallClassifier::RangeField<Key>::add(int bit, Key low, Key high)
+{
+    const int first = split(low);
+    if (high != maxKey)
+        split(successor(high));
+    for (size_t i = size_t(first); i < starts.size() && starts[i] <= high; ++i)
+        sets[i].set(bit);
+}
+
+template<typename Key>
+void FirewallClassifier::RangeField<Key>::remove(int bit, Key low, Key high)
+{
+    for (size_t i = size_t(find(low)); i < starts.size() && starts[i] <= high; ++i)
+        sets[i].clear(bit);
+}
+
+template<typename Key>
+void FirewallClassifier::RangeField<Key>::rebuild(const std::vector<Key> &boundaries)
+{
+    starts = boundaries;
+    sets.assign(starts.size(), SparseBits());
+}
+
+void FirewallClassifier::Wildcard::set(int bit)
+{
+    const size_t word = size_t(bit) >> 6;
+    words[word] |= 1ULL << (bit & 63);
+    summary[word >> 6] |= 1ULL << (word & 63);
+}
+
+void FirewallClassifier::Wildcard::clear(int bit)
+{
+    const size_t word = size_t(bit) >> 6;
+    words[word] &= ~(1ULL << (bit & 63));
+    if (words[word] == 0)
+        summary[word >> 6] &= ~(1ULL << (word & 63));
+}
+
+FirewallClassifier::FirewallClassifier()
+    : directions(FirewallRule::Outbound)
+    , protocols(255)
+    , localPorts(65535)
+    , remotePorts(65535)
+    , addresses(FirewallAddress::max())
+{
+}
+
+FirewallClassifier::~FirewallClassifier() = default;
+
+void FirewallClassifier::clear()
+{
+    ruleSlots.clear();
+    freeSlots.clear();
+    order.clear();
+    slotOfId.clear();
+    directions.reset();
+    protocols.reset();
+    localPorts.reset();
+    remotePorts.reset();
+    addresses.reset();
+    processes.clear();
+    for (Wildcard &wildcard : wildcards) {
+        wildcard.words.clear();
+        wildcard.summary.clear();
+    }
+    misplaced.clear();
+    misplacedBits.clear();
+    indexedCount = 0;
+}
+
+int FirewallClassifier::processKey(const QString &name)
+{
+    auto it = processKeys.find(name);
+    if (it == processKeys.end())
+        it = processKeys.insert(name, processKeys.size());
+    return it.value();
+}
+
+int FirewallClassifier::allocateSlot(int after, int before)
+{
+    // A free slot between the neighbours keeps the new rule in order;
+    // appending does too when nothing follows
+    auto it = freeSlots.upper_bound(after);
+    if (it == freeSlots.end() || *it >= before) {
+        if (before == INT_MAX || freeSlots.empty()) {
+            const int slot = int(ruleSlots.size());
+            ruleSlots.emplace_back();
+            resizeBitmaps();
+            return slot;
+        }
+        it = freeSlots.begin();
+    }
+    const int slot = *it;
+    freeSlots.erase(it);
+    return slot;
+}
+
+void FirewallClassifier::resizeBitmaps()
+{
+    const size_t words = (ruleSlots.size() + 63) / 64;
+    for (Wildcard &wildcard : wildcards) {
+        wildcard.words.resize(words);
+        wildcard.summary.resize((words + 63) / 64);
+    }
+    misplacedBits.resize(words);
+}
+
+bool FirewallClassifier::isMisplaced(int slot) const
+{
+    return (misplacedBits[size_t(slot) >> 6] >> (slot & 63)) & 1;
+}
+
+void FirewallClassifier::placedNeighbours(int position, int skip, int *after, int *before) const
+{
+    *after = -1;
+    *before = INT_MAX;
+    for (int i = position - 1; i >= 0; --i) {
+        const int slot = order[size_t(i)];
+        if (slot != skip && !isMisplaced(slot)) {
+            *after = slot;
+            break;
+        }
+    }
+    for (int i = position; i < ruleCount(); ++i) {
+        const int slot = order[size_t(i)];
+        if (slot != skip && !isMisplaced(slot)) {
+            *before = slot;
+            break;
+        }
+    }
+}
+
+void FirewallClassifier::setMisplaced(int slot, bool value)
+{
+    if (value == isMisplaced(slot))
+        return;
+    if (value) {
+        misplacedBits[size_t(slot) >> 6] |= 1ULL << (slot & 63);
+        misplaced.push_back(slot);
+    } else {
+        misplacedBits[size_t(slot) >> 6] &= ~(1ULL << (slot & 63));
+        misplaced.erase(std::find(misplaced.begin(), misplaced.end(), slot));
+    }
+}
+
+void FirewallClassifier::index(int slot)
+{
+    Slot &entry = ruleSlots[size_t(slot)];
+    const FirewallRule &rule = entry.rule;
+    if (entry.indexed || !rule.enabled)
+        return;
+
+    if (rule.direction == FirewallRule::AnyDirection)
+        wildcards[DirectionField].set(slot);
+    else
+        directions.add(slot, rule.direction, rule.direction);
+    if (rule.protocol == 0)
+        wildcards[ProtocolField].set(slot);
+    else
+        protocols.add(slot, rule.protocol, rule.protocol);
+    if (rule.localPortLow == 0 && rule.localPortHigh == 65535)
+        wildcards[LocalPortField].set(slot);
+    else
+        localPorts.add(slot, rule.localPortLow, rule.localPortHigh);
+    if (rule.remotePortLow == 0 && rule.remotePortHigh == 65535)
+        wildcards[RemotePortField].set(slot);
+    else
+        remotePorts.add(slot, rule.remotePortLow, rule.remotePortHigh);
+    if (rule.remoteLow == FirewallAddress() && rule.remoteHigh == FirewallAddress::max())
+        wildcards[AddressField].set(slot);
+    else
+        addresses.add(slot, rule.remoteLow, rule.remoteHigh);
+    if (entry.processKey < 0)
+        wildcards[ProcessField].set(slot);
+    else
+        processes[entry.processKey].set(slot);
+
+    entry.indexed = true;
+    ++indexedCount;
+}
+
+void FirewallClassifier::unindex(int slot)
+{
+    Slot &entry = ruleSlots[size_t(slot)];
+    const FirewallRule &rule = entry.rule;
+    if (!entry.indexed)
+        return;
+
+    if (rule.direction == FirewallRule::AnyDirection)
+        wildcards[DirectionField].clear(slot);
+    else
+        directions.remove(slot, rule.direction, rule.direction);
+    if (rule.protocol == 0)
+        wildcards[ProtocolField].clear(slot);
+    else
+        protocols.remove(slot, rule.protocol, rule.protocol);
+    if (rule.localPortLow == 0 && rule.localPortHigh == 65535)
+        wildcards[LocalPortField].clear(slot);
+    else
+        localPorts.remove(slot, rule.localPortLow, rule.localPortHigh);
+    if (rule.remotePortLow == 0 && rule.remotePortHigh == 65535)
+        wildcards[RemotePortField].clear(slot);
+    else
+        remotePorts.remove(slot, rule.remotePortLow, rule.remotePortHigh);
+    if (rule.remoteLow == FirewallAddress() && rule.remoteHigh == FirewallAddress::max())
+        wildcards[AddressField].clear(slot);
+    else
+        addresses.remove(slot, rule.remoteLow, rule.remoteHigh);
+    if (entry.processKey < 0) {
+        wildcards[ProcessField].clear(slot);
+    } else {
+        auto it = processes.find(entry.processKey);
+        if (it != processes.end()) {
+            it->clear(slot);
+            if (it->words.empty())
+                processes.erase(it);
+        }
+    }
+
+    entry.indexed = false;
+    --indexedCount;
+}
+
+void FirewallClassifier::renumber(int first, int last)
+{
+    for (int position = first; position <= last; ++position)
+        ruleSlots[size_t(order[size_t(position)])].position = position;
+}
+
+void FirewallClassifier::setRules(const QVector<FirewallRule> &rules)
+{
+    clear();
+    ruleSlots.resize(size_t(rules.size()));
+    order.resize(size_t(rules.size()));
+    for (int position = 0; position < rules.size(); ++position) {
+        Slot &entry = ruleSlots[size_t(position)];
+        entry.rule = rules.at(position);
+        entry.processKey = entry.rule.process.isEmpty() ? -1 : processKey(entry.rule.process);
+        order[size_t(position)] = position;
+    }
+    rebuildIndex();
+}
+
+void FirewallClassifier::rebuildIndex()
+{
+    // Hand out slots in rule order again, so match() can stop at the
+    // first hit and the free list is empty
+    std::vector<Slot> compacted;
+    compacted.reserve(order.size());
+    slotOfId.clear();
+    for (size_t position = 0; position < order.size(); ++position) {
+        compacted.push_back(std::move(ruleSlots[size_t(order[position])]));
+        compacted.back().position = int(position);
+        order[position] = int(position);
+        slotOfId.insert(compacted.back().rule.id, int(position));
+    }
+    ruleSlots = std::move(compacted);
+    freeSlots.clear();
+    misplaced.clear();
+    misplacedBits.assign((ruleSlots.size() + 63) / 64, 0);
+    resizeBitmaps();
+
+    std::vector<quint32> directionBounds { 0 };
+    std::vector<quint32> protocolBounds { 0 };
+    std::vector<quint32> localBounds { 0 };
+    std::vector<quint32> remoteBounds { 0 };
+    std::vector<FirewallAddress> addressBounds { FirewallAddress() };
+    for (const Slot &entry : ruleSlots) {
+        const FirewallRule &rule = entry.rule;
+        if (entry.position < 0 || !rule.enabled)
+            continue;
+        if (rule.direction != FirewallRule::AnyDirection)
+            addBoundaries<quint32>(&directionBounds, rule.direction, rule.direction, directions.maxKey);
+        if (rule.protocol != 0)
+            addBoundaries<quint32>(&protocolBounds, rule.protocol, rule.protocol, protocols.maxKey);
+        addBoundaries<quint32>(&localBounds, rule.localPortLow, rule.localPortHigh, localPorts.maxKey);
+        addBoundaries<quint32>(&remoteBounds, rule.remotePortLow, rule.remotePortHigh, remotePorts.maxKey);
+        addBoundaries(&addressBounds, rule.remoteLow, rule.remoteHigh, addresses.maxKey);
+    }
+    const auto unique = [](auto *bounds) {
+        std::sort(bounds->begin(), bounds->end());
+        bounds->erase(std::unique(bounds->begin(), bounds->end()), bounds->end());
+    };
+    unique(&directionBounds);
+    unique(&protocolBounds);
+    unique(&localBounds);
+    unique(&remoteBounds);
+    unique(&addressBounds);
+
+    directions.rebuild(directionBounds);
+    protocols.rebuild(protocolBounds);
+    localPorts.rebuild(localBounds);
+    remotePorts.rebuild(remoteBounds);
+    addresses.rebuild(addressBounds);
+    processes.clear();
+    for (Wildcard &wildcard : wildcards) {
+        std::fill(wildcard.words.begin(), wildcard.words.end(), 0);
+        std::fill(wildcard.summary.begin(), wildcard.summary.end(), 0);
+    }
+    indexedCount = 0;
+    for (size_t slot = 0; slot < ruleSlots.size(); ++slot) {
+        ruleSlots[slot].indexed = false;
+        if (ruleSlots[slot].position >= 0)
+            index(int(slot));
+    }
+}
+
+void FirewallClassifier::compactIfSparse()
+{
+    const size_t intervals = directions.starts.size() + protocols.starts.size() + localPorts.starts.size()
+                             + remotePorts.starts.size() + addresses.starts.size();
+    const size_t needed = 5 * (2 * size_t(indexedCount) + 1);
+    if (intervals > kCompactFactor * needed || int(misplaced.size()) > kMaxMisplaced + ruleCount() / 32)
+        rebuildIndex();
+}
+
+void FirewallClassifier::insertRule(int position, const FirewallRule &rule)
+{
+    position = qBound(0, position, ruleCount());
+    int after;
+    int before;
+    placedNeighbours(position, -1, &after, &before);
+    const int slot = allocateSlot(after, before);
+    Slot &entry = ruleSlots[size_t(slot)];
+    entry.rule = rule;
+    entry.processKey = rule.process.isEmpty() ? -1 : processKey(rule.process);
+    order.insert(order.begin() + position, slot);
+    renumber(position, ruleCount() - 1);
+    slotOfId.insert(rule.id, slot);
+    index(slot);
+    setMisplaced(slot, slot <= after || slot >= before);
+    compactIfSparse();
+}
+
+void FirewallClassifier::updateRule(const FirewallRule &rule)
+{
+    const int slot = slotOfId.value(rule.id, -1);
+    if (slot < 0)
+        return;
+    unindex(slot);
+    Slot &entry = ruleSlots[size_t(slot)];
+    entry.rule = rule;
+    entry.processKey = rule.process.isEmpty() ? -1 : processKey(rule.process);
+    index(slot);
+    compactIfSparse();
+}
+
+void FirewallClassifier::removeRule(quint32 id)
+{
+    const int slot = slotOfId.value(id, -1);
+    if (slot < 0)
+        return;
+    unindex(slot);
+    setMisplaced(slot, false);
+    Slot &entry = ruleSlots[size_t(slot)];
+    const int position = entry.position;
+    order.erase(order.begin() + position);
+    renumber(position, ruleCount() - 1);
+    entry = Slot();
+    freeSlots.insert(slot);
+    slotOfId.remove(id);
+    compactIfSparse();
+}
+
+void FirewallClassifier::moveRule(int from, int to)
+{
+    if (from == to || from < 0 || to < 0 || from >= ruleCount() || to >= ruleCount())
+        return;
+    if (from < to)
+        std::rotate(order.begin() + from, order.begin() + from + 1, order.begin() + to + 1);
+    else
+        std::rotate(order.begin() + to, order.begin() + from, order.begin() + from + 1);
+    renumber(qMin(from, to), qMax(from, to));
+
+    // Only the moved rule can have left order; the bit stays put and the
+    // rule joins the ones checked after the scan
+    const int slot = order[size_t(to)];
+    int after;
+    int before;
+    placedNeighbours(to, slot, &after, &before);
+    setMisplaced(slot, slot <= after || slot >= before);
+    compactIfSparse();
+}
+
+const FirewallRule *FirewallClassifier::match(const FirewallQuery &query) const
+{
+    if (indexedCount == 0)
+        return nullptr;
+
+    static const SparseBits kNone;
+    const SparseBits *sets[FieldCount];
+    sets[DirectionField] = &directions.sets[size_t(directions.find(query.direction))];
+    sets[ProtocolField] = &protocols.sets[size_t(protocols.find(query.protocol))];
+    sets[LocalPortField] = &localPorts.sets[size_t(localPorts.find(query.localPort))];
+    sets[RemotePortField] = &remotePorts.sets[size_t(remotePorts.find(query.remotePort))];
+    sets[AddressField] = &addresses.sets[size_t(addresses.find(query.remoteAddress))];
+    const auto process = processes.constFind(query.process);
+    sets[ProcessField] = process == processes.constEnd() ? &kNone : &process.value();
+
+    // Leapfrog over the words each field has bits in (wildcard or interval
+    // set) until every field agrees on one, then AND that word
+    const quint32 wordCount = quint32(wildcards[0].words.size());
+    size_t cursor[FieldCount] = {};
+    const auto nextWord = [&](int field, quint32 from) {
+        const std::vector<SparseBits::Word> &sparse = sets[field]->words;
+        size_t &at = cursor[field];
+        while (at < sparse.size() && sparse[at].index < from)
+            ++at;
+        quint32 next = at < sparse.size() ? sparse[at].index : wordCount;
+        const std::vector<quint64> &summary = wildcards[field].summary;
+        for (quint32 k = from >> 6; (k << 6) < next && k < summary.size(); ++k) {
+            quint64 bits = summary[k];
+            if (k == from >> 6)
+                bits &= ~0ULL << (from & 63);
+            if (bits) {
+                next = qMin(next, (k << 6) + quint32(__builtin_ctzll(bits)));
+                break;
+            }
+        }
+        return next;
+    };
+
+    int bestSlot = -1;
+    quint32 w = 0;
+    while (w < wordCount) {
+        int agreed = 0;
+        for (int field = 0; agreed < FieldCount && w < wordCount; field = (field + 1) % FieldCount) {
+            const quint32 next = nextWord(field, w);
+            if (next == w) {
+                ++agreed;
+            } else {
+                w = next;
+                agreed = 1;
+            }
+        }
+        if (w >= wordCount)
+            break;
+
+        quint64 bits = ~misplacedBits[w];
+        for (int field = 0; field < FieldCount; ++field) {
+            quint64 fieldBits = wildcards[field].words[w];
+            const std::vector<SparseBits::Word> &sparse = sets[field]->words;
+            if (cursor[field] < sparse.size() && sparse[cursor[field]].index == w)
+                fieldBits |= sparse[cursor[field]].bits;
+            bits &= fieldBits;
+        }
+        // Slots outside the misplaced set follow rule order, so the lowest
+        // surviving bit is the earliest of them that matches
+        if (bits) {
+            bestSlot = int(w * 64 + quint32(__builtin_ctzll(bits)));
+            break;
+        }
+        ++w;
+    }
+
+    int bestPosition = bestSlot < 0 ? ruleCount() : ruleSlots[size_t(bestSlot)].position;
+    for (int slot : misplaced) {
+        const Slot &entry = ruleSlots[size_t(slot)];
+        if (entry.position < bestPosition && matchesLinear(entry, query)) {
+            bestPosition = entry.position;
+            bestSlot = slot;
+        }
+    }
+    return bestSlot < 0 ? nullptr : &ruleSlots[size_t(bestSlot)].rule;
+}
+
+bool FirewallClassifier::matchesLinear(const Slot &slot, const FirewallQuery &query) const
+{
+    const FirewallRule &rule = slot.rule;
+    return rule.enabled
+           && (rule.direction == FirewallRule::AnyDirection || rule.direction == query.direction)
+           && (rule.protocol == 0 || rule.protocol == query.protocol)
+           && query.localPort >= rule.localPortLow && query.localPort <= rule.localPortHigh
+           && query.remotePort >= rule.remotePortLow && query.remotePort <= rule.remotePortHigh
+           && rule.remoteLow <= query.remoteAddress && query.remoteAddress <= rule.remoteHigh
+           && (slot.processKey < 0 || slot.processKey == query.process);
+}
+
+const FirewallRule *FirewallClassifier::matchLinear(const FirewallQuery &query) const
+{
+    for (int slot : order) {
+        if (matchesLinear(ruleSlots[size_t(slot)], query))
+            return &ruleSlots[size_t(slot)].rule;
+    }
+    return nullptr;
+}
+
+FirewallClassifier::Stats FirewallClassifier::stats() const
+{
+    Stats stats;
+    stats.rules = ruleCount();
+    stats.indexedRules = indexedCount;
+    stats.intervals = int(directions.starts.size() + protocols.starts.size() + localPorts.starts.size()
+                          + remotePorts.starts.size() + addresses.starts.size());
+
+    quint64 setWords = 0;
+    quint64 wordCapacity = 0;
+    quint64 setCount = 0;
+    const auto countSets = [&](const std::vector<SparseBits> &sets) {
+        for (const SparseBits &set : sets) {
+            setWords += set.words.size();
+            wordCapacity += set.words.capacity();
+        }
+        setCount += sets.capacity();
+    };
+    countSets(directions.sets);
+    countSets(protocols.sets);
+    countSets(localPorts.sets);
+    countSets(remotePorts.sets);
+    countSets(addresses.sets);
+    for (const SparseBits &set : processes) {
+        setWords += set.words.size();
+        wordCapacity += set.words.capacity();
+    }
+    setCount += quint64(processes.size());
+    stats.setWords = setWords;
+
+    quint64 bytes = wordCapacity * sizeof(SparseBits::Word) + setCount * sizeof(SparseBits);
+    bytes += (directions.starts.capacity() + protocols.starts.capacity() + localPorts.starts.capacity()
+              + remotePorts.starts.capacity()) * sizeof(quint32);
+    bytes += addresses.starts.capacity() * sizeof(FirewallAddress);
+    for (const Wildcard &wildcard : wildcards)
+        bytes += (wildcard.words.capacity() + wildcard.summary.capacity()) * sizeof(quint64);
+    bytes += ruleSlots.capacity() * sizeof(Slot) + order.capacity() * sizeof(int);
+    stats.memoryBytes = bytes;
+    return stats;
+}
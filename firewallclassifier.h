@@ -0,0 +1,209 @@
+#ifndef FIREWALLCLASSIFIER_H
+#define FIREWALLCLASSIFIER_H
+
+#include <QHash>
+#include <QString>
+#include <QVector>
+#include <set>
+#include <vector>
+
+// 128-bit address; IPv4 is stored IPv4-mapped (::ffff:a.b.c.d), so one
+// range type covers both families
+struct FirewallAddress
+{
+    quint64 high = 0;
+    quint64 low = 0;
+
+    static FirewallAddress fromIpv4(quint32 address) { return { 0, 0xffff00000000ULL | address }; }
+    static FirewallAddress fromBytes(const quint8 *bytes, bool ipv6);
+    static FirewallAddress max() { return { ~0ULL, ~0ULL }; }
+
+    bool operator==(const FirewallAddress &other) const { return high == other.high && low == other.low; }
+    bool operator!=(const FirewallAddress &other) const { return !(*this == other); }
+    bool operator<(const FirewallAddress &other) const
+    {
+        return high < other.high || (high == other.high && low < other.low);
+    }
+    bool operator<=(const FirewallAddress &other) const { return !(other < *this); }
+};
+
+struct FirewallRule
+{
+    enum Action : quint8 { Allow, Block };
+    enum Direction : quint8 { AnyDirection, Inbound, Outbound };
+
+    quint32 id = 0;                    // Stable across edits; never 0
+    bool enabled = true;
+    Action action = Block;
+    Direction direction = AnyDirection;
+    quint8 protocol = 0;               // IPPROTO_*; 0 matches any
+    FirewallAddress remoteLow;
+    FirewallAddress remoteHigh = FirewallAddress::max();
+    quint16 localPortLow = 0;
+    quint16 localPortHigh = 65535;
+    quint16 remotePortLow = 0;
+    quint16 remotePortHigh = 65535;
+    QString process;                   // Executable name; empty matches any
+    QString comment;
+
+    // "any", "10.0.0.0/8", "2001:db8::/32", "192.0.2.1" or "a-b"
+    bool setRemote(const QString &text);
+    QString remoteText() const;
+    // "any", "443" or "1024-65535"
+    static bool parsePorts(const QString &text, quint16 *low, quint16 *high);
+    static QString portsText(quint16 low, quint16 high);
+};
+
+// One connection or packet to classify, from the host's point of view
+struct FirewallQuery
+{
+    FirewallAddress remoteAddress;
+    quint16 localPort = 0;
+    quint16 remotePort = 0;
+    quint8 protocol = 0;
+    FirewallRule::Direction direction = FirewallRule::Outbound;
+    int process = -1;                  // FirewallClassifier::processKey()
+};
+
+// Bit-vector packet classifier. Every rule owns one bit. Each field keeps
+// its value space cut into elementary intervals at rule boundaries, and
+// per interval the set of rules that constrain the field and accept it;
+// rules that leave a field open sit in that field's wildcard set. A match
+// looks the query up in each field, ANDs the per-field sets and takes the
+// accepted rule earliest in rule order.
+//
+// Interval sets are sparse (only non-zero 64-bit words), and a summary
+// bit per wildcard word lets the AND leapfrog to words every field has
+// bits in. Bits are handed out in rule order, so the first word that
+// survives the AND holds the answer and the lookup stops there.
+//
+// Inserting, editing, removing or moving one rule only touches that
+// rule's bits and the intervals its ranges cover. A rule whose bit cannot
+// follow rule order (moved, or inserted with no free bit between its
+// neighbours) is masked out of the scan and checked on its own; enough of
+// those, or of intervals left behind by removals, trigger a rebuild.
+class FirewallClassifier
+{
+public:
+    struct Stats
+    {
+        int rules = 0;
+        int indexedRules = 0;          // Enabled ones
+        int intervals = 0;             // Across all range fields
+        quint64 setWords = 0;          // Non-zero words in interval sets
+        quint64 memoryBytes = 0;
+    };
+
+    FirewallClassifier();
+    ~FirewallClassifier();
+
+    // Full rebuild; the vector's order is the rule order
+    void setRules(const QVector<FirewallRule> &rules);
+    void insertRule(int position, const FirewallRule &rule);
+    // Replaces the rule with the same id, keeping its position
+    void updateRule(const FirewallRule &rule);
+    void removeRule(quint32 id);
+    void moveRule(int from, int to);
+    void clear();
+
+    int ruleCount() const { return int(order.size()); }
+    const FirewallRule &ruleAt(int position) const { return ruleSlots[size_t(order[size_t(position)])].rule; }
+
+    // Process names are interned; unknown names get a key that matches
+    // only rules without a process
+    int processKey(const QString &name);
+    int findProcessKey(const QString &name) const { return processKeys.value(name, -1); }
+
+    // The first enabled rule in order that matches, or nullptr
+    const FirewallRule *match(const FirewallQuery &query) const;
+    // Reference implementation walking the rules in order
+    const FirewallRule *matchLinear(const FirewallQuery &query) const;
+
+    Stats stats() const;
+
+private:
+    // Sorted non-zero words of a bit set
+    struct SparseBits
+    {
+        struct Word
+        {
+            quint32 index;
+            quint64 bits;
+        };
+
+        void set(int bit);
+        void clear(int bit);
+        std::vector<Word> words;
+    };
+
+    // Elementary intervals over [0, maxKey]; sets[i] covers
+    // [starts[i], starts[i + 1])
+    template<typename Key>
+    struct RangeField
+    {
+        explicit RangeField(Key maxKey);
+
+        void reset();
+        int find(Key key) const;
+        int split(Key at);
+        void add(int bit, Key low, Key high);
+        void remove(int bit, Key low, Key high);
+        void rebuild(const std::vector<Key> &boundaries);
+
+        Key maxKey;
+        std::vector<Key> starts;
+        std::vector<SparseBits> sets;
+    };
+
+    // Dense set of the rules that leave a field open
+    struct Wildcard
+    {
+        void set(int bit);
+        void clear(int bit);
+
+        std::vector<quint64> words;
+        std::vector<quint64> summary;  // Bit w: words[w] != 0
+    };
+
+    enum Field { DirectionField, ProtocolField, LocalPortField, RemotePortField, AddressField, ProcessField, FieldCount };
+
+    struct Slot
+    {
+        FirewallRule rule;
+        int position = -1;             // In `order`; -1 when free
+        int processKey = -1;
+        bool indexed = false;
+    };
+
+    int allocateSlot(int after, int before);
+    void resizeBitmaps();
+    bool isMisplaced(int slot) const;
+    void setMisplaced(int slot, bool value);
+    void placedNeighbours(int position, int skip, int *after, int *before) const;
+    void index(int slot);
+    void unindex(int slot);
+    void renumber(int first, int last);
+    void rebuildIndex();
+    void compactIfSparse();
+    bool matchesLinear(const Slot &slot, const FirewallQuery &query) const;
+
+    std::vector<Slot> ruleSlots;
+    std::set<int> freeSlots;
+    std::vector<int> order;            // Rule order -> slot
+    QHash<quint32, int> slotOfId;
+    QHash<QString, int> processKeys;
+
+    RangeField<quint32> directions;
+    RangeField<quint32> protocols;
+    RangeField<quint32> localPorts;
+    RangeField<quint32> remotePorts;
+    RangeField<FirewallAddress> addresses;
+    QHash<int, SparseBits> processes;
+    Wildcard wildcards[FieldCount];
+    // Slots whose order disagrees with rule order since the last rebuild
+    std::vector<int> misplaced;
+    std::vector<quint64> misplacedBits;
+    int indexedCount = 0;
+};
+
+#endif // FIREWALLCLASSIFIER_H
@@ -0,0 +1,322 @@
+#include "firewallrulemodel.h"
+#include <QFile>
+#include <QStringList>
+#include <cstdio>
+
+namespace {
+
+const int kFieldCount = 9;
+
+QString escapeField(QString text)
+{
+    return text.replace('\t', ' ').replace('\n', ' ');
+}
+
+} // namespace
+
+FirewallRuleModel::FirewallRuleModel(QObject *parent)
+    : QAbstractTableModel(parent)
+{
+}
+
+int FirewallRuleModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : compiled.ruleCount();
+}
+
+int FirewallRuleModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : ColumnCount;
+}
+
+QString FirewallRuleModel::protocolText(quint8 protocol)
+{
+    switch (protocol) {
+    case 0: return "any";
+    case 1: return "ICMP";
+    case 6: return "TCP";
+    case 17: return "UDP";
+    case 58: return "ICMPv6";
+    default: return QString::number(protocol);
+    }
+}
+
+bool FirewallRuleModel::parseProtocol(const QString &text, quint8 *protocol)
+{
+    const QString name = text.trimmed().toLower();
+    if (name.isEmpty() || name == "any" || name == "*")
+        *protocol = 0;
+    else if (name == "icmp")
+        *protocol = 1;
+    else if (name == "tcp")
+        *protocol = 6;
+    else if (name == "udp")
+        *protocol = 17;
+    else if (name == "icmpv6")
+        *protocol = 58;
+    else {
+        bool ok = false;
+        const uint number = name.toUInt(&ok);
+        if (!ok || number > 255)
+            return false;
+        *protocol = quint8(number);
+    }
+    return true;
+}
+
+QVariant FirewallRuleModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= compiled.ruleCount())
+        return QVariant();
+
+    const FirewallRule &rule = compiled.ruleAt(index.row());
+    if (index.column() == EnabledColumn)
+        return role == Qt::CheckStateRole ? QVariant(rule.enabled ? Qt::Checked : Qt::Unchecked) : QVariant();
+    if (role != Qt::DisplayRole && role != Qt::EditRole)
+        return QVariant();
+
+    switch (index.column()) {
+    case ActionColumn:
+        return rule.action == FirewallRule::Allow ? tr("Allow") : tr("Block");
+    case DirectionColumn:
+        if (rule.direction == FirewallRule::AnyDirection)
+            return tr("Any");
+        return rule.direction == FirewallRule::Inbound ? tr("In") : tr("Out");
+    case ProtocolColumn:
+        return protocolText(rule.protocol);
+    case RemoteColumn:
+        return rule.remoteText();
+    case LocalPortsColumn:
+        return FirewallRule::portsText(rule.localPortLow, rule.localPortHigh);
+    case RemotePortsColumn:
+        return FirewallRule::portsText(rule.remotePortLow, rule.remotePortHigh);
+    case ProcessColumn:
+        return rule.process.isEmpty() && role == Qt::DisplayRole ? QString("any") : rule.process;
+    case CommentColumn:
+        return rule.comment;
+    default:
+        return QVariant();
+    }
+}
+
+bool FirewallRuleModel::setData(const QModelIndex &index, const QVariant &value, int role)
+{
+    if (!index.isValid() || index.row() >= compiled.ruleCount())
+        return false;
+
+    if ((index.column() == EnabledColumn) != (role == Qt::CheckStateRole))
+        return false;
+    FirewallRule rule = compiled.ruleAt(index.row());
+    const QString text = value.toString().trimmed();
+    bool ok = true;
+    switch (index.column()) {
+    case EnabledColumn:
+        rule.enabled = value.toInt() == Qt::Checked;
+        break;
+    case ActionColumn:
+        if (text.compare("allow", Qt::CaseInsensitive) == 0)
+            rule.action = FirewallRule::Allow;
+        else if (text.compare("block", Qt::CaseInsensitive) == 0)
+            rule.action = FirewallRule::Block;
+        else
+            ok = false;
+        break;
+    case DirectionColumn:
+        if (text.isEmpty() || text.compare("any", Qt::CaseInsensitive) == 0)
+            rule.direction = FirewallRule::AnyDirection;
+        else if (text.compare("in", Qt::CaseInsensitive) == 0 || text.compare("inbound", Qt::CaseInsensitive) == 0)
+            rule.direction = FirewallRule::Inbound;
+        else if (text.compare("out", Qt::CaseInsensitive) == 0 || text.compare("outbound", Qt::CaseInsensitive) == 0)
+            rule.direction = FirewallRule::Outbound;
+        else
+            ok = false;
+        break;
+    case ProtocolColumn:
+        ok = parseProtocol(text, &rule.protocol);
+        break;
+    case RemoteColumn:
+        ok = rule.setRemote(text);
+        break;
+    case LocalPortsColumn:
+        ok = FirewallRule::parsePorts(text, &rule.localPortLow, &rule.localPortHigh);
+        break;
+    case RemotePortsColumn:
+        ok = FirewallRule::parsePorts(text, &rule.remotePortLow, &rule.remotePortHigh);
+        break;
+    case ProcessColumn:
+        rule.process = text.compare("any", Qt::CaseInsensitive) == 0 ? QString() : escapeField(text);
+        break;
+    case CommentColumn:
+        rule.comment = escapeField(value.toString());
+        break;
+    default:
+        return false;
+    }
+    if (!ok)
+        return false;
+
+    compiled.updateRule(rule);
+    emit dataChanged(index, index);
+    emit rulesChanged();
+    return true;
+}
+
+Qt::ItemFlags FirewallRuleModel::flags(const QModelIndex &index) const
+{
+    if (!index.isValid())
+        return Qt::NoItemFlags;
+    if (index.column() == EnabledColumn)
+        return Qt::ItemIsEnabled | Qt::ItemIsSelectable | Qt::ItemIsUserCheckable;
+    return Qt::ItemIsEnabled | Qt::ItemIsSelectable | Qt::ItemIsEditable;
+}
+
+QVariant FirewallRuleModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (role != Qt::DisplayRole)
+        return QVariant();
+    if (orientation == Qt::Vertical)
+        return section + 1;
+
+    switch (section) {
+    case EnabledColumn: return tr("On");
+    case ActionColumn: return tr("Action");
+    case DirectionColumn: return tr("Dir");
+    case ProtocolColumn: return tr("Proto");
+    case RemoteColumn: return tr("Remote address");
+    case LocalPortsColumn: return tr("Local ports");
+    case RemotePortsColumn: return tr("Remote ports");
+    case ProcessColumn: return tr("Process");
+    case CommentColumn: return tr("Comment");
+    default: return QVariant();
+    }
+}
+
+int FirewallRuleModel::addRule(int row)
+{
+    row = qBound(0, row, compiled.ruleCount());
+    FirewallRule rule;
+    rule.id = nextId++;
+    rule.enabled = false;
+    rule.direction = FirewallRule::Outbound;
+    beginInsertRows(QModelIndex(), row, row);
+    compiled.insertRule(row, rule);
+    endInsertRows();
+    emit rulesChanged();
+    return row;
+}
+
+void FirewallRuleModel::removeRule(int row)
+{
+    if (row < 0 || row >= compiled.ruleCount())
+        return;
+    beginRemoveRows(QModelIndex(), row, row);
+    compiled.removeRule(compiled.ruleAt(row).id);
+    endRemoveRows();
+    emit rulesChanged();
+}
+
+void FirewallRuleModel::moveRule(int from, int to)
+{
+    if (from == to || from < 0 || to < 0 || from >= compiled.ruleCount() || to >= compiled.ruleCount())
+        return;
+    // beginMoveRows takes the destination as the row the item lands in
+    // front of, before the move
+    if (!beginMoveRows(QModelIndex(), from, from, QModelIndex(), to > from ? to + 1 : to))
+        return;
+    compiled.moveRule(from, to);
+    endMoveRows();
+    emit rulesChanged();
+}
+
+bool FirewallRuleModel::load(const QString &path)
+{
+    QFile file(path);
+    if (!file.exists()) {
+        beginResetModel();
+        compiled.clear();
+        endResetModel();
+        emit rulesChanged();
+        return true;
+    }
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        lastError = file.errorString();
+        return false;
+    }
+
+    QVector<FirewallRule> rules;
+    int lineNumber = 0;
+    while (!file.atEnd()) {
+        ++lineNumber;
+        const QString line = QString::fromUtf8(file.readLine()).remove('\n').remove('\r');
+        if (line.trimmed().isEmpty() || line.startsWith('#'))
+            continue;
+        const QStringList fields = line.split('\t');
+        FirewallRule rule;
+        rule.id = quint32(rules.size() + 1);
+        bool ok = fields.size() == kFieldCount;
+        if (ok) {
+            rule.enabled = fields.at(0) == "1";
+            rule.action = fields.at(1) == "allow" ? FirewallRule::Allow : FirewallRule::Block;
+            rule.direction = fields.at(2) == "in" ? FirewallRule::Inbound
+                             : fields.at(2) == "out" ? FirewallRule::Outbound
+                                                     : FirewallRule::AnyDirection;
+            ok = parseProtocol(fields.at(3), &rule.protocol) && rule.setRemote(fields.at(4))
+                 && FirewallRule::parsePorts(fields.at(5), &rule.localPortLow, &rule.localPortHigh)
+                 && FirewallRule::parsePorts(fields.at(6), &rule.remotePortLow, &rule.remotePortHigh);
+            rule.process = fields.at(7);
+            rule.comment = fields.at(8);
+        }
+        if (!ok) {
+            lastError = tr("%1: line %2 is not a valid rule").arg(path).arg(lineNumber);
+            return false;
+        }
+        rules.append(rule);
+    }
+
+    beginResetModel();
+    compiled.setRules(rules);
+    nextId = quint32(rules.size() + 1);
+    endResetModel();
+    emit rulesChanged();
+    return true;
+}
+
+bool FirewallRuleModel::save(const QString &path) const
+{
+    QByteArray text = "# enabled\taction\tdirection\tprotocol\tremote\tlocal ports\tremote ports\tprocess\tcomment\n";
+    for (int row = 0; row < compiled.ruleCount(); ++row) {
+        const FirewallRule &rule = compiled.ruleAt(row);
+        const char *direction = rule.direction == FirewallRule::Inbound    ? "in"
+                                : rule.direction == FirewallRule::Outbound ? "out"
+                                                                           : "any";
+        const QStringList fields = {
+            rule.enabled ? "1" : "0",
+            rule.action == FirewallRule::Allow ? "allow" : "block",
+            direction,
+            protocolText(rule.protocol),
+            rule.remoteText(),
+            FirewallRule::portsText(rule.localPortLow, rule.localPortHigh),
+            FirewallRule::portsText(rule.remotePortLow, rule.remotePortHigh),
+            rule.process,
+            rule.comment
+        };
+        text += fields.join('\t').toUtf8() + '\n';
+    }
+
+    // Written beside the target and renamed over it, so a crash mid-save
+    // never leaves a truncated rule file
+    const QString temporaryPath = path + ".new";
+    QFile out(temporaryPath);
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        lastError = out.errorString();
+        return false;
+    }
+    const bool ok = out.write(text) == text.size();
+    out.close();
+    if (!ok || std::rename(QFile::encodeName(temporaryPath).constData(), QFile::encodeName(path).constData()) != 0) {
+        lastError = ok ? tr("Cannot replace %1").arg(path) : out.errorString();
+        QFile::remove(temporaryPath);
+        return false;
+    }
+    return true;
+}
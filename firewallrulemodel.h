@@ -0,0 +1,65 @@
+#ifndef FIREWALLRULEMODEL_H
+#define FIREWALLRULEMODEL_H
+
+#include <QAbstractTableModel>
+#include <QString>
+#include "firewallclassifier.h"
+
+// Editable rule list for the Network tab's firewall section. Owns the
+// compiled classifier and applies each edit to it incrementally, so the
+// connection table can classify against the rules as they are typed.
+//
+// Rules persist as one tab-separated line each, in the order the table
+// shows them:
+//   enabled  action  direction  protocol  remote  local ports  remote ports  process  comment
+class FirewallRuleModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+    enum Column {
+        EnabledColumn = 0,
+        ActionColumn,
+        DirectionColumn,
+        ProtocolColumn,
+        RemoteColumn,
+        LocalPortsColumn,
+        RemotePortsColumn,
+        ProcessColumn,
+        CommentColumn,
+        ColumnCount
+    };
+
+    explicit FirewallRuleModel(QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    bool setData(const QModelIndex &index, const QVariant &value, int role = Qt::EditRole) override;
+    Qt::ItemFlags flags(const QModelIndex &index) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+    // New rules start disabled so an unfinished one never matches
+    int addRule(int row);
+    void removeRule(int row);
+    void moveRule(int from, int to);
+
+    bool load(const QString &path);
+    bool save(const QString &path) const;
+    QString errorString() const { return lastError; }
+
+    const FirewallClassifier &classifier() const { return compiled; }
+
+    static QString protocolText(quint8 protocol);
+    static bool parseProtocol(const QString &text, quint8 *protocol);
+
+signals:
+    void rulesChanged();
+
+private:
+    FirewallClassifier compiled;
+    quint32 nextId = 1;
+    mutable QString lastError;
+};
+
+#endif // FIREWALLRULEMODEL_H
@@ -0,0 +1,503 @@
+#include "flowmetadata.h"
+#include <cstring>
+
+namespace {
+
+const int kJa3Limit = 4096;
+const int kMaxMethodLength = 8;
+
+const char *const kHttpMethods[] = { "GET", "POST", "HEAD", "PUT", "DELETE", "OPTIONS", "PATCH", "CONNECT", "TRACE" };
+
+quint16 read16(const uchar *p)
+{
+    return quint16(p[0] << 8 | p[1]);
+}
+
+quint32 read24(const uchar *p)
+{
+    return quint32(p[0]) << 16 | quint32(p[1]) << 8 | p[2];
+}
+
+// RFC 8701 reserved values, which JA3 leaves out so clients that
+// randomize them keep one fingerprint
+bool isGrease(quint16 value)
+{
+    return (value & 0x0f0f) == 0x0a0a && (value >> 8) == (value & 0xff);
+}
+
+// Bounds-checked cursor over a length-prefixed TLS structure
+struct Reader
+{
+    const uchar *p;
+    const uchar *end;
+
+    bool has(qint64 count) const { return end - p >= count; }
+    quint8 u8() { return *p++; }
+    quint16 u16() { const quint16 value = read16(p); p += 2; return value; }
+    // Splits off the next `length` bytes; false when they are not all there
+    bool take(qint64 length, Reader *part)
+    {
+        if (!has(length))
+            return false;
+        *part = { p, p + length };
+        p += length;
+        return true;
+    }
+};
+
+// The JA3 string is built on the stack and hashed once; a ClientHello
+// that does not fit is simply left without a fingerprint
+class Ja3Text
+{
+public:
+    void number(quint32 value)
+    {
+        char digits[10];
+        int count = 0;
+        do {
+            digits[count++] = char('0' + value % 10);
+            value /= 10;
+        } while (value);
+        if (length + count > kJa3Limit) {
+            overflow = true;
+            return;
+        }
+        while (count)
+            text[length++] = digits[--count];
+    }
+    void put(char c)
+    {
+        if (length < kJa3Limit)
+            text[length++] = c;
+        else
+            overflow = true;
+    }
+    void item(quint32 value, bool *first)
+    {
+        if (!*first)
+            put('-');
+        *first = false;
+        number(value);
+    }
+    // A list of 16-bit values without GREASE
+    void list16(Reader reader)
+    {
+        bool first = true;
+        while (reader.has(2)) {
+            const quint16 value = reader.u16();
+            if (!isGrease(value))
+                item(value, &first);
+        }
+    }
+
+    char text[kJa3Limit];
+    int length = 0;
+    bool overflow = false;
+};
+
+quint32 rotate(quint32 value, int bits)
+{
+    return value << bits | value >> (32 - bits);
+}
+
+// One RFC 1321 round step; F/G/H/I are the four round functions
+#define MD5_STEP(function, a, b, c, d, word, constant, shift) \
+    a = b + rotate(a + function(b, c, d) + (word) + constant, shift)
+#define MD5_F(x, y, z) (z ^ (x & (y ^ z)))
+#define MD5_G(x, y, z) (y ^ (z & (x ^ y)))
+#define MD5_H(x, y, z) (x ^ y ^ z)
+#define MD5_I(x, y, z) (y ^ (x | ~z))
+
+void md5Block(quint32 state[4], const uchar *block)
+{
+    quint32 w[16];
+    for (int i = 0; i < 16; ++i)
+        w[i] = quint32(block[i * 4]) | quint32(block[i * 4 + 1]) << 8 | quint32(block[i * 4 + 2]) << 16
+               | quint32(block[i * 4 + 3]) << 24;
+    quint32 a = state[0], b = state[1], c = state[2], d = state[3];
+
+    MD5_STEP(MD5_F, a, b, c, d, w[0], 0xd76aa478, 7);
+    MD5_STEP(MD5_F, d, a, b, c, w[1], 0xe8c7b756, 12);
+    MD5_STEP(MD5_F, c, d, a, b, w[2], 0x242070db, 17);
+    MD5_STEP(MD5_F, b, c, d, a, w[3], 0xc1bdceee, 22);
+    MD5_STEP(MD5_F, a, b, c, d, w[4], 0xf57c0faf, 7);
+    MD5_STEP(MD5_F, d, a, b, c, w[5], 0x4787c62a, 12);
+    MD5_STEP(MD5_F, c, d, a, b, w[6], 0xa8304613, 17);
+    MD5_STEP(MD5_F, b, c, d, a, w[7], 0xfd469501, 22);
+    MD5_STEP(MD5_F, a, b, c, d, w[8], 0x698098d8, 7);
+    MD5_STEP(MD5_F, d, a, b, c, w[9], 0x8b44f7af, 12);
+    MD5_STEP(MD5_F, c, d, a, b, w[10], 0xffff5bb1, 17);
+    MD5_STEP(MD5_F, b, c, d, a, w[11], 0x895cd7be, 22);
+    MD5_STEP(MD5_F, a, b, c, d, w[12], 0x6b901122, 7);
+    MD5_STEP(MD5_F, d, a, b, c, w[13], 0xfd987193, 12);
+    MD5_STEP(MD5_F, c, d, a, b, w[14], 0xa679438e, 17);
+    MD5_STEP(MD5_F, b, c, d, a, w[15], 0x49b40821, 22);
+
+    MD5_STEP(MD5_G, a, b, c, d, w[1], 0xf61e2562, 5);
+    MD5_STEP(MD5_G, d, a, b, c, w[6], 0xc040b340, 9);
+    MD5_STEP(MD5_G, c, d, a, b, w[11], 0x265e5a51, 14);
+    MD5_STEP(MD5_G, b, c, d, a, w[0], 0xe9b6c7aa, 20);
+    MD5_STEP(MD5_G, a, b, c, d, w[5], 0xd62f105d, 5);
+    MD5_STEP(MD5_G, d, a, b, c, w[10], 0x02441453, 9);
+    MD5_STEP(MD5_G, c, d, a, b, w[15], 0xd8a1e681, 14);
+    MD5_STEP(MD5_G, b, c, d, a, w[4], 0xe7d3fbc8, 20);
+    MD5_STEP(MD5_G, a, b, c, d, w[9], 0x21e1cde6, 5);
+    MD5_STEP(MD5_G, d, a, b, c, w[14], 0xc33707d6, 9);
+    MD5_STEP(MD5_G, c, d, a, b, w[3], 0xf4d50d87, 14);
+    MD5_STEP(MD5_G, b, c, d, a, w[8], 0x455a14ed, 20);
+    MD5_STEP(MD5_G, a, b, c, d, w[13], 0xa9e3e905, 5);
+    MD5_STEP(MD5_G, d, a, b, c, w[2], 0xfcefa3f8, 9);
+    MD5_STEP(MD5_G, c, d, a, b, w[7], 0x676f02d9, 14);
+    MD5_STEP(MD5_G, b, c, d, a, w[12], 0x8d2a4c8a, 20);
+
+    MD5_STEP(MD5_H, a, b, c, d, w[5], 0xfffa3942, 4);
+    MD5_STEP(MD5_H, d, a, b, c, w[8], 0x8771f681, 11);
+    MD5_STEP(MD5_H, c, d, a, b, w[11], 0x6d9d6122, 16);
+    MD5_STEP(MD5_H, b, c, d, a, w[14], 0xfde5380c, 23);
+    MD5_STEP(MD5_H, a, b, c, d, w[1], 0xa4beea44, 4);
+    MD5_STEP(MD5_H, d, a, b, c, w[4], 0x4bdecfa9, 11);
+    MD5_STEP(MD5_H, c, d, a, b, w[7], 0xf6bb4b60, 16);
+    MD5_STEP(MD5_H, b, c, d, a, w[10], 0xbebfbc70, 23);
+    MD5_STEP(MD5_H, a, b, c, d, w[13], 0x289b7ec6, 4);
+    MD5_STEP(MD5_H, d, a, b, c, w[0], 0xeaa127fa, 11);
+    MD5_STEP(MD5_H, c, d, a, b, w[3], 0xd4ef3085, 16);
+    MD5_STEP(MD5_H, b, c, d, a, w[6], 0x04881d05, 23);
+    MD5_STEP(MD5_H, a, b, c, d, w[9], 0xd9d4d039, 4);
+    MD5_STEP(MD5_H, d, a, b, c, w[12], 0xe6db99e5, 11);
+    MD5_STEP(MD5_H, c, d, a, b, w[15], 0x1fa27cf8, 16);
+    MD5_STEP(MD5_H, b, c, d, a, w[2], 0xc4ac5665, 23);
+
+    MD5_STEP(MD5_I, a, b, c, d, w[0], 0xf4292244, 6);
+    MD5_STEP(MD5_I, d, a, b, c, w[7], 0x432aff97, 10);
+    MD5_STEP(MD5_I, c, d, a, b, w[14], 0xab9423a7, 15);
+    MD5_STEP(MD5_I, b, c, d, a, w[5], 0xfc93a039, 21);
+    MD5_STEP(MD5_I, a, b, c, d, w[12], 0x655b59c3, 6);
+    MD5_STEP(MD5_I, d, a, b, c, w[3], 0x8f0ccc92, 10);
+    MD5_STEP(MD5_I, c, d, a, b, w[10], 0xffeff47d, 15);
+    MD5_STEP(MD5_I, b, c, d, a, w[1], 0x85845dd1, 21);
+    MD5_STEP(MD5_I, a, b, c, d, w[8], 0x6fa87e4f, 6);
+    MD5_STEP(MD5_I, d, a, b, c, w[15], 0xfe2ce6e0, 10);
+    MD5_STEP(MD5_I, c, d, a, b, w[6], 0xa3014314, 15);
+    MD5_STEP(MD5_I, b, c, d, a, w[13], 0x4e0811a1, 21);
+    MD5_STEP(MD5_I, a, b, c, d, w[4], 0xf7537e82, 6);
+    MD5_STEP(MD5_I, d, a, b, c, w[11], 0xbd3af235, 10);
+    MD5_STEP(MD5_I, c, d, a, b, w[2], 0x2ad7d2bb, 15);
+    MD5_STEP(MD5_I, b, c, d, a, w[9], 0xeb86d391, 21);
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
+
+#undef MD5_STEP
+#undef MD5_F
+#undef MD5_G
+#undef MD5_H
+#undef MD5_I
+
+// Plain RFC 1321 MD5; JA3 is defined over it, and hashing a few hundred
+// bytes per flow does not justify a QCryptographicHash allocation
+void md5(const uchar *data, int length, quint8 digest[16])
+{
+    quint32 state[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+    int offset = 0;
+    for (; offset + 64 <= length; offset += 64)
+        md5Block(state, data + offset);
+
+    // The tail, the 0x80 marker and the bit length fill one or two blocks
+    uchar tail[128] = {};
+    const int rest = length - offset;
+    memcpy(tail, data + offset, size_t(rest));
+    tail[rest] = 0x80;
+    const int tailLength = rest < 56 ? 64 : 128;
+    const quint64 bits = quint64(length) * 8;
+    for (int i = 0; i < 8; ++i)
+        tail[tailLength - 8 + i] = uchar(bits >> (8 * i));
+    for (int i = 0; i < tailLength; i += 64)
+        md5Block(state, tail + i);
+
+    for (int i = 0; i < 16; ++i)
+        digest[i] = quint8(state[i / 4] >> (8 * (i % 4)));
+}
+
+void setName(FlowMetadata *metadata, const uchar *text, int length)
+{
+    const int limit = int(sizeof(metadata->name));
+    if (length > limit) {
+        length = limit;
+        metadata->flags |= FlowMetadata::NameTruncated;
+    }
+    for (int i = 0; i < length; ++i) {
+        const uchar c = text[i];
+        metadata->name[i] = c >= 'A' && c <= 'Z' ? char(c + 32) : (c < 0x20 || c >= 0x7f ? '?' : char(c));
+    }
+    metadata->nameLength = quint8(length);
+}
+
+void setAlpn(FlowMetadata *metadata, const uchar *text, int length)
+{
+    length = qMin(length, int(sizeof(metadata->alpn)));
+    for (int i = 0; i < length; ++i)
+        metadata->alpn[i] = text[i] < 0x20 || text[i] >= 0x7f ? '?' : char(text[i]);
+    metadata->alpnLength = quint8(length);
+}
+
+bool startsWithNoCase(const uchar *text, int length, const char *prefix)
+{
+    const int prefixLength = int(strlen(prefix));
+    if (length < prefixLength)
+        return false;
+    for (int i = 0; i < prefixLength; ++i) {
+        if ((text[i] | 0x20) != uchar(prefix[i]))
+            return false;
+    }
+    return true;
+}
+
+} // namespace
+
+QString FlowMetadata::ja3Text() const
+{
+    if (!(flags & HasJa3))
+        return QString();
+    static const char kHex[] = "0123456789abcdef";
+    char text[32];
+    for (int i = 0; i < 16; ++i) {
+        text[i * 2] = kHex[ja3[i] >> 4];
+        text[i * 2 + 1] = kHex[ja3[i] & 0x0f];
+    }
+    return QString::fromLatin1(text, 32);
+}
+
+QString FlowMetadata::versionText() const
+{
+    switch (tlsVersion) {
+    case 0x0300: return "SSL 3.0";
+    case 0x0301: return "TLS 1.0";
+    case 0x0302: return "TLS 1.1";
+    case 0x0303: return "TLS 1.2";
+    case 0x0304: return "TLS 1.3";
+    default: return tlsVersion ? QString("TLS 0x%1").arg(tlsVersion, 4, 16, QChar('0')) : QString();
+    }
+}
+
+QString FlowMetadata::describe() const
+{
+    if (protocol == Unknown)
+        return QString();
+    QString text = protocol == Tls ? "TLS" : "HTTP";
+    if (nameLength) {
+        text += ' ';
+        text += nameText();
+    }
+    if (protocol == Tls && alpnLength)
+        text += QString(" (%1)").arg(alpnText());
+    return text;
+}
+
+namespace L7Extractor {
+
+Result extract(const uchar *payload, int length, FlowMetadata *metadata, int *totalLength)
+{
+    if (length <= 0)
+        return NotApplicable;
+    if (payload[0] == 0x16)
+        return parseClientHello(payload, length, metadata, totalLength);
+    return parseHttpRequest(payload, length, metadata);
+}
+
+Result parseClientHello(const uchar *record, int length, FlowMetadata *metadata, int *totalLength)
+{
+    // Record header, then the handshake header: type 1 and a 24-bit length
+    if (length < 9 || record[0] != 0x16 || record[1] != 0x03 || record[5] != 0x01)
+        return NotApplicable;
+    const int recordLength = read16(record + 3);
+    const qint64 helloLength = read24(record + 6);
+    // A ClientHello continued in a second record is not followed
+    if (recordLength > 16384 || helloLength + 4 > recordLength)
+        return NotApplicable;
+
+    *totalLength = 5 + recordLength;
+    const bool complete = length >= 9 + helloLength;
+    Reader hello = { record + 9, record + (complete ? 9 + helloLength : length) };
+
+    metadata->protocol = FlowMetadata::Tls;
+    if (!hello.has(2 + 32 + 1))
+        return complete ? Found : NeedMore;
+
+    Ja3Text ja3;
+    const quint16 clientVersion = hello.u16();
+    metadata->tlsVersion = clientVersion;
+    ja3.number(clientVersion);
+    ja3.put(',');
+    hello.p += 32;
+
+    Reader part;
+    bool whole = hello.take(hello.u8(), &part);
+    whole = whole && hello.has(2) && hello.take(hello.u16(), &part);
+    if (whole)
+        ja3.list16(part);
+    ja3.put(',');
+    whole = whole && hello.has(1) && hello.take(hello.u8(), &part);
+
+    Reader groups = { nullptr, nullptr };
+    Reader pointFormats = { nullptr, nullptr };
+    Reader extensions = { nullptr, nullptr };
+    // Extensions are walked even when the list is cut short by the end of
+    // the segment, so a split ClientHello still yields an early SNI
+    if (whole && hello.has(2)) {
+        const quint16 listLength = hello.u16();
+        if (!hello.take(listLength, &extensions)) {
+            extensions = hello;
+            whole = false;
+        }
+    }
+    bool first = true;
+    while (extensions.has(4)) {
+        const quint16 type = extensions.u16();
+        Reader body;
+        if (!extensions.take(extensions.u16(), &body)) {
+            whole = false;
+            break;
+        }
+        if (!isGrease(type))
+            ja3.item(type, &first);
+
+        switch (type) {
+        case 0x0000: {  // server_name: a list of (type, name); host_name is type 0
+            Reader names;
+            if (!body.has(2) || !body.take(body.u16(), &names))
+                break;
+            while (names.has(3)) {
+                const quint8 nameType = names.u8();
+                Reader name;
+                if (!names.take(names.u16(), &name))
+                    break;
+                if (nameType == 0 && metadata->nameLength == 0) {
+                    setName(metadata, name.p, int(name.end - name.p));
+                    break;
+                }
+            }
+            break;
+        }
+        case 0x0010: {  // application_layer_protocol_negotiation
+            Reader protocols;
+            if (body.has(2) && body.take(body.u16(), &protocols) && protocols.has(1)) {
+                Reader protocol;
+                if (protocols.take(protocols.u8(), &protocol))
+                    setAlpn(metadata, protocol.p, int(protocol.end - protocol.p));
+            }
+            break;
+        }
+        case 0x000a:  // supported_groups
+            if (body.has(2))
+                body.take(body.u16(), &groups);
+            break;
+        case 0x000b:  // ec_point_formats
+            if (body.has(1))
+                body.take(body.u8(), &pointFormats);
+            break;
+        case 0x002b: {  // supported_versions: the real offer when 1.3 is in it
+            Reader versions;
+            if (body.has(1) && body.take(body.u8(), &versions)) {
+                while (versions.has(2)) {
+                    const quint16 version = versions.u16();
+                    if (!isGrease(version) && version > metadata->tlsVersion)
+                        metadata->tlsVersion = version;
+                }
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    if (!complete)
+        return NeedMore;
+    if (whole) {
+        ja3.put(',');
+        ja3.list16(groups);
+        ja3.put(',');
+        bool firstFormat = true;
+        while (pointFormats.has(1))
+            ja3.item(pointFormats.u8(), &firstFormat);
+        if (!ja3.overflow) {
+            md5(reinterpret_cast<const uchar *>(ja3.text), ja3.length, metadata->ja3);
+            metadata->flags |= FlowMetadata::HasJa3;
+        }
+    }
+    return Found;
+}
+
+Result parseHttpRequest(const uchar *request, int length, FlowMetadata *metadata)
+{
+    // "METHOD SP target SP HTTP/1.x CRLF", then header lines up to an
+    // empty one; only the first segment is read
+    int methodLength = 0;
+    while (methodLength < length && methodLength <= kMaxMethodLength && request[methodLength] != ' ')
+        ++methodLength;
+    if (methodLength >= length || methodLength > kMaxMethodLength)
+        return NotApplicable;
+    bool known = false;
+    for (const char *method : kHttpMethods) {
+        if (int(strlen(method)) == methodLength && memcmp(method, request, size_t(methodLength)) == 0) {
+            known = true;
+            break;
+        }
+    }
+    if (!known)
+        return NotApplicable;
+
+    const uchar *end = request + length;
+    const uchar *line = static_cast<const uchar *>(memchr(request, '\n', size_t(length)));
+    if (!line) {
+        // A request line longer than the segment
+        metadata->protocol = FlowMetadata::Http;
+        return Found;
+    }
+    const uchar *version = line;
+    if (version[-1] == '\r')
+        --version;
+    if (version - request < methodLength + 10 || memcmp(version - 8, "HTTP/1.", 7) != 0)
+        return NotApplicable;
+
+    metadata->protocol = FlowMetadata::Http;
+    const uchar protocol[] = { 'h', 't', 't', 'p', '/', '1', '.', version[-1] };
+    setAlpn(metadata, protocol, 8);
+
+    while (line && line + 1 < end) {
+        const uchar *start = line + 1;
+        line = static_cast<const uchar *>(memchr(start, '\n', size_t(end - start)));
+        const uchar *lineEnd = line ? line : end;
+        if (lineEnd - start <= 1)
+            break;   // The empty line ending the headers
+        if (!line || !startsWithNoCase(start, int(lineEnd - start), "host:"))
+            continue;
+
+        const uchar *value = start + 5;
+        const uchar *valueEnd = lineEnd;
+        while (value < valueEnd && (*value == ' ' || *value == '\t'))
+            ++value;
+        while (valueEnd > value && (valueEnd[-1] == '\r' || valueEnd[-1] == ' ' || valueEnd[-1] == '\t'))
+            --valueEnd;
+        // Drop the port: after "]" for an IPv6 literal, else after the only ':'
+        const uchar *colon = nullptr;
+        for (const uchar *p = valueEnd; p > value; --p) {
+            if (p[-1] == ']')
+                break;
+            if (p[-1] == ':') {
+                colon = p - 1;
+                break;
+            }
+        }
+        if (colon && (*value == '[' || !memchr(value, ':', size_t(colon - value))))
+            valueEnd = colon;
+        setName(metadata, value, int(valueEnd - value));
+        break;
+    }
+    return Found;
+}
+
+} // namespace L7Extractor
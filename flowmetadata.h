@@ -0,0 +1,61 @@
+#ifndef FLOWMETADATA_H
+#define FLOWMETADATA_H
+
+#include <QString>
+
+// What the first client payload of a TCP flow says about the application:
+// the server name and ALPN from a TLS ClientHello (plus a JA3 fingerprint
+// of the client's TLS stack) or the Host of an HTTP/1 request. Fixed size
+// so it can sit beside flow entries and ride along in exported records.
+struct FlowMetadata
+{
+    enum Protocol : quint8 { Unknown = 0, Tls, Http };
+    enum Flags : quint8 {
+        HasJa3 = 0x01,         // The whole ClientHello was seen
+        NameTruncated = 0x02,
+        Reassembled = 0x04     // The ClientHello spanned several segments
+    };
+
+    quint8 protocol = Unknown;
+    quint8 flags = 0;
+    quint8 nameLength = 0;
+    quint8 alpnLength = 0;
+    quint16 tlsVersion = 0;    // Highest version offered, e.g. 0x0304
+    quint16 reserved = 0;
+    quint8 ja3[16];            // MD5 of the JA3 string when HasJa3
+    char alpn[16];             // First protocol offered ("h2"), or "http/1.1"
+    char name[120];            // SNI or Host, lowercase and without a port
+
+    QString nameText() const { return QString::fromLatin1(name, nameLength); }
+    QString alpnText() const { return QString::fromLatin1(alpn, alpnLength); }
+    QString ja3Text() const;
+    QString versionText() const;
+    // "TLS example.com (h2)", "HTTP example.com", or empty
+    QString describe() const;
+};
+
+static_assert(sizeof(FlowMetadata) == 160, "FlowMetadata is copied into every exported record");
+
+// Reads application metadata straight out of captured payload bytes: no
+// copies of the payload and no allocations, only bounds-checked reads.
+// Payload that is neither TLS nor HTTP/1 is rejected on its first bytes.
+namespace L7Extractor {
+
+enum Result {
+    NotApplicable,  // Not a ClientHello or HTTP request
+    NeedMore,       // A ClientHello continues past `length`; fields seen so far are filled in
+    Found
+};
+
+// `payload` is the start of the client's byte stream. On NeedMore,
+// *totalLength is the size of the whole ClientHello record.
+Result extract(const uchar *payload, int length, FlowMetadata *metadata, int *totalLength);
+Result parseClientHello(const uchar *record, int length, FlowMetadata *metadata, int *totalLength);
+Result parseHttpRequest(const uchar *request, int length, FlowMetadata *metadata);
+
+// Largest ClientHello record collected across segments
+const int kMaxClientHello = 16384 + 5;
+
+} // namespace L7Extractor
+
+#endif // FLOWMETADATA_H
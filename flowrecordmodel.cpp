@@ -0,0 +1,119 @@
+#include "flowrecordmodel.h"
+#include <QHostAddress>
+#include <QLocale>
+
+FlowRecordModel::FlowRecordModel(int maxRows, QObject *parent)
+    : QAbstractTableModel(parent), maxRows(maxRows)
+{
+}
+
+int FlowRecordModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : rows.size();
+}
+
+int FlowRecordModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : ColumnCount;
+}
+
+QString FlowRecordModel::formatEndpoint(const FlowRecord &record, bool endpointA) const
+{
+    const quint8 *bytes = endpointA ? record.addressA : record.addressB;
+    const quint16 port = endpointA ? record.portA : record.portB;
+    QHostAddress address;
+    if (record.ipVersion == 4) {
+        address.setAddress(quint32(bytes[0]) << 24 | quint32(bytes[1]) << 16 | quint32(bytes[2]) << 8 | bytes[3]);
+        return port ? QString("%1:%2").arg(address.toString()).arg(port) : address.toString();
+    }
+    address.setAddress(bytes);
+    return port ? QString("[%1]:%2").arg(address.toString()).arg(port) : address.toString();
+}
+
+QVariant FlowRecordModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= rows.size())
+        return QVariant();
+
+    const FlowRecord &record = rows.at(index.row());
+    if (role == Qt::ToolTipRole && index.column() == ApplicationColumn) {
+        const FlowMetadata &metadata = record.metadata;
+        if (metadata.protocol != FlowMetadata::Tls)
+            return QVariant();
+        QString text = metadata.versionText();
+        if (metadata.alpnLength)
+            text += QString(", ALPN %1").arg(metadata.alpnText());
+        if (metadata.flags & FlowMetadata::HasJa3)
+            text += QString("\nJA3 %1").arg(metadata.ja3Text());
+        return text;
+    }
+    if (role != Qt::DisplayRole)
+        return QVariant();
+
+    switch (index.column()) {
+    case ProtocolColumn: {
+        QString name = record.protocol == 6 ? "TCP" : record.protocol == 17 ? "UDP"
+                                                  : QString("IP/%1").arg(record.protocol);
+        return record.ipVersion == 6 ? name + "6" : name;
+    }
+    case InitiatorColumn:
+        return formatEndpoint(record, !record.initiatorIsB);
+    case ResponderColumn:
+        return formatEndpoint(record, record.initiatorIsB);
+    case ApplicationColumn:
+        return record.metadata.describe();
+    case PacketsColumn:
+        return QLocale().toString(record.packets);
+    case BytesColumn:
+        return QLocale().formattedDataSize(qint64(record.bytes));
+    case DurationColumn:
+        return QString("%1 s").arg((record.lastSeenNs - record.firstSeenNs) / 1e9, 0, 'f', 1);
+    case ReasonColumn:
+        switch (record.reason) {
+        case FlowRecord::IdleTimeout: return "Idle";
+        case FlowRecord::ActiveTimeout: return "Active (exported)";
+        case FlowRecord::Closed: return "Closed";
+        case FlowRecord::Evicted: return "Evicted";
+        }
+        return QVariant();
+    default:
+        return QVariant();
+    }
+}
+
+QVariant FlowRecordModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation != Qt::Horizontal || role != Qt::DisplayRole)
+        return QVariant();
+
+    switch (section) {
+    case ProtocolColumn: return tr("Proto");
+    case InitiatorColumn: return tr("Initiator");
+    case ResponderColumn: return tr("Responder");
+    case ApplicationColumn: return tr("Application");
+    case PacketsColumn: return tr("Packets");
+    case BytesColumn: return tr("Bytes");
+    case DurationColumn: return tr("Duration");
+    case ReasonColumn: return tr("Ended");
+    default: return QVariant();
+    }
+}
+
+void FlowRecordModel::appendRecords(const QVector<FlowRecord> &records)
+{
+    if (records.isEmpty())
+        return;
+
+    // Only the newest maxRows records can survive the append
+    const int incoming = qMin(int(records.size()), maxRows);
+    const int overflow = rows.size() + incoming - maxRows;
+    if (overflow > 0) {
+        beginRemoveRows(QModelIndex(), 0, overflow - 1);
+        rows.remove(0, overflow);
+        endRemoveRows();
+    }
+
+    beginInsertRows(QModelIndex(), rows.size(), rows.size() + incoming - 1);
+    rows.append(records.mid(records.size() - incoming));
+    endInsertRows();
+}
@@ -0,0 +1,43 @@
+#ifndef FLOWRECORDMODEL_H
+#define FLOWRECORDMODEL_H
+
+#include <QAbstractTableModel>
+#include <QVector>
+#include "flowtable.h"
+
+// Most recently finished (or actively exported) flows, oldest first and
+// capped at a fixed number of rows; the oldest rows fall off the top.
+class FlowRecordModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+    enum Column {
+        ProtocolColumn = 0,
+        InitiatorColumn,
+        ResponderColumn,
+        ApplicationColumn,
+        PacketsColumn,
+        BytesColumn,
+        DurationColumn,
+        ReasonColumn,
+        ColumnCount
+    };
+
+    explicit FlowRecordModel(int maxRows, QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+    void appendRecords(const QVector<FlowRecord> &records);
+
+private:
+    QString formatEndpoint(const FlowRecord &record, bool endpointA) const;
+
+    int maxRows;
+    QVector<FlowRecord> rows;
+};
+
+#endif // FLOWRECORDMODEL_H
@@ -0,0 +1,798 @@
+#include "flowtable.h"
+#include <QMutexLocker>
+#include <cstring>
+#include <limits>
+#include <new>
+
+#ifdef Q_OS_LINUX
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+const int kWheelLevels = 4;
+const int kWheelBits = 6;
+const int kWheelSlots = 1 << kWheelBits;
+const quint64 kWheelMask = kWheelSlots - 1;
+const quint32 kCentisecondsPerTick = 10;          // 100 ms
+const quint32 kCloseTimerItem = 0x80000000u;      // Item bit: FIN/RST timer
+const int kEvictionCandidates = 8;
+const int kPrefetchGroup = 16;
+const int kMaxPendingRecordsPerShard = 4096;
+const int kReassembliesPerShard = 4;
+const quint32 kNoSlot = 0xffffffffu;
+const qint64 kUnsetBase = std::numeric_limits<qint64>::min();
+const quint8 kTcpFin = 0x01;
+const quint8 kTcpRst = 0x04;
+
+quint64 mix(quint64 h, quint64 word)
+{
+    h = (h ^ word) * 0xbf58476d1ce4e5b9ull;
+    return h ^ (h >> 31);
+}
+
+// Hashes the canonical key, so both directions of a flow agree
+quint64 flowHash(const FlowEntry &key)
+{
+    quint64 words[4];
+    memcpy(words, key.addressA, 16);
+    memcpy(words + 2, key.addressB, 16);
+    quint64 h = 0x9e3779b97f4a7c15ull;
+    for (quint64 word : words)
+        h = mix(h, word);
+    h = mix(h, quint64(key.portA) << 32 | quint64(key.portB) << 16 | quint64(key.protocol) << 8 | key.ipVersion);
+    h ^= h >> 29;
+    h *= 0x94d049bb133111ebull;
+    return h ^ (h >> 32);
+}
+
+// Maps a 32-bit hash onto [0, range) without a division
+quint32 reduce(quint32 hash, quint32 range)
+{
+    return quint32((quint64(hash) * range) >> 32);
+}
+
+bool sameKey(const FlowEntry &a, const FlowEntry &b)
+{
+    return a.portA == b.portA && a.portB == b.portB && a.protocol == b.protocol
+           && a.ipVersion == b.ipVersion && memcmp(a.addressA, b.addressA, 16) == 0
+           && memcmp(a.addressB, b.addressB, 16) == 0;
+}
+
+bool isClosing(const FlowEntry &entry)
+{
+    return entry.protocol == 6 && (entry.tcpFlags & (kTcpFin | kTcpRst));
+}
+
+// Fills the canonical key for a packet; returns true when the packet's
+// source is endpoint B
+bool canonicalKey(const PacketView &packet, FlowEntry &key)
+{
+    memset(&key, 0, sizeof(key));
+    const int length = packet.addressLength();
+    const uchar *source = packet.sourceAddress();
+    const uchar *destination = packet.destinationAddress();
+    int order = memcmp(source, destination, size_t(length));
+    if (order == 0)
+        order = packet.sourcePort < packet.destinationPort ? -1 : (packet.sourcePort > packet.destinationPort ? 1 : 0);
+    const bool reversed = order > 0;
+
+    memcpy(key.addressA, reversed ? destination : source, size_t(length));
+    memcpy(key.addressB, reversed ? source : destination, size_t(length));
+    key.portA = reversed ? packet.destinationPort : packet.sourcePort;
+    key.portB = reversed ? packet.sourcePort : packet.destinationPort;
+    key.protocol = packet.protocol;
+    key.ipVersion = packet.ipVersion;
+    return reversed;
+}
+
+// Zeroed, cache-line aligned and lazily committed: untouched slots of a
+// large table cost address space, not memory
+FlowEntry *allocateEntries(quint32 count)
+{
+    const size_t bytes = size_t(count) * sizeof(FlowEntry);
+#ifdef Q_OS_LINUX
+    void *mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapped == MAP_FAILED)
+        throw std::bad_alloc();
+    // Every lookup lands on a random line; 2MB pages keep that to one
+    // cache miss instead of a cache miss plus a page walk
+    madvise(mapped, bytes, MADV_HUGEPAGE);
+    return static_cast<FlowEntry *>(mapped);
+#else
+    void *memory = ::operator new(bytes, std::align_val_t(alignof(FlowEntry)));
+    memset(memory, 0, bytes);
+    return static_cast<FlowEntry *>(memory);
+#endif
+}
+
+void freeEntries(FlowEntry *entries, quint32 count)
+{
+    if (!entries)
+        return;
+#ifdef Q_OS_LINUX
+    munmap(entries, size_t(count) * sizeof(FlowEntry));
+#else
+    Q_UNUSED(count);
+    ::operator delete(entries, std::align_val_t(alignof(FlowEntry)));
+#endif
+}
+
+// A ClientHello being collected from in-order segments. The buffer is
+// allocated the first time the slot is used and kept for reuse.
+struct Reassembly
+{
+    quint32 slot = kNoSlot;
+    quint32 nextSequence = 0;
+    int length = 0;
+    int expected = 0;
+    std::unique_ptr<uchar[]> buffer;
+};
+
+inline void prefetch(const void *address)
+{
+#if defined(__GNUC__)
+    __builtin_prefetch(address, 1);
+#else
+    Q_UNUSED(address);
+#endif
+}
+
+} // namespace
+
+struct alignas(64) FlowTable::Shard
+{
+    QMutex mutex;
+    FlowEntry *entries = nullptr;
+    std::atomic<FlowEntry *> prefetchBase { nullptr };  // Same as entries; read unlocked
+    quint32 slotCount = 0;
+    quint32 capacity = 0;
+    quint32 live = 0;
+    quint32 tombstones = 0;
+
+    std::vector<quint32> wheel[kWheelLevels][kWheelSlots];
+    std::vector<quint32> firing;
+    quint64 currentTick = 0;
+    quint64 timerItems = 0;
+
+    quint64 packets = 0;
+    quint64 created = 0;
+    quint64 evictions = 0;
+    quint64 idleExpiries = 0;
+    quint64 closedExpiries = 0;
+    quint64 activeExports = 0;
+    quint64 droppedRecords = 0;
+    quint64 rebuilds = 0;
+    quint64 probeHistogram[16] = {};
+    quint64 maxProbe = 0;
+    QVector<FlowRecord> exported;
+
+    // Metadata of entries with HasMetadata: metadataIndex maps a slot to
+    // its place in the pool, which only grows and recycles freed places,
+    // so storing a flow's metadata allocates nothing in steady state
+    std::vector<quint32> metadataIndex;
+    std::vector<FlowMetadata> metadata;
+    std::vector<quint32> freeMetadata;
+    Reassembly reassemblies[kReassembliesPerShard];
+    quint64 tlsFlows = 0;
+    quint64 httpFlows = 0;
+    quint64 reassembled = 0;
+    quint64 reassemblyFailures = 0;
+};
+
+double FlowTableStats::averageProbe() const
+{
+    quint64 lookups = 0;
+    quint64 total = 0;
+    for (int i = 0; i < 16; ++i) {
+        lookups += probeHistogram[i];
+        total += probeHistogram[i] * quint64(i);
+    }
+    return lookups ? double(total) / double(lookups) : 0;
+}
+
+FlowTable::FlowTable(quint64 maxFlows, int shardCount)
+    : baseNs(kUnsetBase)
+{
+    init(maxFlows, shardCount);
+}
+
+FlowTable::FlowTable(quint64 maxFlows, int shardCount, const Timeouts &timeouts)
+    : timeouts(timeouts), baseNs(kUnsetBase)
+{
+    init(maxFlows, shardCount);
+}
+
+FlowTable::~FlowTable()
+{
+    for (const std::unique_ptr<Shard> &shard : shards)
+        freeEntries(shard->entries, shard->slotCount);
+}
+
+void FlowTable::init(quint64 maxFlows, int shardCount)
+{
+    while ((1 << shardBits) < qBound(1, shardCount, 1024))
+        ++shardBits;
+    // Hashing never splits flows perfectly evenly; a little slack per
+    // shard lets the table reach maxFlows before any shard evicts
+    quint64 perShard = (maxFlows + (1ull << shardBits) - 1) >> shardBits;
+    perShard = qMax<quint64>(perShard + perShard / 64 + 64, 16);
+
+    shards.resize(size_t(1) << shardBits);
+    for (std::unique_ptr<Shard> &shard : shards) {
+        shard.reset(new Shard());
+        // Linear probing stays short below 75% load
+        shard->capacity = quint32(qMin<quint64>(perShard, 0x7fffffffu / 2));
+        shard->slotCount = shard->capacity + shard->capacity / 3 + 1;
+        shard->entries = allocateEntries(shard->slotCount);
+        shard->prefetchBase.store(shard->entries);
+    }
+}
+
+int FlowTable::shardOf(const PacketView &packet) const
+{
+    if (packet.ipVersion == 0)
+        return 0;
+    FlowEntry key;
+    canonicalKey(packet, key);
+    return shardBits ? int(flowHash(key) >> (64 - shardBits)) : 0;
+}
+
+quint32 FlowTable::centisecondsFor(qint64 nowNs)
+{
+    // The first timestamp seen becomes the time base, so replayed files
+    // age flows on their own clock
+    qint64 base = baseNs.load(std::memory_order_relaxed);
+    if (base == kUnsetBase) {
+        const qint64 candidate = nowNs - nowNs % 10000000;
+        baseNs.compare_exchange_strong(base, candidate);
+        base = baseNs.load();
+    }
+    if (nowNs <= base)
+        return 0;
+    return quint32(qMin<qint64>((nowNs - base) / 10000000, std::numeric_limits<quint32>::max() / 2));
+}
+
+quint32 FlowTable::idleTimeoutCs(const FlowEntry &entry) const
+{
+    if (isClosing(entry))
+        return timeouts.closedSeconds * 100;
+    if (entry.protocol == 6)
+        return timeouts.tcpIdleSeconds * 100;
+    if (entry.protocol == 17)
+        return timeouts.udpIdleSeconds * 100;
+    return timeouts.otherIdleSeconds * 100;
+}
+
+quint64 FlowTable::prepareKey(const PacketView &packet, FlowEntry &key) const
+{
+    const bool reversed = canonicalKey(packet, key);
+    const quint64 hash = flowHash(key);
+    key.hash = quint32(hash);
+    key.state = reversed ? quint8(FlowEntry::InitiatorIsB) : quint8(0);
+    return hash;
+}
+
+void FlowTable::onPackets(const PacketView *packets, int count)
+{
+    // Hash a group of packets and prefetch their home slots before
+    // touching any of them, so the cache misses overlap
+    FlowEntry keys[kPrefetchGroup];
+    quint64 hashes[kPrefetchGroup];
+    qint64 latest = 0;
+    for (int start = 0; start < count; start += kPrefetchGroup) {
+        const int group = qMin(kPrefetchGroup, count - start);
+        for (int i = 0; i < group; ++i) {
+            const PacketView &packet = packets[start + i];
+            latest = qMax(latest, packet.timestampNs);
+            if (packet.ipVersion == 0)
+                continue;
+            hashes[i] = prepareKey(packet, keys[i]);
+            Shard &shard = shardFor(hashes[i]);
+            prefetch(shard.prefetchBase.load(std::memory_order_relaxed) + reduce(keys[i].hash, shard.slotCount));
+        }
+        for (int i = 0; i < group; ++i) {
+            const PacketView &packet = packets[start + i];
+            if (packet.ipVersion == 0)
+                nonIpPackets.fetch_add(1, std::memory_order_relaxed);
+            else
+                apply(packet, keys[i], hashes[i]);
+        }
+    }
+    if (count > 0)
+        advance(latest);
+}
+
+void FlowTable::onIdle(qint64 nowNs)
+{
+    advance(nowNs);
+}
+
+bool FlowTable::update(const PacketView &packet)
+{
+    if (packet.ipVersion == 0) {
+        nonIpPackets.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    FlowEntry key;
+    const quint64 hash = prepareKey(packet, key);
+    apply(packet, key, hash);
+    return true;
+}
+
+void FlowTable::apply(const PacketView &packet, const FlowEntry &key, quint64 hash)
+{
+    const quint32 nowCs = centisecondsFor(packet.timestampNs);
+
+    Shard &shard = shardFor(hash);
+    QMutexLocker lock(&shard.mutex);
+    ++shard.packets;
+
+    FlowEntry *entry = findOrInsert(shard, key, nowCs);
+    const bool wasClosing = isClosing(*entry);
+    entry->packets += 1;
+    entry->bytes += packet.wireLength;
+    entry->lastSeen = qMax(entry->lastSeen, nowCs);
+    entry->tcpFlags |= packet.tcpFlags;
+
+    // Only the initiator's first payload is read, so every other packet
+    // pays for one flag test
+    if (inspection && packet.payloadLength > 0 && entry->protocol == 6 && !(entry->state & FlowEntry::Inspected)
+        && (key.state & FlowEntry::InitiatorIsB) == (entry->state & FlowEntry::InitiatorIsB))
+        inspect(shard, *entry, packet);
+
+    // Deadlines only move later as packets arrive, which the idle item
+    // handles lazily; FIN/RST moves it earlier and needs its own item
+    if (!wasClosing && isClosing(*entry) && !(entry->state & FlowEntry::CloseTimerArmed)) {
+        entry->state |= FlowEntry::CloseTimerArmed;
+        schedule(shard, quint32(entry - shard.entries) | kCloseTimerItem, nowCs + timeouts.closedSeconds * 100);
+    }
+
+    if (shard.tombstones > shard.slotCount / 16)
+        rebuild(shard);
+}
+
+FlowEntry *FlowTable::findOrInsert(Shard &shard, const FlowEntry &key, quint32 nowCs)
+{
+    FlowEntry *entries = shard.entries;
+    quint32 index = reduce(key.hash, shard.slotCount);
+    qint64 freeSlot = -1;
+    qint64 oldest = -1;
+    int liveSeen = 0;
+    quint32 probe = 0;
+
+    for (;; ++probe) {
+        FlowEntry &entry = entries[index];
+        const quint8 slotState = entry.slotState();
+        if (slotState == FlowEntry::Empty) {
+            if (freeSlot < 0)
+                freeSlot = index;
+            break;
+        }
+        if (slotState == FlowEntry::Deleted) {
+            if (freeSlot < 0)
+                freeSlot = index;
+        } else if (entry.hash == key.hash && sameKey(entry, key)) {
+            ++shard.probeHistogram[qMin<quint32>(probe, 15)];
+            shard.maxProbe = qMax<quint64>(shard.maxProbe, probe);
+            return &entry;
+        } else if (liveSeen++ < kEvictionCandidates
+                   && (oldest < 0 || entry.lastSeen < entries[oldest].lastSeen)) {
+            oldest = index;
+        }
+        if (++index == shard.slotCount)
+            index = 0;
+    }
+    ++shard.probeHistogram[qMin<quint32>(probe, 15)];
+    shard.maxProbe = qMax<quint64>(shard.maxProbe, probe);
+
+    quint32 target = quint32(freeSlot);
+    if (shard.live >= shard.capacity) {
+        ++shard.evictions;
+        if (oldest >= 0) {
+            // Reuse the victim's slot in place: no tombstone, and its
+            // idle timer item carries over to the new flow
+            target = quint32(oldest);
+            exportFlow(shard, entries[target], FlowRecord::Evicted);
+            forgetInspection(shard, entries[target]);
+            --shard.live;
+        } else {
+            // The new key's chain holds no live flows; evict from the
+            // neighbourhood instead
+            quint32 scan = reduce(key.hash, shard.slotCount);
+            qint64 victim = -1;
+            for (int seen = 0; seen < kEvictionCandidates;) {
+                if (entries[scan].slotState() == FlowEntry::Live) {
+                    if (victim < 0 || entries[scan].lastSeen < entries[victim].lastSeen)
+                        victim = scan;
+                    ++seen;
+                }
+                if (++scan == shard.slotCount)
+                    scan = 0;
+            }
+            expire(shard, quint32(victim), FlowRecord::Evicted, 0);
+            ++shard.tombstones;
+        }
+    }
+
+    FlowEntry &entry = entries[target];
+    if (entry.slotState() == FlowEntry::Deleted)
+        --shard.tombstones;
+    const quint8 armed = entry.state & (FlowEntry::IdleTimerArmed | FlowEntry::CloseTimerArmed);
+    entry = key;
+    entry.state = FlowEntry::Live | armed | (key.state & FlowEntry::InitiatorIsB);
+    entry.firstSeen = nowCs;
+    entry.lastSeen = nowCs;
+    ++shard.live;
+    ++shard.created;
+
+    if (!(armed & FlowEntry::IdleTimerArmed)) {
+        entry.state |= FlowEntry::IdleTimerArmed;
+        schedule(shard, target, nowCs + qMin(idleTimeoutCs(entry), timeouts.activeSeconds * 100));
+    }
+    return &entry;
+}
+
+void FlowTable::expire(Shard &shard, quint32 index, FlowRecord::Reason reason, quint8 consumedTimer)
+{
+    FlowEntry &entry = shard.entries[index];
+    exportFlow(shard, entry, reason);
+    forgetInspection(shard, entry);
+    // Whichever timer items remain in the wheel keep their armed bits so
+    // a later occupant of the slot does not queue duplicates
+    entry.state = FlowEntry::Deleted | (entry.state & (FlowEntry::IdleTimerArmed | FlowEntry::CloseTimerArmed) & ~consumedTimer);
+    --shard.live;
+}
+
+void FlowTable::exportFlow(Shard &shard, const FlowEntry &entry, FlowRecord::Reason reason)
+{
+    if (shard.exported.size() >= kMaxPendingRecordsPerShard) {
+        ++shard.droppedRecords;
+        return;
+    }
+    const qint64 base = baseNs.load(std::memory_order_relaxed);
+    FlowRecord record;
+    memcpy(record.addressA, entry.addressA, 16);
+    memcpy(record.addressB, entry.addressB, 16);
+    record.portA = entry.portA;
+    record.portB = entry.portB;
+    record.protocol = entry.protocol;
+    record.ipVersion = entry.ipVersion;
+    record.tcpFlags = entry.tcpFlags;
+    record.reason = reason;
+    record.initiatorIsB = entry.state & FlowEntry::InitiatorIsB;
+    record.packets = entry.packets;
+    record.bytes = entry.bytes;
+    record.firstSeenNs = base + qint64(entry.firstSeen) * 10000000;
+    record.lastSeenNs = base + qint64(entry.lastSeen) * 10000000;
+    if (entry.state & FlowEntry::HasMetadata)
+        record.metadata = shard.metadata[shard.metadataIndex[size_t(&entry - shard.entries)]];
+    shard.exported.append(record);
+}
+
+void FlowTable::inspect(Shard &shard, FlowEntry &entry, const PacketView &packet)
+{
+    const quint32 index = quint32(&entry - shard.entries);
+    const uchar *payload = packet.payload();
+    int length = packet.payloadLength;
+    FlowMetadata metadata;
+    int total = 0;
+
+    if (entry.state & FlowEntry::Reassembling) {
+        Reassembly *pending = nullptr;
+        for (Reassembly &reassembly : shard.reassemblies) {
+            if (reassembly.slot == index)
+                pending = &reassembly;
+        }
+        // Segments that overlap what was collected (retransmissions) are
+        // trimmed; a gap ends collection with the fields seen so far
+        const qint32 offset = qint32(packet.tcpSequence - pending->nextSequence);
+        if (offset < 0) {
+            if (-offset >= length)
+                return;
+            payload -= offset;
+            length += offset;
+        }
+        if (offset <= 0) {
+            const int take = qMin(length, pending->expected - pending->length);
+            memcpy(pending->buffer.get() + pending->length, payload, size_t(take));
+            pending->length += take;
+            pending->nextSequence += quint32(length);
+            if (pending->length < pending->expected)
+                return;
+        }
+        if (L7Extractor::parseClientHello(pending->buffer.get(), pending->length, &metadata, &total) == L7Extractor::Found) {
+            metadata.flags |= FlowMetadata::Reassembled;
+            ++shard.reassembled;
+        } else {
+            ++shard.reassemblyFailures;
+        }
+        pending->slot = kNoSlot;
+        entry.state &= quint8(~FlowEntry::Reassembling);
+        finishInspection(shard, entry, metadata);
+        return;
+    }
+
+    if (L7Extractor::extract(payload, length, &metadata, &total) == L7Extractor::NeedMore) {
+        for (Reassembly &reassembly : shard.reassemblies) {
+            if (reassembly.slot != kNoSlot)
+                continue;
+            if (!reassembly.buffer)
+                reassembly.buffer.reset(new uchar[L7Extractor::kMaxClientHello]);
+            memcpy(reassembly.buffer.get(), payload, size_t(length));
+            reassembly.slot = index;
+            reassembly.length = length;
+            reassembly.expected = total;
+            reassembly.nextSequence = packet.tcpSequence + quint32(length);
+            entry.state |= FlowEntry::Reassembling;
+            return;
+        }
+        ++shard.reassemblyFailures;
+    }
+    finishInspection(shard, entry, metadata);
+}
+
+void FlowTable::finishInspection(Shard &shard, FlowEntry &entry, const FlowMetadata &metadata)
+{
+    entry.state |= FlowEntry::Inspected;
+    if (metadata.protocol == FlowMetadata::Unknown)
+        return;
+    if (metadata.protocol == FlowMetadata::Tls)
+        ++shard.tlsFlows;
+    else
+        ++shard.httpFlows;
+    if (shard.metadataIndex.empty())
+        shard.metadataIndex.resize(shard.slotCount);
+    quint32 place;
+    if (shard.freeMetadata.empty()) {
+        place = quint32(shard.metadata.size());
+        shard.metadata.push_back(metadata);
+    } else {
+        place = shard.freeMetadata.back();
+        shard.freeMetadata.pop_back();
+        shard.metadata[place] = metadata;
+    }
+    shard.metadataIndex[size_t(&entry - shard.entries)] = place;
+    entry.state |= FlowEntry::HasMetadata;
+}
+
+// Drops whatever is stored beside an entry that is leaving its slot
+void FlowTable::forgetInspection(Shard &shard, FlowEntry &entry)
+{
+    const quint32 index = quint32(&entry - shard.entries);
+    if (entry.state & FlowEntry::HasMetadata)
+        shard.freeMetadata.push_back(shard.metadataIndex[index]);
+    if (entry.state & FlowEntry::Reassembling) {
+        for (Reassembly &reassembly : shard.reassemblies) {
+            if (reassembly.slot == index)
+                reassembly.slot = kNoSlot;
+        }
+    }
+    entry.state &= quint8(~(FlowEntry::HasMetadata | FlowEntry::Reassembling));
+}
+
+void FlowTable::schedule(Shard &shard, quint32 item, quint32 deadlineCs)
+{
+    // Round up so an item never fires before its deadline
+    quint64 deadline = (quint64(deadlineCs) + kCentisecondsPerTick - 1) / kCentisecondsPerTick;
+    deadline = qMax(deadline, shard.currentTick + 1);
+    const quint64 delta = deadline - shard.currentTick;
+
+    int level = 0;
+    while (level < kWheelLevels - 1 && delta >= (quint64(1) << (kWheelBits * (level + 1))))
+        ++level;
+    if (level == kWheelLevels - 1)
+        deadline = qMin(deadline, shard.currentTick + (quint64(1) << (kWheelBits * kWheelLevels)) - 1);
+
+    shard.wheel[level][(deadline >> (kWheelBits * level)) & kWheelMask].push_back(item);
+    ++shard.timerItems;
+}
+
+void FlowTable::processTimer(Shard &shard, quint32 item, quint32 nowCs)
+{
+    const quint32 index = item & ~kCloseTimerItem;
+    const quint8 timerBit = (item & kCloseTimerItem) ? quint8(FlowEntry::CloseTimerArmed) : quint8(FlowEntry::IdleTimerArmed);
+    FlowEntry &entry = shard.entries[index];
+
+    if (entry.slotState() != FlowEntry::Live) {
+        entry.state &= quint8(~timerBit);
+        return;
+    }
+
+    const quint32 idleDeadline = entry.lastSeen + idleTimeoutCs(entry);
+    if (item & kCloseTimerItem) {
+        if (!isClosing(entry)) {
+            // A stale item from the slot's previous occupant
+            entry.state &= quint8(~timerBit);
+        } else if (nowCs >= idleDeadline) {
+            ++shard.closedExpiries;
+            expire(shard, index, FlowRecord::Closed, timerBit);
+            ++shard.tombstones;
+        } else {
+            schedule(shard, item, idleDeadline);
+        }
+        return;
+    }
+
+    if (nowCs >= idleDeadline) {
+        if (isClosing(entry))
+            ++shard.closedExpiries;
+        else
+            ++shard.idleExpiries;
+        expire(shard, index, isClosing(entry) ? FlowRecord::Closed : FlowRecord::IdleTimeout, timerBit);
+        ++shard.tombstones;
+        return;
+    }
+
+    quint32 activeDeadline = entry.firstSeen + timeouts.activeSeconds * 100;
+    if (nowCs >= activeDeadline) {
+        if (entry.packets > 0) {
+            ++shard.activeExports;
+            exportFlow(shard, entry, FlowRecord::ActiveTimeout);
+        }
+        entry.packets = 0;
+        entry.bytes = 0;
+        entry.firstSeen = nowCs;
+        activeDeadline = nowCs + timeouts.activeSeconds * 100;
+    }
+    schedule(shard, item, qMin(idleDeadline, activeDeadline));
+}
+
+void FlowTable::advanceShard(Shard &shard, quint64 tick, quint32 nowCs)
+{
+    while (shard.currentTick < tick) {
+        if (shard.timerItems == 0) {
+            shard.currentTick = tick;
+            break;
+        }
+        const quint64 current = ++shard.currentTick;
+
+        // Entering a new span of a coarser level: pull its bucket down.
+        // Items are re-queued from the entry's own deadline, so a bucket
+        // is simply fired early and sorts itself out.
+        for (int level = kWheelLevels - 1; level > 0; --level) {
+            if ((current & ((quint64(1) << (kWheelBits * level)) - 1)) != 0)
+                continue;
+            std::vector<quint32> &bucket = shard.wheel[level][(current >> (kWheelBits * level)) & kWheelMask];
+            if (bucket.empty())
+                continue;
+            shard.firing.swap(bucket);
+            shard.timerItems -= shard.firing.size();
+            for (quint32 item : shard.firing)
+                processTimer(shard, item, nowCs);
+            shard.firing.clear();
+        }
+
+        std::vector<quint32> &bucket = shard.wheel[0][current & kWheelMask];
+        if (bucket.empty())
+            continue;
+        shard.firing.swap(bucket);
+        shard.timerItems -= shard.firing.size();
+        for (quint32 item : shard.firing)
+            processTimer(shard, item, nowCs);
+        shard.firing.clear();
+    }
+}
+
+void FlowTable::advance(qint64 nowNs)
+{
+    const quint32 nowCs = centisecondsFor(nowNs);
+    const quint64 tick = nowCs / kCentisecondsPerTick;
+    quint64 previous = advancedTick.load(std::memory_order_relaxed);
+    if (tick <= previous || !advancedTick.compare_exchange_strong(previous, tick))
+        return;
+
+    for (const std::unique_ptr<Shard> &shard : shards) {
+        QMutexLocker lock(&shard->mutex);
+        advanceShard(*shard, tick, nowCs);
+        if (shard->tombstones > shard->slotCount / 16)
+            rebuild(*shard);
+    }
+}
+
+void FlowTable::rebuild(Shard &shard)
+{
+    // Re-inserting the live flows drops every tombstone; the wheel is
+    // rebuilt with exactly one idle item (plus a close item) per flow
+    FlowEntry *old = shard.entries;
+    shard.entries = allocateEntries(shard.slotCount);
+    for (int level = 0; level < kWheelLevels; ++level) {
+        for (std::vector<quint32> &bucket : shard.wheel[level])
+            bucket.clear();
+    }
+    shard.timerItems = 0;
+    shard.tombstones = 0;
+    // Side storage follows its entries to their new slots
+    std::vector<quint32> metadataIndex(shard.metadataIndex.empty() ? 0 : shard.slotCount);
+    quint32 reassemblySlots[kReassembliesPerShard];
+    for (quint32 &slot : reassemblySlots)
+        slot = kNoSlot;
+
+    for (quint32 i = 0; i < shard.slotCount; ++i) {
+        const FlowEntry &entry = old[i];
+        if (entry.slotState() != FlowEntry::Live)
+            continue;
+        quint32 index = reduce(entry.hash, shard.slotCount);
+        while (shard.entries[index].slotState() != FlowEntry::Empty) {
+            if (++index == shard.slotCount)
+                index = 0;
+        }
+        FlowEntry &copy = shard.entries[index];
+        copy = entry;
+        copy.state = FlowEntry::Live | FlowEntry::IdleTimerArmed
+                     | (entry.state & (FlowEntry::InitiatorIsB | FlowEntry::Inspected | FlowEntry::HasMetadata
+                                       | FlowEntry::Reassembling));
+        if (entry.state & FlowEntry::HasMetadata)
+            metadataIndex[index] = shard.metadataIndex[i];
+        if (entry.state & FlowEntry::Reassembling) {
+            for (int r = 0; r < kReassembliesPerShard; ++r) {
+                if (shard.reassemblies[r].slot == i)
+                    reassemblySlots[r] = index;
+            }
+        }
+        schedule(shard, index, qMin(copy.lastSeen + idleTimeoutCs(copy),
+                                    copy.firstSeen + timeouts.activeSeconds * 100));
+        if (isClosing(copy)) {
+            copy.state |= FlowEntry::CloseTimerArmed;
+            schedule(shard, index | kCloseTimerItem, copy.lastSeen + idleTimeoutCs(copy));
+        }
+    }
+    shard.metadataIndex.swap(metadataIndex);
+    for (int r = 0; r < kReassembliesPerShard; ++r)
+        shard.reassemblies[r].slot = reassemblySlots[r];
+    shard.prefetchBase.store(shard.entries, std::memory_order_relaxed);
+    freeEntries(old, shard.slotCount);
+    ++shard.rebuilds;
+}
+
+int FlowTable::drainRecords(QVector<FlowRecord> &records, int maxRecords)
+{
+    int drained = 0;
+    for (const std::unique_ptr<Shard> &shard : shards) {
+        if (drained >= maxRecords)
+            break;
+        QMutexLocker lock(&shard->mutex);
+        const int take = qMin(maxRecords - drained, int(shard->exported.size()));
+        for (int i = 0; i < take; ++i)
+            records.append(shard->exported.at(i));
+        shard->exported.erase(shard->exported.begin(), shard->exported.begin() + take);
+        drained += take;
+    }
+    return drained;
+}
+
+FlowTableStats FlowTable::stats() const
+{
+    FlowTableStats stats;
+    stats.nonIpPackets = nonIpPackets.load(std::memory_order_relaxed);
+    for (const std::unique_ptr<Shard> &shard : shards) {
+        QMutexLocker lock(&shard->mutex);
+        stats.liveFlows += shard->live;
+        stats.capacity += shard->capacity;
+        stats.slots += shard->slotCount;
+        stats.tombstones += shard->tombstones;
+        stats.packets += shard->packets;
+        stats.created += shard->created;
+        stats.evictions += shard->evictions;
+        stats.idleExpiries += shard->idleExpiries;
+        stats.closedExpiries += shard->closedExpiries;
+        stats.activeExports += shard->activeExports;
+        stats.droppedRecords += shard->droppedRecords;
+        stats.rebuilds += shard->rebuilds;
+        stats.tlsFlows += shard->tlsFlows;
+        stats.httpFlows += shard->httpFlows;
+        stats.reassembled += shard->reassembled;
+        stats.reassemblyFailures += shard->reassemblyFailures;
+        stats.timerItems += shard->timerItems;
+        for (int i = 0; i < 16; ++i)
+            stats.probeHistogram[i] += shard->probeHistogram[i];
+        stats.maxProbe = qMax(stats.maxProbe, shard->maxProbe);
+        stats.memoryBytes += quint64(shard->slotCount) * sizeof(FlowEntry) + shard->timerItems * sizeof(quint32)
+                             + quint64(shard->metadataIndex.size()) * sizeof(quint32)
+                             + quint64(shard->metadata.capacity()) * sizeof(FlowMetadata);
+        for (const Reassembly &reassembly : shard->reassemblies)
+            stats.memoryBytes += reassembly.buffer ? L7Extractor::kMaxClientHello : 0;
+    }
+    return stats;
+}
@@ -0,0 +1,182 @@
+#ifndef FLOWTABLE_H
+#define FLOWTABLE_H
+
+#include <QMutex>
+#include <QVector>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "flowmetadata.h"
+#include "packetview.h"
+
+// One bidirectional 5-tuple flow, packed into a single cache line. The
+// endpoints are stored in canonical order (lower address/port first) so
+// both directions hash to the same entry.
+struct alignas(64) FlowEntry
+{
+    enum State : quint8 {
+        Empty = 0,
+        Live = 1,
+        Deleted = 2,
+        StateMask = 0x03,
+        Inspected = 0x04,      // Payload inspection is done for this flow
+        HasMetadata = 0x08,    // Application metadata is stored beside the entry
+        Reassembling = 0x10,   // A split ClientHello is being collected
+        InitiatorIsB = 0x20,   // First packet was sent by endpoint B
+        IdleTimerArmed = 0x40, // A wheel item for the idle/active timeout exists
+        CloseTimerArmed = 0x80 // A wheel item for the FIN/RST timeout exists
+    };
+
+    quint8 addressA[16];
+    quint8 addressB[16];
+    quint16 portA;
+    quint16 portB;
+    quint8 protocol;
+    quint8 ipVersion;
+    quint8 state;
+    quint8 tcpFlags;        // OR of all flags seen in either direction
+    quint32 hash;
+    quint32 firstSeen;      // Centiseconds since the table's time base
+    quint32 lastSeen;
+    quint32 packets;
+    quint64 bytes;
+
+    quint8 slotState() const { return state & StateMask; }
+};
+
+static_assert(sizeof(FlowEntry) == 64, "FlowEntry must fill exactly one cache line");
+
+// A flow leaving the table (or exported while still active)
+struct FlowRecord
+{
+    enum Reason : quint8 { IdleTimeout, ActiveTimeout, Closed, Evicted };
+
+    quint8 addressA[16];
+    quint8 addressB[16];
+    quint16 portA = 0;
+    quint16 portB = 0;
+    quint8 protocol = 0;
+    quint8 ipVersion = 0;
+    quint8 tcpFlags = 0;
+    quint8 reason = IdleTimeout;
+    bool initiatorIsB = false;
+    quint64 packets = 0;
+    quint64 bytes = 0;
+    qint64 firstSeenNs = 0;
+    qint64 lastSeenNs = 0;
+    FlowMetadata metadata;
+};
+
+struct FlowTableStats
+{
+    quint64 liveFlows = 0;
+    quint64 capacity = 0;       // Live flows the table will hold before evicting
+    quint64 slots = 0;
+    quint64 tombstones = 0;
+    quint64 packets = 0;
+    quint64 nonIpPackets = 0;
+    quint64 created = 0;
+    quint64 evictions = 0;
+    quint64 idleExpiries = 0;
+    quint64 closedExpiries = 0;
+    quint64 activeExports = 0;
+    quint64 droppedRecords = 0; // Exports lost because nobody drained them
+    quint64 rebuilds = 0;
+    quint64 tlsFlows = 0;
+    quint64 httpFlows = 0;
+    quint64 reassembled = 0;        // ClientHellos collected from several segments
+    quint64 reassemblyFailures = 0; // Gaps, oversized records or no free buffer
+    quint64 timerItems = 0;
+    quint64 probeHistogram[16] = {};  // Extra slots inspected per lookup; last bucket is 15+
+    quint64 maxProbe = 0;
+    quint64 memoryBytes = 0;
+
+    double occupancy() const { return slots ? double(liveFlows) / double(slots) : 0; }
+    double averageProbe() const;
+};
+
+// Concurrent flow table for captured packets. The table is split into
+// power-of-two shards picked by the symmetric flow hash, RSS style, so a
+// capture thread that owns a subset of shards never contends; each shard
+// has its own lock, linear-probing slot array and timer wheel.
+//
+// Timeouts run on a 4-level hierarchical wheel with 100 ms ticks. Packets
+// only touch their entry: a wheel item re-checks the entry's real deadline
+// when it fires and re-queues itself if the flow was active meanwhile, so
+// there is no per-packet timer work and no periodic sweep.
+//
+// Memory is fixed at construction: a shard that reaches its live-flow
+// capacity evicts the least recently seen flow among the new key's first
+// probe slots.
+//
+// The first client payload of each TCP flow goes through L7Extractor;
+// what it finds is kept in a per-shard side table keyed by slot, so the
+// entry itself only spends state bits on it, and is copied into the
+// flow's records. A ClientHello split across segments is collected in
+// one of a few per-shard buffers as long as segments arrive in order.
+class FlowTable : public PacketSink
+{
+public:
+    struct Timeouts
+    {
+        quint32 tcpIdleSeconds = 300;
+        quint32 udpIdleSeconds = 60;
+        quint32 otherIdleSeconds = 30;
+        quint32 closedSeconds = 5;        // After FIN or RST
+        quint32 activeSeconds = 120;      // Long flows are exported this often
+    };
+
+    explicit FlowTable(quint64 maxFlows, int shardCount = 64);
+    FlowTable(quint64 maxFlows, int shardCount, const Timeouts &timeouts);
+    ~FlowTable();
+
+    // Payload inspection is on by default; switch it before packets arrive
+    void setInspectionEnabled(bool enabled) { inspection = enabled; }
+
+    void onPackets(const PacketView *packets, int count) override;
+    void onIdle(qint64 nowNs) override;
+
+    // Adds one packet; returns false for non-IP packets
+    bool update(const PacketView &packet);
+    // Runs timeouts up to the given packet-clock time
+    void advance(qint64 nowNs);
+
+    int shardCount() const { return int(shards.size()); }
+    // Same mapping the table uses internally, for callers that want to
+    // pin packets to the thread owning a shard
+    int shardOf(const PacketView &packet) const;
+
+    // Moves up to maxRecords exported flows into `records`
+    int drainRecords(QVector<FlowRecord> &records, int maxRecords);
+    FlowTableStats stats() const;
+
+private:
+    struct Shard;
+
+    void init(quint64 maxFlows, int shardCount);
+    Shard &shardFor(quint64 hash) { return *shards[shardBits ? size_t(hash >> (64 - shardBits)) : 0]; }
+    quint32 centisecondsFor(qint64 nowNs);
+    quint64 prepareKey(const PacketView &packet, FlowEntry &key) const;
+    void apply(const PacketView &packet, const FlowEntry &key, quint64 hash);
+    FlowEntry *findOrInsert(Shard &shard, const FlowEntry &key, quint32 nowCs);
+    void processTimer(Shard &shard, quint32 item, quint32 nowCs);
+    void schedule(Shard &shard, quint32 item, quint32 deadlineCs);
+    void advanceShard(Shard &shard, quint64 tick, quint32 nowCs);
+    void expire(Shard &shard, quint32 index, FlowRecord::Reason reason, quint8 consumedTimer);
+    void rebuild(Shard &shard);
+    void exportFlow(Shard &shard, const FlowEntry &entry, FlowRecord::Reason reason);
+    void inspect(Shard &shard, FlowEntry &entry, const PacketView &packet);
+    void finishInspection(Shard &shard, FlowEntry &entry, const FlowMetadata &metadata);
+    void forgetInspection(Shard &shard, FlowEntry &entry);
+    quint32 idleTimeoutCs(const FlowEntry &entry) const;
+
+    Timeouts timeouts;
+    bool inspection = true;
+    std::vector<std::unique_ptr<Shard>> shards;
+    int shardBits = 0;
+    std::atomic<qint64> baseNs;
+    std::atomic<quint64> advancedTick { 0 };
+    std::atomic<quint64> nonIpPackets { 0 };
+};
+
+#endif // FLOWTABLE_H
@@ -0,0 +1,122 @@
+#include "headlessmain.h"
+#include "domainblocklist.h"
+#include "filescanner.h"
+#include "ipinfotable.h"
+#include "parserworkerpool.h"
+#include "scanreportwriter.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFileInfo>
+#include <cstdio>
+
+namespace {
+
+// Compiles a hosts file or domain list into a blocklist image
+int compileBlocklist(const QString &sourcePath, const QString &imagePath)
+{
+    DomainBlocklist::CompileStats stats;
+    QString failure;
+    if (!DomainBlocklist::compile(sourcePath, imagePath, &stats, &failure)) {
+        fprintf(stderr, "blocklist: %s\n", qPrintable(failure));
+        return 2;
+    }
+    fprintf(stderr, "%llu lines, %llu domains (%llu duplicates, %llu invalid) in %lld ms, %.1f MB image\n",
+            static_cast<unsigned long long>(stats.lines), static_cast<unsigned long long>(stats.domains),
+            static_cast<unsigned long long>(stats.duplicates), static_cast<unsigned long long>(stats.invalid),
+            static_cast<long long>(stats.elapsedMs), stats.imageBytes / 1048576.0);
+    return 0;
+}
+
+// Compiles GeoIP, ASN and reputation files into one IP data image
+int compileIpInfo(const QStringList &sourcePaths, const QString &imagePath)
+{
+    IpInfoTable::CompileStats stats;
+    QString failure;
+    if (!IpInfoTable::compile(sourcePaths, imagePath, &stats, &failure)) {
+        fprintf(stderr, "ipinfo: %s\n", qPrintable(failure));
+        return 2;
+    }
+    fprintf(stderr, "%llu lines, %llu networks (%llu invalid), %llu records, %llu nodes in %lld ms, %.1f MB image\n",
+            static_cast<unsigned long long>(stats.lines), static_cast<unsigned long long>(stats.entries),
+            static_cast<unsigned long long>(stats.invalid), static_cast<unsigned long long>(stats.records),
+            static_cast<unsigned long long>(stats.nodes), static_cast<long long>(stats.elapsedMs),
+            stats.imageBytes / 1048576.0);
+    return 0;
+}
+
+} // namespace
+
+int runHeadless(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("rhynec");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Rhynec Security headless scanner");
+    parser.addHelpOption();
+    QCommandLineOption headlessOption("headless", "Run without a GUI.");
+    QCommandLineOption scanOption("scan", "Scan a file or directory.", "path");
+    QCommandLineOption inProcessOption("in-process", "Parse in-process instead of in sandboxed workers.");
+    QCommandLineOption blocklistOption("compile-blocklist", "Compile a hosts file or domain <list> into a blocklist image.", "list");
+    QCommandLineOption imageOption("blocklist-image", "Write the compiled blocklist to <file> (default: <list>.rbl).", "file");
+    QCommandLineOption ipInfoOption("compile-ipinfo", "Compile a GeoIP, ASN or reputation <csv> into an IP data image; "
+                                                       "repeat for several sources.", "csv");
+    QCommandLineOption ipInfoImageOption("ipinfo-image", "Write the compiled IP data to <file> (default: <csv>.rip).", "file");
+    parser.addOptions({ headlessOption, scanOption });
+    parser.addOptions(ScanReportWriter::commandLineOptions());
+    parser.addOptions({ inProcessOption, blocklistOption, imageOption, ipInfoOption, ipInfoImageOption });
+    parser.process(app);
+
+    if (parser.isSet(blocklistOption)) {
+        const QString source = parser.value(blocklistOption);
+        return compileBlocklist(source, parser.isSet(imageOption) ? parser.value(imageOption) : source + ".rbl");
+    }
+
+    if (parser.isSet(ipInfoOption)) {
+        const QStringList sources = parser.values(ipInfoOption);
+        return compileIpInfo(sources, parser.isSet(ipInfoImageOption) ? parser.value(ipInfoImageOption)
+                                                                      : sources.first() + ".rip");
+    }
+
+    // Every argument is checked before the report is opened, which
+    // truncates it
+    if (!parser.isSet(scanOption)) {
+        parser.showHelp(2);
+    }
+    const QString scanPath = parser.value(scanOption);
+    if (!QFileInfo::exists(scanPath)) {
+        fprintf(stderr, "No such file or directory: %s\n", qPrintable(scanPath));
+        return 2;
+    }
+
+    ScanReportWriter writer;
+    if (!writer.beginFromCommandLine(parser)) {
+        fprintf(stderr, "report: %s\n", qPrintable(writer.errorString()));
+        return 2;
+    }
+
+    ParserWorkerPool pool;
+    pool.setMode(parser.isSet(inProcessOption) ? ParserWorkerPool::Mode::InProcess
+                                               : ParserWorkerPool::Mode::Sandboxed);
+    FileScanner scanner(&pool);
+    if (writer.isActive()) {
+        QObject::connect(&scanner, &FileScanner::resultReady, &writer, &ScanReportWriter::addResult);
+    }
+    QObject::connect(&scanner, &FileScanner::finished, &app, &QCoreApplication::quit, Qt::QueuedConnection);
+
+    scanner.start(scanPath);
+    app.exec();
+
+    const LatencyHistogram latency = pool.latency(pool.mode());
+    fprintf(stderr, "%llu files, %llu detections in %lld ms (p50 %.1f us, p99 %.1f us per file)\n",
+            static_cast<unsigned long long>(scanner.filesScanned()),
+            static_cast<unsigned long long>(scanner.detections()),
+            static_cast<long long>(scanner.elapsedMs()),
+            latency.percentile(50) / 1000.0, latency.percentile(99) / 1000.0);
+
+    if (writer.isActive() && !writer.finish()) {
+        fprintf(stderr, "report: %s\n", qPrintable(writer.errorString()));
+        return 2;
+    }
+    return scanner.detections() > 0 ? 1 : 0;
+}
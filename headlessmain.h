@@ -0,0 +1,8 @@
+#ifndef HEADLESSMAIN_H
+#define HEADLESSMAIN_H
+
+// Entry point for `rhynec --headless ...`: scanning and report export
+// on a QCoreApplication, for machines without a display.
+int runHeadless(int argc, char *argv[]);
+
+#endif // HEADLESSMAIN_H
@@ -0,0 +1,321 @@
+#include "iouring.h"
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+// C libraries older than io_uring lack the numbers, which are the same
+// on every architecture but Alpha
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+#ifndef __NR_io_uring_register
+#define __NR_io_uring_register 427
+#endif
+
+namespace {
+
+int ioUringSetup(unsigned entries, io_uring_params *params)
+{
+    return int(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, const void *argument, size_t size)
+{
+    return int(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, argument, size));
+}
+
+int ioUringRegister(int fd, unsigned opcode, const void *argument, unsigned count)
+{
+    return int(syscall(__NR_io_uring_register, fd, opcode, argument, count));
+}
+
+QString failed(const char *what)
+{
+    return QString("%1: %2").arg(what).arg(strerror(errno));
+}
+
+} // namespace
+
+IoUring::~IoUring()
+{
+    close();
+}
+
+bool IoUring::setup(unsigned entries, unsigned flags, QString *error)
+{
+    close();
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = flags;
+    int fd = ioUringSetup(entries, &params);
+    if (fd < 0 && errno == EINVAL && flags != 0) {
+        memset(&params, 0, sizeof(params));
+        fd = ioUringSetup(entries, &params);
+    }
+    if (fd < 0) {
+        *error = failed("io_uring_setup");
+        return false;
+    }
+    ringFd = fd;
+    // Timed waits in io_uring_enter itself (Linux 5.11)
+    if (!(params.features & IORING_FEAT_EXT_ARG)) {
+        *error = "io_uring lacks timed waits";
+        close();
+        return false;
+    }
+
+    const size_t submissionSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    const size_t completionSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    ringMemorySize = single ? qMax(submissionSize, completionSize) : submissionSize;
+    ringMemory = mmap(nullptr, ringMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ringMemory == MAP_FAILED) {
+        ringMemory = nullptr;
+        *error = failed("io_uring ring mmap");
+        close();
+        return false;
+    }
+    void *completion = ringMemory;
+    if (!single) {
+        completionMemorySize = completionSize;
+        completionMemory = mmap(nullptr, completionSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (completionMemory == MAP_FAILED) {
+            completionMemory = nullptr;
+            *error = failed("io_uring completion mmap");
+            close();
+            return false;
+        }
+        completion = completionMemory;
+    }
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void *entryMemory = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (entryMemory == MAP_FAILED) {
+        *error = failed("io_uring entry mmap");
+        close();
+        return false;
+    }
+    sqes = static_cast<io_uring_sqe *>(entryMemory);
+
+    uchar *submission = static_cast<uchar *>(ringMemory);
+    sqHead = reinterpret_cast<unsigned *>(submission + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned *>(submission + params.sq_off.tail);
+    sqMask = *reinterpret_cast<unsigned *>(submission + params.sq_off.ring_mask);
+    sqEntries = params.sq_entries;
+    sqeTail = *sqTail;
+    // Entries are used in ring order, so the indirection array is fixed
+    unsigned *array = reinterpret_cast<unsigned *>(submission + params.sq_off.array);
+    for (unsigned i = 0; i < sqEntries; ++i)
+        array[i] = i;
+    uchar *completions = static_cast<uchar *>(completion);
+    cqHead = reinterpret_cast<unsigned *>(completions + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned *>(completions + params.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned *>(completions + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe *>(completions + params.cq_off.cqes);
+
+    // Without a probe (before Linux 5.6) nothing counts as supported
+    const unsigned probeOps = 256;
+    std::vector<uchar> probeMemory(sizeof(io_uring_probe) + probeOps * sizeof(io_uring_probe_op), 0);
+    io_uring_probe *probe = reinterpret_cast<io_uring_probe *>(probeMemory.data());
+    memset(opcodes, 0, sizeof(opcodes));
+    if (ioUringRegister(fd, IORING_REGISTER_PROBE, probe, probeOps) == 0) {
+        for (unsigned op = 0; op < probe->ops_len && op < probeOps; ++op) {
+            if (probe->ops[op].flags & IO_URING_OP_SUPPORTED)
+                opcodes[op / 64] |= quint64(1) << (op % 64);
+        }
+    }
+    return true;
+}
+
+void IoUring::close()
+{
+    if (sqes)
+        munmap(sqes, sqesSize);
+    if (completionMemory)
+        munmap(completionMemory, completionMemorySize);
+    if (ringMemory)
+        munmap(ringMemory, ringMemorySize);
+    if (ringFd >= 0)
+        ::close(ringFd);
+    ringFd = -1;
+    sqes = nullptr;
+    completionMemory = nullptr;
+    ringMemory = nullptr;
+    sqHead = sqTail = cqHead = cqTail = nullptr;
+    cqes = nullptr;
+    sqeTail = 0;
+}
+
+bool IoUring::supports(int opcode) const
+{
+    return opcode >= 0 && opcode < 256 && (opcodes[opcode / 64] >> (opcode % 64)) & 1;
+}
+
+bool IoUring::registerBuffers(const iovec *buffers, unsigned count, QString *error)
+{
+    if (ioUringRegister(ringFd, IORING_REGISTER_BUFFERS, buffers, count) == 0)
+        return true;
+    *error = failed("io_uring buffer registration");
+    return false;
+}
+
+void IoUring::unregisterBuffers()
+{
+    ioUringRegister(ringFd, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+}
+
+bool IoUring::registerFiles(const int *fds, unsigned count, QString *error)
+{
+    if (ioUringRegister(ringFd, IORING_REGISTER_FILES, fds, count) == 0)
+        return true;
+    *error = failed("io_uring file registration");
+    return false;
+}
+
+bool IoUring::setupBufferRing(quint16 group, unsigned entries, BufferRing *ring, QString *error)
+{
+    // The kernel wants a page-aligned ring of a power of two entries
+    const size_t size = entries * sizeof(io_uring_buf);
+    void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (memory == MAP_FAILED) {
+        *error = failed("Buffer ring mmap");
+        return false;
+    }
+    io_uring_buf_reg registration;
+    memset(&registration, 0, sizeof(registration));
+    registration.ring_addr = quint64(quintptr(memory));
+    registration.ring_entries = entries;
+    registration.bgid = group;
+    if (ioUringRegister(ringFd, IORING_REGISTER_PBUF_RING, &registration, 1) != 0) {
+        *error = failed("io_uring buffer ring registration");
+        munmap(memory, size);
+        return false;
+    }
+    ring->ring = static_cast<io_uring_buf_ring *>(memory);
+    ring->entries = entries;
+    ring->group = group;
+    ring->tail = 0;
+    return true;
+}
+
+void IoUring::freeBufferRing(BufferRing *ring)
+{
+    if (!ring->ring)
+        return;
+    io_uring_buf_reg registration;
+    memset(&registration, 0, sizeof(registration));
+    registration.bgid = ring->group;
+    if (ringFd >= 0)
+        ioUringRegister(ringFd, IORING_UNREGISTER_PBUF_RING, &registration, 1);
+    munmap(ring->ring, ring->entries * sizeof(io_uring_buf));
+    ring->ring = nullptr;
+    ring->entries = 0;
+}
+
+void IoUring::provideBuffer(BufferRing *ring, void *address, unsigned length, quint16 id)
+{
+    // Entries start at the ring itself, the tail overlaying the first
+    // one's reserved field; some headers misplace bufs for C++
+    io_uring_buf &buffer = reinterpret_cast<io_uring_buf *>(ring->ring)[ring->tail & (ring->entries - 1)];
+    buffer.addr = quint64(quintptr(address));
+    buffer.len = length;
+    buffer.bid = id;
+    ++ring->tail;
+}
+
+void IoUring::publishBuffers(BufferRing *ring)
+{
+    __atomic_store_n(&ring->ring->tail, ring->tail, __ATOMIC_RELEASE);
+}
+
+io_uring_sqe *IoUring::nextSqe()
+{
+    if (sqeTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries)
+        return nullptr;
+    io_uring_sqe *entry = &sqes[sqeTail & sqMask];
+    ++sqeTail;
+    memset(entry, 0, sizeof(*entry));
+    return entry;
+}
+
+unsigned IoUring::queued() const
+{
+    return sqeTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+}
+
+int IoUring::submitAndWait(unsigned minimum, qint64 timeoutNs)
+{
+    __atomic_store_n(sqTail, sqeTail, __ATOMIC_RELEASE);
+    const unsigned toSubmit = queued();
+    // With deferred task running, completions are only posted from here,
+    // so even a call that waits for none asks for them
+    unsigned flags = IORING_ENTER_GETEVENTS;
+    io_uring_getevents_arg argument;
+    __kernel_timespec timeout;
+    memset(&argument, 0, sizeof(argument));
+    if (timeoutNs >= 0) {
+        timeout.tv_sec = timeoutNs / 1000000000;
+        timeout.tv_nsec = timeoutNs % 1000000000;
+        argument.sigmask_sz = _NSIG / 8;
+        argument.ts = quint64(quintptr(&timeout));
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+    const int result = ioUringEnter(ringFd, toSubmit, minimum, flags, timeoutNs >= 0 ? &argument : nullptr,
+                                    timeoutNs >= 0 ? sizeof(argument) : 0);
+    if (result >= 0)
+        return result;
+    // A timeout, a signal or a full completion queue: the caller reaps
+    if (errno == ETIME || errno == EINTR || errno == EAGAIN || errno == EBUSY)
+        return 0;
+    return -errno;
+}
+
+io_uring_cqe *IoUring::peekCompletion()
+{
+    const unsigned head = *cqHead;
+    if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+        return nullptr;
+    return &cqes[head & cqMask];
+}
+
+void IoUring::consumeCompletion()
+{
+    __atomic_store_n(cqHead, *cqHead + 1, __ATOMIC_RELEASE);
+}
+
+#else
+
+IoUring::~IoUring() {}
+
+bool IoUring::setup(unsigned, unsigned, QString *error)
+{
+    *error = "io_uring requires Linux";
+    return false;
+}
+
+void IoUring::close() {}
+bool IoUring::supports(int) const { return false; }
+bool IoUring::registerBuffers(const iovec *, unsigned, QString *) { return false; }
+void IoUring::unregisterBuffers() {}
+bool IoUring::registerFiles(const int *, unsigned, QString *) { return false; }
+bool IoUring::setupBufferRing(quint16, unsigned, BufferRing *, QString *) { return false; }
+void IoUring::freeBufferRing(BufferRing *) {}
+void IoUring::provideBuffer(BufferRing *, void *, unsigned, quint16) {}
+void IoUring::publishBuffers(BufferRing *) {}
+io_uring_sqe *IoUring::nextSqe() { return nullptr; }
+unsigned IoUring::queued() const { return 0; }
+int IoUring::submitAndWait(unsigned, qint64) { return -1; }
+io_uring_cqe *IoUring::peekCompletion() { return nullptr; }
+void IoUring::consumeCompletion() {}
+
+#endif
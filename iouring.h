@@ -0,0 +1,94 @@
+#ifndef IOURING_H
+#define IOURING_H
+
+#include <QString>
+#include <QtGlobal>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+struct iovec;
+
+// io_uring over its raw system calls, without liburing: the submission
+// and completion rings mapped into this process, registered buffers and
+// files, and provided buffer rings from which multishot receives take a
+// buffer per completion. Users include <linux/io_uring.h> to fill in the
+// entries.
+//
+// One thread submits and reaps. setup() fails where the kernel lacks
+// io_uring, has it disabled (kernel.io_uring_disabled, a seccomp filter)
+// or predates what we rely on, and callers then keep to their classic
+// system calls.
+class IoUring
+{
+public:
+    // Opcodes newer than some kernel headers
+    static const int kOpReadMultishot = 49;    // Linux 6.7
+
+    // A ring of buffers provided to the kernel under one group id; bufs
+    // overlay the ring, as in the kernel's io_uring_buf_ring
+    struct BufferRing
+    {
+        io_uring_buf_ring *ring = nullptr;
+        unsigned entries = 0;                  // Power of two
+        quint16 group = 0;
+        quint16 tail = 0;
+    };
+
+    IoUring() = default;
+    ~IoUring();
+    IoUring(const IoUring &) = delete;
+    IoUring &operator=(const IoUring &) = delete;
+
+    // flags are IORING_SETUP_* hints; a kernel that rejects them gets a
+    // plain ring instead
+    bool setup(unsigned entries, unsigned flags, QString *error);
+    void close();
+    bool isOpen() const { return ringFd >= 0; }
+    // Whether the kernel implements an IORING_OP_*
+    bool supports(int opcode) const;
+
+    bool registerBuffers(const iovec *buffers, unsigned count, QString *error);
+    void unregisterBuffers();
+    // A -1 entry leaves its slot free for direct opens
+    bool registerFiles(const int *fds, unsigned count, QString *error);
+    bool setupBufferRing(quint16 group, unsigned entries, BufferRing *ring, QString *error);
+    void freeBufferRing(BufferRing *ring);
+    // Queues a buffer for the kernel; publishBuffers() makes the queued
+    // ones visible at once
+    static void provideBuffer(BufferRing *ring, void *address, unsigned length, quint16 id);
+    static void publishBuffers(BufferRing *ring);
+
+    // A zeroed entry, or null while the submission queue is full
+    io_uring_sqe *nextSqe();
+    unsigned queued() const;
+    // Submits what is queued and waits for `minimum` completions or
+    // timeoutNs (-1 for no limit), in one io_uring_enter. Returns the
+    // number submitted or -errno; a timeout is not an error.
+    int submitAndWait(unsigned minimum, qint64 timeoutNs);
+    // Completions in order; consume each one peeked
+    io_uring_cqe *peekCompletion();
+    void consumeCompletion();
+
+private:
+    int ringFd = -1;
+    void *ringMemory = nullptr;
+    size_t ringMemorySize = 0;
+    void *completionMemory = nullptr;          // Only where the kernel maps the rings apart
+    size_t completionMemorySize = 0;
+    io_uring_sqe *sqes = nullptr;
+    size_t sqesSize = 0;
+
+    unsigned *sqHead = nullptr;
+    unsigned *sqTail = nullptr;
+    unsigned sqMask = 0;
+    unsigned sqEntries = 0;
+    unsigned sqeTail = 0;                      // Ours, published on submit
+    unsigned *cqHead = nullptr;
+    unsigned *cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe *cqes = nullptr;
+    quint64 opcodes[4] = {};                   // Bit per supported opcode
+};
+
+#endif // IOURING_H
@@ -0,0 +1,962 @@
+#include "ipinfotable.h"
+#include <QElapsedTimer>
+#include <QHash>
+#include <QHostAddress>
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+const char kImageMagic[8] = { 'R', 'H', 'I', 'P', 'T', '0', '0', '1' };
+const quint32 kImageVersion = 1;
+const int kDirectBits = 20;
+const int kStride = 6;
+const int kBatchLanes = 16;
+// Direct and resolved entries: a record index with this bit, else a node
+const quint32 kRecordFlag = 0x80000000u;
+const quint32 kMaxIndex = 0x3fffffffu;
+const int kMaxRisk = 100;
+
+// Addresses left-aligned in 128 bits; IPv4 takes the top 32
+typedef unsigned __int128 Key;
+
+struct TrieHeader
+{
+    quint32 keyBits;
+    quint32 directBits;
+    quint64 directOffset;
+    quint64 nodesOffset;
+    quint64 nodeCount;
+    quint64 leavesOffset;
+    quint64 leafCount;
+};
+
+struct ImageHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 reserved;
+    quint64 recordCount;
+    quint64 recordsOffset;
+    quint64 stringsOffset;
+    quint64 stringsSize;
+    TrieHeader v4;
+    TrieHeader v6;
+    quint64 fileSize;
+};
+
+enum Attribute { CountryAttribute, AsnAttribute, RiskAttribute, AttributeCount };
+
+inline quint64 alignSection(quint64 offset)
+{
+    return (offset + 63) & ~quint64(63);
+}
+
+// The 6 bits at `offset` from the top of the 128-bit key
+template<int KeyBits>
+inline unsigned chunk(quint64 high, quint64 low, int offset)
+{
+    if (KeyBits <= 64 || offset <= 58)
+        return unsigned(high >> (58 - offset)) & 63;
+    if (offset >= 64)
+        return unsigned(low >> (122 - offset)) & 63;
+    return unsigned((high << (offset - 58)) | (low >> (122 - offset))) & 63;
+}
+
+inline quint64 below(unsigned bit)
+{
+    return bit == 63 ? ~quint64(0) : (quint64(2) << bit) - 1;
+}
+
+bool parseIpv4(const char *text, int length, quint32 *address)
+{
+    quint32 value = 0;
+    int octets = 0;
+    int i = 0;
+    while (octets < 4) {
+        quint32 octet = 0;
+        const int start = i;
+        while (i < length && text[i] >= '0' && text[i] <= '9' && i - start < 3)
+            octet = octet * 10 + quint32(text[i++] - '0');
+        if (i == start || octet > 255)
+            return false;
+        value = (value << 8) | octet;
+        if (++octets < 4) {
+            if (i >= length || text[i] != '.')
+                return false;
+            ++i;
+        }
+    }
+    if (i != length)
+        return false;
+    *address = value;
+    return true;
+}
+
+bool parseAddress(const QByteArray &text, Key *key, bool *ipv6)
+{
+    quint32 v4 = 0;
+    if (parseIpv4(text.constData(), text.size(), &v4)) {
+        *key = Key(v4) << 96;
+        *ipv6 = false;
+        return true;
+    }
+    if (!text.contains(':'))
+        return false;
+    QHostAddress address;
+    if (!address.setAddress(QString::fromLatin1(text)) || address.protocol() != QAbstractSocket::IPv6Protocol)
+        return false;
+    const Q_IPV6ADDR bytes = address.toIPv6Address();
+    Key value = 0;
+    for (int i = 0; i < 16; ++i)
+        value = (value << 8) | bytes[i];
+    *key = value;
+    *ipv6 = true;
+    return true;
+}
+
+// "10.0.0.0/8", "2001:db8::/32" or a single address
+bool parseNetwork(const QByteArray &text, Key *first, Key *last, bool *ipv6)
+{
+    const int slash = text.indexOf('/');
+    Key address = 0;
+    if (!parseAddress(slash < 0 ? text : text.left(slash), &address, ipv6))
+        return false;
+    const int familyBits = *ipv6 ? 128 : 32;
+    int length = familyBits;
+    if (slash >= 0) {
+        bool ok = false;
+        length = text.mid(slash + 1).toInt(&ok);
+        if (!ok || length < 0 || length > familyBits)
+            return false;
+    }
+    const int hostBits = 128 - length;
+    const Key host = hostBits == 128 ? ~Key(0) : (Key(1) << hostBits) - 1;
+    *first = address & ~host;
+    *last = *first | host;
+    return true;
+}
+
+// Splits on `separator`, honouring double quotes
+QList<QByteArray> splitFields(const QByteArray &line, char separator)
+{
+    QList<QByteArray> fields;
+    if (!line.contains('"')) {
+        fields = line.split(separator);
+        for (QByteArray &field : fields)
+            field = field.trimmed();
+        return fields;
+    }
+    QByteArray field;
+    bool quoted = false;
+    for (int i = 0; i < line.size(); ++i) {
+        const char c = line.at(i);
+        if (c == '"') {
+            if (quoted && i + 1 < line.size() && line.at(i + 1) == '"')
+                field += line.at(++i);
+            else
+                quoted = !quoted;
+        } else if (c == separator && !quoted) {
+            fields.append(field.trimmed());
+            field.clear();
+        } else {
+            field += c;
+        }
+    }
+    fields.append(field.trimmed());
+    return fields;
+}
+
+bool parseCountry(const QByteArray &text, quint32 *value)
+{
+    if (text.size() != 2 || !isalpha(uchar(text.at(0))) || !isalpha(uchar(text.at(1))))
+        return false;
+    *value = (quint32(toupper(uchar(text.at(0)))) << 8) | quint32(toupper(uchar(text.at(1))));
+    return true;
+}
+
+bool parseAsn(QByteArray text, quint32 *asn)
+{
+    if (text.startsWith("AS") || text.startsWith("as"))
+        text.remove(0, 2);
+    if (text.isEmpty())
+        return false;
+    for (char c : text) {
+        if (c < '0' || c > '9')
+            return false;
+    }
+    bool ok = false;
+    *asn = text.toUInt(&ok);
+    return ok;
+}
+
+bool parseRisk(const QByteArray &text, quint32 *risk)
+{
+    if (text.isEmpty())
+        return false;
+    bool ok = false;
+    const double value = text.toDouble(&ok);
+    if (!ok || value < 0)
+        return false;
+    // Feeds that score 0-1 are scaled to 0-100
+    *risk = quint32(qMin<double>(kMaxRisk, value <= 1 && text.contains('.') ? value * kMaxRisk : value));
+    return true;
+}
+
+} // namespace
+
+// Collects per-attribute intervals from every source, resolves them into
+// flat range maps and writes the image
+class IpInfoTable::Builder
+{
+public:
+    bool addFile(const QString &path, CompileStats *stats, QString *error);
+    bool write(const QString &imagePath, CompileStats *stats, QString *error);
+
+private:
+    // An inclusive address range carrying one attribute's value; later
+    // sources win over earlier ones for identical ranges
+    struct Interval
+    {
+        Key first;
+        Key last;
+        quint32 value;
+        quint32 sequence;
+    };
+
+    // `value` holds from `start` up to the next boundary
+    struct Boundary
+    {
+        Key start;
+        quint32 value;
+    };
+
+    struct Columns
+    {
+        int last = -1;             // Range end, when rows are "first,last"
+        int country = -1;
+        int asn = -1;
+        int organization = -1;
+        int risk = -1;
+        bool blocklist = false;
+    };
+
+    struct TrieImage
+    {
+        std::vector<quint32> direct;
+        std::vector<Node> nodes;
+        std::vector<quint32> leaves;
+    };
+
+    Columns detectColumns(const QList<QByteArray> &fields, bool *header) const;
+    bool addRow(const QList<QByteArray> &fields, const Columns &columns);
+    void addInterval(bool ipv6, Attribute attribute, Key first, Key last, quint32 value);
+    quint32 internAsn(quint32 asn, const QByteArray &organization);
+    quint32 internRecord(const quint32 *values);
+    static std::vector<Boundary> resolve(std::vector<Interval> &intervals);
+    std::vector<Boundary> merge(std::vector<Interval> *attributes);
+    static void buildTrie(const std::vector<Boundary> &ranges, TrieImage *trie);
+    static void fillNode(const std::vector<Boundary> &ranges, quint32 nodeIndex, Key base, int consumed, TrieImage *trie);
+    static bool uniform(const std::vector<Boundary> &ranges, size_t *cursor, Key first, Key last, quint32 *value);
+
+    std::vector<Interval> intervals[2][AttributeCount];
+    quint32 sequence = 0;
+    struct Asn
+    {
+        quint32 asn;
+        quint32 organization;
+        quint16 organizationLength;
+    };
+    std::vector<Asn> asns;
+    QHash<quint32, quint32> asnIndex;
+    QByteArray strings;
+    std::vector<IpInfoRecord> records;
+    QHash<quint64, quint32> recordIndex;
+};
+
+IpInfoTable::Builder::Columns IpInfoTable::Builder::detectColumns(const QList<QByteArray> &fields, bool *header) const
+{
+    Columns columns;
+    Key key = 0;
+    bool ipv6 = false;
+    Key ignored = 0;
+    *header = !parseNetwork(fields.at(0), &key, &ignored, &ipv6);
+    if (*header) {
+        for (int i = 1; i < fields.size(); ++i) {
+            const QByteArray name = fields.at(i).toLower();
+            if (name == "last" || name == "end" || name == "range_end" || name == "ip_range_end" || name == "end_ip"
+                || name == "ip_to")
+                columns.last = i;
+            else if (name == "country" || name == "country_code" || name == "cc" || name == "iso_code"
+                     || name == "country_iso_code")
+                columns.country = i;
+            else if (name == "asn" || name == "autonomous_system_number" || name == "as_number")
+                columns.asn = i;
+            else if (name == "organization" || name == "org" || name == "as_org" || name == "as_name"
+                     || name == "autonomous_system_organization" || name == "as_description")
+                columns.organization = i;
+            else if (name == "risk" || name == "score" || name == "reputation")
+                columns.risk = i;
+        }
+    } else {
+        // Infer from the first row: an address in the second column makes
+        // rows ranges, then the first value of each shape claims a column
+        int next = 1;
+        if (fields.size() > 1 && parseAddress(fields.at(1), &key, &ipv6)) {
+            columns.last = 1;
+            next = 2;
+        }
+        quint32 value = 0;
+        for (int i = next; i < fields.size(); ++i) {
+            const QByteArray &field = fields.at(i);
+            if (field.isEmpty())
+                continue;
+            if (columns.country < 0 && parseCountry(field, &value))
+                columns.country = i;
+            else if (columns.asn < 0 && parseAsn(field, &value))
+                columns.asn = i;
+            else if (columns.organization < 0 && columns.asn >= 0 && !parseRisk(field, &value))
+                columns.organization = i;
+        }
+    }
+    columns.blocklist = columns.country < 0 && columns.asn < 0 && columns.risk < 0;
+    return columns;
+}
+
+void IpInfoTable::Builder::addInterval(bool ipv6, Attribute attribute, Key first, Key last, quint32 value)
+{
+    intervals[ipv6 ? 1 : 0][attribute].push_back({ first, last, value, sequence++ });
+}
+
+quint32 IpInfoTable::Builder::internAsn(quint32 asn, const QByteArray &organization)
+{
+    const auto found = asnIndex.constFind(asn);
+    if (found != asnIndex.constEnd()) {
+        // Sources without names must not hide a name another one gave
+        Asn &existing = asns[found.value()];
+        if (existing.organizationLength == 0 && !organization.isEmpty()) {
+            existing.organization = quint32(strings.size());
+            existing.organizationLength = quint16(qMin(organization.size(), 0xffff));
+            strings += organization.left(existing.organizationLength);
+        }
+        return found.value();
+    }
+    Asn entry = { asn, quint32(strings.size()), quint16(qMin(organization.size(), 0xffff)) };
+    strings += organization.left(entry.organizationLength);
+    asns.push_back(entry);
+    asnIndex.insert(asn, quint32(asns.size() - 1));
+    return quint32(asns.size() - 1);
+}
+
+bool IpInfoTable::Builder::addRow(const QList<QByteArray> &fields, const Columns &columns)
+{
+    Key first = 0;
+    Key last = 0;
+    bool ipv6 = false;
+    if (columns.last >= 0) {
+        bool lastIpv6 = false;
+        if (columns.last >= fields.size() || !parseAddress(fields.at(0), &first, &ipv6)
+            || !parseAddress(fields.at(columns.last), &last, &lastIpv6) || ipv6 != lastIpv6 || last < first)
+            return false;
+        if (!ipv6)
+            last |= (Key(1) << 96) - 1;
+    } else if (!parseNetwork(fields.at(0), &first, &last, &ipv6)) {
+        return false;
+    }
+
+    const auto field = [&fields](int column) { return column >= 0 && column < fields.size() ? fields.at(column) : QByteArray(); };
+    quint32 value = 0;
+    if (columns.blocklist) {
+        addInterval(ipv6, RiskAttribute, first, last, kMaxRisk + 1);
+        return true;
+    }
+    if (parseCountry(field(columns.country), &value))
+        addInterval(ipv6, CountryAttribute, first, last, value);
+    // AS 0 is how dumps mark unrouted space
+    if (parseAsn(field(columns.asn), &value) && value != 0)
+        addInterval(ipv6, AsnAttribute, first, last, internAsn(value, field(columns.organization)) + 1);
+    if (parseRisk(field(columns.risk), &value))
+        addInterval(ipv6, RiskAttribute, first, last, value + 1);
+    return true;
+}
+
+bool IpInfoTable::Builder::addFile(const QString &path, CompileStats *stats, QString *error)
+{
+    QFile source(path);
+    if (!source.open(QIODevice::ReadOnly)) {
+        *error = QString("%1: %2").arg(path, source.errorString());
+        return false;
+    }
+
+    bool started = false;
+    Columns columns;
+    while (!source.atEnd()) {
+        QByteArray line = source.readLine();
+        ++stats->lines;
+        // "#" and, in Spamhaus drop lists, ";" start comments
+        for (const char marker : { '#', ';' }) {
+            const int comment = line.indexOf(marker);
+            if (comment >= 0)
+                line.truncate(comment);
+        }
+        line = line.trimmed();
+        if (line.isEmpty())
+            continue;
+
+        QList<QByteArray> fields;
+        if (line.contains('\t') || line.contains(',')) {
+            fields = splitFields(line, line.contains('\t') ? '\t' : ',');
+        } else {
+            const int space = line.indexOf(' ');
+            fields.append(space < 0 ? line : line.left(space));
+        }
+
+        if (!started) {
+            started = true;
+            bool header = false;
+            columns = detectColumns(fields, &header);
+            if (header)
+                continue;
+        }
+        if (addRow(fields, columns))
+            ++stats->entries;
+        else
+            ++stats->invalid;
+    }
+    return true;
+}
+
+// Flattens possibly nested intervals into boundaries where the innermost
+// (longest) covering interval's value starts
+std::vector<IpInfoTable::Builder::Boundary> IpInfoTable::Builder::resolve(std::vector<Interval> &intervals)
+{
+    std::sort(intervals.begin(), intervals.end(), [](const Interval &a, const Interval &b) {
+        if (a.first != b.first)
+            return a.first < b.first;
+        if (a.last != b.last)
+            return a.last > b.last;
+        return a.sequence < b.sequence;
+    });
+
+    std::vector<Boundary> out = { { 0, 0 } };
+    const auto emitValue = [&out](Key start, quint32 value) {
+        if (out.back().start == start) {
+            out.back().value = value;
+            if (out.size() > 1 && out[out.size() - 2].value == value)
+                out.pop_back();
+        } else if (out.back().value != value) {
+            out.push_back({ start, value });
+        }
+    };
+
+    std::vector<const Interval *> open;
+    const auto closeBefore = [&](Key position, bool all) {
+        while (!open.empty() && (all || open.back()->last < position)) {
+            const Key end = open.back()->last;
+            open.pop_back();
+            // Ranges that overlap without nesting end inside the one above
+            while (!open.empty() && open.back()->last <= end)
+                open.pop_back();
+            if (end != ~Key(0))
+                emitValue(end + 1, open.empty() ? 0 : open.back()->value);
+        }
+    };
+    for (const Interval &interval : intervals) {
+        closeBefore(interval.first, false);
+        emitValue(interval.first, interval.value);
+        open.push_back(&interval);
+    }
+    closeBefore(0, true);
+    return out;
+}
+
+quint32 IpInfoTable::Builder::internRecord(const quint32 *values)
+{
+    const quint64 key = quint64(values[CountryAttribute]) | (quint64(values[RiskAttribute]) << 16)
+                        | (quint64(values[AsnAttribute]) << 24);
+    const auto found = recordIndex.constFind(key);
+    if (found != recordIndex.constEnd())
+        return found.value();
+
+    IpInfoRecord record;
+    memset(&record, 0, sizeof(record));
+    if (values[CountryAttribute]) {
+        record.country[0] = char(values[CountryAttribute] >> 8);
+        record.country[1] = char(values[CountryAttribute] & 0xff);
+    }
+    if (values[AsnAttribute]) {
+        const Asn &asn = asns[values[AsnAttribute] - 1];
+        record.asn = asn.asn;
+        record.organization = asn.organization;
+        record.organizationLength = asn.organizationLength;
+    }
+    if (values[RiskAttribute])
+        record.risk = quint8(values[RiskAttribute] - 1);
+    records.push_back(record);
+    recordIndex.insert(key, quint32(records.size() - 1));
+    return quint32(records.size() - 1);
+}
+
+// One range map of record indexes from the per-attribute maps
+std::vector<IpInfoTable::Builder::Boundary> IpInfoTable::Builder::merge(std::vector<Interval> *attributes)
+{
+    std::vector<Boundary> maps[AttributeCount];
+    for (int a = 0; a < AttributeCount; ++a) {
+        maps[a] = resolve(attributes[a]);
+        std::vector<Interval>().swap(attributes[a]);
+    }
+
+    std::vector<Boundary> out;
+    size_t cursor[AttributeCount] = {};
+    Key position = 0;
+    for (;;) {
+        quint32 values[AttributeCount];
+        for (int a = 0; a < AttributeCount; ++a)
+            values[a] = maps[a][cursor[a]].value;
+        const quint32 record = internRecord(values);
+        if (out.empty() || out.back().value != record)
+            out.push_back({ position, record });
+
+        bool more = false;
+        Key next = ~Key(0);
+        for (int a = 0; a < AttributeCount; ++a) {
+            if (cursor[a] + 1 < maps[a].size() && (!more || maps[a][cursor[a] + 1].start < next)) {
+                next = maps[a][cursor[a] + 1].start;
+                more = true;
+            }
+        }
+        if (!more)
+            break;
+        position = next;
+        for (int a = 0; a < AttributeCount; ++a) {
+            if (cursor[a] + 1 < maps[a].size() && maps[a][cursor[a] + 1].start == position)
+                ++cursor[a];
+        }
+    }
+    return out;
+}
+
+// Whether one range covers [first, last]. Slots are visited in address
+// order, so `cursor` (the range holding the previous slot) only moves
+// forward.
+bool IpInfoTable::Builder::uniform(const std::vector<Boundary> &ranges, size_t *cursor, Key first, Key last,
+                                   quint32 *value)
+{
+    while (*cursor + 1 < ranges.size() && ranges[*cursor + 1].start <= first)
+        ++*cursor;
+    *value = ranges[*cursor].value;
+    return *cursor + 1 == ranges.size() || ranges[*cursor + 1].start > last;
+}
+
+void IpInfoTable::Builder::fillNode(const std::vector<Boundary> &ranges, quint32 nodeIndex, Key base, int consumed,
+                                    TrieImage *trie)
+{
+    const int slotBits = 128 - consumed - kStride;
+    const Key span = (Key(1) << slotBits) - 1;
+    Node node;
+    memset(&node, 0, sizeof(node));
+    node.leafBase = quint32(trie->leaves.size());
+    size_t cursor = size_t(std::upper_bound(ranges.begin(), ranges.end(), base,
+                                            [](Key key, const Boundary &boundary) { return key < boundary.start; })
+                           - ranges.begin()) - 1;
+    bool haveLeaf = false;
+    quint32 previous = 0;
+    for (unsigned slot = 0; slot < 64; ++slot) {
+        const Key first = base | (Key(slot) << slotBits);
+        quint32 value = 0;
+        if (!uniform(ranges, &cursor, first, first | span, &value)) {
+            node.children |= quint64(1) << slot;
+        } else if (!haveLeaf || value != previous) {
+            node.leaves |= quint64(1) << slot;
+            trie->leaves.push_back(value);
+            previous = value;
+            haveLeaf = true;
+        }
+    }
+    node.childBase = quint32(trie->nodes.size());
+    trie->nodes.resize(trie->nodes.size() + size_t(__builtin_popcountll(node.children)));
+    trie->nodes[nodeIndex] = node;
+
+    quint32 child = node.childBase;
+    for (unsigned slot = 0; slot < 64; ++slot) {
+        if (node.children & (quint64(1) << slot))
+            fillNode(ranges, child++, base | (Key(slot) << slotBits), consumed + kStride, trie);
+    }
+}
+
+void IpInfoTable::Builder::buildTrie(const std::vector<Boundary> &ranges, TrieImage *trie)
+{
+    const int slotBits = 128 - kDirectBits;
+    const Key span = (Key(1) << slotBits) - 1;
+    trie->direct.resize(size_t(1) << kDirectBits);
+    size_t cursor = 0;
+    for (size_t slot = 0; slot < trie->direct.size(); ++slot) {
+        const Key first = Key(slot) << slotBits;
+        quint32 value = 0;
+        if (uniform(ranges, &cursor, first, first | span, &value)) {
+            trie->direct[slot] = kRecordFlag | value;
+        } else {
+            trie->direct[slot] = quint32(trie->nodes.size());
+            trie->nodes.push_back(Node());
+            fillNode(ranges, trie->direct[slot], first, kDirectBits, trie);
+        }
+    }
+}
+
+bool IpInfoTable::Builder::write(const QString &imagePath, CompileStats *stats, QString *error)
+{
+    records.clear();
+    recordIndex.clear();
+    const quint32 none[AttributeCount] = {};
+    internRecord(none);
+
+    TrieImage tries[2];
+    for (int family = 0; family < 2; ++family) {
+        const std::vector<Boundary> ranges = merge(intervals[family]);
+        buildTrie(ranges, &tries[family]);
+        if (tries[family].nodes.size() > kMaxIndex || tries[family].leaves.size() > kMaxIndex) {
+            *error = "Too many distinct prefixes for one image";
+            return false;
+        }
+    }
+    if (records.size() > kMaxIndex) {
+        *error = "Too many distinct records for one image";
+        return false;
+    }
+
+    ImageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kImageMagic, sizeof(header.magic));
+    header.version = kImageVersion;
+    header.recordCount = records.size();
+    header.recordsOffset = alignSection(sizeof(ImageHeader));
+    header.stringsOffset = alignSection(header.recordsOffset + records.size() * sizeof(IpInfoRecord));
+    header.stringsSize = quint64(strings.size());
+    quint64 offset = alignSection(header.stringsOffset + header.stringsSize);
+    TrieHeader *trieHeaders[2] = { &header.v4, &header.v6 };
+    for (int family = 0; family < 2; ++family) {
+        TrieHeader &trie = *trieHeaders[family];
+        trie.keyBits = family ? 128 : 32;
+        trie.directBits = kDirectBits;
+        trie.directOffset = offset;
+        trie.nodesOffset = alignSection(trie.directOffset + tries[family].direct.size() * sizeof(quint32));
+        trie.nodeCount = tries[family].nodes.size();
+        trie.leavesOffset = alignSection(trie.nodesOffset + trie.nodeCount * sizeof(Node));
+        trie.leafCount = tries[family].leaves.size();
+        offset = alignSection(trie.leavesOffset + trie.leafCount * sizeof(quint32));
+    }
+    header.fileSize = offset;
+
+    // Written beside the target and renamed over it, so a running process
+    // that has the old image mapped is never disturbed
+    const QString temporaryPath = imagePath + ".new";
+    QFile out(temporaryPath);
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        *error = out.errorString();
+        return false;
+    }
+    bool ok = true;
+    const auto section = [&out, &ok](quint64 at, const void *data, quint64 size) {
+        const quint64 gap = at - quint64(out.pos());
+        if (ok && gap > 0)
+            ok = out.write(QByteArray(int(gap), '\0')) == qint64(gap);
+        ok = ok && (size == 0 || out.write(static_cast<const char *>(data), qint64(size)) == qint64(size));
+    };
+    section(0, &header, sizeof(header));
+    section(header.recordsOffset, records.data(), records.size() * sizeof(IpInfoRecord));
+    section(header.stringsOffset, strings.constData(), header.stringsSize);
+    for (int family = 0; family < 2; ++family) {
+        const TrieHeader &trie = *trieHeaders[family];
+        section(trie.directOffset, tries[family].direct.data(), tries[family].direct.size() * sizeof(quint32));
+        section(trie.nodesOffset, tries[family].nodes.data(), trie.nodeCount * sizeof(Node));
+        section(trie.leavesOffset, tries[family].leaves.data(), trie.leafCount * sizeof(quint32));
+    }
+    section(header.fileSize, nullptr, 0);
+    out.close();
+    if (!ok || std::rename(QFile::encodeName(temporaryPath).constData(), QFile::encodeName(imagePath).constData()) != 0) {
+        *error = ok ? QString("Cannot replace %1").arg(imagePath) : out.errorString();
+        QFile::remove(temporaryPath);
+        return false;
+    }
+
+    stats->records = records.size();
+    stats->nodes = tries[0].nodes.size() + tries[1].nodes.size();
+    stats->imageBytes = header.fileSize;
+    return true;
+}
+
+bool IpInfoTable::compile(const QStringList &sourcePaths, const QString &imagePath, CompileStats *stats, QString *error)
+{
+    QElapsedTimer elapsed;
+    elapsed.start();
+    CompileStats local;
+    CompileStats &counts = stats ? *stats : local;
+    counts = CompileStats();
+
+    Builder builder;
+    for (const QString &path : sourcePaths) {
+        if (!builder.addFile(path, &counts, error))
+            return false;
+    }
+    if (!builder.write(imagePath, &counts, error))
+        return false;
+    counts.elapsedMs = elapsed.elapsed();
+    return true;
+}
+
+IpInfoTable::IpInfoTable()
+{
+}
+
+IpInfoTable::~IpInfoTable()
+{
+    close();
+}
+
+void IpInfoTable::close()
+{
+    if (map)
+        file.unmap(map);
+    file.close();
+    map = nullptr;
+    records = nullptr;
+    strings = nullptr;
+    stringsSize = 0;
+    recordTotal = 0;
+    v4 = Trie();
+    v6 = Trie();
+}
+
+bool IpInfoTable::open(const QString &imagePath)
+{
+    close();
+    file.setFileName(imagePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        lastError = file.errorString();
+        return false;
+    }
+    const quint64 size = quint64(file.size());
+    if (size < sizeof(ImageHeader)) {
+        lastError = "IP data image is truncated";
+        file.close();
+        return false;
+    }
+    map = file.map(0, qint64(size));
+    if (!map) {
+        lastError = file.errorString();
+        file.close();
+        return false;
+    }
+
+    ImageHeader header;
+    memcpy(&header, map, sizeof(header));
+    const auto sectionFits = [size](quint64 offset, quint64 count, quint64 itemSize) {
+        return offset % 64 == 0 && offset <= size && count <= (size - offset) / itemSize;
+    };
+    const auto trieValid = [&](const TrieHeader &trie, quint32 keyBits) {
+        return trie.keyBits == keyBits && trie.directBits == quint32(kDirectBits)
+               && sectionFits(trie.directOffset, quint64(1) << kDirectBits, sizeof(quint32))
+               && sectionFits(trie.nodesOffset, trie.nodeCount, sizeof(Node)) && trie.nodeCount <= kMaxIndex
+               && sectionFits(trie.leavesOffset, trie.leafCount, sizeof(quint32)) && trie.leafCount <= kMaxIndex;
+    };
+    const bool valid = memcmp(header.magic, kImageMagic, sizeof(header.magic)) == 0
+                       && header.version == kImageVersion && header.fileSize == size && header.recordCount > 0
+                       && header.recordCount <= kMaxIndex
+                       && sectionFits(header.recordsOffset, header.recordCount, sizeof(IpInfoRecord))
+                       && sectionFits(header.stringsOffset, header.stringsSize, 1)
+                       && trieValid(header.v4, 32) && trieValid(header.v6, 128);
+    if (!valid) {
+        lastError = "Not an IP data image, or from an incompatible version";
+        close();
+        return false;
+    }
+
+    recordTotal = header.recordCount;
+    records = reinterpret_cast<const IpInfoRecord *>(map + header.recordsOffset);
+    strings = reinterpret_cast<const char *>(map + header.stringsOffset);
+    stringsSize = header.stringsSize;
+    const TrieHeader *headers[2] = { &header.v4, &header.v6 };
+    Trie *tries[2] = { &v4, &v6 };
+    for (int family = 0; family < 2; ++family) {
+        tries[family]->direct = reinterpret_cast<const quint32 *>(map + headers[family]->directOffset);
+        tries[family]->nodes = reinterpret_cast<const Node *>(map + headers[family]->nodesOffset);
+        tries[family]->leaves = reinterpret_cast<const quint32 *>(map + headers[family]->leavesOffset);
+    }
+    return true;
+}
+
+template<int KeyBits>
+void IpInfoTable::lookupGroup(const Trie &trie, const quint64 *high, const quint64 *low, int count,
+                              const IpInfoRecord **out) const
+{
+    quint32 entry[kBatchLanes];
+    int active[kBatchLanes];
+    int live = 0;
+    for (int i = 0; i < count; ++i)
+        __builtin_prefetch(&trie.direct[high[i] >> (64 - kDirectBits)]);
+    for (int i = 0; i < count; ++i) {
+        entry[i] = trie.direct[high[i] >> (64 - kDirectBits)];
+        if (!(entry[i] & kRecordFlag)) {
+            __builtin_prefetch(&trie.nodes[entry[i]]);
+            active[live++] = i;
+        }
+    }
+
+    // Every lane still inside the trie descends one level per pass, so
+    // they share the bit offset; lanes that reach a leaf drop out
+    for (int offset = kDirectBits; live > 0; offset += kStride) {
+        int remaining = 0;
+        for (int k = 0; k < live; ++k) {
+            const int i = active[k];
+            const Node &node = trie.nodes[entry[i]];
+            const unsigned bit = chunk<KeyBits>(high[i], low[i], offset);
+            const quint64 mask = below(bit);
+            if (node.children & (quint64(1) << bit)) {
+                entry[i] = node.childBase + quint32(__builtin_popcountll(node.children & mask)) - 1;
+                __builtin_prefetch(&trie.nodes[entry[i]]);
+                active[remaining++] = i;
+            } else {
+                entry[i] = kRecordFlag | trie.leaves[node.leafBase + quint32(__builtin_popcountll(node.leaves & mask)) - 1];
+            }
+        }
+        live = remaining;
+    }
+    for (int i = 0; i < count; ++i) {
+        out[i] = records + (entry[i] & ~kRecordFlag);
+        __builtin_prefetch(out[i]);
+    }
+}
+
+namespace {
+
+// Shared by the single lookups; the batch walk is the same steps interleaved
+template<int KeyBits, typename Trie, typename Node>
+inline quint32 walk(const Trie &trie, quint64 high, quint64 low)
+{
+    quint32 entry = trie.direct[high >> (64 - kDirectBits)];
+    for (int offset = kDirectBits; !(entry & kRecordFlag); offset += kStride) {
+        const Node &node = trie.nodes[entry];
+        const unsigned bit = chunk<KeyBits>(high, low, offset);
+        const quint64 mask = below(bit);
+        if (node.children & (quint64(1) << bit))
+            entry = node.childBase + quint32(__builtin_popcountll(node.children & mask)) - 1;
+        else
+            entry = kRecordFlag | trie.leaves[node.leafBase + quint32(__builtin_popcountll(node.leaves & mask)) - 1];
+    }
+    return entry & ~kRecordFlag;
+}
+
+inline bool isMappedIpv4(const quint8 *address)
+{
+    static const quint8 prefix[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+    return memcmp(address, prefix, sizeof(prefix)) == 0;
+}
+
+inline quint64 readHigh(const quint8 *address)
+{
+    quint64 value = 0;
+    for (int i = 0; i < 8; ++i)
+        value = (value << 8) | address[i];
+    return value;
+}
+
+inline quint32 readIpv4(const quint8 *address)
+{
+    return (quint32(address[0]) << 24) | (quint32(address[1]) << 16) | (quint32(address[2]) << 8) | address[3];
+}
+
+} // namespace
+
+const IpInfoRecord *IpInfoTable::lookupV4(quint32 address) const
+{
+    if (!records)
+        return nullptr;
+    return records + walk<32, Trie, Node>(v4, quint64(address) << 32, 0);
+}
+
+const IpInfoRecord *IpInfoTable::lookupV6(const quint8 *address) const
+{
+    if (!records)
+        return nullptr;
+    if (isMappedIpv4(address))
+        return lookupV4(readIpv4(address + 12));
+    return records + walk<128, Trie, Node>(v6, readHigh(address), readHigh(address + 8));
+}
+
+const IpInfoRecord *IpInfoTable::lookup(const quint8 *address, bool ipv6) const
+{
+    return ipv6 ? lookupV6(address) : lookupV4(readIpv4(address));
+}
+
+void IpInfoTable::lookupV4(const quint32 *addresses, int count, const IpInfoRecord **out) const
+{
+    if (!records) {
+        std::fill(out, out + count, nullptr);
+        return;
+    }
+    quint64 high[kBatchLanes];
+    const quint64 low[kBatchLanes] = {};
+    for (int first = 0; first < count; first += kBatchLanes) {
+        const int lanes = qMin(kBatchLanes, count - first);
+        for (int i = 0; i < lanes; ++i)
+            high[i] = quint64(addresses[first + i]) << 32;
+        lookupGroup<32>(v4, high, low, lanes, out + first);
+    }
+}
+
+void IpInfoTable::lookupV6(const quint8 *addresses, int count, const IpInfoRecord **out) const
+{
+    if (!records) {
+        std::fill(out, out + count, nullptr);
+        return;
+    }
+    quint64 high[kBatchLanes];
+    quint64 low[kBatchLanes];
+    int index[kBatchLanes];
+    const IpInfoRecord *found[kBatchLanes];
+    int lanes = 0;
+    const auto flush = [&]() {
+        lookupGroup<128>(v6, high, low, lanes, found);
+        for (int i = 0; i < lanes; ++i)
+            out[index[i]] = found[i];
+        lanes = 0;
+    };
+    for (int i = 0; i < count; ++i) {
+        const quint8 *address = addresses + size_t(i) * 16;
+        if (isMappedIpv4(address)) {
+            out[i] = lookupV4(readIpv4(address + 12));
+            continue;
+        }
+        high[lanes] = readHigh(address);
+        low[lanes] = readHigh(address + 8);
+        index[lanes++] = i;
+        if (lanes == kBatchLanes)
+            flush();
+    }
+    if (lanes)
+        flush();
+}
+
+QString IpInfoTable::organization(const IpInfoRecord &record) const
+{
+    if (!strings || quint64(record.organization) + record.organizationLength > stringsSize)
+        return QString();
+    return QString::fromUtf8(strings + record.organization, record.organizationLength);
+}
+
+QString IpInfoTable::describe(const IpInfoRecord &record) const
+{
+    QStringList parts;
+    if (record.country[0])
+        parts.append(QString::fromLatin1(record.country, 2));
+    if (record.asn) {
+        const QString name = organization(record);
+        parts.append(name.isEmpty() ? QString("AS%1").arg(record.asn) : QString("AS%1 %2").arg(record.asn).arg(name));
+    }
+    if (record.risk)
+        parts.append(QString("risk %1").arg(record.risk));
+    return parts.join(", ");
+}
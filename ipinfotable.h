@@ -0,0 +1,116 @@
+#ifndef IPINFOTABLE_H
+#define IPINFOTABLE_H
+
+#include <QFile>
+#include <QString>
+#include <QStringList>
+
+// What is known about one address range. Record 0 is the empty record
+// every unlisted address maps to.
+struct IpInfoRecord
+{
+    quint32 asn;             // 0 when unknown
+    quint32 organization;    // Offset of the AS name in the string pool
+    quint16 organizationLength;
+    char country[2];         // ISO 3166 alpha-2; zeros when unknown
+    quint8 risk;             // 0-100 from reputation feeds; 0 when unlisted
+    quint8 reserved[3];
+};
+
+static_assert(sizeof(IpInfoRecord) == 16, "Records are mapped from disk and must stay 16 bytes");
+
+// Country, AS and reputation by longest-prefix match, compiled once into
+// an image file and mapped at load time: opening checks a header, and
+// pages are faulted in only as lookups touch them.
+//
+// Each address family is a Poptrie: the top 20 bits index a direct table
+// whose entries are either a record or a node, and every node resolves 6
+// more bits with two 64-bit maps. A set bit in `children` means the slot
+// continues in a child node, found by popcount among the node's
+// contiguous children; otherwise the slot is a leaf, found by popcount
+// of `leaves`, which marks only where the record changes, so runs of
+// equal leaves are stored once. A /24 takes one node, a /48 five.
+//
+// The image is trusted like the blocklist image: the header is checked
+// on open, node contents are not.
+class IpInfoTable
+{
+public:
+    struct CompileStats
+    {
+        quint64 lines = 0;
+        quint64 entries = 0;     // Prefixes and ranges accepted
+        quint64 invalid = 0;
+        quint64 records = 0;     // Distinct attribute combinations
+        quint64 nodes = 0;
+        quint64 imageBytes = 0;
+        qint64 elapsedMs = 0;
+    };
+
+    // Reads CSV or tab-separated files, each row a network ("10.0.0.0/8",
+    // "2001:db8::/32") or an inclusive "first,last" address range followed
+    // by values. A header row names the columns (country / country_code,
+    // asn / autonomous_system_number, organization / as_name, risk / score
+    // / reputation); without one, two letters read as a country, a number
+    // or "AS123" as an ASN and other text as the AS name. A file listing
+    // networks alone is a blocklist and marks them risk 100. For each
+    // attribute the longest matching prefix wins, across all files.
+    static bool compile(const QStringList &sourcePaths, const QString &imagePath, CompileStats *stats, QString *error);
+
+    IpInfoTable();
+    ~IpInfoTable();
+
+    bool open(const QString &imagePath);
+    void close();
+    bool isOpen() const { return records != nullptr; }
+    quint64 recordCount() const { return recordTotal; }
+    QString errorString() const { return lastError; }
+
+    // Never nullptr while open; IPv4-mapped IPv6 addresses use the IPv4 table
+    const IpInfoRecord *lookupV4(quint32 address) const;
+    const IpInfoRecord *lookupV6(const quint8 *address) const;
+    const IpInfoRecord *lookup(const quint8 *address, bool ipv6) const;
+    // Walks `count` lookups in lockstep, prefetching each one's next node
+    // while the others are resolved, so cache misses overlap
+    void lookupV4(const quint32 *addresses, int count, const IpInfoRecord **out) const;
+    void lookupV6(const quint8 *addresses, int count, const IpInfoRecord **out) const;
+
+    QString organization(const IpInfoRecord &record) const;
+    QString describe(const IpInfoRecord &record) const;
+
+private:
+    class Builder;
+
+    struct Node
+    {
+        quint64 children;
+        quint64 leaves;
+        quint32 leafBase;
+        quint32 childBase;
+        quint64 reserved;
+    };
+
+    struct Trie
+    {
+        const quint32 *direct = nullptr;
+        const Node *nodes = nullptr;
+        const quint32 *leaves = nullptr;
+    };
+
+    // Up to kBatchLanes lookups; keys are left-aligned 128-bit addresses
+    template<int KeyBits>
+    void lookupGroup(const Trie &trie, const quint64 *high, const quint64 *low, int count,
+                     const IpInfoRecord **out) const;
+
+    QFile file;
+    uchar *map = nullptr;
+    const IpInfoRecord *records = nullptr;
+    const char *strings = nullptr;
+    quint64 stringsSize = 0;
+    quint64 recordTotal = 0;
+    Trie v4;
+    Trie v6;
+    QString lastError;
+};
+
+#endif // IPINFOTABLE_H
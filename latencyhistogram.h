@@ -0,0 +1,82 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <QtGlobal>
+#include <array>
+
+// Fixed-size log-linear histogram for latency samples in nanoseconds.
+// Each power of two is split into 8 sub-buckets, giving ~12% worst-case
+// error on percentiles with no allocation and O(1) recording.
+class LatencyHistogram
+{
+public:
+    void record(quint64 nanos)
+    {
+        ++buckets[bucketFor(nanos)];
+        ++total;
+        sum += nanos;
+        if (nanos > maxValue)
+            maxValue = nanos;
+    }
+
+    void merge(const LatencyHistogram &other)
+    {
+        for (size_t i = 0; i < buckets.size(); ++i)
+            buckets[i] += other.buckets[i];
+        total += other.total;
+        sum += other.sum;
+        maxValue = qMax(maxValue, other.maxValue);
+    }
+
+    void reset() { *this = LatencyHistogram(); }
+
+    quint64 count() const { return total; }
+    quint64 max() const { return maxValue; }
+    quint64 mean() const { return total ? sum / total : 0; }
+
+    // Returns the upper bound of the bucket holding the given percentile
+    // (0-100), clamped to the largest recorded value.
+    quint64 percentile(double p) const
+    {
+        if (total == 0)
+            return 0;
+        const quint64 rank = quint64(double(total) * qBound(0.0, p, 100.0) / 100.0 + 0.5);
+        quint64 seen = 0;
+        for (size_t i = 0; i < buckets.size(); ++i) {
+            seen += buckets[i];
+            if (seen >= qMax<quint64>(rank, 1))
+                return qMin(upperBound(int(i)), maxValue);
+        }
+        return maxValue;
+    }
+
+private:
+    static const int kLinear = 16;
+    static const int kSubBits = 3;
+
+    static int bucketFor(quint64 v)
+    {
+        if (v < kLinear)
+            return int(v);
+        const int exponent = 63 - __builtin_clzll(v);
+        const int sub = int((v >> (exponent - kSubBits)) & ((1 << kSubBits) - 1));
+        return kLinear + (exponent - 4) * (1 << kSubBits) + sub;
+    }
+
+    static quint64 upperBound(int index)
+    {
+        if (index < kLinear)
+            return quint64(index);
+        const int exponent = (index - kLinear) / (1 << kSubBits) + 4;
+        const int sub = (index - kLinear) % (1 << kSubBits);
+        const quint64 step = quint64(1) << (exponent - kSubBits);
+        return (quint64(1) << exponent) + step * quint64(sub + 1) - 1;
+    }
+
+    std::array<quint64, kLinear + 60 * (1 << kSubBits)> buckets {};
+    quint64 total = 0;
+    quint64 sum = 0;
+    quint64 maxValue = 0;
+};
+
+#endif // LATENCYHISTOGRAM_H
@@ -1,4 +1,6 @@
 #include "mainwindow.h"
+#include "headlessmain.h"
+#include "parserworker.h"
 #include <QApplication>
 #include <QFontDatabase>
 #include <QFile>
@@ -6,6 +8,15 @@
 
 int main(int argc, char *argv[])
 {
+    // Sandboxed parser workers re-exec this binary; they must never
+    // construct the GUI application
+    if (argc > 1 && qstrcmp(argv[1], "--parser-worker") == 0)
+        return runParserWorker(argc, argv);
+
+    // Servers without a display scan and export through QCoreApplication
+    if (argc > 1 && qstrcmp(argv[1], "--headless") == 0)
+        return runHeadless(argc, argv);
+
     QApplication app(argc, argv);
 
     // Set application style
@@ -1,4 +1,14 @@
 #include "mainwindow.h"
+#include "daemonclient.h"
+#include "eventjournal.h"
+#include "metricsbus.h"
+#include "networktab.h"
+#include "quarantinestore.h"
+#include "securitytab.h"
+#include "statustab.h"
+#include "taskscheduler.h"
+#include "timeseriesstore.h"
+#include "vpntab.h"
 #include <QPixmap>
 #include <QHBoxLayout>
 #include <QFileDialog>
@@ -22,6 +32,13 @@
 #include <QImage>
 #include <QIcon>
 
+namespace {
+
+// Segments wholly older than this are deleted
+const qint64 kJournalRetentionSeconds = 30ll * 24 * 3600;
+
+} // namespace
+
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent), networkManager(new QNetworkAccessManager(this)), currentTab("Status")
 {
@@ -90,6 +107,11 @@ MainWindow::~MainWindow()
     if (collapsedContainer) {
         delete collapsedContainer;
     }
+    // The pages stop their engines, which may still be writing metrics
+    qDeleteAll(tabPages);
+    tabPages.clear();
+    TaskScheduler::instance()->setMetricsBus(nullptr);
+    delete metricsBus;
 }
 
 void MainWindow::setupFonts()
@@ -211,7 +233,12 @@ void MainWindow::setupUi()
     contentTitleLabel->setStyleSheet("color: #333333;");
 
     contentLayout->addWidget(contentTitleLabel, 0, Qt::AlignCenter);
-    contentLayout->addStretch(1);
+
+    // Pages for tabs that have real content; page 0 is an empty placeholder
+    tabStack = new QStackedWidget(contentArea);
+    tabStack->addWidget(new QWidget(tabStack));
+    contentLayout->addWidget(tabStack, 1);
+    createTabPages();
 
     // Create sidebar layout with perfect spacing
     sidebarLayout = new QVBoxLayout(sidebarFrame);
@@ -462,7 +489,52 @@ void MainWindow::updateCenterContent(const QString &tabName)
     // Update the content area title with the current tab name
     contentTitleLabel->setText(tabName);
 
-    // You can add more tab-specific content here in the future
+    // Switch to the tab's page, or the empty placeholder if it has none
+    tabStack->setCurrentWidget(tabPages.value(tabName, tabStack->widget(0)));
+}
+
+void MainWindow::createTabPages()
+{
+    QString dataPath = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+
+    quarantineStore = new QuarantineStore(this);
+    if (!quarantineStore->open(QuarantineStore::defaultDirectory())) {
+        qDebug() << "Quarantine unavailable:" << quarantineStore->errorString();
+    }
+
+    // A missing snapshot just means there is no history yet
+    const QString historyPath = dataPath + "/history.tsdb";
+    trafficHistory = new TimeSeriesStore(this);
+    if (QFile::exists(historyPath) && !trafficHistory->loadSnapshot(historyPath)) {
+        qDebug() << "Traffic history not restored:" << trafficHistory->errorString();
+    }
+
+    // Appends are dropped while it cannot be opened; the log stays empty
+    EventJournal::Options journalOptions;
+    journalOptions.directory = dataPath + "/journal";
+    journalOptions.retentionSeconds = kJournalRetentionSeconds;
+    eventJournal = new EventJournal(this);
+    if (!eventJournal->open(journalOptions)) {
+        qDebug() << "Event journal unavailable:" << eventJournal->errorString();
+    }
+
+    // Without a daemon the tabs run the engines themselves, as before
+    daemonClient = new DaemonClient(this);
+    if (!daemonClient->attach()) {
+        qDebug() << "Daemon not attached:" << daemonClient->errorString();
+    }
+
+    metricsBus = new MetricsBus();
+    TaskScheduler::instance()->setMetricsBus(metricsBus);
+    tabPages["Status"] = new StatusTab(metricsBus, eventJournal, daemonClient, tabStack);
+    tabPages["VPN"] = new VpnTab(dataPath + "/latency.cache", metricsBus, daemonClient, tabStack);
+    tabPages["Security"] = new SecurityTab(quarantineStore, metricsBus, eventJournal, tabStack);
+    tabPages["Network"] = new NetworkTab(trafficHistory, historyPath, dataPath + "/blocklist.rbl",
+                                         dataPath + "/firewall.rules", dataPath + "/ipinfo.rip", metricsBus, tabStack);
+
+    for (QWidget* page : tabPages) {
+        tabStack->addWidget(page);
+    }
 }
 
 // Create a FREE subscription badge using the provided SVG
@@ -23,6 +23,13 @@
 #include <QResizeEvent>
 #include <QHash>
 #include <QVariant>
+#include <QStackedWidget>
+
+class DaemonClient;
+class EventJournal;
+class MetricsBus;
+class QuarantineStore;
+class TimeSeriesStore;
 
 // Helper class to render SVG
 class SvgPainter : public QObject
@@ -83,6 +90,7 @@ private:
     QWidget* createFreeSubscriptionBadge(bool small = false);
     QWidget* createModernDivider(bool minimized = false);
     QWidget* createThreeDotsButton(bool smaller = false);
+    void createTabPages();
     void activateTab(const QString &tabName);
     void collapseSidebar();
     void expandSidebar();
@@ -106,6 +114,16 @@ private:
     // Content area
     QFrame *contentArea;
     QLabel *contentTitleLabel;
+    QStackedWidget *tabStack;
+    QMap<QString, QWidget*> tabPages;  // Tabs without an entry show only their title
+
+    // Engines shared by the tab pages; the metrics bus outlives them all,
+    // and so does the journal, a child of the window
+    QuarantineStore *quarantineStore;
+    TimeSeriesStore *trafficHistory;
+    EventJournal *eventJournal;
+    DaemonClient *daemonClient = nullptr;
+    MetricsBus *metricsBus = nullptr;
 
     // Pre-rendered button images for crisp display
     QPixmap expandButtonImage;
@@ -0,0 +1,128 @@
+#include "metricsbus.h"
+#include <QMutexLocker>
+
+MetricsProducer::MetricsProducer(const QString &name, int ringCapacity)
+    : label(name)
+{
+    quint32 capacity = 16;
+    while (capacity < quint32(qMax(ringCapacity, 1)))
+        capacity <<= 1;
+    ring.resize(capacity);
+    ringMask = capacity - 1;
+}
+
+int MetricsBus::metric(const QString &name, Kind kind, const QString &unit)
+{
+    QMutexLocker lock(&mutex);
+    for (size_t i = 0; i < infos.size(); ++i) {
+        if (infos[i].name == name)
+            return infos[i].kind == kind ? int(i) : -1;
+    }
+    if (infos.size() >= size_t(MetricsProducer::kMaxMetrics))
+        return -1;
+    infos.push_back({ name, unit, kind });
+    return int(infos.size()) - 1;
+}
+
+std::shared_ptr<MetricsProducer> MetricsBus::attach(const QString &name, int ringCapacity)
+{
+    std::shared_ptr<MetricsProducer> producer(new MetricsProducer(name, ringCapacity));
+    QMutexLocker lock(&mutex);
+    producers.push_back(producer);
+    return producer;
+}
+
+MetricsSnapshot MetricsBus::drain(qint64 nowNs, int sampleBudget)
+{
+    QMutexLocker lock(&mutex);
+    MetricsSnapshot snapshot;
+    snapshot.metrics.resize(int(infos.size()));
+    for (size_t i = 0; i < infos.size(); ++i) {
+        snapshot.metrics[int(i)].name = infos[i].name;
+        snapshot.metrics[int(i)].unit = infos[i].unit;
+        snapshot.metrics[int(i)].kind = infos[i].kind;
+    }
+    const int metricCount = int(infos.size());
+    quint64 counts[MetricsProducer::kMaxMetrics] = {};
+    for (int i = 0; i < metricCount; ++i)
+        counts[i] = retiredCounts[i];
+
+    // Samples, sharing the budget round-robin so one busy thread cannot
+    // starve the others; the starting producer rotates between drains
+    quint64 sampleCounts[MetricsProducer::kMaxMetrics] = {};
+    int budget = sampleBudget;
+    const size_t producerCount = producers.size();
+    for (size_t n = 0; n < producerCount && budget > 0; ++n) {
+        MetricsProducer &producer = *producers[(nextProducer + n) % producerCount];
+        const int share = qMax(1, budget / int(producerCount - n));
+        const quint32 head = producer.ringHead.load(std::memory_order_relaxed);
+        const quint32 tail = producer.ringTail.load(std::memory_order_acquire);
+        const quint32 take = qMin(tail - head, quint32(share));
+        for (quint32 k = 0; k < take; ++k) {
+            const MetricsProducer::Sample &sample = producer.ring[(head + k) & producer.ringMask];
+            if (sample.metric < 0 || sample.metric >= metricCount)
+                continue;
+            MetricsSnapshot::Metric &metric = snapshot.metrics[sample.metric];
+            metric.samples.record(quint64(qMax<qint64>(sample.value, 0)));
+            lastSamples[sample.metric] = sample.value;
+            ++sampleCounts[sample.metric];
+        }
+        producer.ringHead.store(head + take, std::memory_order_release);
+        budget -= int(take);
+        snapshot.samplesDrained += take;
+    }
+    nextProducer = producerCount ? (nextProducer + 1) % producerCount : 0;
+
+    quint64 dropped = droppedByRetired;
+    for (size_t p = 0; p < producers.size();) {
+        MetricsProducer &producer = *producers[p];
+        // Read before the rest, so a retired producer is known to have
+        // written everything it ever will
+        const bool retired = producer.retired.load(std::memory_order_acquire);
+        for (int i = 0; i < metricCount; ++i) {
+            const quint64 value = producer.counters[i].load(std::memory_order_relaxed);
+            counts[i] += value;
+            const quint64 writes = producer.gaugeWrites[i].load(std::memory_order_acquire);
+            if (writes != producer.gaugeWritesSeen[i]) {
+                merged += writes - producer.gaugeWritesSeen[i] - 1;
+                producer.gaugeWritesSeen[i] = writes;
+            }
+            if (infos[size_t(i)].kind == Gauge && !retired)
+                snapshot.metrics[i].value += producer.gauges[i].load(std::memory_order_relaxed);
+        }
+        const quint64 producerDropped = producer.dropped.load(std::memory_order_relaxed);
+        dropped += producerDropped;
+        const quint32 pending = producer.ringTail.load(std::memory_order_acquire)
+                                - producer.ringHead.load(std::memory_order_relaxed);
+        if (retired && pending == 0) {
+            for (int i = 0; i < metricCount; ++i)
+                retiredCounts[i] += producer.counters[i].load(std::memory_order_relaxed);
+            droppedByRetired += producerDropped;
+            producers.erase(producers.begin() + std::ptrdiff_t(p));
+            continue;
+        }
+        snapshot.samplesPending += pending;
+        ++p;
+    }
+
+    const qint64 intervalNs = lastDrainNs >= 0 ? nowNs - lastDrainNs : 0;
+    for (int i = 0; i < metricCount; ++i) {
+        MetricsSnapshot::Metric &metric = snapshot.metrics[i];
+        if (metric.kind == Counter) {
+            metric.value = qint64(counts[i]);
+            if (intervalNs > 0)
+                metric.ratePerSecond = double(counts[i] - lastCounts[i]) * 1e9 / double(intervalNs);
+            lastCounts[i] = counts[i];
+        } else if (metric.kind == Sample) {
+            metric.value = lastSamples[i];
+            if (intervalNs > 0)
+                metric.ratePerSecond = double(sampleCounts[i]) * 1e9 / double(intervalNs);
+        }
+    }
+    lastDrainNs = nowNs;
+    snapshot.producers = int(producers.size());
+    snapshot.intervalNs = intervalNs;
+    snapshot.samplesDropped = dropped;
+    snapshot.gaugesMerged = merged;
+    return snapshot;
+}
@@ -0,0 +1,164 @@
+#ifndef METRICSBUS_H
+#define METRICSBUS_H
+
+#include <QMutex>
+#include <QString>
+#include <QVector>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "latencyhistogram.h"
+
+// What engine threads write to a MetricsProducer. Only the thread that
+// attached the producer writes to it; nothing on that path takes a lock
+// or wakes another thread.
+class MetricsProducer
+{
+public:
+    static const int kMaxMetrics = 64;
+
+    // Counters only go up: packets, bytes, files
+    void add(int metric, quint64 delta = 1)
+    {
+        std::atomic<quint64> &value = counters[metric];
+        value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    // Gauges keep their latest value: a queue depth, a connection count.
+    // Sets the aggregator never saw are counted as merged.
+    void set(int metric, qint64 value)
+    {
+        gauges[metric].store(value, std::memory_order_relaxed);
+        std::atomic<quint64> &writes = gaugeWrites[metric];
+        writes.store(writes.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Samples go through the ring one by one, for latencies and other
+    // distributions. False when the ring is full; the sample is counted
+    // as dropped rather than waiting for the GUI.
+    bool record(int metric, qint64 value)
+    {
+        const quint32 tail = ringTail.load(std::memory_order_relaxed);
+        if (tail - cachedHead == quint32(ring.size())) {
+            cachedHead = ringHead.load(std::memory_order_acquire);
+            if (tail - cachedHead == quint32(ring.size())) {
+                dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        ring[tail & ringMask] = { metric, value };
+        ringTail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // The producer's thread is done with it; the bus forgets it once its
+    // last samples are drained, keeping its counters in the totals
+    void retire() { retired.store(true, std::memory_order_release); }
+
+    QString name() const { return label; }
+
+private:
+    friend class MetricsBus;
+
+    struct Sample
+    {
+        int metric;
+        qint64 value;
+    };
+
+    MetricsProducer(const QString &name, int ringCapacity);
+
+    QString label;
+    std::atomic<quint64> counters[kMaxMetrics] = {};
+    std::atomic<qint64> gauges[kMaxMetrics] = {};
+    std::atomic<quint64> gaugeWrites[kMaxMetrics] = {};
+    std::atomic<quint64> dropped { 0 };
+    std::atomic<bool> retired { false };
+
+    // Single-producer single-consumer ring; head and tail on lines of
+    // their own so the two sides only share a line when one catches up
+    std::vector<Sample> ring;
+    quint32 ringMask = 0;
+    alignas(64) std::atomic<quint32> ringTail { 0 };
+    quint32 cachedHead = 0;                   // Producer's last view of ringHead
+    alignas(64) std::atomic<quint32> ringHead { 0 };
+    // Consumer side, touched only by drain()
+    quint64 gaugeWritesSeen[kMaxMetrics] = {};
+};
+
+// One drain of the bus
+struct MetricsSnapshot
+{
+    struct Metric
+    {
+        QString name;
+        QString unit;
+        int kind = 0;                 // MetricsBus::Kind
+        qint64 value = 0;             // Counter total, gauge sum, or last sample
+        double ratePerSecond = 0;     // Counters and samples, over the last interval
+        LatencyHistogram samples;     // Samples of the last interval
+    };
+
+    QVector<Metric> metrics;
+    int producers = 0;
+    qint64 intervalNs = 0;
+    quint64 samplesDrained = 0;       // This drain
+    quint64 samplesPending = 0;       // Left in the rings for the next one
+    // Since the bus was created
+    quint64 samplesDropped = 0;       // Rings were full
+    quint64 gaugesMerged = 0;         // Overwritten before a drain saw them
+};
+
+// Carries engine metrics to the GUI without a signal per update. Engine
+// threads attach a producer each and write to it; the GUI thread calls
+// drain() at display rate and gets one snapshot of every metric.
+//
+// drain() reads each producer's counters and gauges and at most
+// `sampleBudget` samples from their rings, so its cost depends on the
+// number of metrics and threads, not on how fast they are written.
+// Samples beyond the budget wait in the rings, and once a ring is full
+// further samples are dropped and counted. Gauges hold only their latest
+// value; sets between two drains are merged, and counted as well.
+class MetricsBus
+{
+public:
+    enum Kind { Counter, Gauge, Sample };
+
+    static const int kDefaultRingCapacity = 4096;
+
+    // Registers a metric, or returns the id it already has. At most
+    // MetricsProducer::kMaxMetrics; -1 beyond that or on a kind mismatch.
+    int metric(const QString &name, Kind kind, const QString &unit = QString());
+
+    // Called on the engine thread that will write to the producer; the
+    // producer stays valid until that thread retires it
+    std::shared_ptr<MetricsProducer> attach(const QString &name, int ringCapacity = kDefaultRingCapacity);
+
+    MetricsSnapshot drain(qint64 nowNs, int sampleBudget);
+
+private:
+    struct MetricInfo
+    {
+        QString name;
+        QString unit;
+        Kind kind;
+    };
+
+    // Guards the registry and the producer list, which change only when
+    // metrics are registered and threads attach; drain() holds it, the
+    // writers never do
+    mutable QMutex mutex;
+    std::vector<MetricInfo> infos;
+    std::vector<std::shared_ptr<MetricsProducer>> producers;
+    size_t nextProducer = 0;                  // Where the sample budget starts next drain
+
+    // Counters of retired producers, so totals never go backwards
+    quint64 retiredCounts[MetricsProducer::kMaxMetrics] = {};
+    quint64 lastCounts[MetricsProducer::kMaxMetrics] = {};
+    qint64 lastSamples[MetricsProducer::kMaxMetrics] = {};
+    quint64 droppedByRetired = 0;
+    quint64 merged = 0;
+    qint64 lastDrainNs = -1;
+};
+
+#endif // METRICSBUS_H
@@ -0,0 +1,93 @@
+#include "metricsmodel.h"
+#include <QLocale>
+
+namespace {
+
+QString formatValue(double value, const QString &unit)
+{
+    if (unit == "B")
+        return QLocale().formattedDataSize(qint64(value));
+    if (unit == "ns")
+        return value < 1e6 ? QString("%1 us").arg(value / 1e3, 0, 'f', 1) : QString("%1 ms").arg(value / 1e6, 0, 'f', 1);
+    const QString number = QLocale().toString(qint64(value));
+    return unit.isEmpty() ? number : number + " " + unit;
+}
+
+} // namespace
+
+MetricsModel::MetricsModel(QObject *parent)
+    : QAbstractTableModel(parent)
+{
+}
+
+int MetricsModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : rows.size();
+}
+
+int MetricsModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : ColumnCount;
+}
+
+QVariant MetricsModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= rows.size())
+        return QVariant();
+
+    const MetricsSnapshot::Metric &metric = rows.at(index.row());
+    if (role == Qt::TextAlignmentRole && index.column() != MetricColumn)
+        return int(Qt::AlignRight | Qt::AlignVCenter);
+    if (role != Qt::DisplayRole)
+        return QVariant();
+
+    const bool sample = metric.kind == MetricsBus::Sample;
+    switch (index.column()) {
+    case MetricColumn:
+        return metric.name;
+    case ValueColumn:
+        return formatValue(double(metric.value), metric.unit);
+    case RateColumn:
+        // Samples count per second whatever their unit
+        if (metric.kind == MetricsBus::Gauge)
+            return QVariant();
+        return sample ? QString("%1/s").arg(QLocale().toString(qint64(metric.ratePerSecond)))
+                      : formatValue(metric.ratePerSecond, metric.unit) + "/s";
+    case MedianColumn:
+        return sample && metric.samples.count() ? formatValue(double(metric.samples.percentile(50)), metric.unit)
+                                                : QVariant();
+    case TailColumn:
+        return sample && metric.samples.count() ? formatValue(double(metric.samples.percentile(99)), metric.unit)
+                                                : QVariant();
+    default:
+        return QVariant();
+    }
+}
+
+QVariant MetricsModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation != Qt::Horizontal || role != Qt::DisplayRole)
+        return QVariant();
+
+    switch (section) {
+    case MetricColumn: return tr("Metric");
+    case ValueColumn: return tr("Value");
+    case RateColumn: return tr("Rate");
+    case MedianColumn: return tr("p50");
+    case TailColumn: return tr("p99");
+    default: return QVariant();
+    }
+}
+
+void MetricsModel::update(const MetricsSnapshot &snapshot)
+{
+    if (snapshot.metrics.size() != rows.size()) {
+        beginResetModel();
+        rows = snapshot.metrics;
+        endResetModel();
+        return;
+    }
+    rows = snapshot.metrics;
+    if (!rows.isEmpty())
+        emit dataChanged(index(0, 0), index(rows.size() - 1, ColumnCount - 1));
+}
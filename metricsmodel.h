@@ -0,0 +1,37 @@
+#ifndef METRICSMODEL_H
+#define METRICSMODEL_H
+
+#include <QAbstractTableModel>
+#include "metricsbus.h"
+
+// One row per metric on the bus, replaced wholesale by each snapshot.
+// Rows only change when a metric is registered, so an update is a single
+// dataChanged over the table.
+class MetricsModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+    enum Column {
+        MetricColumn = 0,
+        ValueColumn,
+        RateColumn,
+        MedianColumn,
+        TailColumn,
+        ColumnCount
+    };
+
+    explicit MetricsModel(QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+    void update(const MetricsSnapshot &snapshot);
+
+private:
+    QVector<MetricsSnapshot::Metric> rows;
+};
+
+#endif // METRICSMODEL_H
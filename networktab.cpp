@@ -0,0 +1,839 @@
+#include "networktab.h"
+#include "chartwidget.h"
+#include "connectiontablemodel.h"
+#include "firewallrulemodel.h"
+#include "flowrecordmodel.h"
+#include "flowtable.h"
+#include "portscanmodel.h"
+#include "traffichistory.h"
+#include <QDateTime>
+#include <QFile>
+#include <QFileDialog>
+#include <QHBoxLayout>
+#include <QHeaderView>
+#include <QLocale>
+#include <QNetworkInterface>
+#include <QVBoxLayout>
+
+namespace {
+
+// Sized for a desktop: ~85 MB of slots, committed only as flows arrive
+const quint64 kMaxFlows = 1000000;
+const int kFlowRecordRows = 10000;
+const int kScanResultRows = 100000;
+
+const qint64 kResolutionSeconds[TimeSeriesStore::ResolutionCount] = { 1, 60, 3600 };
+// The chart decimates to its width, so a finer tier is worth loading
+const int kHistoryMaxPoints = 20000;
+
+} // namespace
+
+NetworkTab::NetworkTab(TimeSeriesStore *history, const QString &historyPath, const QString &blocklistPath,
+                       const QString &firewallPath, const QString &ipInfoPath, MetricsBus *metrics,
+                       QWidget *parent)
+    : QWidget(parent), metrics(metrics), ipInfoPath(ipInfoPath), history(history), blocklistPath(blocklistPath),
+      firewallPath(firewallPath)
+{
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->setContentsMargins(0, 10, 0, 0);
+    layout->setSpacing(10);
+
+    sections = new QTabWidget(this);
+    sections->setDocumentMode(true);
+    sections->addTab(createConnectionsSection(), "Connections");
+    sections->addTab(createCaptureSection(), "Capture");
+    sections->addTab(createFlowsSection(), "Flows");
+    sections->addTab(createHistorySection(), "History");
+    sections->addTab(createDnsSection(), "DNS Filter");
+    sections->addTab(createFirewallSection(), "Firewall");
+    sections->addTab(createDiscoverySection(), "Discovery");
+    layout->addWidget(sections, 1);
+
+    connectionModel->setClassifier(&firewallModel->classifier());
+    connect(firewallModel, &FirewallRuleModel::rulesChanged, connectionModel, &ConnectionTableModel::reclassify);
+
+    // Shares the collector thread with the connection monitor, whose
+    // diffs carry the per-process byte counts
+    trafficHistory = new TrafficHistory(history, historyPath);
+    trafficHistory->moveToThread(&collectorThread);
+    connect(&collectorThread, &QThread::started, trafficHistory, &TrafficHistory::start);
+    connect(&collectorThread, &QThread::finished, trafficHistory, &TrafficHistory::stop);
+    connect(&collectorThread, &QThread::finished, trafficHistory, &QObject::deleteLater);
+    connect(connectionMonitor, &ConnectionMonitor::diffReady, trafficHistory, &TrafficHistory::onConnectionDiff);
+
+    collectorThread.start();
+}
+
+NetworkTab::~NetworkTab()
+{
+    // The engine holds a raw pointer to the flow table
+    captureEngine->requestStop();
+    captureEngine->wait();
+    collectorThread.quit();
+    collectorThread.wait();
+    // The compilers report back to this tab
+    imports.cancel();
+    TaskScheduler::instance()->wait(imports);
+}
+
+QTableView* NetworkTab::createTableView(QAbstractItemModel *model)
+{
+    QTableView *view = new QTableView(this);
+    view->setModel(model);
+    view->setSelectionBehavior(QAbstractItemView::SelectRows);
+    view->setShowGrid(false);
+    view->setAlternatingRowColors(true);
+    view->verticalHeader()->hide();
+    // Fixed row heights keep scrolling independent of the row count
+    view->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+    view->verticalHeader()->setDefaultSectionSize(24);
+    view->horizontalHeader()->setStretchLastSection(true);
+    view->setStyleSheet(
+        "QTableView { border: 1px solid #e0e0e0; border-radius: 4px; background-color: white; }"
+        "QHeaderView::section { background-color: #f8f8f8; border: none; padding: 6px; }"
+        );
+    return view;
+}
+
+QPushButton* NetworkTab::createActionButton(const QString &text)
+{
+    QPushButton *button = new QPushButton(text, this);
+    button->setCursor(Qt::PointingHandCursor);
+    button->setFocusPolicy(Qt::NoFocus);
+    button->setStyleSheet(
+        "QPushButton {"
+        "   border: none;"
+        "   border-radius: 4px;"
+        "   background-color: #f8f8f8;"
+        "   padding: 6px 12px;"
+        "}"
+        "QPushButton:hover { background-color: #f0f0f0; }"
+        "QPushButton:pressed { background-color: #e8e8e8; }"
+        );
+    return button;
+}
+
+QWidget* NetworkTab::createConnectionsSection()
+{
+    QWidget *section = new QWidget(this);
+    QVBoxLayout *layout = new QVBoxLayout(section);
+    layout->setContentsMargins(0, 8, 0, 0);
+
+    QHBoxLayout *controls = new QHBoxLayout();
+    importIpInfoButton = createActionButton("Import IP data...");
+    connect(importIpInfoButton, &QPushButton::clicked, this, &NetworkTab::onImportIpInfoClicked);
+    ipInfoLabel = new QLabel(section);
+    ipInfoLabel->setStyleSheet("color: #777777;");
+    controls->addWidget(importIpInfoButton);
+    controls->addWidget(ipInfoLabel, 1);
+    layout->addLayout(controls);
+
+    connectionStatsLabel = new QLabel("Collecting connections...", section);
+    connectionStatsLabel->setStyleSheet("color: #777777;");
+    layout->addWidget(connectionStatsLabel);
+
+    connectionModel = new ConnectionTableModel(this);
+    QTableView *view = createTableView(connectionModel);
+    view->setColumnWidth(ConnectionTableModel::ProcessColumn, 200);
+    view->setColumnWidth(ConnectionTableModel::LocalColumn, 220);
+    view->setColumnWidth(ConnectionTableModel::RemoteColumn, 220);
+    view->setColumnWidth(ConnectionTableModel::OriginColumn, 240);
+    layout->addWidget(view, 1);
+    openIpInfo();
+
+    connectionMonitor = new ConnectionMonitor();
+    connectionMonitor->setMetricsBus(metrics);
+    connectionMonitor->moveToThread(&collectorThread);
+    connect(&collectorThread, &QThread::started, connectionMonitor, [this]() { connectionMonitor->start(1000); });
+    connect(&collectorThread, &QThread::finished, connectionMonitor, &QObject::deleteLater);
+    connect(connectionMonitor, &ConnectionMonitor::diffReady, this, &NetworkTab::onConnectionDiff);
+    connect(connectionMonitor, &ConnectionMonitor::error, this, &NetworkTab::onMonitorError);
+
+    return section;
+}
+
+void NetworkTab::onConnectionDiff(const ConnectionDiff &diff)
+{
+    connectionModel->applyDiff(diff);
+
+    const ConnectionRefreshStats &stats = diff.stats;
+    connectionStatsLabel->setText(
+        QString("%1 sockets  ·  +%2 −%3 ~%4  ·  refresh %5 ms wall, %6 ms CPU (netlink %7 ms, PID scan %8 ms)%9")
+            .arg(stats.sockets).arg(stats.added).arg(stats.removed).arg(stats.changed)
+            .arg(stats.wallMicros / 1000.0, 0, 'f', 1)
+            .arg(stats.cpuMicros / 1000.0, 0, 'f', 1)
+            .arg(stats.netlinkMicros / 1000.0, 0, 'f', 1)
+            .arg(stats.inodeScanMicros / 1000.0, 0, 'f', 1)
+            .arg(stats.unresolvedInodes ? QString("  ·  %1 unresolved").arg(stats.unresolvedInodes) : QString()));
+}
+
+void NetworkTab::onMonitorError(const QString &message)
+{
+    connectionStatsLabel->setText(message);
+}
+
+void NetworkTab::openIpInfo()
+{
+    // The model never sees a table mid-reopen: both run on this thread
+    connectionModel->setIpInfo(nullptr);
+    if (!QFile::exists(ipInfoPath)) {
+        ipInfoLabel->setText("Import GeoIP, ASN or reputation CSVs to label remote addresses");
+        return;
+    }
+    if (!ipInfo.open(ipInfoPath)) {
+        ipInfoLabel->setText(ipInfo.errorString());
+        return;
+    }
+    ipInfoLabel->setText(QString("IP data: %1 distinct records").arg(QLocale().toString(ipInfo.recordCount())));
+    connectionModel->setIpInfo(&ipInfo);
+}
+
+void NetworkTab::onImportIpInfoClicked()
+{
+    const QStringList sources = QFileDialog::getOpenFileNames(this, tr("Import IP Data"), QString(),
+                                                              tr("CSV and TSV files (*.csv *.tsv *.txt);;All files (*)"));
+    if (sources.isEmpty())
+        return;
+
+    // The selected files replace the previous import as a whole, since
+    // per-attribute longest-prefix resolution needs every source at once
+    importIpInfoButton->setEnabled(false);
+    ipInfoLabel->setText(QString("Compiling %1 files...").arg(sources.size()));
+    const QString image = ipInfoPath;
+    TaskScheduler *scheduler = TaskScheduler::instance();
+    scheduler->post(scheduler->taskType("import"), TaskScheduler::Background, [this, sources, image]() {
+        IpInfoTable::CompileStats stats;
+        QString message;
+        const bool ok = IpInfoTable::compile(sources, image, &stats, &message);
+        QMetaObject::invokeMethod(this, [this, ok, stats, message]() { onIpInfoCompiled(ok, stats, message); },
+                                  Qt::QueuedConnection);
+    }, imports);
+}
+
+void NetworkTab::onIpInfoCompiled(bool ok, const IpInfoTable::CompileStats &stats, const QString &message)
+{
+    importIpInfoButton->setEnabled(true);
+    if (!ok) {
+        ipInfoLabel->setText("Import failed: " + message);
+        return;
+    }
+    openIpInfo();
+    if (ipInfo.isOpen())
+        ipInfoLabel->setText(QString("Imported %1 networks from %2 lines in %3 ms (%4 invalid)  ·  %5 records, %6 image")
+                                 .arg(QLocale().toString(stats.entries))
+                                 .arg(QLocale().toString(stats.lines))
+                                 .arg(stats.elapsedMs)
+                                 .arg(stats.invalid)
+                                 .arg(QLocale().toString(stats.records))
+                                 .arg(QLocale().formattedDataSize(qint64(stats.imageBytes))));
+}
+
+QWidget* NetworkTab::createCaptureSection()
+{
+    QWidget *section = new QWidget(this);
+    QVBoxLayout *layout = new QVBoxLayout(section);
+    layout->setContentsMargins(0, 8, 0, 0);
+
+    QHBoxLayout *controls = new QHBoxLayout();
+    interfaceCombo = new QComboBox(section);
+    interfaceCombo->addItem("All interfaces", QString());
+    for (const QNetworkInterface &interface : QNetworkInterface::allInterfaces())
+        interfaceCombo->addItem(interface.humanReadableName(), interface.name());
+    captureButton = createActionButton("Start capture");
+    replayButton = createActionButton("Replay capture file...");
+    connect(captureButton, &QPushButton::clicked, this, &NetworkTab::onCaptureClicked);
+    connect(replayButton, &QPushButton::clicked, this, &NetworkTab::onReplayClicked);
+    controls->addWidget(interfaceCombo);
+    controls->addWidget(captureButton);
+    controls->addWidget(replayButton);
+    controls->addStretch(1);
+    layout->addLayout(controls);
+
+    captureSourceLabel = new QLabel("Not capturing", section);
+    captureStatsLabel = new QLabel(section);
+    captureStatsLabel->setStyleSheet("color: #777777;");
+    layout->addWidget(captureSourceLabel);
+    layout->addWidget(captureStatsLabel);
+    layout->addStretch(1);
+
+    captureEngine = new CaptureEngine(this);
+    captureEngine->setMetricsBus(metrics);
+    connect(captureEngine, &CaptureEngine::statsUpdated, this, &NetworkTab::onCaptureStats);
+    connect(captureEngine, &CaptureEngine::error, this, &NetworkTab::onCaptureError);
+    connect(captureEngine, &QThread::finished, this, &NetworkTab::onCaptureFinished);
+
+    return section;
+}
+
+void NetworkTab::startCapture(PacketSource *source, const QString &label)
+{
+    captureEngine->setSource(source);
+    captureEngine->start();
+    captureSourceLabel->setText(label);
+    captureStatsLabel->clear();
+    captureButton->setText("Stop");
+    replayButton->setEnabled(false);
+    interfaceCombo->setEnabled(false);
+}
+
+void NetworkTab::onCaptureClicked()
+{
+    if (captureEngine->isRunning()) {
+        captureEngine->requestStop();
+        return;
+    }
+
+    TpacketV3Source::Options options;
+    options.interfaceName = interfaceCombo->currentData().toString();
+    startCapture(new TpacketV3Source(options), "Capturing on " + interfaceCombo->currentText());
+}
+
+void NetworkTab::onReplayClicked()
+{
+    QString path = QFileDialog::getOpenFileName(this, tr("Replay Capture"), QString(),
+                                                tr("Packet captures (*.pcap *.pcapng *.cap);;All files (*)"));
+    if (path.isEmpty())
+        return;
+    startCapture(new PcapReplaySource(path), "Replaying " + path);
+}
+
+void NetworkTab::onCaptureStats(const CaptureStats &stats)
+{
+    captureStatsLabel->setText(
+        QString("%1 packets, %2  ·  %3 pps  ·  %4 dropped, %5 ring full  ·  batch latency p50 %6 ms, p99 %7 ms%8")
+            .arg(stats.packets)
+            .arg(QLocale().formattedDataSize(qint64(stats.bytes)))
+            .arg(QLocale().toString(stats.packetsPerSecond, 'f', 0))
+            .arg(stats.kernelDrops)
+            .arg(stats.ringFreezes)
+            .arg(stats.batchLatency.percentile(50) / 1e6, 0, 'f', 2)
+            .arg(stats.batchLatency.percentile(99) / 1e6, 0, 'f', 2)
+            .arg(stats.undecoded ? QString("  ·  %1 non-IP").arg(stats.undecoded) : QString()));
+}
+
+void NetworkTab::onCaptureError(const QString &message)
+{
+    captureStatsLabel->setText(message);
+}
+
+void NetworkTab::onCaptureFinished()
+{
+    captureSourceLabel->setText("Not capturing");
+    captureButton->setText("Start capture");
+    replayButton->setEnabled(true);
+    interfaceCombo->setEnabled(true);
+}
+
+QWidget* NetworkTab::createFlowsSection()
+{
+    QWidget *section = new QWidget(this);
+    QVBoxLayout *layout = new QVBoxLayout(section);
+    layout->setContentsMargins(0, 8, 0, 0);
+
+    flowStatsLabel = new QLabel("Start a capture to aggregate flows", section);
+    flowStatsLabel->setStyleSheet("color: #777777;");
+    layout->addWidget(flowStatsLabel);
+
+    flowModel = new FlowRecordModel(kFlowRecordRows, this);
+    QTableView *view = createTableView(flowModel);
+    view->setColumnWidth(FlowRecordModel::InitiatorColumn, 240);
+    view->setColumnWidth(FlowRecordModel::ResponderColumn, 240);
+    view->setColumnWidth(FlowRecordModel::ApplicationColumn, 220);
+    layout->addWidget(view, 1);
+
+    flowTable.reset(new FlowTable(kMaxFlows));
+    captureEngine->addSink(flowTable.get());
+
+    connect(&flowTimer, &QTimer::timeout, this, &NetworkTab::refreshFlows);
+    flowTimer.start(1000);
+
+    return section;
+}
+
+void NetworkTab::refreshFlows()
+{
+    QVector<FlowRecord> records;
+    flowTable->drainRecords(records, kFlowRecordRows);
+    flowModel->appendRecords(records);
+
+    const FlowTableStats stats = flowTable->stats();
+    if (stats.packets == 0)
+        return;
+    flowStatsLabel->setText(
+        QString("%1 active flows (%2% of slots)  ·  probe avg %3, max %4  ·  %5 evicted, %6 idle, %7 closed, %8 exported  ·  "
+                "%9 TLS, %10 HTTP  ·  %11")
+            .arg(QLocale().toString(stats.liveFlows))
+            .arg(stats.occupancy() * 100, 0, 'f', 1)
+            .arg(stats.averageProbe(), 0, 'f', 2)
+            .arg(stats.maxProbe)
+            .arg(stats.evictions)
+            .arg(stats.idleExpiries)
+            .arg(stats.closedExpiries)
+            .arg(stats.activeExports)
+            .arg(stats.tlsFlows)
+            .arg(stats.httpFlows)
+            .arg(QLocale().formattedDataSize(qint64(stats.memoryBytes))));
+}
+
+QWidget* NetworkTab::createHistorySection()
+{
+    QWidget *section = new QWidget(this);
+    QVBoxLayout *layout = new QVBoxLayout(section);
+    layout->setContentsMargins(0, 8, 0, 0);
+
+    QHBoxLayout *controls = new QHBoxLayout();
+    historySeriesCombo = new QComboBox(section);
+    historySeriesCombo->setMinimumWidth(260);
+    historySpanCombo = new QComboBox(section);
+    historySpanCombo->addItem("Last hour", 3600);
+    historySpanCombo->addItem("Last 24 hours", 24 * 3600);
+    historySpanCombo->addItem("Last 7 days", 7 * 24 * 3600);
+    historySpanCombo->addItem("Last year", 365 * 24 * 3600);
+    controls->addWidget(historySeriesCombo);
+    controls->addWidget(historySpanCombo);
+    controls->addStretch(1);
+    layout->addLayout(controls);
+
+    historyChart = new ChartWidget(section);
+    layout->addWidget(historyChart, 1);
+
+    historyStatsLabel = new QLabel(section);
+    historyStatsLabel->setStyleSheet("color: #777777;");
+    layout->addWidget(historyStatsLabel);
+
+    connect(historySeriesCombo, &QComboBox::currentIndexChanged, this, &NetworkTab::loadHistory);
+    connect(historySpanCombo, &QComboBox::currentIndexChanged, this, &NetworkTab::loadHistory);
+    connect(&historyTimer, &QTimer::timeout, this, &NetworkTab::refreshHistory);
+    historyTimer.start(1000);
+
+    updateHistorySeriesList();
+    return section;
+}
+
+void NetworkTab::updateHistorySeriesList()
+{
+    QStringList names = history->seriesNames();
+    if (names.size() == historySeriesCombo->count())
+        return;
+    names.sort();
+
+    const QString selected = historySeriesCombo->currentText();
+    historySeriesCombo->blockSignals(true);
+    historySeriesCombo->clear();
+    historySeriesCombo->addItems(names);
+    historySeriesCombo->setCurrentIndex(qMax(0, names.indexOf(selected)));
+    historySeriesCombo->blockSignals(false);
+    if (historySeriesCombo->currentText() != selected)
+        loadHistory();
+}
+
+void NetworkTab::loadHistory()
+{
+    const QString name = historySeriesCombo->currentText();
+    historySeries = history->findSeries(name);
+    historyChart->clear();
+    if (historySeries < 0)
+        return;
+
+    // Stored points are per-interval totals; the chart shows rates
+    const bool packets = name.endsWith("pk");
+    historyChart->setValueFormatter([packets](double value) {
+        return packets ? QString("%1 pk/s").arg(value, 0, 'f', value < 10 ? 1 : 0)
+                       : QLocale().formattedDataSize(qint64(value)) + "/s";
+    });
+
+    const qint64 span = historySpanCombo->currentData().toLongLong();
+    const qint64 now = QDateTime::currentSecsSinceEpoch();
+    historyResolution = history->resolutionFor(span, kHistoryMaxPoints);
+    historyLoadedUntil = now - span;
+    refreshHistory();
+    historyChart->setViewRange(double(now - span), double(now));
+    historyChart->setFollowing(true);
+}
+
+void NetworkTab::refreshHistory()
+{
+    updateHistorySeriesList();
+
+    const TimeSeriesStore::Stats stats = history->stats();
+    historyStatsLabel->setText(QString("%1 series  ·  %2 points in %3 blocks  ·  %4%5")
+                                   .arg(stats.series)
+                                   .arg(QLocale().toString(stats.points))
+                                   .arg(QLocale().toString(stats.blocks))
+                                   .arg(QLocale().formattedDataSize(qint64(stats.memoryBytes)))
+                                   .arg(stats.evictedBlocks ? QString("  ·  %1 blocks evicted for memory").arg(stats.evictedBlocks)
+                                                            : QString()));
+    if (historySeries < 0)
+        return;
+
+    // Only complete intervals; a coarse tier's newest point is still
+    // being rolled up
+    const qint64 width = kResolutionSeconds[historyResolution];
+    const qint64 complete = QDateTime::currentSecsSinceEpoch() / width * width - 1;
+    if (complete <= historyLoadedUntil)
+        return;
+
+    QVector<TimeSeriesStore::Point> points;
+    history->query(historySeries, historyResolution, historyLoadedUntil + 1, complete, points);
+    historyLoadedUntil = complete;
+
+    QVector<QPointF> rates;
+    rates.reserve(points.size());
+    for (const TimeSeriesStore::Point &point : points) {
+        if (point.time + width - 1 <= complete)
+            rates.append(QPointF(double(point.time), point.value / double(width)));
+    }
+    historyChart->appendPoints(rates);
+}
+
+QWidget* NetworkTab::createDnsSection()
+{
+    QWidget *section = new QWidget(this);
+    QVBoxLayout *layout = new QVBoxLayout(section);
+    layout->setContentsMargins(0, 8, 0, 0);
+
+    QHBoxLayout *controls = new QHBoxLayout();
+    dnsPortSpin = new QSpinBox(section);
+    dnsPortSpin->setRange(1, 65535);
+    dnsPortSpin->setValue(DnsStub::Options().port);
+    dnsPortSpin->setPrefix("127.0.0.1:");
+    dnsUpstreamEdit = new QLineEdit(DnsStub::Options().upstreamAddress, section);
+    dnsUpstreamEdit->setPlaceholderText("Upstream resolver address");
+    dnsUpstreamEdit->setMaximumWidth(220);
+    dnsButton = createActionButton("Start filter");
+    importBlocklistButton = createActionButton("Import blocklist...");
+    connect(dnsButton, &QPushButton::clicked, this, &NetworkTab::onDnsClicked);
+    connect(importBlocklistButton, &QPushButton::clicked, this, &NetworkTab::onImportBlocklistClicked);
+    controls->addWidget(new QLabel("Listen on", section));
+    controls->addWidget(dnsPortSpin);
+    controls->addWidget(new QLabel("forward to", section));
+    controls->addWidget(dnsUpstreamEdit);
+    controls->addWidget(dnsButton);
+    controls->addWidget(importBlocklistButton);
+    controls->addStretch(1);
+    layout->addLayout(controls);
+
+    blocklistLabel = new QLabel(section);
+    dnsStatsLabel = new QLabel("Point the system resolver at the listen address to filter its lookups", section);
+    dnsStatsLabel->setStyleSheet("color: #777777;");
+    layout->addWidget(blocklistLabel);
+    layout->addWidget(dnsStatsLabel);
+    layout->addStretch(1);
+    updateBlocklistLabel();
+
+    dnsStub = new DnsStub(this);
+    connect(dnsStub, &DnsStub::statsUpdated, this, &NetworkTab::onDnsStats);
+    connect(dnsStub, &DnsStub::error, this, &NetworkTab::onDnsError);
+    connect(dnsStub, &QThread::finished, this, &NetworkTab::onDnsFinished);
+
+    return section;
+}
+
+void NetworkTab::updateBlocklistLabel()
+{
+    // Opening maps the image and checks its header, so this is cheap
+    DomainBlocklist blocklist;
+    if (!QFile::exists(blocklistPath))
+        blocklistLabel->setText("No blocklist imported; queries are only cached and forwarded");
+    else if (!blocklist.open(blocklistPath))
+        blocklistLabel->setText(blocklist.errorString());
+    else
+        blocklistLabel->setText(QString("Blocking %1 domains").arg(QLocale().toString(blocklist.size())));
+}
+
+void NetworkTab::onDnsClicked()
+{
+    if (dnsStub->isRunning()) {
+        dnsStub->requestStop();
+        return;
+    }
+
+    DnsStub::Options options;
+    options.port = quint16(dnsPortSpin->value());
+    options.upstreamAddress = dnsUpstreamEdit->text().trimmed();
+    if (QFile::exists(blocklistPath))
+        options.blocklistPath = blocklistPath;
+    dnsStub->setOptions(options);
+    dnsStub->start();
+    dnsStatsLabel->setText(QString("Listening on %1 port %2").arg(options.listenAddress).arg(options.port));
+    dnsButton->setText("Stop filter");
+    dnsPortSpin->setEnabled(false);
+    dnsUpstreamEdit->setEnabled(false);
+}
+
+void NetworkTab::onImportBlocklistClicked()
+{
+    const QString source = QFileDialog::getOpenFileName(this, tr("Import Blocklist"), QString(),
+                                                        tr("Hosts files and domain lists (*.txt *.hosts *.list hosts);;All files (*)"));
+    if (source.isEmpty())
+        return;
+
+    // Millions of lines take seconds to compile; the running filter keeps
+    // its old image until the new one is renamed into place
+    importBlocklistButton->setEnabled(false);
+    blocklistLabel->setText("Compiling " + source + "...");
+    const QString image = blocklistPath;
+    TaskScheduler *scheduler = TaskScheduler::instance();
+    scheduler->post(scheduler->taskType("import"), TaskScheduler::Background, [this, source, image]() {
+        DomainBlocklist::CompileStats stats;
+        QString message;
+        const bool ok = DomainBlocklist::compile(source, image, &stats, &message);
+        QMetaObject::invokeMethod(this, [this, ok, stats, message]() { onBlocklistCompiled(ok, stats, message); },
+                                  Qt::QueuedConnection);
+    }, imports);
+}
+
+void NetworkTab::onBlocklistCompiled(bool ok, const DomainBlocklist::CompileStats &stats, const QString &message)
+{
+    importBlocklistButton->setEnabled(true);
+    if (!ok) {
+        blocklistLabel->setText("Import failed: " + message);
+        return;
+    }
+    updateBlocklistLabel();
+    dnsStatsLabel->setText(QString("Imported %1 domains from %2 lines in %3 ms (%4 duplicates, %5 invalid)")
+                               .arg(QLocale().toString(stats.domains))
+                               .arg(QLocale().toString(stats.lines))
+                               .arg(stats.elapsedMs)
+                               .arg(stats.duplicates)
+                               .arg(stats.invalid));
+    if (dnsStub->isRunning())
+        dnsStub->requestBlocklistReload();
+}
+
+void NetworkTab::onDnsStats(const DnsStats &stats)
+{
+    dnsStatsLabel->setText(
+        QString("%1 queries  ·  %2 q/s  ·  %3 blocked  ·  %4 cache hits (%5 cached)  ·  %6 forwarded, %7 timed out  ·  overhead p50 %8 µs, p99 %9 µs")
+            .arg(QLocale().toString(stats.queries))
+            .arg(QLocale().toString(stats.queriesPerSecond, 'f', 0))
+            .arg(QLocale().toString(stats.blocked))
+            .arg(QLocale().toString(stats.cacheHits))
+            .arg(stats.cacheEntries)
+            .arg(QLocale().toString(stats.forwarded))
+            .arg(stats.timeouts)
+            .arg(stats.overhead.percentile(50) / 1000.0, 0, 'f', 1)
+            .arg(stats.overhead.percentile(99) / 1000.0, 0, 'f', 1));
+}
+
+void NetworkTab::onDnsError(const QString &message)
+{
+    dnsStatsLabel->setText(message);
+}
+
+void NetworkTab::onDnsFinished()
+{
+    dnsButton->setText("Start filter");
+    dnsPortSpin->setEnabled(true);
+    dnsUpstreamEdit->setEnabled(true);
+}
+
+QWidget* NetworkTab::createFirewallSection()
+{
+    QWidget *section = new QWidget(this);
+    QVBoxLayout *layout = new QVBoxLayout(section);
+    layout->setContentsMargins(0, 8, 0, 0);
+
+    QHBoxLayout *controls = new QHBoxLayout();
+    QPushButton *addButton = createActionButton("Add rule");
+    QPushButton *removeButton = createActionButton("Remove");
+    QPushButton *upButton = createActionButton("Move up");
+    QPushButton *downButton = createActionButton("Move down");
+    connect(addButton, &QPushButton::clicked, this, &NetworkTab::onAddRuleClicked);
+    connect(removeButton, &QPushButton::clicked, this, &NetworkTab::onRemoveRuleClicked);
+    connect(upButton, &QPushButton::clicked, this, [this]() { onMoveRuleClicked(-1); });
+    connect(downButton, &QPushButton::clicked, this, [this]() { onMoveRuleClicked(1); });
+    controls->addWidget(addButton);
+    controls->addWidget(removeButton);
+    controls->addWidget(upButton);
+    controls->addWidget(downButton);
+    controls->addStretch(1);
+    layout->addLayout(controls);
+
+    firewallStatsLabel = new QLabel(section);
+    firewallStatsLabel->setStyleSheet("color: #777777;");
+    layout->addWidget(firewallStatsLabel);
+
+    // The first enabled rule that matches wins, so the row number is the
+    // rule's priority
+    firewallModel = new FirewallRuleModel(this);
+    firewallView = createTableView(firewallModel);
+    firewallView->verticalHeader()->show();
+    firewallView->setSelectionMode(QAbstractItemView::SingleSelection);
+    firewallView->setColumnWidth(FirewallRuleModel::EnabledColumn, 40);
+    firewallView->setColumnWidth(FirewallRuleModel::RemoteColumn, 220);
+    firewallView->setColumnWidth(FirewallRuleModel::ProcessColumn, 140);
+    layout->addWidget(firewallView, 1);
+
+    if (!firewallModel->load(firewallPath))
+        firewallStatsLabel->setText(firewallModel->errorString());
+    else
+        onRulesChanged();
+    connect(firewallModel, &FirewallRuleModel::rulesChanged, this, &NetworkTab::onRulesChanged);
+
+    return section;
+}
+
+void NetworkTab::onAddRuleClicked()
+{
+    const QModelIndex current = firewallView->currentIndex();
+    const int row = firewallModel->addRule(current.isValid() ? current.row() + 1 : firewallModel->rowCount());
+    firewallView->setCurrentIndex(firewallModel->index(row, FirewallRuleModel::RemoteColumn));
+    firewallView->edit(firewallView->currentIndex());
+}
+
+void NetworkTab::onRemoveRuleClicked()
+{
+    const QModelIndex current = firewallView->currentIndex();
+    if (current.isValid())
+        firewallModel->removeRule(current.row());
+}
+
+void NetworkTab::onMoveRuleClicked(int offset)
+{
+    const QModelIndex current = firewallView->currentIndex();
+    if (!current.isValid())
+        return;
+    const int to = current.row() + offset;
+    if (to < 0 || to >= firewallModel->rowCount())
+        return;
+    firewallModel->moveRule(current.row(), to);
+    firewallView->setCurrentIndex(firewallModel->index(to, current.column()));
+}
+
+void NetworkTab::onRulesChanged()
+{
+    // A few hundred bytes per rule; rewriting on every edit keeps the
+    // file current without a save button
+    if (!firewallModel->save(firewallPath)) {
+        firewallStatsLabel->setText("Cannot save rules: " + firewallModel->errorString());
+        return;
+    }
+    const FirewallClassifier::Stats stats = firewallModel->classifier().stats();
+    firewallStatsLabel->setText(
+        QString("%1 rules (%2 enabled)  ·  %3 intervals, %4 KB compiled  ·  "
+                "rules label connections in the Connections table and are not enforced")
+            .arg(stats.rules)
+            .arg(stats.indexedRules)
+            .arg(stats.intervals)
+            .arg(stats.memoryBytes / 1024));
+}
+
+QWidget* NetworkTab::createDiscoverySection()
+{
+    QWidget *section = new QWidget(this);
+    QVBoxLayout *layout = new QVBoxLayout(section);
+    layout->setContentsMargins(0, 8, 0, 0);
+
+    // Start from the subnet of the first interface that is up
+    QString subnet;
+    for (const QNetworkInterface &interface : QNetworkInterface::allInterfaces()) {
+        const QNetworkInterface::InterfaceFlags flags = interface.flags();
+        if (!(flags & QNetworkInterface::IsUp) || !(flags & QNetworkInterface::IsRunning)
+            || (flags & QNetworkInterface::IsLoopBack))
+            continue;
+        for (const QNetworkAddressEntry &entry : interface.addressEntries()) {
+            if (entry.ip().protocol() != QAbstractSocket::IPv4Protocol || entry.prefixLength() < 16)
+                continue;
+            const quint32 mask = entry.prefixLength() == 32 ? ~0u : ~(~0u >> entry.prefixLength());
+            subnet = QString("%1/%2").arg(QHostAddress(entry.ip().toIPv4Address() & mask).toString())
+                         .arg(entry.prefixLength());
+            break;
+        }
+        if (!subnet.isEmpty())
+            break;
+    }
+
+    QHBoxLayout *controls = new QHBoxLayout();
+    scanTargetsEdit = new QLineEdit(subnet, section);
+    scanTargetsEdit->setPlaceholderText("Hosts, networks or ranges, e.g. 192.168.1.0/24");
+    scanTargetsEdit->setMinimumWidth(240);
+    scanPortsEdit = new QLineEdit(PortScanner::Options().ports, section);
+    scanPortsEdit->setPlaceholderText("Ports, e.g. 22,80,8000-8100");
+    scanPortsEdit->setMaximumWidth(220);
+    scanButton = createActionButton("Start scan");
+    connect(scanButton, &QPushButton::clicked, this, &NetworkTab::onScanClicked);
+    connect(scanTargetsEdit, &QLineEdit::returnPressed, this, &NetworkTab::onScanClicked);
+    controls->addWidget(new QLabel("Scan", section));
+    controls->addWidget(scanTargetsEdit, 1);
+    controls->addWidget(new QLabel("ports", section));
+    controls->addWidget(scanPortsEdit);
+    controls->addWidget(scanButton);
+    layout->addLayout(controls);
+
+    scanStatsLabel = new QLabel("Finds live hosts and open TCP ports with plain connects", section);
+    scanStatsLabel->setStyleSheet("color: #777777;");
+    layout->addWidget(scanStatsLabel);
+
+    portScanModel = new PortScanModel(kScanResultRows, this);
+    QTableView *view = createTableView(portScanModel);
+    view->setColumnWidth(PortScanModel::HostColumn, 260);
+    view->setColumnWidth(PortScanModel::ServiceColumn, 140);
+    layout->addWidget(view, 1);
+
+    portScanner = new PortScanner(this);
+    portScanner->setMetricsBus(metrics);
+    connect(portScanner, &PortScanner::resultsReady, this, &NetworkTab::onScanResults);
+    connect(portScanner, &PortScanner::statsUpdated, this, &NetworkTab::onScanStats);
+    connect(portScanner, &PortScanner::error, this, &NetworkTab::onScanError);
+    connect(portScanner, &QThread::finished, this, &NetworkTab::onScanFinished);
+
+    return section;
+}
+
+void NetworkTab::onScanClicked()
+{
+    if (portScanner->isRunning()) {
+        portScanner->requestStop();
+        return;
+    }
+
+    PortScanner::Options options;
+    options.targets = scanTargetsEdit->text().trimmed();
+    options.ports = scanPortsEdit->text().trimmed();
+    portScanner->setOptions(options);
+    portScanModel->clear();
+    portScanner->start();
+    scanStatsLabel->setText("Scanning...");
+    scanButton->setText("Stop scan");
+    scanTargetsEdit->setEnabled(false);
+    scanPortsEdit->setEnabled(false);
+}
+
+void NetworkTab::onScanResults(const QVector<PortScanResult> &results)
+{
+    portScanModel->appendResults(results);
+}
+
+void NetworkTab::onScanStats(const PortScanStats &stats)
+{
+    const QString progress = stats.finished
+        ? QString("Done in %1 s").arg(stats.elapsedMs / 1000.0, 0, 'f', 1)
+        : QString("%1% of %2 probes").arg(stats.targets ? 100 * (stats.probes - stats.retries) / stats.targets : 0)
+              .arg(QLocale().toString(stats.targets));
+    scanStatsLabel->setText(
+        QString("%1  ·  %2 of %3 hosts up, %4 open ports  ·  %5 probes/s (limit %6), %7 in flight  ·  "
+                "%8 filtered, %9 unreachable  ·  RTT p50 %10 ms")
+            .arg(progress)
+            .arg(stats.hostsUp)
+            .arg(stats.hosts)
+            .arg(stats.open)
+            .arg(QLocale().toString(stats.probesPerSecond, 'f', 0))
+            .arg(QLocale().toString(stats.rateLimit, 'f', 0))
+            .arg(stats.inFlight)
+            .arg(QLocale().toString(stats.filtered))
+            .arg(QLocale().toString(stats.unreachable))
+            .arg(stats.rtt.percentile(50) / 1e6, 0, 'f', 2));
+}
+
+void NetworkTab::onScanError(const QString &message)
+{
+    scanStatsLabel->setText(message);
+}
+
+void NetworkTab::onScanFinished()
+{
+    scanButton->setText("Start scan");
+    scanTargetsEdit->setEnabled(true);
+    scanPortsEdit->setEnabled(true);
+}
@@ -0,0 +1,168 @@
+#ifndef NETWORKTAB_H
+#define NETWORKTAB_H
+
+#include <QWidget>
+#include <QComboBox>
+#include <QLabel>
+#include <QLineEdit>
+#include <QPushButton>
+#include <QSpinBox>
+#include <QTabWidget>
+#include <QTableView>
+#include <QThread>
+#include <QTimer>
+#include <memory>
+#include "connectionmonitor.h"
+#include "dnsstub.h"
+#include "domainblocklist.h"
+#include "ipinfotable.h"
+#include "packetcapture.h"
+#include "portscanner.h"
+#include "taskscheduler.h"
+#include "timeseriesstore.h"
+
+class ChartWidget;
+class ConnectionTableModel;
+class FirewallRuleModel;
+class FlowRecordModel;
+class FlowTable;
+class MetricsBus;
+class PortScanModel;
+class TrafficHistory;
+
+// Content page for the Network tab. Each engine gets its own section; the
+// collectors run on a shared worker thread and only diffs reach the GUI.
+class NetworkTab : public QWidget
+{
+    Q_OBJECT
+
+public:
+    // `history` receives interface and per-process traffic; it is
+    // snapshotted to `historyPath`. Imported DNS blocklists are compiled
+    // to `blocklistPath`, imported IP data to `ipInfoPath`; firewall rules
+    // are kept in `firewallPath`. The engines count what they do on
+    // `metrics`.
+    NetworkTab(TimeSeriesStore *history, const QString &historyPath, const QString &blocklistPath,
+               const QString &firewallPath, const QString &ipInfoPath, MetricsBus *metrics,
+               QWidget *parent = nullptr);
+    ~NetworkTab();
+
+private slots:
+    void onConnectionDiff(const ConnectionDiff &diff);
+    void onMonitorError(const QString &message);
+    void onImportIpInfoClicked();
+    void onIpInfoCompiled(bool ok, const IpInfoTable::CompileStats &stats, const QString &message);
+    void onCaptureClicked();
+    void onReplayClicked();
+    void onCaptureStats(const CaptureStats &stats);
+    void onCaptureError(const QString &message);
+    void onCaptureFinished();
+    void refreshFlows();
+    void loadHistory();
+    void refreshHistory();
+    void onDnsClicked();
+    void onImportBlocklistClicked();
+    void onBlocklistCompiled(bool ok, const DomainBlocklist::CompileStats &stats, const QString &message);
+    void onDnsStats(const DnsStats &stats);
+    void onDnsError(const QString &message);
+    void onDnsFinished();
+    void onAddRuleClicked();
+    void onRemoveRuleClicked();
+    void onMoveRuleClicked(int offset);
+    void onRulesChanged();
+    void onScanClicked();
+    void onScanResults(const QVector<PortScanResult> &results);
+    void onScanStats(const PortScanStats &stats);
+    void onScanError(const QString &message);
+    void onScanFinished();
+
+private:
+    QWidget* createConnectionsSection();
+    QWidget* createCaptureSection();
+    QWidget* createFlowsSection();
+    QWidget* createHistorySection();
+    QWidget* createDnsSection();
+    QWidget* createFirewallSection();
+    QWidget* createDiscoverySection();
+    void updateBlocklistLabel();
+    void openIpInfo();
+    void updateHistorySeriesList();
+    void startCapture(PacketSource *source, const QString &label);
+    QTableView* createTableView(QAbstractItemModel *model);
+    QPushButton* createActionButton(const QString &text);
+
+    MetricsBus *metrics;
+    QTabWidget *sections;
+    // The IP info and blocklist compiles, on the shared scheduler
+    CancellationToken imports = CancellationToken::create();
+
+    // Connections section
+    QThread collectorThread;
+    ConnectionMonitor *connectionMonitor;
+    TrafficHistory *trafficHistory;
+    ConnectionTableModel *connectionModel;
+    QLabel *connectionStatsLabel;
+    // Mapped for the Origin column; imports compile in the background
+    // and the image is reopened once renamed into place
+    IpInfoTable ipInfo;
+    QString ipInfoPath;
+    QPushButton *importIpInfoButton;
+    QLabel *ipInfoLabel;
+
+    // Capture section; the engine runs its own thread because both
+    // sources block between batches
+    CaptureEngine *captureEngine;
+    QComboBox *interfaceCombo;
+    QPushButton *captureButton;
+    QPushButton *replayButton;
+    QLabel *captureSourceLabel;
+    QLabel *captureStatsLabel;
+
+    // Flows section: the table is a capture sink and is polled, so the
+    // capture thread never waits on the GUI
+    std::unique_ptr<FlowTable> flowTable;
+    FlowRecordModel *flowModel;
+    QLabel *flowStatsLabel;
+    QTimer flowTimer;
+
+    // History section: charts one series of the traffic store, read on
+    // the GUI thread since queries only decode the blocks in view
+    TimeSeriesStore *history;
+    QComboBox *historySeriesCombo;
+    QComboBox *historySpanCombo;
+    ChartWidget *historyChart;
+    QLabel *historyStatsLabel;
+    QTimer historyTimer;
+    int historySeries = -1;
+    TimeSeriesStore::Resolution historyResolution = TimeSeriesStore::Seconds;
+    qint64 historyLoadedUntil = 0;
+
+    // DNS filter section; the stub runs its own thread, and imports are
+    // compiled in the background
+    DnsStub *dnsStub;
+    QString blocklistPath;
+    QSpinBox *dnsPortSpin;
+    QLineEdit *dnsUpstreamEdit;
+    QPushButton *dnsButton;
+    QPushButton *importBlocklistButton;
+    QLabel *blocklistLabel;
+    QLabel *dnsStatsLabel;
+
+    // Firewall section: edits recompile the classifier incrementally and
+    // the Connections table shows which rule each socket hits
+    FirewallRuleModel *firewallModel;
+    QString firewallPath;
+    QTableView *firewallView;
+    QLabel *firewallStatsLabel;
+
+    // Discovery section; the scanner runs its own thread and streams
+    // answers in batches
+    PortScanner *portScanner;
+    PortScanModel *portScanModel;
+    QLineEdit *scanTargetsEdit;
+    QLineEdit *scanPortsEdit;
+    QPushButton *scanButton;
+    QLabel *scanStatsLabel;
+};
+
+#endif // NETWORKTAB_H
@@ -0,0 +1,48 @@
+#ifndef PACKETBUFFERPOOL_H
+#define PACKETBUFFERPOOL_H
+
+#include <QtGlobal>
+#include <memory>
+#include <vector>
+
+// Fixed-size packet buffers carved out of one allocation up front. Each
+// tunnel queue owns its pools, so taking and returning a buffer is a
+// stack pop/push with no locking, and nothing is allocated per packet.
+class PacketBufferPool
+{
+public:
+    PacketBufferPool(int count, int bufferSize)
+        : size(size_t(bufferSize + kAlignment - 1) & ~size_t(kAlignment - 1)),
+          storage(new uchar[size * size_t(count) + kAlignment])
+    {
+        uchar *base = storage.get() + (kAlignment - reinterpret_cast<quintptr>(storage.get()) % kAlignment) % kAlignment;
+        freeList.reserve(size_t(count));
+        for (int i = count - 1; i >= 0; --i)
+            freeList.push_back(base + size * size_t(i));
+    }
+
+    // nullptr once every buffer is out
+    uchar *take()
+    {
+        if (freeList.empty())
+            return nullptr;
+        uchar *buffer = freeList.back();
+        freeList.pop_back();
+        return buffer;
+    }
+
+    void give(uchar *buffer) { freeList.push_back(buffer); }
+
+    int bufferSize() const { return int(size); }
+    int available() const { return int(freeList.size()); }
+
+private:
+    // Cache-line aligned, so vector loads never straddle two buffers
+    static const int kAlignment = 64;
+
+    size_t size;
+    std::unique_ptr<uchar[]> storage;
+    std::vector<uchar *> freeList;
+};
+
+#endif // PACKETBUFFERPOOL_H
@@ -0,0 +1,591 @@
+#include "packetcapture.h"
+#include "metricsbus.h"
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QtEndian>
+#include <cstring>
+#include <ctime>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#endif
+
+namespace {
+
+const int kReplayBatch = 256;
+const int kStatsEveryBlocks = 16;
+const qint64 kPublishIntervalNs = 1000000000;
+
+// pcapng block types
+const quint32 kSectionHeaderBlock = 0x0a0d0d0a;
+const quint32 kInterfaceDescriptionBlock = 1;
+const quint32 kSimplePacketBlock = 3;
+const quint32 kEnhancedPacketBlock = 6;
+const quint32 kByteOrderMagic = 0x1a2b3c4d;
+
+qint64 realtimeNanos()
+{
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+} // namespace
+
+#ifdef Q_OS_LINUX
+
+TpacketV3Source::TpacketV3Source(const Options &options)
+    : options(options)
+{
+}
+
+TpacketV3Source::~TpacketV3Source()
+{
+    if (ring)
+        munmap(ring, ringSize);
+    if (socketFd >= 0)
+        close(socketFd);
+}
+
+QString TpacketV3Source::description() const
+{
+    return options.interfaceName.isEmpty() ? QString("all interfaces") : options.interfaceName;
+}
+
+bool TpacketV3Source::open()
+{
+    socketFd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, htons(ETH_P_ALL));
+    if (socketFd < 0) {
+        lastError = QString("AF_PACKET socket: %1 (needs CAP_NET_RAW)").arg(QString::fromLocal8Bit(strerror(errno)));
+        return false;
+    }
+
+    int version = TPACKET_V3;
+    if (setsockopt(socketFd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+        lastError = QString("TPACKET_V3 is not supported: %1").arg(QString::fromLocal8Bit(strerror(errno)));
+        return false;
+    }
+
+    // Frame size only matters for the kernel's sanity checks in V3;
+    // frames are packed back to back inside each block.
+    tpacket_req3 request;
+    memset(&request, 0, sizeof(request));
+    request.tp_block_size = options.blockSize;
+    request.tp_block_nr = options.blockCount;
+    request.tp_frame_size = TPACKET_ALIGNMENT << 7;
+    request.tp_frame_nr = (options.blockSize / request.tp_frame_size) * options.blockCount;
+    request.tp_retire_blk_tov = options.retireTimeoutMs;
+    if (setsockopt(socketFd, SOL_PACKET, PACKET_RX_RING, &request, sizeof(request)) < 0) {
+        lastError = QString("PACKET_RX_RING: %1").arg(QString::fromLocal8Bit(strerror(errno)));
+        return false;
+    }
+
+    ringSize = size_t(options.blockSize) * options.blockCount;
+    void *mapped = mmap(nullptr, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, socketFd, 0);
+    if (mapped == MAP_FAILED) {
+        lastError = QString("mmap ring: %1").arg(QString::fromLocal8Bit(strerror(errno)));
+        ringSize = 0;
+        return false;
+    }
+    ring = static_cast<uchar *>(mapped);
+
+    sockaddr_ll address;
+    memset(&address, 0, sizeof(address));
+    address.sll_family = AF_PACKET;
+    address.sll_protocol = htons(ETH_P_ALL);
+    if (!options.interfaceName.isEmpty()) {
+        address.sll_ifindex = int(if_nametoindex(options.interfaceName.toLocal8Bit().constData()));
+        if (address.sll_ifindex == 0) {
+            lastError = QString("Unknown interface %1").arg(options.interfaceName);
+            return false;
+        }
+    }
+    if (bind(socketFd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0) {
+        lastError = QString("bind: %1").arg(QString::fromLocal8Bit(strerror(errno)));
+        return false;
+    }
+
+    if (options.promiscuous && address.sll_ifindex != 0) {
+        packet_mreq membership;
+        memset(&membership, 0, sizeof(membership));
+        membership.mr_ifindex = address.sll_ifindex;
+        membership.mr_type = PACKET_MR_PROMISC;
+        setsockopt(socketFd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &membership, sizeof(membership));
+    }
+
+    // Counters accumulated before the ring existed are not ours
+    readKernelStats();
+    drops = 0;
+    freezes = 0;
+    return true;
+}
+
+void TpacketV3Source::readKernelStats()
+{
+    // The kernel resets its counters on every read
+    tpacket_stats_v3 kernelStats;
+    socklen_t length = sizeof(kernelStats);
+    if (getsockopt(socketFd, SOL_PACKET, PACKET_STATISTICS, &kernelStats, &length) == 0) {
+        drops += kernelStats.tp_drops;
+        freezes += kernelStats.tp_freeze_q_cnt;
+    }
+    blocksSinceStats = 0;
+}
+
+int TpacketV3Source::next(PacketSink &sink, int timeoutMs)
+{
+    tpacket_block_desc *block = reinterpret_cast<tpacket_block_desc *>(ring + size_t(currentBlock) * options.blockSize);
+    if ((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+        pollfd readable = { socketFd, POLLIN | POLLERR, 0 };
+        if (poll(&readable, 1, timeoutMs) < 0 && errno != EINTR) {
+            lastError = QString("poll: %1").arg(QString::fromLocal8Bit(strerror(errno)));
+            return -1;
+        }
+        if ((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+            readKernelStats();
+            sink.onIdle(realtimeNanos());
+            return 0;
+        }
+    }
+
+    const quint32 count = block->hdr.bh1.num_pkts;
+    if (batch.size() < count)
+        batch.resize(count);
+
+    const uchar *frame = reinterpret_cast<const uchar *>(block) + block->hdr.bh1.offset_to_first_pkt;
+    for (quint32 i = 0; i < count; ++i) {
+        const tpacket3_hdr *header = reinterpret_cast<const tpacket3_hdr *>(frame);
+        const sockaddr_ll *link = reinterpret_cast<const sockaddr_ll *>(frame + TPACKET_ALIGN(sizeof(tpacket3_hdr)));
+        PacketView &packet = batch[i];
+        packet = PacketView();
+        packet.data = frame + header->tp_mac;
+        packet.capturedLength = header->tp_snaplen;
+        packet.wireLength = header->tp_len;
+        packet.timestampNs = qint64(header->tp_sec) * 1000000000 + header->tp_nsec;
+        // tun and PPP devices deliver bare IP; everything else we see
+        // here (Ethernet, loopback, veth, bridges) has an Ethernet header
+        const quint16 linkType = (link->sll_hatype == ARPHRD_NONE || link->sll_hatype == ARPHRD_PPP)
+                                     ? quint16(PacketView::RawIp) : quint16(PacketView::Ethernet);
+        if (!PacketDecoder::decode(packet, linkType))
+            ++undecoded;
+        frame += header->tp_next_offset;
+    }
+
+    if (count > 0)
+        sink.onPackets(batch.data(), int(count));
+
+    const qint64 lastPacketNs = qint64(block->hdr.bh1.ts_last_pkt.ts_sec) * 1000000000
+                                + block->hdr.bh1.ts_last_pkt.ts_nsec;
+    const qint64 latencyNs = realtimeNanos() - lastPacketNs;
+    if (count > 0 && latencyNs >= 0)
+        latency.record(quint64(latencyNs));
+
+    __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    currentBlock = (currentBlock + 1) % options.blockCount;
+    if (++blocksSinceStats >= kStatsEveryBlocks)
+        readKernelStats();
+    return int(count);
+}
+
+#else
+
+TpacketV3Source::TpacketV3Source(const Options &options)
+    : options(options)
+{
+}
+
+TpacketV3Source::~TpacketV3Source()
+{
+}
+
+QString TpacketV3Source::description() const
+{
+    return options.interfaceName;
+}
+
+bool TpacketV3Source::open()
+{
+    lastError = "Live capture requires AF_PACKET (Linux only)";
+    return false;
+}
+
+void TpacketV3Source::readKernelStats()
+{
+}
+
+int TpacketV3Source::next(PacketSink &, int)
+{
+    return -1;
+}
+
+#endif
+
+PcapReplaySource::PcapReplaySource(const QString &path, int loops)
+    : file(path), loopsRemaining(qMax(loops, 1))
+{
+}
+
+QString PcapReplaySource::description() const
+{
+    return file.fileName();
+}
+
+quint16 PcapReplaySource::read16(const uchar *p) const
+{
+    quint16 value;
+    memcpy(&value, p, sizeof(value));
+    return swapped ? qbswap(value) : value;
+}
+
+quint32 PcapReplaySource::read32(const uchar *p) const
+{
+    quint32 value;
+    memcpy(&value, p, sizeof(value));
+    return swapped ? qbswap(value) : value;
+}
+
+bool PcapReplaySource::open()
+{
+    if (!file.open(QIODevice::ReadOnly)) {
+        lastError = file.errorString();
+        return false;
+    }
+    if (file.size() < 24) {
+        lastError = "File is too small to be a capture";
+        return false;
+    }
+    begin = file.map(0, file.size());
+    if (!begin) {
+        lastError = file.errorString();
+        return false;
+    }
+    end = begin + file.size();
+
+    quint32 magic;
+    memcpy(&magic, begin, sizeof(magic));
+    pcapng = magic == kSectionHeaderBlock;
+    return pcapng ? openPcapng() : openPcap();
+}
+
+bool PcapReplaySource::openPcap()
+{
+    quint32 magic;
+    memcpy(&magic, begin, sizeof(magic));
+    switch (magic) {
+    case 0xa1b2c3d4: swapped = false; pcapSubsecondNanos = 1000; break;
+    case 0xa1b23c4d: swapped = false; pcapSubsecondNanos = 1; break;
+    case 0xd4c3b2a1: swapped = true; pcapSubsecondNanos = 1000; break;
+    case 0x4d3cb2a1: swapped = true; pcapSubsecondNanos = 1; break;
+    default:
+        lastError = "Not a pcap or pcapng file";
+        return false;
+    }
+    // The upper bits of the link type field carry FCS information
+    pcapLinkType = quint16(read32(begin + 20) & 0xffff);
+    firstRecord = begin + 24;
+    cursor = firstRecord;
+    return true;
+}
+
+bool PcapReplaySource::openPcapng()
+{
+    // Section headers are handled as they are met, so a file with several
+    // sections (e.g. concatenated captures) replays correctly
+    firstRecord = begin;
+    cursor = firstRecord;
+    return true;
+}
+
+bool PcapReplaySource::nextPcap(PacketView &packet, quint16 *linkType)
+{
+    if (end - cursor < 16)
+        return false;
+    const quint32 capturedLength = read32(cursor + 8);
+    if (quint64(end - cursor - 16) < capturedLength) {
+        lastError = "Truncated pcap record";
+        return false;
+    }
+    packet.timestampNs = qint64(read32(cursor)) * 1000000000 + qint64(read32(cursor + 4)) * pcapSubsecondNanos;
+    packet.capturedLength = capturedLength;
+    packet.wireLength = read32(cursor + 12);
+    packet.data = cursor + 16;
+    *linkType = pcapLinkType;
+    cursor += 16 + capturedLength;
+    return true;
+}
+
+bool PcapReplaySource::nextPcapng(PacketView &packet, quint16 *linkType)
+{
+    while (end - cursor >= 12) {
+        quint32 type;
+        memcpy(&type, cursor, sizeof(type));
+        if (type == kSectionHeaderBlock) {
+            quint32 byteOrder;
+            memcpy(&byteOrder, cursor + 8, sizeof(byteOrder));
+            if (byteOrder != kByteOrderMagic && byteOrder != qbswap(kByteOrderMagic)) {
+                lastError = "Bad pcapng byte-order magic";
+                return false;
+            }
+            swapped = byteOrder != kByteOrderMagic;
+            interfaces.clear();
+        } else {
+            type = read32(cursor);
+        }
+
+        const quint32 blockLength = read32(cursor + 4);
+        if (blockLength < 12 || (blockLength & 3) || quint64(end - cursor) < blockLength) {
+            lastError = "Malformed pcapng block";
+            return false;
+        }
+        const uchar *block = cursor;
+        cursor += blockLength;
+
+        if (type == kInterfaceDescriptionBlock && blockLength >= 20) {
+            Interface interface;
+            interface.linkType = read16(block + 8);
+            // Options: if_tsresol (9) changes the timestamp unit
+            const uchar *option = block + 16;
+            const uchar *optionsEnd = block + blockLength - 4;
+            while (optionsEnd - option >= 4) {
+                const quint16 code = read16(option);
+                const quint16 length = read16(option + 2);
+                if (code == 0 || optionsEnd - option - 4 < length)
+                    break;
+                if (code == 9 && length >= 1) {
+                    const quint8 resolution = option[4];
+                    const quint8 exponent = resolution & 0x7f;
+                    quint64 units = 1;
+                    for (quint8 i = 0; i < exponent && units < (quint64(1) << 60); ++i)
+                        units *= (resolution & 0x80) ? 2 : 10;
+                    interface.unitsPerSecond = units;
+                }
+                option += 4 + ((length + 3) & ~3);
+            }
+            interfaces.append(interface);
+        } else if (type == kEnhancedPacketBlock && blockLength >= 32) {
+            const quint32 interfaceId = read32(block + 8);
+            const quint32 capturedLength = read32(block + 20);
+            if (interfaceId >= quint32(interfaces.size()) || capturedLength > blockLength - 32) {
+                lastError = "Malformed pcapng packet block";
+                return false;
+            }
+            const Interface &interface = interfaces.at(int(interfaceId));
+            const quint64 units = quint64(read32(block + 12)) << 32 | read32(block + 16);
+            if (interface.unitsPerSecond == 1000000)
+                packet.timestampNs = qint64(units * 1000);
+            else if (interface.unitsPerSecond == 1000000000)
+                packet.timestampNs = qint64(units);
+            else
+                packet.timestampNs = qint64(double(units) * 1e9 / double(interface.unitsPerSecond));
+            packet.capturedLength = capturedLength;
+            packet.wireLength = read32(block + 24);
+            packet.data = block + 28;
+            *linkType = interface.linkType;
+            return true;
+        } else if (type == kSimplePacketBlock && blockLength >= 16) {
+            if (interfaces.isEmpty()) {
+                lastError = "pcapng packet before any interface";
+                return false;
+            }
+            packet.wireLength = read32(block + 8);
+            packet.capturedLength = qMin(packet.wireLength, blockLength - 16);
+            packet.data = block + 12;
+            *linkType = interfaces.first().linkType;
+            return true;
+        }
+    }
+    return false;
+}
+
+int PcapReplaySource::next(PacketSink &sink, int)
+{
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    if (batch.size() < size_t(kReplayBatch))
+        batch.resize(kReplayBatch);
+
+    int count = 0;
+    while (count < kReplayBatch) {
+        PacketView &packet = batch[count];
+        packet = PacketView();
+        quint16 linkType = 0;
+        const bool more = pcapng ? nextPcapng(packet, &linkType) : nextPcap(packet, &linkType);
+        if (!more) {
+            if (!lastError.isEmpty() || --loopsRemaining <= 0)
+                break;
+            cursor = firstRecord;
+            continue;
+        }
+        if (!PacketDecoder::decode(packet, linkType))
+            ++undecoded;
+        ++count;
+    }
+
+    if (count == 0)
+        return -1;
+    sink.onPackets(batch.data(), count);
+    latency.record(quint64(elapsed.nsecsElapsed()));
+    return count;
+}
+
+void CaptureEngine::FanOut::onPackets(const PacketView *batch, int count)
+{
+    quint64 batchBytes = 0;
+    for (int i = 0; i < count; ++i)
+        batchBytes += batch[i].wireLength;
+    packets += quint64(count);
+    bytes += batchBytes;
+    ++batches;
+    if (metrics) {
+        metrics->add(packetsMetric, quint64(count));
+        metrics->add(bytesMetric, batchBytes);
+        metrics->record(batchMetric, count);
+    }
+
+    for (PacketSink *sink : sinks)
+        sink->onPackets(batch, count);
+}
+
+void CaptureEngine::FanOut::onIdle(qint64 nowNs)
+{
+    for (PacketSink *sink : sinks)
+        sink->onIdle(nowNs);
+}
+
+CaptureEngine::CaptureEngine(QObject *parent)
+    : QThread(parent)
+{
+    qRegisterMetaType<CaptureStats>();
+}
+
+CaptureEngine::~CaptureEngine()
+{
+    requestStop();
+    wait();
+}
+
+void CaptureEngine::setSource(PacketSource *newSource)
+{
+    Q_ASSERT(!isRunning());
+    source.reset(newSource);
+    stopRequested.store(false);
+}
+
+void CaptureEngine::setMetricsBus(MetricsBus *bus)
+{
+    Q_ASSERT(!isRunning());
+    metricsBus = bus;
+    if (!bus)
+        return;
+    fanOut.packetsMetric = bus->metric("capture.packets", MetricsBus::Counter);
+    fanOut.bytesMetric = bus->metric("capture.bytes", MetricsBus::Counter, "B");
+    fanOut.batchMetric = bus->metric("capture.batch", MetricsBus::Sample, "packets");
+    dropsMetric = bus->metric("capture.kernel.drops", MetricsBus::Gauge);
+    // A full registry leaves the engine off the bus
+    if (fanOut.packetsMetric < 0 || fanOut.bytesMetric < 0 || fanOut.batchMetric < 0 || dropsMetric < 0)
+        metricsBus = nullptr;
+}
+
+void CaptureEngine::addSink(PacketSink *sink)
+{
+    Q_ASSERT(!isRunning());
+    fanOut.sinks.append(sink);
+}
+
+void CaptureEngine::removeSink(PacketSink *sink)
+{
+    Q_ASSERT(!isRunning());
+    fanOut.sinks.removeAll(sink);
+}
+
+void CaptureEngine::requestStop()
+{
+    stopRequested.store(true);
+}
+
+CaptureStats CaptureEngine::stats() const
+{
+    QMutexLocker lock(&statsMutex);
+    return current;
+}
+
+void CaptureEngine::run()
+{
+    fanOut.packets = 0;
+    fanOut.bytes = 0;
+    fanOut.batches = 0;
+    packetsAtLastPublish = 0;
+    lastPublishNs = 0;
+    {
+        QMutexLocker lock(&statsMutex);
+        current = CaptureStats();
+    }
+
+    if (!source) {
+        emit error(tr("No packet source"));
+        return;
+    }
+    if (!source->open()) {
+        emit error(source->errorString());
+        return;
+    }
+
+    std::shared_ptr<MetricsProducer> metrics;
+    if (metricsBus)
+        metrics = metricsBus->attach("Capture");
+    fanOut.metrics = metrics.get();
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    while (!stopRequested.load(std::memory_order_relaxed)) {
+        if (source->next(fanOut, 100) < 0) {
+            if (!source->errorString().isEmpty())
+                emit error(source->errorString());
+            break;
+        }
+        if (metrics)
+            metrics->set(dropsMetric, qint64(source->kernelDrops()));
+        const qint64 nowNs = elapsed.nsecsElapsed();
+        if (nowNs - lastPublishNs >= kPublishIntervalNs)
+            publish(nowNs, false);
+    }
+    publish(elapsed.nsecsElapsed(), true);
+    fanOut.metrics = nullptr;
+    if (metrics)
+        metrics->retire();
+}
+
+void CaptureEngine::publish(qint64 elapsedNs, bool final)
+{
+    CaptureStats snapshot;
+    {
+        QMutexLocker lock(&statsMutex);
+        current.packets = fanOut.packets;
+        current.bytes = fanOut.bytes;
+        current.batches = fanOut.batches;
+        current.kernelDrops = source->kernelDrops();
+        current.ringFreezes = source->ringFreezes();
+        current.undecoded = source->undecodedPackets();
+        current.elapsedMs = elapsedNs / 1000000;
+        // A finished run reports its overall rate rather than the tail end
+        const quint64 packets = final ? fanOut.packets : fanOut.packets - packetsAtLastPublish;
+        const qint64 intervalNs = final ? elapsedNs : elapsedNs - lastPublishNs;
+        current.packetsPerSecond = intervalNs > 0 ? double(packets) * 1e9 / double(intervalNs) : 0;
+        current.batchLatency.merge(source->batchLatency());
+        snapshot = current;
+    }
+    source->batchLatency().reset();
+    packetsAtLastPublish = fanOut.packets;
+    lastPublishNs = elapsedNs;
+    emit statsUpdated(snapshot);
+}
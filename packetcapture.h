@@ -0,0 +1,200 @@
+#ifndef PACKETCAPTURE_H
+#define PACKETCAPTURE_H
+
+#include <QFile>
+#include <QMetaType>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QVector>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "latencyhistogram.h"
+#include "packetview.h"
+
+class MetricsBus;
+class MetricsProducer;
+
+struct CaptureStats
+{
+    quint64 packets = 0;
+    quint64 bytes = 0;            // Wire length, not captured length
+    quint64 batches = 0;          // Ring blocks, or replay batches
+    quint64 kernelDrops = 0;      // tp_drops since the capture started
+    quint64 ringFreezes = 0;      // Times the kernel found no free block
+    quint64 undecoded = 0;        // Non-IP or truncated headers
+    qint64 elapsedMs = 0;
+    double packetsPerSecond = 0;  // Last interval; the whole run once finished
+    // Live: kernel timestamp of a block's last packet until the block is
+    // returned to the ring. Replay: decode + analyzers per batch.
+    LatencyHistogram batchLatency;
+};
+
+Q_DECLARE_METATYPE(CaptureStats)
+
+// One packet input. next() blocks for at most timeoutMs and delivers at
+// most one batch to the sink, so the engine can check for a stop request
+// between batches.
+class PacketSource
+{
+public:
+    virtual ~PacketSource() {}
+
+    virtual bool open() = 0;
+    // Packets delivered, 0 on timeout, -1 at end of input or on error
+    virtual int next(PacketSink &sink, int timeoutMs) = 0;
+    virtual QString description() const = 0;
+    QString errorString() const { return lastError; }
+
+    // Cumulative counters; only read from the capture thread
+    virtual quint64 kernelDrops() const { return 0; }
+    virtual quint64 ringFreezes() const { return 0; }
+    quint64 undecodedPackets() const { return undecoded; }
+    LatencyHistogram &batchLatency() { return latency; }
+
+protected:
+    QString lastError;
+    quint64 undecoded = 0;
+    LatencyHistogram latency;
+};
+
+// Live capture from an AF_PACKET socket with a TPACKET_V3 mmap ring. The
+// kernel fills whole blocks of variable-length frames; each retired block
+// is decoded in place and handed to the sink as one batch, then returned
+// to the kernel. A block retires when full or after retireTimeoutMs.
+class TpacketV3Source : public PacketSource
+{
+public:
+    struct Options
+    {
+        QString interfaceName;         // Empty captures on all interfaces
+        quint32 blockSize = 1 << 20;
+        quint32 blockCount = 64;
+        quint32 retireTimeoutMs = 20;
+        bool promiscuous = false;
+    };
+
+    explicit TpacketV3Source(const Options &options);
+    ~TpacketV3Source();
+
+    bool open() override;
+    int next(PacketSink &sink, int timeoutMs) override;
+    QString description() const override;
+    quint64 kernelDrops() const override { return drops; }
+    quint64 ringFreezes() const override { return freezes; }
+
+private:
+    void readKernelStats();
+
+    Options options;
+    int socketFd = -1;
+    uchar *ring = nullptr;
+    size_t ringSize = 0;
+    quint32 currentBlock = 0;
+    quint64 drops = 0;
+    quint64 freezes = 0;
+    int blocksSinceStats = 0;
+    std::vector<PacketView> batch;
+};
+
+// Replays a pcap or pcapng file as fast as the analyzers allow. The file
+// is mapped, so PacketView::data points straight into the page cache and
+// nothing is copied. Timestamps are preserved; pacing is not.
+class PcapReplaySource : public PacketSource
+{
+public:
+    explicit PcapReplaySource(const QString &path, int loops = 1);
+
+    bool open() override;
+    int next(PacketSink &sink, int timeoutMs) override;
+    QString description() const override;
+
+private:
+    struct Interface
+    {
+        quint16 linkType = 0;
+        quint64 unitsPerSecond = 1000000;
+    };
+
+    bool openPcap();
+    bool openPcapng();
+    bool nextPcap(PacketView &packet, quint16 *linkType);
+    bool nextPcapng(PacketView &packet, quint16 *linkType);
+    quint16 read16(const uchar *p) const;
+    quint32 read32(const uchar *p) const;
+
+    QFile file;
+    int loopsRemaining;
+    const uchar *begin = nullptr;
+    const uchar *end = nullptr;
+    const uchar *cursor = nullptr;
+    const uchar *firstRecord = nullptr;
+    bool pcapng = false;
+    bool swapped = false;
+    quint16 pcapLinkType = 0;
+    qint64 pcapSubsecondNanos = 1000;   // 1000 for microsecond files, 1 for nanosecond
+    QVector<Interface> interfaces;      // pcapng, in IDB order
+    std::vector<PacketView> batch;
+};
+
+// Drives one PacketSource on a dedicated thread and fans each batch out
+// to the registered sinks. Sinks are called on the capture thread and
+// must not keep pointers into a batch after onPackets() returns.
+class CaptureEngine : public QThread
+{
+    Q_OBJECT
+
+public:
+    explicit CaptureEngine(QObject *parent = nullptr);
+    ~CaptureEngine();
+
+    // Only while stopped. The engine takes ownership of the source.
+    void setSource(PacketSource *source);
+    void addSink(PacketSink *sink);
+    void removeSink(PacketSink *sink);
+    // Only while stopped; packets, bytes and batch sizes are then counted
+    // there as they arrive
+    void setMetricsBus(MetricsBus *bus);
+
+    void requestStop();
+    CaptureStats stats() const;
+
+signals:
+    void statsUpdated(const CaptureStats &stats);
+    void error(const QString &message);
+
+protected:
+    void run() override;
+
+private:
+    class FanOut : public PacketSink
+    {
+    public:
+        void onPackets(const PacketView *packets, int count) override;
+        void onIdle(qint64 nowNs) override;
+
+        QVector<PacketSink *> sinks;
+        quint64 packets = 0;
+        quint64 bytes = 0;
+        quint64 batches = 0;
+        MetricsProducer *metrics = nullptr;    // While running with a bus
+        int packetsMetric = -1;
+        int bytesMetric = -1;
+        int batchMetric = -1;
+    };
+
+    void publish(qint64 elapsedNs, bool final);
+
+    std::unique_ptr<PacketSource> source;
+    FanOut fanOut;
+    MetricsBus *metricsBus = nullptr;
+    int dropsMetric = -1;
+    std::atomic<bool> stopRequested { false };
+    mutable QMutex statsMutex;
+    CaptureStats current;
+    quint64 packetsAtLastPublish = 0;
+    qint64 lastPublishNs = 0;
+};
+
+#endif // PACKETCAPTURE_H
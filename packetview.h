@@ -0,0 +1,186 @@
+#ifndef PACKETVIEW_H
+#define PACKETVIEW_H
+
+#include <QtGlobal>
+
+// Decoded header metadata for one captured packet. `data` points into the
+// capture ring or the mapped pcap file and is only valid for the duration
+// of the PacketSink::onPackets() call that delivered it; analyzers that
+// need bytes later must copy them.
+struct PacketView
+{
+    enum LinkType : quint16 {
+        Ethernet = 1,      // DLT_EN10MB
+        RawIp = 101,       // DLT_RAW
+        LinuxCooked = 113  // DLT_LINUX_SLL
+    };
+
+    const uchar *data = nullptr;
+    qint64 timestampNs = 0;
+    quint32 capturedLength = 0;
+    quint32 wireLength = 0;
+    quint16 l3Offset = 0;
+    quint16 l4Offset = 0;
+    // 32 bits, as GRO and BIG TCP hand over packets past 64 KiB
+    quint32 payloadOffset = 0;
+    quint32 payloadLength = 0;
+    quint16 sourcePort = 0;
+    quint16 destinationPort = 0;
+    quint8 ipVersion = 0;    // 0 when the packet is not IPv4/IPv6
+    quint8 protocol = 0;     // IPPROTO_* of the transport header
+    quint8 tcpFlags = 0;
+    quint8 reserved = 0;
+    quint32 tcpSequence = 0;
+
+    // Addresses point into the IP header; 4 or 16 bytes by ipVersion
+    const uchar *sourceAddress() const { return data + l3Offset + (ipVersion == 4 ? 12 : 8); }
+    const uchar *destinationAddress() const { return data + l3Offset + (ipVersion == 4 ? 16 : 24); }
+    int addressLength() const { return ipVersion == 4 ? 4 : 16; }
+    const uchar *payload() const { return data + payloadOffset; }
+};
+
+// Receives packets in batches: one TPACKET_V3 block, or one run of
+// records from a replayed file. Sinks run on the capture thread.
+class PacketSink
+{
+public:
+    virtual ~PacketSink() {}
+    virtual void onPackets(const PacketView *packets, int count) = 0;
+    // Live capture only: no block arrived within the poll timeout.
+    // nowNs is on the same clock as packet timestamps.
+    virtual void onIdle(qint64 nowNs) { Q_UNUSED(nowNs); }
+};
+
+// Header-only decode: link layer, IPv4/IPv6 (with extension headers) and
+// TCP/UDP ports. Never reads past capturedLength. Kept inline so capture
+// loops can decode without a call per packet.
+namespace PacketDecoder {
+
+inline quint16 readBe16(const uchar *p)
+{
+    return quint16(p[0] << 8 | p[1]);
+}
+
+inline quint32 readBe32(const uchar *p)
+{
+    return quint32(p[0]) << 24 | quint32(p[1]) << 16 | quint32(p[2]) << 8 | p[3];
+}
+
+inline void decodeTransport(PacketView &packet, quint32 offset, quint32 end)
+{
+    const uchar *data = packet.data;
+    packet.l4Offset = quint16(offset);
+    if (packet.protocol == 6 && offset + 20 <= end) {
+        packet.sourcePort = readBe16(data + offset);
+        packet.destinationPort = readBe16(data + offset + 2);
+        packet.tcpSequence = readBe32(data + offset + 4);
+        packet.tcpFlags = data[offset + 13];
+        const quint32 headerLength = quint32(data[offset + 12] >> 4) * 4;
+        offset += qMax<quint32>(headerLength, 20);
+    } else if (packet.protocol == 17 && offset + 8 <= end) {
+        packet.sourcePort = readBe16(data + offset);
+        packet.destinationPort = readBe16(data + offset + 2);
+        offset += 8;
+    } else {
+        return;
+    }
+    if (offset <= end) {
+        packet.payloadOffset = offset;
+        packet.payloadLength = end - offset;
+    }
+}
+
+inline bool decode(PacketView &packet, quint16 linkType)
+{
+    const uchar *data = packet.data;
+    const quint32 length = packet.capturedLength;
+    quint32 offset = 0;
+    quint16 etherType = 0;
+
+    switch (linkType) {
+    case PacketView::Ethernet:
+        if (length < 14)
+            return false;
+        etherType = readBe16(data + 12);
+        offset = 14;
+        // 802.1Q / 802.1ad tags, at most two
+        for (int tags = 0; tags < 2 && (etherType == 0x8100 || etherType == 0x88a8); ++tags) {
+            if (offset + 4 > length)
+                return false;
+            etherType = readBe16(data + offset + 2);
+            offset += 4;
+        }
+        break;
+    case PacketView::LinuxCooked:
+        if (length < 16)
+            return false;
+        etherType = readBe16(data + 14);
+        offset = 16;
+        break;
+    case PacketView::RawIp:
+        if (length < 1)
+            return false;
+        etherType = (data[0] >> 4) == 6 ? 0x86dd : 0x0800;
+        break;
+    default:
+        return false;
+    }
+
+    packet.l3Offset = quint16(offset);
+    if (etherType == 0x0800) {
+        if (offset + 20 > length || (data[offset] >> 4) != 4)
+            return false;
+        const quint32 headerLength = quint32(data[offset] & 0x0f) * 4;
+        const quint32 totalLength = readBe16(data + offset + 2);
+        packet.ipVersion = 4;
+        packet.protocol = data[offset + 9];
+        // GSO and BIG TCP packets leave the total length 0 and run to the
+        // end of the capture
+        const quint32 end = totalLength == 0 ? length : qMin(length, offset + qMax(totalLength, headerLength));
+        // Non-first fragments carry no transport header
+        if ((readBe16(data + offset + 6) & 0x1fff) != 0)
+            return true;
+        decodeTransport(packet, offset + headerLength, end);
+        return true;
+    }
+
+    if (etherType == 0x86dd) {
+        if (offset + 40 > length || (data[offset] >> 4) != 6)
+            return false;
+        packet.ipVersion = 6;
+        // A payload length of 0 announces a jumbogram, or BIG TCP
+        const quint32 payloadLength = readBe16(data + offset + 4);
+        const quint32 end = payloadLength == 0 ? length : qMin(length, offset + 40 + payloadLength);
+        quint8 next = data[offset + 6];
+        quint32 cursor = offset + 40;
+        for (int hops = 0; hops < 6; ++hops) {
+            if (next == 0 || next == 43 || next == 60) {
+                if (cursor + 8 > end)
+                    return true;
+                next = data[cursor];
+                cursor += (quint32(data[cursor + 1]) + 1) * 8;
+            } else if (next == 44) {
+                if (cursor + 8 > end)
+                    return true;
+                const bool firstFragment = (readBe16(data + cursor + 2) & 0xfff8) == 0;
+                next = data[cursor];
+                cursor += 8;
+                if (!firstFragment) {
+                    packet.protocol = next;
+                    return true;
+                }
+            } else {
+                break;
+            }
+        }
+        packet.protocol = next;
+        decodeTransport(packet, cursor, end);
+        return true;
+    }
+
+    return false;
+}
+
+} // namespace PacketDecoder
+
+#endif // PACKETVIEW_H
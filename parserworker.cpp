@@ -0,0 +1,158 @@
+#include "parserworker.h"
+#include "fileparser.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#endif
+
+#ifdef Q_OS_LINUX
+namespace {
+
+#if defined(__x86_64__)
+const quint32 kAuditArch = AUDIT_ARCH_X86_64;
+#elif defined(__aarch64__)
+const quint32 kAuditArch = AUDIT_ARCH_AARCH64;
+#else
+const quint32 kAuditArch = 0;
+#endif
+
+#define ALLOW_SYSCALL(name) \
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, __NR_##name, 0, 1), \
+    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW)
+
+// After setup the worker only needs to move bytes over its socket, manage
+// heap memory and exit. Executable mappings are refused so a parser bug
+// cannot be turned into injected code.
+bool installSeccompFilter()
+{
+    if (kAuditArch == 0) {
+        fprintf(stderr, "parser-worker: seccomp filter not available on this architecture\n");
+        return false;
+    }
+
+    struct sock_filter filter[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, arch)),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, kAuditArch, 1, 0),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_KILL_PROCESS),
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr)),
+
+        // mmap is allowed only without PROT_EXEC
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, __NR_mmap, 0, 3),
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, args[2])),
+        BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, PROT_EXEC, 1, 0),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr)),
+
+        ALLOW_SYSCALL(read),
+        ALLOW_SYSCALL(write),
+        ALLOW_SYSCALL(recvfrom),
+        ALLOW_SYSCALL(sendto),
+        ALLOW_SYSCALL(recvmsg),
+        ALLOW_SYSCALL(sendmsg),
+        ALLOW_SYSCALL(brk),
+        ALLOW_SYSCALL(munmap),
+        ALLOW_SYSCALL(mremap),
+        ALLOW_SYSCALL(madvise),
+        ALLOW_SYSCALL(futex),
+        ALLOW_SYSCALL(clock_gettime),
+        ALLOW_SYSCALL(rt_sigreturn),
+        ALLOW_SYSCALL(exit),
+        ALLOW_SYSCALL(exit_group),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_KILL_PROCESS),
+    };
+
+    struct sock_fprog program;
+    program.len = static_cast<unsigned short>(sizeof(filter) / sizeof(filter[0]));
+    program.filter = filter;
+
+    if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) != 0) {
+        perror("parser-worker: PR_SET_NO_NEW_PRIVS");
+        return false;
+    }
+    if (syscall(__NR_seccomp, SECCOMP_SET_MODE_FILTER, 0, &program) != 0) {
+        perror("parser-worker: seccomp");
+        return false;
+    }
+    return true;
+}
+
+#undef ALLOW_SYSCALL
+
+} // namespace
+#endif
+
+int runParserWorker(int argc, char *argv[])
+{
+#ifdef Q_OS_LINUX
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s --parser-worker <slots> <slot-size>\n", argv[0]);
+        return 2;
+    }
+    const quint32 slotCount = quint32(strtoul(argv[2], nullptr, 10));
+    const quint64 slotSize = strtoull(argv[3], nullptr, 10);
+    if (slotCount == 0 || slotSize == 0)
+        return 2;
+
+    // Die together with the GUI; the pool would respawn us anyway
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (getppid() == 1)
+        return 0;
+
+    const size_t ringSize = size_t(slotCount) * slotSize;
+    void *mapping = mmap(nullptr, ringSize, PROT_READ, MAP_SHARED, kParserWorkerRingFd, 0);
+    if (mapping == MAP_FAILED) {
+        perror("parser-worker: mmap ring");
+        return 1;
+    }
+    const uchar *ring = static_cast<const uchar *>(mapping);
+    close(kParserWorkerRingFd);
+
+    // Cap private memory; the parser itself does not allocate and the
+    // shared ring is not counted against RLIMIT_DATA
+    struct rlimit limit;
+    limit.rlim_cur = limit.rlim_max = quint64(256) << 20;
+    setrlimit(RLIMIT_DATA, &limit);
+
+    if (!installSeccompFilter())
+        return 1;
+
+    for (;;) {
+        ParseRequest request;
+        const ssize_t received = recv(kParserWorkerControlFd, &request, sizeof(request), 0);
+        if (received == 0)
+            break; // Pool closed the socket
+        if (received < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (received != ssize_t(sizeof(request)) || request.slot >= slotCount || request.length > slotSize)
+            break;
+
+        ScanVerdict verdict = FileParser::parse(ring + quint64(request.slot) * slotSize,
+                                                qint64(request.length), qint64(request.fileSize));
+        verdict.jobId = request.jobId;
+        if (send(kParserWorkerControlFd, &verdict, sizeof(verdict), MSG_NOSIGNAL) != ssize_t(sizeof(verdict)))
+            break;
+    }
+    return 0;
+#else
+    Q_UNUSED(argc);
+    fprintf(stderr, "%s: sandboxed parser workers are only supported on Linux\n", argv[0]);
+    return 2;
+#endif
+}
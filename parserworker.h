@@ -0,0 +1,27 @@
+#ifndef PARSERWORKER_H
+#define PARSERWORKER_H
+
+#include <QtGlobal>
+
+// Wire format between ParserWorkerPool and its sandboxed workers. Requests
+// travel over a SOCK_SEQPACKET socket and point into the worker's shared
+// memfd ring; the file bytes themselves are never sent over the socket.
+// Replies are raw ScanVerdict records.
+struct ParseRequest
+{
+    quint64 jobId;
+    quint32 slot;
+    quint32 length;
+    quint64 fileSize;
+};
+
+// File descriptors the pool installs in each worker before exec
+const int kParserWorkerControlFd = 3;
+const int kParserWorkerRingFd = 4;
+
+// Entry point for `rhynec --parser-worker <slots> <slotSize>`. Maps the
+// ring read-only, locks itself down with seccomp and then serves requests
+// until the control socket closes. Never returns to the Qt code path.
+int runParserWorker(int argc, char *argv[]);
+
+#endif // PARSERWORKER_H
@@ -0,0 +1,848 @@
+#include "parserworkerpool.h"
+#include "fileparser.h"
+#include "metricsbus.h"
+#include "parserworker.h"
+#include "taskscheduler.h"
+#include <QCoreApplication>
+#include <QFile>
+#include <QThread>
+#include <QDebug>
+#include <algorithm>
+#include <chrono>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+extern char **environ;
+#endif
+
+namespace {
+
+const unsigned kRingEntries = 256;
+// Requests per file in a round: openat, read, send, close
+const unsigned kChainLength = 4;
+// Registering a worker ring pins it, faulting in the whole memfd, so
+// rings are only registered while they stay this small together
+const quint64 kMaxRegisteredBytes = 64ull << 20;
+// How long stop() gives workers to exit once their sockets are closed,
+// and how often it looks
+const qint64 kRetireGraceNs = 100 * 1000 * 1000;
+const unsigned long kRetirePollUs = 1000;
+
+qint64 monotonicNanos()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+ParserWorkerPool::ParserWorkerPool(QObject *parent)
+    : QObject(parent), watchdog(this)
+{
+    qRegisterMetaType<ScanVerdict>();
+
+    workerCount = qBound(1, QThread::idealThreadCount() - 1, 8);
+
+    watchdog.setInterval(100);
+    connect(&watchdog, &QTimer::timeout, this, &ParserWorkerPool::checkTimeouts);
+}
+
+ParserWorkerPool::~ParserWorkerPool()
+{
+    stop();
+    // Parses not yet started are skipped; the running ones post to us
+    inProcessTasks.cancel();
+    TaskScheduler::instance()->wait(inProcessTasks);
+    if (metrics)
+        metrics->retire();
+}
+
+void ParserWorkerPool::setMode(Mode mode)
+{
+#ifndef Q_OS_LINUX
+    if (mode == Mode::Sandboxed) {
+        qDebug() << "Sandboxed parsing is Linux-only, falling back to in-process mode";
+        mode = Mode::InProcess;
+    }
+#endif
+    if (running && mode != currentMode) {
+        stop();
+        currentMode = mode;
+        start();
+        return;
+    }
+    currentMode = mode;
+}
+
+void ParserWorkerPool::setWorkerCount(int count)
+{
+    workerCount = qMax(1, count);
+}
+
+void ParserWorkerPool::setIoUringEnabled(bool enabled)
+{
+    ioUringEnabled = enabled;
+    ringUnavailable = enabled ? QString() : QString("turned off");
+}
+
+void ParserWorkerPool::setMetricsBus(MetricsBus *bus)
+{
+    metricsBus = bus;
+    if (!bus)
+        return;
+    filesMetric = bus->metric("scanner.files", MetricsBus::Counter);
+    detectionsMetric = bus->metric("scanner.detections", MetricsBus::Counter);
+    latencyMetric = bus->metric("scanner.latency", MetricsBus::Sample, "ns");
+    // A full registry leaves the pool off the bus
+    if (filesMetric < 0 || detectionsMetric < 0 || latencyMetric < 0)
+        metricsBus = nullptr;
+}
+
+QString ParserWorkerPool::readPath() const
+{
+    if (ring.isOpen())
+        return fixedBuffers ? QString("io_uring, registered buffers") : QString("io_uring");
+    return QString("pread (%1)").arg(ringUnavailable.isEmpty() ? QString("nothing dispatched yet") : ringUnavailable);
+}
+
+void ParserWorkerPool::setSlotSize(quint32 bytes)
+{
+    // Keep slots page aligned so every slot maps cleanly
+    slotSize = qMax<quint32>(4096, (bytes + 4095) & ~quint32(4095));
+}
+
+bool ParserWorkerPool::start()
+{
+    if (running)
+        return true;
+    running = true;
+
+    if (currentMode == Mode::InProcess)
+        return true;
+
+    workers.resize(workerCount);
+    for (int i = 0; i < workerCount; ++i) {
+        if (!spawnWorker(i)) {
+            qDebug() << "Parser worker" << i << "failed to start, using in-process mode";
+            stop();
+            currentMode = Mode::InProcess;
+            running = true;
+            return false;
+        }
+    }
+    watchdog.start();
+    return true;
+}
+
+void ParserWorkerPool::stop()
+{
+    watchdog.stop();
+    // Every socket is closed before any worker is waited for, so they
+    // exit side by side within one grace period
+    for (Worker &worker : workers)
+        closeWorkerSocket(worker);
+    const qint64 graceEndsNs = monotonicNanos() + kRetireGraceNs;
+    for (int i = 0; i < workers.size(); ++i)
+        retireWorker(i, graceEndsNs);
+    workers.clear();
+    ring.close();
+    ringBuffersStale = true;
+
+    // Anything still queued is reported so callers never wait forever
+    while (!pending.isEmpty()) {
+        const Job job = pending.dequeue();
+        ScanVerdict verdict;
+        verdict.status = ScanVerdict::Unreadable;
+        finishJob(job, verdict);
+    }
+    running = false;
+}
+
+quint64 ParserWorkerPool::submit(const QString &filePath)
+{
+    Job job;
+    job.id = nextJobId++;
+    job.path = filePath;
+    job.submittedNs = monotonicNanos();
+
+    if (currentMode == Mode::InProcess) {
+        // The scheduler's workers are shared; this keeps to workerCount
+        // of them and queues the rest
+        if (inProcessActive < workerCount)
+            runInProcess(job);
+        else
+            pending.enqueue(job);
+    } else {
+        // Dispatch from the event loop so verdicts (even immediate ones for
+        // unreadable files) are never emitted before submit() returns
+        pending.enqueue(job);
+        if (!dispatchScheduled) {
+            dispatchScheduled = true;
+            QMetaObject::invokeMethod(this, [this]() {
+                dispatchScheduled = false;
+                dispatch();
+            }, Qt::QueuedConnection);
+        }
+    }
+    return job.id;
+}
+
+int ParserWorkerPool::pendingJobs() const
+{
+    int count = pending.size() + inProcessActive;
+    for (const Worker &worker : workers)
+        count += worker.inFlight.size();
+    return count;
+}
+
+LatencyHistogram ParserWorkerPool::latency(Mode mode) const
+{
+    return mode == Mode::Sandboxed ? sandboxedLatency : inProcessLatency;
+}
+
+void ParserWorkerPool::resetLatency()
+{
+    sandboxedLatency.reset();
+    inProcessLatency.reset();
+}
+
+void ParserWorkerPool::runInProcess(const Job &job)
+{
+    ++inProcessActive;
+    TaskScheduler *scheduler = TaskScheduler::instance();
+    if (parseTaskType < 0)
+        parseTaskType = scheduler->taskType("parse");
+    ParserWorkerPool *pool = this;
+    const quint32 limit = slotSize;
+    scheduler->post(parseTaskType, TaskScheduler::Normal, [pool, job, limit]() {
+        ScanVerdict verdict;
+        QFile file(job.path);
+        if (file.open(QIODevice::ReadOnly)) {
+            const QByteArray data = file.read(limit);
+            verdict = FileParser::parse(reinterpret_cast<const uchar *>(data.constData()),
+                                        data.size(), file.size());
+        } else {
+            verdict.status = ScanVerdict::Unreadable;
+        }
+
+        // The destructor waits for these tasks, so `pool` outlives the post
+        QMetaObject::invokeMethod(pool, [pool, job, verdict]() {
+            --pool->inProcessActive;
+            if (pool->currentMode == Mode::InProcess && !pool->pending.isEmpty())
+                pool->runInProcess(pool->pending.dequeue());
+            pool->finishJob(job, verdict);
+        }, Qt::QueuedConnection);
+    }, inProcessTasks);
+}
+
+void ParserWorkerPool::finishJob(const Job &job, ScanVerdict verdict)
+{
+    verdict.jobId = job.id;
+    const quint64 elapsed = quint64(qMax<qint64>(0, monotonicNanos() - job.submittedNs));
+    if (currentMode == Mode::Sandboxed)
+        sandboxedLatency.record(elapsed);
+    else
+        inProcessLatency.record(elapsed);
+    if (metricsBus && !metrics)
+        metrics = metricsBus->attach("File scanner");
+    if (metrics) {
+        metrics->add(filesMetric);
+        if (verdict.status == ScanVerdict::Suspicious || verdict.status == ScanVerdict::Malicious)
+            metrics->add(detectionsMetric);
+        metrics->record(latencyMetric, qint64(elapsed));
+    }
+
+    emit verdictReady(job.path, verdict);
+
+    if (pendingJobs() == 0)
+        emit drained();
+}
+
+#ifdef Q_OS_LINUX
+
+bool ParserWorkerPool::spawnWorker(int index)
+{
+    Worker &worker = workers[index];
+    const size_t ringSize = size_t(slotsPerWorker) * slotSize;
+
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) != 0) {
+        qDebug() << "socketpair failed:" << strerror(errno);
+        return false;
+    }
+
+    const int ringFd = memfd_create("rhynec-parser-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (ringFd < 0 || ftruncate(ringFd, off_t(ringSize)) != 0) {
+        qDebug() << "memfd ring setup failed:" << strerror(errno);
+        close(sockets[0]);
+        close(sockets[1]);
+        if (ringFd >= 0)
+            close(ringFd);
+        return false;
+    }
+    // The worker must not be able to resize the ring under us
+    fcntl(ringFd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+
+    void *mapping = mmap(nullptr, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED, ringFd, 0);
+    if (mapping == MAP_FAILED) {
+        qDebug() << "mmap of parser ring failed:" << strerror(errno);
+        close(sockets[0]);
+        close(sockets[1]);
+        close(ringFd);
+        return false;
+    }
+
+    // dup2 onto 3/4 is a no-op if an fd already has that number, which
+    // would leave FD_CLOEXEC set; move both well clear first.
+    const int childControl = fcntl(sockets[1], F_DUPFD_CLOEXEC, 16);
+    const int childRing = fcntl(ringFd, F_DUPFD_CLOEXEC, 16);
+    close(sockets[1]);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, childControl, kParserWorkerControlFd);
+    posix_spawn_file_actions_adddup2(&actions, childRing, kParserWorkerRingFd);
+
+    const QByteArray program = QCoreApplication::applicationFilePath().toLocal8Bit();
+    const QByteArray slotsArg = QByteArray::number(slotsPerWorker);
+    const QByteArray slotSizeArg = QByteArray::number(slotSize);
+    char *argv[] = {
+        const_cast<char *>(program.constData()),
+        const_cast<char *>("--parser-worker"),
+        const_cast<char *>(slotsArg.constData()),
+        const_cast<char *>(slotSizeArg.constData()),
+        nullptr
+    };
+
+    pid_t pid = -1;
+    const int spawnError = posix_spawn(&pid, program.constData(), &actions, nullptr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(childControl);
+    close(childRing);
+
+    if (spawnError != 0) {
+        qDebug() << "Failed to spawn parser worker:" << strerror(spawnError);
+        munmap(mapping, ringSize);
+        close(sockets[0]);
+        close(ringFd);
+        return false;
+    }
+
+    fcntl(sockets[0], F_SETFL, fcntl(sockets[0], F_GETFL) | O_NONBLOCK);
+
+    worker.pid = pid;
+    worker.controlFd = sockets[0];
+    worker.ringFd = ringFd;
+    worker.ring = static_cast<uchar *>(mapping);
+    worker.freeSlots = (1u << slotsPerWorker) - 1;
+    worker.inFlight.clear();
+    ringBuffersStale = true;
+    worker.notifier = new QSocketNotifier(worker.controlFd, QSocketNotifier::Read, this);
+    connect(worker.notifier, &QSocketNotifier::activated, this,
+            [this](QSocketDescriptor socket) { onWorkerReadable(int(socket)); });
+    return true;
+}
+
+void ParserWorkerPool::closeWorkerSocket(Worker &worker)
+{
+    if (worker.notifier) {
+        worker.notifier->setEnabled(false);
+        worker.notifier->deleteLater();
+        worker.notifier = nullptr;
+    }
+    if (worker.controlFd >= 0) {
+        close(worker.controlFd);
+        worker.controlFd = -1;
+    }
+}
+
+void ParserWorkerPool::retireWorker(int index, qint64 graceEndsNs)
+{
+    Worker &worker = workers[index];
+    closeWorkerSocket(worker);
+    if (worker.pid > 0) {
+        // Closing the socket makes a healthy worker exit on its own, and
+        // it has until graceEndsNs to; one that is still there then, or
+        // one retired after a crash or a hang, which gets no grace, is
+        // killed.
+        int status = 0;
+        pid_t reaped = waitpid(pid_t(worker.pid), &status, WNOHANG);
+        while (reaped == 0 && monotonicNanos() < graceEndsNs) {
+            QThread::usleep(kRetirePollUs);
+            reaped = waitpid(pid_t(worker.pid), &status, WNOHANG);
+        }
+        if (reaped == 0) {
+            kill(pid_t(worker.pid), SIGKILL);
+            waitpid(pid_t(worker.pid), &status, 0);
+        }
+        worker.pid = -1;
+    }
+    if (worker.ring) {
+        munmap(worker.ring, size_t(slotsPerWorker) * slotSize);
+        worker.ring = nullptr;
+        ringBuffersStale = true;
+    }
+    if (worker.ringFd >= 0) {
+        close(worker.ringFd);
+        worker.ringFd = -1;
+    }
+
+    // Requeue work the worker accepted but never answered
+    while (!worker.inFlight.isEmpty())
+        pending.prepend(worker.inFlight.takeLast());
+    worker.freeSlots = 0;
+}
+
+void ParserWorkerPool::handleWorkerFailure(int index, quint8 status, const QString &reason)
+{
+    // The worker parses its queue in order, so the head job is the one
+    // that crashed or hung it. Report that file instead of retrying it.
+    if (!workers[index].inFlight.isEmpty()) {
+        const int socket = workers[index].controlFd;
+        const Job poisoned = workers[index].inFlight.dequeue();
+        ScanVerdict verdict;
+        verdict.status = status;
+        finishJob(poisoned, verdict);
+
+        // finishJob emits and a connected slot may have stopped the pool,
+        // or restarted it with new workers
+        if (index >= workers.size() || workers[index].controlFd != socket)
+            return;
+    }
+
+    retireWorker(index);
+    ++restarts;
+    emit workerRestarted(index, reason);
+
+    if (running && !spawnWorker(index))
+        qDebug() << "Parser worker" << index << "could not be restarted";
+    dispatch();
+}
+
+ParserWorkerPool::Worker *ParserWorkerPool::workerForSocket(int socket, int *index)
+{
+    for (int i = 0; i < workers.size(); ++i) {
+        if (workers[i].controlFd == socket) {
+            *index = i;
+            return &workers[i];
+        }
+    }
+    return nullptr;
+}
+
+void ParserWorkerPool::onWorkerReadable(int socket)
+{
+    int index = -1;
+    Worker *worker = workerForSocket(socket, &index);
+    if (!worker)
+        return;
+
+    for (;;) {
+        ScanVerdict verdict;
+        const ssize_t received = recv(worker->controlFd, &verdict, sizeof(verdict), 0);
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received != ssize_t(sizeof(verdict))) {
+            // EOF or garbage: the worker is gone or misbehaving
+            handleWorkerFailure(index, ScanVerdict::Crashed, QStringLiteral("worker exited"));
+            return;
+        }
+
+        if (worker->inFlight.isEmpty() || worker->inFlight.head().id != verdict.jobId) {
+            handleWorkerFailure(index, ScanVerdict::Crashed, QStringLiteral("out-of-order reply"));
+            return;
+        }
+
+        const Job job = worker->inFlight.dequeue();
+        worker->freeSlots |= 1u << job.slot;
+        worker->headStartedNs = monotonicNanos();
+        finishJob(job, verdict);
+
+        // finishJob emits and a connected slot may have stopped the pool
+        worker = workerForSocket(socket, &index);
+        if (!worker)
+            return;
+    }
+
+    dispatch();
+}
+
+void ParserWorkerPool::checkTimeouts()
+{
+    const qint64 now = monotonicNanos();
+    const qint64 limit = qint64(jobTimeoutMs) * 1000000;
+    for (int i = 0; i < workers.size(); ++i) {
+        const Worker &worker = workers[i];
+        if (!worker.inFlight.isEmpty() && now - worker.headStartedNs > limit)
+            handleWorkerFailure(i, ScanVerdict::TimedOut, QStringLiteral("job timeout"));
+    }
+}
+
+void ParserWorkerPool::dispatch()
+{
+    if (ioUringEnabled && dispatchRing())
+        return;
+    for (int i = 0; i < workers.size() && !pending.isEmpty(); ++i) {
+        Worker &worker = workers[i];
+        while (worker.pid > 0 && worker.freeSlots && !pending.isEmpty()) {
+            Job job = pending.dequeue();
+            if (!sendToWorker(worker, job)) {
+                // Socket refused the request: treat like a dead worker
+                pending.prepend(job);
+                handleWorkerFailure(i, ScanVerdict::Crashed, QStringLiteral("control socket closed"));
+                return;
+            }
+        }
+    }
+}
+
+bool ParserWorkerPool::sendToWorker(Worker &worker, Job &job)
+{
+    const int fd = open(QFile::encodeName(job.path).constData(), O_RDONLY | O_CLOEXEC | O_NOCTTY);
+    ++syscallsDispatching;
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        if (fd >= 0) {
+            close(fd);
+            syscallsDispatching += 2;
+        }
+        ScanVerdict verdict;
+        verdict.status = ScanVerdict::Unreadable;
+        finishJob(job, verdict);
+        return true;
+    }
+
+    job.slot = quint32(__builtin_ctz(worker.freeSlots));
+    uchar *slot = worker.ring + quint64(job.slot) * slotSize;
+
+    // Read straight into the shared mapping; this is the only copy
+    const quint64 wanted = qMin<quint64>(quint64(info.st_size), slotSize);
+    quint64 filled = 0;
+    while (filled < wanted) {
+        const ssize_t n = pread(fd, slot + filled, wanted - filled, off_t(filled));
+        ++syscallsDispatching;
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        filled += quint64(n);
+    }
+    close(fd);
+    // fstat, close and send
+    syscallsDispatching += 3;
+
+    ParseRequest request;
+    request.jobId = job.id;
+    request.slot = job.slot;
+    request.length = quint32(filled);
+    request.fileSize = quint64(info.st_size);
+    if (send(worker.controlFd, &request, sizeof(request), MSG_NOSIGNAL) != ssize_t(sizeof(request)))
+        return false;
+
+    worker.freeSlots &= ~(1u << job.slot);
+    if (worker.inFlight.isEmpty())
+        worker.headStartedNs = monotonicNanos();
+    worker.inFlight.enqueue(job);
+    ++filesDispatched;
+    return true;
+}
+
+bool ParserWorkerPool::setupRing()
+{
+    if (!ring.setup(kRingEntries, IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_SUBMIT_ALL,
+                    &ringUnavailable))
+        return false;
+    if (!ring.supports(IORING_OP_STATX) || !ring.supports(IORING_OP_OPENAT) || !ring.supports(IORING_OP_READ)
+        || !ring.supports(IORING_OP_SEND) || !ring.supports(IORING_OP_CLOSE)) {
+        ringUnavailable = "io_uring lacks file operations";
+        ring.close();
+        return false;
+    }
+    // A direct descriptor per worker, which each open in its chain replaces
+    const std::vector<int> files(static_cast<size_t>(workers.size()), -1);
+    if (!ring.registerFiles(files.data(), unsigned(files.size()), &ringUnavailable)) {
+        ring.close();
+        return false;
+    }
+    ringBuffersStale = true;
+    return true;
+}
+
+// Worker rings change whenever one is respawned; reads fall back to
+// plain ones where the rings cannot be registered
+void ParserWorkerPool::registerRingBuffers()
+{
+    ring.unregisterBuffers();
+    ringBuffersStale = false;
+    fixedBuffers = false;
+    const size_t ringSize = size_t(slotsPerWorker) * slotSize;
+    if (quint64(workers.size()) * ringSize > kMaxRegisteredBytes)
+        return;
+    std::vector<iovec> buffers(static_cast<size_t>(workers.size()));
+    for (int i = 0; i < workers.size(); ++i)
+        buffers[size_t(i)] = { workers[i].ring, workers[i].ring ? ringSize : 0 };
+    QString error;
+    fixedBuffers = ring.registerBuffers(buffers.data(), unsigned(buffers.size()), &error);
+}
+
+// Hands pending jobs to every free slot in rounds over the ring. False
+// when the ring cannot be used, leaving the jobs to dispatch().
+bool ParserWorkerPool::dispatchRing()
+{
+    if (!ring.isOpen() && !setupRing()) {
+        ioUringEnabled = false;
+        return false;
+    }
+    if (ringBuffersStale)
+        registerRingBuffers();
+
+    struct RingJob
+    {
+        int worker;
+        Job job;
+        QByteArray path;
+        struct statx info;
+        ParseRequest request;
+        int results[kChainLength];
+    };
+
+    // Submits what is queued and reaps `expected` completions
+    const auto runRound = [this](unsigned expected, auto handle) {
+        unsigned reaped = 0;
+        while (reaped < expected) {
+            const int result = ring.submitAndWait(expected - reaped, -1);
+            ++syscallsDispatching;
+            if (result < 0) {
+                ringUnavailable = QString("io_uring_enter: %1").arg(strerror(-result));
+                return false;
+            }
+            while (io_uring_cqe *completion = ring.peekCompletion()) {
+                handle(completion->user_data, completion->res);
+                ring.consumeCompletion();
+                ++reaped;
+            }
+        }
+        return true;
+    };
+
+    while (!pending.isEmpty()) {
+        std::vector<RingJob> batch;
+        for (int i = 0; i < workers.size() && !pending.isEmpty(); ++i) {
+            quint32 available = workers[i].pid > 0 ? workers[i].freeSlots : 0;
+            while (available && !pending.isEmpty() && batch.size() < kRingEntries / kChainLength) {
+                RingJob entry;
+                entry.worker = i;
+                entry.job = pending.dequeue();
+                entry.job.slot = quint32(__builtin_ctz(available));
+                available &= available - 1;
+                entry.path = QFile::encodeName(entry.job.path);
+                batch.push_back(entry);
+            }
+        }
+        if (batch.empty())
+            return true;
+
+        // Round one: what each file is and how much of it to read
+        for (size_t k = 0; k < batch.size(); ++k) {
+            io_uring_sqe *entry = ring.nextSqe();
+            entry->opcode = IORING_OP_STATX;
+            entry->fd = AT_FDCWD;
+            entry->addr = quint64(quintptr(batch[k].path.constData()));
+            entry->len = STATX_TYPE | STATX_SIZE;
+            entry->off = quint64(quintptr(&batch[k].info));
+            entry->user_data = k;
+        }
+        std::vector<int> statResults(batch.size());
+        if (!runRound(unsigned(batch.size()), [&statResults](quint64 k, int result) { statResults[k] = result; })) {
+            for (auto entry = batch.rbegin(); entry != batch.rend(); ++entry)
+                pending.prepend(entry->job);
+            ring.close();
+            ioUringEnabled = false;
+            return false;
+        }
+
+        // Round two: per worker, one chain through its files in slot
+        // order, so its requests arrive in the order inFlight expects
+        std::vector<Job> unreadable;
+        std::vector<size_t> regular;
+        for (size_t k = 0; k < batch.size(); ++k) {
+            if (statResults[k] == 0 && S_ISREG(batch[k].info.stx_mode))
+                regular.push_back(k);
+            else
+                unreadable.push_back(batch[k].job);
+        }
+        for (size_t n = 0; n < regular.size(); ++n) {
+            RingJob &job = batch[regular[n]];
+            const Worker &worker = workers[job.worker];
+            const quint64 wanted = qMin<quint64>(job.info.stx_size, slotSize);
+            job.request.jobId = job.job.id;
+            job.request.slot = job.job.slot;
+            job.request.length = quint32(wanted);
+            job.request.fileSize = job.info.stx_size;
+            std::fill(job.results, job.results + kChainLength, -ECANCELED);
+            const quint64 tag = quint64(regular[n]) * kChainLength;
+            const bool chainGoesOn = n + 1 < regular.size() && batch[regular[n + 1]].worker == job.worker;
+
+            io_uring_sqe *entry = ring.nextSqe();
+            entry->opcode = IORING_OP_OPENAT;
+            entry->fd = AT_FDCWD;
+            entry->addr = quint64(quintptr(job.path.constData()));
+            entry->open_flags = O_RDONLY | O_NOCTTY;
+            entry->file_index = unsigned(job.worker) + 1;
+            entry->flags = IOSQE_IO_LINK;
+            entry->user_data = tag;
+
+            // A short read ends the chain, like any failure in it
+            entry = ring.nextSqe();
+            entry->opcode = fixedBuffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+            entry->fd = job.worker;
+            entry->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+            entry->addr = quint64(quintptr(worker.ring + quint64(job.job.slot) * slotSize));
+            entry->len = unsigned(wanted);
+            entry->buf_index = quint16(fixedBuffers ? job.worker : 0);
+            entry->user_data = tag + 1;
+
+            entry = ring.nextSqe();
+            entry->opcode = IORING_OP_SEND;
+            entry->fd = worker.controlFd;
+            entry->addr = quint64(quintptr(&job.request));
+            entry->len = sizeof(job.request);
+            entry->msg_flags = MSG_NOSIGNAL;
+            entry->flags = IOSQE_IO_LINK;
+            entry->user_data = tag + 2;
+
+            entry = ring.nextSqe();
+            entry->opcode = IORING_OP_CLOSE;
+            entry->file_index = unsigned(job.worker) + 1;
+            entry->flags = chainGoesOn ? IOSQE_IO_LINK : 0;
+            entry->user_data = tag + 3;
+        }
+        const bool ran = regular.empty()
+                         || runRound(unsigned(regular.size()) * kChainLength, [&batch](quint64 tag, int result) {
+                                batch[tag / kChainLength].results[tag % kChainLength] = result;
+                            });
+        if (!ran) {
+            // Nothing was submitted: the plain path takes the round
+            ring.close();
+            ioUringEnabled = false;
+        }
+
+        std::vector<Job> requeue;
+        int failedWorker = -1;
+        for (size_t k : regular) {
+            RingJob &job = batch[k];
+            // sendToWorker finishes unreadable jobs, whose slots may stop the pool
+            if (!running)
+                return true;
+            Worker &worker = workers[job.worker];
+            if (job.worker == failedWorker) {
+                requeue.push_back(job.job);
+            } else if (ran && job.results[2] == int(sizeof(job.request))) {
+                worker.freeSlots &= ~(1u << job.job.slot);
+                if (worker.inFlight.isEmpty())
+                    worker.headStartedNs = monotonicNanos();
+                worker.inFlight.enqueue(job.job);
+                ++filesDispatched;
+            } else if (!ran || job.results[2] == -ECANCELED) {
+                // The open or read fell short: the plain path, still in order
+                if (!sendToWorker(worker, job.job)) {
+                    failedWorker = failedWorker < 0 ? job.worker : failedWorker;
+                    requeue.push_back(job.job);
+                }
+            } else if (failedWorker < 0) {
+                failedWorker = job.worker;
+                requeue.push_back(job.job);
+            } else {
+                requeue.push_back(job.job);
+            }
+        }
+        for (auto job = requeue.rbegin(); job != requeue.rend(); ++job)
+            pending.prepend(*job);
+        for (const Job &job : unreadable) {
+            ScanVerdict verdict;
+            verdict.status = ScanVerdict::Unreadable;
+            finishJob(job, verdict);
+        }
+        if (!running)
+            return true;
+        if (failedWorker >= 0) {
+            // Socket refused the request: treat like a dead worker
+            handleWorkerFailure(failedWorker, ScanVerdict::Crashed, QStringLiteral("control socket closed"));
+            return true;
+        }
+        if (!ran)
+            return false;
+    }
+    return true;
+}
+
+#else
+
+bool ParserWorkerPool::spawnWorker(int)
+{
+    return false;
+}
+
+void ParserWorkerPool::closeWorkerSocket(Worker &)
+{
+}
+
+void ParserWorkerPool::retireWorker(int, qint64)
+{
+}
+
+void ParserWorkerPool::handleWorkerFailure(int, quint8, const QString &)
+{
+}
+
+ParserWorkerPool::Worker *ParserWorkerPool::workerForSocket(int, int *)
+{
+    return nullptr;
+}
+
+void ParserWorkerPool::onWorkerReadable(int)
+{
+}
+
+void ParserWorkerPool::checkTimeouts()
+{
+}
+
+void ParserWorkerPool::dispatch()
+{
+}
+
+bool ParserWorkerPool::sendToWorker(Worker &, Job &)
+{
+    return false;
+}
+
+bool ParserWorkerPool::dispatchRing()
+{
+    return false;
+}
+
+bool ParserWorkerPool::setupRing()
+{
+    return false;
+}
+
+void ParserWorkerPool::registerRingBuffers()
+{
+}
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef PARSERWORKERPOOL_H
+#define PARSERWORKERPOOL_H
+
+#include <QObject>
+#include <QQueue>
+#include <QString>
+#include <QTimer>
+#include <QVector>
+#include <QSocketNotifier>
+#include <memory>
+#include "iouring.h"
+#include "latencyhistogram.h"
+#include "scanverdict.h"
+#include "taskscheduler.h"
+
+class MetricsBus;
+class MetricsProducer;
+
+// Pool of long-lived, seccomp-restricted parser processes. File bytes are
+// pread() straight into a per-worker memfd ring that the worker maps
+// read-only, so nothing is copied across the process boundary; only the
+// 32-byte ScanVerdict comes back. Workers that crash or exceed the job
+// timeout are killed and respawned, and the file that took them down is
+// reported as Crashed/TimedOut rather than retried.
+//
+// Where the kernel allows, files go out in rounds over an io_uring: one
+// batch of statx for every free slot, then per worker a linked chain of
+// openat, read into the slot, request send and close, for each file in
+// turn, so a round costs two system calls however many files it holds.
+// A file the chain cannot finish (it shrank, or vanished) takes the
+// plain open/pread path, which also serves kernels without io_uring.
+//
+// The pool does blocking file reads in its own thread, so hosts should
+// move it off the GUI thread. InProcess mode parses on the shared
+// TaskScheduler instead, workerCount files at a time, and exists so both
+// paths can be compared by latency().
+class ParserWorkerPool : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum class Mode { Sandboxed, InProcess };
+
+    explicit ParserWorkerPool(QObject *parent = nullptr);
+    ~ParserWorkerPool();
+
+    void setMode(Mode mode);
+    Mode mode() const { return currentMode; }
+
+    // Must be called before start()
+    void setWorkerCount(int count);
+    void setSlotSize(quint32 bytes);
+    void setJobTimeout(int milliseconds) { jobTimeoutMs = milliseconds; }
+    // Sandboxed mode only; takes effect at the next dispatch
+    void setIoUringEnabled(bool enabled);
+    // Before the first submit(); verdicts and their latency are then
+    // counted there
+    void setMetricsBus(MetricsBus *bus);
+
+    bool start();
+    void stop();
+    bool isRunning() const { return running; }
+
+    // Queues a file and returns its job id; the verdict arrives through
+    // verdictReady() carrying the same id.
+    quint64 submit(const QString &filePath);
+    int pendingJobs() const;
+
+    // Submit-to-verdict latency per mode, for comparing sandbox overhead
+    LatencyHistogram latency(Mode mode) const;
+    void resetLatency();
+    int restartCount() const { return restarts; }
+
+    // Files handed to workers, and the system calls spent opening,
+    // reading and sending them, waits included
+    quint64 dispatchedFiles() const { return filesDispatched; }
+    quint64 dispatchSyscalls() const { return syscallsDispatching; }
+    // "io_uring", or "pread" and why io_uring was passed over
+    QString readPath() const;
+
+signals:
+    void verdictReady(const QString &filePath, const ScanVerdict &verdict);
+    void workerRestarted(int workerIndex, const QString &reason);
+    void drained();
+
+private slots:
+    void onWorkerReadable(int socket);
+    void checkTimeouts();
+
+private:
+    struct Job
+    {
+        quint64 id = 0;
+        QString path;
+        qint64 submittedNs = 0;
+        quint32 slot = 0;
+    };
+
+    struct Worker
+    {
+        qint64 pid = -1;
+        int controlFd = -1;
+        int ringFd = -1;
+        uchar *ring = nullptr;
+        QSocketNotifier *notifier = nullptr;
+        quint32 freeSlots = 0;  // Bitmask of unused ring slots
+        QQueue<Job> inFlight;   // Worker answers strictly in order
+        qint64 headStartedNs = 0;
+    };
+
+    bool spawnWorker(int index);
+    void closeWorkerSocket(Worker &worker);
+    // Kills the worker unless it exits by graceEndsNs, steady clock
+    void retireWorker(int index, qint64 graceEndsNs = 0);
+    void handleWorkerFailure(int index, quint8 status, const QString &reason);
+    void dispatch();
+    bool dispatchRing();
+    bool setupRing();
+    void registerRingBuffers();
+    bool sendToWorker(Worker &worker, Job &job);
+    void runInProcess(const Job &job);
+    void finishJob(const Job &job, ScanVerdict verdict);
+    Worker *workerForSocket(int socket, int *index);
+
+    Mode currentMode = Mode::Sandboxed;
+    int workerCount = 0;
+    int slotsPerWorker = 4;
+    quint32 slotSize = 16u << 20;
+    int jobTimeoutMs = 5000;
+    bool running = false;
+    int restarts = 0;
+    quint64 nextJobId = 1;
+    int inProcessActive = 0;
+    bool dispatchScheduled = false;
+
+    // Set up by the first dispatch, so the ring belongs to the thread
+    // that submits to it
+    IoUring ring;
+    bool ioUringEnabled = true;
+    QString ringUnavailable;
+    bool ringBuffersStale = true;
+    bool fixedBuffers = false;
+    quint64 filesDispatched = 0;
+    quint64 syscallsDispatching = 0;
+
+    QVector<Worker> workers;
+    QQueue<Job> pending;
+    QTimer watchdog;
+    CancellationToken inProcessTasks = CancellationToken::create();
+    int parseTaskType = -1;
+    LatencyHistogram sandboxedLatency;
+    LatencyHistogram inProcessLatency;
+
+    // Attached on the pool's thread by the first verdict
+    MetricsBus *metricsBus = nullptr;
+    std::shared_ptr<MetricsProducer> metrics;
+    int filesMetric = -1;
+    int detectionsMetric = -1;
+    int latencyMetric = -1;
+};
+
+#endif // PARSERWORKERPOOL_H
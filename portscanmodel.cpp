@@ -0,0 +1,91 @@
+#include "portscanmodel.h"
+
+PortScanModel::PortScanModel(int maxRows, QObject *parent)
+    : QAbstractTableModel(parent), maxRows(maxRows)
+{
+}
+
+int PortScanModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : rows.size();
+}
+
+int PortScanModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : ColumnCount;
+}
+
+QVariant PortScanModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= rows.size())
+        return QVariant();
+
+    const PortScanResult &result = rows.at(index.row());
+    if (role == Qt::TextAlignmentRole && (index.column() == PortColumn || index.column() == RttColumn))
+        return int(Qt::AlignRight | Qt::AlignVCenter);
+    if (role != Qt::DisplayRole)
+        return QVariant();
+
+    switch (index.column()) {
+    case HostColumn:
+        return result.addressText();
+    case PortColumn:
+        return result.port;
+    case ServiceColumn:
+        return PortScanner::serviceName(result.port);
+    case StateColumn:
+        switch (result.state) {
+        // The port is whichever answered first, open or closed
+        case PortScanResult::HostUp: return "Host up";
+        case PortScanResult::Open: return "Open";
+        case PortScanResult::Closed: return "Closed";
+        }
+        return QVariant();
+    case RttColumn:
+        return result.rttUs < 10000 ? QString("%1 ms").arg(result.rttUs / 1000.0, 0, 'f', 2)
+                                    : QString("%1 ms").arg(result.rttUs / 1000);
+    default:
+        return QVariant();
+    }
+}
+
+QVariant PortScanModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation != Qt::Horizontal || role != Qt::DisplayRole)
+        return QVariant();
+
+    switch (section) {
+    case HostColumn: return tr("Host");
+    case PortColumn: return tr("Port");
+    case ServiceColumn: return tr("Service");
+    case StateColumn: return tr("State");
+    case RttColumn: return tr("RTT");
+    default: return QVariant();
+    }
+}
+
+void PortScanModel::appendResults(const QVector<PortScanResult> &results)
+{
+    if (results.isEmpty())
+        return;
+
+    // Only the newest maxRows results can survive the append
+    const int incoming = qMin(int(results.size()), maxRows);
+    const int overflow = rows.size() + incoming - maxRows;
+    if (overflow > 0) {
+        beginRemoveRows(QModelIndex(), 0, overflow - 1);
+        rows.remove(0, overflow);
+        endRemoveRows();
+    }
+
+    beginInsertRows(QModelIndex(), rows.size(), rows.size() + incoming - 1);
+    rows.append(results.mid(results.size() - incoming));
+    endInsertRows();
+}
+
+void PortScanModel::clear()
+{
+    beginResetModel();
+    rows.clear();
+    endResetModel();
+}
@@ -0,0 +1,39 @@
+#ifndef PORTSCANMODEL_H
+#define PORTSCANMODEL_H
+
+#include <QAbstractTableModel>
+#include <QVector>
+#include "portscanner.h"
+
+// Answers from the running scan in arrival order, capped at a fixed
+// number of rows; the oldest rows fall off the top.
+class PortScanModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+    enum Column {
+        HostColumn = 0,
+        PortColumn,
+        ServiceColumn,
+        StateColumn,
+        RttColumn,
+        ColumnCount
+    };
+
+    explicit PortScanModel(int maxRows, QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+    void appendResults(const QVector<PortScanResult> &results);
+    void clear();
+
+private:
+    int maxRows;
+    QVector<PortScanResult> rows;
+};
+
+#endif // PORTSCANMODEL_H
@@ -0,0 +1,827 @@
+#include "portscanner.h"
+#include "metricsbus.h"
+#include <QElapsedTimer>
+#include <QHostAddress>
+#include <QMutexLocker>
+#include <QStringList>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <queue>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const int kPollMs = 50;
+const qint64 kPublishIntervalNs = 200000000;
+const qint64 kAdjustIntervalNs = 100000000;
+const int kEventBatch = 256;
+const double kDecrease = 0.7;
+
+const quint16 kCommonPorts[] = { 21, 22, 23, 25, 53, 80, 110, 111, 135, 139, 143, 443, 445, 548, 554, 631, 993,
+                                 995, 1433, 1723, 1883, 3306, 3389, 5000, 5432, 5900, 6379, 8000, 8008, 8080,
+                                 8443, 8888, 9000, 9100, 27017 };
+
+const struct { quint16 port; const char *name; } kServices[] = {
+    { 21, "ftp" }, { 22, "ssh" }, { 23, "telnet" }, { 25, "smtp" }, { 53, "dns" }, { 80, "http" },
+    { 110, "pop3" }, { 111, "rpcbind" }, { 135, "msrpc" }, { 139, "netbios" }, { 143, "imap" },
+    { 443, "https" }, { 445, "smb" }, { 548, "afp" }, { 554, "rtsp" }, { 631, "ipp" }, { 993, "imaps" },
+    { 995, "pop3s" }, { 1433, "mssql" }, { 1723, "pptp" }, { 1883, "mqtt" }, { 3306, "mysql" },
+    { 3389, "rdp" }, { 5000, "upnp" }, { 5432, "postgres" }, { 5900, "vnc" }, { 6379, "redis" },
+    { 8000, "http-alt" }, { 8008, "http-alt" }, { 8080, "http-proxy" }, { 8443, "https-alt" },
+    { 8888, "http-alt" }, { 9000, "http-alt" }, { 9100, "printer" }, { 27017, "mongodb" }
+};
+
+qint64 monotonicNanos()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void setV4(PortScanner::Host *host, quint32 address)
+{
+    memset(host->address, 0, sizeof(host->address));
+    host->ipv6 = false;
+    host->address[0] = quint8(address >> 24);
+    host->address[1] = quint8(address >> 16);
+    host->address[2] = quint8(address >> 8);
+    host->address[3] = quint8(address);
+}
+
+bool parseAddress(const QString &text, QHostAddress *address)
+{
+    return address->setAddress(text) && (address->protocol() == QAbstractSocket::IPv4Protocol
+                                         || address->protocol() == QAbstractSocket::IPv6Protocol);
+}
+
+// RFC 6298: SRTT and RTTVAR from one sample, in nanoseconds
+void updateRtt(qint64 *srtt, qint64 *rttvar, qint64 sample)
+{
+    if (*srtt == 0) {
+        *srtt = qMax<qint64>(sample, 1);
+        *rttvar = sample / 2;
+        return;
+    }
+    *rttvar = (3 * *rttvar + qAbs(*srtt - sample)) / 4;
+    *srtt = qMax<qint64>((7 * *srtt + sample) / 8, 1);
+}
+
+} // namespace
+
+QString PortScanResult::addressText() const
+{
+    if (!ipv6)
+        return QHostAddress(quint32(address[0]) << 24 | quint32(address[1]) << 16 | quint32(address[2]) << 8 | address[3]).toString();
+    return QHostAddress(address).toString();
+}
+
+bool PortScanner::parseTargets(const QString &text, std::vector<Host> *hosts, QString *error)
+{
+    hosts->clear();
+    const QString simplified = QString(text).replace(',', ' ').simplified();
+    if (simplified.isEmpty()) {
+        *error = "No targets";
+        return false;
+    }
+    const QStringList tokens = simplified.split(' ');
+    for (const QString &token : tokens) {
+        QHostAddress first;
+        Host host;
+        const int slash = token.indexOf('/');
+        const int dash = token.indexOf('-');
+        if (slash > 0) {
+            bool ok = false;
+            const int prefix = token.mid(slash + 1).toInt(&ok);
+            if (!parseAddress(token.left(slash), &first) || !ok) {
+                *error = QString("%1 is not a network").arg(token);
+                return false;
+            }
+            const bool v6 = first.protocol() == QAbstractSocket::IPv6Protocol;
+            const int hostBits = (v6 ? 128 : 32) - prefix;
+            if (hostBits < 0 || hostBits > 16) {
+                *error = QString("%1: prefixes must cover at most %2 hosts").arg(token).arg(kMaxHosts);
+                return false;
+            }
+            const quint32 count = 1u << hostBits;
+            if (hosts->size() + count > size_t(kMaxHosts)) {
+                *error = QString("More than %1 hosts").arg(kMaxHosts);
+                return false;
+            }
+            if (!v6) {
+                const quint32 network = first.toIPv4Address() & ~(count - 1);
+                // Network and broadcast addresses never answer a connect
+                const quint32 skip = hostBits >= 2 ? 1 : 0;
+                for (quint32 i = skip; i < count - skip; ++i) {
+                    setV4(&host, network + i);
+                    hosts->push_back(host);
+                }
+            } else {
+                const Q_IPV6ADDR base = first.toIPv6Address();
+                host.ipv6 = true;
+                memcpy(host.address, base.c, 16);
+                for (quint32 i = 0; i < count; ++i) {
+                    host.address[14] = quint8((hostBits > 8 ? base.c[14] & ~((count - 1) >> 8) : base.c[14]) | (i >> 8));
+                    host.address[15] = quint8((hostBits >= 8 ? 0 : base.c[15] & ~(count - 1)) | (i & 0xff));
+                    hosts->push_back(host);
+                }
+            }
+        } else if (dash > 0) {
+            QHostAddress last;
+            const QString right = token.mid(dash + 1);
+            const bool lastOctet = !right.contains('.') && !right.contains(':');
+            if (!parseAddress(token.left(dash), &first) || first.protocol() != QAbstractSocket::IPv4Protocol
+                || (lastOctet ? right.toUInt() > 255
+                              : !parseAddress(right, &last) || last.protocol() != QAbstractSocket::IPv4Protocol)) {
+                *error = QString("%1 is not an IPv4 range").arg(token);
+                return false;
+            }
+            const quint32 low = first.toIPv4Address();
+            const quint32 high = lastOctet ? (low & 0xffffff00u) | right.toUInt() : last.toIPv4Address();
+            if (high < low || high - low >= quint32(kMaxHosts) || hosts->size() + (high - low + 1) > size_t(kMaxHosts)) {
+                *error = QString("%1: ranges must be ascending and cover at most %2 hosts").arg(token).arg(kMaxHosts);
+                return false;
+            }
+            for (quint32 address = low;; ++address) {
+                setV4(&host, address);
+                hosts->push_back(host);
+                if (address == high)
+                    break;
+            }
+        } else {
+            if (!parseAddress(token, &first)) {
+                *error = QString("%1 is not an address").arg(token);
+                return false;
+            }
+            if (first.protocol() == QAbstractSocket::IPv4Protocol) {
+                setV4(&host, first.toIPv4Address());
+            } else {
+                host.ipv6 = true;
+                memcpy(host.address, first.toIPv6Address().c, 16);
+            }
+            if (hosts->size() >= size_t(kMaxHosts)) {
+                *error = QString("More than %1 hosts").arg(kMaxHosts);
+                return false;
+            }
+            hosts->push_back(host);
+        }
+    }
+    return true;
+}
+
+bool PortScanner::parsePorts(const QString &text, std::vector<quint16> *ports, QString *error)
+{
+    // A bitmap dedupes overlapping ranges and yields ascending order
+    std::vector<bool> wanted(65536, false);
+    const QString simplified = QString(text).replace(',', ' ').simplified();
+    const QStringList tokens = simplified.isEmpty() ? QStringList() : simplified.split(' ');
+    for (const QString &token : tokens) {
+        if (token.compare("common", Qt::CaseInsensitive) == 0) {
+            for (quint16 port : kCommonPorts)
+                wanted[port] = true;
+            continue;
+        }
+        const int dash = token.indexOf('-');
+        bool lowOk = false;
+        bool highOk = false;
+        const uint low = (dash > 0 ? token.left(dash) : token).toUInt(&lowOk);
+        const uint high = dash > 0 ? token.mid(dash + 1).toUInt(&highOk) : low;
+        if (!lowOk || (dash > 0 && !highOk) || low == 0 || high > 65535 || high < low) {
+            *error = QString("%1 is not a port or port range").arg(token);
+            return false;
+        }
+        for (uint port = low; port <= high; ++port)
+            wanted[port] = true;
+    }
+    ports->clear();
+    for (uint port = 1; port < 65536; ++port) {
+        if (wanted[port])
+            ports->push_back(quint16(port));
+    }
+    if (ports->empty()) {
+        *error = "No ports";
+        return false;
+    }
+    return true;
+}
+
+QString PortScanner::serviceName(quint16 port)
+{
+    for (const auto &service : kServices) {
+        if (service.port == port)
+            return service.name;
+    }
+    return QString();
+}
+
+#ifdef Q_OS_LINUX
+
+// Sockets and pacing state for one run(); lives on the scanner's thread
+class PortScanner::Session
+{
+public:
+    Session(const PortScanner::Options &options, std::vector<Host> &hosts, std::vector<quint16> &ports);
+    ~Session();
+
+    bool open();
+    // Starts the connects the rate and in-flight budgets allow, and
+    // returns how many milliseconds the caller may sleep
+    int dispatch(qint64 nowNs);
+    void poll(int timeoutMs);
+    void expire(qint64 nowNs);
+    void adjustRate(qint64 nowNs);
+    bool done() const { return inFlight == 0 && active.empty(); }
+    QString errorString() const { return lastError; }
+
+    quint64 probes = 0;
+    quint64 retries = 0;
+    quint64 openPorts = 0;
+    quint64 closedPorts = 0;
+    quint64 filtered = 0;
+    quint64 unreachable = 0;
+    quint64 hostsUp = 0;
+    quint64 localErrors = 0;
+    int inFlight = 0;
+    double rate;
+    LatencyHistogram rtt;
+    QVector<PortScanResult> results;
+    MetricsProducer *metrics = nullptr;   // Each answer's round trip goes there as a sample
+    int rttMetric = -1;
+
+private:
+    // A pending retry packs the port index with the attempt number
+    struct HostState
+    {
+        quint32 nextPort = 0;
+        int inFlight = 0;
+        bool up = false;
+        bool unreachable = false;
+        bool inRing = false;
+        qint64 srttNs = 0;
+        qint64 rttvarNs = 0;
+        std::vector<quint32> retries;
+    };
+
+    struct Probe
+    {
+        int fd = -1;
+        quint32 host = 0;
+        quint16 portIndex = 0;
+        quint8 attempt = 0;
+        quint32 serial = 0;
+        qint64 sentNs = 0;
+    };
+
+    struct Deadline
+    {
+        qint64 ns;
+        quint32 slot;
+        quint32 serial;
+        bool operator>(const Deadline &other) const { return ns > other.ns; }
+    };
+
+    bool launch(quint32 host, quint16 portIndex, quint8 attempt, qint64 nowNs);
+    void complete(quint32 slot, int socketError, qint64 nowNs);
+    void finish(quint32 host, quint16 portIndex, quint8 attempt, int socketError, qint64 rttNs);
+    void timedOut(quint32 host, quint16 portIndex, quint8 attempt);
+    void markUp(quint32 host, quint16 port, qint64 rttNs);
+    void addResult(quint32 host, quint16 port, PortScanResult::State state, qint64 rttNs);
+    void enqueue(quint32 host);
+    qint64 timeoutNs(const HostState &state, quint8 attempt) const;
+
+    PortScanner::Options options;
+    QString lastError;
+    const std::vector<Host> &hosts;
+    const std::vector<quint16> &ports;
+    std::vector<HostState> states;
+    std::vector<quint32> active;      // Hosts with connects left to start
+    size_t cursor = 0;
+
+    int epollFd = -1;
+    std::vector<Probe> pending;
+    std::vector<quint32> freeSlots;
+    std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline>> deadlines;
+    quint32 nextSerial = 1;
+    qint64 srttNs = 0;                // Scan-wide estimate
+    qint64 rttvarNs = 0;
+
+    double tokens = 1;
+    qint64 refilledNs = 0;
+    qint64 adjustedNs = 0;
+    bool slowStart = true;
+    bool rateLimited = false;
+    quint64 intervalAnswers = 0;
+    quint64 intervalLosses = 0;
+    quint64 intervalLocalErrors = 0;
+};
+
+PortScanner::Session::Session(const PortScanner::Options &options, std::vector<Host> &hosts,
+                              std::vector<quint16> &ports)
+    : rate(qBound(options.minRate, options.initialRate, options.maxRate)), options(options), hosts(hosts),
+      ports(ports), states(hosts.size())
+{
+    active.reserve(hosts.size());
+    for (quint32 i = 0; i < quint32(hosts.size()); ++i)
+        enqueue(i);
+}
+
+PortScanner::Session::~Session()
+{
+    for (const Probe &probe : pending) {
+        if (probe.fd >= 0)
+            ::close(probe.fd);
+    }
+    if (epollFd >= 0)
+        ::close(epollFd);
+}
+
+bool PortScanner::Session::open()
+{
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0) {
+        lastError = QString("epoll: %1").arg(strerror(errno));
+        return false;
+    }
+    pending.reserve(size_t(options.maxInFlight));
+    return true;
+}
+
+void PortScanner::Session::enqueue(quint32 host)
+{
+    if (states[host].inRing)
+        return;
+    states[host].inRing = true;
+    active.push_back(host);
+}
+
+qint64 PortScanner::Session::timeoutNs(const HostState &state, quint8 attempt) const
+{
+    const qint64 minNs = qint64(options.minTimeoutMs) * 1000000;
+    const qint64 maxNs = qint64(options.maxTimeoutMs) * 1000000;
+    qint64 timeout;
+    if (state.srttNs)
+        timeout = state.srttNs + 4 * state.rttvarNs;
+    else if (srttNs)
+        timeout = srttNs + 4 * rttvarNs;
+    else
+        timeout = qint64(options.initialTimeoutMs) * 1000000;
+    return qMin(qBound(minNs, timeout, maxNs) << qMin<int>(attempt, 8), maxNs);
+}
+
+int PortScanner::Session::dispatch(qint64 nowNs)
+{
+    if (refilledNs == 0)
+        refilledNs = nowNs;
+    // Bursts are capped at 10 ms worth of connects
+    const double burst = qMax(1.0, rate / 100);
+    tokens = qMin(burst, tokens + double(nowNs - refilledNs) * rate / 1e9);
+    refilledNs = nowNs;
+
+    while (inFlight < options.maxInFlight && tokens >= 1 && !active.empty()) {
+        // Round-robin over hosts with work, skipping those at their cap
+        bool found = false;
+        for (size_t tries = active.size(); tries > 0; --tries) {
+            if (cursor >= active.size())
+                cursor = 0;
+            if (states[active[cursor]].inFlight < options.perHostInFlight) {
+                found = true;
+                break;
+            }
+            ++cursor;
+        }
+        if (!found)
+            break;
+
+        const quint32 host = active[cursor];
+        HostState &state = states[host];
+        quint32 target;
+        if (!state.retries.empty()) {
+            target = state.retries.back();
+            state.retries.pop_back();
+        } else {
+            target = state.nextPort++;
+        }
+        if (state.retries.empty() && state.nextPort >= ports.size()) {
+            state.inRing = false;
+            active[cursor] = active.back();
+            active.pop_back();
+        } else {
+            ++cursor;
+        }
+
+        if (!launch(host, quint16(target), quint8(target >> 16), nowNs)) {
+            // Out of local ports, descriptors or buffers: put the target
+            // back and let the rate cut relieve the pressure
+            state.retries.push_back(target);
+            enqueue(host);
+            ++localErrors;
+            ++intervalLocalErrors;
+            break;
+        }
+        tokens -= 1;
+    }
+
+    const bool waiting = !active.empty() && inFlight < options.maxInFlight;
+    if (waiting && tokens < 1)
+        rateLimited = true;
+    int waitMs = kPollMs;
+    if (waiting && tokens < 1)
+        waitMs = qMax(1, int((1 - tokens) * 1000 / rate + 0.999));
+    if (!deadlines.empty())
+        waitMs = qMin(waitMs, int(qMax<qint64>(0, deadlines.top().ns - nowNs + 999999) / 1000000));
+    return waitMs;
+}
+
+bool PortScanner::Session::launch(quint32 host, quint16 portIndex, quint8 attempt, qint64 nowNs)
+{
+    const Host &target = hosts[host];
+    const int fd = socket(target.ipv6 ? AF_INET6 : AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+    // Closing with an RST instead of a FIN handshake leaves no TIME_WAIT
+    const linger abort = { 1, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &abort, sizeof(abort));
+
+    sockaddr_storage address;
+    memset(&address, 0, sizeof(address));
+    socklen_t length;
+    if (target.ipv6) {
+        sockaddr_in6 *v6 = reinterpret_cast<sockaddr_in6 *>(&address);
+        v6->sin6_family = AF_INET6;
+        v6->sin6_port = htons(ports[portIndex]);
+        memcpy(&v6->sin6_addr, target.address, 16);
+        length = sizeof(sockaddr_in6);
+    } else {
+        sockaddr_in *v4 = reinterpret_cast<sockaddr_in *>(&address);
+        v4->sin_family = AF_INET;
+        v4->sin_port = htons(ports[portIndex]);
+        memcpy(&v4->sin_addr, target.address, 4);
+        length = sizeof(sockaddr_in);
+    }
+
+    ++probes;
+    if (::connect(fd, reinterpret_cast<const sockaddr *>(&address), length) == 0 || errno != EINPROGRESS) {
+        const int result = errno;
+        if (result == EAGAIN || result == EADDRNOTAVAIL || result == ENOBUFS || result == ENOMEM) {
+            --probes;
+            ::close(fd);
+            return false;
+        }
+        ::close(fd);
+        finish(host, portIndex, attempt, result, 0);
+        return true;
+    }
+
+    quint32 slot;
+    if (freeSlots.empty()) {
+        slot = quint32(pending.size());
+        pending.emplace_back();
+    } else {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+    }
+    Probe &probe = pending[slot];
+    probe.fd = fd;
+    probe.host = host;
+    probe.portIndex = portIndex;
+    probe.attempt = attempt;
+    probe.serial = nextSerial++;
+    probe.sentNs = nowNs;
+
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLOUT;
+    event.data.u32 = slot;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+    deadlines.push({ nowNs + timeoutNs(states[host], attempt), slot, probe.serial });
+    ++states[host].inFlight;
+    ++inFlight;
+    return true;
+}
+
+void PortScanner::Session::poll(int timeoutMs)
+{
+    epoll_event events[kEventBatch];
+    const int count = epoll_wait(epollFd, events, kEventBatch, timeoutMs);
+    if (count <= 0)
+        return;
+    const qint64 nowNs = monotonicNanos();
+    for (int i = 0; i < count; ++i) {
+        const quint32 slot = events[i].data.u32;
+        int socketError = 0;
+        socklen_t length = sizeof(socketError);
+        getsockopt(pending[slot].fd, SOL_SOCKET, SO_ERROR, &socketError, &length);
+        complete(slot, socketError, nowNs);
+    }
+}
+
+void PortScanner::Session::complete(quint32 slot, int socketError, qint64 nowNs)
+{
+    Probe &probe = pending[slot];
+    // Closing also drops the descriptor from the epoll set
+    ::close(probe.fd);
+    probe.fd = -1;
+    ++probe.serial;
+    freeSlots.push_back(slot);
+    --states[probe.host].inFlight;
+    --inFlight;
+    finish(probe.host, probe.portIndex, probe.attempt, socketError, nowNs - probe.sentNs);
+}
+
+void PortScanner::Session::finish(quint32 host, quint16 portIndex, quint8 attempt, int socketError, qint64 rttNs)
+{
+    const quint16 port = ports[portIndex];
+    HostState &state = states[host];
+    switch (socketError) {
+    case 0:
+        ++openPorts;
+        markUp(host, port, rttNs);
+        addResult(host, port, PortScanResult::Open, rttNs);
+        break;
+    case ECONNREFUSED:
+        ++closedPorts;
+        markUp(host, port, rttNs);
+        if (options.reportClosed)
+            addResult(host, port, PortScanResult::Closed, rttNs);
+        break;
+    case EHOSTUNREACH:
+    case ENETUNREACH:
+    case EHOSTDOWN:
+        // Nothing routes there: drop the host's remaining ports too
+        ++unreachable;
+        if (!state.unreachable) {
+            state.unreachable = true;
+            unreachable += state.retries.size() + (ports.size() - state.nextPort);
+            state.retries.clear();
+            state.nextPort = quint32(ports.size());
+        }
+        break;
+    default:
+        timedOut(host, portIndex, attempt);
+        break;
+    }
+}
+
+void PortScanner::Session::timedOut(quint32 host, quint16 portIndex, quint8 attempt)
+{
+    HostState &state = states[host];
+    // Silence from a host that has answered before is loss, not a filter
+    if (state.up)
+        ++intervalLosses;
+    if (attempt < options.retries && !state.unreachable) {
+        ++retries;
+        state.retries.push_back(quint32(portIndex) | quint32(attempt + 1) << 16);
+        enqueue(host);
+    } else {
+        ++filtered;
+    }
+}
+
+void PortScanner::Session::markUp(quint32 host, quint16 port, qint64 rttNs)
+{
+    HostState &state = states[host];
+    ++intervalAnswers;
+    rtt.record(quint64(rttNs));
+    if (metrics)
+        metrics->record(rttMetric, rttNs);
+    updateRtt(&state.srttNs, &state.rttvarNs, rttNs);
+    updateRtt(&srttNs, &rttvarNs, rttNs);
+    if (!state.up) {
+        state.up = true;
+        ++hostsUp;
+        addResult(host, port, PortScanResult::HostUp, rttNs);
+    }
+}
+
+void PortScanner::Session::addResult(quint32 host, quint16 port, PortScanResult::State state, qint64 rttNs)
+{
+    PortScanResult result;
+    memcpy(result.address, hosts[host].address, 16);
+    result.ipv6 = hosts[host].ipv6;
+    result.state = state;
+    result.port = port;
+    result.rttUs = quint32(qMin<qint64>(rttNs / 1000, 0xffffffffu));
+    results.append(result);
+}
+
+void PortScanner::Session::expire(qint64 nowNs)
+{
+    while (!deadlines.empty() && deadlines.top().ns <= nowNs) {
+        const Deadline deadline = deadlines.top();
+        deadlines.pop();
+        Probe &probe = pending[deadline.slot];
+        if (probe.fd < 0 || probe.serial != deadline.serial)
+            continue;
+        complete(deadline.slot, ETIMEDOUT, nowNs);
+    }
+}
+
+void PortScanner::Session::adjustRate(qint64 nowNs)
+{
+    if (adjustedNs == 0)
+        adjustedNs = nowNs;
+    if (nowNs - adjustedNs < kAdjustIntervalNs)
+        return;
+    adjustedNs = nowNs;
+
+    if (intervalLocalErrors > 0 || intervalLosses > qMax<quint64>(2, intervalAnswers / 20)) {
+        rate = qMax(double(options.minRate), rate * kDecrease);
+        slowStart = false;
+    } else if (rateLimited) {
+        // Only grow when the budget, not the hosts, held the scan back
+        rate = qMin(double(options.maxRate), slowStart ? rate * 2 : rate + options.initialRate / 4.0);
+    }
+    rateLimited = false;
+    intervalAnswers = 0;
+    intervalLosses = 0;
+    intervalLocalErrors = 0;
+}
+
+#else
+
+class PortScanner::Session
+{
+public:
+    Session(const PortScanner::Options &, std::vector<Host> &, std::vector<quint16> &) {}
+
+    bool open() { return false; }
+    int dispatch(qint64) { return 0; }
+    void poll(int) {}
+    void expire(qint64) {}
+    void adjustRate(qint64) {}
+    bool done() const { return true; }
+    QString errorString() const { return "The network scanner requires epoll (Linux only)"; }
+
+    quint64 probes = 0;
+    quint64 retries = 0;
+    quint64 openPorts = 0;
+    quint64 closedPorts = 0;
+    quint64 filtered = 0;
+    quint64 unreachable = 0;
+    quint64 hostsUp = 0;
+    quint64 localErrors = 0;
+    int inFlight = 0;
+    double rate = 0;
+    LatencyHistogram rtt;
+    QVector<PortScanResult> results;
+    MetricsProducer *metrics = nullptr;
+    int rttMetric = -1;
+};
+
+#endif
+
+PortScanner::PortScanner(QObject *parent)
+    : QThread(parent)
+{
+    qRegisterMetaType<PortScanResult>();
+    qRegisterMetaType<QVector<PortScanResult>>();
+    qRegisterMetaType<PortScanStats>();
+}
+
+PortScanner::~PortScanner()
+{
+    requestStop();
+    wait();
+}
+
+void PortScanner::setOptions(const Options &options)
+{
+    Q_ASSERT(!isRunning());
+    settings = options;
+}
+
+void PortScanner::setMetricsBus(MetricsBus *bus)
+{
+    Q_ASSERT(!isRunning());
+    metricsBus = bus;
+    if (!bus)
+        return;
+    probesMetric = bus->metric("scan.probes", MetricsBus::Counter);
+    openMetric = bus->metric("scan.open", MetricsBus::Counter);
+    inFlightMetric = bus->metric("scan.inflight", MetricsBus::Gauge);
+    rttMetric = bus->metric("scan.rtt", MetricsBus::Sample, "ns");
+    // A full registry leaves the scanner off the bus
+    if (probesMetric < 0 || openMetric < 0 || inFlightMetric < 0 || rttMetric < 0)
+        metricsBus = nullptr;
+}
+
+void PortScanner::requestStop()
+{
+    stopRequested.store(true);
+}
+
+PortScanStats PortScanner::stats() const
+{
+    QMutexLocker lock(&statsMutex);
+    return current;
+}
+
+void PortScanner::run()
+{
+    stopRequested.store(false);
+    probesAtLastPublish = 0;
+    lastPublishNs = 0;
+
+    std::vector<Host> hosts;
+    std::vector<quint16> ports;
+    QString failure;
+    if (!parseTargets(settings.targets, &hosts, &failure) || !parsePorts(settings.ports, &ports, &failure)) {
+        emit error(failure);
+        return;
+    }
+    if (quint64(hosts.size()) * ports.size() > kMaxTargets) {
+        emit error(QString("%1 hosts x %2 ports is more than %3 probes").arg(hosts.size()).arg(ports.size()).arg(kMaxTargets));
+        return;
+    }
+    {
+        QMutexLocker lock(&statsMutex);
+        current = PortScanStats();
+        current.hosts = hosts.size();
+        current.targets = quint64(hosts.size()) * ports.size();
+    }
+
+    Session session(settings, hosts, ports);
+    if (!session.open()) {
+        emit error(session.errorString());
+        return;
+    }
+
+    // The session's counters reach the bus once per pass of the loop
+    std::shared_ptr<MetricsProducer> metrics;
+    if (metricsBus)
+        metrics = metricsBus->attach("Port scanner");
+    session.metrics = metrics.get();
+    session.rttMetric = rttMetric;
+    quint64 probesCounted = 0;
+    quint64 openCounted = 0;
+    const auto count = [&]() {
+        if (!metrics)
+            return;
+        metrics->add(probesMetric, session.probes - probesCounted);
+        metrics->add(openMetric, session.openPorts - openCounted);
+        metrics->set(inFlightMetric, session.inFlight);
+        probesCounted = session.probes;
+        openCounted = session.openPorts;
+    };
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    while (!stopRequested.load(std::memory_order_relaxed) && !session.done()) {
+        const int waitMs = session.dispatch(monotonicNanos());
+        session.poll(qMin(waitMs, kPollMs));
+        const qint64 nowNs = monotonicNanos();
+        session.expire(nowNs);
+        session.adjustRate(nowNs);
+        count();
+        const qint64 elapsedNs = elapsed.nsecsElapsed();
+        if (elapsedNs - lastPublishNs >= kPublishIntervalNs)
+            publish(session, elapsedNs, false);
+    }
+    count();
+    publish(session, elapsed.nsecsElapsed(), true);
+    session.metrics = nullptr;
+    if (metrics) {
+        metrics->set(inFlightMetric, 0);
+        metrics->retire();
+    }
+}
+
+void PortScanner::publish(Session &session, qint64 elapsedNs, bool final)
+{
+    PortScanStats snapshot;
+    {
+        QMutexLocker lock(&statsMutex);
+        current.probes = session.probes;
+        current.retries = session.retries;
+        current.open = session.openPorts;
+        current.closed = session.closedPorts;
+        current.filtered = session.filtered;
+        current.unreachable = session.unreachable;
+        current.hostsUp = session.hostsUp;
+        current.localErrors = session.localErrors;
+        current.inFlight = session.inFlight;
+        current.rateLimit = session.rate;
+        current.elapsedMs = elapsedNs / 1000000;
+        current.finished = final;
+        const quint64 probes = final ? session.probes : session.probes - probesAtLastPublish;
+        const qint64 intervalNs = final ? elapsedNs : elapsedNs - lastPublishNs;
+        current.probesPerSecond = intervalNs > 0 ? double(probes) * 1e9 / double(intervalNs) : 0;
+        current.rtt.merge(session.rtt);
+        snapshot = current;
+    }
+    session.rtt.reset();
+    probesAtLastPublish = session.probes;
+    lastPublishNs = elapsedNs;
+    if (!session.results.isEmpty()) {
+        emit resultsReady(session.results);
+        session.results.clear();
+    }
+    emit statsUpdated(snapshot);
+}
@@ -0,0 +1,149 @@
+#ifndef PORTSCANNER_H
+#define PORTSCANNER_H
+
+#include <QMetaType>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QVector>
+#include <atomic>
+#include <vector>
+#include "latencyhistogram.h"
+
+class MetricsBus;
+
+// One answer from a scan. Hosts are reported once, by the first probe
+// they answer; open ports always; closed ports only when asked for.
+struct PortScanResult
+{
+    enum State : quint8 { HostUp, Open, Closed };
+
+    quint8 address[16];     // IPv4 in the first 4 bytes
+    bool ipv6 = false;
+    quint8 state = Open;
+    quint16 port = 0;
+    quint32 rttUs = 0;      // Connect round trip
+
+    QString addressText() const;
+};
+
+Q_DECLARE_METATYPE(PortScanResult)
+
+struct PortScanStats
+{
+    quint64 targets = 0;          // Host:port pairs in the scan
+    quint64 probes = 0;           // Connects started, retries included
+    quint64 retries = 0;
+    quint64 open = 0;
+    quint64 closed = 0;
+    quint64 filtered = 0;         // No answer after every retry
+    quint64 unreachable = 0;      // Host or network unreachable
+    quint64 hostsUp = 0;
+    quint64 hosts = 0;
+    quint64 localErrors = 0;      // Connects refused locally (ports, buffers)
+    int inFlight = 0;
+    double rateLimit = 0;         // Current probes/s budget
+    double probesPerSecond = 0;   // Last interval; the whole run once finished
+    qint64 elapsedMs = 0;
+    bool finished = false;
+    LatencyHistogram rtt;         // Answered connects
+};
+
+Q_DECLARE_METATYPE(PortScanStats)
+
+// Connect scanner for host and service discovery. Every host:port pair
+// gets a non-blocking TCP connect; an accepted connect is an open port,
+// a refused one a closed port on a live host, silence a filtered port.
+// Sockets close with an RST, so scans leave no TIME_WAIT behind.
+//
+// One thread multiplexes thousands of connects on epoll:
+// - a token bucket paces new connects, growing the rate exponentially
+//   until the first sign of loss and additively after, and cutting it
+//   by 30% when hosts that have answered start timing out or the kernel
+//   runs short of ports or buffers;
+// - each host has a cap on connects in flight, and hosts are served
+//   round-robin so one slow host never starves the rest;
+// - timeouts follow each host's smoothed RTT (RFC 6298 SRTT + 4 RTTVAR),
+//   falling back to the scan-wide estimate until a host has answered,
+//   and double on every retry.
+class PortScanner : public QThread
+{
+    Q_OBJECT
+
+public:
+    struct Options
+    {
+        // Addresses, CIDR prefixes ("192.168.1.0/24") and ranges
+        // ("10.0.0.1-10.0.0.40"), separated by commas or spaces
+        QString targets;
+        // Ports and ranges ("22,80,8000-8100"); "common" for a short list
+        // of well-known services
+        QString ports = "common";
+        int maxInFlight = 2048;
+        int perHostInFlight = 64;
+        int initialRate = 2000;       // Connects per second
+        int maxRate = 200000;
+        int minRate = 50;
+        int initialTimeoutMs = 1000;  // Until RTT samples arrive
+        int minTimeoutMs = 50;
+        int maxTimeoutMs = 3000;
+        int retries = 1;
+        bool reportClosed = false;
+    };
+
+    struct Host
+    {
+        quint8 address[16];
+        bool ipv6;
+    };
+
+    // Largest scan accepted, in hosts and in host:port pairs
+    static const int kMaxHosts = 65536;
+    static const quint64 kMaxTargets = 16ull << 20;
+
+    static bool parseTargets(const QString &text, std::vector<Host> *hosts, QString *error);
+    static bool parsePorts(const QString &text, std::vector<quint16> *ports, QString *error);
+    // Short service name for a well-known port, or an empty string
+    static QString serviceName(quint16 port);
+
+    explicit PortScanner(QObject *parent = nullptr);
+    ~PortScanner();
+
+    // Only while stopped
+    void setOptions(const Options &options);
+    Options options() const { return settings; }
+    // Only while stopped; probes, open ports and round trips are then
+    // counted there as the scan goes
+    void setMetricsBus(MetricsBus *bus);
+
+    void requestStop();
+    PortScanStats stats() const;
+
+signals:
+    // Batched every publish interval, in the order answers arrived
+    void resultsReady(const QVector<PortScanResult> &results);
+    void statsUpdated(const PortScanStats &stats);
+    void error(const QString &message);
+
+protected:
+    void run() override;
+
+private:
+    class Session;
+
+    void publish(Session &session, qint64 elapsedNs, bool final);
+
+    Options settings;
+    MetricsBus *metricsBus = nullptr;
+    int probesMetric = -1;
+    int openMetric = -1;
+    int inFlightMetric = -1;
+    int rttMetric = -1;
+    std::atomic<bool> stopRequested { false };
+    mutable QMutex statsMutex;
+    PortScanStats current;
+    quint64 probesAtLastPublish = 0;
+    qint64 lastPublishNs = 0;
+};
+
+#endif // PORTSCANNER_H
@@ -0,0 +1,114 @@
+#include "quarantinemodel.h"
+#include "quarantinestore.h"
+#include <QDateTime>
+#include <QFileInfo>
+#include <QColor>
+#include <QLocale>
+#include <algorithm>
+
+QuarantineModel::QuarantineModel(QuarantineStore *store, QObject *parent)
+    : QAbstractTableModel(parent), store(store)
+{
+    connect(store, &QuarantineStore::recordAppended, this, &QuarantineModel::onRecordAppended);
+    connect(store, &QuarantineStore::recordChanged, this, &QuarantineModel::onRecordChanged);
+    reload();
+}
+
+void QuarantineModel::reload()
+{
+    beginResetModel();
+    visibleRecords.clear();
+    const int count = store->recordCount();
+    visibleRecords.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        if (!(store->record(i)->flags & QuarantineRecord::Removed))
+            visibleRecords.append(i);
+    }
+    endResetModel();
+}
+
+int QuarantineModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : visibleRecords.size();
+}
+
+int QuarantineModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : ColumnCount;
+}
+
+int QuarantineModel::recordAt(int row) const
+{
+    return row >= 0 && row < visibleRecords.size() ? visibleRecords.at(row) : -1;
+}
+
+QVariant QuarantineModel::data(const QModelIndex &index, int role) const
+{
+    const QuarantineRecord *entry = store->record(recordAt(index.row()));
+    if (!entry)
+        return QVariant();
+
+    if (role == RecordIndexRole)
+        return recordAt(index.row());
+    if (role == OriginalPathRole || role == Qt::ToolTipRole)
+        return store->pathOf(*entry);
+    if (role == Qt::ForegroundRole && (entry->flags & QuarantineRecord::Restored))
+        return QColor("#999999");
+    if (role != Qt::DisplayRole)
+        return QVariant();
+
+    switch (index.column()) {
+    case NameColumn:
+        return QFileInfo(store->pathOf(*entry)).fileName();
+    case HostColumn:
+        return store->hostOf(*entry);
+    case SizeColumn:
+        return QLocale().formattedDataSize(qint64(entry->originalSize));
+    case DateColumn:
+        return QDateTime::fromMSecsSinceEpoch(entry->quarantinedAt).toString("yyyy-MM-dd hh:mm");
+    case HashColumn:
+        return QByteArray(reinterpret_cast<const char *>(entry->sha256), 32).toHex().left(16);
+    default:
+        return QVariant();
+    }
+}
+
+QVariant QuarantineModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation != Qt::Horizontal || role != Qt::DisplayRole)
+        return QVariant();
+
+    switch (section) {
+    case NameColumn: return tr("File");
+    case HostColumn: return tr("Host");
+    case SizeColumn: return tr("Size");
+    case DateColumn: return tr("Quarantined");
+    case HashColumn: return tr("SHA-256");
+    default: return QVariant();
+    }
+}
+
+void QuarantineModel::onRecordAppended(int record)
+{
+    // Records are only ever appended, so the new row always goes last
+    const int row = visibleRecords.size();
+    beginInsertRows(QModelIndex(), row, row);
+    visibleRecords.append(record);
+    endInsertRows();
+}
+
+void QuarantineModel::onRecordChanged(int record)
+{
+    const auto it = std::lower_bound(visibleRecords.begin(), visibleRecords.end(), record);
+    if (it == visibleRecords.end() || *it != record)
+        return;
+
+    const int row = int(it - visibleRecords.begin());
+    if (store->record(record)->flags & QuarantineRecord::Removed) {
+        beginRemoveRows(QModelIndex(), row, row);
+        visibleRecords.remove(row);
+        endRemoveRows();
+    } else {
+        emit dataChanged(index(row, 0), index(row, ColumnCount - 1));
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef QUARANTINEMODEL_H
+#define QUARANTINEMODEL_H
+
+#include <QAbstractTableModel>
+#include <QVector>
+
+class QuarantineStore;
+
+// Table model over the mapped quarantine index. It keeps only a vector of
+// visible record numbers; every cell is decoded on demand from the
+// mapping, so the Security tab view stays responsive at 100k+ items.
+class QuarantineModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+    enum Column {
+        NameColumn = 0,
+        HostColumn,
+        SizeColumn,
+        DateColumn,
+        HashColumn,
+        ColumnCount
+    };
+
+    enum Role {
+        RecordIndexRole = Qt::UserRole + 1,
+        OriginalPathRole
+    };
+
+    explicit QuarantineModel(QuarantineStore *store, QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+    int recordAt(int row) const;
+    void reload();
+
+private slots:
+    void onRecordAppended(int record);
+    void onRecordChanged(int record);
+
+private:
+    QuarantineStore *store;
+    QVector<int> visibleRecords;  // Ascending record numbers of non-removed items
+};
+
+#endif // QUARANTINEMODEL_H
@@ -0,0 +1,544 @@
+#include "quarantinestore.h"
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <QSysInfo>
+#include <QDebug>
+#include <cstring>
+
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char kIndexMagic[8] = { 'R', 'H', 'Q', 'I', 'D', 'X', '0', '1' };
+const quint32 kIndexVersion = 1;
+const qint64 kChunkSize = 1 << 20;
+const qint64 kIndexGrowRecords = 16384;
+const qint64 kNamesGrowBytes = 4 << 20;
+// The desktop application, named after its executable
+const char kApplicationName[] = "RhynecSecurity";
+
+void writeLe32(uchar *out, quint32 value)
+{
+    out[0] = uchar(value);
+    out[1] = uchar(value >> 8);
+    out[2] = uchar(value >> 16);
+    out[3] = uchar(value >> 24);
+}
+
+quint32 readLe32(const uchar *in)
+{
+    return quint32(in[0]) | quint32(in[1]) << 8 | quint32(in[2]) << 16 | quint32(in[3]) << 24;
+}
+
+bool syncFile(QFile &file)
+{
+#ifdef Q_OS_LINUX
+    return fdatasync(file.handle()) == 0;
+#elif defined(Q_OS_UNIX)
+    return fsync(file.handle()) == 0;
+#else
+    return file.flush();
+#endif
+}
+
+// Writes back the pages of a mapping that cover [offset, offset + length)
+bool syncMapping(uchar *data, qint64 offset, qint64 length)
+{
+#ifdef Q_OS_UNIX
+    const qint64 page = sysconf(_SC_PAGESIZE);
+    const qint64 start = offset / page * page;
+    return msync(data + start, size_t(offset + length - start), MS_SYNC) == 0;
+#else
+    Q_UNUSED(data);
+    Q_UNUSED(offset);
+    Q_UNUSED(length);
+    return true;
+#endif
+}
+
+// Hashes and compresses `file` onto the end of `pack`, one chunk at a
+// time, and fills in where the object went
+bool appendObject(QFile &pack, QFile &file, QuarantineRecord &entry, QByteArray *digest, QString *error)
+{
+    const qint64 start = pack.size();
+    if (!pack.seek(start)) {
+        *error = pack.errorString();
+        return false;
+    }
+
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    QByteArray chunk;
+    chunk.resize(int(kChunkSize));
+    quint64 stored = 0;
+    quint64 original = 0;
+    quint32 chunks = 0;
+    for (;;) {
+        const qint64 n = file.read(chunk.data(), kChunkSize);
+        if (n < 0) {
+            pack.resize(start);
+            *error = file.errorString();
+            return false;
+        }
+        if (n == 0)
+            break;
+
+        // The key is the hash of exactly the bytes stored, even if the
+        // file is still being written to
+        hash.addData(QByteArrayView(chunk.constData(), n));
+        original += quint64(n);
+
+        const QByteArray compressed = qCompress(reinterpret_cast<const uchar *>(chunk.constData()), int(n), 6);
+        uchar header[8];
+        writeLe32(header, quint32(compressed.size()));
+        writeLe32(header + 4, quint32(n));
+        if (pack.write(reinterpret_cast<const char *>(header), 8) != 8
+            || pack.write(compressed) != compressed.size()) {
+            // Drop the partial object so the pack stays a clean chunk stream
+            *error = pack.errorString();
+            pack.resize(start);
+            return false;
+        }
+        stored += 8 + quint64(compressed.size());
+        ++chunks;
+    }
+
+    if (!pack.flush()) {
+        *error = pack.errorString();
+        return false;
+    }
+
+    entry.packOffset = quint64(start);
+    entry.storedSize = stored;
+    entry.originalSize = original;
+    entry.chunkCount = chunks;
+    *digest = hash.result();
+    return true;
+}
+
+// Decompresses the object of `entry` from `pack` into `output`, checking
+// its SHA-256 on the way
+bool readObject(QFile &pack, const QuarantineRecord &entry, QIODevice *output, QString *error)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    qint64 offset = qint64(entry.packOffset);
+    QByteArray compressed;
+    for (quint32 i = 0; i < entry.chunkCount; ++i) {
+        uchar header[8];
+        if (!pack.seek(offset) || pack.read(reinterpret_cast<char *>(header), 8) != 8) {
+            *error = QuarantineStore::tr("Pack is truncated");
+            return false;
+        }
+        const quint32 storedLength = readLe32(header);
+        const quint32 rawLength = readLe32(header + 4);
+        if (storedLength > quint32(2 * kChunkSize) || rawLength > quint32(kChunkSize)) {
+            *error = QuarantineStore::tr("Corrupt chunk header in pack");
+            return false;
+        }
+
+        compressed.resize(int(storedLength));
+        if (pack.read(compressed.data(), storedLength) != qint64(storedLength)) {
+            *error = QuarantineStore::tr("Pack is truncated");
+            return false;
+        }
+
+        const QByteArray raw = qUncompress(compressed);
+        if (raw.size() != int(rawLength)) {
+            *error = QuarantineStore::tr("Corrupt chunk in pack");
+            return false;
+        }
+
+        hash.addData(raw);
+        if (output->write(raw) != raw.size()) {
+            *error = output->errorString();
+            return false;
+        }
+        offset += 8 + qint64(storedLength);
+    }
+
+    if (memcmp(hash.result().constData(), entry.sha256, 32) != 0) {
+        *error = QuarantineStore::tr("Restored data does not match its SHA-256");
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+// Lives at offset 0 of index.dat and occupies one record slot
+struct QuarantineStore::IndexHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 recordSize;
+    quint64 recordCount;
+    quint64 namesUsed;
+    uchar reserved[96];
+};
+
+QuarantineStore::QuarantineStore(QObject *parent)
+    : QObject(parent)
+{
+}
+
+QuarantineStore::~QuarantineStore()
+{
+    close();
+}
+
+QString QuarantineStore::defaultDirectory()
+{
+    // Spelled out rather than AppDataLocation, which follows whichever
+    // program asks; on Linux and macOS it is where that puts the
+    // desktop application's data
+    return QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/" + kApplicationName
+           + "/quarantine";
+}
+
+bool QuarantineStore::fail(const QString &message)
+{
+    lastError = message;
+    qDebug() << "Quarantine:" << message;
+    return false;
+}
+
+bool QuarantineStore::open(const QString &directory)
+{
+    static_assert(sizeof(IndexHeader) == sizeof(QuarantineRecord), "header must fill exactly one record slot");
+    close();
+
+    QDir dir(directory);
+    if (!dir.exists() && !dir.mkpath("."))
+        return fail(tr("Cannot create %1").arg(directory));
+
+    packPath = dir.filePath("pack.dat");
+    packFile.setFileName(packPath);
+    if (!packFile.open(QIODevice::ReadWrite))
+        return fail(packFile.errorString());
+
+    if (!mapFile(indexFile, dir.filePath("index.dat"), qint64(sizeof(QuarantineRecord)) * kIndexGrowRecords)
+        || !mapFile(namesFile, dir.filePath("names.dat"), kNamesGrowBytes)) {
+        close();
+        return false;
+    }
+
+    index = reinterpret_cast<IndexHeader *>(indexFile.data);
+    if (memcmp(index->magic, kIndexMagic, sizeof(kIndexMagic)) != 0) {
+        // A fresh (zero-filled) file; anything else is not ours
+        for (size_t i = 0; i < sizeof(IndexHeader); ++i) {
+            if (indexFile.data[i] != 0) {
+                close();
+                return fail(tr("index.dat is not a quarantine index"));
+            }
+        }
+        memcpy(index->magic, kIndexMagic, sizeof(kIndexMagic));
+        index->version = kIndexVersion;
+        index->recordSize = sizeof(QuarantineRecord);
+    } else if (index->version != kIndexVersion || index->recordSize != sizeof(QuarantineRecord)) {
+        close();
+        return fail(tr("Unsupported quarantine index version"));
+    }
+
+    // Rebuild the dedup table; this touches only 32 bytes per record
+    const int count = recordCount();
+    objects.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        const QuarantineRecord *entry = record(i);
+        if (entry->objectRecord == quint32(i)) {
+            objects.insert(QByteArray(reinterpret_cast<const char *>(entry->sha256), 32), quint32(i));
+        }
+    }
+    return true;
+}
+
+void QuarantineStore::close()
+{
+    objects.clear();
+    index = nullptr;
+    unmapFile(indexFile);
+    unmapFile(namesFile);
+    if (packFile.isOpen())
+        packFile.close();
+    packPath.clear();
+}
+
+bool QuarantineStore::mapFile(MappedFile &mapped, const QString &path, qint64 minimumSize)
+{
+    mapped.file.setFileName(path);
+    if (!mapped.file.open(QIODevice::ReadWrite))
+        return fail(mapped.file.errorString());
+    if (mapped.file.size() < minimumSize && !mapped.file.resize(minimumSize))
+        return fail(mapped.file.errorString());
+
+    mapped.capacity = mapped.file.size();
+    mapped.data = mapped.file.map(0, mapped.capacity);
+    if (!mapped.data)
+        return fail(tr("Cannot map %1: %2").arg(path, mapped.file.errorString()));
+    return true;
+}
+
+bool QuarantineStore::growFile(MappedFile &mapped, qint64 required)
+{
+    if (required <= mapped.capacity)
+        return true;
+
+    const bool isIndex = &mapped == &indexFile;
+    const qint64 step = isIndex ? qint64(sizeof(QuarantineRecord)) * kIndexGrowRecords : kNamesGrowBytes;
+    const qint64 newCapacity = (required + step - 1) / step * step;
+
+    mapped.file.unmap(mapped.data);
+    mapped.data = nullptr;
+    if (!mapped.file.resize(newCapacity))
+        return fail(mapped.file.errorString());
+    mapped.data = mapped.file.map(0, newCapacity);
+    if (!mapped.data)
+        return fail(mapped.file.errorString());
+    mapped.capacity = newCapacity;
+
+    if (isIndex)
+        index = reinterpret_cast<IndexHeader *>(mapped.data);
+    return true;
+}
+
+void QuarantineStore::unmapFile(MappedFile &mapped)
+{
+    if (mapped.data) {
+        mapped.file.unmap(mapped.data);
+        mapped.data = nullptr;
+    }
+    mapped.capacity = 0;
+    if (mapped.file.isOpen())
+        mapped.file.close();
+}
+
+int QuarantineStore::recordCount() const
+{
+    return index ? int(index->recordCount) : 0;
+}
+
+const QuarantineRecord *QuarantineStore::record(int i) const
+{
+    if (!index || i < 0 || quint64(i) >= index->recordCount)
+        return nullptr;
+    // Record slot 0 holds the header
+    return reinterpret_cast<const QuarantineRecord *>(indexFile.data) + 1 + i;
+}
+
+QuarantineRecord *QuarantineStore::mutableRecord(int i)
+{
+    return const_cast<QuarantineRecord *>(record(i));
+}
+
+QString QuarantineStore::pathOf(const QuarantineRecord &entry) const
+{
+    if (entry.nameOffset + entry.pathLength > quint64(namesFile.capacity))
+        return QString();
+    return QString::fromUtf8(reinterpret_cast<const char *>(namesFile.data + entry.nameOffset),
+                             int(entry.pathLength));
+}
+
+QString QuarantineStore::hostOf(const QuarantineRecord &entry) const
+{
+    const quint64 offset = entry.nameOffset + entry.pathLength;
+    if (offset + entry.hostLength > quint64(namesFile.capacity))
+        return QString();
+    return QString::fromUtf8(reinterpret_cast<const char *>(namesFile.data + offset), int(entry.hostLength));
+}
+
+quint64 QuarantineStore::packSize() const
+{
+    return packFile.isOpen() ? quint64(packFile.size()) : 0;
+}
+
+quint64 QuarantineStore::appendNames(const QByteArray &path, const QByteArray &host)
+{
+    const quint64 offset = index->namesUsed;
+    if (!growFile(namesFile, qint64(offset) + path.size() + host.size()))
+        return quint64(-1);
+    memcpy(namesFile.data + offset, path.constData(), size_t(path.size()));
+    memcpy(namesFile.data + offset + path.size(), host.constData(), size_t(host.size()));
+    index->namesUsed = offset + quint64(path.size() + host.size());
+    return offset;
+}
+
+int QuarantineStore::quarantineFile(const QString &path, const QString &host, bool removeOriginal)
+{
+    if (!isOpen()) {
+        fail(tr("Quarantine store is not open"));
+        return -1;
+    }
+    return commit(prepare(path), host, removeOriginal);
+}
+
+QuarantineStore::PreparedSample QuarantineStore::prepare(const QString &path) const
+{
+    PreparedSample sample;
+    sample.path = path;
+    memset(&sample.entry, 0, sizeof(sample.entry));
+
+    QFile source(path);
+    if (!source.open(QIODevice::ReadOnly)) {
+        sample.error = source.errorString();
+        return sample;
+    }
+    // A handle of our own, so the store's keeps serving its thread
+    QFile pack(packPath);
+    if (packPath.isEmpty() || !pack.open(QIODevice::ReadWrite)) {
+        sample.error = packPath.isEmpty() ? tr("Quarantine store is not open") : pack.errorString();
+        return sample;
+    }
+
+    sample.entry.quarantinedAt = QDateTime::currentMSecsSinceEpoch();
+    sample.entry.permissions = quint32(source.permissions().toInt());
+
+    // One pass hashes and compresses, so a file that changes under us is
+    // stored as read; a duplicate is dropped from the pack again on commit
+    if (!appendObject(pack, source, sample.entry, &sample.digest, &sample.error))
+        return sample;
+    // The object reaches the disk before any record refers to it
+    if (!syncFile(pack)) {
+        sample.error = tr("Cannot sync the quarantine store");
+        pack.resize(qint64(sample.entry.packOffset));
+        return sample;
+    }
+    memcpy(sample.entry.sha256, sample.digest.constData(), 32);
+    return sample;
+}
+
+int QuarantineStore::commit(const PreparedSample &sample, const QString &host, bool removeOriginal)
+{
+    if (!sample.error.isEmpty()) {
+        fail(sample.error);
+        return -1;
+    }
+    if (!isOpen()) {
+        fail(tr("Quarantine store is not open"));
+        return -1;
+    }
+
+    const int slot = recordCount();
+    if (!growFile(indexFile, qint64(sizeof(QuarantineRecord)) * (slot + 2)))
+        return -1;
+
+    QuarantineRecord entry = sample.entry;
+    const auto existing = objects.constFind(sample.digest);
+    if (existing != objects.constEnd()) {
+        // Only the tail of the pack is ours to cut
+        if (packFile.size() == qint64(entry.packOffset + entry.storedSize))
+            packFile.resize(qint64(entry.packOffset));
+        const QuarantineRecord *owner = record(int(existing.value()));
+        entry.packOffset = owner->packOffset;
+        entry.storedSize = owner->storedSize;
+        entry.chunkCount = owner->chunkCount;
+        entry.objectRecord = existing.value();
+    } else {
+        entry.objectRecord = quint32(slot);
+    }
+
+    const QByteArray pathUtf8 = QFileInfo(sample.path).absoluteFilePath().toUtf8();
+    const QByteArray hostUtf8 = (host.isEmpty() ? QSysInfo::machineHostName() : host).toUtf8();
+    entry.nameOffset = appendNames(pathUtf8, hostUtf8);
+    if (entry.nameOffset == quint64(-1))
+        return -1;
+    entry.pathLength = quint32(pathUtf8.size());
+    entry.hostLength = quint32(hostUtf8.size());
+
+    // The names reach the disk before the record that refers to them, as
+    // the object did in prepare(), and the record before the original goes.
+    // Write the record, then publish it by bumping the count
+    const qint64 recordOffset = qint64(sizeof(QuarantineRecord)) * (1 + slot);
+    memcpy(indexFile.data + recordOffset, &entry, sizeof(entry));
+    if (!syncMapping(namesFile.data, qint64(entry.nameOffset), pathUtf8.size() + hostUtf8.size())
+        || !syncMapping(indexFile.data, recordOffset, sizeof(QuarantineRecord))) {
+        fail(tr("Cannot sync the quarantine store"));
+        return -1;
+    }
+    index->recordCount = quint64(slot) + 1;
+    if (entry.objectRecord == quint32(slot))
+        objects.insert(sample.digest, quint32(slot));
+    const bool durable = syncMapping(indexFile.data, 0, sizeof(IndexHeader));
+
+    if (removeOriginal && !durable)
+        qDebug() << "Quarantined but kept the original, the index could not be synced:" << sample.path;
+    else if (removeOriginal && !QFile::remove(sample.path))
+        qDebug() << "Quarantined but could not remove original:" << sample.path;
+
+    emit recordAppended(slot);
+    return slot;
+}
+
+bool QuarantineStore::restore(int recordIndex, QIODevice *output)
+{
+    const QuarantineRecord *entry = record(recordIndex);
+    if (!entry)
+        return fail(tr("No such quarantine record"));
+    QString error;
+    if (!readObject(packFile, *entry, output, &error))
+        return fail(error);
+    return true;
+}
+
+bool QuarantineStore::restoreToPath(int recordIndex, const QString &path)
+{
+    const QuarantineRecord *entry = record(recordIndex);
+    if (!entry)
+        return fail(tr("No such quarantine record"));
+    QString error;
+    if (!restoreCopy(*entry, path, &error))
+        return fail(error);
+    markRestored(recordIndex);
+    return true;
+}
+
+bool QuarantineStore::restoreCopy(const QuarantineRecord &entry, const QString &path, QString *error) const
+{
+    QFile pack(packPath);
+    if (packPath.isEmpty() || !pack.open(QIODevice::ReadOnly)) {
+        *error = packPath.isEmpty() ? tr("Quarantine store is not open") : pack.errorString();
+        return false;
+    }
+
+    // Decompress straight into the destination; if the hash check fails
+    // the partial file is removed rather than left looking restored.
+    QFile output(path);
+    if (!output.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        *error = output.errorString();
+        return false;
+    }
+    if (!readObject(pack, entry, &output, error) || !output.flush()) {
+        if (error->isEmpty())
+            *error = output.errorString();
+        output.close();
+        output.remove();
+        return false;
+    }
+    output.close();
+    output.setPermissions(QFile::Permissions::fromInt(int(entry.permissions)));
+    return true;
+}
+
+void QuarantineStore::markRestored(int recordIndex)
+{
+    QuarantineRecord *entry = mutableRecord(recordIndex);
+    if (!entry)
+        return;
+    entry->flags |= QuarantineRecord::Restored;
+    emit recordChanged(recordIndex);
+}
+
+bool QuarantineStore::removeRecord(int recordIndex)
+{
+    QuarantineRecord *entry = mutableRecord(recordIndex);
+    if (!entry)
+        return fail(tr("No such quarantine record"));
+
+    // The pack is append-only; the object stays for other copies and
+    // the record is only hidden.
+    entry->flags |= QuarantineRecord::Removed;
+    emit recordChanged(recordIndex);
+    return true;
+}
@@ -0,0 +1,135 @@
+#ifndef QUARANTINESTORE_H
+#define QUARANTINESTORE_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QDateTime>
+#include <QFile>
+#include <QHash>
+#include <QIODevice>
+#include <QString>
+
+// Fixed-size index entry; the index file is an array of these behind a
+// header and is mapped straight into memory, so listing never parses.
+struct QuarantineRecord
+{
+    enum Flag : quint32 {
+        Restored = 0x1,
+        Removed  = 0x2
+    };
+
+    uchar sha256[32];
+    quint64 packOffset;     // Start of the object's chunk stream in pack.dat
+    quint64 storedSize;     // Compressed bytes in the pack
+    quint64 originalSize;
+    qint64 quarantinedAt;   // ms since epoch
+    quint64 nameOffset;     // UTF-8 path followed by host in names.dat
+    quint32 pathLength;
+    quint32 hostLength;
+    quint32 chunkCount;
+    quint32 flags;
+    quint32 objectRecord;   // Record that owns the pack bytes (itself unless deduplicated)
+    quint32 permissions;
+    uchar reserved[32];
+};
+
+static_assert(sizeof(QuarantineRecord) == 128, "Index records are mapped from disk and must stay 128 bytes");
+
+// Content-addressed quarantine. Samples are keyed by SHA-256 and stored
+// once in an append-only pack of qCompress'd 1 MiB chunks, no matter how
+// many hosts or paths they were quarantined from. Every quarantine event
+// still gets its own index record so listing shows each copy.
+//
+// Layout under the store directory:
+//   pack.dat   chunk stream: [u32 stored][u32 raw][qCompress data]...
+//   index.dat  header + QuarantineRecord[], mmap'd and grown in steps
+//   names.dat  UTF-8 paths and host names, mmap'd the same way
+//
+// Appends commit by bumping the record count in the index header last,
+// after syncing the pack, so a crash mid-quarantine leaves only
+// unreferenced pack bytes behind. The original is removed only once the
+// record is on disk.
+class QuarantineStore : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit QuarantineStore(QObject *parent = nullptr);
+    ~QuarantineStore();
+
+    // Where the desktop application keeps its store, whichever program asks
+    static QString defaultDirectory();
+
+    bool open(const QString &directory);
+    void close();
+    bool isOpen() const { return index != nullptr; }
+    QString errorString() const { return lastError; }
+
+    // Moves a file into quarantine. `host` defaults to this machine and is
+    // set explicitly when importing samples collected on other hosts.
+    // Returns the new record index or -1.
+    int quarantineFile(const QString &path, const QString &host = QString(), bool removeOriginal = true);
+
+    // Streams the sample back out, decompressing chunk by chunk and
+    // verifying the SHA-256 on the fly. No temporary files are written.
+    bool restore(int record, QIODevice *output);
+    bool restoreToPath(int record, const QString &path);
+    bool removeRecord(int record);
+
+    // The slow halves of quarantineFile() and restoreToPath(), for callers
+    // that run them off the store's thread: they go through pack handles
+    // of their own and touch neither the mapped index nor errorString().
+    // One at a time, and no quarantineFile() or commit() meanwhile, since
+    // commit() cuts a duplicate off the end of the pack.
+    struct PreparedSample
+    {
+        QString path;
+        QuarantineRecord entry;
+        QByteArray digest;
+        QString error;                 // Empty once the object is in the pack
+    };
+    PreparedSample prepare(const QString &path) const;
+    // On the store's thread: records a prepared sample and removes the original
+    int commit(const PreparedSample &sample, const QString &host = QString(), bool removeOriginal = true);
+    // `entry` is a copy, as an append may move the mapping
+    bool restoreCopy(const QuarantineRecord &entry, const QString &path, QString *error) const;
+    void markRestored(int record);
+
+    // Direct views into the mapped index; valid until the next append
+    int recordCount() const;
+    const QuarantineRecord *record(int index) const;
+    QString pathOf(const QuarantineRecord &record) const;
+    QString hostOf(const QuarantineRecord &record) const;
+    quint64 packSize() const;
+    int uniqueSamples() const { return objects.size(); }
+
+signals:
+    void recordAppended(int index);
+    void recordChanged(int index);
+
+private:
+    struct MappedFile
+    {
+        QFile file;
+        uchar *data = nullptr;
+        qint64 capacity = 0;
+    };
+
+    bool mapFile(MappedFile &mapped, const QString &path, qint64 minimumSize);
+    bool growFile(MappedFile &mapped, qint64 required);
+    void unmapFile(MappedFile &mapped);
+    quint64 appendNames(const QByteArray &path, const QByteArray &host);
+    QuarantineRecord *mutableRecord(int index);
+    bool fail(const QString &message);
+
+    struct IndexHeader;
+    IndexHeader *index = nullptr;
+    MappedFile indexFile;
+    MappedFile namesFile;
+    QFile packFile;
+    QString packPath;                    // For the handles of prepare() and restoreCopy()
+    QHash<QByteArray, quint32> objects;  // SHA-256 -> owning record
+    QString lastError;
+};
+
+#endif // QUARANTINESTORE_H
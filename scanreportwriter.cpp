@@ -0,0 +1,538 @@
+#include "scanreportwriter.h"
+#include <QCommandLineParser>
+#include <QFile>
+#include <cerrno>
+#include <cstring>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#endif
+
+#ifdef RHYNEC_HAVE_ZLIB
+#include <zlib.h>
+#else
+struct z_stream_s {};
+#endif
+
+namespace {
+
+const char kCsvHeader[] = "path,status,type,score,flags,size,parse_us\n";
+
+const char kSarifHeader[] =
+    "{\"$schema\":\"https://json.schemastore.org/sarif-2.1.0.json\",\"version\":\"2.1.0\","
+    "\"runs\":[{\"tool\":{\"driver\":{\"name\":\"Rhynec Security\",\"informationUri\":\"https://rhynec.com\","
+    "\"rules\":["
+    "{\"id\":\"malicious\",\"shortDescription\":{\"text\":\"File matched a malicious pattern\"}},"
+    "{\"id\":\"suspicious\",\"shortDescription\":{\"text\":\"File has suspicious structure\"}},"
+    "{\"id\":\"unreadable\",\"shortDescription\":{\"text\":\"File could not be read\"}},"
+    "{\"id\":\"crashed\",\"shortDescription\":{\"text\":\"Parser worker crashed on this file\"}},"
+    "{\"id\":\"timed_out\",\"shortDescription\":{\"text\":\"Parser worker timed out on this file\"}}"
+    "]}},\"results\":[";
+
+const char kSarifFooter[] = "]}]}\n";
+
+const char *sarifLevel(quint8 status)
+{
+    switch (status) {
+    case ScanVerdict::Malicious: return "error";
+    case ScanVerdict::Suspicious: return "warning";
+    default: return "note";
+    }
+}
+
+} // namespace
+
+ScanReportWriter::ScanReportWriter(QObject *parent)
+    : QObject(parent)
+{
+    qRegisterMetaType<ScanVerdict>();
+}
+
+ScanReportWriter::~ScanReportWriter()
+{
+    if (isActive())
+        finish();
+}
+
+bool ScanReportWriter::compressionAvailable()
+{
+#ifdef RHYNEC_HAVE_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool ScanReportWriter::formatForPath(const QString &path, Format *format, bool *compress)
+{
+    QString name = path.toLower();
+    *compress = name.endsWith(".gz");
+    if (*compress)
+        name.chop(3);
+
+    if (name.endsWith(".jsonl") || name.endsWith(".ndjson"))
+        *format = Format::JsonLines;
+    else if (name.endsWith(".csv"))
+        *format = Format::Csv;
+    else if (name.endsWith(".sarif") || name.endsWith(".sarif.json"))
+        *format = Format::Sarif;
+    else
+        return false;
+    return true;
+}
+
+QList<QCommandLineOption> ScanReportWriter::commandLineOptions()
+{
+    return { QCommandLineOption("report", "Write results to <file> (\"-\" for stdout).", "file"),
+             QCommandLineOption("format", "Report format: jsonl, csv or sarif.", "format"),
+             QCommandLineOption("compress", "Gzip the report.") };
+}
+
+bool ScanReportWriter::beginFromCommandLine(const QCommandLineParser &parser)
+{
+    if (!parser.isSet("report"))
+        return true;
+    const QString path = parser.value("report");
+    Format reportFormat = Format::JsonLines;
+    bool compress = false;
+    if (parser.isSet("format")) {
+        const QString name = parser.value("format");
+        if (name == "jsonl")
+            reportFormat = Format::JsonLines;
+        else if (name == "csv")
+            reportFormat = Format::Csv;
+        else if (name == "sarif")
+            reportFormat = Format::Sarif;
+        else
+            return fail(tr("Unknown report format: %1").arg(name));
+    } else if (!formatForPath(path, &reportFormat, &compress)) {
+        return fail(tr("Cannot infer a report format from %1; use --format").arg(path));
+    }
+    return begin(path, reportFormat, compress || parser.isSet("compress"));
+}
+
+bool ScanReportWriter::fail(const QString &message)
+{
+    if (!failed)
+        lastError = message;
+    failed = true;
+    return false;
+}
+
+void ScanReportWriter::endDeflate()
+{
+#ifdef RHYNEC_HAVE_ZLIB
+    if (zstream) {
+        deflateEnd(zstream.get());
+        zstream.reset();
+    }
+#endif
+}
+
+double ScanReportWriter::rowsPerSecond() const
+{
+    const qint64 nanos = isActive() ? timer.nsecsElapsed() : elapsedAtFinish;
+    return nanos > 0 ? double(rows) * 1e9 / double(nanos) : 0.0;
+}
+
+bool ScanReportWriter::begin(const QString &path, Format reportFormat, bool compress)
+{
+    if (isActive())
+        finish();
+
+    format = reportFormat;
+    failed = false;
+    lastError.clear();
+    rows = sarifResults = rawBytes = outputBytes = 0;
+    currentBlock = 0;
+    memset(blockUsed, 0, sizeof(blockUsed));
+    stageUsed = 0;
+
+    // Set up before the output is opened, so a failure here leaves no
+    // empty report behind
+    if (compress) {
+#ifdef RHYNEC_HAVE_ZLIB
+        if (!stage)
+            stage.reset(new char[kBlockSize]);
+        zstream.reset(new z_stream_s);
+        memset(zstream.get(), 0, sizeof(z_stream_s));
+        // windowBits 15 + 16 selects a gzip wrapper
+        if (deflateInit2(zstream.get(), Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            zstream.reset();
+            return fail(tr("Cannot initialise gzip stream"));
+        }
+#else
+        return fail(tr("This build has no compression support"));
+#endif
+    }
+
+#ifdef Q_OS_UNIX
+    if (path == "-") {
+        fd = STDOUT_FILENO;
+        ownsFd = false;
+    } else {
+        fd = ::open(QFile::encodeName(path).constData(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        ownsFd = true;
+        if (fd < 0) {
+            const QString message = QString::fromLocal8Bit(strerror(errno));
+            endDeflate();
+            return fail(message);
+        }
+    }
+#else
+    Q_UNUSED(path);
+    endDeflate();
+    return fail(tr("Report export requires a POSIX platform"));
+#endif
+
+    if (!blocks)
+        blocks.reset(new char[size_t(kBlockCount) * kBlockSize]);
+
+    timer.start();
+    writeHeader();
+    return !failed;
+}
+
+bool ScanReportWriter::finish()
+{
+    if (!isActive())
+        return false;
+
+    writeFooter();
+
+#ifdef RHYNEC_HAVE_ZLIB
+    if (zstream)
+        deflateStage(Z_FINISH);
+#endif
+    endDeflate();
+    flushBlocks();
+
+#ifdef Q_OS_UNIX
+    if (ownsFd && ::close(fd) != 0)
+        fail(QString::fromLocal8Bit(strerror(errno)));
+#endif
+    fd = -1;
+    elapsedAtFinish = timer.nsecsElapsed();
+    return !failed;
+}
+
+void ScanReportWriter::addResult(const QString &path, const ScanVerdict &verdict)
+{
+    const QByteArray utf8 = path.toUtf8();
+    addResultUtf8(utf8.constData(), utf8.size(), verdict);
+}
+
+void ScanReportWriter::addResultUtf8(const char *path, int length, const ScanVerdict &verdict)
+{
+    if (!isActive() || failed)
+        return;
+
+    switch (format) {
+    case Format::JsonLines:
+        writeJsonRow(path, size_t(length), verdict);
+        break;
+    case Format::Csv:
+        writeCsvRow(path, size_t(length), verdict);
+        break;
+    case Format::Sarif:
+        if (verdict.status != ScanVerdict::Clean)
+            writeSarifResult(path, size_t(length), verdict);
+        break;
+    }
+    ++rows;
+}
+
+void ScanReportWriter::writeHeader()
+{
+    if (format == Format::Csv)
+        append(kCsvHeader);
+    else if (format == Format::Sarif)
+        append(kSarifHeader);
+}
+
+void ScanReportWriter::writeFooter()
+{
+    if (format == Format::Sarif)
+        append(kSarifFooter);
+}
+
+void ScanReportWriter::writeJsonRow(const char *path, size_t length, const ScanVerdict &verdict)
+{
+    append("{\"path\":");
+    appendJsonString(path, length);
+    append(",\"status\":\"");
+    append(scanStatusName(verdict.status));
+    append("\",\"type\":\"");
+    append(scanFileTypeName(verdict.fileType));
+    append("\",\"score\":");
+    appendNumber(verdict.score);
+    append(",\"flags\":");
+    appendFlagsJson(verdict.flags);
+    append(",\"size\":");
+    appendNumber(verdict.fileSize);
+    append(",\"parse_us\":");
+    appendNumber(verdict.parseMicros);
+    append("}\n");
+}
+
+void ScanReportWriter::writeCsvRow(const char *path, size_t length, const ScanVerdict &verdict)
+{
+    appendCsvField(path, length);
+    append(",");
+    append(scanStatusName(verdict.status));
+    append(",");
+    append(scanFileTypeName(verdict.fileType));
+    append(",");
+    appendNumber(verdict.score);
+    append(",");
+    bool first = true;
+    for (quint16 bit = 1; bit; bit <<= 1) {
+        if (verdict.flags & bit) {
+            if (!first)
+                append("|");
+            append(scanFlagName(bit));
+            first = false;
+        }
+    }
+    append(",");
+    appendNumber(verdict.fileSize);
+    append(",");
+    appendNumber(verdict.parseMicros);
+    append("\n");
+}
+
+void ScanReportWriter::writeSarifResult(const char *path, size_t length, const ScanVerdict &verdict)
+{
+    if (sarifResults++ > 0)
+        append(",");
+    append("{\"ruleId\":\"");
+    append(scanStatusName(verdict.status));
+    append("\",\"level\":\"");
+    append(sarifLevel(verdict.status));
+    append("\",\"message\":{\"text\":\"");
+    append(scanFileTypeName(verdict.fileType));
+    append(" file scored ");
+    appendNumber(verdict.score);
+    append("\"},\"locations\":[{\"physicalLocation\":{\"artifactLocation\":{\"uri\":\"");
+    appendFileUri(path, length);
+    append("\"}}}],\"properties\":{\"flags\":");
+    appendFlagsJson(verdict.flags);
+    append(",\"size\":");
+    appendNumber(verdict.fileSize);
+    append("}}");
+}
+
+void ScanReportWriter::appendFlagsJson(quint16 flags)
+{
+    append("[");
+    bool first = true;
+    for (quint16 bit = 1; bit; bit <<= 1) {
+        if (flags & bit) {
+            append(first ? "\"" : ",\"");
+            append(scanFlagName(bit));
+            append("\"");
+            first = false;
+        }
+    }
+    append("]");
+}
+
+void ScanReportWriter::append(const char *text)
+{
+    append(text, strlen(text));
+}
+
+void ScanReportWriter::appendNumber(quint64 value)
+{
+    char digits[20];
+    int n = 0;
+    do {
+        digits[sizeof(digits) - 1 - n++] = char('0' + value % 10);
+        value /= 10;
+    } while (value);
+    append(digits + sizeof(digits) - n, size_t(n));
+}
+
+void ScanReportWriter::appendJsonString(const char *text, size_t length)
+{
+    static const char hex[] = "0123456789abcdef";
+    append("\"", 1);
+    size_t runStart = 0;
+    for (size_t i = 0; i < length; ++i) {
+        const uchar c = uchar(text[i]);
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+        append(text + runStart, i - runStart);
+        if (c == '"' || c == '\\') {
+            const char escaped[2] = { '\\', char(c) };
+            append(escaped, 2);
+        } else {
+            const char escaped[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+            append(escaped, 6);
+        }
+        runStart = i + 1;
+    }
+    append(text + runStart, length - runStart);
+    append("\"", 1);
+}
+
+void ScanReportWriter::appendCsvField(const char *text, size_t length)
+{
+    // RFC 4180: quote when the field holds a separator, quote or newline
+    bool needsQuotes = false;
+    for (size_t i = 0; i < length && !needsQuotes; ++i)
+        needsQuotes = text[i] == ',' || text[i] == '"' || text[i] == '\n' || text[i] == '\r';
+    if (!needsQuotes) {
+        append(text, length);
+        return;
+    }
+
+    append("\"", 1);
+    size_t runStart = 0;
+    for (size_t i = 0; i < length; ++i) {
+        if (text[i] == '"') {
+            append(text + runStart, i + 1 - runStart);
+            append("\"", 1);
+            runStart = i + 1;
+        }
+    }
+    append(text + runStart, length - runStart);
+    append("\"", 1);
+}
+
+void ScanReportWriter::appendFileUri(const char *path, size_t length)
+{
+    // Percent-encode everything outside the unreserved set plus '/', which
+    // also keeps the result valid inside a JSON string
+    static const char hex[] = "0123456789ABCDEF";
+    append(path[0] == '/' ? "file://" : "file:///");
+    for (size_t i = 0; i < length; ++i) {
+        const uchar c = uchar(path[i]);
+        const bool plain = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+                           || c == '/' || c == '-' || c == '_' || c == '.' || c == '~';
+        if (plain) {
+            append(path + i, 1);
+        } else {
+            const char escaped[3] = { '%', hex[c >> 4], hex[c & 0xf] };
+            append(escaped, 3);
+        }
+    }
+}
+
+void ScanReportWriter::append(const char *data, size_t length)
+{
+    rawBytes += length;
+#ifdef RHYNEC_HAVE_ZLIB
+    if (zstream) {
+        while (length > 0) {
+            const size_t chunk = qMin(length, size_t(kBlockSize) - stageUsed);
+            memcpy(stage.get() + stageUsed, data, chunk);
+            stageUsed += chunk;
+            data += chunk;
+            length -= chunk;
+            if (stageUsed == size_t(kBlockSize))
+                deflateStage(Z_NO_FLUSH);
+        }
+        return;
+    }
+#endif
+    appendRaw(data, length);
+}
+
+void ScanReportWriter::appendRaw(const char *data, size_t length)
+{
+    while (length > 0) {
+        size_t &used = blockUsed[currentBlock];
+        const size_t chunk = qMin(length, size_t(kBlockSize) - used);
+        memcpy(blocks.get() + size_t(currentBlock) * kBlockSize + used, data, chunk);
+        used += chunk;
+        data += chunk;
+        length -= chunk;
+        if (used == size_t(kBlockSize)) {
+            if (currentBlock + 1 == kBlockCount)
+                flushBlocks();
+            else
+                ++currentBlock;
+        }
+    }
+}
+
+bool ScanReportWriter::deflateStage(int flushMode)
+{
+#ifdef RHYNEC_HAVE_ZLIB
+    z_stream *z = zstream.get();
+    z->next_in = reinterpret_cast<Bytef *>(stage.get());
+    z->avail_in = uInt(stageUsed);
+    for (;;) {
+        size_t &used = blockUsed[currentBlock];
+        z->next_out = reinterpret_cast<Bytef *>(blocks.get() + size_t(currentBlock) * kBlockSize + used);
+        z->avail_out = uInt(size_t(kBlockSize) - used);
+        const int result = deflate(z, flushMode);
+        used = size_t(kBlockSize) - z->avail_out;
+        if (result == Z_STREAM_ERROR)
+            return fail(tr("gzip stream error"));
+
+        if (used == size_t(kBlockSize)) {
+            if (currentBlock + 1 == kBlockCount) {
+                if (!flushBlocks())
+                    return false;
+            } else {
+                ++currentBlock;
+            }
+            continue;
+        }
+        // Output space remains, so deflate consumed all input it could
+        if (flushMode != Z_FINISH || result == Z_STREAM_END)
+            break;
+    }
+    stageUsed = 0;
+    return true;
+#else
+    Q_UNUSED(flushMode);
+    return false;
+#endif
+}
+
+bool ScanReportWriter::flushBlocks()
+{
+#ifdef Q_OS_UNIX
+    struct iovec vectors[kBlockCount];
+    int count = 0;
+    for (int i = 0; i <= currentBlock; ++i) {
+        if (blockUsed[i] == 0)
+            continue;
+        vectors[count].iov_base = blocks.get() + size_t(i) * kBlockSize;
+        vectors[count].iov_len = blockUsed[i];
+        ++count;
+    }
+
+    struct iovec *next = vectors;
+    while (count > 0 && !failed) {
+        const ssize_t written = ::writev(fd, next, count);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            fail(QString::fromLocal8Bit(strerror(errno)));
+            break;
+        }
+        outputBytes += quint64(written);
+
+        // Skip over fully written vectors and trim a partial one
+        size_t remaining = size_t(written);
+        while (count > 0 && remaining >= next->iov_len) {
+            remaining -= next->iov_len;
+            ++next;
+            --count;
+        }
+        if (count > 0) {
+            next->iov_base = static_cast<char *>(next->iov_base) + remaining;
+            next->iov_len -= remaining;
+        }
+    }
+#endif
+    currentBlock = 0;
+    memset(blockUsed, 0, sizeof(blockUsed));
+    return !failed;
+}
@@ -0,0 +1,105 @@
+#ifndef SCANREPORTWRITER_H
+#define SCANREPORTWRITER_H
+
+#include <QCommandLineOption>
+#include <QList>
+#include <QObject>
+#include <QString>
+#include <QElapsedTimer>
+#include <memory>
+#include "scanverdict.h"
+
+class QCommandLineParser;
+struct z_stream_s;
+
+// Streaming exporter for scan results. Rows are formatted straight into a
+// small fixed set of 64 KiB blocks that are flushed with a single writev()
+// once all of them are full, optionally through a streaming gzip stage.
+// Nothing grows with the number of results: memory use is the same for
+// ten rows or ten million.
+//
+// SARIF is written as one document whose header and footer are emitted by
+// begin()/finish(); only non-clean verdicts become SARIF results.
+class ScanReportWriter : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum class Format { JsonLines, Csv, Sarif };
+
+    explicit ScanReportWriter(QObject *parent = nullptr);
+    ~ScanReportWriter();
+
+    // Picks the format from the extension (.jsonl, .csv, .sarif) and
+    // enables compression for a trailing .gz
+    static bool formatForPath(const QString &path, Format *format, bool *compress);
+    static bool compressionAvailable();
+
+    // The --report, --format and --compress options of the command-line
+    // front ends, and begin() on what they ask for: the format given, or
+    // the one the report's name implies. True when there is no --report.
+    static QList<QCommandLineOption> commandLineOptions();
+    bool beginFromCommandLine(const QCommandLineParser &parser);
+
+    // "-" writes to standard output
+    bool begin(const QString &path, Format format, bool compress = false);
+    bool finish();
+    bool isActive() const { return fd >= 0; }
+    QString errorString() const { return lastError; }
+
+    quint64 rowsWritten() const { return rows; }
+    quint64 bytesFormatted() const { return rawBytes; }
+    quint64 bytesWritten() const { return outputBytes; }
+    double rowsPerSecond() const;
+
+public slots:
+    void addResult(const QString &path, const ScanVerdict &verdict);
+    void addResultUtf8(const char *path, int length, const ScanVerdict &verdict);
+
+private:
+    static const int kBlockCount = 8;
+    static const int kBlockSize = 64 * 1024;
+
+    void append(const char *data, size_t length);
+    void append(const char *text);
+    void appendNumber(quint64 value);
+    void appendJsonString(const char *text, size_t length);
+    void appendCsvField(const char *text, size_t length);
+    void appendFileUri(const char *path, size_t length);
+    void appendFlagsJson(quint16 flags);
+
+    void appendRaw(const char *data, size_t length);
+    bool deflateStage(int flushMode);
+    void endDeflate();
+    bool flushBlocks();
+    bool fail(const QString &message);
+
+    void writeHeader();
+    void writeFooter();
+    void writeJsonRow(const char *path, size_t length, const ScanVerdict &verdict);
+    void writeCsvRow(const char *path, size_t length, const ScanVerdict &verdict);
+    void writeSarifResult(const char *path, size_t length, const ScanVerdict &verdict);
+
+    Format format = Format::JsonLines;
+    int fd = -1;
+    bool ownsFd = false;
+    bool failed = false;
+    QString lastError;
+
+    std::unique_ptr<char[]> blocks;      // kBlockCount * kBlockSize
+    int currentBlock = 0;
+    size_t blockUsed[kBlockCount] = {};
+
+    std::unique_ptr<char[]> stage;       // Plain text awaiting deflate
+    size_t stageUsed = 0;
+    std::unique_ptr<z_stream_s> zstream;
+
+    quint64 rows = 0;
+    quint64 sarifResults = 0;
+    quint64 rawBytes = 0;
+    quint64 outputBytes = 0;
+    QElapsedTimer timer;
+    qint64 elapsedAtFinish = 0;
+};
+
+#endif // SCANREPORTWRITER_H
@@ -0,0 +1,89 @@
+#ifndef SCANVERDICT_H
+#define SCANVERDICT_H
+
+#include <QtGlobal>
+#include <QMetaType>
+
+// Compact result of parsing one file. It is a fixed-size POD on purpose:
+// sandboxed parser workers send it back over a socket as raw bytes, so it
+// must not contain pointers or Qt containers.
+struct ScanVerdict
+{
+    enum Status : quint8 {
+        Clean = 0,
+        Suspicious,
+        Malicious,
+        Unreadable,
+        Crashed,     // Worker died while parsing this file
+        TimedOut     // Worker was killed for exceeding the job timeout
+    };
+
+    enum FileType : quint8 {
+        UnknownType = 0,
+        Elf,
+        Pe,
+        Zip,
+        Script,
+        Pdf
+    };
+
+    enum Flag : quint16 {
+        Truncated              = 0x0001, // Only a prefix of the file was parsed
+        EicarTestFile          = 0x0002,
+        ZipBomb                = 0x0004,
+        EntryOutsideCode       = 0x0008,
+        MalformedHeader        = 0x0010,
+        PackedSections         = 0x0020,
+        WritableCode           = 0x0040,
+        EmbeddedJavaScript     = 0x0080,
+        AutoAction             = 0x0100
+    };
+
+    quint64 jobId = 0;
+    quint64 fileSize = 0;
+    quint32 parseMicros = 0;
+    quint16 flags = 0;
+    quint8 status = Clean;
+    quint8 fileType = UnknownType;
+    quint32 score = 0;
+    quint32 reserved = 0;
+};
+
+static_assert(sizeof(ScanVerdict) == 32, "ScanVerdict is sent over the wire and must stay 32 bytes");
+
+// Stable lower-case names used in reports and machine-readable output
+
+inline const char *scanStatusName(quint8 status)
+{
+    static const char *const names[] = {
+        "clean", "suspicious", "malicious", "unreadable", "crashed", "timed_out"
+    };
+    return status < sizeof(names) / sizeof(names[0]) ? names[status] : "unknown";
+}
+
+inline const char *scanFileTypeName(quint8 type)
+{
+    static const char *const names[] = { "unknown", "elf", "pe", "zip", "script", "pdf" };
+    return type < sizeof(names) / sizeof(names[0]) ? names[type] : "unknown";
+}
+
+// `flag` must be a single ScanVerdict::Flag bit
+inline const char *scanFlagName(quint16 flag)
+{
+    switch (flag) {
+    case ScanVerdict::Truncated: return "truncated";
+    case ScanVerdict::EicarTestFile: return "eicar_test_file";
+    case ScanVerdict::ZipBomb: return "zip_bomb";
+    case ScanVerdict::EntryOutsideCode: return "entry_outside_code";
+    case ScanVerdict::MalformedHeader: return "malformed_header";
+    case ScanVerdict::PackedSections: return "packed_sections";
+    case ScanVerdict::WritableCode: return "writable_code";
+    case ScanVerdict::EmbeddedJavaScript: return "embedded_javascript";
+    case ScanVerdict::AutoAction: return "auto_action";
+    default: return "unknown";
+    }
+}
+
+Q_DECLARE_METATYPE(ScanVerdict)
+
+#endif // SCANVERDICT_H
@@ -0,0 +1,399 @@
+#include "securitytab.h"
+#include "alertmodel.h"
+#include "eventjournal.h"
+#include "filescanner.h"
+#include "parserworkerpool.h"
+#include "quarantinemodel.h"
+#include "quarantinestore.h"
+#include "scanreportwriter.h"
+#include <QApplication>
+#include <QDateTime>
+#include <QFileDialog>
+#include <QFileInfo>
+#include <QHBoxLayout>
+#include <QHeaderView>
+#include <QLocale>
+#include <QMessageBox>
+#include <QVBoxLayout>
+
+namespace {
+
+const int kAlertIntervalMs = 250;
+// New groups taken per tick; the rest wait in the pipeline's queue
+const int kAlertsPerTick = 64;
+
+// One line of the event log per scanned file, and one more for an alert
+void journalVerdict(EventJournal *journal, const QString &path, const ScanVerdict &verdict, const Alert *alert)
+{
+    const qint64 timeUs = QDateTime::currentMSecsSinceEpoch() * 1000;
+    journal->append(EventJournal::ScanResult, timeUs,
+                    QString("%1 %2 %3")
+                        .arg(QString::fromLatin1(scanStatusName(verdict.status)),
+                             QString::fromLatin1(scanFileTypeName(verdict.fileType)), path)
+                        .toUtf8());
+    if (alert) {
+        journal->append(EventJournal::SecurityAlert, timeUs,
+                        QString("%1 %2 %3")
+                            .arg(QString::fromLatin1(alertSeverityName(alert->severity)), alert->rule, path)
+                            .toUtf8());
+    }
+}
+
+} // namespace
+
+SecurityTab::SecurityTab(QuarantineStore *quarantine, MetricsBus *metrics, EventJournal *journal, QWidget *parent)
+    : QWidget(parent), quarantine(quarantine)
+{
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->setContentsMargins(0, 10, 0, 0);
+    layout->setSpacing(10);
+
+    // Scan row: pick a folder and optionally stream a report while scanning
+    QHBoxLayout *scanLayout = new QHBoxLayout();
+    scanButton = createActionButton("Scan folder...");
+    connect(scanButton, &QPushButton::clicked, this, &SecurityTab::onScanClicked);
+    scanStatusLabel = new QLabel("No scan running", this);
+    scanStatusLabel->setStyleSheet("color: #777777;");
+    scanLayout->addWidget(scanButton);
+    scanLayout->addSpacing(12);
+    scanLayout->addWidget(scanStatusLabel);
+    scanLayout->addStretch(1);
+    layout->addLayout(scanLayout);
+
+    scanPool = new ParserWorkerPool();
+    scanPool->setMetricsBus(metrics);
+    scanner = new FileScanner(scanPool);
+    reportWriter = new ScanReportWriter();
+    scanPool->moveToThread(&scanThread);
+    scanner->moveToThread(&scanThread);
+    reportWriter->moveToThread(&scanThread);
+    connect(&scanThread, &QThread::finished, scanner, &QObject::deleteLater);
+    connect(&scanThread, &QThread::finished, reportWriter, &QObject::deleteLater);
+    connect(&scanThread, &QThread::finished, scanPool, &QObject::deleteLater);
+    connect(scanner, &FileScanner::resultReady, reportWriter, &ScanReportWriter::addResult);
+    connect(scanner, &FileScanner::progress, this, &SecurityTab::onScanProgress);
+    connect(scanner, &FileScanner::finished, this, &SecurityTab::onScanFinished);
+    // Runs on the scan thread; takeAlerts() picks the results up
+    AlertPipeline *pipeline = &alerts;
+    connect(scanner, &FileScanner::resultReady, scanner, [pipeline, journal](const QString &path, const ScanVerdict &verdict) {
+        if (verdict.status == ScanVerdict::Suspicious || verdict.status == ScanVerdict::Malicious) {
+            const Alert alert = alertForVerdict(path, verdict);
+            pipeline->submit(alert);
+            journalVerdict(journal, path, verdict, &alert);
+        } else {
+            journalVerdict(journal, path, verdict, nullptr);
+        }
+    }, Qt::DirectConnection);
+    scanThread.start();
+
+    // Alerts: rate-limited notifications above the latest groups
+    QHBoxLayout *alertHeaderLayout = new QHBoxLayout();
+    QLabel *alertSectionLabel = new QLabel("Alerts", this);
+    QFont alertSectionFont = alertSectionLabel->font();
+    alertSectionFont.setWeight(QFont::DemiBold);
+    alertSectionFont.setPixelSize(18);
+    alertSectionLabel->setFont(alertSectionFont);
+    alertSummaryLabel = new QLabel("No alerts", this);
+    alertSummaryLabel->setStyleSheet("color: #777777;");
+    QPushButton *clearAlertsButton = createActionButton("Clear");
+    connect(clearAlertsButton, &QPushButton::clicked, this, &SecurityTab::onClearAlertsClicked);
+    alertHeaderLayout->addWidget(alertSectionLabel);
+    alertHeaderLayout->addSpacing(12);
+    alertHeaderLayout->addWidget(alertSummaryLabel);
+    alertHeaderLayout->addStretch(1);
+    alertHeaderLayout->addWidget(clearAlertsButton);
+    layout->addLayout(alertHeaderLayout);
+
+    notificationLabel = new QLabel(this);
+    notificationLabel->setWordWrap(true);
+    notificationLabel->setStyleSheet("background-color: #fff4e5; border-radius: 4px; padding: 8px;");
+    notificationLabel->hide();
+    layout->addWidget(notificationLabel);
+
+    alertModel = new AlertModel(this);
+    alertView = new QTableView(this);
+    alertView->setModel(alertModel);
+    alertView->setSelectionBehavior(QAbstractItemView::SelectRows);
+    alertView->setSelectionMode(QAbstractItemView::SingleSelection);
+    alertView->setShowGrid(false);
+    alertView->setAlternatingRowColors(true);
+    alertView->verticalHeader()->hide();
+    alertView->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+    alertView->verticalHeader()->setDefaultSectionSize(26);
+    alertView->horizontalHeader()->setSectionResizeMode(QHeaderView::Interactive);
+    alertView->horizontalHeader()->setStretchLastSection(true);
+    alertView->setColumnWidth(AlertModel::RuleColumn, 180);
+    alertView->setColumnWidth(AlertModel::LocationColumn, 260);
+    alertView->setStyleSheet(
+        "QTableView { border: 1px solid #e0e0e0; border-radius: 4px; background-color: white; }"
+        "QHeaderView::section { background-color: #f8f8f8; border: none; padding: 6px; }"
+        );
+    layout->addWidget(alertView, 1);
+
+    connect(&alertTimer, &QTimer::timeout, this, &SecurityTab::takeAlerts);
+    alertTimer.start(kAlertIntervalMs);
+
+    // Header row: section title, summary and actions
+    QHBoxLayout *headerLayout = new QHBoxLayout();
+    QLabel *sectionLabel = new QLabel("Quarantine", this);
+    QFont sectionFont = sectionLabel->font();
+    sectionFont.setWeight(QFont::DemiBold);
+    sectionFont.setPixelSize(18);
+    sectionLabel->setFont(sectionFont);
+
+    summaryLabel = new QLabel(this);
+    summaryLabel->setStyleSheet("color: #777777;");
+
+    addButton = createActionButton("Quarantine file...");
+    restoreButton = createActionButton("Restore");
+    removeButton = createActionButton("Delete");
+    connect(addButton, &QPushButton::clicked, this, &SecurityTab::onQuarantineFileClicked);
+    connect(restoreButton, &QPushButton::clicked, this, &SecurityTab::onRestoreClicked);
+    connect(removeButton, &QPushButton::clicked, this, &SecurityTab::onRemoveClicked);
+
+    headerLayout->addWidget(sectionLabel);
+    headerLayout->addSpacing(12);
+    headerLayout->addWidget(summaryLabel);
+    headerLayout->addStretch(1);
+    headerLayout->addWidget(addButton);
+    headerLayout->addWidget(restoreButton);
+    headerLayout->addWidget(removeButton);
+    layout->addLayout(headerLayout);
+
+    // The view only ever asks for visible rows; fixed row heights keep
+    // Qt from measuring all 100k rows when the model resets.
+    quarantineModel = new QuarantineModel(quarantine, this);
+    quarantineView = new QTableView(this);
+    quarantineView->setModel(quarantineModel);
+    quarantineView->setSelectionBehavior(QAbstractItemView::SelectRows);
+    quarantineView->setSelectionMode(QAbstractItemView::SingleSelection);
+    quarantineView->setShowGrid(false);
+    quarantineView->setAlternatingRowColors(true);
+    quarantineView->verticalHeader()->hide();
+    quarantineView->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+    quarantineView->verticalHeader()->setDefaultSectionSize(26);
+    quarantineView->horizontalHeader()->setSectionResizeMode(QHeaderView::Interactive);
+    quarantineView->horizontalHeader()->setStretchLastSection(true);
+    quarantineView->setColumnWidth(QuarantineModel::NameColumn, 260);
+    quarantineView->setStyleSheet(
+        "QTableView { border: 1px solid #e0e0e0; border-radius: 4px; background-color: white; }"
+        "QHeaderView::section { background-color: #f8f8f8; border: none; padding: 6px; }"
+        );
+    layout->addWidget(quarantineView, 1);
+
+    connect(quarantineModel, &QAbstractItemModel::rowsInserted, this, &SecurityTab::updateSummary);
+    connect(quarantineModel, &QAbstractItemModel::rowsRemoved, this, &SecurityTab::updateSummary);
+    connect(quarantineModel, &QAbstractItemModel::modelReset, this, &SecurityTab::updateSummary);
+    updateSummary();
+}
+
+SecurityTab::~SecurityTab()
+{
+    // A sample being quarantined or restored reports back to this tab
+    quarantineTasks.cancel();
+    TaskScheduler::instance()->wait(quarantineTasks);
+    // The writer finishes its report when the thread tears it down
+    scanThread.quit();
+    scanThread.wait();
+}
+
+void SecurityTab::onScanClicked()
+{
+    if (scanRunning) {
+        QMetaObject::invokeMethod(scanner, &FileScanner::cancel);
+        return;
+    }
+
+    QString folder = QFileDialog::getExistingDirectory(this, tr("Scan Folder"));
+    if (folder.isEmpty())
+        return;
+
+    // The report is optional; cancelling the dialog just scans
+    QString reportPath = QFileDialog::getSaveFileName(
+        this, tr("Export Report (optional)"), QString(),
+        tr("JSON Lines (*.jsonl *.jsonl.gz);;CSV (*.csv *.csv.gz);;SARIF (*.sarif *.sarif.gz)"));
+
+    ScanReportWriter::Format format = ScanReportWriter::Format::JsonLines;
+    bool compress = false;
+    if (!reportPath.isEmpty() && !ScanReportWriter::formatForPath(reportPath, &format, &compress)) {
+        reportPath += ".jsonl";
+    }
+
+    ScanReportWriter *writer = reportWriter;
+    FileScanner *fileScanner = scanner;
+    QMetaObject::invokeMethod(scanner, [writer, fileScanner, folder, reportPath, format, compress]() {
+        if (!reportPath.isEmpty())
+            writer->begin(reportPath, format, compress);
+        fileScanner->start(folder);
+    });
+
+    scanRunning = true;
+    scanButton->setText("Cancel scan");
+    scanStatusLabel->setText("Scanning " + folder + "...");
+}
+
+void SecurityTab::onScanProgress(quint64 filesScanned, quint64 detections)
+{
+    scanStatusLabel->setText(QString("%1 files scanned, %2 detections")
+                                 .arg(filesScanned).arg(detections));
+}
+
+void SecurityTab::onScanFinished()
+{
+    ScanReportWriter *writer = reportWriter;
+    QMetaObject::invokeMethod(reportWriter, [writer]() {
+        if (writer->isActive())
+            writer->finish();
+    });
+    scanRunning = false;
+    scanButton->setText("Scan folder...");
+}
+
+QPushButton* SecurityTab::createActionButton(const QString &text)
+{
+    QPushButton *button = new QPushButton(text, this);
+    button->setCursor(Qt::PointingHandCursor);
+    button->setFocusPolicy(Qt::NoFocus);
+    button->setStyleSheet(
+        "QPushButton {"
+        "   border: none;"
+        "   border-radius: 4px;"
+        "   background-color: #f8f8f8;"
+        "   padding: 6px 12px;"
+        "}"
+        "QPushButton:hover { background-color: #f0f0f0; }"
+        "QPushButton:pressed { background-color: #e8e8e8; }"
+        );
+    return button;
+}
+
+int SecurityTab::selectedRecord() const
+{
+    const QModelIndexList rows = quarantineView->selectionModel()->selectedRows();
+    if (rows.isEmpty())
+        return -1;
+    return quarantineModel->recordAt(rows.first().row());
+}
+
+void SecurityTab::setQuarantineBusy(const QString &activity)
+{
+    quarantineBusy = !activity.isEmpty();
+    addButton->setEnabled(!quarantineBusy);
+    restoreButton->setEnabled(!quarantineBusy);
+    removeButton->setEnabled(!quarantineBusy);
+    if (quarantineBusy)
+        summaryLabel->setText(activity);
+    else
+        updateSummary();
+}
+
+void SecurityTab::updateSummary()
+{
+    if (quarantineBusy)
+        return;
+    summaryLabel->setText(QString("%1 items, %2 unique samples, %3 stored")
+                              .arg(quarantineModel->rowCount())
+                              .arg(quarantine->uniqueSamples())
+                              .arg(QLocale().formattedDataSize(qint64(quarantine->packSize()))));
+}
+
+void SecurityTab::takeAlerts()
+{
+    const AlertBatch batch = alerts.take(QDateTime::currentMSecsSinceEpoch(), kAlertsPerTick);
+    if (batch.opened.isEmpty() && batch.updated.isEmpty() && batch.notifications.isEmpty())
+        return;
+    alertModel->addBatch(batch);
+
+    if (!batch.notifications.isEmpty()) {
+        QStringList lines;
+        for (const AlertNotification &notification : batch.notifications) {
+            lines.append(QString("<b>%1</b>  %2")
+                             .arg(QString::fromLatin1(alertSeverityName(notification.severity)).toUpper(),
+                                  notification.text.toHtmlEscaped()));
+        }
+        notificationLabel->setText(lines.join("<br>"));
+        notificationLabel->show();
+        QApplication::alert(window());
+    }
+
+    const AlertPipeline::Stats stats = alerts.stats();
+    alertSummaryLabel->setText(QString("%1 alerts in %2 groups  ·  %3 waiting, %4 shed")
+                                   .arg(QLocale().toString(qulonglong(stats.alerts)))
+                                   .arg(QLocale().toString(qulonglong(stats.groups)))
+                                   .arg(batch.waiting)
+                                   .arg(QLocale().toString(qulonglong(stats.shed + stats.preempted))));
+}
+
+void SecurityTab::onClearAlertsClicked()
+{
+    alertModel->clear();
+    notificationLabel->hide();
+}
+
+void SecurityTab::onQuarantineFileClicked()
+{
+    QString path = QFileDialog::getOpenFileName(this, tr("Quarantine File"));
+    if (path.isEmpty())
+        return;
+
+    // Hashing and compressing run in the background; only recording the
+    // sample, a few synced pages, comes back to this thread
+    setQuarantineBusy(QString("Quarantining %1...").arg(QFileInfo(path).fileName()));
+    QuarantineStore *store = quarantine;
+    TaskScheduler *scheduler = TaskScheduler::instance();
+    scheduler->run(scheduler->taskType("quarantine"), TaskScheduler::Background, this,
+                   [store, path]() { return store->prepare(path); },
+                   [this](const QuarantineStore::PreparedSample &sample) { onSamplePrepared(sample); },
+                   quarantineTasks);
+}
+
+void SecurityTab::onSamplePrepared(const QuarantineStore::PreparedSample &sample)
+{
+    setQuarantineBusy(QString());
+    if (quarantine->commit(sample) < 0) {
+        QMessageBox::warning(this, tr("Quarantine"), quarantine->errorString());
+    }
+}
+
+void SecurityTab::onRestoreClicked()
+{
+    int record = selectedRecord();
+    const QuarantineRecord *entry = quarantine->record(record);
+    if (!entry)
+        return;
+
+    QString target = QFileDialog::getSaveFileName(this, tr("Restore File"), quarantine->pathOf(*entry));
+    if (target.isEmpty())
+        return;
+
+    setQuarantineBusy(QString("Restoring %1...").arg(QFileInfo(target).fileName()));
+    QuarantineStore *store = quarantine;
+    const QuarantineRecord copy = *entry;
+    TaskScheduler *scheduler = TaskScheduler::instance();
+    scheduler->run(scheduler->taskType("quarantine"), TaskScheduler::Background, this,
+                   [store, copy, target]() {
+                       QString error;
+                       store->restoreCopy(copy, target, &error);
+                       return error;
+                   },
+                   [this, record](const QString &error) { onRestoreFinished(record, error); },
+                   quarantineTasks);
+}
+
+void SecurityTab::onRestoreFinished(int record, const QString &error)
+{
+    setQuarantineBusy(QString());
+    if (!error.isEmpty()) {
+        QMessageBox::warning(this, tr("Restore"), error);
+        return;
+    }
+    quarantine->markRestored(record);
+}
+
+void SecurityTab::onRemoveClicked()
+{
+    int record = selectedRecord();
+    if (record < 0)
+        return;
+    quarantine->removeRecord(record);
+}
@@ -0,0 +1,85 @@
+#ifndef SECURITYTAB_H
+#define SECURITYTAB_H
+
+#include <QWidget>
+#include <QLabel>
+#include <QPushButton>
+#include <QTableView>
+#include <QThread>
+#include <QTimer>
+#include "alertpipeline.h"
+#include "quarantinestore.h"
+#include "scanverdict.h"
+#include "taskscheduler.h"
+
+class AlertModel;
+class EventJournal;
+class FileScanner;
+class ParserWorkerPool;
+class MetricsBus;
+class QuarantineModel;
+class ScanReportWriter;
+
+// Content page for the Security tab: folder scans with report export,
+// the alerts they raise, and the quarantine list with its actions. Scans
+// count their files on `metrics` and write every result and alert to
+// `journal`.
+class SecurityTab : public QWidget
+{
+    Q_OBJECT
+
+public:
+    SecurityTab(QuarantineStore *quarantine, MetricsBus *metrics, EventJournal *journal, QWidget *parent = nullptr);
+    ~SecurityTab();
+
+private slots:
+    void onScanClicked();
+    void onScanProgress(quint64 filesScanned, quint64 detections);
+    void onScanFinished();
+    void onQuarantineFileClicked();
+    void onRestoreClicked();
+    void onRemoveClicked();
+    void onSamplePrepared(const QuarantineStore::PreparedSample &sample);
+    void onRestoreFinished(int record, const QString &error);
+    void updateSummary();
+    void takeAlerts();
+    void onClearAlertsClicked();
+
+private:
+    QPushButton* createActionButton(const QString &text);
+    int selectedRecord() const;
+    void setQuarantineBusy(const QString &activity);
+
+    QuarantineStore *quarantine;
+    QuarantineModel *quarantineModel;
+    QTableView *quarantineView;
+    QLabel *summaryLabel;
+    QPushButton *addButton;
+    QPushButton *restoreButton;
+    QPushButton *removeButton;
+    // Quarantining and restoring read, compress and write whole samples,
+    // so they run as Background tasks, one at a time
+    CancellationToken quarantineTasks = CancellationToken::create();
+    bool quarantineBusy = false;
+
+    // Scanning runs on its own thread: the pool does blocking reads and
+    // the report writer blocking writes
+    QThread scanThread;
+    ParserWorkerPool *scanPool;
+    FileScanner *scanner;
+    ScanReportWriter *reportWriter;
+    QPushButton *scanButton;
+    QLabel *scanStatusLabel;
+    bool scanRunning = false;
+
+    // Detections are submitted on the scan thread and taken on a timer,
+    // so a burst of them never reaches the GUI one by one
+    AlertPipeline alerts;
+    AlertModel *alertModel;
+    QTableView *alertView;
+    QLabel *alertSummaryLabel;
+    QLabel *notificationLabel;
+    QTimer alertTimer;
+};
+
+#endif // SECURITYTAB_H
@@ -0,0 +1,304 @@
+#include "servercatalog.h"
+#include <QStringList>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+const int kOneTypoLength = 6;
+const int kTwoTyposLength = 12;
+// Words whose matches are kept for the next queries
+const int kRecentWords = 16;
+
+quint32 trigramKey(uchar a, uchar b, uchar c)
+{
+    return quint32(a) << 16 | quint32(b) << 8 | c;
+}
+
+// Lowercased, with ASCII punctuation turned into spaces so that
+// "de-fra-01" and "10.0.0.1" split into words
+QByteArray normalized(const QString &text)
+{
+    QByteArray bytes = text.toLower().toUtf8();
+    for (char &c : bytes) {
+        const uchar byte = uchar(c);
+        if (byte < 0x80 && !((byte >= 'a' && byte <= 'z') || (byte >= '0' && byte <= '9')))
+            c = ' ';
+    }
+    return bytes;
+}
+
+int allowedEdits(int length)
+{
+    return length >= kTwoTyposLength ? 2 : length >= kOneTypoLength ? 1 : 0;
+}
+
+// Whether `word` occurs in `text` within `maxEdits` insertions, deletions
+// and substitutions (Sellers' algorithm: edit distance where the match may
+// start anywhere in the text). Only for words too long for Myers'.
+bool approximatelyContains(const char *text, int textLength, const QByteArray &word, int maxEdits)
+{
+    const int length = word.size();
+    std::vector<int> distance(size_t(length) + 1);
+    for (int i = 0; i <= length; ++i)
+        distance[i] = i;
+    for (int j = 0; j < textLength; ++j) {
+        int diagonal = 0;
+        for (int i = 1; i <= length; ++i) {
+            const int above = distance[i];
+            const int cost = word[i - 1] == text[j] ? 0 : 1;
+            distance[i] = std::min({ above + 1, distance[i - 1] + 1, diagonal + cost });
+            diagonal = above;
+        }
+        if (distance[length] <= maxEdits)
+            return true;
+    }
+    return false;
+}
+
+} // namespace
+
+void ServerCatalog::build(const QVector<VpnServer> &servers)
+{
+    texts.clear();
+    textOffsets.assign(1, 0);
+    std::vector<std::pair<quint32, quint32>> pairs;
+    for (int i = 0; i < servers.size(); ++i) {
+        const VpnServer &server = servers.at(i);
+        const QByteArray line = normalized(QStringList({ server.name, server.country, server.city, server.address }).join(' '));
+        texts.append(line);
+        textOffsets.push_back(quint32(texts.size()));
+
+        // Each word padded with two spaces in front, so its first one and
+        // two characters make trigrams of their own
+        const int start = int(pairs.size());
+        for (int at = 0; at < line.size();) {
+            while (at < line.size() && line[at] == ' ')
+                ++at;
+            int end = at;
+            while (end < line.size() && line[end] != ' ')
+                ++end;
+            uchar previous[2] = { ' ', ' ' };
+            for (int k = at; k < end; ++k) {
+                const uchar c = uchar(line[k]);
+                pairs.emplace_back(trigramKey(previous[0], previous[1], c), quint32(i));
+                previous[0] = previous[1];
+                previous[1] = c;
+            }
+            at = end;
+        }
+        // A server is listed once per trigram
+        std::sort(pairs.begin() + start, pairs.end());
+        pairs.erase(std::unique(pairs.begin() + start, pairs.end()), pairs.end());
+    }
+
+    std::sort(pairs.begin(), pairs.end());
+    trigrams.clear();
+    postingOffsets.clear();
+    postingList.resize(pairs.size());
+    for (size_t i = 0; i < pairs.size(); ++i) {
+        if (trigrams.empty() || trigrams.back() != pairs[i].first) {
+            trigrams.push_back(pairs[i].first);
+            postingOffsets.push_back(quint32(i));
+        }
+        postingList[i] = pairs[i].second;
+    }
+    postingOffsets.push_back(quint32(pairs.size()));
+
+    recentWords.clear();
+    counts.assign(size_t(servers.size()), 0);
+    touched.clear();
+}
+
+QByteArray ServerCatalog::text(int server) const
+{
+    return texts.mid(int(textOffsets[size_t(server)]), int(textOffsets[size_t(server) + 1] - textOffsets[size_t(server)]));
+}
+
+quint64 ServerCatalog::memoryBytes() const
+{
+    return quint64(texts.size()) + (textOffsets.size() + trigrams.size() + postingOffsets.size() + postingList.size()) * 4
+           + counts.size() * sizeof(quint16);
+}
+
+std::pair<const quint32 *, const quint32 *> ServerCatalog::postings(quint32 trigram) const
+{
+    const auto found = std::lower_bound(trigrams.begin(), trigrams.end(), trigram);
+    if (found == trigrams.end() || *found != trigram)
+        return { nullptr, nullptr };
+    const size_t slot = size_t(found - trigrams.begin());
+    return { postingList.data() + postingOffsets[slot], postingList.data() + postingOffsets[slot + 1] };
+}
+
+// Myers' bit-parallel edit distance: bit i of the vertical deltas stands
+// for row i of Sellers' column, and the last row's score is tracked
+bool ServerCatalog::verify(quint32 server, const Pattern &pattern) const
+{
+    const char *line = texts.constData() + textOffsets[server];
+    const int length = int(textOffsets[server + 1] - textOffsets[server]);
+    const QByteArray &word = pattern.text;
+    if (pattern.maxEdits == 0)
+        return std::search(line, line + length, word.constData(), word.constData() + word.size()) != line + length;
+    if (word.size() > 64)
+        return approximatelyContains(line, length, word, pattern.maxEdits);
+
+    const quint64 last = quint64(1) << (word.size() - 1);
+    quint64 plus = ~quint64(0);
+    quint64 minus = 0;
+    int score = word.size();
+    for (int j = 0; j < length; ++j) {
+        const quint64 equal = pattern.masks[uchar(line[j])];
+        const quint64 vertical = equal | minus;
+        const quint64 horizontal = (((equal & plus) + plus) ^ plus) | equal;
+        quint64 horizontalPlus = minus | ~(horizontal | plus);
+        quint64 horizontalMinus = plus & horizontal;
+        if (horizontalPlus & last)
+            ++score;
+        else if (horizontalMinus & last)
+            --score;
+        if (score <= pattern.maxEdits)
+            return true;
+        // The top row is all zeros, since a match may start anywhere
+        horizontalPlus <<= 1;
+        horizontalMinus <<= 1;
+        plus = horizontalMinus | ~(vertical | horizontalPlus);
+        minus = horizontalPlus & vertical;
+    }
+    return false;
+}
+
+int ServerCatalog::search(const QString &query, std::vector<char> *matches)
+{
+    const size_t count = size_t(size());
+    std::vector<QByteArray> queryWords;
+    for (const QByteArray &text : normalized(query).split(' ')) {
+        if (!text.isEmpty() && std::find(queryWords.begin(), queryWords.end(), text) == queryWords.end())
+            queryWords.push_back(text);
+    }
+    std::vector<const Word *> words;
+    for (const QByteArray &text : queryWords)
+        words.push_back(&findWord(text));
+    // The query's own words are the most recently used
+    while (recentWords.size() > qMax(size_t(kRecentWords), words.size()))
+        recentWords.pop_front();
+
+    if (words.empty()) {
+        matches->assign(count, 1);
+        return int(count);
+    }
+    // Start from the rarest word
+    const Word *rarest = words.front();
+    for (const Word *word : words) {
+        if (word->servers.size() < rarest->servers.size())
+            rarest = word;
+    }
+    matches->assign(count, 0);
+    int found = 0;
+    for (quint32 server : rarest->servers) {
+        bool all = true;
+        for (const Word *word : words)
+            all = all && word->matches[server];
+        (*matches)[server] = all ? 1 : 0;
+        found += all ? 1 : 0;
+    }
+    return found;
+}
+
+const ServerCatalog::Word &ServerCatalog::findWord(const QByteArray &text)
+{
+    for (auto word = recentWords.begin(); word != recentWords.end(); ++word) {
+        if (word->text == text) {
+            recentWords.splice(recentWords.end(), recentWords, word);
+            return recentWords.back();
+        }
+    }
+    Word word;
+    matchWord(text, &word);
+    recentWords.push_back(std::move(word));
+    return recentWords.back();
+}
+
+void ServerCatalog::matchWord(const QByteArray &text, Word *result)
+{
+    const size_t count = size_t(size());
+    result->text = text;
+    result->matches.assign(count, 0);
+    result->servers.clear();
+
+    // Short words are looked up as word starts, which the padded trigrams
+    // answer exactly
+    if (text.size() < 3) {
+        const quint32 key = text.size() == 1 ? trigramKey(' ', ' ', uchar(text[0]))
+                                             : trigramKey(' ', uchar(text[0]), uchar(text[1]));
+        const auto list = postings(key);
+        for (const quint32 *server = list.first; server != list.second; ++server) {
+            result->matches[*server] = 1;
+            result->servers.push_back(*server);
+        }
+        return;
+    }
+
+    Pattern pattern;
+    pattern.text = text;
+    pattern.maxEdits = allowedEdits(text.size());
+    memset(pattern.masks, 0, sizeof(pattern.masks));
+    for (int i = 0; i < qMin(int(text.size()), 64); ++i)
+        pattern.masks[uchar(text[i])] |= quint64(1) << i;
+
+    // The trigrams of each piece; pieces are at least 3 characters long
+    const int pieceCount = pattern.maxEdits + 1;
+    std::vector<std::vector<std::pair<const quint32 *, const quint32 *>>> pieces(static_cast<size_t>(pieceCount));
+    size_t postingCount = 0;
+    for (int piece = 0; piece < pieceCount; ++piece) {
+        const int begin = piece * text.size() / pieceCount;
+        const int end = (piece + 1) * text.size() / pieceCount;
+        std::vector<quint32> keys;
+        for (int i = begin; i + 2 < end; ++i)
+            keys.push_back(trigramKey(uchar(text[i]), uchar(text[i + 1]), uchar(text[i + 2])));
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        for (quint32 key : keys) {
+            pieces[size_t(piece)].push_back(postings(key));
+            postingCount += size_t(pieces[size_t(piece)].back().second - pieces[size_t(piece)].back().first);
+        }
+    }
+
+    // A word that grew matches a subset of what its prefix matched, as
+    // long as both are allowed as many typos
+    const Word *prefix = nullptr;
+    for (const Word &word : recentWords) {
+        if (word.text.size() >= 3 && text.startsWith(word.text) && allowedEdits(word.text.size()) == pattern.maxEdits
+            && (!prefix || word.text.size() > prefix->text.size()))
+            prefix = &word;
+    }
+    std::vector<quint32> candidates;
+    if (prefix && prefix->servers.size() <= postingCount) {
+        candidates = prefix->servers;
+    } else {
+        for (const auto &lists : pieces) {
+            for (const auto &list : lists) {
+                for (const quint32 *server = list.first; server != list.second; ++server) {
+                    if (counts[*server]++ == 0)
+                        touched.push_back(*server);
+                }
+            }
+            for (quint32 server : touched) {
+                if (counts[server] == lists.size() && !result->matches[server]) {
+                    result->matches[server] = 1;
+                    candidates.push_back(server);
+                }
+                counts[server] = 0;
+            }
+            touched.clear();
+        }
+        // Results go in server order
+        std::sort(candidates.begin(), candidates.end());
+    }
+
+    for (quint32 server : candidates) {
+        const bool match = verify(server, pattern);
+        result->matches[server] = match ? 1 : 0;
+        if (match)
+            result->servers.push_back(server);
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef SERVERCATALOG_H
+#define SERVERCATALOG_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+#include <list>
+#include <utility>
+#include <vector>
+#include "vpnprober.h"
+
+// Type-ahead search over a catalog of VPN servers. Each server's name,
+// country, city and address become one lowercased line of words, and
+// every trigram of every word, plus its first one and two characters
+// padded with spaces, goes into sorted posting lists.
+//
+// A server matches a query when it matches each of the query's words.
+// Words of one or two characters match the start of a word; longer ones
+// match anywhere, with one typo allowed from 6 characters and two from
+// 12. Split into one piece more than it has typos, a word keeps at least
+// one piece intact, so the candidates are the servers holding every
+// trigram of some piece; a bit-parallel edit distance scan of the line
+// (Myers' algorithm) confirms them.
+//
+// The matches of recent words are kept, so typing into the last word of
+// a query redoes only that word, a backspace finds the shorter word
+// still known, and a word that merely grew narrows the matches of its
+// prefix instead of going back to the index.
+class ServerCatalog
+{
+public:
+    void build(const QVector<VpnServer> &servers);
+    int size() const { return int(textOffsets.size()) - 1; }
+
+    // matches[i] becomes 1 where server i matches, 0 elsewhere; an empty
+    // query matches everything. Returns the number of matches.
+    int search(const QString &query, std::vector<char> *matches);
+
+    QByteArray text(int server) const;
+    quint64 memoryBytes() const;
+
+private:
+    struct Word
+    {
+        QByteArray text;
+        std::vector<char> matches;
+        std::vector<quint32> servers;
+    };
+
+    struct Pattern
+    {
+        QByteArray text;
+        int maxEdits = 0;
+        quint64 masks[256];           // Myers' match vectors, for words of up to 64 bytes
+    };
+
+    const Word &findWord(const QByteArray &text);
+    void matchWord(const QByteArray &text, Word *result);
+    bool verify(quint32 server, const Pattern &pattern) const;
+    std::pair<const quint32 *, const quint32 *> postings(quint32 trigram) const;
+
+    // Lines of all servers back to back
+    QByteArray texts;
+    std::vector<quint32> textOffsets;
+    // Trigrams in ascending order, each with its slice of postingList
+    std::vector<quint32> trigrams;
+    std::vector<quint32> postingOffsets;
+    std::vector<quint32> postingList;
+    // Least recently used first
+    std::list<Word> recentWords;
+    std::vector<quint16> counts;
+    std::vector<quint32> touched;
+};
+
+#endif // SERVERCATALOG_H
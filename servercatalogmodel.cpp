@@ -0,0 +1,247 @@
+#include "servercatalogmodel.h"
+
+namespace {
+
+// Beyond this many runs of rows to remove or insert, a reset is cheaper
+// for the view than replaying them
+const int kMaxRuns = 32;
+
+} // namespace
+
+ServerCatalogModel::ServerCatalogModel(VpnProber *prober, QObject *parent)
+    : QAbstractTableModel(parent), prober(prober)
+{
+    connect(prober, &VpnProber::latencyUpdated, this, &ServerCatalogModel::onLatencyUpdated);
+}
+
+int ServerCatalogModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : shownCount;
+}
+
+int ServerCatalogModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : ColumnCount;
+}
+
+QVariant ServerCatalogModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= shownCount)
+        return QVariant();
+
+    if (role == Qt::TextAlignmentRole && (index.column() == LoadColumn || index.column() == LatencyColumn))
+        return int(Qt::AlignRight | Qt::AlignVCenter);
+    const int server = serverAt(index.row());
+    const ServerLatency &latency = prober->latency(server);
+    if (role == Qt::ToolTipRole && index.column() == LatencyColumn && latency.cached)
+        return tr("When last probed");
+    if (role != Qt::DisplayRole)
+        return QVariant();
+
+    const VpnServer &entry = prober->servers().at(server);
+    switch (index.column()) {
+    case NameColumn:
+        return entry.name;
+    case CountryColumn:
+        return entry.country;
+    case CityColumn:
+        return entry.city;
+    case AddressColumn:
+        return entry.port == VpnServer().port ? entry.address : QString("%1 port %2").arg(entry.address).arg(entry.port);
+    case LoadColumn:
+        return entry.load < 0 ? QString() : QString("%1%").arg(entry.load);
+    case LatencyColumn:
+        if (!latency.measured())
+            return tr("no reply yet");
+        return QString("%1 ms ± %2%3")
+            .arg(latency.rttMs, 0, 'f', 1)
+            .arg(latency.jitterMs, 0, 'f', 1)
+            .arg(latency.loss >= 0.005 ? QString(", %1% loss").arg(qRound(latency.loss * 100)) : QString());
+    default:
+        return QVariant();
+    }
+}
+
+QVariant ServerCatalogModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation != Qt::Horizontal || role != Qt::DisplayRole)
+        return QVariant();
+
+    switch (section) {
+    case NameColumn: return tr("Server");
+    case CountryColumn: return tr("Country");
+    case CityColumn: return tr("City");
+    case AddressColumn: return tr("Address");
+    case LoadColumn: return tr("Load");
+    case LatencyColumn: return tr("Latency");
+    default: return QVariant();
+    }
+}
+
+void ServerCatalogModel::reload()
+{
+    beginResetModel();
+    serverCatalog.build(prober->servers());
+    serverCatalog.search(filterText, &matches);
+    const std::vector<int> &ranking = prober->ranking();
+    shownRanks.resize(ranking.size());
+    for (size_t rank = 0; rank < ranking.size(); ++rank)
+        shownRanks[rank] = matches[size_t(ranking[rank])];
+    rebuildTree();
+    endResetModel();
+}
+
+void ServerCatalogModel::setFilter(const QString &text)
+{
+    if (text == filterText)
+        return;
+    filterText = text;
+    serverCatalog.search(filterText, &matches);
+    applyMatches();
+}
+
+int ServerCatalogModel::serverAt(int row) const
+{
+    return prober->ranking()[size_t(rankAt(row))];
+}
+
+// Walks the ranks once, gathering the runs of rows that appear or
+// disappear; ranks neither shown before nor now do not break a run
+void ServerCatalogModel::applyMatches()
+{
+    struct Run
+    {
+        bool insert;
+        int firstRank;
+        int lastRank;
+        int rows;
+    };
+
+    const std::vector<int> &ranking = prober->ranking();
+    std::vector<Run> runs;
+    bool open = false;
+    for (int rank = 0; rank < int(ranking.size()); ++rank) {
+        const bool was = shownRanks[size_t(rank)];
+        const bool now = matches[size_t(ranking[size_t(rank)])];
+        if (was == now) {
+            open = open && !was;
+            continue;
+        }
+        if (open && runs.back().insert == now) {
+            runs.back().lastRank = rank;
+            ++runs.back().rows;
+            continue;
+        }
+        if (int(runs.size()) == kMaxRuns) {
+            beginResetModel();
+            for (size_t i = 0; i < ranking.size(); ++i)
+                shownRanks[i] = matches[size_t(ranking[i])];
+            rebuildTree();
+            endResetModel();
+            return;
+        }
+        runs.push_back({ now, rank, rank, 1 });
+        open = true;
+    }
+
+    // Runs in rank order: those before have already moved the rows
+    for (const Run &run : runs) {
+        const int first = rowsBefore(run.firstRank);
+        if (run.insert)
+            beginInsertRows(QModelIndex(), first, first + run.rows - 1);
+        else
+            beginRemoveRows(QModelIndex(), first, first + run.rows - 1);
+        for (int rank = run.firstRank; rank <= run.lastRank; ++rank)
+            setShown(rank, matches[size_t(ranking[size_t(rank)])]);
+        if (run.insert)
+            endInsertRows();
+        else
+            endRemoveRows();
+    }
+}
+
+// The prober has moved server from one rank to the other and everything
+// between up or down a rank; their flags follow
+void ServerCatalogModel::onLatencyUpdated(int server, int fromRank, int toRank)
+{
+    if (shownRanks.size() != prober->ranking().size())
+        return;
+
+    const bool shown = matches[size_t(server)];
+    if (fromRank == toRank) {
+        if (shown) {
+            const int row = rowsBefore(fromRank);
+            emit dataChanged(this->index(row, LatencyColumn), this->index(row, LatencyColumn));
+        }
+        return;
+    }
+
+    const int fromRow = rowsBefore(fromRank);
+    const int toRow = toRank > fromRank ? fromRow + rowsBefore(toRank + 1) - rowsBefore(fromRank + 1)
+                                        : rowsBefore(toRank);
+    const bool moved = shown && fromRow != toRow;
+    if (moved)
+        beginMoveRows(QModelIndex(), fromRow, fromRow, QModelIndex(), toRow > fromRow ? toRow + 1 : toRow);
+    if (toRank > fromRank) {
+        for (int rank = fromRank; rank < toRank; ++rank)
+            setShown(rank, shownRanks[size_t(rank) + 1]);
+    } else {
+        for (int rank = fromRank; rank > toRank; --rank)
+            setShown(rank, shownRanks[size_t(rank) - 1]);
+    }
+    setShown(toRank, shown);
+    if (moved)
+        endMoveRows();
+    if (shown)
+        emit dataChanged(this->index(toRow, LatencyColumn), this->index(toRow, LatencyColumn));
+}
+
+void ServerCatalogModel::rebuildTree()
+{
+    const int size = int(shownRanks.size());
+    tree.assign(size_t(size) + 1, 0);
+    shownCount = 0;
+    for (int i = 1; i <= size; ++i) {
+        tree[size_t(i)] += shownRanks[size_t(i) - 1];
+        shownCount += shownRanks[size_t(i) - 1];
+        const int parent = i + (i & -i);
+        if (parent <= size)
+            tree[size_t(parent)] += tree[size_t(i)];
+    }
+    treeStep = 1;
+    while (treeStep * 2 <= size)
+        treeStep *= 2;
+}
+
+void ServerCatalogModel::setShown(int rank, bool shown)
+{
+    if (bool(shownRanks[size_t(rank)]) == shown)
+        return;
+    shownRanks[size_t(rank)] = shown;
+    const int delta = shown ? 1 : -1;
+    shownCount += delta;
+    for (int i = rank + 1; i < int(tree.size()); i += i & -i)
+        tree[size_t(i)] += delta;
+}
+
+int ServerCatalogModel::rowsBefore(int rank) const
+{
+    int rows = 0;
+    for (int i = rank; i > 0; i -= i & -i)
+        rows += tree[size_t(i)];
+    return rows;
+}
+
+// Descends the tree for the rank holding the row's flag
+int ServerCatalogModel::rankAt(int row) const
+{
+    int rank = 0;
+    int remaining = row + 1;
+    for (int step = treeStep; step > 0; step /= 2) {
+        if (rank + step < int(tree.size()) && tree[size_t(rank + step)] < remaining) {
+            rank += step;
+            remaining -= tree[size_t(rank)];
+        }
+    }
+    return rank;
+}
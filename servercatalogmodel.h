@@ -0,0 +1,70 @@
+#ifndef SERVERCATALOGMODEL_H
+#define SERVERCATALOGMODEL_H
+
+#include <QAbstractTableModel>
+#include <QString>
+#include <vector>
+#include "servercatalog.h"
+#include "vpnprober.h"
+
+// The prober's servers that match a search, in the prober's ranking,
+// fastest first. Rows are never stored: a Fenwick tree over ranks counts
+// the matching ones, so the row of a rank and the rank of a row are both
+// O(log n), and a view with fixed row heights only ever asks for the
+// rows on screen.
+//
+// A probe result that moves a server a few ranks flips the flags between
+// them and becomes a single row move, or nothing at all when the server
+// is filtered out. A new search removes and inserts the runs of rows
+// that changed, and resets the model only when there are too many runs.
+class ServerCatalogModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+    enum Column {
+        NameColumn = 0,
+        CountryColumn,
+        CityColumn,
+        AddressColumn,
+        LoadColumn,
+        LatencyColumn,
+        ColumnCount
+    };
+
+    explicit ServerCatalogModel(VpnProber *prober, QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+    // Indexes the prober's servers anew, after VpnProber::setServers()
+    void reload();
+    void setFilter(const QString &text);
+    QString filter() const { return filterText; }
+    int serverAt(int row) const;
+    const ServerCatalog &catalog() const { return serverCatalog; }
+
+private slots:
+    void onLatencyUpdated(int server, int fromRank, int toRank);
+
+private:
+    void applyMatches();
+    void rebuildTree();
+    void setShown(int rank, bool shown);
+    // Matching servers ranked before rank
+    int rowsBefore(int rank) const;
+    int rankAt(int row) const;
+
+    VpnProber *prober;
+    ServerCatalog serverCatalog;
+    QString filterText;
+    std::vector<char> matches;        // By server
+    std::vector<char> shownRanks;     // By rank
+    std::vector<int> tree;            // Fenwick tree over shownRanks
+    int treeStep = 0;                 // Highest power of two within the tree
+    int shownCount = 0;
+};
+
+#endif // SERVERCATALOGMODEL_H
@@ -0,0 +1,279 @@
+#include "statustab.h"
+#include "daemonclient.h"
+#include "eventjournal.h"
+#include "eventlogmodel.h"
+#include "metricsbus.h"
+#include "metricsmodel.h"
+#include <QHBoxLayout>
+#include <QHeaderView>
+#include <QLocale>
+#include <QScrollBar>
+#include <QSettings>
+#include <QVBoxLayout>
+
+namespace {
+
+const int kDefaultHz = 30;
+// Samples taken off the rings per drain; more wait for the next one
+const int kSampleBudget = 2048;
+// Daemon results moved into the journal per drain
+const int kDaemonEventBudget = 4096;
+const qint64 kLabelIntervalNs = 500000000;
+const int kLogIntervalMs = 250;
+// Typing pauses this long before the search starts over
+const int kSearchDelayMs = 200;
+
+} // namespace
+
+StatusTab::StatusTab(MetricsBus *bus, EventJournal *journal, DaemonClient *daemon, QWidget *parent)
+    : QWidget(parent), bus(bus), journal(journal), search(journal), daemon(daemon)
+{
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->setContentsMargins(0, 10, 0, 0);
+    layout->setSpacing(10);
+
+    QSettings settings("Rhynec", "RhynecSecurity");
+
+    // Header row: section title and refresh rate
+    QHBoxLayout *headerLayout = new QHBoxLayout();
+    QLabel *sectionLabel = new QLabel("Engine metrics", this);
+    QFont sectionFont = sectionLabel->font();
+    sectionFont.setWeight(QFont::DemiBold);
+    sectionFont.setPixelSize(18);
+    sectionLabel->setFont(sectionFont);
+    refreshSpin = new QSpinBox(this);
+    refreshSpin->setRange(1, 120);
+    refreshSpin->setSuffix(" Hz");
+    refreshSpin->setValue(settings.value("Status/RefreshHz", kDefaultHz).toInt());
+    headerLayout->addWidget(sectionLabel);
+    headerLayout->addStretch(1);
+    headerLayout->addWidget(new QLabel("Refresh", this));
+    headerLayout->addWidget(refreshSpin);
+    layout->addLayout(headerLayout);
+
+    model = new MetricsModel(this);
+    view = new QTableView(this);
+    view->setModel(model);
+    view->setSelectionBehavior(QAbstractItemView::SelectRows);
+    view->setShowGrid(false);
+    view->setAlternatingRowColors(true);
+    view->verticalHeader()->hide();
+    view->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+    view->verticalHeader()->setDefaultSectionSize(24);
+    view->horizontalHeader()->setStretchLastSection(true);
+    view->setColumnWidth(MetricsModel::MetricColumn, 200);
+    view->setColumnWidth(MetricsModel::ValueColumn, 140);
+    view->setColumnWidth(MetricsModel::RateColumn, 140);
+    view->setStyleSheet(
+        "QTableView { border: 1px solid #e0e0e0; border-radius: 4px; background-color: white; }"
+        "QHeaderView::section { background-color: #f8f8f8; border: none; padding: 6px; }"
+        );
+    layout->addWidget(view, 1);
+
+    // Backpressure: what the engines wrote faster than the page drains
+    busLabel = new QLabel("No engine has reported yet", this);
+    busLabel->setStyleSheet("color: #777777;");
+    layout->addWidget(busLabel);
+
+    // Backend: the privileged daemon, when one runs
+    QHBoxLayout *daemonLayout = new QHBoxLayout();
+    daemonLabel = new QLabel(this);
+    daemonLabel->setStyleSheet("color: #777777;");
+    daemonButton = new QPushButton(this);
+    daemonLayout->addWidget(daemonLabel, 1);
+    daemonLayout->addWidget(daemonButton);
+    layout->addLayout(daemonLayout);
+    connect(daemonButton, &QPushButton::clicked, this, &StatusTab::toggleDaemon);
+    connect(daemon, &DaemonClient::detached, this, &StatusTab::updateDaemonRow);
+    updateDaemonRow();
+
+    // Event log: every event the journal keeps, or the hits of a search
+    QHBoxLayout *logHeaderLayout = new QHBoxLayout();
+    QLabel *logSectionLabel = new QLabel("Event log", this);
+    logSectionLabel->setFont(sectionFont);
+    searchEdit = new QLineEdit(this);
+    searchEdit->setPlaceholderText("Search the log");
+    searchEdit->setClearButtonEnabled(true);
+    searchEdit->setMaximumWidth(320);
+    logHeaderLayout->addWidget(logSectionLabel);
+    logHeaderLayout->addStretch(1);
+    logHeaderLayout->addWidget(searchEdit);
+    layout->addLayout(logHeaderLayout);
+
+    // Fixed row heights let the view place any row without measuring the
+    // ones above it, so scrolling costs the same at any log size
+    logModel = new EventLogModel(journal, this);
+    logView = new QTableView(this);
+    logView->setModel(logModel);
+    logView->setSelectionBehavior(QAbstractItemView::SelectRows);
+    logView->setShowGrid(false);
+    logView->setAlternatingRowColors(true);
+    logView->setWordWrap(false);
+    logView->verticalHeader()->hide();
+    logView->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+    logView->verticalHeader()->setDefaultSectionSize(24);
+    logView->horizontalHeader()->setSectionResizeMode(QHeaderView::Interactive);
+    logView->horizontalHeader()->setStretchLastSection(true);
+    logView->setColumnWidth(EventLogModel::TimeColumn, 190);
+    logView->setColumnWidth(EventLogModel::TypeColumn, 150);
+    logView->setStyleSheet(view->styleSheet());
+    layout->addWidget(logView, 2);
+
+    logLabel = new QLabel(this);
+    logLabel->setStyleSheet("color: #777777;");
+    layout->addWidget(logLabel);
+
+    connect(&logTimer, &QTimer::timeout, this, &StatusTab::refreshLog);
+    logTimer.start(kLogIntervalMs);
+    searchDelay.setSingleShot(true);
+    connect(&searchDelay, &QTimer::timeout, this, &StatusTab::startSearch);
+    connect(searchEdit, &QLineEdit::textChanged, &searchDelay, [this]() { searchDelay.start(kSearchDelayMs); });
+    connect(&search, &EventSearch::hitsFound, this, &StatusTab::onHitsFound);
+    connect(&search, &EventSearch::searchFinished, this, &StatusTab::onSearchFinished);
+    search.start(QThread::LowPriority);
+    logView->scrollToBottom();
+    updateLogLabel();
+
+    clock.start();
+    drainTimer.setTimerType(Qt::PreciseTimer);
+    connect(&drainTimer, &QTimer::timeout, this, &StatusTab::drain);
+    connect(refreshSpin, &QSpinBox::valueChanged, this, &StatusTab::onRefreshRateChanged);
+    onRefreshRateChanged(refreshSpin->value());
+}
+
+void StatusTab::onRefreshRateChanged(int hz)
+{
+    QSettings settings("Rhynec", "RhynecSecurity");
+    settings.setValue("Status/RefreshHz", hz);
+    drainTimer.start(qMax(1, 1000 / qMax(1, hz)));
+}
+
+void StatusTab::drain()
+{
+    const qint64 startNs = clock.nsecsElapsed();
+    MetricsSnapshot snapshot = bus->drain(startNs, kSampleBudget);
+    // The daemon's results are journaled whether or not the page shows,
+    // so its ring keeps room for more
+    if (daemon->isAttached())
+        daemonEvents += quint64(daemon->takeEvents(journal, kDaemonEventBudget));
+    if (!isVisible())
+        return;
+    if (daemon->isAttached())
+        daemon->ring()->readMetrics(&snapshot, "daemon/");
+    model->update(snapshot);
+    drainNs.record(quint64(clock.nsecsElapsed() - startNs));
+
+    if (startNs - labelUpdatedNs < kLabelIntervalNs)
+        return;
+    labelUpdatedNs = startNs;
+    busLabel->setText(QString("%1 engine threads  ·  %2 samples per refresh, %3 waiting  ·  %4 dropped, %5 gauge "
+                              "updates merged  ·  refresh p99 %6 µs")
+                          .arg(snapshot.producers)
+                          .arg(snapshot.samplesDrained)
+                          .arg(snapshot.samplesPending)
+                          .arg(QLocale().toString(qulonglong(snapshot.samplesDropped)))
+                          .arg(QLocale().toString(qulonglong(snapshot.gaugesMerged)))
+                          .arg(drainNs.percentile(99) / 1000.0, 0, 'f', 1));
+    drainNs.reset();
+    updateDaemonRow();
+}
+
+void StatusTab::refreshLog()
+{
+    if (!isVisible())
+        return;
+    // Follow new events only when already at the end, like a terminal
+    QScrollBar *scrollBar = logView->verticalScrollBar();
+    const bool atEnd = scrollBar->value() == scrollBar->maximum();
+    logModel->refresh();
+    if (atEnd && !logModel->showingHits())
+        logView->scrollToBottom();
+    updateLogLabel();
+}
+
+void StatusTab::startSearch()
+{
+    const QString text = searchEdit->text().trimmed();
+    if (text.isEmpty()) {
+        search.cancel();
+        searchId = 0;
+        logModel->showLog();
+        logView->scrollToBottom();
+    } else {
+        searchId = search.search(text, EventLogModel::kMaxHits);
+        searchDone = false;
+        logModel->showHits();
+    }
+    updateLogLabel();
+}
+
+void StatusTab::onHitsFound(quint64 id, const QVector<EventSearchHit> &hits)
+{
+    // Batches of a search typed over may still be queued
+    if (id != searchId)
+        return;
+    logModel->addHits(hits);
+    updateLogLabel();
+}
+
+void StatusTab::onSearchFinished(quint64 id, quint64 pagesRead, quint64 pagesSkipped)
+{
+    if (id != searchId)
+        return;
+    searchDone = true;
+    searchPagesRead = pagesRead;
+    searchPagesSkipped = pagesSkipped;
+    updateLogLabel();
+}
+
+void StatusTab::updateLogLabel()
+{
+    const quint64 events = logModel->events();
+    const quint64 indexed = qMin(search.indexedEvents(), events);
+    QString text = QString("%1 events").arg(QLocale().toString(qulonglong(events)));
+    if (events > 0 && indexed < events)
+        text += QString(", %1% indexed for search").arg(indexed * 100 / events);
+    if (logModel->showingHits()) {
+        const int hits = logModel->rowCount();
+        if (!searchDone) {
+            text += QString("  ·  searching, %1 matches so far").arg(QLocale().toString(hits));
+        } else {
+            const quint64 pages = searchPagesRead + searchPagesSkipped;
+            text += QString("  ·  %1%2 matches, newest first  ·  %3 of %4 pages skipped by the index")
+                        .arg(hits >= EventLogModel::kMaxHits ? "first " : "")
+                        .arg(QLocale().toString(hits))
+                        .arg(QLocale().toString(qulonglong(searchPagesSkipped)))
+                        .arg(QLocale().toString(qulonglong(pages)));
+        }
+    }
+    logLabel->setText(text);
+}
+
+void StatusTab::toggleDaemon()
+{
+    if (daemon->isAttached()) {
+        daemon->detach();
+    } else {
+        daemon->attach();
+        daemonEvents = 0;
+    }
+    updateDaemonRow();
+}
+
+void StatusTab::updateDaemonRow()
+{
+    if (!daemon->isAttached()) {
+        const QString reason = daemon->errorString();
+        daemonLabel->setText(reason.isEmpty() ? QString("Daemon: not attached")
+                                              : QString("Daemon: not attached  ·  %1").arg(reason));
+        daemonButton->setText("Attach");
+        return;
+    }
+    const DaemonRing *ring = daemon->ring();
+    daemonLabel->setText(QString("Daemon: attached to pid %1  ·  %2 results taken, %3 KB waiting  ·  %4 dropped")
+                             .arg(daemon->daemonPid())
+                             .arg(QLocale().toString(qulonglong(daemonEvents)))
+                             .arg(QLocale().toString(qulonglong(ring->pendingBytes() / 1024)))
+                             .arg(QLocale().toString(qulonglong(ring->droppedRecords()))));
+    daemonButton->setText("Detach");
+}
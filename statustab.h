@@ -0,0 +1,82 @@
+#ifndef STATUSTAB_H
+#define STATUSTAB_H
+
+#include <QWidget>
+#include <QElapsedTimer>
+#include <QLabel>
+#include <QLineEdit>
+#include <QPushButton>
+#include <QSpinBox>
+#include <QTableView>
+#include <QTimer>
+#include "eventsearch.h"
+#include "latencyhistogram.h"
+
+class DaemonClient;
+class EventJournal;
+class EventLogModel;
+class MetricsBus;
+class MetricsModel;
+
+// Content page for the Status tab: live metrics from every engine and
+// the event log. The engines write to `bus` from their own threads and
+// this page drains it on a timer at the chosen refresh rate, so the GUI
+// thread does the same work per refresh however busy the engines are.
+// The drain goes on while the page is hidden, to keep the rings from
+// filling up, but the table is only updated while it shows.
+//
+// The log reads `journal` only for the rows on screen, and searches it
+// on a thread of its own, showing hits as they come.
+//
+// While `daemon` is attached, the same drain reads its metrics and moves
+// its results into the journal, both straight from shared memory.
+class StatusTab : public QWidget
+{
+    Q_OBJECT
+
+public:
+    StatusTab(MetricsBus *bus, EventJournal *journal, DaemonClient *daemon, QWidget *parent = nullptr);
+
+private slots:
+    void onRefreshRateChanged(int hz);
+    void drain();
+    void refreshLog();
+    void startSearch();
+    void onHitsFound(quint64 id, const QVector<EventSearchHit> &hits);
+    void onSearchFinished(quint64 id, quint64 pagesRead, quint64 pagesSkipped);
+    void toggleDaemon();
+
+private:
+    void updateLogLabel();
+    void updateDaemonRow();
+
+    MetricsBus *bus;
+    MetricsModel *model;
+    QTableView *view;
+    QSpinBox *refreshSpin;
+    QLabel *busLabel;
+    QTimer drainTimer;
+    QElapsedTimer clock;
+    LatencyHistogram drainNs;     // Since the label was last updated
+    qint64 labelUpdatedNs = 0;
+
+    EventJournal *journal;
+    EventLogModel *logModel;
+    QTableView *logView;
+    QLineEdit *searchEdit;
+    QLabel *logLabel;
+    QTimer logTimer;
+    QTimer searchDelay;           // Restarted by each keystroke
+    EventSearch search;
+    quint64 searchId = 0;
+    bool searchDone = false;
+    quint64 searchPagesRead = 0;
+    quint64 searchPagesSkipped = 0;
+
+    DaemonClient *daemon;
+    QLabel *daemonLabel;
+    QPushButton *daemonButton;
+    quint64 daemonEvents = 0;     // Taken since attaching
+};
+
+#endif // STATUSTAB_H
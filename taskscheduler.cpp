@@ -0,0 +1,524 @@
+#include "taskscheduler.h"
+#include "metricsbus.h"
+#include <QDir>
+#include <QFile>
+#include <QMutexLocker>
+#include <QStringList>
+#include <algorithm>
+#include <utility>
+
+#ifdef Q_OS_LINUX
+#include <sched.h>
+#endif
+
+namespace {
+
+const qint64 kInitialDequeCapacity = 256;
+
+const char *const kLaneNames[] = { "interactive", "normal", "background" };
+
+#ifdef Q_OS_LINUX
+// A sysfs CPU list: "0-3,8-11"
+std::vector<int> parseCpuList(const QByteArray &list)
+{
+    std::vector<int> cpus;
+    for (const QByteArray &range : list.trimmed().split(',')) {
+        const QList<QByteArray> ends = range.split('-');
+        bool firstOk = false;
+        bool lastOk = true;
+        const int first = ends[0].toInt(&firstOk);
+        const int last = ends.size() == 2 ? ends[1].toInt(&lastOk) : first;
+        if (!firstOk || !lastOk || ends.size() > 2)
+            continue;
+        for (int cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+#endif
+
+} // namespace
+
+CancellationToken CancellationToken::create()
+{
+    CancellationToken token;
+    token.state = std::make_shared<State>();
+    return token;
+}
+
+void CancellationToken::cancel()
+{
+    if (state)
+        state->cancelled.store(true, std::memory_order_release);
+}
+
+struct TaskScheduler::Task
+{
+    std::function<void()> work;
+    CancellationToken token;
+    qint64 postedNs = 0;
+    int type = 0;
+    int lane = Normal;
+};
+
+// Chase-Lev work-stealing deque, in the C11 formulation of Lê et al.: the
+// owner pushes and takes at the bottom without a lock, thieves take from
+// the top with one compare-and-swap, and the two only race for the last
+// task. The array doubles when full; the old one is kept, since a thief
+// may still be reading it, until the deque goes.
+class TaskScheduler::TaskDeque
+{
+public:
+    TaskDeque() : array(new Array(kInitialDequeCapacity)) {}
+    ~TaskDeque() { delete array.load(std::memory_order_relaxed); }
+
+    // Owner only
+    void push(Task *task)
+    {
+        const qint64 b = bottom.load(std::memory_order_relaxed);
+        const qint64 t = top.load(std::memory_order_acquire);
+        Array *a = array.load(std::memory_order_relaxed);
+        if (b - t > a->mask)
+            a = grow(a, t, b);
+        a->put(b, task);
+        bottom.store(b + 1, std::memory_order_release);
+    }
+
+    // Owner only; the newest task
+    Task *take()
+    {
+        const qint64 b = bottom.load(std::memory_order_relaxed) - 1;
+        Array *a = array.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        qint64 t = top.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        Task *task = a->get(b);
+        if (t == b) {
+            // The last one, which a thief may be taking as well
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                task = nullptr;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return task;
+    }
+
+    // Any thread; the oldest task, or nullptr when empty or when another
+    // thread got there first
+    Task *steal()
+    {
+        qint64 t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const qint64 b = bottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return nullptr;
+        Array *a = array.load(std::memory_order_acquire);
+        Task *task = a->get(t);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return nullptr;
+        return task;
+    }
+
+    bool isEmpty() const
+    {
+        return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Array
+    {
+        explicit Array(qint64 capacity)
+            : mask(capacity - 1), cells(new std::atomic<Task *>[size_t(capacity)])
+        {
+        }
+
+        Task *get(qint64 index) const { return cells[index & mask].load(std::memory_order_relaxed); }
+        void put(qint64 index, Task *task) { cells[index & mask].store(task, std::memory_order_relaxed); }
+
+        const qint64 mask;
+        std::unique_ptr<std::atomic<Task *>[]> cells;
+    };
+
+    Array *grow(Array *old, qint64 t, qint64 b)
+    {
+        Array *bigger = new Array((old->mask + 1) * 2);
+        for (qint64 i = t; i < b; ++i)
+            bigger->put(i, old->get(i));
+        retired.emplace_back(old);
+        array.store(bigger, std::memory_order_release);
+        return bigger;
+    }
+
+    alignas(64) std::atomic<qint64> top { 0 };
+    alignas(64) std::atomic<qint64> bottom { 0 };
+    std::atomic<Array *> array;
+    std::vector<std::unique_ptr<Array>> retired;
+};
+
+struct TaskScheduler::Worker
+{
+    TaskScheduler *scheduler = nullptr;
+    int index = 0;
+    int cpu = -1;                      // Pinned to, or -1
+    int node = 0;
+    TaskDeque deques[PriorityCount];
+    std::vector<int> victims;          // Same node first
+    std::shared_ptr<MetricsProducer> metrics;
+    // Written by the worker only
+    std::atomic<quint64> run { 0 };
+    std::atomic<quint64> stolen { 0 };
+    std::atomic<quint64> cancelled { 0 };
+};
+
+thread_local TaskScheduler::Worker *TaskScheduler::currentWorker = nullptr;
+
+TaskScheduler::TaskScheduler()
+{
+    start(Options());
+}
+
+TaskScheduler::TaskScheduler(const Options &options)
+{
+    start(options);
+}
+
+TaskScheduler::~TaskScheduler()
+{
+    stopping.store(true, std::memory_order_release);
+    {
+        QMutexLocker lock(&idleMutex);
+        wake.wakeAll();
+    }
+    for (std::unique_ptr<QThread> &thread : threads)
+        thread->wait();
+
+    // Dropped unrun, but counted as finished so no wait() is left hanging
+    for (std::unique_ptr<Worker> &worker : workers) {
+        for (TaskDeque &deque : worker->deques) {
+            while (Task *task = deque.take())
+                finishTask(task);
+        }
+    }
+    for (int lane = 0; lane < PriorityCount; ++lane) {
+        while (Task *task = takeInjected(lane))
+            finishTask(task);
+    }
+}
+
+TaskScheduler *TaskScheduler::instance()
+{
+    static TaskScheduler scheduler;
+    return &scheduler;
+}
+
+void TaskScheduler::start(const Options &options)
+{
+    clock.start();
+    for (std::atomic<int> &metric : waitMetrics)
+        metric.store(-1, std::memory_order_relaxed);
+
+    // (node, cpu) for every CPU the process may run on
+    std::vector<std::pair<int, int>> cpus;
+#ifdef Q_OS_LINUX
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        std::vector<int> nodeOf(CPU_SETSIZE, 0);
+        const QDir nodes("/sys/devices/system/node");
+        for (const QString &entry : nodes.entryList({ "node*" }, QDir::Dirs)) {
+            bool ok = false;
+            const int node = entry.mid(4).toInt(&ok);
+            QFile list(nodes.filePath(entry + "/cpulist"));
+            if (!ok || !list.open(QIODevice::ReadOnly))
+                continue;
+            for (int cpu : parseCpuList(list.readAll())) {
+                if (cpu >= 0 && cpu < CPU_SETSIZE)
+                    nodeOf[size_t(cpu)] = node;
+            }
+        }
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &allowed))
+                cpus.emplace_back(nodeOf[size_t(cpu)], cpu);
+        }
+    }
+#endif
+    if (cpus.empty()) {
+        for (int cpu = 0; cpu < qMax(1, QThread::idealThreadCount()); ++cpu)
+            cpus.emplace_back(0, cpu);
+    }
+    std::sort(cpus.begin(), cpus.end());
+
+    const int count = options.workers > 0 ? options.workers : int(cpus.size());
+    for (int i = 0; i < count; ++i) {
+        std::unique_ptr<Worker> worker(new Worker);
+        worker->scheduler = this;
+        worker->index = i;
+        if (options.pinWorkers) {
+            worker->node = cpus[size_t(i) % cpus.size()].first;
+            worker->cpu = cpus[size_t(i) % cpus.size()].second;
+        }
+        workers.push_back(std::move(worker));
+    }
+    // Each worker looks at the others starting from its neighbour, so
+    // thieves spread out rather than all trying worker 0 first
+    for (int i = 0; i < count; ++i) {
+        std::vector<int> &victims = workers[size_t(i)]->victims;
+        for (int pass = 0; pass < 2; ++pass) {
+            for (int step = 1; step < count; ++step) {
+                const int victim = (i + step) % count;
+                const bool sameNode = workers[size_t(victim)]->node == workers[size_t(i)]->node;
+                if (sameNode == (pass == 0))
+                    victims.push_back(victim);
+            }
+        }
+    }
+
+    for (std::unique_ptr<Worker> &worker : workers) {
+        Worker *self = worker.get();
+        std::unique_ptr<QThread> thread(QThread::create([this, self]() { workerLoop(self); }));
+        thread->setObjectName(QString("Task worker %1").arg(self->index));
+        thread->start();
+        threads.push_back(std::move(thread));
+    }
+}
+
+int TaskScheduler::taskType(const QString &name)
+{
+    QMutexLocker lock(&typesMutex);
+    for (int i = 0; i < typeCount; ++i) {
+        if (types[i].name == name)
+            return i;
+    }
+    if (typeCount == kMaxTaskTypes)
+        return kMaxTaskTypes - 1;
+    types[typeCount].name = name;
+    if (MetricsBus *bus = metricsBus.load(std::memory_order_relaxed))
+        registerMetrics(bus, typeCount);
+    return typeCount++;
+}
+
+void TaskScheduler::setMetricsBus(MetricsBus *bus)
+{
+    QMutexLocker lock(&typesMutex);
+    if (!bus) {
+        // Workers keep the producers they attached, which outlive the bus
+        metricsBus.store(nullptr, std::memory_order_release);
+        return;
+    }
+    if (metricsBus.load(std::memory_order_relaxed))
+        return;
+    for (int lane = 0; lane < PriorityCount; ++lane) {
+        waitMetrics[lane].store(bus->metric(QString("tasks.wait.%1").arg(kLaneNames[lane]), MetricsBus::Sample, "ns"),
+                                std::memory_order_relaxed);
+    }
+    stolenMetric.store(bus->metric("tasks.stolen", MetricsBus::Counter), std::memory_order_relaxed);
+    for (int i = 0; i < typeCount; ++i)
+        registerMetrics(bus, i);
+    metricsBus.store(bus, std::memory_order_release);
+}
+
+void TaskScheduler::registerMetrics(MetricsBus *bus, int type)
+{
+    types[type].runMetric.store(bus->metric("tasks." + types[type].name, MetricsBus::Sample, "ns"),
+                                std::memory_order_relaxed);
+}
+
+void TaskScheduler::post(int type, Priority priority, std::function<void()> work, const CancellationToken &token)
+{
+    Task *task = new Task;
+    task->work = std::move(work);
+    task->token = token;
+    task->postedNs = clock.nsecsElapsed();
+    task->type = qBound(0, type, kMaxTaskTypes - 1);
+    task->lane = qBound(0, int(priority), PriorityCount - 1);
+    if (token.state)
+        token.state->outstanding.fetch_add(1, std::memory_order_relaxed);
+    outstanding.fetch_add(1, std::memory_order_relaxed);
+
+    Worker *worker = currentWorker;
+    if (worker && worker->scheduler == this) {
+        worker->deques[task->lane].push(task);
+    } else {
+        QMutexLocker lock(&injectMutex);
+        injected[task->lane].push_back(task);
+        injectedCount[task->lane].fetch_add(1, std::memory_order_relaxed);
+    }
+    wakeWorker();
+}
+
+void TaskScheduler::wakeWorker()
+{
+    // Pairs with the fence a worker passes between counting itself as a
+    // sleeper and looking for work one last time: either it sees this
+    // task, or this sees it asleep
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers.load(std::memory_order_relaxed) > 0) {
+        QMutexLocker lock(&idleMutex);
+        wake.wakeOne();
+    }
+}
+
+void TaskScheduler::workerLoop(Worker *worker)
+{
+    currentWorker = worker;
+#ifdef Q_OS_LINUX
+    if (worker->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(worker->cpu, &set);
+        sched_setaffinity(0, sizeof(set), &set);
+    }
+#endif
+
+    while (!stopping.load(std::memory_order_acquire)) {
+        if (Task *task = findTask(worker)) {
+            runTask(worker, task);
+            continue;
+        }
+        QMutexLocker lock(&idleMutex);
+        sleepers.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!stopping.load(std::memory_order_relaxed) && !hasWork())
+            wake.wait(&idleMutex);
+        sleepers.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    if (worker->metrics)
+        worker->metrics->retire();
+    currentWorker = nullptr;
+}
+
+TaskScheduler::Task *TaskScheduler::findTask(Worker *worker)
+{
+    for (int lane = 0; lane < PriorityCount; ++lane) {
+        if (Task *task = worker->deques[lane].take())
+            return task;
+        if (injectedCount[lane].load(std::memory_order_relaxed) > 0) {
+            if (Task *task = takeInjected(lane))
+                return task;
+        }
+        for (int victim : worker->victims) {
+            if (Task *task = workers[size_t(victim)]->deques[lane].steal()) {
+                worker->stolen.store(worker->stolen.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                if (worker->metrics && stolenMetric.load(std::memory_order_relaxed) >= 0)
+                    worker->metrics->add(stolenMetric.load(std::memory_order_relaxed));
+                return task;
+            }
+        }
+    }
+    return nullptr;
+}
+
+TaskScheduler::Task *TaskScheduler::takeInjected(int lane)
+{
+    QMutexLocker lock(&injectMutex);
+    if (injected[lane].empty())
+        return nullptr;
+    Task *task = injected[lane].front();
+    injected[lane].pop_front();
+    injectedCount[lane].fetch_sub(1, std::memory_order_relaxed);
+    return task;
+}
+
+bool TaskScheduler::hasWork() const
+{
+    for (int lane = 0; lane < PriorityCount; ++lane) {
+        if (injectedCount[lane].load(std::memory_order_relaxed) > 0)
+            return true;
+        for (const std::unique_ptr<Worker> &worker : workers) {
+            if (!worker->deques[lane].isEmpty())
+                return true;
+        }
+    }
+    return false;
+}
+
+void TaskScheduler::runTask(Worker *worker, Task *task)
+{
+    // Attached under the lock setMetricsBus() takes, so a bus being
+    // replaced or deleted is never attached to
+    if (!worker->metrics && metricsBus.load(std::memory_order_relaxed)) {
+        QMutexLocker lock(&typesMutex);
+        if (MetricsBus *bus = metricsBus.load(std::memory_order_acquire))
+            worker->metrics = bus->attach(QString("Task worker %1").arg(worker->index));
+    }
+
+    const qint64 startNs = clock.nsecsElapsed();
+    const bool skipped = task->token.isCancelled();
+    if (skipped) {
+        worker->cancelled.store(worker->cancelled.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    } else {
+        task->work();
+        worker->run.store(worker->run.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    if (worker->metrics) {
+        const int waitMetric = waitMetrics[task->lane].load(std::memory_order_relaxed);
+        if (waitMetric >= 0)
+            worker->metrics->record(waitMetric, startNs - task->postedNs);
+        const int runMetric = types[task->type].runMetric.load(std::memory_order_relaxed);
+        if (!skipped && runMetric >= 0)
+            worker->metrics->record(runMetric, clock.nsecsElapsed() - startNs);
+    }
+    finishTask(task);
+}
+
+void TaskScheduler::finishTask(Task *task)
+{
+    // What the task holds is released before anyone waiting is told
+    const std::shared_ptr<CancellationToken::State> state = task->token.state;
+    delete task;
+
+    bool done = false;
+    if (state && state->outstanding.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        done = true;
+    if (outstanding.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        done = true;
+    if (done) {
+        QMutexLocker lock(&idleMutex);
+        finished.wakeAll();
+    }
+}
+
+void TaskScheduler::wait(const CancellationToken &token)
+{
+    if (!token.state)
+        return;
+    QMutexLocker lock(&idleMutex);
+    while (token.state->outstanding.load(std::memory_order_acquire) > 0)
+        finished.wait(&idleMutex);
+}
+
+void TaskScheduler::waitForIdle()
+{
+    QMutexLocker lock(&idleMutex);
+    while (outstanding.load(std::memory_order_acquire) > 0)
+        finished.wait(&idleMutex);
+}
+
+quint64 TaskScheduler::tasksRun() const
+{
+    quint64 total = 0;
+    for (const std::unique_ptr<Worker> &worker : workers)
+        total += worker->run.load(std::memory_order_relaxed);
+    return total;
+}
+
+quint64 TaskScheduler::tasksStolen() const
+{
+    quint64 total = 0;
+    for (const std::unique_ptr<Worker> &worker : workers)
+        total += worker->stolen.load(std::memory_order_relaxed);
+    return total;
+}
+
+quint64 TaskScheduler::tasksCancelled() const
+{
+    quint64 total = 0;
+    for (const std::unique_ptr<Worker> &worker : workers)
+        total += worker->cancelled.load(std::memory_order_relaxed);
+    return total;
+}
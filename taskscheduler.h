@@ -0,0 +1,181 @@
+#ifndef TASKSCHEDULER_H
+#define TASKSCHEDULER_H
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QObject>
+#include <QString>
+#include <QThread>
+#include <QWaitCondition>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+class MetricsBus;
+
+// Cancels the tasks it was posted with, cooperatively: copies share one
+// flag, a task still queued when it is set is skipped, and a running one
+// checks isCancelled() where stopping is safe. It also counts the tasks
+// not yet finished, for TaskScheduler::wait(). A default-constructed
+// token is never cancelled and counts nothing; create() makes one that
+// does.
+class CancellationToken
+{
+public:
+    CancellationToken() = default;
+    static CancellationToken create();
+
+    bool isValid() const { return state != nullptr; }
+    void cancel();
+    bool isCancelled() const { return state && state->cancelled.load(std::memory_order_acquire); }
+
+private:
+    friend class TaskScheduler;
+
+    struct State
+    {
+        std::atomic<bool> cancelled { false };
+        std::atomic<int> outstanding { 0 };
+    };
+
+    std::shared_ptr<State> state;
+};
+
+// The process's worker threads, shared by every engine that has CPU work
+// to hand off, so the app as a whole runs one thread per core instead of
+// one pool per engine.
+//
+// Each worker keeps a Chase-Lev deque per priority lane: tasks posted
+// from a worker go to the bottom of its own deque and are taken from
+// there, newest first, while idle workers steal the oldest from the top
+// of the others'. Tasks posted from any other thread, the GUI's above all,
+// go through a locked queue per lane. A worker looks for Interactive work
+// everywhere before it runs Normal work, and for Normal before
+// Background; a task is never preempted, so long ones belong in
+// Background.
+//
+// Workers run on the CPUs of the process's affinity mask, which honours
+// cpusets. With pinWorkers each is bound to one of them, ordered by NUMA
+// node, and steals from workers on its own node first.
+//
+// With a MetricsBus, every task type gets a histogram of its run time and
+// every lane one of the time its tasks waited, in the Status tab.
+class TaskScheduler
+{
+public:
+    enum Priority {
+        Interactive = 0,               // Someone is waiting on the screen
+        Normal,
+        Background,                    // Imports, compiles, anything long
+        PriorityCount
+    };
+
+    static const int kMaxTaskTypes = 16;
+
+    struct Options
+    {
+        int workers = 0;               // 0 for one per CPU the process may run on
+        bool pinWorkers = false;
+    };
+
+    TaskScheduler();
+    explicit TaskScheduler(const Options &options);
+    ~TaskScheduler();
+    TaskScheduler(const TaskScheduler &) = delete;
+    TaskScheduler &operator=(const TaskScheduler &) = delete;
+
+    // The process-wide scheduler, started with default options on first use
+    static TaskScheduler *instance();
+
+    int workerCount() const { return int(workers.size()); }
+
+    // Registers a kind of task for the histograms, or returns the id it
+    // already has; at most kMaxTaskTypes, beyond that the last one
+    int taskType(const QString &name);
+    // Any time; workers attach to it at their next task. Null detaches,
+    // before the bus is deleted.
+    void setMetricsBus(MetricsBus *bus);
+
+    // Any thread. Tasks still queued when the scheduler is destroyed are
+    // dropped without running.
+    void post(int type, Priority priority, std::function<void()> work,
+              const CancellationToken &token = CancellationToken());
+
+    // Runs `work` on a worker and hands its result to `done` on the thread
+    // of `context`, through its event loop, unless `token` was cancelled
+    // by then. `context` must outlive the task: owners that may go first
+    // cancel the token and wait() for it when they are destroyed.
+    template <typename Work, typename Done>
+    void run(int type, Priority priority, QObject *context, Work work, Done done,
+             const CancellationToken &token = CancellationToken())
+    {
+        post(type, priority, [context, work, done, token]() mutable {
+            auto result = work();
+            if (token.isCancelled())
+                return;
+            QMetaObject::invokeMethod(context, [done, result]() mutable { done(result); }, Qt::QueuedConnection);
+        }, token);
+    }
+
+    // Blocks until every task posted with `token` has finished or been
+    // skipped; must not be called from a task
+    void wait(const CancellationToken &token);
+    // Blocks until no task is queued or running; for tests and benchmarks
+    void waitForIdle();
+
+    quint64 tasksRun() const;
+    quint64 tasksStolen() const;
+    quint64 tasksCancelled() const;
+
+private:
+    struct Task;
+    struct Worker;
+    class TaskDeque;
+
+    struct TaskType
+    {
+        QString name;
+        std::atomic<int> runMetric { -1 };
+    };
+
+    void start(const Options &options);
+    void workerLoop(Worker *worker);
+    Task *findTask(Worker *worker);
+    Task *takeInjected(int lane);
+    bool hasWork() const;
+    void runTask(Worker *worker, Task *task);
+    void wakeWorker();
+    void finishTask(Task *task);
+    void registerMetrics(MetricsBus *bus, int type);
+
+    // The worker running on this thread, of whichever scheduler
+    static thread_local Worker *currentWorker;
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::unique_ptr<QThread>> threads;
+    QElapsedTimer clock;
+
+    // From threads that are not workers
+    QMutex injectMutex;
+    std::deque<Task *> injected[PriorityCount];
+    std::atomic<int> injectedCount[PriorityCount] = {};
+
+    // Idle workers sleep on `wake`; wait() and waitForIdle() on `finished`
+    QMutex idleMutex;
+    QWaitCondition wake;
+    QWaitCondition finished;
+    std::atomic<int> sleepers { 0 };
+    std::atomic<bool> stopping { false };
+    std::atomic<qint64> outstanding { 0 };
+
+    QMutex typesMutex;
+    TaskType types[kMaxTaskTypes];
+    int typeCount = 0;
+    std::atomic<MetricsBus *> metricsBus { nullptr };
+    std::atomic<int> waitMetrics[PriorityCount] = {};
+    std::atomic<int> stolenMetric { -1 };
+};
+
+#endif // TASKSCHEDULER_H
@@ -0,0 +1,689 @@
+#include "timeseriesstore.h"
+#include <QDateTime>
+#include <QFile>
+#include <QMutexLocker>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+namespace {
+
+const int kBlockBits = TimeSeriesStore::kBlockBytes * 8;
+const int kBlocksPerChunk = 256;
+const qint64 kTierWidth[TimeSeriesStore::ResolutionCount] = { 1, 60, 3600 };
+const char kSnapshotMagic[8] = { 'R', 'H', 'T', 'S', 'D', 'B', '0', '1' };
+const quint32 kSnapshotVersion = 1;
+
+struct SnapshotHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 blockBytes;
+    quint32 seriesCount;
+    quint32 reserved;
+    quint64 blockCount;
+    quint64 namesBytes;
+    qint64 savedAt;
+};
+
+struct SnapshotTier
+{
+    quint64 blockCount;
+    qint64 lastDelta;
+    quint64 lastBits;
+    quint8 lastLeading;
+    quint8 lastTrailing;
+    quint8 reserved[6];
+};
+
+struct SnapshotRollup
+{
+    qint64 start;
+    double sum;
+    double max;
+    quint32 count;
+    quint32 reserved;
+};
+
+struct SnapshotSeries
+{
+    quint32 nameOffset;
+    quint32 nameLength;
+    quint8 aggregation;
+    quint8 reserved[7];
+    SnapshotTier tiers[TimeSeriesStore::ResolutionCount];
+    SnapshotRollup rollups[TimeSeriesStore::ResolutionCount];
+};
+
+struct SnapshotBlock
+{
+    qint64 firstTime;
+    qint64 lastTime;
+    double firstValue;
+    quint16 count;
+    quint16 bitsUsed;
+    quint32 reserved;
+};
+
+quint64 doubleBits(double value)
+{
+    quint64 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+double bitsDouble(quint64 bits)
+{
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Big-endian bit stream over a zeroed, fixed-size buffer
+void writeBits(uchar *buffer, quint32 &position, quint64 value, int bits)
+{
+    while (bits > 0) {
+        const int room = 8 - int(position & 7);
+        const int take = qMin(bits, room);
+        const quint8 chunk = quint8((value >> (bits - take)) & ((1u << take) - 1));
+        buffer[position >> 3] |= quint8(chunk << (room - take));
+        position += quint32(take);
+        bits -= take;
+    }
+}
+
+quint64 readBits(const uchar *buffer, quint32 &position, int bits)
+{
+    quint64 value = 0;
+    while (bits > 0) {
+        const int room = 8 - int(position & 7);
+        const int take = qMin(bits, room);
+        const quint8 chunk = quint8((buffer[position >> 3] >> (room - take)) & ((1u << take) - 1));
+        value = (value << take) | chunk;
+        position += quint32(take);
+        bits -= take;
+    }
+    return value;
+}
+
+int leadingZeros(quint64 value)
+{
+    return value ? __builtin_clzll(value) : 64;
+}
+
+int trailingZeros(quint64 value)
+{
+    return value ? __builtin_ctzll(value) : 64;
+}
+
+// Timestamp delta-of-delta classes: prefix bits, payload bits, bias
+struct DodClass
+{
+    quint32 prefix;
+    int prefixBits;
+    int valueBits;
+    qint64 bias;
+};
+
+const DodClass kDodClasses[] = {
+    { 0x2, 2, 7, 63 },
+    { 0x6, 3, 9, 255 },
+    { 0xe, 4, 12, 2047 },
+    { 0xf, 4, 32, 0 },
+};
+
+int dodClassFor(qint64 dod)
+{
+    if (dod >= -63 && dod <= 64)
+        return 0;
+    if (dod >= -255 && dod <= 256)
+        return 1;
+    if (dod >= -2047 && dod <= 2048)
+        return 2;
+    return 3;
+}
+
+qint64 floorTo(qint64 time, qint64 width)
+{
+    const qint64 remainder = time % width;
+    return remainder < 0 ? time - remainder - width : time - remainder;
+}
+
+} // namespace
+
+TimeSeriesStore::TimeSeriesStore(QObject *parent)
+    : QObject(parent)
+{
+    retention[Seconds] = 3600;
+    retention[Minutes] = 7 * 24 * 3600;
+    retention[Hours] = 366 * 24 * 3600;
+}
+
+TimeSeriesStore::~TimeSeriesStore()
+{
+}
+
+void TimeSeriesStore::setRetention(Resolution resolution, qint64 seconds)
+{
+    QMutexLocker lock(&mutex);
+    retention[resolution] = seconds;
+}
+
+void TimeSeriesStore::setMemoryBudget(quint64 bytes)
+{
+    QMutexLocker lock(&mutex);
+    memoryBudget = bytes;
+}
+
+int TimeSeriesStore::series(const QString &name, Aggregation aggregation)
+{
+    QMutexLocker lock(&mutex);
+    auto it = seriesByName.constFind(name);
+    if (it != seriesByName.constEnd())
+        return it.value();
+
+    seriesList.emplace_back();
+    seriesList.back().name = name;
+    seriesList.back().aggregation = aggregation;
+    const int id = int(seriesList.size()) - 1;
+    seriesByName.insert(name, id);
+    return id;
+}
+
+int TimeSeriesStore::findSeries(const QString &name) const
+{
+    QMutexLocker lock(&mutex);
+    return seriesByName.value(name, -1);
+}
+
+QStringList TimeSeriesStore::seriesNames() const
+{
+    QMutexLocker lock(&mutex);
+    QStringList names;
+    names.reserve(int(seriesList.size()));
+    for (const Series &entry : seriesList)
+        names.append(entry.name);
+    return names;
+}
+
+uchar *TimeSeriesStore::payload(quint32 index) const
+{
+    return chunks[index / kBlocksPerChunk].get() + size_t(index % kBlocksPerChunk) * kBlockBytes;
+}
+
+quint32 TimeSeriesStore::allocateBlock()
+{
+    enforceBudget();
+    if (freeBlocks.empty()) {
+        const quint32 first = quint32(chunks.size()) * kBlocksPerChunk;
+        chunks.emplace_back(new uchar[size_t(kBlocksPerChunk) * kBlockBytes]);
+        for (int i = kBlocksPerChunk - 1; i >= 0; --i)
+            freeBlocks.push_back(first + quint32(i));
+    }
+    const quint32 index = freeBlocks.back();
+    freeBlocks.pop_back();
+    memset(payload(index), 0, kBlockBytes);
+    ++usedBlocks;
+    return index;
+}
+
+void TimeSeriesStore::releaseBlock(quint32 index)
+{
+    freeBlocks.push_back(index);
+    --usedBlocks;
+}
+
+void TimeSeriesStore::enforceBudget()
+{
+    const quint64 perBlock = kBlockBytes + sizeof(Block);
+    if ((usedBlocks + 1) * perBlock <= memoryBudget || seriesList.empty())
+        return;
+
+    // Round-robin over series, finest tier first; the open block of a
+    // tier is never evicted
+    for (int level = Seconds; level < ResolutionCount; ++level) {
+        for (size_t visited = 0; visited < seriesList.size(); ++visited) {
+            evictionCursor = (evictionCursor + 1) % seriesList.size();
+            Tier &tier = seriesList[evictionCursor].tiers[level];
+            if (tier.blocks.size() < 2)
+                continue;
+            releaseBlock(tier.blocks.front().payload);
+            tier.blocks.pop_front();
+            ++evictedBlocks;
+            return;
+        }
+    }
+}
+
+void TimeSeriesStore::appendToTier(Tier &tier, qint64 time, double value, qint64 keepSeconds)
+{
+    const quint64 bits = doubleBits(value);
+
+    if (!tier.blocks.empty()) {
+        Block &block = tier.blocks.back();
+        const qint64 delta = time - block.lastTime;
+        const qint64 dod = delta - tier.lastDelta;
+
+        int timeBits = 1;
+        int dodClass = -1;
+        if (dod != 0) {
+            dodClass = dodClassFor(dod);
+            timeBits = kDodClasses[dodClass].prefixBits + kDodClasses[dodClass].valueBits;
+        }
+
+        const quint64 xorBits = bits ^ tier.lastBits;
+        int valueBits = 1;
+        int leading = 0;
+        int trailing = 0;
+        bool reuseWindow = false;
+        if (xorBits != 0) {
+            leading = qMin(leadingZeros(xorBits), 31);
+            trailing = trailingZeros(xorBits);
+            reuseWindow = tier.lastLeading != 0xff && leading >= tier.lastLeading && trailing >= tier.lastTrailing;
+            valueBits = reuseWindow ? 2 + (64 - tier.lastLeading - tier.lastTrailing)
+                                    : 2 + 5 + 6 + (64 - leading - trailing);
+        }
+
+        const bool fitsInt32 = dod >= qint64(INT32_MIN) && dod <= qint64(INT32_MAX);
+        if (fitsInt32 && block.count < 0xffff && block.bitsUsed + timeBits + valueBits <= kBlockBits) {
+            uchar *buffer = payload(block.payload);
+            quint32 position = block.bitsUsed;
+            if (dodClass < 0) {
+                writeBits(buffer, position, 0, 1);
+            } else {
+                const DodClass &encoding = kDodClasses[dodClass];
+                writeBits(buffer, position, encoding.prefix, encoding.prefixBits);
+                writeBits(buffer, position, quint64(dod + encoding.bias) & ((quint64(1) << encoding.valueBits) - 1),
+                          encoding.valueBits);
+            }
+            if (xorBits == 0) {
+                writeBits(buffer, position, 0, 1);
+            } else if (reuseWindow) {
+                writeBits(buffer, position, 0x2, 2);
+                writeBits(buffer, position, xorBits >> tier.lastTrailing, 64 - tier.lastLeading - tier.lastTrailing);
+            } else {
+                const int meaningful = 64 - leading - trailing;
+                writeBits(buffer, position, 0x3, 2);
+                writeBits(buffer, position, quint64(leading), 5);
+                writeBits(buffer, position, quint64(meaningful - 1), 6);
+                writeBits(buffer, position, xorBits >> trailing, meaningful);
+                tier.lastLeading = quint8(leading);
+                tier.lastTrailing = quint8(trailing);
+            }
+            block.bitsUsed = quint16(position);
+            ++block.count;
+            block.lastTime = time;
+            tier.lastDelta = delta;
+            tier.lastBits = bits;
+            return;
+        }
+    }
+
+    // Start a new block; its first point lives in the block header
+    Block block;
+    block.firstTime = time;
+    block.lastTime = time;
+    block.firstValue = value;
+    block.count = 1;
+    block.payload = allocateBlock();
+    tier.blocks.push_back(block);
+    tier.lastDelta = 0;
+    tier.lastBits = bits;
+    tier.lastLeading = 0xff;
+    tier.lastTrailing = 0;
+
+    while (tier.blocks.size() > 1 && tier.blocks.front().lastTime < time - keepSeconds) {
+        releaseBlock(tier.blocks.front().payload);
+        tier.blocks.pop_front();
+    }
+}
+
+double TimeSeriesStore::rollupValue(const Series &series, const Rollup &rollup) const
+{
+    switch (series.aggregation) {
+    case Mean:
+        return rollup.count ? rollup.sum / rollup.count : 0;
+    case Max:
+        return rollup.max;
+    case Sum:
+    default:
+        return rollup.sum;
+    }
+}
+
+void TimeSeriesStore::rollUp(Series &series, int level, qint64 time, double value)
+{
+    // Both coarse tiers roll up from the 1 s samples, so means stay exact
+    const qint64 start = floorTo(time, kTierWidth[level]);
+    Rollup &rollup = series.rollups[level];
+    if (rollup.start >= 0 && rollup.start != start && rollup.count > 0) {
+        appendToTier(series.tiers[level], rollup.start, rollupValue(series, rollup), retention[level]);
+        rollup = Rollup();
+    }
+    if (rollup.count == 0)
+        rollup.start = start;
+    rollup.max = rollup.count ? qMax(rollup.max, value) : value;
+    rollup.sum += value;
+    ++rollup.count;
+}
+
+void TimeSeriesStore::append(int id, qint64 timeSeconds, double value)
+{
+    QMutexLocker lock(&mutex);
+    if (id < 0 || id >= int(seriesList.size()))
+        return;
+
+    Series &entry = seriesList[size_t(id)];
+    const Tier &seconds = entry.tiers[Seconds];
+    if (!seconds.blocks.empty() && timeSeconds <= seconds.blocks.back().lastTime) {
+        ++rejectedSamples;
+        return;
+    }
+
+    appendToTier(entry.tiers[Seconds], timeSeconds, value, retention[Seconds]);
+    rollUp(entry, Minutes, timeSeconds, value);
+    rollUp(entry, Hours, timeSeconds, value);
+}
+
+void TimeSeriesStore::decodeBlock(const Block &block, qint64 from, qint64 to, QVector<Point> &points) const
+{
+    qint64 time = block.firstTime;
+    quint64 bits = doubleBits(block.firstValue);
+    if (time >= from && time <= to)
+        points.append({ time, block.firstValue });
+
+    const uchar *buffer = payload(block.payload);
+    quint32 position = 0;
+    qint64 delta = 0;
+    int leading = 0;
+    int trailing = 0;
+    for (int i = 1; i < block.count; ++i) {
+        qint64 dod = 0;
+        if (readBits(buffer, position, 1)) {
+            int cls = 0;
+            while (cls < 3 && readBits(buffer, position, 1))
+                ++cls;
+            const DodClass &encoding = kDodClasses[cls];
+            const quint64 raw = readBits(buffer, position, encoding.valueBits);
+            dod = cls == 3 ? qint64(qint32(quint32(raw))) : qint64(raw) - encoding.bias;
+        }
+        delta += dod;
+        time += delta;
+
+        if (readBits(buffer, position, 1)) {
+            if (readBits(buffer, position, 1)) {
+                leading = int(readBits(buffer, position, 5));
+                const int meaningful = int(readBits(buffer, position, 6)) + 1;
+                trailing = 64 - leading - meaningful;
+            }
+            bits ^= readBits(buffer, position, 64 - leading - trailing) << trailing;
+        }
+
+        if (time > to)
+            break;
+        if (time >= from)
+            points.append({ time, bitsDouble(bits) });
+    }
+}
+
+int TimeSeriesStore::query(int id, Resolution resolution, qint64 from, qint64 to, QVector<Point> &points) const
+{
+    QMutexLocker lock(&mutex);
+    if (id < 0 || id >= int(seriesList.size()))
+        return 0;
+
+    const Series &entry = seriesList[size_t(id)];
+    const std::deque<Block> &blocks = entry.tiers[resolution].blocks;
+    const int before = points.size();
+
+    // Blocks are in time order; skip straight to the first one that can
+    // contain `from`
+    auto first = std::partition_point(blocks.begin(), blocks.end(),
+                                      [from](const Block &block) { return block.lastTime < from; });
+    for (auto it = first; it != blocks.end() && it->firstTime <= to; ++it)
+        decodeBlock(*it, from, to, points);
+
+    if (resolution != Seconds) {
+        const Rollup &rollup = entry.rollups[resolution];
+        if (rollup.count > 0 && rollup.start >= from && rollup.start <= to)
+            points.append({ rollup.start, rollupValue(entry, rollup) });
+    }
+    return points.size() - before;
+}
+
+TimeSeriesStore::Resolution TimeSeriesStore::resolutionFor(qint64 spanSeconds, int maxPoints) const
+{
+    QMutexLocker lock(&mutex);
+    for (int level = Seconds; level < Hours; ++level) {
+        if (spanSeconds <= retention[level] && spanSeconds / kTierWidth[level] <= maxPoints)
+            return Resolution(level);
+    }
+    return Hours;
+}
+
+TimeSeriesStore::Stats TimeSeriesStore::stats() const
+{
+    QMutexLocker lock(&mutex);
+    Stats result;
+    result.series = int(seriesList.size());
+    result.blocks = usedBlocks;
+    for (const Series &entry : seriesList) {
+        for (const Tier &tier : entry.tiers) {
+            for (const Block &block : tier.blocks)
+                result.points += block.count;
+        }
+        result.memoryBytes += sizeof(Series) + quint64(entry.name.size()) * 2;
+    }
+    result.memoryBytes += quint64(chunks.size()) * kBlocksPerChunk * kBlockBytes + usedBlocks * sizeof(Block)
+                          + freeBlocks.capacity() * sizeof(quint32);
+    result.evictedBlocks = evictedBlocks;
+    result.rejectedSamples = rejectedSamples;
+    return result;
+}
+
+bool TimeSeriesStore::saveSnapshot(const QString &path)
+{
+    QMutexLocker lock(&mutex);
+
+    QByteArray names;
+    quint64 blockCount = 0;
+    for (const Series &entry : seriesList) {
+        names += entry.name.toUtf8();
+        for (const Tier &tier : entry.tiers)
+            blockCount += tier.blocks.size();
+    }
+
+    const quint64 seriesBytes = quint64(seriesList.size()) * sizeof(SnapshotSeries);
+    const quint64 infoBytes = blockCount * sizeof(SnapshotBlock);
+    const quint64 total = sizeof(SnapshotHeader) + seriesBytes + infoBytes + blockCount * kBlockBytes + quint64(names.size());
+
+    const QString temporaryPath = path + ".new";
+    QFile file(temporaryPath);
+    if (!file.open(QIODevice::ReadWrite | QIODevice::Truncate) || !file.resize(qint64(total))) {
+        lastError = file.errorString();
+        return false;
+    }
+    uchar *map = file.map(0, qint64(total));
+    if (!map) {
+        lastError = file.errorString();
+        file.remove();
+        return false;
+    }
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kSnapshotMagic, sizeof(header.magic));
+    header.version = kSnapshotVersion;
+    header.blockBytes = kBlockBytes;
+    header.seriesCount = quint32(seriesList.size());
+    header.blockCount = blockCount;
+    header.namesBytes = quint64(names.size());
+    header.savedAt = QDateTime::currentSecsSinceEpoch();
+    memcpy(map, &header, sizeof(header));
+
+    uchar *seriesOut = map + sizeof(SnapshotHeader);
+    uchar *infoOut = seriesOut + seriesBytes;
+    uchar *payloadOut = infoOut + infoBytes;
+    memcpy(payloadOut + blockCount * kBlockBytes, names.constData(), size_t(names.size()));
+
+    quint32 nameOffset = 0;
+    for (const Series &entry : seriesList) {
+        SnapshotSeries record;
+        memset(&record, 0, sizeof(record));
+        record.nameOffset = nameOffset;
+        record.nameLength = quint32(entry.name.toUtf8().size());
+        nameOffset += record.nameLength;
+        record.aggregation = entry.aggregation;
+        for (int level = 0; level < ResolutionCount; ++level) {
+            const Tier &tier = entry.tiers[level];
+            record.tiers[level].blockCount = tier.blocks.size();
+            record.tiers[level].lastDelta = tier.lastDelta;
+            record.tiers[level].lastBits = tier.lastBits;
+            record.tiers[level].lastLeading = tier.lastLeading;
+            record.tiers[level].lastTrailing = tier.lastTrailing;
+            record.rollups[level].start = entry.rollups[level].start;
+            record.rollups[level].sum = entry.rollups[level].sum;
+            record.rollups[level].max = entry.rollups[level].max;
+            record.rollups[level].count = entry.rollups[level].count;
+
+            for (const Block &block : tier.blocks) {
+                SnapshotBlock info;
+                memset(&info, 0, sizeof(info));
+                info.firstTime = block.firstTime;
+                info.lastTime = block.lastTime;
+                info.firstValue = block.firstValue;
+                info.count = block.count;
+                info.bitsUsed = block.bitsUsed;
+                memcpy(infoOut, &info, sizeof(info));
+                infoOut += sizeof(info);
+                memcpy(payloadOut, payload(block.payload), kBlockBytes);
+                payloadOut += kBlockBytes;
+            }
+        }
+        memcpy(seriesOut, &record, sizeof(record));
+        seriesOut += sizeof(record);
+    }
+
+    file.unmap(map);
+#ifdef Q_OS_UNIX
+    fsync(file.handle());
+#endif
+    file.close();
+
+    if (std::rename(QFile::encodeName(temporaryPath).constData(), QFile::encodeName(path).constData()) != 0) {
+        lastError = QString("Cannot replace %1").arg(path);
+        QFile::remove(temporaryPath);
+        return false;
+    }
+    return true;
+}
+
+bool TimeSeriesStore::loadSnapshot(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        lastError = file.errorString();
+        return false;
+    }
+    const quint64 size = quint64(file.size());
+    if (size < sizeof(SnapshotHeader)) {
+        lastError = "Snapshot is truncated";
+        return false;
+    }
+    const uchar *map = file.map(0, qint64(size));
+    if (!map) {
+        lastError = file.errorString();
+        return false;
+    }
+
+    SnapshotHeader header;
+    memcpy(&header, map, sizeof(header));
+    if (memcmp(header.magic, kSnapshotMagic, sizeof(header.magic)) != 0 || header.version != kSnapshotVersion
+        || header.blockBytes != quint32(kBlockBytes)) {
+        lastError = "Not a history snapshot, or from an incompatible version";
+        return false;
+    }
+    const quint64 seriesBytes = quint64(header.seriesCount) * sizeof(SnapshotSeries);
+    if (header.blockCount > size / kBlockBytes || header.namesBytes > size) {
+        lastError = "Snapshot is corrupt";
+        return false;
+    }
+    const quint64 infoBytes = header.blockCount * sizeof(SnapshotBlock);
+    if (sizeof(SnapshotHeader) + seriesBytes + infoBytes + header.blockCount * kBlockBytes + header.namesBytes != size) {
+        lastError = "Snapshot is truncated";
+        return false;
+    }
+
+    const uchar *seriesIn = map + sizeof(SnapshotHeader);
+    const uchar *infoIn = seriesIn + seriesBytes;
+    const uchar *payloadIn = infoIn + infoBytes;
+    const char *names = reinterpret_cast<const char *>(payloadIn + header.blockCount * kBlockBytes);
+
+    QMutexLocker lock(&mutex);
+    seriesList.clear();
+    seriesByName.clear();
+    chunks.clear();
+    freeBlocks.clear();
+    usedBlocks = 0;
+    evictionCursor = 0;
+
+    quint64 blocksRead = 0;
+    for (quint32 i = 0; i < header.seriesCount; ++i) {
+        SnapshotSeries record;
+        memcpy(&record, seriesIn + quint64(i) * sizeof(SnapshotSeries), sizeof(record));
+        if (quint64(record.nameOffset) + record.nameLength > header.namesBytes || record.aggregation > Max) {
+            lastError = "Snapshot is corrupt";
+            seriesList.clear();
+            seriesByName.clear();
+            return false;
+        }
+
+        seriesList.emplace_back();
+        Series &entry = seriesList.back();
+        entry.name = QString::fromUtf8(names + record.nameOffset, int(record.nameLength));
+        entry.aggregation = Aggregation(record.aggregation);
+        for (int level = 0; level < ResolutionCount; ++level) {
+            Tier &tier = entry.tiers[level];
+            tier.lastDelta = record.tiers[level].lastDelta;
+            tier.lastBits = record.tiers[level].lastBits;
+            tier.lastLeading = record.tiers[level].lastLeading;
+            tier.lastTrailing = record.tiers[level].lastTrailing;
+            entry.rollups[level].start = record.rollups[level].start;
+            entry.rollups[level].sum = record.rollups[level].sum;
+            entry.rollups[level].max = record.rollups[level].max;
+            entry.rollups[level].count = record.rollups[level].count;
+
+            if (record.tiers[level].blockCount > header.blockCount - blocksRead) {
+                lastError = "Snapshot is corrupt";
+                seriesList.clear();
+                seriesByName.clear();
+                return false;
+            }
+            for (quint64 b = 0; b < record.tiers[level].blockCount; ++b, ++blocksRead) {
+                SnapshotBlock info;
+                memcpy(&info, infoIn + blocksRead * sizeof(SnapshotBlock), sizeof(info));
+                if (info.bitsUsed > kBlockBits || info.count == 0) {
+                    lastError = "Snapshot is corrupt";
+                    seriesList.clear();
+                    seriesByName.clear();
+                    return false;
+                }
+                Block block;
+                block.firstTime = info.firstTime;
+                block.lastTime = info.lastTime;
+                block.firstValue = info.firstValue;
+                block.count = info.count;
+                block.bitsUsed = info.bitsUsed;
+                block.payload = allocateBlock();
+                memcpy(payload(block.payload), payloadIn + blocksRead * kBlockBytes, kBlockBytes);
+                tier.blocks.push_back(block);
+            }
+        }
+        seriesByName.insert(entry.name, int(seriesList.size()) - 1);
+    }
+    return true;
+}
@@ -0,0 +1,139 @@
+#ifndef TIMESERIESSTORE_H
+#define TIMESERIESSTORE_H
+
+#include <QObject>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <deque>
+#include <memory>
+#include <vector>
+
+// In-memory history for counters such as per-process and per-interface
+// bytes/s. Every series keeps three tiers (1 s, 1 min, 1 h); only 1 s
+// samples are appended and the coarser tiers are rolled up as each
+// minute/hour completes.
+//
+// Points are Gorilla-compressed (delta-of-delta timestamps, XOR'd
+// doubles) into fixed 512-byte blocks drawn from a shared pool. A query
+// decodes only the blocks overlapping its range. Retention is per tier
+// and a global memory budget evicts the oldest fine-grained blocks first.
+// All methods are thread-safe.
+class TimeSeriesStore : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Resolution { Seconds = 0, Minutes, Hours, ResolutionCount };
+    enum Aggregation : quint8 { Sum = 0, Mean, Max };
+
+    struct Point
+    {
+        qint64 time;    // Seconds since the epoch, start of the interval
+        double value;
+    };
+
+    struct Stats
+    {
+        int series = 0;
+        quint64 blocks = 0;
+        quint64 points = 0;
+        quint64 memoryBytes = 0;
+        quint64 evictedBlocks = 0;     // Dropped to stay within the budget
+        quint64 rejectedSamples = 0;   // Out of order or duplicate timestamps
+    };
+
+    explicit TimeSeriesStore(QObject *parent = nullptr);
+    ~TimeSeriesStore();
+
+    void setRetention(Resolution resolution, qint64 seconds);
+    void setMemoryBudget(quint64 bytes);
+
+    // Returns the id of the named series, creating it if needed
+    int series(const QString &name, Aggregation aggregation = Sum);
+    int findSeries(const QString &name) const;
+    QStringList seriesNames() const;
+
+    void append(int series, qint64 timeSeconds, double value);
+
+    // Appends the points with from <= time <= to, oldest first. The
+    // interval still being rolled up is included as the last point.
+    int query(int series, Resolution resolution, qint64 from, qint64 to, QVector<Point> &points) const;
+    // Finest tier that retains `span` seconds in at most maxPoints points
+    Resolution resolutionFor(qint64 spanSeconds, int maxPoints) const;
+
+    // The snapshot is written through a mapping of a temporary file that
+    // then replaces `path`, so a crash never leaves a torn snapshot
+    bool saveSnapshot(const QString &path);
+    bool loadSnapshot(const QString &path);
+    QString errorString() const { return lastError; }
+
+    Stats stats() const;
+
+    static const int kBlockBytes = 512;
+
+private:
+    struct Block
+    {
+        qint64 firstTime = 0;
+        qint64 lastTime = 0;
+        double firstValue = 0;
+        quint32 payload = 0;       // Index into the block pool
+        quint16 count = 0;
+        quint16 bitsUsed = 0;
+    };
+
+    // Appender state for the newest block of a tier
+    struct Tier
+    {
+        std::deque<Block> blocks;
+        qint64 lastDelta = 0;
+        quint64 lastBits = 0;
+        quint8 lastLeading = 0xff;  // 0xff: no previous XOR window
+        quint8 lastTrailing = 0;
+    };
+
+    struct Rollup
+    {
+        qint64 start = -1;
+        double sum = 0;
+        double max = 0;
+        quint32 count = 0;
+    };
+
+    struct Series
+    {
+        QString name;
+        Aggregation aggregation = Sum;
+        Tier tiers[ResolutionCount];
+        Rollup rollups[ResolutionCount];  // Index 0 is unused
+    };
+
+    void appendToTier(Tier &tier, qint64 time, double value, qint64 keepSeconds);
+    void rollUp(Series &series, int level, qint64 time, double value);
+    double rollupValue(const Series &series, const Rollup &rollup) const;
+    void decodeBlock(const Block &block, qint64 from, qint64 to, QVector<Point> &points) const;
+    quint32 allocateBlock();
+    void releaseBlock(quint32 index);
+    void enforceBudget();
+    uchar *payload(quint32 index) const;
+
+    mutable QMutex mutex;
+    std::vector<Series> seriesList;
+    QHash<QString, int> seriesByName;
+    qint64 retention[ResolutionCount];
+    quint64 memoryBudget = 96ull << 20;
+
+    // Pool of fixed-size blocks, allocated in chunks
+    std::vector<std::unique_ptr<uchar[]>> chunks;
+    std::vector<quint32> freeBlocks;
+    quint64 usedBlocks = 0;
+    quint64 evictedBlocks = 0;
+    quint64 rejectedSamples = 0;
+    size_t evictionCursor = 0;
+    QString lastError;
+};
+
+#endif // TIMESERIESSTORE_H
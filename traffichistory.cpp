@@ -0,0 +1,160 @@
+#include "traffichistory.h"
+#include "timeseriesstore.h"
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+namespace {
+
+const int kSampleIntervalMs = 1000;
+const int kSnapshotIntervalMs = 5 * 60 * 1000;
+
+enum InterfaceSeries { RxBytes, TxBytes, RxPackets, TxPackets };
+
+quint64 counterDelta(quint64 now, quint64 before)
+{
+    // Counters restart when an interface is re-created
+    return now >= before ? now - before : 0;
+}
+
+} // namespace
+
+TrafficHistory::TrafficHistory(TimeSeriesStore *store, const QString &snapshotPath, QObject *parent)
+    : QObject(parent), store(store), snapshotPath(snapshotPath), sampleTimer(this), snapshotTimer(this)
+{
+    qRegisterMetaType<ConnectionDiff>();
+    sampleTimer.setTimerType(Qt::PreciseTimer);
+    connect(&sampleTimer, &QTimer::timeout, this, &TrafficHistory::sample);
+    connect(&snapshotTimer, &QTimer::timeout, this, &TrafficHistory::saveSnapshot);
+}
+
+void TrafficHistory::start()
+{
+    sampleTimer.start(kSampleIntervalMs);
+    snapshotTimer.start(kSnapshotIntervalMs);
+    sample();
+}
+
+void TrafficHistory::stop()
+{
+    sampleTimer.stop();
+    snapshotTimer.stop();
+    saveSnapshot();
+}
+
+void TrafficHistory::saveSnapshot()
+{
+    if (snapshotPath.isEmpty())
+        return;
+    QDir().mkpath(QFileInfo(snapshotPath).absolutePath());
+    if (!store->saveSnapshot(snapshotPath))
+        qDebug() << "Traffic history snapshot failed:" << store->errorString();
+}
+
+void TrafficHistory::onConnectionDiff(const ConnectionDiff &diff)
+{
+    for (auto it = diff.processNames.constBegin(); it != diff.processNames.constEnd(); ++it)
+        processNames.insert(it.key(), it.value());
+
+    for (auto it = diff.traffic.constBegin(); it != diff.traffic.constEnd(); ++it) {
+        const QString name = processNames.value(it.key(), QString("pid %1").arg(it.key()));
+        ProcessTraffic &pending = pendingTraffic[name];
+        pending.bytesReceived += it.value().bytesReceived;
+        pending.bytesSent += it.value().bytesSent;
+    }
+}
+
+void TrafficHistory::sample()
+{
+    // A late timer can land in the same second as the previous sample;
+    // skip it and let the next sample cover the longer interval
+    const qint64 now = QDateTime::currentSecsSinceEpoch();
+    if (now <= lastSampleTime)
+        return;
+    const bool first = lastSampleTime == 0;
+    lastSampleTime = now;
+
+    sampleInterfaces(first ? -1 : now);
+    sampleProcesses(first ? -1 : now);
+}
+
+void TrafficHistory::sampleInterfaces(qint64 now)
+{
+    QFile file("/proc/net/dev");
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+
+    // Two header lines, then "  name: rxBytes rxPackets ... txBytes txPackets ..."
+    file.readLine();
+    file.readLine();
+    while (!file.atEnd()) {
+        const QByteArray line = file.readLine();
+        const int colon = line.indexOf(':');
+        if (colon < 0)
+            continue;
+        const QList<QByteArray> fields = line.mid(colon + 1).simplified().split(' ');
+        if (fields.size() < 10)
+            continue;
+
+        const QString name = QString::fromLatin1(line.left(colon).trimmed());
+        InterfaceCounters current;
+        current.rxBytes = fields[0].toULongLong();
+        current.rxPackets = fields[1].toULongLong();
+        current.txBytes = fields[8].toULongLong();
+        current.txPackets = fields[9].toULongLong();
+
+        auto it = interfaces.find(name);
+        if (it == interfaces.end()) {
+            const QString prefix = "if:" + name;
+            current.series[RxBytes] = store->series(prefix + ":rx", TimeSeriesStore::Sum);
+            current.series[TxBytes] = store->series(prefix + ":tx", TimeSeriesStore::Sum);
+            current.series[RxPackets] = store->series(prefix + ":rxpk", TimeSeriesStore::Sum);
+            current.series[TxPackets] = store->series(prefix + ":txpk", TimeSeriesStore::Sum);
+            interfaces.insert(name, current);
+            continue;
+        }
+
+        InterfaceCounters &previous = it.value();
+        if (now >= 0) {
+            store->append(previous.series[RxBytes], now, counterDelta(current.rxBytes, previous.rxBytes));
+            store->append(previous.series[TxBytes], now, counterDelta(current.txBytes, previous.txBytes));
+            store->append(previous.series[RxPackets], now, counterDelta(current.rxPackets, previous.rxPackets));
+            store->append(previous.series[TxPackets], now, counterDelta(current.txPackets, previous.txPackets));
+        }
+        previous.rxBytes = current.rxBytes;
+        previous.rxPackets = current.rxPackets;
+        previous.txBytes = current.txBytes;
+        previous.txPackets = current.txPackets;
+    }
+}
+
+void TrafficHistory::sampleProcesses(qint64 now)
+{
+    if (now < 0) {
+        pendingTraffic.clear();
+        return;
+    }
+
+    for (auto it = processes.begin(); it != processes.end(); ++it) {
+        if (!it.value().wasActive || pendingTraffic.contains(it.key()))
+            continue;
+        // Close the run of activity so graphs drop to zero
+        store->append(it.value().rx, now, 0);
+        store->append(it.value().tx, now, 0);
+        it.value().wasActive = false;
+    }
+
+    for (auto it = pendingTraffic.constBegin(); it != pendingTraffic.constEnd(); ++it) {
+        ProcessSeries &series = processes[it.key()];
+        if (series.rx < 0) {
+            series.rx = store->series("proc:" + it.key() + ":rx", TimeSeriesStore::Sum);
+            series.tx = store->series("proc:" + it.key() + ":tx", TimeSeriesStore::Sum);
+        }
+        store->append(series.rx, now, it.value().bytesReceived);
+        store->append(series.tx, now, it.value().bytesSent);
+        series.wasActive = true;
+    }
+    pendingTraffic.clear();
+}
@@ -0,0 +1,70 @@
+#ifndef TRAFFICHISTORY_H
+#define TRAFFICHISTORY_H
+
+#include <QObject>
+#include <QHash>
+#include <QString>
+#include <QTimer>
+#include "connectionmonitor.h"
+
+class TimeSeriesStore;
+
+// Feeds a TimeSeriesStore with one sample per second:
+//   if:<interface>:rx / tx / rxpk / txpk   bytes and packets from /proc/net/dev
+//   proc:<name>:rx / tx                    TCP bytes per process name
+// Each point is the amount moved since the previous sample and series
+// roll up by Sum, so a minute point is that minute's total; divide by the
+// resolution's width for a rate. Process series only get points while
+// the process is moving data (plus one zero when it stops), so idle
+// processes cost nothing. The store is snapshotted periodically and when
+// the sampler stops. Intended to live on the same worker thread as the
+// ConnectionMonitor it listens to.
+class TrafficHistory : public QObject
+{
+    Q_OBJECT
+
+public:
+    TrafficHistory(TimeSeriesStore *store, const QString &snapshotPath, QObject *parent = nullptr);
+
+public slots:
+    void start();
+    void stop();
+    void onConnectionDiff(const ConnectionDiff &diff);
+
+private slots:
+    void sample();
+    void saveSnapshot();
+
+private:
+    struct InterfaceCounters
+    {
+        quint64 rxBytes = 0;
+        quint64 rxPackets = 0;
+        quint64 txBytes = 0;
+        quint64 txPackets = 0;
+        int series[4] = { -1, -1, -1, -1 };
+    };
+
+    struct ProcessSeries
+    {
+        int rx = -1;
+        int tx = -1;
+        bool wasActive = false;
+    };
+
+    void sampleInterfaces(qint64 now);
+    void sampleProcesses(qint64 now);
+
+    TimeSeriesStore *store;
+    QString snapshotPath;
+    QTimer sampleTimer;
+    QTimer snapshotTimer;
+    qint64 lastSampleTime = 0;
+
+    QHash<QString, InterfaceCounters> interfaces;
+    QHash<qint32, QString> processNames;
+    QHash<QString, ProcessTraffic> pendingTraffic;  // Since the last sample
+    QHash<QString, ProcessSeries> processes;
+};
+
+#endif // TRAFFICHISTORY_H
@@ -0,0 +1,479 @@
+#include "vpnprober.h"
+#include "vpntunnel.h"
+#include <QDateTime>
+#include <QFile>
+#include <QHostInfo>
+#include <QRandomGenerator>
+#include <QStringList>
+#include <QtEndian>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+const int kTickMs = 5;
+// Probes in flight; sequence numbers index it modulo its size
+const quint64 kRingSize = 8192;
+const int kSocketBufferBytes = 1 << 20;
+const double kRttGain = 0.125;
+const double kJitterGain = 0.25;
+const double kLossGain = 0.125;
+// Keeps a server that lost everything ranked, far down
+const double kMaxLoss = 0.95;
+const qint64 kCacheMaxAgeSecs = 7 * 24 * 3600;
+const char kCacheMagic[8] = { 'R', 'H', 'L', 'A', 'T', 'C', '0', '1' };
+const quint32 kCacheVersion = 1;
+
+struct CacheHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 entryCount;
+    quint64 keysBytes;
+    qint64 savedAt;
+};
+
+struct CacheEntry
+{
+    double rttMs;
+    double jitterMs;
+    double loss;
+    qint64 measuredAt;
+    quint32 keyOffset;
+    quint32 keyLength;
+};
+
+QString cacheKey(const VpnServer &server)
+{
+    return server.address + ':' + QString::number(server.port);
+}
+
+} // namespace
+
+double ServerLatency::score() const
+{
+    if (!measured())
+        return std::numeric_limits<double>::infinity();
+    return (rttMs + 2 * jitterMs) / (1 - qMin(loss, kMaxLoss));
+}
+
+bool VpnProber::readServerList(const QString &path, QVector<VpnServer> *servers, QString *error)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        *error = file.errorString();
+        return false;
+    }
+    servers->clear();
+    int lineNumber = 0;
+    while (!file.atEnd()) {
+        ++lineNumber;
+        QString line = QString::fromUtf8(file.readLine());
+        const int comment = line.indexOf('#');
+        if (comment >= 0)
+            line.truncate(comment);
+        line = line.trimmed();
+        if (line.isEmpty())
+            continue;
+        const QStringList fields = line.split(',');
+        VpnServer server;
+        bool valid = fields.size() >= 2 && fields.size() <= 6;
+        if (valid) {
+            server.name = fields[0].trimmed();
+            server.address = fields[1].trimmed();
+            valid = !server.address.isEmpty();
+        }
+        if (valid && fields.size() > 2 && !fields[2].trimmed().isEmpty()) {
+            const uint port = fields[2].trimmed().toUInt(&valid);
+            valid = valid && port > 0 && port <= 65535;
+            server.port = quint16(port);
+        }
+        if (fields.size() > 3)
+            server.country = fields[3].trimmed();
+        if (fields.size() > 4)
+            server.city = fields[4].trimmed();
+        if (valid && fields.size() > 5 && !fields[5].trimmed().isEmpty()) {
+            server.load = fields[5].trimmed().toInt(&valid);
+            valid = valid && server.load >= 0 && server.load <= 100;
+        }
+        if (!valid) {
+            *error = QString("Line %1: expected name,address[,port[,country[,city[,load]]]]").arg(lineNumber);
+            return false;
+        }
+        if (server.name.isEmpty())
+            server.name = server.address;
+        servers->append(server);
+    }
+    return true;
+}
+
+VpnProber::VpnProber(QObject *parent)
+    : QObject(parent), socket(this), timer(this), proberId(QRandomGenerator::global()->generate()),
+      inFlight(kRingSize)
+{
+    timer.setTimerType(Qt::PreciseTimer);
+    connect(&timer, &QTimer::timeout, this, &VpnProber::onTick);
+    connect(&socket, &QUdpSocket::readyRead, this, &VpnProber::onReadyRead);
+}
+
+VpnProber::~VpnProber()
+{
+    stop();
+}
+
+void VpnProber::setOptions(const Options &options)
+{
+    if (!isRunning())
+        settings = options;
+}
+
+void VpnProber::setServers(const QVector<VpnServer> &servers)
+{
+    ++generation;
+    serverList = servers;
+    const size_t count = size_t(servers.size());
+    addresses.assign(count, QHostAddress());
+    lookupPending.assign(count, 0);
+    results.assign(count, ServerLatency());
+    scores.resize(count);
+    order.resize(count);
+    ranks.resize(count);
+    oldestSequence = nextSequence;
+    due.clear();
+
+    for (size_t i = 0; i < count; ++i) {
+        const auto cached = cache.constFind(cacheKey(servers[int(i)]));
+        if (cached != cache.constEnd()) {
+            results[i] = cached.value();
+            results[i].sent = 0;
+            results[i].received = 0;
+            results[i].cached = true;
+        }
+        scores[i] = results[i].score();
+        order[i] = int(i);
+        resolve(int(i));
+    }
+    std::sort(order.begin(), order.end(), [this](int a, int b) { return ranksBefore(a, b); });
+    for (size_t rank = 0; rank < count; ++rank)
+        ranks[size_t(order[rank])] = int(rank);
+
+    if (isRunning()) {
+        for (size_t i = 0; i < count; ++i)
+            due.emplace_back(0, int(i));
+    }
+    if (best() != lastBest) {
+        lastBest = best();
+        emit bestChanged(lastBest);
+    }
+}
+
+void VpnProber::resolve(int server)
+{
+    const QString &name = serverList[server].address;
+    QHostAddress address;
+    if (address.setAddress(name)) {
+        addresses[size_t(server)] = address;
+        return;
+    }
+    lookupPending[size_t(server)] = 1;
+    const int lookupGeneration = generation;
+    QHostInfo::lookupHost(name, this, [this, server, lookupGeneration](const QHostInfo &info) {
+        if (lookupGeneration != generation)
+            return;
+        lookupPending[size_t(server)] = 0;
+        // Prefer IPv4, which the socket reaches on every host
+        for (const QHostAddress &found : info.addresses()) {
+            if (addresses[size_t(server)].isNull() || found.protocol() == QAbstractSocket::IPv4Protocol)
+                addresses[size_t(server)] = found;
+            if (found.protocol() == QAbstractSocket::IPv4Protocol)
+                break;
+        }
+    });
+}
+
+int VpnProber::best() const
+{
+    if (order.empty() || !results[size_t(order.front())].measured())
+        return -1;
+    return order.front();
+}
+
+void VpnProber::start()
+{
+    if (isRunning())
+        return;
+    if (socket.state() != QAbstractSocket::BoundState && !socket.bind(QHostAddress::Any, 0)) {
+        lastError = socket.errorString();
+        emit error(QString("Cannot open the probe socket: %1").arg(lastError));
+        return;
+    }
+    socket.setSocketOption(QAbstractSocket::ReceiveBufferSizeSocketOption, kSocketBufferBytes);
+
+    // Every server is due at once; the pacing spreads the first round out
+    clock.start();
+    lastTickNs = 0;
+    sendCredit = 1;
+    oldestSequence = nextSequence;
+    due.clear();
+    for (int i = 0; i < serverList.size(); ++i)
+        due.emplace_back(0, i);
+    timer.start(kTickMs);
+}
+
+void VpnProber::stop()
+{
+    timer.stop();
+    socket.close();
+    // Probes still out are neither answered nor lost
+    oldestSequence = nextSequence;
+    due.clear();
+}
+
+void VpnProber::onTick()
+{
+    const qint64 now = clock.nsecsElapsed();
+    expireProbes(now);
+
+    const double burst = qMax(1.0, 2.0 * settings.probesPerSecond * kTickMs / 1000.0);
+    sendCredit = qMin(burst, sendCredit + double(now - lastTickNs) * settings.probesPerSecond / 1e9);
+    lastTickNs = now;
+    const qint64 intervalNs = qint64(settings.intervalMs) * 1000000;
+    while (sendCredit >= 1 && !due.empty() && due.front().first <= now) {
+        const int server = due.front().second;
+        if (addresses[size_t(server)].isNull()) {
+            due.pop_front();
+            // Still resolving; a failed lookup drops the server
+            if (lookupPending[size_t(server)])
+                due.emplace_back(now + intervalNs, server);
+            continue;
+        }
+        if (!sendProbe(server, now))
+            break;
+        due.pop_front();
+        due.emplace_back(now + intervalNs, server);
+        sendCredit -= 1;
+    }
+}
+
+bool VpnProber::sendProbe(int server, qint64 nowNs)
+{
+    if (nextSequence - oldestSequence >= kRingSize)
+        return false;
+    uchar probe[VpnTunnel::kHeaderSize];
+    memset(probe, 0, sizeof(probe));
+    probe[0] = VpnTunnel::kProbeType;
+    qToBigEndian(proberId, probe + 4);
+    qToBigEndian(nextSequence, probe + 8);
+    ++results[size_t(server)].sent;
+    if (socket.writeDatagram(reinterpret_cast<const char *>(probe), sizeof(probe), addresses[size_t(server)],
+                             serverList[server].port) < 0) {
+        // Unreachable network and the like
+        record(server, -1);
+        return true;
+    }
+    Probe &slot = inFlight[nextSequence % kRingSize];
+    slot.server = server;
+    slot.sentNs = nowNs;
+    ++nextSequence;
+    return true;
+}
+
+void VpnProber::expireProbes(qint64 nowNs)
+{
+    const qint64 timeoutNs = qint64(settings.timeoutMs) * 1000000;
+    while (oldestSequence < nextSequence) {
+        Probe &probe = inFlight[oldestSequence % kRingSize];
+        if (probe.server >= 0) {
+            if (nowNs - probe.sentNs < timeoutNs)
+                break;
+            const int server = probe.server;
+            probe.server = -1;
+            record(server, -1);
+        }
+        ++oldestSequence;
+    }
+}
+
+void VpnProber::onReadyRead()
+{
+    const qint64 now = clock.nsecsElapsed();
+    while (socket.hasPendingDatagrams()) {
+        uchar reply[VpnTunnel::kHeaderSize + 1];
+        QHostAddress from;
+        quint16 port = 0;
+        const qint64 length = socket.readDatagram(reinterpret_cast<char *>(reply), sizeof(reply), &from, &port);
+        if (length != VpnTunnel::kHeaderSize || reply[0] != VpnTunnel::kProbeReplyType
+            || qFromBigEndian<quint32>(reply + 4) != proberId)
+            continue;
+        const quint64 sequence = qFromBigEndian<quint64>(reply + 8);
+        if (sequence < oldestSequence || sequence >= nextSequence)
+            continue;
+        Probe &probe = inFlight[sequence % kRingSize];
+        if (probe.server < 0 || port != serverList[probe.server].port
+            || !from.isEqual(addresses[size_t(probe.server)], QHostAddress::ConvertV4MappedToIPv4))
+            continue;
+        const int server = probe.server;
+        probe.server = -1;
+        record(server, double(now - probe.sentNs) / 1e6);
+    }
+}
+
+void VpnProber::record(int server, double rttMs)
+{
+    ServerLatency &result = results[size_t(server)];
+    if (rttMs < 0) {
+        result.loss += kLossGain * (1 - result.loss);
+    } else {
+        ++result.received;
+        result.measuredAt = QDateTime::currentSecsSinceEpoch();
+        if (!result.measured() || result.cached) {
+            // A cached result is from another network, perhaps
+            result.rttMs = rttMs;
+            result.jitterMs = 0;
+            result.cached = false;
+        } else {
+            result.jitterMs += kJitterGain * (std::fabs(result.rttMs - rttMs) - result.jitterMs);
+            result.rttMs += kRttGain * (rttMs - result.rttMs);
+        }
+        result.loss -= kLossGain * result.loss;
+    }
+    rerank(server);
+}
+
+bool VpnProber::ranksBefore(int a, int b) const
+{
+    const double scoreA = scores[size_t(a)];
+    const double scoreB = scores[size_t(b)];
+    return scoreA < scoreB || (scoreA == scoreB && a < b);
+}
+
+void VpnProber::rerank(int server)
+{
+    const int from = ranks[size_t(server)];
+    scores[size_t(server)] = results[size_t(server)].score();
+
+    // Scores change a little per result, so the server moves a few places
+    int at = from;
+    while (at > 0 && ranksBefore(server, order[size_t(at - 1)])) {
+        order[size_t(at)] = order[size_t(at - 1)];
+        ranks[size_t(order[size_t(at)])] = at;
+        --at;
+    }
+    while (at + 1 < int(order.size()) && ranksBefore(order[size_t(at + 1)], server)) {
+        order[size_t(at)] = order[size_t(at + 1)];
+        ranks[size_t(order[size_t(at)])] = at;
+        ++at;
+    }
+    order[size_t(at)] = server;
+    ranks[size_t(server)] = at;
+
+    emit latencyUpdated(server, from, at);
+    if (best() != lastBest) {
+        lastBest = best();
+        emit bestChanged(lastBest);
+    }
+}
+
+bool VpnProber::loadCache(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        lastError = file.errorString();
+        return false;
+    }
+    const QByteArray data = file.readAll();
+    CacheHeader header;
+    if (size_t(data.size()) < sizeof(header)) {
+        lastError = "Latency cache is truncated";
+        return false;
+    }
+    memcpy(&header, data.constData(), sizeof(header));
+    if (memcmp(header.magic, kCacheMagic, sizeof(header.magic)) != 0 || header.version != kCacheVersion) {
+        lastError = "Not a latency cache, or from an incompatible version";
+        return false;
+    }
+    const quint64 entriesBytes = quint64(header.entryCount) * sizeof(CacheEntry);
+    if (sizeof(header) + entriesBytes + header.keysBytes != quint64(data.size())) {
+        lastError = "Latency cache is truncated";
+        return false;
+    }
+
+    const char *entries = data.constData() + sizeof(header);
+    const char *keys = entries + entriesBytes;
+    const qint64 oldest = QDateTime::currentSecsSinceEpoch() - kCacheMaxAgeSecs;
+    cache.clear();
+    for (quint32 i = 0; i < header.entryCount; ++i) {
+        CacheEntry entry;
+        memcpy(&entry, entries + i * sizeof(entry), sizeof(entry));
+        if (quint64(entry.keyOffset) + entry.keyLength > header.keysBytes) {
+            lastError = "Latency cache is corrupt";
+            cache.clear();
+            return false;
+        }
+        if (entry.measuredAt < oldest || !(entry.rttMs >= 0))
+            continue;
+        ServerLatency result;
+        result.rttMs = entry.rttMs;
+        result.jitterMs = entry.jitterMs;
+        result.loss = qBound(0.0, entry.loss, 1.0);
+        result.measuredAt = entry.measuredAt;
+        result.cached = true;
+        cache.insert(QString::fromUtf8(keys + entry.keyOffset, int(entry.keyLength)), result);
+    }
+    return true;
+}
+
+bool VpnProber::saveCache(const QString &path)
+{
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (results[i].measured())
+            cache.insert(cacheKey(serverList[int(i)]), results[i]);
+    }
+
+    QByteArray entries;
+    QByteArray keys;
+    const qint64 oldest = QDateTime::currentSecsSinceEpoch() - kCacheMaxAgeSecs;
+    for (auto it = cache.constBegin(); it != cache.constEnd(); ++it) {
+        if (it.value().measuredAt < oldest)
+            continue;
+        const QByteArray key = it.key().toUtf8();
+        CacheEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.rttMs = it.value().rttMs;
+        entry.jitterMs = it.value().jitterMs;
+        entry.loss = it.value().loss;
+        entry.measuredAt = it.value().measuredAt;
+        entry.keyOffset = quint32(keys.size());
+        entry.keyLength = quint32(key.size());
+        entries.append(reinterpret_cast<const char *>(&entry), int(sizeof(entry)));
+        keys.append(key);
+    }
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kCacheMagic, sizeof(header.magic));
+    header.version = kCacheVersion;
+    header.entryCount = quint32(entries.size() / int(sizeof(CacheEntry)));
+    header.keysBytes = quint64(keys.size());
+    header.savedAt = QDateTime::currentSecsSinceEpoch();
+
+    const QString temporaryPath = path + ".new";
+    QFile file(temporaryPath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)
+        || file.write(reinterpret_cast<const char *>(&header), sizeof(header)) != qint64(sizeof(header))
+        || file.write(entries) != entries.size() || file.write(keys) != keys.size()) {
+        lastError = file.errorString();
+        file.remove();
+        return false;
+    }
+    file.close();
+    if (std::rename(QFile::encodeName(temporaryPath).constData(), QFile::encodeName(path).constData()) != 0) {
+        lastError = QString("Cannot replace %1").arg(path);
+        QFile::remove(temporaryPath);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,157 @@
+#ifndef VPNPROBER_H
+#define VPNPROBER_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QHostAddress>
+#include <QObject>
+#include <QString>
+#include <QTimer>
+#include <QUdpSocket>
+#include <QVector>
+#include <deque>
+#include <utility>
+#include <vector>
+
+struct VpnServer
+{
+    QString name;
+    QString address;              // IP address or host name
+    quint16 port = 51820;
+    QString country;
+    QString city;
+    int load = -1;                // Percent busy as the list says, -1 if it does not
+};
+
+// What the prober knows of one server. Round trip and jitter are smoothed
+// with TCP's gains (RFC 6298: 1/8 and 1/4), loss with the round trip's.
+struct ServerLatency
+{
+    double rttMs = -1;            // -1 until a reply arrives or the cache has one
+    double jitterMs = 0;          // Mean deviation of the round trip
+    double loss = 0;              // Smoothed fraction of probes lost, 0..1
+    quint32 sent = 0;             // This run
+    quint32 received = 0;
+    qint64 measuredAt = 0;        // Seconds since the epoch of the last reply
+    bool cached = false;          // From an earlier run, no reply yet in this one
+
+    bool measured() const { return rttMs >= 0; }
+    // Lower is better: round trip plus two deviations, stretched by loss.
+    // Infinite while unmeasured.
+    double score() const;
+};
+
+// Measures round trip, jitter and loss to hundreds of VPN servers at once
+// and keeps them ranked. A probe is a bare tunnel header of type
+// VpnTunnel::kProbeType carrying our id and a sequence number, which the
+// server echoes with VpnTunnel::kProbeReplyType.
+//
+// Everything runs on the owning thread's event loop: one unconnected UDP
+// socket for all servers, a pacing timer that spreads probes to
+// probesPerSecond, and asynchronous lookups for host names. Probes in
+// flight sit in a ring indexed by sequence number, so replies and
+// timeouts cost O(1). Each result moves its server within the ranking by
+// insertion rather than resorting, and says where it moved from and to.
+//
+// Results outlive the run in a cache keyed by address and port, so the
+// ranking is usable the moment the server list is set at startup.
+class VpnProber : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Options
+    {
+        int intervalMs = 2000;         // Between probes to one server
+        int timeoutMs = 1000;          // A probe unanswered this long is lost
+        int probesPerSecond = 1000;    // Across all servers
+    };
+
+    // One server per line: name,address[,port[,country[,city[,load]]]],
+    // where an empty port is the default; '#' starts a comment
+    static bool readServerList(const QString &path, QVector<VpnServer> *servers, QString *error);
+
+    explicit VpnProber(QObject *parent = nullptr);
+    ~VpnProber();
+
+    // Only while stopped
+    void setOptions(const Options &options);
+    Options options() const { return settings; }
+    // Replaces the servers and their results; those the cache knows start
+    // out ranked by their cached results
+    void setServers(const QVector<VpnServer> &servers);
+    const QVector<VpnServer> &servers() const { return serverList; }
+
+    // Results of earlier runs; entries older than a week are dropped
+    bool loadCache(const QString &path);
+    // Writes the measured servers over what was loaded
+    bool saveCache(const QString &path);
+    QString errorString() const { return lastError; }
+
+    void start();
+    void stop();
+    bool isRunning() const { return timer.isActive(); }
+
+    const ServerLatency &latency(int server) const { return results[size_t(server)]; }
+    // Server indices best first; unmeasured servers last, in list order
+    const std::vector<int> &ranking() const { return order; }
+    int rankOf(int server) const { return ranks[size_t(server)]; }
+    // -1 while no server has a result
+    int best() const;
+    // Takes a round trip measured elsewhere, the tunnel's own traffic say;
+    // negative for a loss
+    void addResult(int server, double rttMs) { record(server, rttMs); }
+
+signals:
+    // A probe was answered or lost, moving the server from one rank to
+    // another (often the same)
+    void latencyUpdated(int server, int fromRank, int toRank);
+    void bestChanged(int server);
+    void error(const QString &message);
+
+private slots:
+    void onTick();
+    void onReadyRead();
+
+private:
+    struct Probe
+    {
+        int server = -1;              // -1 once answered or expired
+        qint64 sentNs = 0;
+    };
+
+    bool sendProbe(int server, qint64 nowNs);
+    void expireProbes(qint64 nowNs);
+    // A negative round trip records a loss
+    void record(int server, double rttMs);
+    void rerank(int server);
+    bool ranksBefore(int a, int b) const;
+    void resolve(int server);
+
+    Options settings;
+    QUdpSocket socket;
+    QTimer timer;
+    QElapsedTimer clock;
+    quint32 proberId = 0;
+    QVector<VpnServer> serverList;
+    std::vector<QHostAddress> addresses;       // Null until resolved
+    std::vector<char> lookupPending;
+    std::vector<ServerLatency> results;
+    std::vector<double> scores;                // score() of each server as ranked
+    std::vector<int> order;
+    std::vector<int> ranks;
+    int lastBest = -1;
+    // Servers in the order they are due a probe; every server waits the
+    // same interval, so appending keeps it sorted
+    std::deque<std::pair<qint64, int>> due;
+    std::vector<Probe> inFlight;
+    quint64 nextSequence = 0;
+    quint64 oldestSequence = 0;
+    double sendCredit = 0;
+    qint64 lastTickNs = 0;
+    int generation = 0;                        // Outdates host lookups from an earlier list
+    QHash<QString, ServerLatency> cache;
+    QString lastError;
+};
+
+#endif // VPNPROBER_H
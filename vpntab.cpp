@@ -0,0 +1,411 @@
+#include "vpntab.h"
+#include "daemonclient.h"
+#include <QFile>
+#include <QFileDialog>
+#include <QHBoxLayout>
+#include <QHeaderView>
+#include <QLocale>
+#include <QSettings>
+#include <QVBoxLayout>
+
+namespace {
+
+// The daemon's tunnel publishes its counters this often
+const int kDaemonPollMs = 1000;
+
+} // namespace
+
+VpnTab::VpnTab(const QString &latencyCachePath, MetricsBus *metrics, DaemonClient *daemon, QWidget *parent)
+    : QWidget(parent), daemon(daemon), cachePath(latencyCachePath)
+{
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->setContentsMargins(0, 10, 0, 0);
+    layout->setSpacing(10);
+
+    const VpnTunnel::Options defaults;
+    QSettings settings("Rhynec", "RhynecSecurity");
+
+    // Server row: an imported list, probed for the fastest server
+    QHBoxLayout *serverLayout = new QHBoxLayout();
+    serverListButton = createActionButton("Server list...");
+    useBestButton = createActionButton("Use best");
+    useBestButton->setEnabled(false);
+    bestLabel = new QLabel("Import a list of servers (name,address[,port[,country[,city[,load]]]] per line) to find the fastest", this);
+    bestLabel->setStyleSheet("color: #777777;");
+    connect(serverListButton, &QPushButton::clicked, this, &VpnTab::onServerListClicked);
+    connect(useBestButton, &QPushButton::clicked, this, &VpnTab::onUseBestClicked);
+    serverLayout->addWidget(serverListButton);
+    serverLayout->addWidget(useBestButton);
+    serverLayout->addSpacing(12);
+    serverLayout->addWidget(bestLabel, 1);
+    layout->addLayout(serverLayout);
+
+    // The servers fastest first, narrowed by the search as it is typed
+    prober = new VpnProber(this);
+    searchEdit = new QLineEdit(this);
+    searchEdit->setPlaceholderText("Search servers by name, country, city or address");
+    searchEdit->setClearButtonEnabled(true);
+    searchEdit->setVisible(false);
+    connect(searchEdit, &QLineEdit::textEdited, this, &VpnTab::onSearchEdited);
+    layout->addWidget(searchEdit);
+
+    serverModel = new ServerCatalogModel(prober, this);
+    serverView = new QTableView(this);
+    serverView->setModel(serverModel);
+    serverView->setSelectionBehavior(QAbstractItemView::SelectRows);
+    serverView->setShowGrid(false);
+    serverView->setAlternatingRowColors(true);
+    serverView->verticalHeader()->hide();
+    // Fixed row heights keep scrolling independent of the row count
+    serverView->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+    serverView->verticalHeader()->setDefaultSectionSize(24);
+    serverView->horizontalHeader()->setStretchLastSection(true);
+    serverView->setColumnWidth(ServerCatalogModel::NameColumn, 200);
+    serverView->setColumnWidth(ServerCatalogModel::AddressColumn, 200);
+    serverView->setStyleSheet(
+        "QTableView { border: 1px solid #e0e0e0; border-radius: 4px; background-color: white; }"
+        "QHeaderView::section { background-color: #f8f8f8; border: none; padding: 6px; }"
+        );
+    serverView->setVisible(false);
+    connect(serverView, &QTableView::clicked, this, &VpnTab::onServerClicked);
+    layout->addWidget(serverView, 1);
+
+    // Peer row: where the other end listens, and our own port
+    QHBoxLayout *peerLayout = new QHBoxLayout();
+    peerEdit = new QLineEdit(settings.value("Vpn/Peer").toString(), this);
+    peerEdit->setPlaceholderText("Peer address");
+    peerEdit->setMaximumWidth(220);
+    peerPortSpin = new QSpinBox(this);
+    peerPortSpin->setRange(1, 65535);
+    peerPortSpin->setValue(settings.value("Vpn/PeerPort", defaults.peerPort).toInt());
+    listenPortSpin = new QSpinBox(this);
+    listenPortSpin->setRange(1, 65535);
+    listenPortSpin->setValue(settings.value("Vpn/ListenPort", defaults.listenPort).toInt());
+    peerLayout->addWidget(new QLabel("Peer", this));
+    peerLayout->addWidget(peerEdit);
+    peerLayout->addWidget(new QLabel("port", this));
+    peerLayout->addWidget(peerPortSpin);
+    peerLayout->addSpacing(12);
+    peerLayout->addWidget(new QLabel("Listen on port", this));
+    peerLayout->addWidget(listenPortSpin);
+    peerLayout->addStretch(1);
+    layout->addLayout(peerLayout);
+
+    // Tunnel row: our address inside the tunnel and the shared key
+    QHBoxLayout *tunnelLayout = new QHBoxLayout();
+    addressEdit = new QLineEdit(settings.value("Vpn/Address", defaults.address).toString(), this);
+    addressEdit->setPlaceholderText("10.77.0.1/24");
+    addressEdit->setMaximumWidth(160);
+    keyEdit = new QLineEdit(settings.value("Vpn/Key").toString(), this);
+    keyEdit->setPlaceholderText("Shared key (64 hex digits)");
+    keyEdit->setEchoMode(QLineEdit::PasswordEchoOnEdit);
+    keyEdit->setMinimumWidth(260);
+    newKeyButton = createActionButton("New key");
+    connectButton = createActionButton("Connect");
+    connect(newKeyButton, &QPushButton::clicked, this, &VpnTab::onNewKeyClicked);
+    connect(connectButton, &QPushButton::clicked, this, &VpnTab::onConnectClicked);
+    tunnelLayout->addWidget(new QLabel("Tunnel address", this));
+    tunnelLayout->addWidget(addressEdit);
+    tunnelLayout->addSpacing(12);
+    tunnelLayout->addWidget(new QLabel("Key", this));
+    tunnelLayout->addWidget(keyEdit, 1);
+    tunnelLayout->addWidget(newKeyButton);
+    tunnelLayout->addWidget(connectButton);
+    layout->addLayout(tunnelLayout);
+
+    statusLabel = new QLabel("Not connected", this);
+    statsLabel = new QLabel(daemon->isAttached()
+                                ? "Both ends need the same key; rhynec-daemon creates the tunnel device"
+                                : "Both ends need the same key; creating the tunnel device needs CAP_NET_ADMIN",
+                            this);
+    statsLabel->setStyleSheet("color: #777777;");
+    layout->addWidget(statusLabel);
+    layout->addWidget(statsLabel);
+    // Takes the slack only while the server view is hidden
+    layout->addStretch();
+
+    tunnel = new VpnTunnel(this);
+    tunnel->setMetricsBus(metrics);
+    connect(tunnel, &VpnTunnel::statsUpdated, this, &VpnTab::onTunnelStats);
+    connect(tunnel, &VpnTunnel::error, this, &VpnTab::onTunnelError);
+    connect(tunnel, &QThread::finished, this, &VpnTab::onTunnelFinished);
+
+    daemonPoll.setInterval(kDaemonPollMs);
+    connect(&daemonPoll, &QTimer::timeout, this, &VpnTab::onDaemonTunnelPoll);
+    connect(daemon, &DaemonClient::detached, this, &VpnTab::onDaemonDetached);
+
+    connect(prober, &VpnProber::latencyUpdated, this, &VpnTab::onLatencyUpdated);
+    connect(prober, &VpnProber::error, bestLabel, &QLabel::setText);
+    // A missing cache just means nothing was probed before
+    if (QFile::exists(cachePath))
+        prober->loadCache(cachePath);
+    const QString serverListPath = settings.value("Vpn/ServerList").toString();
+    if (!serverListPath.isEmpty() && loadServers(serverListPath) && peerEdit->text().isEmpty() && prober->best() >= 0)
+        usePeer(prober->best());
+
+    // A tunnel left up by the last window
+    if (daemon->isAttached())
+        onDaemonTunnelPoll();
+}
+
+VpnTab::~VpnTab()
+{
+    if (!prober->servers().isEmpty())
+        prober->saveCache(cachePath);
+}
+
+QPushButton* VpnTab::createActionButton(const QString &text)
+{
+    QPushButton *button = new QPushButton(text, this);
+    button->setCursor(Qt::PointingHandCursor);
+    button->setFocusPolicy(Qt::NoFocus);
+    button->setStyleSheet(
+        "QPushButton {"
+        "   border: none;"
+        "   border-radius: 4px;"
+        "   background-color: #f8f8f8;"
+        "   padding: 6px 12px;"
+        "}"
+        "QPushButton:hover { background-color: #f0f0f0; }"
+        "QPushButton:pressed { background-color: #e8e8e8; }"
+        );
+    return button;
+}
+
+void VpnTab::setFormEnabled(bool enabled)
+{
+    serverListButton->setEnabled(enabled);
+    useBestButton->setEnabled(enabled && prober->best() >= 0);
+    searchEdit->setEnabled(enabled);
+    serverView->setEnabled(enabled);
+    peerEdit->setEnabled(enabled);
+    peerPortSpin->setEnabled(enabled);
+    listenPortSpin->setEnabled(enabled);
+    addressEdit->setEnabled(enabled);
+    keyEdit->setEnabled(enabled);
+    newKeyButton->setEnabled(enabled);
+}
+
+bool VpnTab::loadServers(const QString &path)
+{
+    QVector<VpnServer> servers;
+    QString failure;
+    if (!VpnProber::readServerList(path, &servers, &failure)) {
+        bestLabel->setText(QString("Cannot read %1: %2").arg(path, failure));
+        return false;
+    }
+    prober->stop();
+    prober->setServers(servers);
+    serverModel->reload();
+    searchEdit->setVisible(!servers.isEmpty());
+    serverView->setVisible(!servers.isEmpty());
+    showBest();
+    if (!tunnelUp() && !servers.isEmpty())
+        prober->start();
+    return true;
+}
+
+void VpnTab::usePeer(int server)
+{
+    const VpnServer &entry = prober->servers().at(server);
+    peerEdit->setText(entry.address);
+    peerPortSpin->setValue(entry.port);
+}
+
+void VpnTab::showBest()
+{
+    const int server = prober->best();
+    useBestButton->setEnabled(server >= 0 && !tunnelUp());
+    if (server < 0) {
+        bestLabel->setText(QString("Probing %1 servers...").arg(prober->servers().size()));
+        return;
+    }
+    const ServerLatency &latency = prober->latency(server);
+    bestLabel->setText(QString("Best of %1: %2, %3 ms%4")
+                           .arg(prober->servers().size())
+                           .arg(prober->servers().at(server).name)
+                           .arg(latency.rttMs, 0, 'f', 1)
+                           .arg(latency.cached ? " when last probed" : ""));
+}
+
+void VpnTab::onServerListClicked()
+{
+    const QString path = QFileDialog::getOpenFileName(this, tr("Server List"), QString(),
+                                                      tr("Server lists (*.csv *.txt);;All files (*)"));
+    if (path.isEmpty() || !loadServers(path))
+        return;
+    QSettings settings("Rhynec", "RhynecSecurity");
+    settings.setValue("Vpn/ServerList", path);
+}
+
+void VpnTab::onUseBestClicked()
+{
+    if (prober->best() >= 0)
+        usePeer(prober->best());
+}
+
+void VpnTab::onSearchEdited(const QString &text)
+{
+    serverModel->setFilter(text);
+}
+
+void VpnTab::onServerClicked(const QModelIndex &index)
+{
+    usePeer(serverModel->serverAt(index.row()));
+}
+
+// The model moves the rows itself; only the best server is ours to show
+void VpnTab::onLatencyUpdated(int server, int fromRank, int toRank)
+{
+    Q_UNUSED(server);
+    if (fromRank == 0 || toRank == 0)
+        showBest();
+}
+
+void VpnTab::onNewKeyClicked()
+{
+    keyEdit->setText(QString::fromLatin1(VpnTunnel::generateKey().toHex()));
+    statsLabel->setText("Copy the new key to the peer before connecting");
+}
+
+void VpnTab::onConnectClicked()
+{
+    if (daemonTunnel) {
+        if (!daemon->stopTunnel())
+            statusLabel->setText("The daemon did not stop the tunnel: " + daemon->errorString());
+        // Shows the whole run, and the form again once it is down
+        onDaemonTunnelPoll();
+        return;
+    }
+    if (tunnel->isRunning()) {
+        tunnel->requestStop();
+        return;
+    }
+
+    VpnTunnel::Options options;
+    options.peerAddress = peerEdit->text().trimmed();
+    options.peerPort = quint16(peerPortSpin->value());
+    options.listenPort = quint16(listenPortSpin->value());
+    options.address = addressEdit->text().trimmed();
+    options.key = QByteArray::fromHex(keyEdit->text().trimmed().toLatin1());
+    if (options.key.size() != ChaCha20Poly1305::kKeySize) {
+        statusLabel->setText("The key must be 64 hex digits");
+        return;
+    }
+
+    QSettings settings("Rhynec", "RhynecSecurity");
+    settings.setValue("Vpn/Peer", options.peerAddress);
+    settings.setValue("Vpn/PeerPort", options.peerPort);
+    settings.setValue("Vpn/ListenPort", options.listenPort);
+    settings.setValue("Vpn/Address", options.address);
+    settings.setValue("Vpn/Key", keyEdit->text().trimmed());
+
+    // Probes would share the uplink with the tunnel
+    prober->stop();
+    if (!prober->servers().isEmpty())
+        prober->saveCache(cachePath);
+
+    if (daemon->isAttached()) {
+        if (!daemon->startTunnel(options)) {
+            statusLabel->setText("The daemon did not start the tunnel: " + daemon->errorString());
+            // It may already run one, started from another window
+            onDaemonTunnelPoll();
+            return;
+        }
+        daemonTunnel = true;
+        daemonPoll.start();
+    } else {
+        tunnel->setOptions(options);
+        tunnel->start();
+    }
+    showConnected(options);
+}
+
+void VpnTab::showConnected(const VpnTunnel::Options &options)
+{
+    statusLabel->setText(QString("Connected to %1 port %2 as %3 on %4%5")
+                             .arg(options.peerAddress)
+                             .arg(options.peerPort)
+                             .arg(options.address)
+                             .arg(options.interfaceName)
+                             .arg(daemonTunnel ? " through rhynec-daemon" : ""));
+    connectButton->setText("Disconnect");
+    setFormEnabled(false);
+}
+
+void VpnTab::onTunnelStats(const VpnStats &stats)
+{
+    statsLabel->setText(
+        QString("Sent %1 (%2 Gbit/s)  ·  received %3 (%4 Gbit/s)  ·  %5 queues (%12 keyed) on %11, %6 crypto, GSO %7, GRO %8  ·  "
+                "%9 dropped, %10 rejected")
+            .arg(QLocale().formattedDataSize(qint64(stats.txBytes)))
+            .arg(stats.txGbps, 0, 'f', 2)
+            .arg(QLocale().formattedDataSize(qint64(stats.rxBytes)))
+            .arg(stats.rxGbps, 0, 'f', 2)
+            .arg(stats.queues)
+            .arg(stats.crypto)
+            .arg(stats.gso ? "on" : "off")
+            .arg(stats.gro ? "on" : "off")
+            .arg(QLocale().toString(stats.dropped))
+            .arg(QLocale().toString(stats.authFailures + stats.replays))
+            .arg(stats.io)
+            .arg(stats.sessions));
+}
+
+void VpnTab::onTunnelError(const QString &message)
+{
+    statusLabel->setText(message);
+}
+
+void VpnTab::onTunnelFinished()
+{
+    if (statusLabel->text().startsWith("Connected"))
+        statusLabel->setText("Not connected");
+    connectButton->setText("Connect");
+    setFormEnabled(true);
+    if (!prober->servers().isEmpty())
+        prober->start();
+}
+
+void VpnTab::onDaemonTunnelPoll()
+{
+    VpnStats stats;
+    bool running = false;
+    QString failure;
+    VpnTunnel::Options options;
+    if (!daemon->queryTunnel(&stats, &running, &failure, &options)) {
+        // A slow answer is tried again on the next tick; a daemon that went
+        // away is handled by onDaemonDetached()
+        if (daemonTunnel)
+            statsLabel->setText("No tunnel counters from the daemon: " + daemon->errorString());
+        return;
+    }
+    if (running && !daemonTunnel) {
+        daemonTunnel = true;
+        daemonPoll.start();
+        prober->stop();
+        showConnected(options);
+    }
+    if (!daemonTunnel)
+        return;
+    if (stats.queues > 0)
+        onTunnelStats(stats);
+    if (running)
+        return;
+    daemonTunnel = false;
+    daemonPoll.stop();
+    onTunnelFinished();
+    if (!failure.isEmpty())
+        onTunnelError(failure);
+}
+
+void VpnTab::onDaemonDetached()
+{
+    if (!daemonTunnel)
+        return;
+    // The tunnel went down with it
+    daemonTunnel = false;
+    daemonPoll.stop();
+    onTunnelFinished();
+    statusLabel->setText("Not connected: rhynec-daemon went away");
+}
@@ -0,0 +1,82 @@
+#ifndef VPNTAB_H
+#define VPNTAB_H
+
+#include <QWidget>
+#include <QLabel>
+#include <QLineEdit>
+#include <QPushButton>
+#include <QSpinBox>
+#include <QTableView>
+#include <QTimer>
+#include "servercatalogmodel.h"
+#include "vpnprober.h"
+#include "vpntunnel.h"
+
+class DaemonClient;
+
+// Content page for the VPN tab: one tunnel to a configured peer. The form
+// is remembered between runs, the pre-shared key included. Servers from an
+// imported list are probed while disconnected and listed fastest first,
+// narrowed by a search as it is typed; their latency is cached in
+// latencyCachePath, so the best server is known the moment the tab opens.
+//
+// While `daemon` is attached the tunnel runs in rhynec-daemon, which
+// holds the privileges its TUN device needs, and its counters are asked
+// for once a second; a tunnel the daemon already runs is picked up when
+// the tab opens. Without a daemon the tunnel runs here, as before, and
+// its queues count their packets on `metrics`.
+class VpnTab : public QWidget
+{
+    Q_OBJECT
+
+public:
+    VpnTab(const QString &latencyCachePath, MetricsBus *metrics, DaemonClient *daemon, QWidget *parent = nullptr);
+    ~VpnTab();
+
+private slots:
+    void onConnectClicked();
+    void onNewKeyClicked();
+    void onServerListClicked();
+    void onUseBestClicked();
+    void onSearchEdited(const QString &text);
+    void onServerClicked(const QModelIndex &index);
+    void onLatencyUpdated(int server, int fromRank, int toRank);
+    void onTunnelStats(const VpnStats &stats);
+    void onTunnelError(const QString &message);
+    void onTunnelFinished();
+    void onDaemonTunnelPoll();
+    void onDaemonDetached();
+
+private:
+    QPushButton* createActionButton(const QString &text);
+    void setFormEnabled(bool enabled);
+    bool loadServers(const QString &path);
+    void usePeer(int server);
+    void showBest();
+    void showConnected(const VpnTunnel::Options &options);
+    bool tunnelUp() const { return daemonTunnel || tunnel->isRunning(); }
+
+    VpnTunnel *tunnel;
+    DaemonClient *daemon;
+    QTimer daemonPoll;
+    bool daemonTunnel = false;              // Up in the daemon, as far as we know
+    VpnProber *prober;
+    QString cachePath;
+    QLineEdit *peerEdit;
+    QSpinBox *peerPortSpin;
+    QSpinBox *listenPortSpin;
+    QLineEdit *addressEdit;
+    QLineEdit *keyEdit;
+    QPushButton *newKeyButton;
+    QPushButton *connectButton;
+    QLabel *statusLabel;
+    QLabel *statsLabel;
+    QPushButton *serverListButton;
+    QPushButton *useBestButton;
+    QLabel *bestLabel;
+    QLineEdit *searchEdit;
+    ServerCatalogModel *serverModel;
+    QTableView *serverView;
+};
+
+#endif // VPNTAB_H
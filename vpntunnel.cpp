@@ -0,0 +1,1505 @@
+#include "vpntunnel.h"
+#include "iouring.h"
+#include "metricsbus.h"
+#include "packetbufferpool.h"
+#include <QElapsedTimer>
+#include <QHostAddress>
+#include <QMessageAuthenticationCode>
+#include <QMutexLocker>
+#include <QRandomGenerator>
+#include <QtEndian>
+#include <algorithm>
+#include <cstring>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <fcntl.h>
+#include <linux/if_tun.h>
+#include <linux/io_uring.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Older C libraries lack the UDP offload options (Linux 4.18 / 5.0)
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#endif
+
+namespace {
+
+const int kPollMs = 50;
+const qint64 kPublishIntervalNs = 1000000000;
+const quint8 kDataType = 1;
+// Hello: type, a flags byte asking for a reply, 2 reserved bytes, the
+// sender's session nonce, the newest nonce it heard from us, and an
+// HMAC-SHA256 of all that under the pre-shared key
+const quint8 kHelloType = 4;
+const quint8 kHelloWantsReply = 1;
+const int kSessionNonceSize = 32;
+const int kHelloMacOffset = 4 + 2 * kSessionNonceSize;
+const int kHelloSize = kHelloMacOffset + 32;
+const qint64 kHelloIntervalNs = 250000000;
+const qint64 kHelloReplyGapNs = 20000000;
+// Peer nonces a queue has moved on from, refused if they come back
+const int kRetiredNonces = 8;
+const char kKeyLabel[] = "rhynec tunnel v1";
+// The kernel takes at most 64 segments, and one IP datagram, per GSO send
+const int kMaxSegments = 64;
+const int kMaxGsoBytes = 65000;
+const int kGroBufferSize = 65536;
+const int kGroBatch = 16;
+const int kSocketBufferBytes = 4 << 20;
+const int kReplayWindow = 256;
+// Datagrams authenticated together
+const int kOpenBatch = 64;
+const unsigned kRingEntries = 256;
+// Completion waits allowed for cancelled requests to finish at stop
+const int kCancelWaits = 20;
+
+} // namespace
+
+#ifdef Q_OS_LINUX
+
+// One TUN queue and its UDP socket; everything here belongs to the
+// queue's thread except the counters, which the publisher reads
+class VpnTunnel::Queue
+{
+public:
+    Queue(int tunFd, int udpFd, const VpnTunnel::Options &options, MetricsBus *metricsBus);
+    ~Queue();
+
+    void run(const std::atomic<bool> &stopRequested);
+    void addTo(VpnStats *stats) const;
+
+    QString failure;    // Read once the thread has finished
+    std::atomic<bool> gso { false };
+    std::atomic<bool> gro { false };
+    std::atomic<bool> keyed { false };   // Session keys agreed with the peer
+
+private:
+    // Counters have one writer, so a relaxed load and store is enough
+    struct Counter
+    {
+        std::atomic<quint64> value { 0 };
+        void add(quint64 n) { value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+        quint64 load() const { return value.load(std::memory_order_relaxed); }
+    };
+
+    // Bitmap ring over the newest counters of the current session; one
+    // spare word so a full window survives the partly used newest word.
+    // Only a new session key empties it.
+    struct ReplayWindow
+    {
+        static const int kWords = kReplayWindow / 64 + 1;
+
+        bool active = false;
+        quint64 highest = 0;
+        quint64 bits[kWords] = {};
+
+        bool acceptable(quint64 counter) const
+        {
+            if (!active || counter > highest)
+                return true;
+            if (highest - counter >= quint64(kReplayWindow))
+                return false;
+            return !((bits[(counter / 64) % kWords] >> (counter % 64)) & 1);
+        }
+
+        void record(quint64 counter)
+        {
+            if (!active) {
+                active = true;
+                highest = counter;
+            } else if (counter > highest) {
+                const quint64 first = highest / 64 + 1;
+                const quint64 last = counter / 64;
+                for (quint64 word = first; word <= last && word - first < quint64(kWords); ++word)
+                    bits[word % kWords] = 0;
+                highest = counter;
+            }
+            bits[(counter / 64) % kWords] |= quint64(1) << (counter % 64);
+        }
+
+        void reset()
+        {
+            active = false;
+            highest = 0;
+            memset(bits, 0, sizeof(bits));
+        }
+    };
+
+    // What a ring request was, in the top half of its user_data; the
+    // bottom half is a buffer or send slot
+    enum RingOperation {
+        TunRead = 1,
+        PeerReceive,
+        TunWrite,
+        PeerSend,
+        Echo,
+        Cancel
+    };
+
+    // A sendmsg in flight: a GSO run of ring buffers
+    struct SendSlot
+    {
+        msghdr header;
+        iovec iov[kMaxSegments];
+        quint16 buffers[kMaxSegments];
+        uchar control[CMSG_SPACE(sizeof(int))];
+    };
+
+    int fromTun();
+    int fromPeer();
+    void stage(uchar *buffer, int length);
+    void send(int first, int count);
+    void deliver(uchar *datagram, int length);
+    void openPending();
+    void countSealed(int count);
+    void countDelivered(quint64 length);
+    void countAuthFailure();
+
+    // The session: Hellos carry each end's nonce and echo the other's,
+    // and an end that hears its own nonce echoed takes the peer's and
+    // derives the keys
+    void maintainSession();
+    void sendHello();
+    void onHello(const uchar *hello);
+    void adopt(const uchar *nonce);
+    bool settled() const;
+    void dropStaged();
+
+    // The io_uring loop; false, with ioFallback set, where it cannot run
+    bool runRing(const std::atomic<bool> &stopRequested);
+    bool setupRing(QString *reason);
+    void stopRing();
+    io_uring_sqe *takeSqe();
+    void armTunRead();
+    void armPeerReceive();
+    bool complete(const io_uring_cqe &completion, QString *unsupported);
+    void onTunRead(const io_uring_cqe &completion);
+    void onPeerReceive(const io_uring_cqe &completion);
+    void sealStaged();
+    void queueSends(const quint16 *buffers, int count);
+    void onSent(int slot, int result);
+    void queueTunWrite(int buffer, const uchar *data, size_t length);
+    void releaseRx(int buffer);
+
+    int tunFd;
+    int udpFd;
+    int mtu;
+    int batchSize;
+    bool useRing;
+    uchar sharedKey[ChaCha20Poly1305::kKeySize];
+    uchar txKey[ChaCha20Poly1305::kKeySize];
+    uchar rxKey[ChaCha20Poly1305::kKeySize];
+    uchar localNonce[kSessionNonceSize];
+    uchar peerNonce[kSessionNonceSize];     // The one the keys came from
+    uchar heardNonce[kSessionNonceSize];    // The newest authentic one
+    std::vector<QByteArray> retiredNonces;
+    bool heard = false;
+    quint32 sender;                         // Ours and the peer's, from
+    quint32 peerSender = 0;                 // the first nonce bytes
+    QElapsedTimer clock;
+    qint64 helloSentNs = -1;
+    // Counters run for the life of the queue, across session keys
+    quint64 nextCounter = 0;
+    ReplayWindow window;
+
+    // Send buffers are taken per batch and returned once sent; receive
+    // buffers stay posted to recvmmsg
+    PacketBufferPool txPool;
+    std::vector<uchar *> txBuffers;
+    std::vector<int> txLengths;
+    std::vector<ChaCha20Poly1305::Packet> txSeal;
+    std::vector<iovec> txIov;
+    std::vector<mmsghdr> txMessages;
+    std::vector<uchar> txControl;
+    int rxCount;
+    int rxBufferSize;
+    PacketBufferPool rxPool;
+    std::vector<iovec> rxIov;
+    std::vector<mmsghdr> rxMessages;
+    std::vector<uchar> rxControl;
+    // Received datagrams that passed the header checks, opened as a batch
+    ChaCha20Poly1305::Packet rxOpen[kOpenBatch];
+    bool rxAuthentic[kOpenBatch];
+    int rxPending = 0;
+    int txStaged = 0;
+    quint64 txStagedBytes = 0;
+
+    // The ring, its buffers, and the requests in flight. Multishot
+    // requests count as one until their last completion.
+    IoUring ring;
+    std::atomic<int> ioState { 0 };    // 1 once on the ring, 2 once on poll()
+    QString ioFallback;                // Set before ioState becomes 2
+    std::unique_ptr<PacketBufferPool> ringTxArena;
+    std::unique_ptr<PacketBufferPool> ringRxArena;
+    std::vector<uchar *> ringTx;       // By buffer id, in group 1
+    std::vector<int> ringTxLengths;
+    std::vector<quint16> ringStaged;   // Ids of the staged datagrams
+    std::vector<uchar *> ringRx;       // By buffer id, in group 0
+    std::vector<int> rxReferences;     // The receive being handled, then its writes
+    quint16 rxOpenBuffer[kOpenBatch];
+    int rxCurrent = -1;                // Buffer being delivered on the ring
+    int ringRxSize = 0;
+    IoUring::BufferRing tunGroup;
+    IoUring::BufferRing peerGroup;
+    int tunPosted = 0;                 // Provided and not yet filled
+    int peerPosted = 0;
+    bool tunArmed = false;
+    bool peerArmed = false;
+    bool tunReadProven = false;        // The multishot TUN read has delivered
+    int inFlight = 0;
+    msghdr peerReceiveHeader;
+    std::vector<SendSlot> sendSlots;
+    std::vector<int> freeSlots;
+
+    Counter txPackets;
+    Counter txBytes;
+    Counter rxPackets;
+    Counter rxBytes;
+    Counter tunReads;
+    Counter tunWrites;
+    Counter sendCalls;
+    Counter receiveCalls;
+    Counter authFailures;
+    Counter replays;
+    Counter dropped;
+    Counter handshakes;
+    Counter syscalls;
+
+    // Mirrors of the counters above on the metrics bus, and the size of
+    // each sealed batch as a sample; null without a bus
+    MetricsBus *metricsBus;
+    std::shared_ptr<MetricsProducer> metrics;
+    int txPacketsMetric = -1;
+    int txBytesMetric = -1;
+    int rxPacketsMetric = -1;
+    int rxBytesMetric = -1;
+    int authFailuresMetric = -1;
+    int batchMetric = -1;
+};
+
+namespace {
+
+const size_t kControlSize = CMSG_SPACE(sizeof(int));
+
+bool enableOption(int fd, int level, int option, int value)
+{
+    return setsockopt(fd, level, option, &value, sizeof(value)) == 0;
+}
+
+} // namespace
+
+VpnTunnel::Queue::Queue(int tunFd, int udpFd, const VpnTunnel::Options &options, MetricsBus *metricsBus)
+    : gso(enableOption(udpFd, SOL_UDP, UDP_SEGMENT, 0)),   // Fails only where the kernel lacks GSO
+      gro(enableOption(udpFd, SOL_UDP, UDP_GRO, 1)),
+      tunFd(tunFd), udpFd(udpFd), mtu(options.mtu), batchSize(qBound(1, options.batchSize, 1024)),
+      useRing(options.ioUring),
+      txPool(batchSize, options.mtu + kOverhead), txBuffers(size_t(batchSize)), txLengths(size_t(batchSize)),
+      txSeal(size_t(batchSize)),
+      txIov(size_t(batchSize)), txMessages(size_t(batchSize)), txControl(kControlSize * size_t(batchSize)),
+      // Coalesced receives need room for a whole run, so fewer buffers
+      rxCount(gro.load() ? qMin(batchSize, kGroBatch) : batchSize),
+      rxBufferSize(gro.load() ? kGroBufferSize : options.mtu + kOverhead),
+      rxPool(rxCount, rxBufferSize), rxIov(size_t(rxCount)), rxMessages(size_t(rxCount)),
+      rxControl(kControlSize * size_t(rxCount)), metricsBus(metricsBus)
+{
+    memcpy(sharedKey, options.key.constData(), sizeof(sharedKey));
+    QRandomGenerator::system()->fillRange(reinterpret_cast<quint32 *>(localNonce), kSessionNonceSize / 4);
+    sender = qFromBigEndian<quint32>(localNonce);
+    clock.start();
+    if (metricsBus) {
+        txPacketsMetric = metricsBus->metric("vpn.tx.packets", MetricsBus::Counter);
+        txBytesMetric = metricsBus->metric("vpn.tx.bytes", MetricsBus::Counter, "B");
+        rxPacketsMetric = metricsBus->metric("vpn.rx.packets", MetricsBus::Counter);
+        rxBytesMetric = metricsBus->metric("vpn.rx.bytes", MetricsBus::Counter, "B");
+        authFailuresMetric = metricsBus->metric("vpn.auth.failures", MetricsBus::Counter);
+        batchMetric = metricsBus->metric("vpn.tx.batch", MetricsBus::Sample, "packets");
+        // A full registry leaves the queue off the bus
+        if (std::min({ txPacketsMetric, txBytesMetric, rxPacketsMetric, rxBytesMetric, authFailuresMetric, batchMetric }) < 0)
+            this->metricsBus = nullptr;
+    }
+
+    memset(rxMessages.data(), 0, sizeof(mmsghdr) * rxMessages.size());
+    for (int i = 0; i < rxCount; ++i) {
+        rxIov[i].iov_base = rxPool.take();
+        rxIov[i].iov_len = size_t(rxBufferSize);
+        rxMessages[i].msg_hdr.msg_iov = &rxIov[i];
+        rxMessages[i].msg_hdr.msg_iovlen = 1;
+        rxMessages[i].msg_hdr.msg_control = &rxControl[kControlSize * size_t(i)];
+    }
+}
+
+VpnTunnel::Queue::~Queue()
+{
+    memset(sharedKey, 0, sizeof(sharedKey));
+    memset(txKey, 0, sizeof(txKey));
+    memset(rxKey, 0, sizeof(rxKey));
+    ::close(tunFd);
+    ::close(udpFd);
+}
+
+void VpnTunnel::Queue::run(const std::atomic<bool> &stopRequested)
+{
+    if (metricsBus)
+        metrics = metricsBus->attach("VPN queue");
+    if (!useRing)
+        ioFallback = "turned off";
+    if (!useRing || !runRing(stopRequested)) {
+        ioState.store(2, std::memory_order_release);
+        pollfd fds[2] = { { tunFd, POLLIN, 0 }, { udpFd, POLLIN, 0 } };
+        while (!stopRequested.load(std::memory_order_relaxed) && failure.isEmpty()) {
+            maintainSession();
+            const int sent = fromTun();
+            const int received = fromPeer();
+            if (sent == 0 && received == 0) {
+                poll(fds, 2, kPollMs);
+                syscalls.add(1);
+            }
+        }
+    }
+    if (metrics)
+        metrics->retire();
+}
+
+void VpnTunnel::Queue::countSealed(int count)
+{
+    txPackets.add(quint64(count));
+    txBytes.add(txStagedBytes);
+    if (metrics) {
+        metrics->add(txPacketsMetric, quint64(count));
+        metrics->add(txBytesMetric, txStagedBytes);
+        metrics->record(batchMetric, count);
+    }
+}
+
+void VpnTunnel::Queue::countDelivered(quint64 length)
+{
+    rxPackets.add(1);
+    rxBytes.add(length);
+    if (metrics) {
+        metrics->add(rxPacketsMetric);
+        metrics->add(rxBytesMetric, length);
+    }
+}
+
+void VpnTunnel::Queue::countAuthFailure()
+{
+    authFailures.add(1);
+    if (metrics)
+        metrics->add(authFailuresMetric);
+}
+
+// Says hello until the peer has our nonce and we have its newest one
+void VpnTunnel::Queue::maintainSession()
+{
+    if (!settled() && (helloSentNs < 0 || clock.nsecsElapsed() - helloSentNs >= kHelloIntervalNs))
+        sendHello();
+}
+
+bool VpnTunnel::Queue::settled() const
+{
+    return keyed.load(std::memory_order_relaxed) && heard && memcmp(heardNonce, peerNonce, kSessionNonceSize) == 0;
+}
+
+// Hellos are rare and small, so they go out directly on either loop
+void VpnTunnel::Queue::sendHello()
+{
+    uchar hello[kHelloSize];
+    hello[0] = kHelloType;
+    hello[1] = settled() ? 0 : kHelloWantsReply;
+    hello[2] = hello[3] = 0;
+    memcpy(hello + 4, localNonce, kSessionNonceSize);
+    if (heard)
+        memcpy(hello + 4 + kSessionNonceSize, heardNonce, kSessionNonceSize);
+    else
+        memset(hello + 4 + kSessionNonceSize, 0, kSessionNonceSize);
+    const QByteArray mac = QMessageAuthenticationCode::hash(
+        QByteArray::fromRawData(reinterpret_cast<const char *>(hello), kHelloMacOffset),
+        QByteArray::fromRawData(reinterpret_cast<const char *>(sharedKey), sizeof(sharedKey)), QCryptographicHash::Sha256);
+    memcpy(hello + kHelloMacOffset, mac.constData(), size_t(kHelloSize - kHelloMacOffset));
+    ::send(udpFd, hello, sizeof(hello), MSG_DONTWAIT);
+    syscalls.add(1);
+    helloSentNs = clock.nsecsElapsed();
+}
+
+void VpnTunnel::Queue::onHello(const uchar *hello)
+{
+    const QByteArray mac = QMessageAuthenticationCode::hash(
+        QByteArray::fromRawData(reinterpret_cast<const char *>(hello), kHelloMacOffset),
+        QByteArray::fromRawData(reinterpret_cast<const char *>(sharedKey), sizeof(sharedKey)), QCryptographicHash::Sha256);
+    uchar difference = 0;
+    for (int i = 0; i < kHelloSize - kHelloMacOffset; ++i)
+        difference |= uchar(mac[i]) ^ hello[kHelloMacOffset + i];
+    if (difference != 0) {
+        countAuthFailure();
+        return;
+    }
+    const uchar *nonce = hello + 4;
+    const uchar *echo = hello + 4 + kSessionNonceSize;
+    // A Hello from a session we moved on from is a replay
+    const QByteArray nonceBytes(reinterpret_cast<const char *>(nonce), kSessionNonceSize);
+    if (std::find(retiredNonces.begin(), retiredNonces.end(), nonceBytes) != retiredNonces.end()) {
+        replays.add(1);
+        return;
+    }
+    memcpy(heardNonce, nonce, kSessionNonceSize);
+    heard = true;
+
+    // Our nonce echoed proves the Hello is from the peer's current run
+    bool adopted = false;
+    if (memcmp(echo, localNonce, kSessionNonceSize) == 0
+        && (!keyed.load(std::memory_order_relaxed) || memcmp(nonce, peerNonce, kSessionNonceSize) != 0)) {
+        adopt(nonce);
+        adopted = true;
+    }
+    const bool wantsReply = hello[1] & kHelloWantsReply;
+    const bool due = helloSentNs < 0 || clock.nsecsElapsed() - helloSentNs >= kHelloReplyGapNs;
+    if ((wantsReply && (adopted || due)) || (!settled() && due))
+        sendHello();
+}
+
+// Datagrams queued under the old keys are opened with them first; the
+// counter carries on, and the window starts over with the new keys
+void VpnTunnel::Queue::adopt(const uchar *nonce)
+{
+    openPending();
+    if (keyed.load(std::memory_order_relaxed)) {
+        if (int(retiredNonces.size()) == kRetiredNonces)
+            retiredNonces.erase(retiredNonces.begin());
+        retiredNonces.emplace_back(reinterpret_cast<const char *>(peerNonce), kSessionNonceSize);
+    }
+    memcpy(peerNonce, nonce, kSessionNonceSize);
+    peerSender = qFromBigEndian<quint32>(peerNonce);
+
+    // One key per direction: HMAC(PSK, label || sender's nonce || receiver's nonce)
+    const QByteArray secret = QByteArray::fromRawData(reinterpret_cast<const char *>(sharedKey), sizeof(sharedKey));
+    const QByteArray ours = QByteArray::fromRawData(reinterpret_cast<const char *>(localNonce), kSessionNonceSize);
+    const QByteArray theirs = QByteArray::fromRawData(reinterpret_cast<const char *>(peerNonce), kSessionNonceSize);
+    QMessageAuthenticationCode tx(QCryptographicHash::Sha256, secret);
+    tx.addData(kKeyLabel, int(sizeof(kKeyLabel)) - 1);
+    tx.addData(ours);
+    tx.addData(theirs);
+    QMessageAuthenticationCode rx(QCryptographicHash::Sha256, secret);
+    rx.addData(kKeyLabel, int(sizeof(kKeyLabel)) - 1);
+    rx.addData(theirs);
+    rx.addData(ours);
+    memcpy(txKey, tx.result().constData(), sizeof(txKey));
+    memcpy(rxKey, rx.result().constData(), sizeof(rxKey));
+
+    window.reset();
+    keyed.store(true, std::memory_order_relaxed);
+    handshakes.add(1);
+}
+
+// Packets read from the TUN before there are keys to seal them with
+void VpnTunnel::Queue::dropStaged()
+{
+    for (int i = 0; i < txStaged; ++i) {
+        if (ioState.load(std::memory_order_relaxed) == 1) {
+            const quint16 id = ringStaged[size_t(i)];
+            IoUring::provideBuffer(&tunGroup, ringTx[id] + kHeaderSize, unsigned(mtu), id);
+            ++tunPosted;
+        } else {
+            txPool.give(txBuffers[i]);
+        }
+    }
+    dropped.add(quint64(txStaged));
+    txStaged = 0;
+    txStagedBytes = 0;
+}
+
+int VpnTunnel::Queue::fromTun()
+{
+    int reads = 0;
+    while (txStaged < batchSize) {
+        uchar *buffer = txPool.take();
+        const ssize_t length = read(tunFd, buffer + kHeaderSize, size_t(mtu));
+        ++reads;
+        if (length <= 0) {
+            txPool.give(buffer);
+            if (length < 0 && errno != EAGAIN && errno != EINTR)
+                failure = QString("TUN read: %1").arg(strerror(errno));
+            break;
+        }
+        stage(buffer, int(length));
+    }
+    tunReads.add(quint64(reads));
+    syscalls.add(quint64(reads));
+    const int count = txStaged;
+    if (count == 0)
+        return 0;
+    if (!keyed.load(std::memory_order_relaxed)) {
+        dropStaged();
+        return count;
+    }
+
+    // The whole batch at once, so short packets share SIMD lanes
+    ChaCha20Poly1305::sealBatch(txKey, txSeal.data(), count);
+    send(0, count);
+    for (int i = 0; i < count; ++i)
+        txPool.give(txBuffers[i]);
+    countSealed(count);
+    txStaged = 0;
+    txStagedBytes = 0;
+    return count;
+}
+
+// Frames a packet read into buffer + kHeaderSize for the next seal
+void VpnTunnel::Queue::stage(uchar *buffer, int length)
+{
+    buffer[0] = kDataType;
+    buffer[1] = buffer[2] = buffer[3] = 0;
+    qToBigEndian(sender, buffer + 4);
+    qToBigEndian(nextCounter++, buffer + 8);
+    uchar *payload = buffer + kHeaderSize;
+    txSeal[txStaged] = { buffer + 4, buffer, kHeaderSize, payload, payload, size_t(length), payload + length };
+    txBuffers[txStaged] = buffer;
+    txLengths[txStaged] = length + kOverhead;
+    txStagedBytes += quint64(length);
+    ++txStaged;
+}
+
+void VpnTunnel::Queue::send(int first, int count)
+{
+    const bool segment = gso.load(std::memory_order_relaxed);
+    int messages = 0;
+    int i = first;
+    while (i < first + count) {
+        // A run of equal sizes, ended early by one shorter datagram, goes
+        // out as one GSO send the kernel splits at `size`
+        const int start = i;
+        const int size = txLengths[i];
+        int total = 0;
+        do {
+            txIov[i].iov_base = txBuffers[i];
+            txIov[i].iov_len = size_t(txLengths[i]);
+            total += txLengths[i];
+            ++i;
+        } while (segment && i < first + count && i - start < kMaxSegments && txLengths[i - 1] == size
+                 && txLengths[i] <= size && total + txLengths[i] <= kMaxGsoBytes);
+
+        mmsghdr &message = txMessages[messages];
+        memset(&message, 0, sizeof(message));
+        message.msg_hdr.msg_iov = &txIov[start];
+        message.msg_hdr.msg_iovlen = size_t(i - start);
+        if (i - start > 1) {
+            cmsghdr *control = reinterpret_cast<cmsghdr *>(&txControl[kControlSize * size_t(messages)]);
+            control->cmsg_level = SOL_UDP;
+            control->cmsg_type = UDP_SEGMENT;
+            control->cmsg_len = CMSG_LEN(sizeof(quint16));
+            const quint16 segmentSize = quint16(size);
+            memcpy(CMSG_DATA(control), &segmentSize, sizeof(segmentSize));
+            message.msg_hdr.msg_control = control;
+            message.msg_hdr.msg_controllen = CMSG_SPACE(sizeof(quint16));
+        }
+        ++messages;
+    }
+
+    int done = 0;
+    while (done < messages) {
+        const int sent = sendmmsg(udpFd, &txMessages[done], unsigned(messages - done), 0);
+        sendCalls.add(1);
+        syscalls.add(1);
+        if (sent > 0) {
+            done += sent;
+            continue;
+        }
+        if (errno == EINTR)
+            continue;
+        int unsent = 0;
+        for (int m = done; m < messages; ++m)
+            unsent += int(txMessages[m].msg_hdr.msg_iovlen);
+        if (segment && (errno == EIO || errno == EINVAL)) {
+            // The route cannot segment (no checksum offload, say): fall
+            // back to one datagram per message for good
+            gso.store(false);
+            send(first + count - unsent, unsent);
+            return;
+        }
+        // Full socket buffer, or the peer's ICMP errors: drop the rest
+        dropped.add(quint64(unsent));
+        return;
+    }
+}
+
+int VpnTunnel::Queue::fromPeer()
+{
+    for (int i = 0; i < rxCount; ++i)
+        rxMessages[i].msg_hdr.msg_controllen = kControlSize;
+    const int received = recvmmsg(udpFd, rxMessages.data(), unsigned(rxCount), MSG_DONTWAIT, nullptr);
+    receiveCalls.add(1);
+    syscalls.add(1);
+    if (received <= 0)
+        return 0;
+
+    for (int i = 0; i < received; ++i) {
+        const msghdr &header = rxMessages[i].msg_hdr;
+        uchar *buffer = static_cast<uchar *>(rxIov[i].iov_base);
+        const int length = int(rxMessages[i].msg_len);
+        if (header.msg_flags & MSG_TRUNC) {
+            dropped.add(1);
+            continue;
+        }
+        int segment = length;
+        for (cmsghdr *control = CMSG_FIRSTHDR(&header); control; control = CMSG_NXTHDR(const_cast<msghdr *>(&header), control)) {
+            if (control->cmsg_level == SOL_UDP && control->cmsg_type == UDP_GRO) {
+                memcpy(&segment, CMSG_DATA(control), sizeof(segment));
+                break;
+            }
+        }
+        if (segment <= 0)
+            segment = length;
+        for (int offset = 0; offset < length; offset += segment)
+            deliver(buffer + offset, qMin(segment, length - offset));
+    }
+    // Before recvmmsg reuses the buffers
+    openPending();
+    return received;
+}
+
+void VpnTunnel::Queue::deliver(uchar *datagram, int length)
+{
+    if (length == kHeaderSize && datagram[0] == kProbeType) {
+        datagram[0] = kProbeReplyType;
+        if (rxCurrent < 0) {
+            ::send(udpFd, datagram, size_t(length), MSG_DONTWAIT);
+            syscalls.add(1);
+            return;
+        }
+        io_uring_sqe *entry = takeSqe();
+        entry->opcode = IORING_OP_SEND;
+        entry->fd = 1;
+        entry->flags = IOSQE_FIXED_FILE;
+        entry->addr = quint64(quintptr(datagram));
+        entry->len = unsigned(length);
+        entry->user_data = quint64(Echo) << 32 | quint64(rxCurrent);
+        ++rxReferences[size_t(rxCurrent)];
+        ++inFlight;
+        return;
+    }
+    if (length == kHelloSize && datagram[0] == kHelloType) {
+        onHello(datagram);
+        return;
+    }
+    // Data from anyone but the current session fails before the tag check
+    if (length < kOverhead || datagram[0] != kDataType || !keyed.load(std::memory_order_relaxed)
+        || qFromBigEndian<quint32>(datagram + 4) != peerSender) {
+        countAuthFailure();
+        return;
+    }
+    const quint64 counter = qFromBigEndian<quint64>(datagram + 8);
+    if (!window.acceptable(counter)) {
+        replays.add(1);
+        return;
+    }
+    const size_t size = size_t(length - kOverhead);
+    uchar *payload = datagram + kHeaderSize;
+    if (rxCurrent >= 0) {
+        rxOpenBuffer[rxPending] = quint16(rxCurrent);
+        ++rxReferences[size_t(rxCurrent)];
+    }
+    rxOpen[rxPending++] = { datagram + 4, datagram, kHeaderSize, payload, payload, size, payload + size };
+    if (rxPending == kOpenBatch)
+        openPending();
+}
+
+// Authenticates the queued datagrams together and writes the authentic
+// ones to the TUN in the order they arrived; on the ring, the writes are
+// queued and each datagram holds its receive buffer until written
+void VpnTunnel::Queue::openPending()
+{
+    if (rxPending == 0)
+        return;
+    const bool onRing = ioState.load(std::memory_order_relaxed) == 1;
+    ChaCha20Poly1305::openBatch(rxKey, rxOpen, rxPending, rxAuthentic);
+    for (int i = 0; i < rxPending; ++i) {
+        const ChaCha20Poly1305::Packet &packet = rxOpen[i];
+        // Only an authentic datagram may move the window, and a batch may
+        // hold one counter twice
+        const quint64 counter = qFromBigEndian<quint64>(packet.ad + 8);
+        if (!rxAuthentic[i] || !window.acceptable(counter)) {
+            if (!rxAuthentic[i])
+                countAuthFailure();
+            else
+                replays.add(1);
+            if (onRing)
+                releaseRx(rxOpenBuffer[i]);
+            continue;
+        }
+        window.record(counter);
+
+        tunWrites.add(1);
+        if (onRing) {
+            queueTunWrite(rxOpenBuffer[i], packet.output, packet.length);
+            continue;
+        }
+        syscalls.add(1);
+        if (write(tunFd, packet.output, packet.length) < 0) {
+            dropped.add(1);
+            continue;
+        }
+        countDelivered(quint64(packet.length));
+    }
+    rxPending = 0;
+}
+
+void VpnTunnel::Queue::addTo(VpnStats *stats) const
+{
+    stats->txPackets += txPackets.load();
+    stats->txBytes += txBytes.load();
+    stats->rxPackets += rxPackets.load();
+    stats->rxBytes += rxBytes.load();
+    stats->tunReads += tunReads.load();
+    stats->tunWrites += tunWrites.load();
+    stats->sendCalls += sendCalls.load();
+    stats->receiveCalls += receiveCalls.load();
+    stats->authFailures += authFailures.load();
+    stats->replays += replays.load();
+    stats->dropped += dropped.load();
+    stats->syscalls += syscalls.load();
+    stats->handshakes += handshakes.load();
+    stats->sessions += keyed.load(std::memory_order_relaxed) ? 1 : 0;
+    stats->gso = stats->gso || gso.load();
+    stats->gro = stats->gro || gro.load();
+    // A queue that has not yet picked leaves the others to say
+    const int state = ioState.load(std::memory_order_acquire);
+    if (state != 0 && !stats->io.startsWith("poll"))
+        stats->io = state == 1 ? QString("io_uring") : QString("poll (%1)").arg(ioFallback);
+}
+
+bool VpnTunnel::Queue::runRing(const std::atomic<bool> &stopRequested)
+{
+    if (!setupRing(&ioFallback)) {
+        stopRing();
+        return false;
+    }
+    ioState.store(1, std::memory_order_release);
+
+    while (!stopRequested.load(std::memory_order_relaxed) && failure.isEmpty()) {
+        maintainSession();
+        if (!tunArmed && tunPosted > 0)
+            armTunRead();
+        if (!peerArmed && peerPosted > 0)
+            armPeerReceive();
+        IoUring::publishBuffers(&tunGroup);
+        IoUring::publishBuffers(&peerGroup);
+
+        const int result = ring.submitAndWait(1, qint64(kPollMs) * 1000000);
+        syscalls.add(1);
+        if (result < 0) {
+            failure = QString("io_uring_enter: %1").arg(strerror(-result));
+            break;
+        }
+        QString unsupported;
+        while (io_uring_cqe *completion = ring.peekCompletion()) {
+            const io_uring_cqe entry = *completion;
+            ring.consumeCompletion();
+            if (!complete(entry, &unsupported))
+                break;
+        }
+        if (!unsupported.isEmpty()) {
+            // The kernel took the requests but not for these files: go
+            // back to poll() before anything has moved
+            ioFallback = unsupported;
+            ioState.store(0, std::memory_order_relaxed);
+            stopRing();
+            return false;
+        }
+        sealStaged();
+        openPending();
+    }
+    stopRing();
+    return true;
+}
+
+bool VpnTunnel::Queue::setupRing(QString *reason)
+{
+    // Deferred task running posts completions only when we wait, which
+    // only one thread may do
+    if (!ring.setup(kRingEntries, IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_COOP_TASKRUN,
+                    reason))
+        return false;
+    if (!ring.supports(IoUring::kOpReadMultishot) || !ring.supports(IORING_OP_RECVMSG)
+        || !ring.supports(IORING_OP_SENDMSG) || !ring.supports(IORING_OP_WRITE_FIXED)) {
+        *reason = "io_uring lacks multishot reads";
+        return false;
+    }
+    const int files[2] = { tunFd, udpFd };
+    if (!ring.registerFiles(files, 2, reason))
+        return false;
+
+    // Twice the batch, so the TUN keeps reading while a batch is sent
+    unsigned txCount = 1;
+    while (txCount < unsigned(batchSize) * 2)
+        txCount *= 2;
+    ringTxArena = std::make_unique<PacketBufferPool>(int(txCount), mtu + kOverhead);
+    ringTx.resize(txCount);
+    ringTxLengths.assign(txCount, 0);
+    ringStaged.resize(size_t(batchSize));
+    if (!ring.setupBufferRing(1, txCount, &tunGroup, reason))
+        return false;
+    for (unsigned id = 0; id < txCount; ++id) {
+        ringTx[id] = ringTxArena->take();
+        IoUring::provideBuffer(&tunGroup, ringTx[id] + kHeaderSize, unsigned(mtu), quint16(id));
+    }
+    tunPosted = int(txCount);
+
+    // A receive lands as io_uring_recvmsg_out, the control messages the
+    // header asks room for, then the datagram or GRO run
+    unsigned rxGroupSize = 1;
+    while (rxGroupSize < unsigned(rxCount))
+        rxGroupSize *= 2;
+    ringRxSize = int(sizeof(io_uring_recvmsg_out) + kControlSize) + rxBufferSize;
+    ringRxArena = std::make_unique<PacketBufferPool>(rxCount, ringRxSize);
+    ringRx.resize(size_t(rxCount));
+    rxReferences.assign(size_t(rxCount), 0);
+    std::vector<iovec> registered(static_cast<size_t>(rxCount));
+    for (int id = 0; id < rxCount; ++id) {
+        ringRx[size_t(id)] = ringRxArena->take();
+        registered[size_t(id)] = { ringRx[size_t(id)], size_t(ringRxSize) };
+    }
+    if (!ring.registerBuffers(registered.data(), unsigned(rxCount), reason)
+        || !ring.setupBufferRing(0, rxGroupSize, &peerGroup, reason))
+        return false;
+    for (int id = 0; id < rxCount; ++id)
+        IoUring::provideBuffer(&peerGroup, ringRx[size_t(id)], unsigned(ringRxSize), quint16(id));
+    peerPosted = rxCount;
+    memset(&peerReceiveHeader, 0, sizeof(peerReceiveHeader));
+    peerReceiveHeader.msg_controllen = kControlSize;
+
+    // A send holds at least one buffer, so there are never more sends
+    sendSlots.resize(txCount);
+    freeSlots.clear();
+    for (int slot = int(txCount) - 1; slot >= 0; --slot)
+        freeSlots.push_back(slot);
+    return true;
+}
+
+// Cancels what is still armed, waits a little for the kernel to let go
+// of the buffers, and frees the ring
+void VpnTunnel::Queue::stopRing()
+{
+    if (ring.isOpen() && inFlight > 0) {
+        io_uring_sqe *entry = takeSqe();
+        entry->opcode = IORING_OP_ASYNC_CANCEL;
+        entry->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+        entry->user_data = quint64(Cancel) << 32;
+        for (int wait = 0; wait < kCancelWaits && inFlight > 0; ++wait) {
+            if (ring.submitAndWait(1, qint64(kPollMs) * 1000000) < 0)
+                break;
+            syscalls.add(1);
+            while (io_uring_cqe *completion = ring.peekCompletion()) {
+                const quint64 operation = completion->user_data >> 32;
+                if (operation != Cancel && !(completion->flags & IORING_CQE_F_MORE))
+                    --inFlight;
+                ring.consumeCompletion();
+            }
+        }
+    }
+    ring.freeBufferRing(&tunGroup);
+    ring.freeBufferRing(&peerGroup);
+    ring.close();
+    // Staged datagrams were read but never sealed
+    txStaged = 0;
+    txStagedBytes = 0;
+    rxPending = 0;
+    inFlight = 0;
+    tunArmed = peerArmed = false;
+}
+
+// Submits what is queued when the submission queue is full
+io_uring_sqe *VpnTunnel::Queue::takeSqe()
+{
+    io_uring_sqe *entry;
+    while (!(entry = ring.nextSqe())) {
+        ring.submitAndWait(0, 0);
+        syscalls.add(1);
+    }
+    return entry;
+}
+
+void VpnTunnel::Queue::armTunRead()
+{
+    io_uring_sqe *entry = takeSqe();
+    entry->opcode = IoUring::kOpReadMultishot;
+    entry->fd = 0;
+    entry->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+    entry->buf_group = tunGroup.group;
+    entry->off = ~quint64(0);
+    entry->user_data = quint64(TunRead) << 32;
+    tunArmed = true;
+    ++inFlight;
+}
+
+void VpnTunnel::Queue::armPeerReceive()
+{
+    io_uring_sqe *entry = takeSqe();
+    entry->opcode = IORING_OP_RECVMSG;
+    entry->fd = 1;
+    entry->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+    entry->buf_group = peerGroup.group;
+    entry->addr = quint64(quintptr(&peerReceiveHeader));
+    entry->len = 1;
+    entry->ioprio = IORING_RECV_MULTISHOT;
+    entry->user_data = quint64(PeerReceive) << 32;
+    peerArmed = true;
+    ++inFlight;
+}
+
+// False once the multishot TUN read turns out unsupported, with the
+// reason in unsupported
+bool VpnTunnel::Queue::complete(const io_uring_cqe &completion, QString *unsupported)
+{
+    const int operation = int(completion.user_data >> 32);
+    const int index = int(completion.user_data & 0xffffffff);
+    const bool more = completion.flags & IORING_CQE_F_MORE;
+    if (!more && operation != Cancel)
+        --inFlight;
+
+    switch (operation) {
+    case TunRead:
+    case PeerReceive:
+        if (!more) {
+            if (operation == TunRead)
+                tunArmed = false;
+            else
+                peerArmed = false;
+        }
+        // TUN devices poll, so Linux 6.7 should take multishot reads on
+        // them; should it not, the first read says so
+        if (operation == TunRead && !tunReadProven && (completion.res == -EINVAL || completion.res == -EOPNOTSUPP)) {
+            *unsupported = QString("multishot TUN read: %1").arg(strerror(-completion.res));
+            return false;
+        }
+        if (operation == TunRead)
+            onTunRead(completion);
+        else
+            onPeerReceive(completion);
+        break;
+    case TunWrite:
+        if (completion.res < 0) {
+            dropped.add(1);
+        } else {
+            countDelivered(quint64(completion.res));
+        }
+        releaseRx(index);
+        break;
+    case Echo:
+        releaseRx(index);
+        break;
+    case PeerSend:
+        onSent(index, completion.res);
+        break;
+    default:
+        break;
+    }
+    return true;
+}
+
+void VpnTunnel::Queue::onTunRead(const io_uring_cqe &completion)
+{
+    if (completion.res < 0 && completion.res != -ENOBUFS && completion.res != -EAGAIN && completion.res != -EINTR)
+        failure = QString("TUN read: %1").arg(strerror(-completion.res));
+    if (!(completion.flags & IORING_CQE_F_BUFFER))
+        return;
+    const quint16 id = quint16(completion.flags >> IORING_CQE_BUFFER_SHIFT);
+    --tunPosted;
+    tunReads.add(1);
+    tunReadProven = true;
+    if (completion.res <= 0) {
+        IoUring::provideBuffer(&tunGroup, ringTx[id] + kHeaderSize, unsigned(mtu), id);
+        ++tunPosted;
+        return;
+    }
+    ringStaged[size_t(txStaged)] = id;
+    ringTxLengths[id] = completion.res + kOverhead;
+    stage(ringTx[id], completion.res);
+    if (txStaged == batchSize)
+        sealStaged();
+}
+
+void VpnTunnel::Queue::onPeerReceive(const io_uring_cqe &completion)
+{
+    if (completion.res < 0 && completion.res != -ENOBUFS && completion.res != -EAGAIN && completion.res != -EINTR)
+        failure = QString("UDP receive: %1").arg(strerror(-completion.res));
+    if (!(completion.flags & IORING_CQE_F_BUFFER))
+        return;
+    const int id = int(completion.flags >> IORING_CQE_BUFFER_SHIFT);
+    --peerPosted;
+    receiveCalls.add(1);
+    uchar *buffer = ringRx[size_t(id)];
+    const io_uring_recvmsg_out *out = reinterpret_cast<const io_uring_recvmsg_out *>(buffer);
+    rxReferences[size_t(id)] = 1;
+    if (completion.res <= 0) {
+        releaseRx(id);
+        return;
+    }
+    if (out->flags & MSG_TRUNC) {
+        dropped.add(1);
+        releaseRx(id);
+        return;
+    }
+
+    // The payload sits past the room asked for, however much was used
+    msghdr header;
+    memset(&header, 0, sizeof(header));
+    header.msg_control = buffer + sizeof(io_uring_recvmsg_out);
+    header.msg_controllen = out->controllen;
+    int segment = int(out->payloadlen);
+    for (cmsghdr *control = CMSG_FIRSTHDR(&header); control; control = CMSG_NXTHDR(&header, control)) {
+        if (control->cmsg_level == SOL_UDP && control->cmsg_type == UDP_GRO) {
+            memcpy(&segment, CMSG_DATA(control), sizeof(segment));
+            break;
+        }
+    }
+    uchar *payload = buffer + sizeof(io_uring_recvmsg_out) + kControlSize;
+    const int length = int(out->payloadlen);
+    if (segment <= 0)
+        segment = length;
+    rxCurrent = id;
+    for (int offset = 0; offset < length; offset += segment)
+        deliver(payload + offset, qMin(segment, length - offset));
+    rxCurrent = -1;
+    releaseRx(id);
+}
+
+void VpnTunnel::Queue::sealStaged()
+{
+    const int count = txStaged;
+    if (count == 0)
+        return;
+    if (!keyed.load(std::memory_order_relaxed)) {
+        dropStaged();
+        return;
+    }
+    ChaCha20Poly1305::sealBatch(txKey, txSeal.data(), count);
+    queueSends(ringStaged.data(), count);
+    countSealed(count);
+    txStaged = 0;
+    txStagedBytes = 0;
+}
+
+// As send(), one sendmsg request per GSO run
+void VpnTunnel::Queue::queueSends(const quint16 *buffers, int count)
+{
+    const bool segment = gso.load(std::memory_order_relaxed);
+    int i = 0;
+    while (i < count) {
+        const int slot = freeSlots.back();
+        freeSlots.pop_back();
+        SendSlot &message = sendSlots[size_t(slot)];
+        const int size = ringTxLengths[buffers[i]];
+        int segments = 0;
+        int total = 0;
+        do {
+            const quint16 id = buffers[i];
+            message.buffers[segments] = id;
+            message.iov[segments].iov_base = ringTx[id];
+            message.iov[segments].iov_len = size_t(ringTxLengths[id]);
+            total += ringTxLengths[id];
+            ++segments;
+            ++i;
+        } while (segment && i < count && segments < kMaxSegments && ringTxLengths[buffers[i - 1]] == size
+                 && ringTxLengths[buffers[i]] <= size && total + ringTxLengths[buffers[i]] <= kMaxGsoBytes);
+
+        memset(&message.header, 0, sizeof(message.header));
+        message.header.msg_iov = message.iov;
+        message.header.msg_iovlen = size_t(segments);
+        if (segments > 1) {
+            cmsghdr *control = reinterpret_cast<cmsghdr *>(message.control);
+            control->cmsg_level = SOL_UDP;
+            control->cmsg_type = UDP_SEGMENT;
+            control->cmsg_len = CMSG_LEN(sizeof(quint16));
+            const quint16 segmentSize = quint16(size);
+            memcpy(CMSG_DATA(control), &segmentSize, sizeof(segmentSize));
+            message.header.msg_control = control;
+            message.header.msg_controllen = CMSG_SPACE(sizeof(quint16));
+        }
+
+        io_uring_sqe *entry = takeSqe();
+        entry->opcode = IORING_OP_SENDMSG;
+        entry->fd = 1;
+        entry->flags = IOSQE_FIXED_FILE;
+        entry->addr = quint64(quintptr(&message.header));
+        entry->len = 1;
+        entry->user_data = quint64(PeerSend) << 32 | quint64(slot);
+        sendCalls.add(1);
+        ++inFlight;
+    }
+}
+
+// The buffers of a finished send go back to the TUN reads
+void VpnTunnel::Queue::onSent(int slot, int result)
+{
+    SendSlot &message = sendSlots[size_t(slot)];
+    const int segments = int(message.header.msg_iovlen);
+    freeSlots.push_back(slot);
+    if (result < 0 && segments > 1 && (result == -EIO || result == -EINVAL) && gso.load(std::memory_order_relaxed)) {
+        // As in send(): the route cannot segment, so resend them singly
+        gso.store(false);
+        quint16 buffers[kMaxSegments];
+        memcpy(buffers, message.buffers, sizeof(quint16) * size_t(segments));
+        queueSends(buffers, segments);
+        return;
+    }
+    if (result < 0)
+        dropped.add(quint64(segments));
+    for (int i = 0; i < segments; ++i) {
+        IoUring::provideBuffer(&tunGroup, ringTx[message.buffers[i]] + kHeaderSize, unsigned(mtu), message.buffers[i]);
+        ++tunPosted;
+    }
+}
+
+void VpnTunnel::Queue::queueTunWrite(int buffer, const uchar *data, size_t length)
+{
+    io_uring_sqe *entry = takeSqe();
+    entry->opcode = IORING_OP_WRITE_FIXED;
+    entry->fd = 0;
+    entry->flags = IOSQE_FIXED_FILE;
+    entry->addr = quint64(quintptr(data));
+    entry->len = unsigned(length);
+    entry->off = ~quint64(0);
+    entry->buf_index = quint16(buffer);
+    entry->user_data = quint64(TunWrite) << 32 | quint64(buffer);
+    ++inFlight;
+}
+
+// A receive buffer goes back to the kernel once nothing points into it
+void VpnTunnel::Queue::releaseRx(int buffer)
+{
+    if (--rxReferences[size_t(buffer)] > 0)
+        return;
+    IoUring::provideBuffer(&peerGroup, ringRx[size_t(buffer)], unsigned(ringRxSize), quint16(buffer));
+    ++peerPosted;
+}
+
+bool VpnTunnel::openTun(const QString &name, int queues, std::vector<int> *fds, QString *error)
+{
+    fds->clear();
+    const QByteArray interface = name.toLocal8Bit();
+    if (interface.isEmpty() || interface.size() >= IFNAMSIZ) {
+        *error = QString("%1 is not a valid interface name").arg(name);
+        return false;
+    }
+    for (int i = 0; i < queues; ++i) {
+        const int fd = ::open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        ifreq request;
+        memset(&request, 0, sizeof(request));
+        request.ifr_flags = IFF_TUN | IFF_NO_PI | (queues > 1 ? IFF_MULTI_QUEUE : 0);
+        memcpy(request.ifr_name, interface.constData(), size_t(interface.size()));
+        if (fd < 0 || ioctl(fd, TUNSETIFF, &request) < 0) {
+            *error = QString("Cannot open TUN queue %1 of %2: %3").arg(i).arg(name).arg(strerror(errno));
+            if (fd >= 0)
+                ::close(fd);
+            for (int opened : *fds)
+                ::close(opened);
+            fds->clear();
+            return false;
+        }
+        fds->push_back(fd);
+    }
+    return true;
+}
+
+bool VpnTunnel::configureInterface(const QString &name, const QString &address, int mtu, QString *error)
+{
+    const int slash = address.indexOf('/');
+    QHostAddress host;
+    bool ok = false;
+    const int prefix = slash > 0 ? address.mid(slash + 1).toInt(&ok) : 32;
+    if (!host.setAddress(slash > 0 ? address.left(slash) : address) || host.protocol() != QAbstractSocket::IPv4Protocol
+        || (slash > 0 && !ok) || prefix < 1 || prefix > 32) {
+        *error = QString("%1 is not an IPv4 address with prefix").arg(address);
+        return false;
+    }
+
+    const int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    ifreq request;
+    memset(&request, 0, sizeof(request));
+    const QByteArray interface = name.toLocal8Bit();
+    memcpy(request.ifr_name, interface.constData(), size_t(qMin<int>(interface.size(), IFNAMSIZ - 1)));
+    const char *step = "socket";
+    bool done = false;
+    if (fd >= 0) {
+        request.ifr_mtu = mtu;
+        step = "MTU";
+        if (ioctl(fd, SIOCSIFMTU, &request) == 0) {
+            sockaddr_in *inet = reinterpret_cast<sockaddr_in *>(&request.ifr_addr);
+            inet->sin_family = AF_INET;
+            inet->sin_addr.s_addr = htonl(host.toIPv4Address());
+            step = "address";
+            if (ioctl(fd, SIOCSIFADDR, &request) == 0) {
+                inet = reinterpret_cast<sockaddr_in *>(&request.ifr_netmask);
+                inet->sin_family = AF_INET;
+                inet->sin_addr.s_addr = htonl(prefix == 32 ? ~0u : ~(~0u >> prefix));
+                step = "netmask";
+                if (ioctl(fd, SIOCSIFNETMASK, &request) == 0) {
+                    step = "flags";
+                    if (ioctl(fd, SIOCGIFFLAGS, &request) == 0) {
+                        request.ifr_flags |= IFF_UP | IFF_RUNNING;
+                        done = ioctl(fd, SIOCSIFFLAGS, &request) == 0;
+                    }
+                }
+            }
+        }
+    }
+    if (!done)
+        *error = QString("Cannot set the %1 of %2: %3").arg(step).arg(name).arg(strerror(errno));
+    if (fd >= 0)
+        ::close(fd);
+    return done;
+}
+
+bool VpnTunnel::openTransport(const Options &options, int queues, std::vector<int> *fds, QString *error)
+{
+    fds->clear();
+    QHostAddress peer;
+    if (!peer.setAddress(options.peerAddress)) {
+        *error = QString("%1 is not a peer address").arg(options.peerAddress);
+        return false;
+    }
+    if (int(options.listenPort) + queues > 65536 || int(options.peerPort) + queues > 65536) {
+        *error = QString("Ports run past 65535 with %1 queues").arg(queues);
+        return false;
+    }
+
+    const bool v6 = peer.protocol() == QAbstractSocket::IPv6Protocol;
+    for (int i = 0; i < queues; ++i) {
+        sockaddr_storage local;
+        sockaddr_storage remote;
+        memset(&local, 0, sizeof(local));
+        memset(&remote, 0, sizeof(remote));
+        socklen_t length;
+        if (v6) {
+            sockaddr_in6 *address = reinterpret_cast<sockaddr_in6 *>(&local);
+            address->sin6_family = AF_INET6;
+            address->sin6_port = htons(quint16(options.listenPort + i));
+            address = reinterpret_cast<sockaddr_in6 *>(&remote);
+            address->sin6_family = AF_INET6;
+            address->sin6_port = htons(quint16(options.peerPort + i));
+            const Q_IPV6ADDR bytes = peer.toIPv6Address();
+            memcpy(&address->sin6_addr, bytes.c, 16);
+            length = sizeof(sockaddr_in6);
+        } else {
+            sockaddr_in *address = reinterpret_cast<sockaddr_in *>(&local);
+            address->sin_family = AF_INET;
+            address->sin_port = htons(quint16(options.listenPort + i));
+            address = reinterpret_cast<sockaddr_in *>(&remote);
+            address->sin_family = AF_INET;
+            address->sin_port = htons(quint16(options.peerPort + i));
+            address->sin_addr.s_addr = htonl(peer.toIPv4Address());
+            length = sizeof(sockaddr_in);
+        }
+
+        const int fd = socket(v6 ? AF_INET6 : AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd >= 0) {
+            enableOption(fd, SOL_SOCKET, SO_SNDBUF, kSocketBufferBytes);
+            enableOption(fd, SOL_SOCKET, SO_RCVBUF, kSocketBufferBytes);
+        }
+        if (fd < 0 || bind(fd, reinterpret_cast<sockaddr *>(&local), length) < 0
+            || ::connect(fd, reinterpret_cast<sockaddr *>(&remote), length) < 0) {
+            *error = QString("Cannot open UDP port %1: %2").arg(options.listenPort + i).arg(strerror(errno));
+            if (fd >= 0)
+                ::close(fd);
+            for (int opened : *fds)
+                ::close(opened);
+            fds->clear();
+            return false;
+        }
+        fds->push_back(fd);
+    }
+    return true;
+}
+
+#else
+
+class VpnTunnel::Queue
+{
+public:
+    void addTo(VpnStats *) const {}
+};
+
+bool VpnTunnel::openTun(const QString &, int, std::vector<int> *fds, QString *error)
+{
+    fds->clear();
+    *error = "The VPN data plane requires Linux TUN devices";
+    return false;
+}
+
+bool VpnTunnel::configureInterface(const QString &, const QString &, int, QString *error)
+{
+    *error = "The VPN data plane requires Linux TUN devices";
+    return false;
+}
+
+bool VpnTunnel::openTransport(const Options &, int, std::vector<int> *fds, QString *error)
+{
+    fds->clear();
+    *error = "The VPN data plane requires Linux TUN devices";
+    return false;
+}
+
+#endif
+
+QByteArray VpnTunnel::generateKey()
+{
+    QByteArray key(ChaCha20Poly1305::kKeySize, '\0');
+    QRandomGenerator::system()->fillRange(reinterpret_cast<quint32 *>(key.data()), ChaCha20Poly1305::kKeySize / 4);
+    return key;
+}
+
+VpnTunnel::VpnTunnel(QObject *parent)
+    : QThread(parent)
+{
+    qRegisterMetaType<VpnStats>();
+}
+
+VpnTunnel::~VpnTunnel()
+{
+    requestStop();
+    wait();
+#ifdef Q_OS_LINUX
+    for (int fd : adoptedTun)
+        ::close(fd);
+    for (int fd : adoptedUdp)
+        ::close(fd);
+#endif
+}
+
+void VpnTunnel::setOptions(const Options &options)
+{
+    Q_ASSERT(!isRunning());
+    settings = options;
+}
+
+void VpnTunnel::setMetricsBus(MetricsBus *bus)
+{
+    Q_ASSERT(!isRunning());
+    metricsBus = bus;
+}
+
+void VpnTunnel::adoptQueues(const std::vector<int> &tunFds, const std::vector<int> &udpFds)
+{
+    Q_ASSERT(!isRunning() && tunFds.size() == udpFds.size());
+    adoptedTun = tunFds;
+    adoptedUdp = udpFds;
+}
+
+void VpnTunnel::requestStop()
+{
+    stopRequested.store(true);
+}
+
+VpnStats VpnTunnel::stats() const
+{
+    QMutexLocker lock(&statsMutex);
+    return current;
+}
+
+void VpnTunnel::run()
+{
+#ifdef Q_OS_LINUX
+    stopRequested.store(false);
+    txBytesAtLastPublish = 0;
+    rxBytesAtLastPublish = 0;
+    lastPublishNs = 0;
+
+    std::vector<int> tunFds;
+    std::vector<int> udpFds;
+    tunFds.swap(adoptedTun);
+    udpFds.swap(adoptedUdp);
+    QString failure;
+    if (settings.key.size() != ChaCha20Poly1305::kKeySize) {
+        failure = QString("The tunnel key must be %1 bytes").arg(ChaCha20Poly1305::kKeySize);
+    } else if (!ChaCha20Poly1305::selfTest(&failure)) {
+        failure = QString("ChaCha20-Poly1305 self-test: %1").arg(failure);
+    } else if (tunFds.empty()) {
+        const int count = settings.queues > 0 ? settings.queues : qMax(1, QThread::idealThreadCount());
+        if (openTun(settings.interfaceName, count, &tunFds, &failure)
+            && (settings.address.isEmpty() || configureInterface(settings.interfaceName, settings.address, settings.mtu, &failure)))
+            openTransport(settings, count, &udpFds, &failure);
+    }
+    if (!failure.isEmpty() || tunFds.size() != udpFds.size()) {
+        for (int fd : tunFds)
+            ::close(fd);
+        for (int fd : udpFds)
+            ::close(fd);
+        emit error(failure.isEmpty() ? QString("Every TUN queue needs a UDP socket") : failure);
+        return;
+    }
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    for (size_t i = 0; i < tunFds.size(); ++i)
+        queues.push_back(std::make_unique<Queue>(tunFds[i], udpFds[i], settings, metricsBus));
+    {
+        QMutexLocker lock(&statsMutex);
+        current = VpnStats();
+        current.queues = int(queues.size());
+    }
+
+    std::vector<std::unique_ptr<QThread>> workers;
+    for (const std::unique_ptr<Queue> &queue : queues) {
+        Queue *worker = queue.get();
+        workers.emplace_back(QThread::create([worker, this]() { worker->run(stopRequested); }));
+        workers.back()->start(QThread::TimeCriticalPriority);
+    }
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    bool workersFailed = false;
+    while (!stopRequested.load() && !workersFailed) {
+        QThread::msleep(kPollMs);
+        for (const std::unique_ptr<QThread> &worker : workers)
+            workersFailed = workersFailed || worker->isFinished();
+        const qint64 elapsedNs = elapsed.nsecsElapsed();
+        if (elapsedNs - lastPublishNs >= kPublishIntervalNs)
+            publish(queues, elapsedNs, false);
+    }
+    stopRequested.store(true);
+    for (const std::unique_ptr<QThread> &worker : workers)
+        worker->wait();
+    for (const std::unique_ptr<Queue> &queue : queues) {
+        if (!queue->failure.isEmpty()) {
+            emit error(queue->failure);
+            break;
+        }
+    }
+    publish(queues, elapsed.nsecsElapsed(), true);
+#else
+    emit error("The VPN data plane requires Linux TUN devices");
+#endif
+}
+
+void VpnTunnel::publish(const std::vector<std::unique_ptr<Queue>> &queues, qint64 elapsedNs, bool final)
+{
+    VpnStats totals;
+    totals.queues = int(queues.size());
+    totals.crypto = ChaCha20Poly1305::implementationName(ChaCha20Poly1305::implementation());
+    for (const std::unique_ptr<Queue> &queue : queues)
+        queue->addTo(&totals);
+    totals.elapsedMs = elapsedNs / 1000000;
+
+    const qint64 intervalNs = final ? elapsedNs : elapsedNs - lastPublishNs;
+    const quint64 txBytes = final ? totals.txBytes : totals.txBytes - txBytesAtLastPublish;
+    const quint64 rxBytes = final ? totals.rxBytes : totals.rxBytes - rxBytesAtLastPublish;
+    totals.txGbps = intervalNs > 0 ? double(txBytes) * 8 / double(intervalNs) : 0;
+    totals.rxGbps = intervalNs > 0 ? double(rxBytes) * 8 / double(intervalNs) : 0;
+    txBytesAtLastPublish = totals.txBytes;
+    rxBytesAtLastPublish = totals.rxBytes;
+    lastPublishNs = elapsedNs;
+    {
+        QMutexLocker lock(&statsMutex);
+        current = totals;
+    }
+    emit statsUpdated(totals);
+}
@@ -0,0 +1,160 @@
+#ifndef VPNTUNNEL_H
+#define VPNTUNNEL_H
+
+#include <QByteArray>
+#include <QMetaType>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "chacha20poly1305.h"
+
+class MetricsBus;
+
+struct VpnStats
+{
+    quint64 txPackets = 0;        // Read from the TUN device and sent to the peer
+    quint64 txBytes = 0;          // Inner packet bytes
+    quint64 rxPackets = 0;        // Authenticated and written to the TUN device
+    quint64 rxBytes = 0;
+    quint64 tunReads = 0;         // Reads, writes, sends and receives, to judge batching:
+    quint64 tunWrites = 0;        // system calls on the poll loop, io_uring requests
+    quint64 sendCalls = 0;        // and completions on the ring
+    quint64 receiveCalls = 0;
+    quint64 syscalls = 0;         // Every system call of the queues, waits included
+    quint64 authFailures = 0;     // Malformed or failed the tag check
+    quint64 replays = 0;
+    quint64 dropped = 0;          // Socket or TUN queue full, or no session keys yet
+    quint64 handshakes = 0;       // Session keys derived, over all queues
+    int queues = 0;
+    int sessions = 0;             // Queues with session keys
+    QString crypto;               // AEAD code path, "AVX2" say
+    bool gso = false;             // UDP segmentation offload on send
+    bool gro = false;             // Coalesced receives
+    QString io;                   // "io_uring", or "poll" and why io_uring was passed over
+    double txGbps = 0;            // Inner traffic, last interval; the whole run once stopped
+    double rxGbps = 0;
+    qint64 elapsedMs = 0;
+};
+
+Q_DECLARE_METATYPE(VpnStats)
+
+// Userspace data plane of the VPN. Inner IP packets read from a TUN device
+// are sealed with ChaCha20-Poly1305 and carried over UDP to one peer;
+// datagrams from the peer are authenticated and written back to the TUN.
+//
+// The TUN is opened with IFF_MULTI_QUEUE and every queue gets a thread
+// and a UDP socket of its own (local port + i talks to peer port + i), so
+// the kernel spreads flows over cores and queues share no state. Queues
+// work in batches: up to batchSize TUN reads, then one sendmmsg in which
+// runs of equal-sized datagrams ride as single UDP GSO sends, and one
+// recvmmsg whose buffers the kernel may fill with GRO-coalesced runs.
+// Packet buffers come from per-queue pools allocated at start.
+//
+// Where the kernel allows, a queue instead runs on an io_uring (Linux
+// 6.7): a multishot read keeps the TUN feeding a ring of provided
+// buffers, a multishot recvmsg does the same for the socket, sends and
+// TUN writes are queued as requests, and one io_uring_enter per loop
+// submits them all and waits for what completed. The TUN and socket are
+// registered files and the receive buffers registered buffers, so the
+// kernel skips the descriptor lookups and page pinning per request.
+// Without io_uring, multishot reads, or permission to use them, a queue
+// keeps to the poll() loop.
+//
+// Both ends hold the same pre-shared key, but no packet is sealed with
+// it. Each queue picks a random 32-byte nonce per run and sends Hellos,
+// authenticated with HMAC-SHA256 under the pre-shared key, that carry
+// its nonce and echo the newest one heard from the peer. A Hello that
+// echoes our own nonce can only come from the peer's current run, so on
+// one the queue takes the peer's nonce and derives a key per direction,
+// HMAC(PSK, label, sender's nonce, receiver's nonce). Keys are therefore
+// fresh for every pair of runs, nonces a queue has moved on from are
+// refused, and until keys are agreed TUN packets are dropped.
+//
+// Each datagram is a 16-byte header (type, 3 reserved bytes, 32-bit
+// sender, 64-bit counter), the sealed packet and its tag. The header is
+// the associated data and sender:counter the nonce; the sender is the
+// start of the run's nonce, data from any other sender is refused, and a
+// 256-packet window, emptied only by new session keys, drops replays.
+// Each send batch is sealed, and each receive opened, in one AEAD call
+// that spreads its packets over the SIMD lanes. Probe headers from the
+// peer are echoed unauthenticated, so it can measure the round trip.
+class VpnTunnel : public QThread
+{
+    Q_OBJECT
+
+public:
+    struct Options
+    {
+        QString interfaceName = "rhynec0";
+        // IPv4 tunnel address and prefix; empty leaves the interface as is
+        QString address = "10.77.0.1/24";
+        int mtu = 1420;
+        quint16 listenPort = 51820;    // Queue i binds listenPort + i
+        QString peerAddress;
+        quint16 peerPort = 51820;
+        QByteArray key;                // kKeySize bytes
+        int queues = 0;                // 0 for one per core
+        int batchSize = 64;
+        bool ioUring = true;           // Where available; see above
+    };
+
+    static const int kHeaderSize = 16;
+    static const int kOverhead = kHeaderSize + ChaCha20Poly1305::kTagSize;
+    // A bare header of this type is a latency probe, echoed back with the
+    // reply type; see VpnProber
+    static const quint8 kProbeType = 2;
+    static const quint8 kProbeReplyType = 3;
+
+    static QByteArray generateKey();
+
+    // Building blocks of run(), public so the two ends of a test can be
+    // opened in different network namespaces: each acts in the namespace
+    // of the calling thread, and the descriptors stay there.
+    static bool openTun(const QString &name, int queues, std::vector<int> *fds, QString *error);
+    static bool configureInterface(const QString &name, const QString &address, int mtu, QString *error);
+    static bool openTransport(const Options &options, int queues, std::vector<int> *fds, QString *error);
+
+    explicit VpnTunnel(QObject *parent = nullptr);
+    ~VpnTunnel();
+
+    // Only while stopped
+    void setOptions(const Options &options);
+    Options options() const { return settings; }
+    // Only while stopped; each queue then also counts its packets there
+    void setMetricsBus(MetricsBus *bus);
+    // Runs the next start() on these descriptors, one TUN queue and one
+    // connected UDP socket per queue, instead of opening its own. The
+    // tunnel closes them when it stops.
+    void adoptQueues(const std::vector<int> &tunFds, const std::vector<int> &udpFds);
+
+    void requestStop();
+    VpnStats stats() const;
+
+signals:
+    void statsUpdated(const VpnStats &stats);
+    void error(const QString &message);
+
+protected:
+    void run() override;
+
+private:
+    class Queue;
+
+    void publish(const std::vector<std::unique_ptr<Queue>> &queues, qint64 elapsedNs, bool final);
+
+    Options settings;
+    MetricsBus *metricsBus = nullptr;
+    std::vector<int> adoptedTun;
+    std::vector<int> adoptedUdp;
+    std::atomic<bool> stopRequested { false };
+    mutable QMutex statsMutex;
+    VpnStats current;
+    quint64 txBytesAtLastPublish = 0;
+    quint64 rxBytesAtLastPublish = 0;
+    qint64 lastPublishNs = 0;
+};
+
+#endif // VPNTUNNEL_H